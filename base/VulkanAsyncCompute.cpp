@@ -0,0 +1,368 @@
+/*
+* Vulkan async compute helper
+*
+* Overlaps a compute simulation with graphics by keeping the simulation state in a ring of buffers:
+* Each simulation step reads the state of the previous step and writes the next one, while graphics draws a state that no running step accesses anymore
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanAsyncCompute.h"
+
+namespace vks
+{
+	/**
+	* Create the frame buffers, command buffers and synchronization primitives
+	*
+	* @param device Vulkan device to create the resources on
+	* @param graphicsQueue Queue used for drawing (and for compute if no dedicated compute queue family is available)
+	* @param size Size of the simulation state
+	* @param usage Usage flags of the frame buffers for graphics (e.g. VK_BUFFER_USAGE_VERTEX_BUFFER_BIT), the buffers are always created as storage buffers
+	* @param dstStageMask Pipeline stage in which graphics first accesses the frame buffers
+	* @param dstAccessMask Access type of graphics to the frame buffers
+	*/
+	void AsyncCompute::create(vks::VulkanDevice* device, VkQueue graphicsQueue, VkDeviceSize size, VkBufferUsageFlags usage, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+	{
+		this->logicalDevice = device->logicalDevice;
+		this->graphicsQueue = graphicsQueue;
+		this->dstStageMask = dstStageMask;
+		this->dstAccessMask = dstAccessMask;
+		graphicsQueueFamilyIndex = device->queueFamilyIndices.graphics;
+		queueFamilyIndex = device->queueFamilyIndices.compute;
+		dedicatedQueue = (queueFamilyIndex != graphicsQueueFamilyIndex);
+		if (dedicatedQueue) {
+			vkGetDeviceQueue(logicalDevice, queueFamilyIndex, 0, &queue);
+		} else {
+			// Single queue fallback: Compute and graphics are serialized on the graphics queue
+			queue = graphicsQueue;
+		}
+
+		commandPool = device->createCommandPool(queueFamilyIndex);
+		for (auto& frame : frames) {
+			VK_CHECK_RESULT(device->createBuffer(usage | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &frame.buffer, size));
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(logicalDevice, &cmdBufAllocateInfo, &frame.commandBuffer));
+		}
+		createSemaphores();
+		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo();
+		VK_CHECK_RESULT(vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fence));
+
+		// Timestamps of both queues are used to measure the overlap
+		const uint32_t graphicsTimestampBits = device->queueFamilyProperties[graphicsQueueFamilyIndex].timestampValidBits;
+		const uint32_t computeTimestampBits = device->queueFamilyProperties[queueFamilyIndex].timestampValidBits;
+		if (device->properties.limits.timestampComputeAndGraphics && (graphicsTimestampBits > 0) && (computeTimestampBits > 0)) {
+			timestampPeriod = device->properties.limits.timestampPeriod;
+			VkQueryPoolCreateInfo queryPoolInfo{};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			// Compute begin/end and graphics begin/end per frame
+			queryPoolInfo.queryCount = frameCount * 4;
+			VK_CHECK_RESULT(vkCreateQueryPool(logicalDevice, &queryPoolInfo, nullptr, &queryPool));
+		}
+	}
+
+	/**
+	* Release all Vulkan resources held by this object
+	*/
+	void AsyncCompute::destroy()
+	{
+		if (logicalDevice == VK_NULL_HANDLE) {
+			return;
+		}
+		vkQueueWaitIdle(queue);
+		for (auto& frame : frames) {
+			frame.buffer.destroy();
+		}
+		destroySemaphores();
+		vkDestroyFence(logicalDevice, fence, nullptr);
+		vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+		if (queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(logicalDevice, queryPool, nullptr);
+		}
+		logicalDevice = VK_NULL_HANDLE;
+	}
+
+	void AsyncCompute::createSemaphores()
+	{
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+		for (auto& frame : frames) {
+			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &frame.computeComplete));
+			VK_CHECK_RESULT(vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &frame.graphicsComplete));
+			frame.graphicsPending = false;
+		}
+	}
+
+	void AsyncCompute::destroySemaphores()
+	{
+		for (auto& frame : frames) {
+			vkDestroySemaphore(logicalDevice, frame.computeComplete, nullptr);
+			vkDestroySemaphore(logicalDevice, frame.graphicsComplete, nullptr);
+		}
+	}
+
+	/**
+	* (Re)start the frame sequence, needs to be called once after the compute command buffers have been recorded and after changing the async mode
+	*
+	* @note In async mode this submits one simulation step ahead of graphics
+	*/
+	void AsyncCompute::reset()
+	{
+		vkQueueWaitIdle(graphicsQueue);
+		vkQueueWaitIdle(queue);
+		// Waiting for idle queues leaves semaphores signaled that won't be waited on anymore, so simply recreate them
+		destroySemaphores();
+		createSemaphores();
+		statistics = Statistics();
+		statisticsFrame = -1;
+		// The frame sequence continues where it stopped, so the next step reads the latest state
+		if (async) {
+			beginFrame();
+			submitCompute();
+		}
+	}
+
+	/**
+	* @return Index of the frame whose buffer the step of the given frame reads
+	*/
+	uint32_t AsyncCompute::previousFrame(uint32_t frame)
+	{
+		return (frame + frameCount - 1) % frameCount;
+	}
+
+	/**
+	* Buffer with the latest simulation state, which is read by the next simulation step (e.g. to upload the initial state)
+	*
+	* @note Must only be written on the compute queue while no simulation step is pending
+	*/
+	vks::Buffer& AsyncCompute::stateBuffer()
+	{
+		return frames[computeFrame].buffer;
+	}
+
+	/**
+	* Begin recording the simulation step for the given frame, the step reads the buffer of previousFrame(frame) and writes the buffer of frame
+	*
+	* @note Adds a barrier making the simulation state written by the previous step (or uploaded to stateBuffer()) visible to this step
+	*/
+	void AsyncCompute::beginCommandBuffer(uint32_t frame)
+	{
+		VkCommandBuffer commandBuffer = frames[frame].commandBuffer;
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		if (queryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffer, queryPool, frame * 4, 2);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, frame * 4);
+		}
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0,
+			1, &memoryBarrier,
+			0, nullptr,
+			0, nullptr);
+	}
+
+	/**
+	* Finish recording the simulation step for the given frame: Releases the buffer read by the step to the graphics queue
+	*
+	* @param frame Index of the frame whose buffer the step writes to
+	*/
+	void AsyncCompute::endCommandBuffer(uint32_t frame)
+	{
+		VkCommandBuffer commandBuffer = frames[frame].commandBuffer;
+
+		if (dedicatedQueue) {
+			// The step has finished reading its input, so graphics can draw it while the next step runs (matched by the acquire in cmdBeginGraphics)
+			// Buffers written by a step don't need to be acquired back, as their previous contents are discarded
+			vks::Buffer& input = frames[previousFrame(frame)].buffer;
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = 0;
+			bufferBarrier.srcQueueFamilyIndex = queueFamilyIndex;
+			bufferBarrier.dstQueueFamilyIndex = graphicsQueueFamilyIndex;
+			bufferBarrier.buffer = input.buffer;
+			bufferBarrier.size = input.size;
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+		}
+
+		if (queryPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, frame * 4 + 1);
+		}
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+	}
+
+	/**
+	* Wait for the previous simulation step to finish, must be called before updating resources used by the simulation (e.g. uniform buffers)
+	*/
+	void AsyncCompute::beginFrame()
+	{
+		if (computeSubmitted) {
+			VK_CHECK_RESULT(vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX));
+			VK_CHECK_RESULT(vkResetFences(logicalDevice, 1, &fence));
+			computeSubmitted = false;
+		}
+		readTimestamps();
+	}
+
+	/**
+	* Submit the next simulation step to the compute queue
+	*
+	* @return Index of the frame buffer graphics draws in this frame
+	*/
+	uint32_t AsyncCompute::submitCompute()
+	{
+		computeFrame = (computeFrame + 1) % frameCount;
+		Frame& frame = frames[computeFrame];
+
+		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		// Don't overwrite the frame buffer until graphics has finished reading it
+		if (frame.graphicsPending) {
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &frame.graphicsComplete;
+			submitInfo.pWaitDstStageMask = &waitStageMask;
+			frame.graphicsPending = false;
+		}
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &frame.computeComplete;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.commandBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		computeSubmitted = true;
+
+		// Graphics draws the input of the last finished step: In async mode that's the step submitted with the previous frame, otherwise it's the step just submitted
+		graphicsFrame = async ? previousFrame(previousFrame(computeFrame)) : previousFrame(computeFrame);
+		return graphicsFrame;
+	}
+
+	/**
+	* Record the acquire of the current frame buffer by the graphics queue, must be recorded outside of a render pass before the buffer is accessed
+	*/
+	void AsyncCompute::cmdBeginGraphics(VkCommandBuffer commandBuffer)
+	{
+		if (dedicatedQueue) {
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = 0;
+			bufferBarrier.dstAccessMask = dstAccessMask;
+			bufferBarrier.srcQueueFamilyIndex = queueFamilyIndex;
+			bufferBarrier.dstQueueFamilyIndex = graphicsQueueFamilyIndex;
+			bufferBarrier.buffer = frames[graphicsFrame].buffer.buffer;
+			bufferBarrier.size = frames[graphicsFrame].buffer.size;
+			vkCmdPipelineBarrier(commandBuffer, dstStageMask, dstStageMask, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+		}
+		// Graphics timestamps are stored next to those of the simulation step running concurrently
+		if (queryPool != VK_NULL_HANDLE) {
+			vkCmdResetQueryPool(commandBuffer, queryPool, computeFrame * 4 + 2, 2);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, computeFrame * 4 + 2);
+		}
+	}
+
+	void AsyncCompute::cmdEndGraphics(VkCommandBuffer commandBuffer)
+	{
+		if (queryPool != VK_NULL_HANDLE) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, computeFrame * 4 + 3);
+		}
+	}
+
+	/**
+	* Submit graphics work to the graphics queue, adds the semaphores for synchronizing access to the current frame buffer with compute
+	*
+	* @param submitInfo Submit info for the graphics work (including e.g. the swap chain semaphores)
+	*/
+	void AsyncCompute::submitGraphics(VkSubmitInfo submitInfo)
+	{
+		Frame& frame = frames[graphicsFrame];
+		// The buffer has been released by the step of the following frame, which read it
+		Frame& releaseFrame = frames[(graphicsFrame + 1) % frameCount];
+		std::vector<VkSemaphore> waitSemaphores(submitInfo.pWaitSemaphores, submitInfo.pWaitSemaphores + submitInfo.waitSemaphoreCount);
+		std::vector<VkPipelineStageFlags> waitStageMasks(submitInfo.pWaitDstStageMask, submitInfo.pWaitDstStageMask + submitInfo.waitSemaphoreCount);
+		std::vector<VkSemaphore> signalSemaphores(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+		waitSemaphores.push_back(releaseFrame.computeComplete);
+		waitStageMasks.push_back(dstStageMask);
+		signalSemaphores.push_back(frame.graphicsComplete);
+		frame.graphicsPending = true;
+
+		submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStageMasks.data();
+		submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+		submitInfo.pSignalSemaphores = signalSemaphores.data();
+		VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE));
+		statisticsFrame = static_cast<int32_t>(computeFrame);
+	}
+
+	/**
+	* Accumulate the GPU times of the last frame into the statistics
+	*
+	* @note Compares timestamps written on different queues, which relies on the implementation using a common time base for all queues (true for all major desktop implementations)
+	*/
+	void AsyncCompute::readTimestamps()
+	{
+		if ((queryPool == VK_NULL_HANDLE) || (statisticsFrame < 0)) {
+			return;
+		}
+		uint64_t timestamps[4];
+		if (vkGetQueryPoolResults(logicalDevice, queryPool, statisticsFrame * 4, 4, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+			return;
+		}
+		statisticsFrame = -1;
+		const double toMs = timestampPeriod / 1000000.0;
+		const double computeBegin = (double)timestamps[0] * toMs;
+		const double computeEnd = (double)timestamps[1] * toMs;
+		const double graphicsBegin = (double)timestamps[2] * toMs;
+		const double graphicsEnd = (double)timestamps[3] * toMs;
+		statistics.computeTime += computeEnd - computeBegin;
+		statistics.graphicsTime += graphicsEnd - graphicsBegin;
+		statistics.overlap += std::max(0.0, std::min(computeEnd, graphicsEnd) - std::max(computeBegin, graphicsBegin));
+		statistics.samples++;
+	}
+
+	/**
+	* Add the async compute settings and statistics to the UI overlay
+	*
+	* @return True if the async mode has been changed
+	*/
+	bool AsyncCompute::updateUIOverlay(vks::UIOverlay* overlay)
+	{
+		bool changed = false;
+		if (overlay->header("Async compute")) {
+			if (overlay->checkBox("Overlap with graphics", &async)) {
+				reset();
+				changed = true;
+			}
+			overlay->text(dedicatedQueue ? "Dedicated compute queue" : "Shared graphics queue (no overlap)");
+			if (statistics.samples > 0) {
+				const double samples = (double)statistics.samples;
+				overlay->text("Compute: %.3f ms", statistics.computeTime / samples);
+				overlay->text("Graphics: %.3f ms", statistics.graphicsTime / samples);
+				overlay->text("Overlap: %.3f ms", statistics.overlap / samples);
+			}
+		}
+		return changed;
+	}
+
+	/**
+	* Print the averaged GPU times to stdout (e.g. at the end of a benchmark run)
+	*/
+	void AsyncCompute::printStatistics()
+	{
+		std::cout << "async compute : " << (async ? "on" : "off") << " (" << (dedicatedQueue ? "dedicated compute queue" : "shared graphics queue") << ")" << "\n";
+		if (statistics.samples == 0) {
+			std::cout << "no GPU timings available" << "\n";
+			return;
+		}
+		const double samples = (double)statistics.samples;
+		const double computeTime = statistics.computeTime / samples;
+		const double graphicsTime = statistics.graphicsTime / samples;
+		const double overlap = statistics.overlap / samples;
+		std::cout << "compute  : " << computeTime << " ms" << "\n";
+		std::cout << "graphics : " << graphicsTime << " ms" << "\n";
+		std::cout << "overlap  : " << overlap << " ms (" << ((computeTime + graphicsTime) > 0.0 ? overlap / (computeTime + graphicsTime) * 100.0 : 0.0) << "% of serialized GPU time)" << "\n";
+	}
+}
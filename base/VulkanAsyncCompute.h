@@ -0,0 +1,103 @@
+/*
+* Vulkan async compute helper
+*
+* Overlaps a compute simulation with graphics by keeping the simulation state in a ring of buffers:
+* Each simulation step reads the state of the previous step and writes the next one, while graphics draws a state that no running step accesses anymore
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanUIOverlay.h"
+
+namespace vks
+{
+	/**
+	* @brief Runs a compute simulation on a dedicated compute queue overlapped with graphics
+	* @note The simulation steps ping-pong between the frame buffers: The step of frame N reads the buffer of frame N - 1 and writes the buffer of frame N. Once it has read its input, it releases that buffer to the graphics queue (including queue family ownership transfers), so no copy of the results is required
+	* @note Graphics draws the buffer released by the last finished step, which is one step behind the latest state (two in async mode, where the step of the current frame is still running)
+	* @note If the device has no compute queue family separate from graphics, compute work is submitted to the graphics queue instead (no overlap)
+	*/
+	class AsyncCompute
+	{
+	private:
+		VkDevice logicalDevice = VK_NULL_HANDLE;
+		uint32_t graphicsQueueFamilyIndex = 0;
+		VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		VkAccessFlags dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		VkFence fence = VK_NULL_HANDLE;
+		bool computeSubmitted = false;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		uint32_t computeFrame = frameCount - 1;
+		int32_t statisticsFrame = -1;
+		void createSemaphores();
+		void destroySemaphores();
+		void readTimestamps();
+	public:
+		/** @brief One buffer written by the running step, one read by it and one drawn by graphics */
+		static const uint32_t frameCount = 3;
+
+		struct Frame {
+			/** @brief Simulation state written by this frame's step, read by the next step and then drawn by graphics */
+			vks::Buffer buffer;
+			/** @brief Simulation step reading the previous frame's buffer and writing into this frame's buffer, recorded by the application */
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			/** @brief Signaled once this frame's step has finished, which releases the previous frame's buffer to graphics */
+			VkSemaphore computeComplete = VK_NULL_HANDLE;
+			/** @brief Signaled once the graphics queue has finished reading the buffer */
+			VkSemaphore graphicsComplete = VK_NULL_HANDLE;
+			bool graphicsPending = false;
+		};
+
+		/** @brief GPU times accumulated since the last reset (in ms), requires timestamp support on both queues */
+		struct Statistics {
+			double computeTime = 0.0;
+			double graphicsTime = 0.0;
+			double overlap = 0.0;
+			uint32_t samples = 0;
+		} statistics;
+
+		std::array<Frame, frameCount> frames;
+		/** @brief Queue the simulation is submitted to (same as the graphics queue if there is no dedicated compute queue) */
+		VkQueue queue = VK_NULL_HANDLE;
+		VkQueue graphicsQueue = VK_NULL_HANDLE;
+		uint32_t queueFamilyIndex = 0;
+		/** @brief Command pool for the compute queue family, can also be used for uploads to the simulation buffers */
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		/** @brief True if compute and graphics use different queue families */
+		bool dedicatedQueue = false;
+		/** @brief If false, graphics waits on the simulation step of the same frame (serialized, e.g. for comparison) */
+		bool async = true;
+		/** @brief Index of the frame buffer to be drawn by graphics in the current frame */
+		uint32_t graphicsFrame = 0;
+
+		void create(vks::VulkanDevice* device, VkQueue graphicsQueue, VkDeviceSize size, VkBufferUsageFlags usage, VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VkAccessFlags dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+		void destroy();
+		void reset();
+		static uint32_t previousFrame(uint32_t frame);
+		vks::Buffer& stateBuffer();
+		void beginCommandBuffer(uint32_t frame);
+		void endCommandBuffer(uint32_t frame);
+		void beginFrame();
+		uint32_t submitCompute();
+		void cmdBeginGraphics(VkCommandBuffer commandBuffer);
+		void cmdEndGraphics(VkCommandBuffer commandBuffer);
+		void submitGraphics(VkSubmitInfo submitInfo);
+		bool updateUIOverlay(vks::UIOverlay* overlay);
+		void printStatistics();
+	};
+}
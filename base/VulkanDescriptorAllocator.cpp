@@ -0,0 +1,367 @@
+/*
+* Vulkan descriptor allocator
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanDescriptorAllocator.h"
+
+namespace vks
+{
+	namespace
+	{
+		// Non-dispatchable handles are pointers on 64 bit platforms and 64 bit integers otherwise
+		template <typename T>
+		uint64_t handleValue(T handle)
+		{
+			return (uint64_t)(handle);
+		}
+	}
+
+	size_t DescriptorAllocator::CacheKeyHash::operator()(const CacheKey& key) const
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (uint64_t value : key.data) {
+			hash = (hash ^ value) * 0x100000001b3ull;
+		}
+		return static_cast<size_t>(hash);
+	}
+
+	/**
+	* Create the allocator
+	*
+	* @param device Logical device to allocate from
+	* @param frameCount Number of frames with separate transient pools (usually the number of frames in flight)
+	*/
+	void DescriptorAllocator::create(VkDevice device, uint32_t frameCount)
+	{
+		this->device = device;
+		frames.resize(std::max(frameCount, 1u));
+		currentFrame = 0;
+	}
+
+	/** @brief Destroys all pools (which frees all sets) and all layouts created by the allocator */
+	void DescriptorAllocator::destroy()
+	{
+		if (device == VK_NULL_HANDLE) {
+			return;
+		}
+		auto destroyChains = [this](PoolChains& chains) {
+			for (auto& chain : chains) {
+				for (VkDescriptorPool pool : chain.second.pools) {
+					vkDestroyDescriptorPool(device, pool, nullptr);
+				}
+			}
+			chains.clear();
+		};
+		destroyChains(persistentChains);
+		for (Frame& frame : frames) {
+			destroyChains(frame.chains);
+			frame.cache.clear();
+		}
+		for (auto& layout : layouts) {
+			vkDestroyDescriptorSetLayout(device, layout.second, nullptr);
+		}
+		layouts.clear();
+		shapes.clear();
+		cache.clear();
+		statistics = Statistics();
+	}
+
+	/**
+	* Returns a descriptor set layout for the given bindings, identical binding lists share one layout
+	* The layout is owned by the allocator and destroyed with it
+	*
+	* @param bindings Layout bindings
+	* @param bindingFlags (Optional) Per-binding flags from descriptor indexing, either empty or one entry per binding
+	*/
+	VkDescriptorSetLayout DescriptorAllocator::createLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, const std::vector<VkDescriptorBindingFlags>& bindingFlags)
+	{
+		assert(bindingFlags.empty() || (bindingFlags.size() == bindings.size()));
+		std::vector<uint32_t> key;
+		for (size_t i = 0; i < bindings.size(); i++) {
+			const VkDescriptorSetLayoutBinding& binding = bindings[i];
+			// Immutable samplers can't be compared by value
+			assert(binding.pImmutableSamplers == nullptr);
+			key.insert(key.end(), { binding.binding, static_cast<uint32_t>(binding.descriptorType), binding.descriptorCount, binding.stageFlags, bindingFlags.empty() ? 0 : bindingFlags[i] });
+		}
+		auto it = layouts.find(key);
+		if (it != layouts.end()) {
+			return it->second;
+		}
+
+		VkDescriptorSetLayoutCreateInfo descriptorLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(bindings);
+		VkDescriptorSetLayoutBindingFlagsCreateInfo setLayoutBindingFlags{};
+		if (!bindingFlags.empty()) {
+			setLayoutBindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+			setLayoutBindingFlags.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+			setLayoutBindingFlags.pBindingFlags = bindingFlags.data();
+			descriptorLayoutCI.pNext = &setLayoutBindingFlags;
+			for (VkDescriptorBindingFlags flags : bindingFlags) {
+				if (flags & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT) {
+					descriptorLayoutCI.flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+				}
+			}
+		}
+		VkDescriptorSetLayout layout;
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayoutCI, nullptr, &layout));
+		layouts[key] = layout;
+		registerLayout(layout, bindings, bindingFlags);
+		return layout;
+	}
+
+	/**
+	* Registers a layout that has been created outside of the allocator
+	*
+	* @param layout Layout to register, must stay valid as long as sets are allocated for it
+	* @param bindings Bindings the layout has been created with
+	* @param bindingFlags (Optional) Binding flags the layout has been created with
+	*/
+	void DescriptorAllocator::registerLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, const std::vector<VkDescriptorBindingFlags>& bindingFlags)
+	{
+		std::map<VkDescriptorType, uint32_t> counts;
+		Shape shape;
+		for (size_t i = 0; i < bindings.size(); i++) {
+			const VkDescriptorSetLayoutBinding& binding = bindings[i];
+			if (!bindingFlags.empty() && (bindingFlags[i] & VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT)) {
+				shape.poolFlags |= VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+			}
+			// The size of the variable binding is only known at allocation time
+			if (!bindingFlags.empty() && (bindingFlags[i] & VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT)) {
+				shape.variableCount = true;
+				shape.variableType = binding.descriptorType;
+				continue;
+			}
+			counts[binding.descriptorType] += binding.descriptorCount;
+		}
+		for (auto& count : counts) {
+			shape.poolSizes.push_back({ count.first, count.second });
+		}
+		shapes[layout] = shape;
+	}
+
+	std::vector<uint32_t> DescriptorAllocator::shapeKey(const Shape& shape)
+	{
+		std::vector<uint32_t> key;
+		for (const VkDescriptorPoolSize& poolSize : shape.poolSizes) {
+			key.push_back(static_cast<uint32_t>(poolSize.type));
+			key.push_back(poolSize.descriptorCount);
+		}
+		key.push_back(shape.variableCount ? static_cast<uint32_t>(shape.variableType) : UINT32_MAX);
+		key.push_back(shape.poolFlags);
+		return key;
+	}
+
+	const DescriptorAllocator::Shape& DescriptorAllocator::getShape(VkDescriptorSetLayout layout) const
+	{
+		auto it = shapes.find(layout);
+		if (it == shapes.end()) {
+			vks::tools::exitFatal("Descriptor set layout has not been registered with the descriptor allocator", -1);
+		}
+		return it->second;
+	}
+
+	VkDescriptorPool DescriptorAllocator::createPool(const Shape& shape, uint32_t setCount, uint32_t variableDescriptorCount)
+	{
+		std::vector<VkDescriptorPoolSize> poolSizes;
+		for (const VkDescriptorPoolSize& poolSize : shape.poolSizes) {
+			poolSizes.push_back({ poolSize.type, poolSize.descriptorCount * setCount });
+		}
+		// Pools for variable sized sets are only guaranteed to fit the set they have been created for
+		if (shape.variableCount && (variableDescriptorCount > 0)) {
+			poolSizes.push_back({ shape.variableType, variableDescriptorCount });
+		}
+		// Pools need at least one pool size, even for layouts without bindings
+		if (poolSizes.empty()) {
+			poolSizes.push_back({ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 });
+		}
+		for (const VkDescriptorPoolSize& poolSize : poolSizes) {
+			statistics.descriptorCounts[poolSize.type] += poolSize.descriptorCount;
+		}
+		VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(poolSizes, setCount);
+		descriptorPoolCI.flags = shape.poolFlags;
+		VkDescriptorPool pool;
+		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolCI, nullptr, &pool));
+		return pool;
+	}
+
+	VkDescriptorSet DescriptorAllocator::allocateFromChain(PoolChain& chain, VkDescriptorSetLayout layout, const Shape& shape, uint32_t variableDescriptorCount, bool transient)
+	{
+		VkDescriptorSetVariableDescriptorCountAllocateInfo variableDescriptorCountAllocInfo{};
+		variableDescriptorCountAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+		variableDescriptorCountAllocInfo.descriptorSetCount = 1;
+		variableDescriptorCountAllocInfo.pDescriptorCounts = &variableDescriptorCount;
+
+		while (true) {
+			bool newPool = false;
+			if (chain.current >= chain.pools.size()) {
+				if (chain.nextSetCount == 0) {
+					chain.nextSetCount = setsPerPool;
+				} else {
+					statistics.poolGrowths++;
+				}
+				chain.pools.push_back(createPool(shape, chain.nextSetCount, variableDescriptorCount));
+				chain.nextSetCount = std::min(chain.nextSetCount * 2, std::max(maxSetsPerPool, setsPerPool));
+				newPool = true;
+			}
+			VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(chain.pools[chain.current], &layout, 1);
+			if (shape.variableCount) {
+				allocInfo.pNext = &variableDescriptorCountAllocInfo;
+			}
+			VkDescriptorSet descriptorSet;
+			VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+			if (result == VK_SUCCESS) {
+				chain.allocatedSets++;
+				if (transient) {
+					statistics.transientSets++;
+					statistics.peakTransientSets = std::max(statistics.peakTransientSets, statistics.transientSets);
+				} else {
+					statistics.persistentSets++;
+				}
+				return descriptorSet;
+			}
+			if (((result != VK_ERROR_OUT_OF_POOL_MEMORY) && (result != VK_ERROR_FRAGMENTED_POOL)) || newPool) {
+				// A pool that has just been created for this shape must be able to hold the set
+				VK_CHECK_RESULT(result);
+			}
+			// The current pool is exhausted, continue with the next one in the chain
+			chain.current++;
+		}
+	}
+
+	/**
+	* Allocate a descriptor set that stays valid until the allocator is destroyed
+	*
+	* @param layout Registered descriptor set layout
+	* @param variableDescriptorCount (Optional) Size of the variable sized binding, if the layout has one
+	*/
+	VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout, uint32_t variableDescriptorCount)
+	{
+		const Shape& shape = getShape(layout);
+		return allocateFromChain(persistentChains[shapeKey(shape)], layout, shape, variableDescriptorCount, false);
+	}
+
+	/**
+	* Allocate a descriptor set for the current frame, the set is released when beginFrame() is called for the same frame index again
+	*
+	* @param layout Registered descriptor set layout
+	* @param variableDescriptorCount (Optional) Size of the variable sized binding, if the layout has one
+	*/
+	VkDescriptorSet DescriptorAllocator::allocateTransient(VkDescriptorSetLayout layout, uint32_t variableDescriptorCount)
+	{
+		assert(!frames.empty());
+		const Shape& shape = getShape(layout);
+		return allocateFromChain(frames[currentFrame].chains[shapeKey(shape)], layout, shape, variableDescriptorCount, true);
+	}
+
+	/**
+	* Returns a set with the given descriptors, sets with identical layout and contents are only allocated and written once
+	*
+	* @param layout Registered descriptor set layout
+	* @param writes Descriptor writes for the set, dstSet is ignored
+	* @param transient If true the set is taken from (and cached for) the current frame only, otherwise it's persistent
+	*
+	* @note Writes with descriptor types that can't be compared by value (e.g. inline uniform blocks) always allocate a new set
+	*/
+	VkDescriptorSet DescriptorAllocator::getCached(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes, bool transient)
+	{
+		CacheKey key;
+		key.data.push_back(handleValue(layout));
+		bool cacheable = true;
+		for (const VkWriteDescriptorSet& write : writes) {
+			key.data.push_back((static_cast<uint64_t>(write.dstBinding) << 32) | write.dstArrayElement);
+			key.data.push_back((static_cast<uint64_t>(write.descriptorType) << 32) | write.descriptorCount);
+			for (uint32_t i = 0; i < write.descriptorCount; i++) {
+				switch (write.descriptorType) {
+				case VK_DESCRIPTOR_TYPE_SAMPLER:
+				case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+				case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+				case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+				case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
+					key.data.push_back(handleValue(write.pImageInfo[i].sampler));
+					key.data.push_back(handleValue(write.pImageInfo[i].imageView));
+					key.data.push_back(static_cast<uint64_t>(write.pImageInfo[i].imageLayout));
+					break;
+				case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+				case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+				case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+				case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+					key.data.push_back(handleValue(write.pBufferInfo[i].buffer));
+					key.data.push_back(write.pBufferInfo[i].offset);
+					key.data.push_back(write.pBufferInfo[i].range);
+					break;
+				case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+				case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+					key.data.push_back(handleValue(write.pTexelBufferView[i]));
+					break;
+				default:
+					cacheable = false;
+					break;
+				}
+			}
+		}
+
+		auto& setCache = transient ? frames[currentFrame].cache : cache;
+		if (cacheable) {
+			auto it = setCache.find(key);
+			if (it != setCache.end()) {
+				statistics.cacheHits++;
+				return it->second;
+			}
+		}
+		statistics.cacheMisses++;
+
+		VkDescriptorSet descriptorSet = transient ? allocateTransient(layout) : allocate(layout);
+		std::vector<VkWriteDescriptorSet> setWrites = writes;
+		for (VkWriteDescriptorSet& write : setWrites) {
+			write.dstSet = descriptorSet;
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+		if (cacheable) {
+			setCache[key] = descriptorSet;
+		}
+		return descriptorSet;
+	}
+
+	/**
+	* Start allocating transient sets for the given frame, releases all sets allocated for it before
+	* Resetting is done per pool and doesn't depend on the number of sets allocated
+	*
+	* @note The device must no longer use any of the frame's sets (e.g. the frame's fence has been waited on)
+	*/
+	void DescriptorAllocator::beginFrame(uint32_t frameIndex)
+	{
+		assert(frameIndex < frames.size());
+		currentFrame = frameIndex;
+		Frame& frame = frames[frameIndex];
+		for (auto& chain : frame.chains) {
+			// Only pools sets have been allocated from need to be reset
+			const size_t usedPools = std::min(static_cast<size_t>(chain.second.current) + 1, chain.second.pools.size());
+			for (size_t i = 0; i < usedPools; i++) {
+				VK_CHECK_RESULT(vkResetDescriptorPool(device, chain.second.pools[i], 0));
+			}
+			chain.second.current = 0;
+			chain.second.allocatedSets = 0;
+		}
+		frame.cache.clear();
+		statistics.transientSets = 0;
+	}
+
+	DescriptorAllocator::Statistics DescriptorAllocator::getStatistics() const
+	{
+		Statistics result = statistics;
+		result.persistentPools = 0;
+		result.transientPools = 0;
+		for (auto& chain : persistentChains) {
+			result.persistentPools += static_cast<uint32_t>(chain.second.pools.size());
+		}
+		for (const Frame& frame : frames) {
+			for (auto& chain : frame.chains) {
+				result.transientPools += static_cast<uint32_t>(chain.second.pools.size());
+			}
+		}
+		return result;
+	}
+}
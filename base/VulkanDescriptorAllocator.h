@@ -0,0 +1,119 @@
+/*
+* Vulkan descriptor allocator
+*
+* Allocates descriptor sets from chains of pools that are sized for the layout they serve and grow on demand, so pool sizes no longer need to be counted up front
+* Supports persistent sets, transient sets that are released all at once when a frame is reused, and sets cached by their descriptor contents
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+
+namespace vks
+{
+	/**
+	* @brief Descriptor set allocator with growable pool chains
+	* @note Layouts either need to be created with createLayout() or be registered with registerLayout(), so the allocator knows how many descriptors of which type a set needs (its "shape")
+	* @note Layouts with the same shape share their pools
+	* @note Not thread safe, use one allocator per thread when recording on multiple threads
+	*/
+	class DescriptorAllocator
+	{
+	public:
+		/** @brief Pool usage since creation, useful for tuning setsPerPool */
+		struct Statistics
+		{
+			uint32_t persistentPools = 0;
+			uint32_t transientPools = 0;
+			uint32_t persistentSets = 0;
+			/** @brief Transient sets allocated for the frame that was started last */
+			uint32_t transientSets = 0;
+			/** @brief Max. number of transient sets allocated for a single frame */
+			uint32_t peakTransientSets = 0;
+			/** @brief Number of times a chain ran out of pool memory and had to allocate a new pool */
+			uint32_t poolGrowths = 0;
+			uint32_t cacheHits = 0;
+			uint32_t cacheMisses = 0;
+			/** @brief Descriptors of each type in all pools (capacity, not usage) */
+			std::map<VkDescriptorType, uint32_t> descriptorCounts;
+		};
+
+		/** @brief Number of sets the first pool of a chain is created for, each following pool of the chain doubles this up to maxSetsPerPool */
+		uint32_t setsPerPool = 16;
+		uint32_t maxSetsPerPool = 1024;
+
+		void create(VkDevice device, uint32_t frameCount = 1);
+		void destroy();
+		VkDescriptorSetLayout createLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings, const std::vector<VkDescriptorBindingFlags>& bindingFlags = {});
+		void registerLayout(VkDescriptorSetLayout layout, const std::vector<VkDescriptorSetLayoutBinding>& bindings, const std::vector<VkDescriptorBindingFlags>& bindingFlags = {});
+		VkDescriptorSet allocate(VkDescriptorSetLayout layout, uint32_t variableDescriptorCount = 0);
+		VkDescriptorSet allocateTransient(VkDescriptorSetLayout layout, uint32_t variableDescriptorCount = 0);
+		VkDescriptorSet getCached(VkDescriptorSetLayout layout, const std::vector<VkWriteDescriptorSet>& writes, bool transient = false);
+		void beginFrame(uint32_t frameIndex);
+		Statistics getStatistics() const;
+	private:
+		/** @brief Descriptor counts of a single set, the variable sized binding (if any) is not included */
+		struct Shape
+		{
+			std::vector<VkDescriptorPoolSize> poolSizes;
+			bool variableCount = false;
+			VkDescriptorType variableType = VK_DESCRIPTOR_TYPE_MAX_ENUM;
+			/** @brief Layouts with update after bind bindings can only allocate from pools created with VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT */
+			VkDescriptorPoolCreateFlags poolFlags = 0;
+		};
+
+		/** @brief Pools for one shape, pools before current are (assumed to be) full */
+		struct PoolChain
+		{
+			std::vector<VkDescriptorPool> pools;
+			uint32_t current = 0;
+			uint32_t nextSetCount = 0;
+			uint32_t allocatedSets = 0;
+		};
+
+		/** @brief Serialized layout and descriptor contents */
+		struct CacheKey
+		{
+			std::vector<uint64_t> data;
+			bool operator==(const CacheKey& other) const { return data == other.data; }
+		};
+
+		struct CacheKeyHash
+		{
+			size_t operator()(const CacheKey& key) const;
+		};
+
+		typedef std::map<std::vector<uint32_t>, PoolChain> PoolChains;
+
+		struct Frame
+		{
+			PoolChains chains;
+			std::unordered_map<CacheKey, VkDescriptorSet, CacheKeyHash> cache;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		std::map<VkDescriptorSetLayout, Shape> shapes;
+		// Layouts created by the allocator, keyed by their serialized bindings
+		std::map<std::vector<uint32_t>, VkDescriptorSetLayout> layouts;
+		PoolChains persistentChains;
+		std::vector<Frame> frames;
+		uint32_t currentFrame = 0;
+		std::unordered_map<CacheKey, VkDescriptorSet, CacheKeyHash> cache;
+		Statistics statistics;
+
+		static std::vector<uint32_t> shapeKey(const Shape& shape);
+		VkDescriptorPool createPool(const Shape& shape, uint32_t setCount, uint32_t variableDescriptorCount);
+		VkDescriptorSet allocateFromChain(PoolChain& chain, VkDescriptorSetLayout layout, const Shape& shape, uint32_t variableDescriptorCount, bool transient);
+		const Shape& getShape(VkDescriptorSetLayout layout) const;
+	};
+}
@@ -28,6 +28,13 @@ namespace vks
 		VkFormat format;
 		VkImageSubresourceRange subresourceRange;
 		VkAttachmentDescription description;
+		/** @brief Size and type of the memory the image is bound to */
+		VkDeviceSize memorySize = 0;
+		uint32_t memoryTypeIndex = 0;
+		/** @brief False if the image is bound to the memory of another attachment (aliasing) */
+		bool ownsMemory = true;
+		/** @brief True if the attachment is backed by lazily allocated memory, which may never be committed on tile based GPUs */
+		bool lazilyAllocated = false;
 
 		/**
 		* @brief Returns true if the attachment has a depth component
@@ -81,6 +88,31 @@ namespace vks
 		VkFormat format;
 		VkImageUsageFlags usage;
 		VkSampleCountFlagBits imageSampleCount = VK_SAMPLE_COUNT_1_BIT;
+		/**
+		* @brief Attachment is only used within the render pass (never sampled, copied or stored)
+		* @note Adds VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT and uses lazily allocated memory if the implementation offers it
+		*/
+		bool transient = false;
+		/**
+		* @brief Bind the image to the memory of an existing attachment (of any framebuffer) instead of allocating new memory
+		* @note Only valid if the two attachments are never in use at the same time, contents of both are undefined after the other one has been written
+		* @note Falls back to a dedicated allocation if the memory is too small or of an incompatible type
+		*/
+		const vks::FramebufferAttachment* aliasAttachment = nullptr;
+	};
+
+	/**
+	* @brief Device memory used by the attachments of a framebuffer
+	*/
+	struct FramebufferMemoryStatistics
+	{
+		/** @brief Bytes allocated for attachments owning their memory (excluding lazily allocated memory) */
+		VkDeviceSize allocated = 0;
+		/** @brief Bytes of lazily allocated memory, and how much of it has actually been committed by the implementation */
+		VkDeviceSize lazilyAllocated = 0;
+		VkDeviceSize lazilyCommitted = 0;
+		/** @brief Bytes that would have been allocated for attachments that alias the memory of another attachment */
+		VkDeviceSize aliased = 0;
 	};
 
 	/**
@@ -118,7 +150,10 @@ namespace vks
 			{
 				vkDestroyImage(vulkanDevice->logicalDevice, attachment.image, nullptr);
 				vkDestroyImageView(vulkanDevice->logicalDevice, attachment.view, nullptr);
-				vkFreeMemory(vulkanDevice->logicalDevice, attachment.memory, nullptr);
+				if (attachment.ownsMemory)
+				{
+					vkFreeMemory(vulkanDevice->logicalDevice, attachment.memory, nullptr);
+				}
 			}
 			vkDestroySampler(vulkanDevice->logicalDevice, sampler, nullptr);
 			vkDestroyRenderPass(vulkanDevice->logicalDevice, renderPass, nullptr);
@@ -174,6 +209,12 @@ namespace vks
 			image.samples = createinfo.imageSampleCount;
 			image.tiling = VK_IMAGE_TILING_OPTIMAL;
 			image.usage = createinfo.usage;
+			if (createinfo.transient)
+			{
+				// Transient attachments may only be combined with other attachment usages
+				assert((createinfo.usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT)) == 0);
+				image.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+			}
 
 			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 			VkMemoryRequirements memReqs;
@@ -181,9 +222,34 @@ namespace vks
 			// Create image for this attachment
 			VK_CHECK_RESULT(vkCreateImage(vulkanDevice->logicalDevice, &image, nullptr, &attachment.image));
 			vkGetImageMemoryRequirements(vulkanDevice->logicalDevice, attachment.image, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
-			memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-			VK_CHECK_RESULT(vkAllocateMemory(vulkanDevice->logicalDevice, &memAlloc, nullptr, &attachment.memory));
+			attachment.memorySize = memReqs.size;
+
+			const vks::FramebufferAttachment* alias = createinfo.aliasAttachment;
+			if (alias && alias->memorySize >= memReqs.size && (memReqs.memoryTypeBits & (1 << alias->memoryTypeIndex)))
+			{
+				// Share the memory of an attachment whose lifetime doesn't overlap with this one
+				attachment.memory = alias->memory;
+				attachment.memoryTypeIndex = alias->memoryTypeIndex;
+				attachment.lazilyAllocated = alias->lazilyAllocated;
+				attachment.ownsMemory = false;
+			}
+			else
+			{
+				VkBool32 lazyMemoryTypeFound = VK_FALSE;
+				if (createinfo.transient)
+				{
+					// Tile based GPUs may keep lazily allocated attachments in on-chip memory and never back them with actual device memory
+					attachment.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &lazyMemoryTypeFound);
+				}
+				if (!lazyMemoryTypeFound)
+				{
+					attachment.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+				}
+				attachment.lazilyAllocated = (lazyMemoryTypeFound == VK_TRUE);
+				memAlloc.allocationSize = memReqs.size;
+				memAlloc.memoryTypeIndex = attachment.memoryTypeIndex;
+				VK_CHECK_RESULT(vkAllocateMemory(vulkanDevice->logicalDevice, &memAlloc, nullptr, &attachment.memory));
+			}
 			VK_CHECK_RESULT(vkBindImageMemory(vulkanDevice->logicalDevice, attachment.image, attachment.memory, 0));
 
 			attachment.subresourceRange = {};
@@ -225,6 +291,35 @@ namespace vks
 			return static_cast<uint32_t>(attachments.size() - 1);
 		}
 
+		/**
+		* Returns the device memory used by all attachments of this framebuffer
+		*
+		* @return Allocated, lazily allocated (and committed) and aliased memory in bytes
+		*/
+		vks::FramebufferMemoryStatistics getMemoryStatistics()
+		{
+			vks::FramebufferMemoryStatistics statistics;
+			for (auto& attachment : attachments)
+			{
+				if (!attachment.ownsMemory)
+				{
+					statistics.aliased += attachment.memorySize;
+				}
+				else if (attachment.lazilyAllocated)
+				{
+					VkDeviceSize committed = 0;
+					vkGetDeviceMemoryCommitment(vulkanDevice->logicalDevice, attachment.memory, &committed);
+					statistics.lazilyAllocated += attachment.memorySize;
+					statistics.lazilyCommitted += committed;
+				}
+				else
+				{
+					statistics.allocated += attachment.memorySize;
+				}
+			}
+			return statistics;
+		}
+
 		/**
 		* Creates a default sampler for sampling from any of the framebuffer attachments
 		* Applications are free to create their own samplers for different use cases 
@@ -0,0 +1,204 @@
+/*
+* Vulkan instanced glyph batch
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanGlyphBatch.h"
+
+namespace vks
+{
+	/**
+	* Create the persistently mapped instance buffer
+	*
+	* @param device Device used to create the buffer
+	* @param frameCount Number of frames that may be in flight (one instance region per frame)
+	* @param maxGlyphs Maximum number of glyphs per frame, glyphs exceeding this count are dropped
+	*/
+	void GlyphBatch::create(vks::VulkanDevice* device, uint32_t frameCount, uint32_t maxGlyphs)
+	{
+		this->device = device;
+		this->frameCount = frameCount;
+		this->maxGlyphs = maxGlyphs;
+		const VkDeviceSize size = getInstanceOffset(frameCount);
+		VK_CHECK_RESULT(device->createBuffer(
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&buffer,
+			size));
+		VK_CHECK_RESULT(buffer.map());
+		memset(buffer.mapped, 0, size);
+		// Draw commands for all frames are stored at the start of the buffer, each drawing a four vertex strip per glyph
+		VkDrawIndirectCommand* commands = static_cast<VkDrawIndirectCommand*>(buffer.mapped);
+		for (uint32_t i = 0; i < frameCount; i++) {
+			commands[i].vertexCount = 4;
+		}
+		mapped = reinterpret_cast<Instance*>(static_cast<uint8_t*>(buffer.mapped) + getInstanceOffset(0));
+	}
+
+	void GlyphBatch::destroy()
+	{
+		buffer.destroy();
+		layouts.clear();
+		mapped = nullptr;
+	}
+
+	VkDeviceSize GlyphBatch::getInstanceOffset(uint32_t frame) const
+	{
+		return frameCount * sizeof(VkDrawIndirectCommand) + (VkDeviceSize)frame * maxGlyphs * sizeof(Instance);
+	}
+
+	/**
+	* Start adding text for the given frame
+	*
+	* @note The application must make sure that the GPU no longer reads the instances of this frame (e.g. by waiting on the frame's fence)
+	*/
+	void GlyphBatch::begin(uint32_t frame)
+	{
+		assert(frame < frameCount);
+		currentFrame = frame;
+		// Evict layouts that weren't used in the previous frame once the cache grows too large
+		// This is done once per frame, so a frame with more live strings than the limit doesn't rescan the cache on every miss
+		if (layouts.size() > maxCachedLayouts) {
+			for (auto layout = layouts.begin(); layout != layouts.end();) {
+				if (layout->second.lastUsed != frameIndex) {
+					layout = layouts.erase(layout);
+				} else {
+					++layout;
+				}
+			}
+		}
+		frameIndex++;
+		current = Statistics();
+	}
+
+	/** @brief Returns the cached layout of a string (in font units, starting at the origin), the layout is created on first use */
+	const GlyphBatch::Layout& GlyphBatch::getLayout(const std::string& text)
+	{
+		auto it = layouts.find(text);
+		if (it != layouts.end()) {
+			current.cacheHits++;
+			it->second.lastUsed = frameIndex;
+			return it->second;
+		}
+		current.cacheMisses++;
+		Layout& layout = layouts[text];
+		layout.lastUsed = frameIndex;
+		layout.instances.reserve(text.size());
+		float x = 0.0f;
+		for (const char c : text) {
+			const Glyph& glyph = glyphs[static_cast<uint8_t>(c)];
+			// Skip glyphs without area (e.g. spaces)
+			if ((glyph.rect.x != glyph.rect.z) && (glyph.rect.y != glyph.rect.w)) {
+				Instance instance;
+				instance.rect = glyph.rect + glm::vec4(x, 0.0f, x, 0.0f);
+				instance.uv = glyph.uv;
+				layout.instances.push_back(instance);
+			}
+			x += glyph.advance;
+		}
+		layout.width = x;
+		return layout;
+	}
+
+	/**
+	* Add a string to the current frame
+	*
+	* @param text String to add
+	* @param x Horizontal position of the pen in target units
+	* @param y Vertical position of the pen in target units
+	* @param scale Scale from font units to target units
+	* @param align Horizontal alignment of the string relative to the pen position
+	*/
+	void GlyphBatch::addText(const std::string& text, float x, float y, glm::vec2 scale, TextAlign align)
+	{
+		assert(mapped);
+		const Layout& layout = getLayout(text);
+		current.texts++;
+		switch (align) {
+		case alignRight:
+			x -= layout.width * scale.x;
+			break;
+		case alignCenter:
+			x -= layout.width * scale.x / 2.0f;
+			break;
+		case alignLeft:
+			break;
+		}
+		const glm::vec4 offset(x, y, x, y);
+		const glm::vec4 size(scale, scale);
+		uint32_t count = static_cast<uint32_t>(layout.instances.size());
+		if (current.glyphs + count > maxGlyphs) {
+			current.droppedGlyphs += current.glyphs + count - maxGlyphs;
+			count = maxGlyphs - current.glyphs;
+		}
+		Instance* dst = mapped + (size_t)currentFrame * maxGlyphs + current.glyphs;
+		for (uint32_t i = 0; i < count; i++) {
+			dst[i].rect = offset + layout.instances[i].rect * size;
+			dst[i].uv = layout.instances[i].uv;
+		}
+		current.glyphs += count;
+	}
+
+	/** @brief Finish the current frame by updating the instance count of it's draw command */
+	void GlyphBatch::end()
+	{
+		VkDrawIndirectCommand* commands = static_cast<VkDrawIndirectCommand*>(buffer.mapped);
+		commands[currentFrame].instanceCount = current.glyphs;
+		commands[currentFrame].firstInstance = 0;
+		statistics = current;
+	}
+
+	/**
+	* Record the draw for all glyphs of a frame
+	*
+	* @note The instance count is read from the buffer at execution time, so the command buffer doesn't need to be recorded again if the text changes
+	*/
+	void GlyphBatch::draw(VkCommandBuffer commandBuffer, uint32_t frame)
+	{
+		const VkDeviceSize offset = getInstanceOffset(frame);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &buffer.buffer, &offset);
+		vkCmdDrawIndirect(commandBuffer, buffer.buffer, frame * sizeof(VkDrawIndirectCommand), 1, sizeof(VkDrawIndirectCommand));
+	}
+
+	/** @brief Returns the width of a string in font units */
+	float GlyphBatch::getTextWidth(const std::string& text)
+	{
+		return getLayout(text).width;
+	}
+
+	uint32_t GlyphBatch::getCachedLayoutCount() const
+	{
+		return static_cast<uint32_t>(layouts.size());
+	}
+
+	uint32_t GlyphBatch::getFrameCount() const
+	{
+		return frameCount;
+	}
+
+	/**
+	* Returns the vertex input state for pipelines drawing glyph batches
+	*
+	* @note Pipelines need to use a triangle strip topology, the vertex shader generates the quad corners from the vertex index (location 0 = rect, location 1 = uv)
+	*/
+	VkPipelineVertexInputStateCreateInfo* GlyphBatch::getPipelineVertexInputState()
+	{
+		static VkVertexInputBindingDescription bindingDescription;
+		static std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions;
+		static VkPipelineVertexInputStateCreateInfo inputState;
+		bindingDescription = vks::initializers::vertexInputBindingDescription(0, sizeof(Instance), VK_VERTEX_INPUT_RATE_INSTANCE);
+		attributeDescriptions = {
+			vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, rect)),
+			vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(Instance, uv)),
+		};
+		inputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+		inputState.vertexBindingDescriptionCount = 1;
+		inputState.pVertexBindingDescriptions = &bindingDescription;
+		inputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+		inputState.pVertexAttributeDescriptions = attributeDescriptions.data();
+		return &inputState;
+	}
+}
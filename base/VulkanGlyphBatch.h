@@ -0,0 +1,106 @@
+/*
+* Vulkan instanced glyph batch
+*
+* Renders text as one instance per glyph with a single (indirect) draw per frame
+* Glyph instances are written to a persistently mapped buffer with one region per frame, so text can change every frame without re-recording command buffers
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vks
+{
+	/** @brief Font metrics of a single glyph in font units */
+	struct Glyph
+	{
+		/** @brief Quad relative to the pen position (x0, y0, x1, y1) */
+		glm::vec4 rect = glm::vec4(0.0f);
+		/** @brief Texture coordinates of the quad (u0, v0, u1, v1) */
+		glm::vec4 uv = glm::vec4(0.0f);
+		float advance = 0.0f;
+	};
+
+	/**
+	* @brief Batches glyphs of all text added during a frame into a single instanced draw
+	* @note Each glyph instance contains the corners of the quad and it's texture coordinates, the vertex shader expands these to a triangle strip with four vertices (see getPipelineVertexInputState)
+	* @note The layouts of strings are cached, so unchanged text is only copied (and moved to it's position) instead of being laid out again
+	*/
+	class GlyphBatch
+	{
+	public:
+		enum TextAlign { alignLeft, alignCenter, alignRight };
+
+		/** @brief Per instance data read by the vertex shader */
+		struct Instance
+		{
+			glm::vec4 rect;
+			glm::vec4 uv;
+		};
+
+		/** @brief Counters of the last completed frame */
+		struct Statistics
+		{
+			uint32_t glyphs = 0;
+			uint32_t texts = 0;
+			uint32_t cacheHits = 0;
+			uint32_t cacheMisses = 0;
+			uint32_t droppedGlyphs = 0;
+		} statistics;
+
+		/** @brief Glyph metrics indexed by character, to be filled by the application */
+		std::array<Glyph, 256> glyphs;
+
+		/** @brief Number of cached string layouts above which layouts not used in the previous frame are evicted when the next frame begins */
+		uint32_t maxCachedLayouts = 4096;
+
+		void create(vks::VulkanDevice* device, uint32_t frameCount, uint32_t maxGlyphs);
+		void destroy();
+		void begin(uint32_t frame);
+		void addText(const std::string& text, float x, float y, glm::vec2 scale = glm::vec2(1.0f), TextAlign align = alignLeft);
+		void end();
+		void draw(VkCommandBuffer commandBuffer, uint32_t frame);
+		float getTextWidth(const std::string& text);
+		uint32_t getCachedLayoutCount() const;
+		uint32_t getFrameCount() const;
+		static VkPipelineVertexInputStateCreateInfo* getPipelineVertexInputState();
+	private:
+		struct Layout
+		{
+			std::vector<Instance> instances;
+			float width = 0.0f;
+			uint64_t lastUsed = 0;
+		};
+
+		vks::VulkanDevice* device = nullptr;
+		/** @brief Indirect draw commands of all frames followed by the glyph instances of all frames */
+		vks::Buffer buffer;
+		uint32_t frameCount = 0;
+		uint32_t maxGlyphs = 0;
+		uint32_t currentFrame = 0;
+		uint64_t frameIndex = 0;
+		Instance* mapped = nullptr;
+		Statistics current;
+		std::unordered_map<std::string, Layout> layouts;
+
+		const Layout& getLayout(const std::string& text);
+		VkDeviceSize getInstanceOffset(uint32_t frame) const;
+	};
+}
@@ -0,0 +1,770 @@
+/*
+* Vulkan image based lighting baker
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanIBLBaker.h"
+
+#include <sstream>
+#include <iomanip>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#endif
+
+namespace vks
+{
+	namespace
+	{
+		// Increase if the baking itself changes in a way that invalidates existing cache files
+		const uint32_t cacheVersion = 1;
+
+		const uint64_t fnvOffsetBasis = 0xcbf29ce484222325ull;
+		const uint64_t fnvPrime = 0x100000001b3ull;
+
+		uint64_t hashCombine(uint64_t hash, uint64_t value)
+		{
+			for (uint32_t i = 0; i < 8; i++) {
+				hash ^= (value >> (i * 8)) & 0xff;
+				hash *= fnvPrime;
+			}
+			return hash;
+		}
+
+		// Hashes the content of a file (FNV-1a on 64 bit words), returns false if the file can't be read
+		bool hashFile(const std::string& filename, uint64_t& hash)
+		{
+			std::ifstream file(filename, std::ios::binary);
+			if (!file.is_open()) {
+				return false;
+			}
+			hash = fnvOffsetBasis;
+			std::vector<uint64_t> chunk(8192);
+			while (file) {
+				file.read(reinterpret_cast<char*>(chunk.data()), chunk.size() * sizeof(uint64_t));
+				const size_t bytes = static_cast<size_t>(file.gcount());
+				// Zero the partial last word
+				if (bytes % sizeof(uint64_t) != 0) {
+					memset(reinterpret_cast<char*>(chunk.data()) + bytes, 0, sizeof(uint64_t) - bytes % sizeof(uint64_t));
+				}
+				const size_t words = (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+				for (size_t i = 0; i < words; i++) {
+					hash = (hash ^ chunk[i]) * fnvPrime;
+				}
+				hash = hashCombine(hash, bytes);
+			}
+			return true;
+		}
+
+		void createDirectory(const std::string& path)
+		{
+#if defined(_WIN32)
+			_mkdir(path.c_str());
+#else
+			mkdir(path.c_str(), 0755);
+#endif
+		}
+
+		// Size of a single texel and the matching OpenGL enums required for the KTX header
+		struct FormatInfo
+		{
+			uint32_t texelSize;
+			uint32_t glType;
+			uint32_t glTypeSize;
+			uint32_t glFormat;
+			uint32_t glInternalFormat;
+		};
+
+		FormatInfo getFormatInfo(VkFormat format)
+		{
+			switch (format) {
+			case VK_FORMAT_R16G16_SFLOAT:
+				return { 4, 0x140B /* GL_HALF_FLOAT */, 2, 0x8227 /* GL_RG */, 0x822F /* GL_RG16F */ };
+			case VK_FORMAT_R16G16B16A16_SFLOAT:
+				return { 8, 0x140B /* GL_HALF_FLOAT */, 2, 0x1908 /* GL_RGBA */, 0x881A /* GL_RGBA16F */ };
+			case VK_FORMAT_R32G32B32A32_SFLOAT:
+				return { 16, 0x1406 /* GL_FLOAT */, 4, 0x1908 /* GL_RGBA */, 0x8814 /* GL_RGBA32F */ };
+			default:
+				assert(!"Unsupported IBL target format");
+				return { 0, 0, 0, 0, 0 };
+			}
+		}
+
+		// View matrices for rendering the cube faces
+		std::array<glm::mat4, 6> getCubeFaceMatrices()
+		{
+			return {
+				// POSITIVE_X
+				glm::rotate(glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+				// NEGATIVE_X
+				glm::rotate(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+				// POSITIVE_Y
+				glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+				// NEGATIVE_Y
+				glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+				// POSITIVE_Z
+				glm::rotate(glm::mat4(1.0f), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
+				// NEGATIVE_Z
+				glm::rotate(glm::mat4(1.0f), glm::radians(180.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
+			};
+		}
+	}
+
+	/**
+	* @param device Device used to create the textures
+	* @param queue Graphics queue the baking commands are submitted to
+	* @param pipelineCache Pipeline cache used for the baking pipelines
+	* @param cube Unit cube model used for rendering the cube faces
+	*/
+	IBLBaker::IBLBaker(vks::VulkanDevice* device, VkQueue queue, VkPipelineCache pipelineCache, vkglTF::Model* cube)
+	{
+		this->device = device;
+		this->queue = queue;
+		this->pipelineCache = pipelineCache;
+		this->cube = cube;
+	}
+
+	IBLBaker::~IBLBaker()
+	{
+		destroyFilters();
+	}
+
+	/** @brief Add a BRDF integration map (look-up-table storing roughness / NdotV) */
+	void IBLBaker::addBRDFLUT(vks::Texture2D* lutBrdf)
+	{
+		Target target;
+		target.type = targetBRDFLUT;
+		target.texture = lutBrdf;
+		// R16G16 is supported pretty much everywhere
+		target.format = VK_FORMAT_R16G16_SFLOAT;
+		target.dim = settings.brdfLutSize;
+		targets.push_back(target);
+	}
+
+	/**
+	* Add the irradiance and pre-filtered cube maps for an environment cube map
+	*
+	* @param filename File the environment cube map was loaded from (its content is used as the cache key)
+	* @param environmentCube Environment cube map to filter
+	* @param irradianceCube Target for the irradiance cube map (may be null)
+	* @param prefilteredCube Target for the pre-filtered cube map (may be null)
+	*/
+	void IBLBaker::addEnvironment(const std::string& filename, vks::TextureCubeMap* environmentCube, vks::TextureCubeMap* irradianceCube, vks::TextureCubeMap* prefilteredCube)
+	{
+		Target target;
+		target.environmentCube = environmentCube;
+		target.environmentFile = filename;
+		target.faceCount = 6;
+		if (irradianceCube) {
+			target.type = targetIrradiance;
+			target.texture = irradianceCube;
+			target.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			target.dim = settings.irradianceSize;
+			target.mipLevels = static_cast<uint32_t>(floor(log2(target.dim))) + 1;
+			targets.push_back(target);
+		}
+		if (prefilteredCube) {
+			target.type = targetPrefiltered;
+			target.texture = prefilteredCube;
+			target.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+			target.dim = settings.prefilteredSize;
+			target.mipLevels = static_cast<uint32_t>(floor(log2(target.dim))) + 1;
+			targets.push_back(target);
+		}
+	}
+
+	uint64_t IBLBaker::getCacheKey(const Target& target, uint64_t contentHash) const
+	{
+		uint64_t key = hashCombine(fnvOffsetBasis, cacheVersion);
+		key = hashCombine(key, contentHash);
+		key = hashCombine(key, target.type);
+		key = hashCombine(key, target.format);
+		key = hashCombine(key, target.dim);
+		key = hashCombine(key, target.mipLevels);
+		switch (target.type) {
+		case targetBRDFLUT:
+			key = hashCombine(key, settings.brdfLutSamples);
+			break;
+		case targetIrradiance:
+			uint32_t deltas[2];
+			memcpy(&deltas[0], &settings.irradianceDeltaPhi, sizeof(float));
+			memcpy(&deltas[1], &settings.irradianceDeltaTheta, sizeof(float));
+			key = hashCombine(key, deltas[0]);
+			key = hashCombine(key, deltas[1]);
+			break;
+		case targetPrefiltered:
+			key = hashCombine(key, settings.prefilteredSamples);
+			break;
+		}
+		return key;
+	}
+
+	/** @brief Loads the cached texture data of a target, returns false if there is no (matching) cache file */
+	bool IBLBaker::loadFromCache(Target& target)
+	{
+		if (!vks::tools::fileExists(target.cacheFile)) {
+			return false;
+		}
+		if (ktxTexture_CreateFromNamedFile(target.cacheFile.c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &target.cached) != KTX_SUCCESS) {
+			target.cached = nullptr;
+			return false;
+		}
+		if ((target.cached->baseWidth != target.dim) || (target.cached->baseHeight != target.dim) || (target.cached->numLevels != target.mipLevels) || (target.cached->numFaces != target.faceCount)) {
+			std::cerr << "IBL cache file \"" << target.cacheFile << "\" does not match the bake settings and will be replaced\n";
+			ktxTexture_Destroy(target.cached);
+			target.cached = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	/** @brief Writes the data read back from a baked target to a KTX (version 1) file */
+	bool IBLBaker::writeToCache(const Target& target)
+	{
+		std::ofstream file(target.cacheFile, std::ios::binary);
+		if (!file.is_open()) {
+			std::cerr << "Could not write IBL cache file \"" << target.cacheFile << "\"\n";
+			return false;
+		}
+		const FormatInfo formatInfo = getFormatInfo(target.format);
+		const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+		const uint32_t header[13] = {
+			0x04030201,							// endianness
+			formatInfo.glType,
+			formatInfo.glTypeSize,
+			formatInfo.glFormat,
+			formatInfo.glInternalFormat,
+			formatInfo.glFormat,				// glBaseInternalFormat
+			target.dim,							// pixelWidth
+			target.dim,							// pixelHeight
+			0,									// pixelDepth
+			0,									// numberOfArrayElements
+			target.faceCount,					// numberOfFaces
+			target.mipLevels,					// numberOfMipmapLevels
+			0,									// bytesOfKeyValueData
+		};
+		file.write(reinterpret_cast<const char*>(identifier), sizeof(identifier));
+		file.write(reinterpret_cast<const char*>(header), sizeof(header));
+		// The read back buffer contains all faces of a mip level in order, which matches the KTX layout (texel sizes are multiples of four, so no padding is required)
+		const uint8_t* data = static_cast<const uint8_t*>(target.staging.mapped);
+		for (uint32_t level = 0; level < target.mipLevels; level++) {
+			const uint32_t dim = std::max(target.dim >> level, 1u);
+			const uint32_t faceSize = dim * dim * formatInfo.texelSize;
+			file.write(reinterpret_cast<const char*>(&faceSize), sizeof(faceSize));
+			file.write(reinterpret_cast<const char*>(data), (std::streamsize)faceSize * target.faceCount);
+			data += (size_t)faceSize * target.faceCount;
+		}
+		return file.good();
+	}
+
+	/** @brief Creates the image, view and sampler of a target texture */
+	void IBLBaker::prepareTarget(Target& target)
+	{
+		VkDevice logicalDevice = device->logicalDevice;
+		vks::Texture* texture = target.texture;
+		const bool isCube = (target.faceCount == 6);
+
+		// Image
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = target.format;
+		imageCI.extent.width = target.dim;
+		imageCI.extent.height = target.dim;
+		imageCI.extent.depth = 1;
+		imageCI.mipLevels = target.mipLevels;
+		imageCI.arrayLayers = target.faceCount;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		// Cube maps are filled by copying from the offscreen framebuffer, the look-up-table is rendered to directly
+		imageCI.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		if (!isCube) {
+			imageCI.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		}
+		imageCI.flags = isCube ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+		VK_CHECK_RESULT(vkCreateImage(logicalDevice, &imageCI, nullptr, &texture->image));
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(logicalDevice, texture->image, &memReqs);
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &texture->deviceMemory));
+		VK_CHECK_RESULT(vkBindImageMemory(logicalDevice, texture->image, texture->deviceMemory, 0));
+		// Image view
+		VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+		viewCI.viewType = isCube ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_2D;
+		viewCI.format = target.format;
+		viewCI.subresourceRange = {};
+		viewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewCI.subresourceRange.levelCount = target.mipLevels;
+		viewCI.subresourceRange.layerCount = target.faceCount;
+		viewCI.image = texture->image;
+		VK_CHECK_RESULT(vkCreateImageView(logicalDevice, &viewCI, nullptr, &texture->view));
+		// Sampler
+		VkSamplerCreateInfo samplerCI = vks::initializers::samplerCreateInfo();
+		samplerCI.magFilter = VK_FILTER_LINEAR;
+		samplerCI.minFilter = VK_FILTER_LINEAR;
+		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.minLod = 0.0f;
+		samplerCI.maxLod = static_cast<float>(target.mipLevels);
+		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(logicalDevice, &samplerCI, nullptr, &texture->sampler));
+
+		texture->device = device;
+		texture->width = target.dim;
+		texture->height = target.dim;
+		texture->mipLevels = target.mipLevels;
+		texture->layerCount = target.faceCount;
+		texture->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		texture->updateDescriptor();
+	}
+
+	/** @brief Creates the render pass, pipeline and (for cube maps) offscreen framebuffer used to bake all targets of the given type */
+	void IBLBaker::prepareFilter(TargetType type, VkFormat format, uint32_t dim)
+	{
+		VkDevice logicalDevice = device->logicalDevice;
+		Filter& filter = filters[type];
+		if (filter.pipeline != VK_NULL_HANDLE) {
+			return;
+		}
+
+		// Render pass
+		VkAttachmentDescription attDesc = {};
+		attDesc.format = format;
+		attDesc.samples = VK_SAMPLE_COUNT_1_BIT;
+		attDesc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attDesc.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpassDescription = {};
+		subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpassDescription.colorAttachmentCount = 1;
+		subpassDescription.pColorAttachments = &colorReference;
+
+		// Use subpass dependencies for layout transitions
+		std::array<VkSubpassDependency, 2> dependencies;
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+		VkRenderPassCreateInfo renderPassCI = vks::initializers::renderPassCreateInfo();
+		renderPassCI.attachmentCount = 1;
+		renderPassCI.pAttachments = &attDesc;
+		renderPassCI.subpassCount = 1;
+		renderPassCI.pSubpasses = &subpassDescription;
+		renderPassCI.dependencyCount = 2;
+		renderPassCI.pDependencies = dependencies.data();
+		VK_CHECK_RESULT(vkCreateRenderPass(logicalDevice, &renderPassCI, nullptr, &filter.renderPass));
+
+		// Offscreen framebuffer the cube faces are rendered to before being copied to the target
+		if (type != targetBRDFLUT) {
+			VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+			imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageCreateInfo.format = format;
+			imageCreateInfo.extent.width = dim;
+			imageCreateInfo.extent.height = dim;
+			imageCreateInfo.extent.depth = 1;
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			VK_CHECK_RESULT(vkCreateImage(logicalDevice, &imageCreateInfo, nullptr, &filter.image));
+
+			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+			VkMemoryRequirements memReqs;
+			vkGetImageMemoryRequirements(logicalDevice, filter.image, &memReqs);
+			memAlloc.allocationSize = memReqs.size;
+			memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &filter.memory));
+			VK_CHECK_RESULT(vkBindImageMemory(logicalDevice, filter.image, filter.memory, 0));
+
+			VkImageViewCreateInfo colorImageView = vks::initializers::imageViewCreateInfo();
+			colorImageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			colorImageView.format = format;
+			colorImageView.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+			colorImageView.image = filter.image;
+			VK_CHECK_RESULT(vkCreateImageView(logicalDevice, &colorImageView, nullptr, &filter.view));
+
+			VkFramebufferCreateInfo fbufCreateInfo = vks::initializers::framebufferCreateInfo();
+			fbufCreateInfo.renderPass = filter.renderPass;
+			fbufCreateInfo.attachmentCount = 1;
+			fbufCreateInfo.pAttachments = &filter.view;
+			fbufCreateInfo.width = dim;
+			fbufCreateInfo.height = dim;
+			fbufCreateInfo.layers = 1;
+			VK_CHECK_RESULT(vkCreateFramebuffer(logicalDevice, &fbufCreateInfo, nullptr, &filter.framebuffer));
+		}
+
+		// Pipeline layout
+		VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(nullptr, 0);
+		// Cube filters sample the environment map and pass the face matrix and filter parameters as push constants (see filtercube.vert)
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(glm::mat4) + 2 * sizeof(uint32_t), 0);
+		if (type != targetBRDFLUT) {
+			pipelineLayoutCI.setLayoutCount = 1;
+			pipelineLayoutCI.pSetLayouts = &descriptorSetLayout;
+			pipelineLayoutCI.pushConstantRangeCount = 1;
+			pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+		}
+		VK_CHECK_RESULT(vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCI, nullptr, &filter.pipelineLayout));
+
+		// Pipeline
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+		VkPipelineRasterizationStateCreateInfo rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+		VkPipelineColorBlendAttachmentState blendAttachmentState = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+		VkPipelineColorBlendStateCreateInfo colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
+		VkPipelineDepthStencilStateCreateInfo depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_FALSE, VK_FALSE, VK_COMPARE_OP_LESS_OR_EQUAL);
+		VkPipelineViewportStateCreateInfo viewportState = vks::initializers::pipelineViewportStateCreateInfo(1, 1);
+		VkPipelineMultisampleStateCreateInfo multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT);
+		std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
+		VkPipelineVertexInputStateCreateInfo emptyInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
+
+		VkGraphicsPipelineCreateInfo pipelineCI = vks::initializers::pipelineCreateInfo(filter.pipelineLayout, filter.renderPass);
+		pipelineCI.pInputAssemblyState = &inputAssemblyState;
+		pipelineCI.pRasterizationState = &rasterizationState;
+		pipelineCI.pColorBlendState = &colorBlendState;
+		pipelineCI.pMultisampleState = &multisampleState;
+		pipelineCI.pViewportState = &viewportState;
+		pipelineCI.pDepthStencilState = &depthStencilState;
+		pipelineCI.pDynamicState = &dynamicState;
+		pipelineCI.stageCount = 2;
+		pipelineCI.pStages = shaderStages.data();
+
+		// The sample count of the look-up-table is passed as a specialization constant
+		VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t));
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(uint32_t), &settings.brdfLutSamples);
+
+		switch (type) {
+		case targetBRDFLUT:
+			pipelineCI.pVertexInputState = &emptyInputState;
+			shaderStages[0] = shaders.brdfLutVert;
+			shaderStages[1] = shaders.brdfLutFrag;
+			shaderStages[1].pSpecializationInfo = &specializationInfo;
+			break;
+		case targetIrradiance:
+			pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::UV });
+			shaderStages[0] = shaders.filterCubeVert;
+			shaderStages[1] = shaders.irradianceFrag;
+			break;
+		case targetPrefiltered:
+			pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::UV });
+			shaderStages[0] = shaders.filterCubeVert;
+			shaderStages[1] = shaders.prefilterFrag;
+			break;
+		}
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineCI, nullptr, &filter.pipeline));
+	}
+
+	void IBLBaker::destroyFilters()
+	{
+		VkDevice logicalDevice = device->logicalDevice;
+		for (Filter& filter : filters) {
+			if (filter.pipeline == VK_NULL_HANDLE) {
+				continue;
+			}
+			vkDestroyPipeline(logicalDevice, filter.pipeline, nullptr);
+			vkDestroyPipelineLayout(logicalDevice, filter.pipelineLayout, nullptr);
+			vkDestroyRenderPass(logicalDevice, filter.renderPass, nullptr);
+			if (filter.framebuffer != VK_NULL_HANDLE) {
+				vkDestroyFramebuffer(logicalDevice, filter.framebuffer, nullptr);
+				vkDestroyImageView(logicalDevice, filter.view, nullptr);
+				vkDestroyImage(logicalDevice, filter.image, nullptr);
+				vkFreeMemory(logicalDevice, filter.memory, nullptr);
+			}
+			filter = Filter();
+		}
+		if (descriptorPool != VK_NULL_HANDLE) {
+			vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+			descriptorPool = VK_NULL_HANDLE;
+		}
+		if (descriptorSetLayout != VK_NULL_HANDLE) {
+			vkDestroyDescriptorSetLayout(logicalDevice, descriptorSetLayout, nullptr);
+			descriptorSetLayout = VK_NULL_HANDLE;
+		}
+	}
+
+	/** @brief Records the copy of the cached texture data to the target */
+	void IBLBaker::upload(VkCommandBuffer commandBuffer, Target& target)
+	{
+		ktx_uint8_t* data = ktxTexture_GetData(target.cached);
+		ktx_size_t size = ktxTexture_GetSize(target.cached);
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &target.staging, size, data));
+
+		std::vector<VkBufferImageCopy> bufferCopyRegions;
+		for (uint32_t face = 0; face < target.faceCount; face++) {
+			for (uint32_t level = 0; level < target.mipLevels; level++) {
+				ktx_size_t offset;
+				KTX_error_code result = ktxTexture_GetImageOffset(target.cached, level, 0, face, &offset);
+				assert(result == KTX_SUCCESS);
+				VkBufferImageCopy bufferCopyRegion = {};
+				bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				bufferCopyRegion.imageSubresource.mipLevel = level;
+				bufferCopyRegion.imageSubresource.baseArrayLayer = face;
+				bufferCopyRegion.imageSubresource.layerCount = 1;
+				bufferCopyRegion.imageExtent.width = std::max(target.dim >> level, 1u);
+				bufferCopyRegion.imageExtent.height = std::max(target.dim >> level, 1u);
+				bufferCopyRegion.imageExtent.depth = 1;
+				bufferCopyRegion.bufferOffset = offset;
+				bufferCopyRegions.push_back(bufferCopyRegion);
+			}
+		}
+		ktxTexture_Destroy(target.cached);
+		target.cached = nullptr;
+
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, target.mipLevels, 0, target.faceCount };
+		vks::tools::setImageLayout(commandBuffer, target.texture->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+		vkCmdCopyBufferToImage(commandBuffer, target.staging.buffer, target.texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(bufferCopyRegions.size()), bufferCopyRegions.data());
+		vks::tools::setImageLayout(commandBuffer, target.texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
+	}
+
+	/**
+	* Records the commands for baking a target
+	*
+	* @note Cube maps are left in transfer destination layout, the look-up-table in color attachment layout (see readback)
+	*/
+	void IBLBaker::render(VkCommandBuffer commandBuffer, Target& target)
+	{
+		Filter& filter = filters[target.type];
+
+		VkClearValue clearValues[1];
+		clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 0.0f } };
+		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+		renderPassBeginInfo.renderPass = filter.renderPass;
+		renderPassBeginInfo.renderArea.extent.width = target.dim;
+		renderPassBeginInfo.renderArea.extent.height = target.dim;
+		renderPassBeginInfo.clearValueCount = 1;
+		renderPassBeginInfo.pClearValues = clearValues;
+
+		VkViewport viewport = vks::initializers::viewport((float)target.dim, (float)target.dim, 0.0f, 1.0f);
+		VkRect2D scissor = vks::initializers::rect2D(target.dim, target.dim, 0, 0);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		if (target.type == targetBRDFLUT) {
+			// The look-up-table is rendered directly into the target with a fullscreen triangle
+			VkFramebufferCreateInfo framebufferCI = vks::initializers::framebufferCreateInfo();
+			framebufferCI.renderPass = filter.renderPass;
+			framebufferCI.attachmentCount = 1;
+			framebufferCI.pAttachments = &target.texture->view;
+			framebufferCI.width = target.dim;
+			framebufferCI.height = target.dim;
+			framebufferCI.layers = 1;
+			VK_CHECK_RESULT(vkCreateFramebuffer(device->logicalDevice, &framebufferCI, nullptr, &target.framebuffer));
+			renderPassBeginInfo.framebuffer = target.framebuffer;
+			clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, filter.pipeline);
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+			vkCmdEndRenderPass(commandBuffer);
+			return;
+		}
+
+		// Cube maps are rendered face by face for each mip level into the offscreen framebuffer and copied to the target
+		struct PushBlock {
+			glm::mat4 mvp;
+			// Irradiance: sampling deltas (phi, theta), pre-filter: roughness and sample count
+			float params[2];
+		} pushBlock;
+		if (target.type == targetIrradiance) {
+			pushBlock.params[0] = settings.irradianceDeltaPhi;
+			pushBlock.params[1] = settings.irradianceDeltaTheta;
+		} else {
+			memcpy(&pushBlock.params[1], &settings.prefilteredSamples, sizeof(uint32_t));
+		}
+		renderPassBeginInfo.framebuffer = filter.framebuffer;
+		const std::array<glm::mat4, 6> matrices = getCubeFaceMatrices();
+		const glm::mat4 projection = glm::perspective((float)(M_PI / 2.0), 1.0f, 0.1f, 512.0f);
+
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, target.mipLevels, 0, 6 };
+		// Change image layout for all cubemap faces to transfer destination
+		vks::tools::setImageLayout(commandBuffer, target.texture->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+
+		for (uint32_t m = 0; m < target.mipLevels; m++) {
+			if (target.type == targetPrefiltered) {
+				pushBlock.params[0] = (float)m / (float)(target.mipLevels - 1);
+			}
+			for (uint32_t f = 0; f < 6; f++) {
+				viewport.width = static_cast<float>(target.dim * std::pow(0.5f, m));
+				viewport.height = static_cast<float>(target.dim * std::pow(0.5f, m));
+				vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+				// Render scene from cube face's point of view
+				vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+				pushBlock.mvp = projection * matrices[f];
+				vkCmdPushConstants(commandBuffer, filter.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushBlock), &pushBlock);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, filter.pipeline);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, filter.pipelineLayout, 0, 1, &target.descriptorSet, 0, NULL);
+				cube->draw(commandBuffer);
+				vkCmdEndRenderPass(commandBuffer);
+
+				vks::tools::setImageLayout(commandBuffer, filter.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+				// Copy region for transfer from framebuffer to cube face
+				VkImageCopy copyRegion = {};
+				copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+				copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, m, f, 1 };
+				copyRegion.extent.width = static_cast<uint32_t>(viewport.width);
+				copyRegion.extent.height = static_cast<uint32_t>(viewport.height);
+				copyRegion.extent.depth = 1;
+				vkCmdCopyImage(commandBuffer, filter.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.texture->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+				// Transform framebuffer color attachment back
+				vks::tools::setImageLayout(commandBuffer, filter.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+			}
+		}
+	}
+
+	/** @brief Transitions a baked target for shader reads, if caching is enabled all mip levels and faces are copied to a host visible buffer first */
+	void IBLBaker::readback(VkCommandBuffer commandBuffer, Target& target)
+	{
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, target.mipLevels, 0, target.faceCount };
+		VkImageLayout layout = (target.type == targetBRDFLUT) ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		if (!target.cacheFile.empty()) {
+			const uint32_t texelSize = getFormatInfo(target.format).texelSize;
+			std::vector<VkBufferImageCopy> bufferCopyRegions;
+			VkDeviceSize offset = 0;
+			for (uint32_t level = 0; level < target.mipLevels; level++) {
+				const uint32_t dim = std::max(target.dim >> level, 1u);
+				VkBufferImageCopy bufferCopyRegion = {};
+				bufferCopyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, target.faceCount };
+				bufferCopyRegion.imageExtent = { dim, dim, 1 };
+				bufferCopyRegion.bufferOffset = offset;
+				bufferCopyRegions.push_back(bufferCopyRegion);
+				offset += (VkDeviceSize)dim * dim * texelSize * target.faceCount;
+			}
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &target.staging, offset));
+			vks::tools::setImageLayout(commandBuffer, target.texture->image, layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, subresourceRange);
+			vkCmdCopyImageToBuffer(commandBuffer, target.texture->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.staging.buffer, static_cast<uint32_t>(bufferCopyRegions.size()), bufferCopyRegions.data());
+			layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		}
+		vks::tools::setImageLayout(commandBuffer, target.texture->image, layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
+	}
+
+	/**
+	* Generates all textures added since the last call
+	*
+	* @note Textures found in the cache are uploaded, all others are baked. Both is done with a single command buffer submission, after which newly baked textures are written to the cache
+	*/
+	void IBLBaker::bake()
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		VkDevice logicalDevice = device->logicalDevice;
+
+		// Look up targets in the cache
+		statistics = Statistics();
+		const bool useCache = !cacheDirectory.empty();
+		if (useCache) {
+			createDirectory(cacheDirectory);
+		}
+		std::string hashedFile;
+		uint64_t contentHash = 0;
+		bool validHash = false;
+		uint32_t bakeCount = 0;
+		for (Target& target : targets) {
+			if (useCache) {
+				// The look-up-table only depends on the settings
+				if (target.type != targetBRDFLUT && target.environmentFile != hashedFile) {
+					hashedFile = target.environmentFile;
+					validHash = hashFile(hashedFile, contentHash);
+				}
+				if (target.type == targetBRDFLUT || validHash) {
+					std::stringstream ss;
+					const char* names[] = { "brdflut", "irradiance", "prefiltered" };
+					ss << cacheDirectory << names[target.type] << "_" << std::hex << std::setw(16) << std::setfill('0') << getCacheKey(target, (target.type == targetBRDFLUT) ? 0 : contentHash) << ".ktx";
+					target.cacheFile = ss.str();
+				}
+			}
+			if (!target.cacheFile.empty() && loadFromCache(target)) {
+				statistics.cacheHits++;
+			} else {
+				statistics.cacheMisses++;
+				target.baked = true;
+				bakeCount++;
+			}
+			prepareTarget(target);
+		}
+
+		// Resources for baking are only created if required
+		if (bakeCount > 0) {
+			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+			};
+			VkDescriptorSetLayoutCreateInfo descriptorsetlayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(logicalDevice, &descriptorsetlayoutCI, nullptr, &descriptorSetLayout));
+			std::vector<VkDescriptorPoolSize> poolSizes = { vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, bakeCount) };
+			VkDescriptorPoolCreateInfo descriptorPoolCI = vks::initializers::descriptorPoolCreateInfo(poolSizes, bakeCount);
+			VK_CHECK_RESULT(vkCreateDescriptorPool(logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
+			for (Target& target : targets) {
+				if (!target.baked) {
+					continue;
+				}
+				prepareFilter(target.type, target.format, target.dim);
+				if (target.type != targetBRDFLUT) {
+					VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+					VK_CHECK_RESULT(vkAllocateDescriptorSets(logicalDevice, &allocInfo, &target.descriptorSet));
+					VkWriteDescriptorSet writeDescriptorSet = vks::initializers::writeDescriptorSet(target.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &target.environmentCube->descriptor);
+					vkUpdateDescriptorSets(logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+				}
+			}
+		}
+
+		// Record and submit uploads and bakes for all targets at once
+		VkCommandBuffer commandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		for (Filter& filter : filters) {
+			if (filter.image != VK_NULL_HANDLE) {
+				vks::tools::setImageLayout(commandBuffer, filter.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+			}
+		}
+		for (Target& target : targets) {
+			if (target.baked) {
+				render(commandBuffer, target);
+				readback(commandBuffer, target);
+			} else {
+				upload(commandBuffer, target);
+			}
+		}
+		device->flushCommandBuffer(commandBuffer, queue);
+
+		// Store newly baked targets in the cache
+		for (Target& target : targets) {
+			if (target.baked && !target.cacheFile.empty()) {
+				VK_CHECK_RESULT(target.staging.map());
+				writeToCache(target);
+			}
+			target.staging.destroy();
+			if (target.framebuffer != VK_NULL_HANDLE) {
+				vkDestroyFramebuffer(logicalDevice, target.framebuffer, nullptr);
+			}
+		}
+		targets.clear();
+		destroyFilters();
+
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		statistics.time = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		std::cout << "Image based lighting textures: " << statistics.cacheHits << " loaded from cache, " << statistics.cacheMisses << " baked, took " << statistics.time << " ms" << std::endl;
+	}
+}
@@ -0,0 +1,136 @@
+/*
+* Vulkan image based lighting baker
+*
+* Generates the textures required for image based lighting (BRDF look-up table, irradiance cube and pre-filtered environment cube)
+* Results are cached on disk as KTX files keyed by the content of the environment map and the bake settings, so later runs only need to upload them
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanTexture.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+#include "VulkanglTFModel.h"
+
+#include <ktx.h>
+
+namespace vks
+{
+	/**
+	* @brief Bakes (or loads from the disk cache) the textures used for image based lighting
+	* @note All textures added before calling bake() are generated with a single command buffer submission
+	* @note Cache files are named after a hash of the environment map file content, the target resolutions, formats and sample counts, so changing any of these invalidates the cache
+	*/
+	class IBLBaker
+	{
+	public:
+		/** @brief Bake parameters, these are part of the cache key */
+		struct Settings
+		{
+			uint32_t brdfLutSize = 512;
+			uint32_t brdfLutSamples = 1024;
+			uint32_t irradianceSize = 64;
+			float irradianceDeltaPhi = (2.0f * float(M_PI)) / 180.0f;
+			float irradianceDeltaTheta = (0.5f * float(M_PI)) / 64.0f;
+			uint32_t prefilteredSize = 512;
+			uint32_t prefilteredSamples = 32;
+		} settings;
+
+		/** @brief Shader stages used for baking, to be loaded by the application (see the pbribl example) */
+		struct Shaders
+		{
+			VkPipelineShaderStageCreateInfo brdfLutVert;
+			VkPipelineShaderStageCreateInfo brdfLutFrag;
+			VkPipelineShaderStageCreateInfo filterCubeVert;
+			VkPipelineShaderStageCreateInfo irradianceFrag;
+			VkPipelineShaderStageCreateInfo prefilterFrag;
+		} shaders;
+
+		struct Statistics
+		{
+			uint32_t cacheHits = 0;
+			uint32_t cacheMisses = 0;
+			double time = 0.0;
+		} statistics;
+
+		/** @brief Directory the baked textures are cached in, an empty string disables the cache */
+#if defined(__ANDROID__)
+		std::string cacheDirectory = "";
+#else
+		std::string cacheDirectory = "ibl_cache/";
+#endif
+
+		IBLBaker(vks::VulkanDevice* device, VkQueue queue, VkPipelineCache pipelineCache, vkglTF::Model* cube);
+		~IBLBaker();
+		void addBRDFLUT(vks::Texture2D* lutBrdf);
+		void addEnvironment(const std::string& filename, vks::TextureCubeMap* environmentCube, vks::TextureCubeMap* irradianceCube, vks::TextureCubeMap* prefilteredCube);
+		void bake();
+	private:
+		enum TargetType { targetBRDFLUT = 0, targetIrradiance = 1, targetPrefiltered = 2 };
+
+		/** @brief Texture to be generated, either by rendering or by uploading it from the cache */
+		struct Target
+		{
+			TargetType type;
+			vks::Texture* texture = nullptr;
+			VkFormat format = VK_FORMAT_UNDEFINED;
+			uint32_t dim = 0;
+			uint32_t mipLevels = 1;
+			uint32_t faceCount = 1;
+			vks::TextureCubeMap* environmentCube = nullptr;
+			std::string environmentFile;
+			std::string cacheFile;
+			ktxTexture* cached = nullptr;
+			bool baked = false;
+			/** @brief Holds the data uploaded from the cache or read back for writing the cache */
+			vks::Buffer staging;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+			VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		};
+
+		/** @brief Render pass, pipeline and offscreen framebuffer shared by all targets of the same type */
+		struct Filter
+		{
+			VkRenderPass renderPass = VK_NULL_HANDLE;
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkFramebuffer framebuffer = VK_NULL_HANDLE;
+		};
+
+		vks::VulkanDevice* device;
+		VkQueue queue;
+		VkPipelineCache pipelineCache;
+		vkglTF::Model* cube;
+		std::vector<Target> targets;
+		std::array<Filter, 3> filters;
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+
+		uint64_t getCacheKey(const Target& target, uint64_t contentHash) const;
+		bool loadFromCache(Target& target);
+		bool writeToCache(const Target& target);
+		void prepareTarget(Target& target);
+		void prepareFilter(TargetType type, VkFormat format, uint32_t dim);
+		void destroyFilters();
+		void upload(VkCommandBuffer commandBuffer, Target& target);
+		void render(VkCommandBuffer commandBuffer, Target& target);
+		void readback(VkCommandBuffer commandBuffer, Target& target);
+	};
+}
@@ -0,0 +1,437 @@
+/*
+* Vulkan background pipeline compilation service
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanPipelineService.h"
+
+namespace vks
+{
+	namespace
+	{
+		// Create infos pointing into a pipeline description, needs to stay alive until the pipeline has been created
+		struct PipelineState
+		{
+			std::vector<VkPipelineShaderStageCreateInfo> stages;
+			std::vector<VkSpecializationInfo> specializationInfos;
+			VkPipelineVertexInputStateCreateInfo vertexInputState;
+			VkPipelineViewportStateCreateInfo viewportState;
+			VkPipelineColorBlendStateCreateInfo colorBlendState;
+			VkPipelineDynamicStateCreateInfo dynamicState;
+
+			PipelineState(const PipelineDescription& description)
+			{
+				specializationInfos.resize(description.stages.size());
+				for (size_t i = 0; i < description.stages.size(); i++) {
+					const PipelineDescription::ShaderStage& stage = description.stages[i];
+					VkPipelineShaderStageCreateInfo shaderStage = {};
+					shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+					shaderStage.stage = stage.stage;
+					shaderStage.module = stage.module;
+					shaderStage.pName = stage.entryPoint.c_str();
+					if (!stage.specializationMapEntries.empty()) {
+						specializationInfos[i] = vks::initializers::specializationInfo(static_cast<uint32_t>(stage.specializationMapEntries.size()), stage.specializationMapEntries.data(), stage.specializationData.size(), stage.specializationData.data());
+						shaderStage.pSpecializationInfo = &specializationInfos[i];
+					}
+					stages.push_back(shaderStage);
+				}
+				vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo(description.vertexBindings, description.vertexAttributes);
+				viewportState = vks::initializers::pipelineViewportStateCreateInfo(description.viewportCount, description.viewportCount);
+				colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(static_cast<uint32_t>(description.blendAttachmentStates.size()), description.blendAttachmentStates.data());
+				dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(description.dynamicStates);
+			}
+
+			// Returns the shader stages matching the given stage flags (used to split the stages between pipeline libraries)
+			std::vector<VkPipelineShaderStageCreateInfo> getStages(VkShaderStageFlags flags) const
+			{
+				std::vector<VkPipelineShaderStageCreateInfo> result;
+				for (const VkPipelineShaderStageCreateInfo& stage : stages) {
+					if (stage.stage & flags) {
+						result.push_back(stage);
+					}
+				}
+				return result;
+			}
+		};
+
+		double elapsed(std::chrono::high_resolution_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+	}
+
+	/** @brief Add a shader stage, specialization data is passed as a single constant with id 0 (for multiple constants fill the stage's map entries directly) */
+	void PipelineDescription::addShaderStage(VkShaderStageFlagBits stage, VkShaderModule module, const void* specializationData, uint32_t specializationSize)
+	{
+		ShaderStage shaderStage;
+		shaderStage.stage = stage;
+		shaderStage.module = module;
+		if (specializationData) {
+			shaderStage.specializationMapEntries.push_back(vks::initializers::specializationMapEntry(0, 0, specializationSize));
+			const uint8_t* data = static_cast<const uint8_t*>(specializationData);
+			shaderStage.specializationData.assign(data, data + specializationSize);
+		}
+		stages.push_back(shaderStage);
+	}
+
+	/** @brief Copies the bindings and attributes of a vertex input state (e.g. from vkglTF::Vertex::getPipelineVertexInputState) */
+	void PipelineDescription::setVertexInputState(const VkPipelineVertexInputStateCreateInfo* vertexInputState)
+	{
+		vertexBindings.assign(vertexInputState->pVertexBindingDescriptions, vertexInputState->pVertexBindingDescriptions + vertexInputState->vertexBindingDescriptionCount);
+		vertexAttributes.assign(vertexInputState->pVertexAttributeDescriptions, vertexInputState->pVertexAttributeDescriptions + vertexInputState->vertexAttributeDescriptionCount);
+	}
+
+	/**
+	* Start the worker threads
+	*
+	* @param device Logical device used to create the pipelines
+	* @param pipelineCache Pipeline cache shared by all workers (pipeline caches are internally synchronized)
+	* @param graphicsPipelineLibrary Use VK_EXT_graphics_pipeline_library for fast-linking (the extension and feature must have been enabled)
+	* @param framesInFlight Number of frames a replaced pipeline is kept alive after it has been replaced
+	* @param threadCount Number of worker threads, zero uses one thread less than the number of hardware threads
+	*/
+	void PipelineService::create(VkDevice device, VkPipelineCache pipelineCache, bool graphicsPipelineLibrary, uint32_t framesInFlight, uint32_t threadCount)
+	{
+		this->device = device;
+		this->pipelineCache = pipelineCache;
+		this->graphicsPipelineLibrary = graphicsPipelineLibrary;
+		this->framesInFlight = framesInFlight;
+		if (threadCount == 0) {
+			threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+		}
+		destroying = false;
+		for (uint32_t i = 0; i < threadCount; i++) {
+			workers.push_back(std::thread(&PipelineService::workerLoop, this));
+		}
+	}
+
+	/** @brief Stops the workers (jobs not yet started are dropped) and destroys all pipelines */
+	void PipelineService::destroy()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			destroying = true;
+			compileJobs.clear();
+			optimizeJobs.clear();
+		}
+		queueCondition.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+		for (Entry& entry : entries) {
+			for (VkPipeline library : entry.libraries) {
+				if (library != VK_NULL_HANDLE) {
+					vkDestroyPipeline(device, library, nullptr);
+				}
+			}
+			// The published pipeline is either the ready one or has already been retired
+			if (entry.ready != VK_NULL_HANDLE) {
+				vkDestroyPipeline(device, entry.ready, nullptr);
+			}
+			if (entry.published != VK_NULL_HANDLE && entry.published != entry.ready) {
+				vkDestroyPipeline(device, entry.published, nullptr);
+			}
+		}
+		entries.clear();
+		for (RetiredPipeline& pipeline : retired) {
+			vkDestroyPipeline(device, pipeline.pipeline, nullptr);
+		}
+		retired.clear();
+	}
+
+	/** @brief Queue a pipeline for compilation and return its handle */
+	uint32_t PipelineService::request(const PipelineDescription& description)
+	{
+		uint32_t handle;
+		{
+			std::lock_guard<std::mutex> lock(entryMutex);
+			handle = static_cast<uint32_t>(entries.size());
+			entries.push_back(Entry());
+			Entry& entry = entries.back();
+			entry.handle = handle;
+			entry.description = description;
+			entry.optimize = linkTimeOptimization && graphicsPipelineLibrary;
+			entry.requestTime = std::chrono::high_resolution_clock::now();
+			entry.libraries.fill(VK_NULL_HANDLE);
+			entry.statistics.name = description.name;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			compileJobs.push_back({ jobCompile, handle });
+		}
+		queueCondition.notify_one();
+		return handle;
+	}
+
+	/** @brief Returns the pipeline published for the handle with the last update() call, VK_NULL_HANDLE if it's not available yet */
+	VkPipeline PipelineService::get(uint32_t handle) const
+	{
+		return entries[handle].published;
+	}
+
+	/**
+	* Publish pipelines compiled since the last call and destroy replaced pipelines no longer in use
+	*
+	* @note Call once per frame from the thread recording command buffers
+	* @return True if any pipeline returned by get() changed (command buffers using it need to be rebuilt)
+	*/
+	bool PipelineService::update()
+	{
+		for (auto it = retired.begin(); it != retired.end();) {
+			if (--it->framesLeft == 0) {
+				vkDestroyPipeline(device, it->pipeline, nullptr);
+				it = retired.erase(it);
+			} else {
+				++it;
+			}
+		}
+		bool changed = false;
+		std::lock_guard<std::mutex> lock(entryMutex);
+		for (Entry& entry : entries) {
+			if (entry.ready != entry.published) {
+				if (entry.published != VK_NULL_HANDLE) {
+					retired.push_back({ entry.published, framesInFlight + 1 });
+				}
+				entry.published = entry.ready;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	/** @brief Blocks until all queued jobs have been finished (e.g. for loading screens or benchmarks) */
+	void PipelineService::waitIdle()
+	{
+		std::unique_lock<std::mutex> lock(queueMutex);
+		idleCondition.wait(lock, [this] { return compileJobs.empty() && optimizeJobs.empty() && (activeJobs == 0); });
+	}
+
+	/** @brief Returns the number of queued or running jobs */
+	uint32_t PipelineService::getPendingCount()
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		return static_cast<uint32_t>(compileJobs.size() + optimizeJobs.size()) + activeJobs;
+	}
+
+	uint32_t PipelineService::getThreadCount() const
+	{
+		return static_cast<uint32_t>(workers.size());
+	}
+
+	bool PipelineService::usesGraphicsPipelineLibrary() const
+	{
+		return graphicsPipelineLibrary;
+	}
+
+	std::vector<PipelineService::Statistics> PipelineService::getStatistics()
+	{
+		std::lock_guard<std::mutex> lock(entryMutex);
+		std::vector<Statistics> statistics;
+		for (const Entry& entry : entries) {
+			statistics.push_back(entry.statistics);
+		}
+		return statistics;
+	}
+
+	void PipelineService::workerLoop()
+	{
+		while (true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this] { return destroying || !compileJobs.empty() || !optimizeJobs.empty(); });
+				if (destroying) {
+					break;
+				}
+				std::deque<Job>& queue = compileJobs.empty() ? optimizeJobs : compileJobs;
+				job = queue.front();
+				queue.pop_front();
+				activeJobs++;
+			}
+			Entry* entry;
+			{
+				std::lock_guard<std::mutex> lock(entryMutex);
+				entry = &entries[job.handle];
+			}
+			if (job.type == jobCompile) {
+				compile(*entry);
+			} else {
+				optimize(*entry);
+			}
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				activeJobs--;
+				if (compileJobs.empty() && optimizeJobs.empty() && (activeJobs == 0)) {
+					idleCondition.notify_all();
+				}
+			}
+		}
+	}
+
+	/** @brief Create a first usable pipeline, with pipeline libraries this is fast-linked and an optimization job is queued */
+	void PipelineService::compile(Entry& entry)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		if (!graphicsPipelineLibrary) {
+			VkPipeline pipeline = createMonolithic(entry);
+			setReady(entry, pipeline, stateOptimized);
+			std::lock_guard<std::mutex> lock(entryMutex);
+			entry.statistics.compileTime = elapsed(tStart);
+			return;
+		}
+		createLibraries(entry);
+		VkPipeline pipeline = link(entry, false);
+		setReady(entry, pipeline, stateFastLinked);
+		{
+			std::lock_guard<std::mutex> lock(entryMutex);
+			entry.statistics.compileTime = elapsed(tStart);
+		}
+		if (entry.optimize) {
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				optimizeJobs.push_back({ jobOptimize, entry.handle });
+			}
+			queueCondition.notify_one();
+		}
+	}
+
+	/** @brief Link the retained libraries into a link time optimized pipeline that replaces the fast-linked one */
+	void PipelineService::optimize(Entry& entry)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		VkPipeline pipeline = link(entry, true);
+		// The libraries are no longer required once all pipelines have been linked
+		for (VkPipeline& library : entry.libraries) {
+			vkDestroyPipeline(device, library, nullptr);
+			library = VK_NULL_HANDLE;
+		}
+		setReady(entry, pipeline, stateOptimized);
+		std::lock_guard<std::mutex> lock(entryMutex);
+		entry.statistics.optimizeTime = elapsed(tStart);
+	}
+
+	/** @brief Hand a compiled pipeline over to the main thread, a pipeline compiled earlier that has not been published yet is destroyed directly */
+	void PipelineService::setReady(Entry& entry, VkPipeline pipeline, State state)
+	{
+		VkPipeline unused = VK_NULL_HANDLE;
+		{
+			std::lock_guard<std::mutex> lock(entryMutex);
+			if (entry.ready != entry.published) {
+				unused = entry.ready;
+			}
+			entry.ready = pipeline;
+			if (entry.statistics.state == statePending) {
+				entry.statistics.latency = elapsed(entry.requestTime);
+			}
+			entry.statistics.state = state;
+		}
+		if (unused != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device, unused, nullptr);
+		}
+	}
+
+	/** @brief Create the four pipeline library parts of an entry */
+	void PipelineService::createLibraries(Entry& entry)
+	{
+		const PipelineDescription& description = entry.description;
+		PipelineState state(description);
+
+		VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
+		libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+
+		VkGraphicsPipelineCreateInfo pipelineCI{};
+		pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineCI.pNext = &libraryInfo;
+		// Link time optimization information needs to be retained for creating the optimized pipeline later on
+		pipelineCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+		if (entry.optimize) {
+			pipelineCI.flags |= VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+		}
+		pipelineCI.layout = description.layout;
+		pipelineCI.renderPass = description.renderPass;
+		pipelineCI.subpass = description.subpass;
+		pipelineCI.pDynamicState = &state.dynamicState;
+
+		// Vertex input interface
+		VkGraphicsPipelineCreateInfo vertexInputCI = pipelineCI;
+		libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+		vertexInputCI.pVertexInputState = &state.vertexInputState;
+		vertexInputCI.pInputAssemblyState = &description.inputAssemblyState;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &vertexInputCI, nullptr, &entry.libraries[0]));
+
+		// Pre-rasterization shaders
+		std::vector<VkPipelineShaderStageCreateInfo> preRasterizationStages = state.getStages(VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_GEOMETRY_BIT);
+		VkGraphicsPipelineCreateInfo preRasterizationCI = pipelineCI;
+		libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+		preRasterizationCI.stageCount = static_cast<uint32_t>(preRasterizationStages.size());
+		preRasterizationCI.pStages = preRasterizationStages.data();
+		preRasterizationCI.pViewportState = &state.viewportState;
+		preRasterizationCI.pRasterizationState = &description.rasterizationState;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &preRasterizationCI, nullptr, &entry.libraries[1]));
+
+		// Fragment shader
+		std::vector<VkPipelineShaderStageCreateInfo> fragmentStages = state.getStages(VK_SHADER_STAGE_FRAGMENT_BIT);
+		VkGraphicsPipelineCreateInfo fragmentShaderCI = pipelineCI;
+		libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+		fragmentShaderCI.stageCount = static_cast<uint32_t>(fragmentStages.size());
+		fragmentShaderCI.pStages = fragmentStages.data();
+		fragmentShaderCI.pDepthStencilState = &description.depthStencilState;
+		fragmentShaderCI.pMultisampleState = &description.multisampleState;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &fragmentShaderCI, nullptr, &entry.libraries[2]));
+
+		// Fragment output interface
+		VkGraphicsPipelineCreateInfo fragmentOutputCI = pipelineCI;
+		libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+		fragmentOutputCI.pColorBlendState = &state.colorBlendState;
+		fragmentOutputCI.pMultisampleState = &description.multisampleState;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &fragmentOutputCI, nullptr, &entry.libraries[3]));
+	}
+
+	/** @brief Link the library parts of an entry into an executable pipeline */
+	VkPipeline PipelineService::link(Entry& entry, bool linkTimeOptimized)
+	{
+		VkPipelineLibraryCreateInfoKHR pipelineLibraryCI{};
+		pipelineLibraryCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+		pipelineLibraryCI.libraryCount = static_cast<uint32_t>(entry.libraries.size());
+		pipelineLibraryCI.pLibraries = entry.libraries.data();
+
+		VkGraphicsPipelineCreateInfo executablePipelineCI{};
+		executablePipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		executablePipelineCI.pNext = &pipelineLibraryCI;
+		executablePipelineCI.layout = entry.description.layout;
+		// Link time optimization trades in pipeline creation time for run-time performance
+		executablePipelineCI.flags = linkTimeOptimized ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &executablePipelineCI, nullptr, &pipeline));
+		return pipeline;
+	}
+
+	/** @brief Create a complete pipeline in one go (used if pipeline libraries are not available) */
+	VkPipeline PipelineService::createMonolithic(Entry& entry)
+	{
+		const PipelineDescription& description = entry.description;
+		PipelineState state(description);
+
+		VkGraphicsPipelineCreateInfo pipelineCI = vks::initializers::pipelineCreateInfo(description.layout, description.renderPass);
+		pipelineCI.subpass = description.subpass;
+		pipelineCI.stageCount = static_cast<uint32_t>(state.stages.size());
+		pipelineCI.pStages = state.stages.data();
+		pipelineCI.pVertexInputState = &state.vertexInputState;
+		pipelineCI.pInputAssemblyState = &description.inputAssemblyState;
+		pipelineCI.pViewportState = &state.viewportState;
+		pipelineCI.pRasterizationState = &description.rasterizationState;
+		pipelineCI.pMultisampleState = &description.multisampleState;
+		pipelineCI.pDepthStencilState = &description.depthStencilState;
+		pipelineCI.pColorBlendState = &state.colorBlendState;
+		pipelineCI.pDynamicState = &state.dynamicState;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipeline));
+		return pipeline;
+	}
+}
@@ -0,0 +1,157 @@
+/*
+* Vulkan background pipeline compilation service
+*
+* Compiles graphics pipelines on a pool of worker threads against a shared pipeline cache, so creating pipelines never stalls a frame
+* With VK_EXT_graphics_pipeline_library a fast-linked pipeline is made available first and replaced by the link time optimized variant once that has been compiled
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <array>
+#include <deque>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+
+namespace vks
+{
+	/**
+	* @brief Self-contained description of a graphics pipeline
+	* @note All state is copied when requesting a pipeline, only the shader modules, pipeline layout and render pass need to stay valid until the service has been destroyed
+	* @note pNext chains of the state structures are not supported and must be null
+	*/
+	struct PipelineDescription
+	{
+		struct ShaderStage
+		{
+			VkShaderStageFlagBits stage;
+			VkShaderModule module;
+			std::string entryPoint = "main";
+			std::vector<VkSpecializationMapEntry> specializationMapEntries;
+			std::vector<uint8_t> specializationData;
+		};
+
+		/** @brief Name displayed in the statistics */
+		std::string name;
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		uint32_t subpass = 0;
+		std::vector<ShaderStage> stages;
+		std::vector<VkVertexInputBindingDescription> vertexBindings;
+		std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+		VkPipelineRasterizationStateCreateInfo rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+		VkPipelineDepthStencilStateCreateInfo depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+		VkPipelineMultisampleStateCreateInfo multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+		std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates = { vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE) };
+		std::vector<VkDynamicState> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		uint32_t viewportCount = 1;
+
+		void addShaderStage(VkShaderStageFlagBits stage, VkShaderModule module, const void* specializationData = nullptr, uint32_t specializationSize = 0);
+		void setVertexInputState(const VkPipelineVertexInputStateCreateInfo* vertexInputState);
+	};
+
+	/**
+	* @brief Pool of worker threads compiling graphics pipelines in the background
+	* @note Requesting a pipeline returns a handle immediately, get() returns VK_NULL_HANDLE until a pipeline has been compiled
+	* @note Compiled (and optimized) pipelines are only published by update(), which the application calls once per frame on the main thread. Replaced pipelines are destroyed once they can no longer be used by frames in flight
+	*/
+	class PipelineService
+	{
+	public:
+		enum State { statePending, stateFastLinked, stateOptimized };
+
+		/** @brief Compile times of a single pipeline in milliseconds */
+		struct Statistics
+		{
+			std::string name;
+			State state = statePending;
+			/** @brief Time from requesting the pipeline until it was first usable (includes time spent waiting in the queue) */
+			double latency = 0.0;
+			/** @brief Time spent creating the pipeline libraries and fast-linking them (or compiling the complete pipeline without pipeline libraries) */
+			double compileTime = 0.0;
+			/** @brief Time spent on the link time optimized pipeline */
+			double optimizeTime = 0.0;
+		};
+
+		/** @brief Create link time optimized pipelines after the fast-linked ones (only applies to pipelines requested after changing it) */
+		bool linkTimeOptimization = true;
+
+		void create(VkDevice device, VkPipelineCache pipelineCache, bool graphicsPipelineLibrary, uint32_t framesInFlight, uint32_t threadCount = 0);
+		void destroy();
+		uint32_t request(const PipelineDescription& description);
+		VkPipeline get(uint32_t handle) const;
+		bool update();
+		void waitIdle();
+		uint32_t getPendingCount();
+		uint32_t getThreadCount() const;
+		bool usesGraphicsPipelineLibrary() const;
+		std::vector<Statistics> getStatistics();
+	private:
+		enum JobType { jobCompile, jobOptimize };
+
+		struct Job
+		{
+			JobType type;
+			uint32_t handle;
+		};
+
+		struct Entry
+		{
+			uint32_t handle = 0;
+			PipelineDescription description;
+			bool optimize = true;
+			std::chrono::high_resolution_clock::time_point requestTime;
+			/** @brief Vertex input, pre-rasterization, fragment shader and fragment output interface libraries */
+			std::array<VkPipeline, 4> libraries;
+			/** @brief Most recent pipeline compiled by a worker (guarded by the entry mutex) */
+			VkPipeline ready = VK_NULL_HANDLE;
+			/** @brief Pipeline returned by get() (only accessed by the main thread) */
+			VkPipeline published = VK_NULL_HANDLE;
+			Statistics statistics;
+		};
+
+		struct RetiredPipeline
+		{
+			VkPipeline pipeline;
+			uint32_t framesLeft;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+		bool graphicsPipelineLibrary = false;
+		uint32_t framesInFlight = 1;
+		std::vector<std::thread> workers;
+		// Entries are never removed, so references to them stay valid while the deque grows
+		std::deque<Entry> entries;
+		std::mutex entryMutex;
+		// Fast compiles are always picked before optimizations
+		std::deque<Job> compileJobs;
+		std::deque<Job> optimizeJobs;
+		uint32_t activeJobs = 0;
+		bool destroying = false;
+		std::mutex queueMutex;
+		std::condition_variable queueCondition;
+		std::condition_variable idleCondition;
+		std::vector<RetiredPipeline> retired;
+
+		void workerLoop();
+		void compile(Entry& entry);
+		void optimize(Entry& entry);
+		void createLibraries(Entry& entry);
+		VkPipeline link(Entry& entry, bool linkTimeOptimized);
+		VkPipeline createMonolithic(Entry& entry);
+		void setReady(Entry& entry, VkPipeline pipeline, State state);
+	};
+}
@@ -0,0 +1,709 @@
+/*
+* Vulkan render graph
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanRenderGraph.h"
+
+#include <algorithm>
+
+namespace vks
+{
+	namespace
+	{
+		const VkAccessFlags writeAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		bool isDepthFormat(VkFormat format)
+		{
+			switch (format) {
+			case VK_FORMAT_D16_UNORM:
+			case VK_FORMAT_X8_D24_UNORM_PACK32:
+			case VK_FORMAT_D32_SFLOAT:
+			case VK_FORMAT_D16_UNORM_S8_UINT:
+			case VK_FORMAT_D24_UNORM_S8_UINT:
+			case VK_FORMAT_D32_SFLOAT_S8_UINT:
+				return true;
+			default:
+				return false;
+			}
+		}
+	}
+
+	void RenderGraph::Pass::addColorOutput(Resource image, VkAttachmentLoadOp loadOp, VkClearColorValue clearValue)
+	{
+		Use use{};
+		use.resource = image;
+		use.access = Access::ColorOutput;
+		use.loadOp = loadOp;
+		use.clearValue.color = clearValue;
+		use.stageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		uses.push_back(use);
+	}
+
+	void RenderGraph::Pass::setDepthStencilOutput(Resource image, VkAttachmentLoadOp loadOp, VkClearDepthStencilValue clearValue)
+	{
+		Use use{};
+		use.resource = image;
+		use.access = Access::DepthStencilOutput;
+		use.loadOp = loadOp;
+		use.clearValue.depthStencil = clearValue;
+		use.stageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+		uses.push_back(use);
+	}
+
+	void RenderGraph::Pass::addSampledInput(Resource image, VkPipelineStageFlags stageMask)
+	{
+		Use use{};
+		use.resource = image;
+		use.access = Access::Sampled;
+		use.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		use.stageMask = stageMask;
+		uses.push_back(use);
+	}
+
+	void RenderGraph::Pass::addStorageOutput(Resource image, VkPipelineStageFlags stageMask)
+	{
+		Use use{};
+		use.resource = image;
+		use.access = Access::StorageOutput;
+		use.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		use.stageMask = stageMask;
+		uses.push_back(use);
+	}
+
+	void RenderGraph::Pass::setSideEffect()
+	{
+		sideEffect = true;
+	}
+
+	void RenderGraph::Pass::setRecordCallback(std::function<void(VkCommandBuffer commandBuffer)> callback)
+	{
+		recordCallback = callback;
+	}
+
+	VkRenderPass RenderGraph::Pass::getRenderPass() const
+	{
+		return renderPass;
+	}
+
+	bool RenderGraph::Pass::isCulled() const
+	{
+		return culled;
+	}
+
+	const std::string& RenderGraph::Pass::getName() const
+	{
+		return name;
+	}
+
+	/** @brief Sampled and storage images are accessed through descriptors, all other uses are attachments of the pass' render pass */
+	bool RenderGraph::Pass::isAttachment(Access access)
+	{
+		return (access != Access::Sampled) && (access != Access::StorageOutput);
+	}
+
+	bool RenderGraph::Pass::hasAttachments() const
+	{
+		for (const Use& use : uses) {
+			if (isAttachment(use.access)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool RenderGraph::Pass::writes(Resource resource) const
+	{
+		for (const Use& use : uses) {
+			if ((use.resource == resource) && ((use.access == Access::ColorOutput) || (use.access == Access::DepthStencilOutput) || (use.access == Access::StorageOutput))) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/** @brief Returns true if the pass depends on the contents written to the image by an earlier pass */
+	bool RenderGraph::Pass::readsPrevious(Resource resource) const
+	{
+		for (const Use& use : uses) {
+			if ((use.resource == resource) && ((use.access == Access::Sampled) || (use.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD))) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void RenderGraph::create(vks::VulkanDevice* device)
+	{
+		this->device = device;
+	}
+
+	/** @brief Destroys all Vulkan objects of the graph, including the cached render passes */
+	void RenderGraph::destroy()
+	{
+		reset();
+		for (auto& renderPass : renderPassCache) {
+			vkDestroyRenderPass(device->logicalDevice, renderPass.second, nullptr);
+		}
+		renderPassCache.clear();
+	}
+
+	/** @brief Removes all passes and images, e.g. to rebuild the graph after settings have changed */
+	void RenderGraph::reset()
+	{
+		releaseResources();
+		passes.clear();
+		images.clear();
+	}
+
+	/** @brief Size of images with a scale of 1.0, takes effect with the next compile() */
+	void RenderGraph::setExtent(uint32_t width, uint32_t height)
+	{
+		extent = { width, height };
+	}
+
+	/**
+	* Declare an image owned by the graph, it's only created if a pass that isn't culled uses it
+	* Contents of graph images are not preserved across frames
+	*
+	* @param name Name for debugging and statistics
+	* @param format Format of the image
+	* @param scale Size relative to the graph's extent
+	*/
+	RenderGraph::Resource RenderGraph::createImage(const std::string& name, VkFormat format, float scale)
+	{
+		Image image;
+		image.name = name;
+		image.format = format;
+		image.scale = scale;
+		images.push_back(image);
+		return static_cast<Resource>(images.size() - 1);
+	}
+
+	/** @brief Add a pass, passes are executed in the order they have been added */
+	RenderGraph::Pass& RenderGraph::addPass(const std::string& name)
+	{
+		passes.push_back(std::unique_ptr<Pass>(new Pass()));
+		passes.back()->name = name;
+		return *passes.back();
+	}
+
+	/** @brief Cull passes, create and alias images, render passes, framebuffers and barriers, the device must not use the graph's resources anymore */
+	void RenderGraph::compile()
+	{
+		releaseResources();
+		statistics = Statistics();
+		for (Image& image : images) {
+			image.extent.width = std::max(static_cast<uint32_t>(extent.width * image.scale), 1u);
+			image.extent.height = std::max(static_cast<uint32_t>(extent.height * image.scale), 1u);
+			image.used = false;
+			image.lazy = false;
+		}
+
+		cullPasses();
+		buildGroups();
+		createImages();
+		allocateMemory();
+		for (uint32_t i = 0; i < groups.size(); i++) {
+			if (groups[i].pass->hasAttachments()) {
+				createRenderPass(i);
+			}
+		}
+		computeBarriers();
+
+		statistics.passes = static_cast<uint32_t>(passes.size());
+		for (auto& pass : passes) {
+			if (pass->culled) {
+				statistics.culledPasses++;
+			}
+		}
+		for (Group& group : groups) {
+			if (group.renderPass != VK_NULL_HANDLE) {
+				statistics.renderPasses++;
+			}
+		}
+	}
+
+	/** @brief Record all passes that have not been culled */
+	void RenderGraph::execute(VkCommandBuffer commandBuffer)
+	{
+		for (Group& group : groups) {
+			if (!group.barriers.empty()) {
+				vkCmdPipelineBarrier(commandBuffer, group.srcStageMask, group.dstStageMask, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(group.barriers.size()), group.barriers.data());
+			}
+			if (group.renderPass == VK_NULL_HANDLE) {
+				if (group.pass->recordCallback) {
+					group.pass->recordCallback(commandBuffer);
+				}
+				continue;
+			}
+			VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+			renderPassBeginInfo.renderPass = group.renderPass;
+			renderPassBeginInfo.framebuffer = group.framebuffer;
+			renderPassBeginInfo.renderArea.extent = group.extent;
+			renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(group.clearValues.size());
+			renderPassBeginInfo.pClearValues = group.clearValues.data();
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			VkViewport viewport = vks::initializers::viewport((float)group.extent.width, (float)group.extent.height, 0.0f, 1.0f);
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+			VkRect2D scissor = vks::initializers::rect2D(group.extent.width, group.extent.height, 0, 0);
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+			if (group.pass->recordCallback) {
+				group.pass->recordCallback(commandBuffer);
+			}
+			vkCmdEndRenderPass(commandBuffer);
+		}
+	}
+
+	/** @brief Returns the image, or VK_NULL_HANDLE if no pass that survived culling uses it */
+	VkImage RenderGraph::getImage(Resource image) const
+	{
+		return images[image].image;
+	}
+
+	/** @brief Returns the image's view, or VK_NULL_HANDLE if no pass that survived culling uses it */
+	VkImageView RenderGraph::getImageView(Resource image) const
+	{
+		return images[image].view;
+	}
+
+	VkExtent2D RenderGraph::getImageExtent(Resource image) const
+	{
+		return images[image].extent;
+	}
+
+	RenderGraph::Statistics RenderGraph::getStatistics() const
+	{
+		return statistics;
+	}
+
+	void RenderGraph::releaseResources()
+	{
+		if (!device) {
+			return;
+		}
+		for (Group& group : groups) {
+			if (group.framebuffer != VK_NULL_HANDLE) {
+				vkDestroyFramebuffer(device->logicalDevice, group.framebuffer, nullptr);
+			}
+		}
+		groups.clear();
+		for (Image& image : images) {
+			if (image.view != VK_NULL_HANDLE) {
+				vkDestroyImageView(device->logicalDevice, image.view, nullptr);
+				image.view = VK_NULL_HANDLE;
+			}
+			if (image.image != VK_NULL_HANDLE) {
+				vkDestroyImage(device->logicalDevice, image.image, nullptr);
+				image.image = VK_NULL_HANDLE;
+			}
+		}
+		for (MemoryBlock& block : memoryBlocks) {
+			vkFreeMemory(device->logicalDevice, block.memory, nullptr);
+		}
+		memoryBlocks.clear();
+		for (auto& pass : passes) {
+			pass->renderPass = VK_NULL_HANDLE;
+		}
+	}
+
+	/** @brief Only passes with side effects and the passes they (indirectly) depend on are kept */
+	void RenderGraph::cullPasses()
+	{
+		std::vector<uint32_t> stack;
+		for (uint32_t i = 0; i < passes.size(); i++) {
+			passes[i]->culled = !passes[i]->sideEffect;
+			if (passes[i]->sideEffect) {
+				stack.push_back(i);
+			}
+		}
+		while (!stack.empty()) {
+			const uint32_t index = stack.back();
+			stack.pop_back();
+			for (const Pass::Use& use : passes[index]->uses) {
+				if (!passes[index]->readsPrevious(use.resource)) {
+					continue;
+				}
+				// The last pass before this one that writes the image produces its contents
+				for (int32_t i = static_cast<int32_t>(index) - 1; i >= 0; i--) {
+					if (passes[i]->writes(use.resource)) {
+						if (passes[i]->culled) {
+							passes[i]->culled = false;
+							stack.push_back(i);
+						}
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	void RenderGraph::buildGroups()
+	{
+		for (auto& pass : passes) {
+			if (pass->culled) {
+				continue;
+			}
+			Group group;
+			group.pass = pass.get();
+			for (const Pass::Use& use : pass->uses) {
+				if (Pass::isAttachment(use.access)) {
+					group.extent = images[use.resource].extent;
+					break;
+				}
+			}
+			groups.push_back(group);
+		}
+		for (uint32_t i = 0; i < groups.size(); i++) {
+			collectGroupUses(groups[i]);
+			for (const GroupUse& groupUse : groups[i].uses) {
+				Image& image = images[groupUse.resource];
+				if (!image.used) {
+					image.used = true;
+					image.firstGroup = i;
+				}
+				image.lastGroup = i;
+			}
+		}
+	}
+
+	void RenderGraph::collectGroupUses(Group& group)
+	{
+		for (const Pass::Use& use : group.pass->uses) {
+			ImageState state;
+			state.stageMask = use.stageMask;
+			switch (use.access) {
+			case Pass::Access::ColorOutput:
+				state.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+				state.accessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | ((use.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0);
+				break;
+			case Pass::Access::DepthStencilOutput:
+				state.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+				state.accessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+				break;
+			case Pass::Access::Sampled:
+				state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+				state.accessMask = VK_ACCESS_SHADER_READ_BIT;
+				break;
+			case Pass::Access::StorageOutput:
+				state.layout = VK_IMAGE_LAYOUT_GENERAL;
+				state.accessMask = VK_ACCESS_SHADER_WRITE_BIT;
+				break;
+			}
+			auto groupUse = std::find_if(group.uses.begin(), group.uses.end(), [&use](const GroupUse& other) { return other.resource == use.resource; });
+			if (groupUse == group.uses.end()) {
+				GroupUse newUse;
+				newUse.resource = use.resource;
+				newUse.first = state;
+				newUse.last = state;
+				group.uses.push_back(newUse);
+			} else {
+				groupUse->last.layout = state.layout;
+				groupUse->last.stageMask |= state.stageMask;
+				groupUse->last.accessMask |= state.accessMask;
+			}
+		}
+	}
+
+	void RenderGraph::createImages()
+	{
+		for (uint32_t i = 0; i < images.size(); i++) {
+			Image& image = images[i];
+			if (!image.used) {
+				continue;
+			}
+			image.usage = 0;
+			bool shaderAccess = false;
+			for (const Group& group : groups) {
+				for (const Pass::Use& use : group.pass->uses) {
+					if (use.resource != i) {
+						continue;
+					}
+					switch (use.access) {
+					case Pass::Access::ColorOutput:
+						image.usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+						break;
+					case Pass::Access::DepthStencilOutput:
+						image.usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+						break;
+					case Pass::Access::Sampled:
+						image.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+						shaderAccess = true;
+						break;
+					case Pass::Access::StorageOutput:
+						image.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+						shaderAccess = true;
+						break;
+					}
+				}
+			}
+			// Images that never leave a single render pass don't need to be stored to memory
+			if (!shaderAccess && (image.firstGroup == image.lastGroup)) {
+				image.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+				image.lazy = true;
+			}
+
+			VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+			imageCI.imageType = VK_IMAGE_TYPE_2D;
+			imageCI.format = image.format;
+			imageCI.extent = { image.extent.width, image.extent.height, 1 };
+			imageCI.mipLevels = 1;
+			imageCI.arrayLayers = 1;
+			imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageCI.usage = image.usage;
+			imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCI, nullptr, &image.image));
+			vkGetImageMemoryRequirements(device->logicalDevice, image.image, &image.memReqs);
+			statistics.images++;
+			statistics.unaliasedMemory += image.memReqs.size;
+		}
+	}
+
+	/** @brief Images are placed into shared memory blocks (largest first), an image can use a block if its lifetime doesn't overlap with the block's other images */
+	void RenderGraph::allocateMemory()
+	{
+		std::vector<Resource> order;
+		for (uint32_t i = 0; i < images.size(); i++) {
+			if (images[i].used) {
+				order.push_back(i);
+			}
+		}
+		std::sort(order.begin(), order.end(), [this](Resource a, Resource b) { return images[a].memReqs.size > images[b].memReqs.size; });
+
+		for (Resource resource : order) {
+			Image& image = images[resource];
+			if (image.lazy) {
+				VkBool32 found = VK_FALSE;
+				device->getMemoryType(image.memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &found);
+				image.lazy = (found == VK_TRUE);
+			}
+			uint32_t blockIndex = static_cast<uint32_t>(memoryBlocks.size());
+			for (uint32_t i = 0; i < memoryBlocks.size(); i++) {
+				const MemoryBlock& block = memoryBlocks[i];
+				if ((block.lazy != image.lazy) || ((block.memoryTypeBits & image.memReqs.memoryTypeBits) == 0)) {
+					continue;
+				}
+				bool overlaps = false;
+				for (Resource other : block.images) {
+					if ((images[other].firstGroup <= image.lastGroup) && (image.firstGroup <= images[other].lastGroup)) {
+						overlaps = true;
+						break;
+					}
+				}
+				if (!overlaps) {
+					blockIndex = i;
+					break;
+				}
+			}
+			if (blockIndex == memoryBlocks.size()) {
+				MemoryBlock block;
+				block.lazy = image.lazy;
+				memoryBlocks.push_back(block);
+			}
+			MemoryBlock& block = memoryBlocks[blockIndex];
+			block.images.push_back(resource);
+			block.memoryTypeBits &= image.memReqs.memoryTypeBits;
+			// Images are bound at offset zero, which satisfies every alignment
+			block.size = std::max(block.size, image.memReqs.size);
+			image.memoryBlock = blockIndex;
+		}
+
+		for (MemoryBlock& block : memoryBlocks) {
+			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+			memAlloc.allocationSize = block.size;
+			memAlloc.memoryTypeIndex = device->getMemoryType(block.memoryTypeBits, block.lazy ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &block.memory));
+			statistics.memory += block.size;
+			for (Resource resource : block.images) {
+				Image& image = images[resource];
+				VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, image.image, block.memory, 0));
+				VkImageViewCreateInfo imageViewCI = vks::initializers::imageViewCreateInfo();
+				imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+				imageViewCI.format = image.format;
+				imageViewCI.subresourceRange = { aspectMask(resource), 0, 1, 0, 1 };
+				imageViewCI.image = image.image;
+				VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &imageViewCI, nullptr, &image.view));
+				if (image.lazy) {
+					statistics.lazyImages++;
+				}
+			}
+		}
+		statistics.memoryBlocks = static_cast<uint32_t>(memoryBlocks.size());
+	}
+
+	/** @brief Creates (or fetches from the cache) the render pass for a pass with attachments and its framebuffer */
+	void RenderGraph::createRenderPass(uint32_t groupIndex)
+	{
+		Group& group = groups[groupIndex];
+		Pass* pass = group.pass;
+
+		// Attachments in the order they have been declared
+		std::vector<Resource> attachments;
+		std::vector<VkAttachmentDescription> attachmentDescriptions;
+		std::vector<VkAttachmentReference> colorReferences;
+		VkAttachmentReference depthReference = { VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+		for (const Pass::Use& use : pass->uses) {
+			if (!Pass::isAttachment(use.access)) {
+				continue;
+			}
+			const uint32_t index = static_cast<uint32_t>(attachments.size());
+			const Image& image = images[use.resource];
+			const GroupUse& groupUse = *std::find_if(group.uses.begin(), group.uses.end(), [&use](const GroupUse& other) { return other.resource == use.resource; });
+			// Contents are only stored if a later pass reads them
+			const VkAttachmentStoreOp storeOp = ((image.lastGroup > groupIndex) || pass->sideEffect) ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			const bool hasStencil = vks::tools::formatHasStencil(image.format);
+			VkAttachmentDescription description{};
+			description.format = image.format;
+			description.samples = VK_SAMPLE_COUNT_1_BIT;
+			description.loadOp = use.loadOp;
+			description.storeOp = storeOp;
+			description.stencilLoadOp = hasStencil ? use.loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			description.stencilStoreOp = hasStencil ? storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			// Transitions into and out of the render pass are done with the graph's barriers
+			description.initialLayout = groupUse.first.layout;
+			description.finalLayout = groupUse.last.layout;
+			attachments.push_back(use.resource);
+			attachmentDescriptions.push_back(description);
+			group.clearValues.push_back(use.clearValue);
+			if (use.access == Pass::Access::ColorOutput) {
+				colorReferences.push_back({ index, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+			} else {
+				depthReference = { index, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+			}
+		}
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+		subpass.pColorAttachments = colorReferences.data();
+		subpass.pDepthStencilAttachment = (depthReference.attachment != VK_ATTACHMENT_UNUSED) ? &depthReference : nullptr;
+
+		// Render passes with the same description are shared, which also keeps pipelines valid across compiles
+		std::vector<uint32_t> key;
+		for (const VkAttachmentDescription& description : attachmentDescriptions) {
+			key.insert(key.end(), { static_cast<uint32_t>(description.format), static_cast<uint32_t>(description.loadOp), static_cast<uint32_t>(description.storeOp), static_cast<uint32_t>(description.initialLayout), static_cast<uint32_t>(description.finalLayout) });
+		}
+		key.push_back(~0u);
+		for (const VkAttachmentReference& reference : colorReferences) {
+			key.push_back(reference.attachment);
+		}
+		key.push_back(depthReference.attachment);
+		auto cached = renderPassCache.find(key);
+		if (cached != renderPassCache.end()) {
+			group.renderPass = cached->second;
+		} else {
+			VkRenderPassCreateInfo renderPassCI{};
+			renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+			renderPassCI.attachmentCount = static_cast<uint32_t>(attachmentDescriptions.size());
+			renderPassCI.pAttachments = attachmentDescriptions.data();
+			renderPassCI.subpassCount = 1;
+			renderPassCI.pSubpasses = &subpass;
+			VK_CHECK_RESULT(vkCreateRenderPass(device->logicalDevice, &renderPassCI, nullptr, &group.renderPass));
+			renderPassCache[key] = group.renderPass;
+		}
+		pass->renderPass = group.renderPass;
+
+		std::vector<VkImageView> views;
+		for (Resource resource : attachments) {
+			views.push_back(images[resource].view);
+		}
+		VkFramebufferCreateInfo framebufferCI = vks::initializers::framebufferCreateInfo();
+		framebufferCI.renderPass = group.renderPass;
+		framebufferCI.attachmentCount = static_cast<uint32_t>(views.size());
+		framebufferCI.pAttachments = views.data();
+		framebufferCI.width = group.extent.width;
+		framebufferCI.height = group.extent.height;
+		framebufferCI.layers = 1;
+		VK_CHECK_RESULT(vkCreateFramebuffer(device->logicalDevice, &framebufferCI, nullptr, &group.framebuffer));
+	}
+
+	/**
+	* Simulates the image states of one frame and derives the barriers required before each group
+	* The first use of an image in a frame discards its contents, it only has to wait for the last use of the memory it shares with other images (which may be in the previous frame)
+	*/
+	void RenderGraph::computeBarriers()
+	{
+		// State of each image after its last use in the frame
+		std::vector<ImageState> lastStates(images.size());
+		for (const Group& group : groups) {
+			for (const GroupUse& groupUse : group.uses) {
+				lastStates[groupUse.resource] = groupUse.last;
+			}
+		}
+
+		std::vector<ImageState> states(images.size());
+		std::vector<bool> touched(images.size(), false);
+		for (Group& group : groups) {
+			for (const GroupUse& groupUse : group.uses) {
+				const Resource resource = groupUse.resource;
+				const Image& image = images[resource];
+				VkImageLayout oldLayout;
+				VkPipelineStageFlags srcStageMask;
+				VkAccessFlags srcAccessMask;
+				if (!touched[resource]) {
+					// Wait for the image that used the memory last, or for the last user of the block in the previous frame
+					Resource predecessor = resource;
+					int32_t predecessorLast = -1;
+					for (Resource other : memoryBlocks[image.memoryBlock].images) {
+						if ((images[other].lastGroup < image.firstGroup) && (static_cast<int32_t>(images[other].lastGroup) > predecessorLast)) {
+							predecessor = other;
+							predecessorLast = static_cast<int32_t>(images[other].lastGroup);
+						}
+					}
+					if (predecessorLast < 0) {
+						for (Resource other : memoryBlocks[image.memoryBlock].images) {
+							if (images[other].lastGroup > images[predecessor].lastGroup) {
+								predecessor = other;
+							}
+						}
+					}
+					oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+					srcStageMask = lastStates[predecessor].stageMask;
+					srcAccessMask = lastStates[predecessor].accessMask & writeAccessMask;
+				} else {
+					const ImageState& state = states[resource];
+					const bool hazard = ((state.accessMask | groupUse.first.accessMask) & writeAccessMask) != 0;
+					if ((state.layout == groupUse.first.layout) && !hazard) {
+						// Consecutive reads don't need a barrier, but the next write has to wait for all of them
+						states[resource].layout = groupUse.last.layout;
+						states[resource].stageMask |= groupUse.last.stageMask;
+						states[resource].accessMask |= groupUse.last.accessMask;
+						continue;
+					}
+					oldLayout = state.layout;
+					srcStageMask = state.stageMask;
+					srcAccessMask = state.accessMask & writeAccessMask;
+				}
+
+				VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+				barrier.srcAccessMask = srcAccessMask;
+				barrier.dstAccessMask = groupUse.first.accessMask;
+				barrier.oldLayout = oldLayout;
+				barrier.newLayout = groupUse.first.layout;
+				barrier.image = image.image;
+				barrier.subresourceRange = { aspectMask(resource), 0, 1, 0, 1 };
+				group.barriers.push_back(barrier);
+				group.srcStageMask |= (srcStageMask != 0) ? srcStageMask : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+				group.dstStageMask |= groupUse.first.stageMask;
+
+				states[resource] = groupUse.last;
+				touched[resource] = true;
+			}
+			statistics.imageBarriers += static_cast<uint32_t>(group.barriers.size());
+			statistics.barrierBatches += group.barriers.empty() ? 0 : 1;
+		}
+	}
+
+	VkImageAspectFlags RenderGraph::aspectMask(Resource image) const
+	{
+		const VkFormat format = images[image].format;
+		if (isDepthFormat(format)) {
+			return VK_IMAGE_ASPECT_DEPTH_BIT | (vks::tools::formatHasStencil(format) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+		}
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+}
@@ -0,0 +1,188 @@
+/*
+* Vulkan render graph
+*
+* Passes declare the images they write and read, the graph then derives render passes, framebuffers, layout transitions and barriers from these declarations
+* Passes that don't contribute to a pass with side effects are culled and images whose lifetimes don't overlap share memory
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <string>
+#include <functional>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+
+namespace vks
+{
+	/**
+	* @brief Frame graph for offscreen passes with automatic synchronization and transient image aliasing
+	* @note Build the graph (createImage(), addPass()), compile() it and call execute() when recording a command buffer
+	* @note Render passes are cached across compiles, so pipelines created for a pass stay valid after recompiling (e.g. on resize)
+	* @note Graphics passes get a viewport and scissor covering their attachments, so their pipelines need to use dynamic viewport and scissor state
+	*/
+	class RenderGraph
+	{
+	public:
+		/** @brief Handle of an image owned by the graph */
+		typedef uint32_t Resource;
+
+		struct Statistics
+		{
+			uint32_t passes = 0;
+			uint32_t culledPasses = 0;
+			uint32_t renderPasses = 0;
+			/** @brief Number of image memory barriers and pipeline barrier commands recorded by execute() */
+			uint32_t imageBarriers = 0;
+			uint32_t barrierBatches = 0;
+			uint32_t images = 0;
+			/** @brief Images that only live within a single render pass and are backed by lazily allocated memory (if the device supports it) */
+			uint32_t lazyImages = 0;
+			uint32_t memoryBlocks = 0;
+			/** @brief Bytes of device memory allocated for all images */
+			VkDeviceSize memory = 0;
+			/** @brief Bytes that would be required if every image had its own allocation */
+			VkDeviceSize unaliasedMemory = 0;
+		};
+
+		class Pass
+		{
+		public:
+			/** @brief Render to a color attachment, with VK_ATTACHMENT_LOAD_OP_LOAD the pass also depends on the image's previous writer */
+			void addColorOutput(Resource image, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearColorValue clearValue = {});
+			void setDepthStencilOutput(Resource image, VkAttachmentLoadOp loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR, VkClearDepthStencilValue clearValue = { 1.0f, 0 });
+			/** @brief Read an image through a sampler */
+			void addSampledInput(Resource image, VkPipelineStageFlags stageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+			/** @brief Write an image as a storage image (e.g. from a compute shader), the image is in VK_IMAGE_LAYOUT_GENERAL during the pass */
+			void addStorageOutput(Resource image, VkPipelineStageFlags stageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			/** @brief Passes with side effects (e.g. rendering to the swap chain) are never culled and keep all of their inputs alive */
+			void setSideEffect();
+			/** @brief Called by execute(), graphics passes are recorded within their render pass */
+			void setRecordCallback(std::function<void(VkCommandBuffer commandBuffer)> callback);
+
+			/** @brief Render pass the pass is recorded in, only valid after compiling and for passes with attachments */
+			VkRenderPass getRenderPass() const;
+			bool isCulled() const;
+			const std::string& getName() const;
+		private:
+			friend class RenderGraph;
+			enum class Access { ColorOutput, DepthStencilOutput, Sampled, StorageOutput };
+			struct Use
+			{
+				Resource resource;
+				Access access;
+				VkAttachmentLoadOp loadOp;
+				VkClearValue clearValue;
+				VkPipelineStageFlags stageMask;
+			};
+			std::string name;
+			std::vector<Use> uses;
+			std::function<void(VkCommandBuffer)> recordCallback;
+			bool sideEffect = false;
+			bool culled = false;
+			VkRenderPass renderPass = VK_NULL_HANDLE;
+			static bool isAttachment(Access access);
+			bool hasAttachments() const;
+			bool writes(Resource resource) const;
+			bool readsPrevious(Resource resource) const;
+		};
+
+		void create(vks::VulkanDevice* device);
+		void destroy();
+		void reset();
+		void setExtent(uint32_t width, uint32_t height);
+		Resource createImage(const std::string& name, VkFormat format, float scale = 1.0f);
+		Pass& addPass(const std::string& name);
+		void compile();
+		void execute(VkCommandBuffer commandBuffer);
+		VkImage getImage(Resource image) const;
+		VkImageView getImageView(Resource image) const;
+		VkExtent2D getImageExtent(Resource image) const;
+		Statistics getStatistics() const;
+	private:
+		struct Image
+		{
+			std::string name;
+			VkFormat format;
+			float scale;
+			VkExtent2D extent = {};
+			VkImageUsageFlags usage = 0;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkMemoryRequirements memReqs = {};
+			bool used = false;
+			bool lazy = false;
+			// First and last group using the image in the current frame
+			uint32_t firstGroup = 0;
+			uint32_t lastGroup = 0;
+			uint32_t memoryBlock = 0;
+		};
+
+		struct MemoryBlock
+		{
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize size = 0;
+			uint32_t memoryTypeBits = ~0u;
+			bool lazy = false;
+			std::vector<Resource> images;
+		};
+
+		/** @brief Layout, stages and accesses of an image within a pass */
+		struct ImageState
+		{
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkPipelineStageFlags stageMask = 0;
+			VkAccessFlags accessMask = 0;
+		};
+
+		struct GroupUse
+		{
+			Resource resource;
+			ImageState first;
+			ImageState last;
+		};
+
+		/** @brief A pass that survived culling, with the render pass and framebuffer for its attachments (if it has any) */
+		struct Group
+		{
+			Pass* pass = nullptr;
+			std::vector<GroupUse> uses;
+			VkExtent2D extent = {};
+			VkRenderPass renderPass = VK_NULL_HANDLE;
+			VkFramebuffer framebuffer = VK_NULL_HANDLE;
+			std::vector<VkClearValue> clearValues;
+			VkPipelineStageFlags srcStageMask = 0;
+			VkPipelineStageFlags dstStageMask = 0;
+			std::vector<VkImageMemoryBarrier> barriers;
+		};
+
+		vks::VulkanDevice* device = nullptr;
+		VkExtent2D extent = {};
+		std::vector<Image> images;
+		std::vector<std::unique_ptr<Pass>> passes;
+		std::vector<Group> groups;
+		std::vector<MemoryBlock> memoryBlocks;
+		// Render passes are kept for the lifetime of the graph, keyed by their attachment description
+		std::map<std::vector<uint32_t>, VkRenderPass> renderPassCache;
+		Statistics statistics;
+
+		void releaseResources();
+		void cullPasses();
+		void buildGroups();
+		void collectGroupUses(Group& group);
+		void createImages();
+		void allocateMemory();
+		void createRenderPass(uint32_t groupIndex);
+		void computeBarriers();
+		VkImageAspectFlags aspectMask(Resource image) const;
+	};
+}
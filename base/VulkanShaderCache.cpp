@@ -0,0 +1,284 @@
+/*
+* Vulkan shader module cache
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanShaderCache.h"
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vks
+{
+	namespace
+	{
+		// FNV-1a over 32 bit words (SPIR-V is always a multiple of four bytes)
+		uint64_t hashCode(const uint8_t* data, size_t size)
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			const size_t words = size / sizeof(uint32_t);
+			for (size_t i = 0; i < words; i++) {
+				uint32_t word;
+				memcpy(&word, data + i * sizeof(uint32_t), sizeof(uint32_t));
+				hash = (hash ^ word) * 0x100000001b3ull;
+			}
+			return (hash ^ size) * 0x100000001b3ull;
+		}
+
+		double elapsed(std::chrono::high_resolution_clock::time_point start)
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	/** @brief Map a file, returns false if the file can't be opened or is empty */
+	bool MappedFile::open(const std::string& filename)
+	{
+		close();
+#if defined(_WIN32)
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart == 0)) {
+			close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL) {
+			close();
+			return false;
+		}
+		mapped = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		length = static_cast<size_t>(fileSize.QuadPart);
+#elif defined(__ANDROID__)
+		asset = AAssetManager_open(androidApp->activity->assetManager, filename.c_str(), AASSET_MODE_BUFFER);
+		if (!asset) {
+			return false;
+		}
+		mapped = static_cast<const uint8_t*>(AAsset_getBuffer(asset));
+		length = AAsset_getLength(asset);
+#else
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat fileStat;
+		if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size == 0)) {
+			::close(fd);
+			return false;
+		}
+		length = static_cast<size_t>(fileStat.st_size);
+		mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		// The mapping stays valid after closing the descriptor
+		::close(fd);
+		if (mapping == MAP_FAILED) {
+			mapping = nullptr;
+			length = 0;
+			return false;
+		}
+		mapped = static_cast<const uint8_t*>(mapping);
+#endif
+		if (!mapped) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+#if defined(_WIN32)
+		if (mapped) {
+			UnmapViewOfFile(mapped);
+		}
+		if (mapping != NULL) {
+			CloseHandle(mapping);
+			mapping = NULL;
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+#elif defined(__ANDROID__)
+		if (asset) {
+			AAsset_close(asset);
+			asset = nullptr;
+		}
+#else
+		if (mapping) {
+			munmap(mapping, length);
+			mapping = nullptr;
+		}
+#endif
+		mapped = nullptr;
+		length = 0;
+	}
+
+	const uint8_t* MappedFile::data() const
+	{
+		return mapped;
+	}
+
+	size_t MappedFile::size() const
+	{
+		return length;
+	}
+
+	void ShaderCache::create(VkDevice device)
+	{
+		this->device = device;
+	}
+
+	/** @brief Destroys all shader modules, must be called before the device is destroyed */
+	void ShaderCache::destroy()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto& module : modules) {
+			vkDestroyShaderModule(device, module.second->module, nullptr);
+		}
+		modules.clear();
+		paths.clear();
+	}
+
+	/** @brief Returns the shader module for a SPIR-V file, the module is created on first use. Returns VK_NULL_HANDLE if the file can't be read */
+	VkShaderModule ShaderCache::get(const std::string& filename)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			statistics.requests++;
+			auto it = paths.find(filename);
+			if (it != paths.end()) {
+				statistics.pathHits++;
+				return it->second->module;
+			}
+		}
+		return load(filename);
+	}
+
+	/** @brief Returns the create info of a module loaded before, only available with retainCode enabled */
+	const VkShaderModuleCreateInfo* ShaderCache::getCreateInfo(const std::string& filename)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = paths.find(filename);
+		if ((it == paths.end()) || it->second->code.empty()) {
+			return nullptr;
+		}
+		return &it->second->createInfo;
+	}
+
+	VkShaderModule ShaderCache::load(const std::string& filename)
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		MappedFile file;
+		if (!file.open(filename)) {
+			std::cerr << "Error: Could not open shader file \"" << filename << "\"" << "\n";
+			return VK_NULL_HANDLE;
+		}
+		assert(file.size() % sizeof(uint32_t) == 0);
+		const uint64_t key = hashCode(file.data(), file.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			statistics.bytesRead += file.size();
+			statistics.readTime += elapsed(tStart);
+			auto it = modules.find(key);
+			if (it != modules.end()) {
+				statistics.contentHits++;
+				paths[filename] = it->second.get();
+				return it->second->module;
+			}
+		}
+
+		// The module is created outside of the lock, so preloading threads don't serialize on the driver
+		auto tCreate = std::chrono::high_resolution_clock::now();
+		std::unique_ptr<Module> module(new Module());
+		VkShaderModuleCreateInfo& moduleCreateInfo = module->createInfo;
+		moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		moduleCreateInfo.codeSize = file.size();
+		// Mapped memory is page aligned, the code only needs to be copied if it's kept or not suitably aligned
+		if (retainCode || (reinterpret_cast<uintptr_t>(file.data()) % sizeof(uint32_t) != 0)) {
+			module->code.resize(file.size() / sizeof(uint32_t));
+			memcpy(module->code.data(), file.data(), file.size());
+			moduleCreateInfo.pCode = module->code.data();
+		} else {
+			moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(file.data());
+		}
+		VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &module->module));
+		if (!retainCode) {
+			module->code.clear();
+			module->code.shrink_to_fit();
+			moduleCreateInfo.pCode = nullptr;
+		}
+		file.close();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		statistics.createTime += elapsed(tCreate);
+		auto it = modules.find(key);
+		if (it != modules.end()) {
+			// Another thread created a module for the same content in the meantime
+			vkDestroyShaderModule(device, module->module, nullptr);
+			statistics.contentHits++;
+			paths[filename] = it->second.get();
+			return it->second->module;
+		}
+		statistics.misses++;
+		Module* cached = module.get();
+		modules[key] = std::move(module);
+		paths[filename] = cached;
+		return cached->module;
+	}
+
+	/**
+	* Load a list of shader files using multiple threads
+	*
+	* @param filenames Shader files to load, files that have already been loaded are skipped
+	* @param threadCount Number of threads to use, zero uses all hardware threads
+	*/
+	void ShaderCache::preload(const std::vector<std::string>& filenames, uint32_t threadCount)
+	{
+		if (threadCount == 0) {
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		}
+		threadCount = std::min(threadCount, static_cast<uint32_t>(filenames.size()));
+		std::atomic<uint32_t> next(0);
+		auto loadFiles = [this, &filenames, &next]() {
+			for (uint32_t i = next++; i < filenames.size(); i = next++) {
+				get(filenames[i]);
+			}
+		};
+		std::vector<std::thread> threads;
+		for (uint32_t i = 0; i < threadCount; i++) {
+			threads.push_back(std::thread(loadFiles));
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		statistics.preloaded += static_cast<uint32_t>(filenames.size());
+	}
+
+	ShaderCache::Statistics ShaderCache::getStatistics()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return statistics;
+	}
+
+	uint32_t ShaderCache::getModuleCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return static_cast<uint32_t>(modules.size());
+	}
+}
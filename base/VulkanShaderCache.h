@@ -0,0 +1,109 @@
+/*
+* Vulkan shader module cache
+*
+* Deduplicates shader modules by file name and by SPIR-V content, so loading the same shader for multiple pipelines only reads the file and creates the module once
+* Shader files are memory mapped and can be preloaded on multiple threads
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#endif
+
+namespace vks
+{
+	/** @brief Read-only memory mapping of a file (or asset on Android) */
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile();
+		bool open(const std::string& filename);
+		void close();
+		const uint8_t* data() const;
+		size_t size() const;
+	private:
+		const uint8_t* mapped = nullptr;
+		size_t length = 0;
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#elif defined(__ANDROID__)
+		AAsset* asset = nullptr;
+#else
+		void* mapping = nullptr;
+#endif
+	};
+
+	/**
+	* @brief Cache for shader modules loaded from SPIR-V files
+	* @note Modules are looked up by file name first, files not loaded before are read and hashed, so identical SPIR-V stored in different files shares a single module
+	* @note The cache owns all modules, they stay valid until destroy() is called
+	* @note All functions are thread safe
+	*/
+	class ShaderCache
+	{
+	public:
+		/** @brief Counters since creation, times are in milliseconds and summed up across threads */
+		struct Statistics
+		{
+			uint32_t requests = 0;
+			/** @brief Requests for a file name that has been loaded before */
+			uint32_t pathHits = 0;
+			/** @brief Requests for a new file name with content matching an existing module */
+			uint32_t contentHits = 0;
+			/** @brief Requests that created a new module */
+			uint32_t misses = 0;
+			uint32_t preloaded = 0;
+			uint64_t bytesRead = 0;
+			double readTime = 0.0;
+			double createTime = 0.0;
+		};
+
+		/** @brief Keep the SPIR-V of all modules in memory, so getCreateInfo() can be used (e.g. for pipeline libraries that consume the code directly) */
+		bool retainCode = false;
+
+		void create(VkDevice device);
+		void destroy();
+		VkShaderModule get(const std::string& filename);
+		const VkShaderModuleCreateInfo* getCreateInfo(const std::string& filename);
+		void preload(const std::vector<std::string>& filenames, uint32_t threadCount = 0);
+		Statistics getStatistics();
+		uint32_t getModuleCount();
+	private:
+		struct Module
+		{
+			VkShaderModule module = VK_NULL_HANDLE;
+			std::vector<uint32_t> code;
+			VkShaderModuleCreateInfo createInfo{};
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		std::mutex mutex;
+		// Modules by content hash (including the code size)
+		std::unordered_map<uint64_t, std::unique_ptr<Module>> modules;
+		std::unordered_map<std::string, Module*> paths;
+		Statistics statistics;
+
+		VkShaderModule load(const std::string& filename);
+	};
+}
@@ -0,0 +1,735 @@
+/*
+* Streaming quadtree terrain
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTerrain.h"
+
+#include <ktx.h>
+#include <cfloat>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vks
+{
+	/*
+		Tile file
+	*/
+
+	TerrainTileFile::~TerrainTileFile()
+	{
+		close();
+	}
+
+	void TerrainTileFile::getTileIndexBases(const Header& header, std::vector<size_t>& bases, size_t& tileCount)
+	{
+		bases.resize(header.levels);
+		tileCount = 0;
+		for (uint32_t level = 0; level < header.levels; level++) {
+			bases[level] = tileCount;
+			const size_t tilesPerSide = (header.dim / header.tileSize) >> level;
+			tileCount += tilesPerSide * tilesPerSide;
+		}
+	}
+
+	bool TerrainTileFile::create(const std::string& filename, const std::string& heightmapFilename, uint32_t dim, uint32_t tileSize, float samplesPerRepeat)
+	{
+		// The tile count per side needs to be a power of two, so the coarsest level is a single tile
+		const uint32_t rootTiles = dim / tileSize;
+		if ((dim % tileSize != 0) || (rootTiles & (rootTiles - 1)) != 0) {
+			std::cerr << "Terrain size " << dim << " is not a power of two multiple of the tile size " << tileSize << "\n";
+			return false;
+		}
+
+		// Load the source heightmap
+		ktxResult result;
+		ktxTexture* ktxTexture;
+#if defined(__ANDROID__)
+		AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, heightmapFilename.c_str(), AASSET_MODE_STREAMING);
+		if (!asset) {
+			return false;
+		}
+		size_t assetSize = AAsset_getLength(asset);
+		ktx_uint8_t* textureData = new ktx_uint8_t[assetSize];
+		AAsset_read(asset, textureData, assetSize);
+		AAsset_close(asset);
+		result = ktxTexture_CreateFromMemory(textureData, assetSize, KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &ktxTexture);
+		delete[] textureData;
+#else
+		result = ktxTexture_CreateFromNamedFile(heightmapFilename.c_str(), KTX_TEXTURE_CREATE_LOAD_IMAGE_DATA_BIT, &ktxTexture);
+#endif
+		if (result != KTX_SUCCESS) {
+			std::cerr << "Could not load heightmap " << heightmapFilename << "\n";
+			return false;
+		}
+		const uint32_t sourceWidth = ktxTexture->baseWidth;
+		const uint32_t sourceHeight = ktxTexture->baseHeight;
+		std::vector<uint16_t> source(sourceWidth * sourceHeight);
+		memcpy(source.data(), ktxTexture_GetData(ktxTexture), std::min(ktxTexture_GetImageSize(ktxTexture, 0), source.size() * sizeof(uint16_t)));
+		ktxTexture_Destroy(ktxTexture);
+
+		// Heights of level 0 are generated on the fly by repeating the source with mirroring and bilinear filtering (same as the heightmap sampler of the tessellation example)
+		// The source is centered on the terrain, so the center of the terrain matches the tessellated patch
+		auto mirror = [](float t) {
+			t = fmodf(t, 2.0f);
+			if (t < 0.0f) {
+				t += 2.0f;
+			}
+			return (t > 1.0f) ? 2.0f - t : t;
+		};
+		auto sampleSource = [&](uint32_t x, uint32_t y) -> uint16_t {
+			const float fx = mirror(((float)x - dim * 0.5f) / samplesPerRepeat + 0.5f) * sourceWidth - 0.5f;
+			const float fy = mirror(((float)y - dim * 0.5f) / samplesPerRepeat + 0.5f) * sourceHeight - 0.5f;
+			const int32_t x0 = std::max(0, std::min((int32_t)floorf(fx), (int32_t)sourceWidth - 1));
+			const int32_t y0 = std::max(0, std::min((int32_t)floorf(fy), (int32_t)sourceHeight - 1));
+			const int32_t x1 = std::min(x0 + 1, (int32_t)sourceWidth - 1);
+			const int32_t y1 = std::min(y0 + 1, (int32_t)sourceHeight - 1);
+			const float tx = std::max(0.0f, std::min(fx - x0, 1.0f));
+			const float ty = std::max(0.0f, std::min(fy - y0, 1.0f));
+			const float h0 = source[x0 + y0 * sourceWidth] * (1.0f - tx) + source[x1 + y0 * sourceWidth] * tx;
+			const float h1 = source[x0 + y1 * sourceWidth] * (1.0f - tx) + source[x1 + y1 * sourceWidth] * tx;
+			return (uint16_t)(h0 * (1.0f - ty) + h1 * ty + 0.5f);
+		};
+
+		Header header = {};
+		header.magic = fileMagic;
+		header.version = fileVersion;
+		header.dim = dim;
+		header.tileSize = tileSize;
+		header.levels = 1;
+		while ((1u << (header.levels - 1)) < rootTiles) {
+			header.levels++;
+		}
+
+		std::vector<size_t> bases;
+		size_t tileCount;
+		getTileIndexBases(header, bases, tileCount);
+
+		std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "Could not create terrain tile file " << filename << "\n";
+			return false;
+		}
+		file.write((const char*)&header, sizeof(Header));
+
+		// Tiles of all levels, finest level first, followed by the min/max height of every tile
+		const uint32_t tileDim = tileSize + 1;
+		std::vector<uint16_t> tile(tileDim * tileDim);
+		std::vector<uint16_t> ranges(tileCount * 2);
+		size_t tileIndex = 0;
+		for (uint32_t level = 0; level < header.levels; level++) {
+			const uint32_t tilesPerSide = rootTiles >> level;
+			const uint32_t levelDim = dim >> level;
+			for (uint32_t ty = 0; ty < tilesPerSide; ty++) {
+				for (uint32_t tx = 0; tx < tilesPerSide; tx++) {
+					uint16_t minHeight = UINT16_MAX;
+					uint16_t maxHeight = 0;
+					for (uint32_t y = 0; y < tileDim; y++) {
+						for (uint32_t x = 0; x < tileDim; x++) {
+							// Border samples of the last tile are clamped to the edge of the terrain
+							const uint32_t sx = std::min(tx * tileSize + x, levelDim - 1) << level;
+							const uint32_t sy = std::min(ty * tileSize + y, levelDim - 1) << level;
+							const uint16_t height = sampleSource(sx, sy);
+							tile[x + y * tileDim] = height;
+							minHeight = std::min(minHeight, height);
+							maxHeight = std::max(maxHeight, height);
+						}
+					}
+					file.write((const char*)tile.data(), tile.size() * sizeof(uint16_t));
+					ranges[tileIndex * 2] = minHeight;
+					ranges[tileIndex * 2 + 1] = maxHeight;
+					tileIndex++;
+				}
+			}
+		}
+		file.write((const char*)ranges.data(), ranges.size() * sizeof(uint16_t));
+		return file.good();
+	}
+
+	bool TerrainTileFile::open(const std::string& filename, uint32_t dim, uint32_t tileSize)
+	{
+		close();
+#if defined(_WIN32)
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		file = ::open(filename.c_str(), O_RDONLY);
+		if (file < 0) {
+			return false;
+		}
+		struct stat fileStat;
+		fstat(file, &fileStat);
+		size = (size_t)fileStat.st_size;
+		if (size > 0) {
+			void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapped != MAP_FAILED) {
+				data = (const uint8_t*)mapped;
+				// Tiles are accessed in a view dependent order
+				madvise(mapped, size, MADV_RANDOM);
+			}
+		}
+#endif
+		if (!data || size < sizeof(Header)) {
+			close();
+			return false;
+		}
+
+		// Only use the file if it matches the requested layout, otherwise it needs to be recreated
+		memcpy(&header, data, sizeof(Header));
+		size_t tileCount = 0;
+		bool valid = (header.magic == fileMagic) && (header.version == fileVersion) && (header.dim == dim) && (header.tileSize == tileSize) && (header.levels > 0);
+		if (valid) {
+			getTileIndexBases(header, levelTileOffsets, tileCount);
+			rangesOffset = sizeof(Header) + tileCount * getTileBytes();
+			valid = (size == rangesOffset + tileCount * 2 * sizeof(uint16_t));
+		}
+		if (!valid) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void TerrainTileFile::close()
+	{
+#if defined(_WIN32)
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping) {
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (data) {
+			munmap((void*)data, size);
+		}
+		if (file >= 0) {
+			::close(file);
+			file = -1;
+		}
+#endif
+		data = nullptr;
+		size = 0;
+		header = {};
+	}
+
+	size_t TerrainTileFile::getTileIndex(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		assert(level < header.levels);
+		return levelTileOffsets[level] + y * getTilesPerSide(level) + x;
+	}
+
+	const uint16_t* TerrainTileFile::getTile(uint32_t level, uint32_t x, uint32_t y) const
+	{
+		return (const uint16_t*)(data + sizeof(Header) + getTileIndex(level, x, y) * getTileBytes());
+	}
+
+	void TerrainTileFile::getTileRange(uint32_t level, uint32_t x, uint32_t y, uint16_t& minHeight, uint16_t& maxHeight) const
+	{
+		const uint16_t* range = (const uint16_t*)(data + rangesOffset) + getTileIndex(level, x, y) * 2;
+		minHeight = range[0];
+		maxHeight = range[1];
+	}
+
+	/*
+		Quadtree terrain
+	*/
+
+	// Number of tiles that can be in flight between the loader thread and the GPU
+	static const uint32_t stagingSlotCount = 32;
+	// Morph ranges of the coarsest level, which is always selected
+	static const float maxRange = 1.0e30f;
+
+	void QuadtreeTerrain::create(vks::VulkanDevice* device, VkQueue queue, const TerrainTileFile* tileFile, uint32_t cacheSize, uint32_t maxInstances)
+	{
+		this->device = device;
+		this->queue = queue;
+		this->tileFile = tileFile;
+		this->maxInstances = maxInstances;
+		const uint32_t tileDim = tileFile->getTileSize() + 1;
+		cacheSize = std::min(cacheSize, device->properties.limits.maxImageArrayLayers);
+
+		// Tile cache
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = VK_FORMAT_R16_UNORM;
+		imageCI.extent = { tileDim, tileDim, 1 };
+		imageCI.mipLevels = 1;
+		imageCI.arrayLayers = cacheSize;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		VK_CHECK_RESULT(vkCreateImage(device->logicalDevice, &imageCI, nullptr, &cacheImage));
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device->logicalDevice, cacheImage, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &cacheMemory));
+		VK_CHECK_RESULT(vkBindImageMemory(device->logicalDevice, cacheImage, cacheMemory, 0));
+		statistics.cacheMemory = memReqs.size;
+
+		VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+		viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		viewCI.format = VK_FORMAT_R16_UNORM;
+		viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, cacheSize };
+		viewCI.image = cacheImage;
+		VK_CHECK_RESULT(vkCreateImageView(device->logicalDevice, &viewCI, nullptr, &cacheView));
+
+		// Heights are sampled at texel centers, linear filtering is only used for vertices that are morphing or drawn from an ancestor's tile
+		VkSamplerCreateInfo samplerCI = vks::initializers::samplerCreateInfo();
+		samplerCI.magFilter = VK_FILTER_LINEAR;
+		samplerCI.minFilter = VK_FILTER_LINEAR;
+		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.maxLod = 0.0f;
+		samplerCI.maxAnisotropy = 1.0f;
+		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(device->logicalDevice, &samplerCI, nullptr, &cacheSampler));
+		tileCacheDescriptor = { cacheSampler, cacheView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+		slots.resize(cacheSize);
+		slotLookup.clear();
+
+		// Staging slots, persistently mapped so the loader thread can copy tiles straight into them
+		stagingSlotSize = (tileFile->getTileBytes() + 15) & ~(VkDeviceSize)15;
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, stagingSlotSize * stagingSlotCount));
+		VK_CHECK_RESULT(stagingBuffer.map());
+		statistics.stagingMemory = stagingSlotSize * stagingSlotCount;
+		freeStagingSlots.clear();
+		for (uint32_t i = stagingSlotCount; i > 0; i--) {
+			freeStagingSlots.push_back(i - 1);
+		}
+
+		// Selection
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &instanceBuffer, maxInstances * sizeof(Instance)));
+		VK_CHECK_RESULT(instanceBuffer.map());
+		instances.reserve(maxInstances);
+		generateGrid();
+		VkDrawIndexedIndirectCommand drawCommand = {};
+		drawCommand.indexCount = indexCount;
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indirectBuffer, sizeof(VkDrawIndexedIndirectCommand), &drawCommand));
+		VK_CHECK_RESULT(indirectBuffer.map());
+
+		uploadCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
+		VkFenceCreateInfo fenceCI = vks::initializers::fenceCreateInfo();
+		VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCI, nullptr, &uploadFence));
+
+		const uint32_t levels = tileFile->getLevels();
+		statistics.levels = levels;
+
+		// The coarsest tile covers the whole terrain and is always resident, so every node has heights to fall back to
+		// All cache layers are transitioned to their shader read layout at the same time
+		memcpy(stagingBuffer.mapped, tileFile->getTile(levels - 1, 0, 0), tileFile->getTileBytes());
+		VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, cacheSize };
+		vks::tools::setImageLayout(copyCmd, cacheImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		copyRegion.imageExtent = { tileDim, tileDim, 1 };
+		vkCmdCopyBufferToImage(copyCmd, stagingBuffer.buffer, cacheImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		vks::tools::setImageLayout(copyCmd, cacheImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange);
+		device->flushCommandBuffer(copyCmd, queue, true);
+		slots[0].key = tileKey(levels - 1, 0, 0);
+		slots[0].state = SlotState::Resident;
+		slots[0].pinned = true;
+		slotLookup[slots[0].key] = 0;
+	}
+
+	void QuadtreeTerrain::destroy()
+	{
+		if (!device) {
+			return;
+		}
+		// Jobs still in the loader queue write to the staging buffer
+		loaderThread.wait();
+		if (uploadSubmitted) {
+			VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &uploadFence, VK_TRUE, UINT64_MAX));
+			uploadSubmitted = false;
+		}
+		completedUploads.clear();
+		vkDestroyFence(device->logicalDevice, uploadFence, nullptr);
+		vkFreeCommandBuffers(device->logicalDevice, device->commandPool, 1, &uploadCommandBuffer);
+		vkDestroySampler(device->logicalDevice, cacheSampler, nullptr);
+		vkDestroyImageView(device->logicalDevice, cacheView, nullptr);
+		vkDestroyImage(device->logicalDevice, cacheImage, nullptr);
+		vkFreeMemory(device->logicalDevice, cacheMemory, nullptr);
+		stagingBuffer.destroy();
+		instanceBuffer.destroy();
+		indirectBuffer.destroy();
+		vertexBuffer.destroy();
+		indexBuffer.destroy();
+		slots.clear();
+		slotLookup.clear();
+		device = nullptr;
+	}
+
+	// A node is drawn as four quadrants, each using the same grid of (tileSize / 2)^2 quads
+	void QuadtreeTerrain::generateGrid()
+	{
+		const uint32_t gridSize = tileFile->getTileSize() / 2;
+		std::vector<glm::vec2> vertices;
+		for (uint32_t y = 0; y <= gridSize; y++) {
+			for (uint32_t x = 0; x <= gridSize; x++) {
+				vertices.push_back(glm::vec2((float)x, (float)y));
+			}
+		}
+		std::vector<uint32_t> indices;
+		for (uint32_t y = 0; y < gridSize; y++) {
+			for (uint32_t x = 0; x < gridSize; x++) {
+				const uint32_t i0 = x + y * (gridSize + 1);
+				const uint32_t i1 = i0 + gridSize + 1;
+				indices.insert(indices.end(), { i0, i1, i1 + 1, i1 + 1, i0 + 1, i0 });
+			}
+		}
+		indexCount = static_cast<uint32_t>(indices.size());
+
+		vks::Buffer vertexStaging, indexStaging;
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &vertexStaging, vertices.size() * sizeof(glm::vec2), vertices.data()));
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &indexStaging, indices.size() * sizeof(uint32_t), indices.data()));
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, vertices.size() * sizeof(glm::vec2)));
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, indices.size() * sizeof(uint32_t)));
+		device->copyBuffer(&vertexStaging, &vertexBuffer, queue);
+		device->copyBuffer(&indexStaging, &indexBuffer, queue);
+		vertexStaging.destroy();
+		indexStaging.destroy();
+	}
+
+	uint64_t QuadtreeTerrain::tileKey(uint32_t level, uint32_t x, uint32_t y)
+	{
+		return ((uint64_t)level << 48) | ((uint64_t)y << 24) | (uint64_t)x;
+	}
+
+	float QuadtreeTerrain::getWorldSize() const
+	{
+		return tileFile->getDim() * sampleSpacing;
+	}
+
+	uint32_t QuadtreeTerrain::getTileSize() const
+	{
+		return tileFile->getTileSize();
+	}
+
+	QuadtreeTerrain::Statistics QuadtreeTerrain::getStatistics() const
+	{
+		return statistics;
+	}
+
+	VkVertexInputBindingDescription QuadtreeTerrain::getVertexInputBinding()
+	{
+		return vks::initializers::vertexInputBindingDescription(0, sizeof(glm::vec2), VK_VERTEX_INPUT_RATE_VERTEX);
+	}
+
+	VkVertexInputAttributeDescription QuadtreeTerrain::getVertexInputAttribute()
+	{
+		return vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32_SFLOAT, 0);
+	}
+
+	void QuadtreeTerrain::getNodeBounds(uint32_t level, uint32_t x, uint32_t y, glm::vec3& min, glm::vec3& max) const
+	{
+		const float nodeSize = (float)(tileFile->getTileSize() << level) * sampleSpacing;
+		const float origin = -getWorldSize() * 0.5f;
+		uint16_t minHeight, maxHeight;
+		tileFile->getTileRange(level, x, y, minHeight, maxHeight);
+		// Heights displace along -y, same as the tessellated terrain
+		min = glm::vec3(origin + x * nodeSize, -(maxHeight / 65535.0f) * heightScale, origin + y * nodeSize);
+		max = glm::vec3(min.x + nodeSize, -(minHeight / 65535.0f) * heightScale, min.z + nodeSize);
+	}
+
+	/*
+		Node selection as described in "Continuous Distance-Dependent Level of Detail for Rendering Heightmaps" (Strugar)
+		Returns false if the node is outside of its level's range, its parent then needs to cover that area
+	*/
+	bool QuadtreeTerrain::selectNode(uint32_t level, uint32_t x, uint32_t y)
+	{
+		glm::vec3 min, max;
+		getNodeBounds(level, x, y, min, max);
+		const glm::vec3 closest = glm::clamp(cameraPosition, min, max);
+		const float distance = glm::length(closest - cameraPosition);
+		if (distance > lodRanges[level]) {
+			return false;
+		}
+
+		const glm::vec3 center = (min + max) * 0.5f;
+		if (!frustum.checkSphere(center, glm::length(max - center))) {
+			// Culled nodes are still handled, so the parent doesn't draw them
+			statistics.culledNodes++;
+			return true;
+		}
+
+		statistics.selectedNodes++;
+		if (level == 0 || distance > lodRanges[level - 1]) {
+			// None of the children is within range of the next finer level
+			for (uint32_t quadrant = 0; quadrant < 4; quadrant++) {
+				addQuadrant(level, x, y, quadrant);
+			}
+			return true;
+		}
+
+		// Quadrants whose child is out of range are drawn at this node's level
+		for (uint32_t quadrant = 0; quadrant < 4; quadrant++) {
+			if (!selectNode(level - 1, x * 2 + (quadrant & 1), y * 2 + (quadrant >> 1))) {
+				addQuadrant(level, x, y, quadrant);
+			}
+		}
+		return true;
+	}
+
+	void QuadtreeTerrain::addQuadrant(uint32_t level, uint32_t x, uint32_t y, uint32_t quadrant)
+	{
+		if (instances.size() >= maxInstances) {
+			return;
+		}
+		const uint32_t tileSize = tileFile->getTileSize();
+		const uint32_t halfTile = tileSize / 2;
+		// Position of the quadrant's first vertex in the node level's sample grid
+		const uint32_t gridX = x * tileSize + (quadrant & 1) * halfTile;
+		const uint32_t gridY = y * tileSize + (quadrant >> 1) * halfTile;
+		const float gridSpacing = sampleSpacing * (float)(1 << level);
+		const float origin = -getWorldSize() * 0.5f;
+
+		glm::vec3 min, max;
+		getNodeBounds(level, x, y, min, max);
+		const float distance = glm::length(glm::clamp(cameraPosition, min, max) - cameraPosition);
+
+		uint32_t residentLevel;
+		const uint32_t slot = findResidentSlot(level, x, y, distance, residentLevel);
+		if (residentLevel != level) {
+			statistics.fallbackInstances++;
+		}
+
+		// Map the node's grid into the texels of the (possibly coarser) resident tile
+		const uint32_t shift = residentLevel - level;
+		const float texelScale = 1.0f / (float)(1 << shift);
+		const uint32_t residentX = (x >> shift) * tileSize;
+		const uint32_t residentY = (y >> shift) * tileSize;
+
+		const float morphEnd = lodRanges[level];
+		const float morphPrevious = (level > 0) ? lodRanges[level - 1] : 0.0f;
+		const float morphStart = (morphEnd >= maxRange) ? maxRange * 0.5f : morphPrevious + (morphEnd - morphPrevious) * morphStartRatio;
+
+		Instance instance;
+		instance.node = glm::vec4(origin + gridX * gridSpacing, origin + gridY * gridSpacing, gridSpacing, 0.0f);
+		instance.texel = glm::vec4(((float)gridX - (float)(residentX << shift)) * texelScale, ((float)gridY - (float)(residentY << shift)) * texelScale, texelScale, (float)slot);
+		instance.morph = glm::vec4(morphStart, morphEnd, 0.0f, 0.0f);
+		instances.push_back(instance);
+	}
+
+	// Returns the cache slot of the node's tile, or of its closest resident ancestor (the coarsest tile is always resident)
+	uint32_t QuadtreeTerrain::findResidentSlot(uint32_t level, uint32_t x, uint32_t y, float distance, uint32_t& residentLevel)
+	{
+		for (uint32_t l = level; l < tileFile->getLevels(); l++) {
+			const uint32_t shift = l - level;
+			auto it = slotLookup.find(tileKey(l, x >> shift, y >> shift));
+			if (it == slotLookup.end()) {
+				// Also request missing ancestors, coarser tiles are streamed first
+				missingTiles.push_back({ l, x >> shift, y >> shift, distance });
+				continue;
+			}
+			CacheSlot& slot = slots[it->second];
+			if (slot.state == SlotState::Resident) {
+				slot.lastUsed = frameIndex;
+				residentLevel = l;
+				return it->second;
+			}
+		}
+		assert(false);
+		residentLevel = tileFile->getLevels() - 1;
+		return 0;
+	}
+
+	// Record and submit copies for all tiles the loader thread has finished
+	void QuadtreeTerrain::processCompletedUploads()
+	{
+		std::vector<PendingUpload> uploads;
+		{
+			std::lock_guard<std::mutex> lock(completedMutex);
+			uploads.swap(completedUploads);
+		}
+		statistics.uploadsLastFrame = static_cast<uint32_t>(uploads.size());
+		if (uploads.empty()) {
+			return;
+		}
+
+		const uint32_t tileDim = tileFile->getTileSize() + 1;
+		std::vector<VkImageMemoryBarrier> toTransfer, toShaderRead;
+		std::vector<VkBufferImageCopy> copyRegions;
+		for (PendingUpload& upload : uploads) {
+			VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+			barrier.image = cacheImage;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, upload.slot, 1 };
+			barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			toTransfer.push_back(barrier);
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			toShaderRead.push_back(barrier);
+
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.bufferOffset = upload.stagingSlot * stagingSlotSize;
+			copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, upload.slot, 1 };
+			copyRegion.imageExtent = { tileDim, tileDim, 1 };
+			copyRegions.push_back(copyRegion);
+		}
+
+		VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(uploadCommandBuffer, &beginInfo));
+		// Evicted layers may still be read by the previous frame
+		vkCmdPipelineBarrier(uploadCommandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+		for (VkBufferImageCopy& copyRegion : copyRegions) {
+			vkCmdCopyBufferToImage(uploadCommandBuffer, stagingBuffer.buffer, cacheImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+		}
+		vkCmdPipelineBarrier(uploadCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(toShaderRead.size()), toShaderRead.data());
+		VK_CHECK_RESULT(vkEndCommandBuffer(uploadCommandBuffer));
+
+		// Submitted ahead of the frame's command buffer on the same queue, so the tiles can already be used by this frame's selection
+		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &uploadCommandBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, uploadFence));
+		uploadSubmitted = true;
+
+		for (PendingUpload& upload : uploads) {
+			slots[upload.slot].state = SlotState::Resident;
+			submittedStagingSlots.push_back(upload.stagingSlot);
+			statistics.streamedTiles++;
+		}
+	}
+
+	// Hand missing tiles to the loader thread, coarse and close tiles first
+	void QuadtreeTerrain::requestMissingTiles()
+	{
+		std::sort(missingTiles.begin(), missingTiles.end(), [](const NodeRequest& a, const NodeRequest& b) {
+			return (a.level != b.level) ? (a.level > b.level) : (a.distance < b.distance);
+		});
+		for (NodeRequest& request : missingTiles) {
+			if (freeStagingSlots.empty()) {
+				break;
+			}
+			const uint64_t key = tileKey(request.level, request.x, request.y);
+			if (slotLookup.find(key) != slotLookup.end()) {
+				continue;
+			}
+			// Replace the least recently used tile that hasn't been used by the current selection
+			int32_t victim = -1;
+			for (uint32_t i = 0; i < slots.size(); i++) {
+				const CacheSlot& slot = slots[i];
+				if (slot.pinned || slot.state == SlotState::Loading || (slot.state == SlotState::Resident && slot.lastUsed == frameIndex)) {
+					continue;
+				}
+				if (slot.state == SlotState::Empty) {
+					victim = i;
+					break;
+				}
+				if (victim < 0 || slot.lastUsed < slots[victim].lastUsed) {
+					victim = i;
+				}
+			}
+			if (victim < 0) {
+				break;
+			}
+			CacheSlot& slot = slots[victim];
+			if (slot.state == SlotState::Resident) {
+				slotLookup.erase(slot.key);
+			}
+			slot.key = key;
+			slot.state = SlotState::Loading;
+			slotLookup[key] = victim;
+
+			const uint32_t stagingSlot = freeStagingSlots.back();
+			freeStagingSlots.pop_back();
+			// Reading from the mapping may page in data from disk, which is done on the loader thread
+			const uint32_t slotIndex = static_cast<uint32_t>(victim);
+			const uint32_t level = request.level, x = request.x, y = request.y;
+			loaderThread.addJob([this, slotIndex, stagingSlot, level, x, y] {
+				memcpy((uint8_t*)stagingBuffer.mapped + stagingSlot * stagingSlotSize, tileFile->getTile(level, x, y), tileFile->getTileBytes());
+				std::lock_guard<std::mutex> lock(completedMutex);
+				completedUploads.push_back({ slotIndex, stagingSlot });
+			});
+		}
+	}
+
+	void QuadtreeTerrain::update(const glm::vec3& cameraPosition, const vks::Frustum& frustum)
+	{
+		frameIndex++;
+
+		// Staging slots of the last upload can be reused once the copies have finished
+		if (uploadSubmitted) {
+			VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &uploadFence, VK_TRUE, UINT64_MAX));
+			VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &uploadFence));
+			uploadSubmitted = false;
+			freeStagingSlots.insert(freeStagingSlots.end(), submittedStagingSlots.begin(), submittedStagingSlots.end());
+			submittedStagingSlots.clear();
+		}
+		processCompletedUploads();
+
+		// The range of every level is twice the range of the next finer level, the coarsest level is always selected
+		const uint32_t levels = tileFile->getLevels();
+		lodRanges.resize(levels);
+		for (uint32_t level = 0; level < levels; level++) {
+			lodRanges[level] = (level == levels - 1) ? maxRange : lodDistance * (float)(1 << level);
+		}
+
+		// Select nodes starting at the root, which covers the whole terrain
+		this->cameraPosition = cameraPosition;
+		this->frustum = frustum;
+		instances.clear();
+		missingTiles.clear();
+		statistics.selectedNodes = 0;
+		statistics.culledNodes = 0;
+		statistics.fallbackInstances = 0;
+		selectNode(levels - 1, 0, 0);
+
+		if (!instances.empty()) {
+			memcpy(instanceBuffer.mapped, instances.data(), instances.size() * sizeof(Instance));
+		}
+		VkDrawIndexedIndirectCommand* drawCommand = (VkDrawIndexedIndirectCommand*)indirectBuffer.mapped;
+		drawCommand->instanceCount = static_cast<uint32_t>(instances.size());
+		statistics.instances = static_cast<uint32_t>(instances.size());
+
+		requestMissingTiles();
+
+		statistics.residentTiles = 0;
+		statistics.pendingTiles = 0;
+		for (const CacheSlot& slot : slots) {
+			statistics.residentTiles += (slot.state == SlotState::Resident) ? 1 : 0;
+			statistics.pendingTiles += (slot.state == SlotState::Loading) ? 1 : 0;
+		}
+	}
+
+	void QuadtreeTerrain::draw(VkCommandBuffer commandBuffer)
+	{
+		VkDeviceSize offsets[1] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer.buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
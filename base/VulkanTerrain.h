@@ -0,0 +1,245 @@
+/*
+* Streaming quadtree terrain
+*
+* Heights are stored in a tiled, mip-mapped file that's accessed through a read only memory mapping
+* Tiles are selected from a quadtree using continuous distance-dependent level of detail (CDLOD), frustum culled per node
+* and streamed into a fixed size GPU tile cache by a background thread, so memory usage doesn't depend on the size of the terrain
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <string>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanTools.h"
+#include "frustum.hpp"
+#include "threadpool.hpp"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+namespace vks
+{
+	/**
+	* @brief Heightmap split into square tiles for all levels of a mip chain, accessed through a read only memory mapping
+	* @note Level n is created by taking every 2^n-th sample of level 0, so vertices of coarser levels coincide with vertices of finer levels
+	* @note Neighbouring tiles share their border samples, a tile stores (tileSize + 1)^2 16 bit heights
+	*/
+	class TerrainTileFile
+	{
+	public:
+		struct Header
+		{
+			uint32_t magic;
+			uint32_t version;
+			/** @brief Samples per side of level 0 */
+			uint32_t dim;
+			uint32_t tileSize;
+			uint32_t levels;
+			uint32_t reserved[3];
+		};
+
+		static const uint32_t fileMagic = 0x4C495454;
+		static const uint32_t fileVersion = 1;
+
+		~TerrainTileFile();
+
+		/**
+		* @brief Create a tiled height file from a single channel 16 bit KTX heightmap
+		* @param filename Name of the tiled file to create
+		* @param heightmapFilename KTX heightmap the heights are generated from, repeated (mirrored) and bilinearly filtered to cover the whole terrain
+		* @param dim Samples per side of the terrain, needs to be tileSize times a power of two
+		* @param tileSize Quads per tile side
+		* @param samplesPerRepeat Number of samples covered by one repetition of the source heightmap
+		*/
+		static bool create(const std::string& filename, const std::string& heightmapFilename, uint32_t dim, uint32_t tileSize, float samplesPerRepeat);
+
+		/** @brief Map an existing tile file, returns false if the file doesn't exist or doesn't match the requested layout */
+		bool open(const std::string& filename, uint32_t dim, uint32_t tileSize);
+		void close();
+
+		uint32_t getDim() const { return header.dim; }
+		uint32_t getTileSize() const { return header.tileSize; }
+		uint32_t getLevels() const { return header.levels; }
+		uint32_t getTilesPerSide(uint32_t level) const { return (header.dim / header.tileSize) >> level; }
+		/** @brief Bytes of a single tile, including the shared border samples */
+		size_t getTileBytes() const { return (header.tileSize + 1) * (header.tileSize + 1) * sizeof(uint16_t); }
+		size_t getFileSize() const { return size; }
+
+		const uint16_t* getTile(uint32_t level, uint32_t x, uint32_t y) const;
+		/** @brief Minimum and maximum height of a tile, used for the bounding boxes of the quadtree nodes */
+		void getTileRange(uint32_t level, uint32_t x, uint32_t y, uint16_t& minHeight, uint16_t& maxHeight) const;
+	private:
+		Header header = {};
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+		std::vector<size_t> levelTileOffsets;
+		size_t rangesOffset = 0;
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#else
+		int file = -1;
+#endif
+		static void getTileIndexBases(const Header& header, std::vector<size_t>& bases, size_t& tileCount);
+		size_t getTileIndex(uint32_t level, uint32_t x, uint32_t y) const;
+	};
+
+	/**
+	* @brief Quadtree terrain with continuous distance-dependent level of detail (CDLOD) and a streaming tile cache
+	* @note All selected nodes are drawn with a single indirect instanced draw, update() rewrites the per-instance data and the draw count
+	*       so command buffers only need to be recorded once
+	* @note The coarsest tile is always resident, nodes whose tile hasn't been streamed in yet are drawn with the height data of their closest resident ancestor
+	*/
+	class QuadtreeTerrain
+	{
+	public:
+		/** @brief Per-instance data, one instance draws one quadrant of a node */
+		struct Instance
+		{
+			/** @brief xy = world space origin (x/z), z = world space distance between two grid vertices */
+			glm::vec4 node;
+			/** @brief xy = offset of the first grid vertex in the cached tile (in texels), z = texels per grid step, w = tile cache layer */
+			glm::vec4 texel;
+			/** @brief x = distance at which morphing to the next coarser level starts, y = distance at which it's finished */
+			glm::vec4 morph;
+		};
+
+		struct Statistics
+		{
+			uint32_t selectedNodes = 0;
+			uint32_t culledNodes = 0;
+			uint32_t instances = 0;
+			/** @brief Instances drawn with the heights of an ancestor as their own tile isn't resident yet */
+			uint32_t fallbackInstances = 0;
+			uint32_t residentTiles = 0;
+			uint32_t pendingTiles = 0;
+			uint32_t uploadsLastFrame = 0;
+			uint64_t streamedTiles = 0;
+			uint32_t levels = 0;
+			VkDeviceSize cacheMemory = 0;
+			VkDeviceSize stagingMemory = 0;
+		};
+
+		/** @brief World space distance between two level 0 samples */
+		float sampleSpacing = 0.25f;
+		/** @brief World space height of a sample with the maximum value */
+		float heightScale = 32.0f;
+		/** @brief Range of the finest level, doubles with every level */
+		float lodDistance = 24.0f;
+		/** @brief Fraction of a level's range after which vertices start morphing towards the next coarser level */
+		float morphStartRatio = 0.66f;
+
+		/** @brief Vertex (grid position) buffer for one quadrant of a node */
+		vks::Buffer vertexBuffer;
+		vks::Buffer indexBuffer;
+		/** @brief Host visible storage buffer containing the Instance data of the current selection */
+		vks::Buffer instanceBuffer;
+		/** @brief Indirect draw command with the instance count of the current selection */
+		vks::Buffer indirectBuffer;
+		/** @brief 2D array image with one cached tile per layer */
+		VkDescriptorImageInfo tileCacheDescriptor = {};
+
+		/**
+		* @brief Create the tile cache, staging slots and draw buffers and load the coarsest tile
+		* @param cacheSize Number of tiles that can be resident, limited by maxImageArrayLayers
+		* @param maxInstances Maximum number of node quadrants drawn per frame
+		*/
+		void create(vks::VulkanDevice* device, VkQueue queue, const TerrainTileFile* tileFile, uint32_t cacheSize = 256, uint32_t maxInstances = 4096);
+		void destroy();
+
+		/**
+		* @brief Select nodes for the current view, submit finished tile uploads and request missing tiles
+		* @note Needs to be called every frame (before submitting the command buffer drawing the terrain), also if the camera didn't change, so streaming can progress
+		* @note Uploads are submitted to the queue passed at creation, the draw needs to be submitted to the same queue
+		*/
+		void update(const glm::vec3& cameraPosition, const vks::Frustum& frustum);
+
+		/** @brief Record the draw of the current selection, requires a pipeline using the vertex input from getVertexInputBinding() and getVertexInputAttribute() */
+		void draw(VkCommandBuffer commandBuffer);
+
+		/** @brief World space size of the whole terrain, which is centered at the origin */
+		float getWorldSize() const;
+		uint32_t getTileSize() const;
+		Statistics getStatistics() const;
+
+		/** @brief Vertices only contain the grid position (vec2) within a quadrant */
+		static VkVertexInputBindingDescription getVertexInputBinding();
+		static VkVertexInputAttributeDescription getVertexInputAttribute();
+	private:
+		enum class SlotState { Empty, Loading, Resident };
+
+		struct CacheSlot
+		{
+			uint64_t key = 0;
+			SlotState state = SlotState::Empty;
+			uint64_t lastUsed = 0;
+			bool pinned = false;
+		};
+
+		struct PendingUpload
+		{
+			uint32_t slot;
+			uint32_t stagingSlot;
+		};
+
+		struct NodeRequest
+		{
+			uint32_t level, x, y;
+			float distance;
+		};
+
+		vks::VulkanDevice* device = nullptr;
+		VkQueue queue = VK_NULL_HANDLE;
+		const TerrainTileFile* tileFile = nullptr;
+
+		VkImage cacheImage = VK_NULL_HANDLE;
+		VkDeviceMemory cacheMemory = VK_NULL_HANDLE;
+		VkImageView cacheView = VK_NULL_HANDLE;
+		VkSampler cacheSampler = VK_NULL_HANDLE;
+		std::vector<CacheSlot> slots;
+		std::unordered_map<uint64_t, uint32_t> slotLookup;
+
+		// Tiles are copied from the memory mapped file into host visible staging slots by the loader thread
+		vks::Buffer stagingBuffer;
+		VkDeviceSize stagingSlotSize = 0;
+		std::vector<uint32_t> freeStagingSlots;
+		std::vector<uint32_t> submittedStagingSlots;
+		vks::Thread loaderThread;
+		std::mutex completedMutex;
+		std::vector<PendingUpload> completedUploads;
+
+		VkCommandBuffer uploadCommandBuffer = VK_NULL_HANDLE;
+		VkFence uploadFence = VK_NULL_HANDLE;
+		bool uploadSubmitted = false;
+
+		uint32_t maxInstances = 0;
+		uint32_t indexCount = 0;
+		std::vector<Instance> instances;
+		std::vector<float> lodRanges;
+		std::vector<NodeRequest> missingTiles;
+		glm::vec3 cameraPosition;
+		vks::Frustum frustum;
+		uint64_t frameIndex = 0;
+		Statistics statistics;
+
+		static uint64_t tileKey(uint32_t level, uint32_t x, uint32_t y);
+		void getNodeBounds(uint32_t level, uint32_t x, uint32_t y, glm::vec3& min, glm::vec3& max) const;
+		bool selectNode(uint32_t level, uint32_t x, uint32_t y);
+		void addQuadrant(uint32_t level, uint32_t x, uint32_t y, uint32_t quadrant);
+		uint32_t findResidentSlot(uint32_t level, uint32_t x, uint32_t y, float distance, uint32_t& residentLevel);
+		void processCompletedUploads();
+		void requestMissingTiles();
+		void generateGrid();
+	};
+}
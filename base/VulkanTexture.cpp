@@ -7,6 +7,7 @@
 */
 
 #include <VulkanTexture.h>
+#include "profiler.hpp"
 
 namespace vks
 {
@@ -66,6 +67,7 @@ namespace vks
 	*/
 	void Texture2D::loadFromFile(std::string filename, VkFormat format, vks::VulkanDevice *device, VkQueue copyQueue, VkImageUsageFlags imageUsageFlags, VkImageLayout imageLayout, bool forceLinear)
 	{
+		VKS_PROFILE_ZONE("texture upload");
 		ktxTexture* ktxTexture;
 		ktxResult result = loadKTXFile(filename, &ktxTexture);
 		assert(result == KTX_SUCCESS);
@@ -346,6 +348,7 @@ namespace vks
 	*/
 	void Texture2D::fromBuffer(void* buffer, VkDeviceSize bufferSize, VkFormat format, uint32_t texWidth, uint32_t texHeight, vks::VulkanDevice *device, VkQueue copyQueue, VkFilter filter, VkImageUsageFlags imageUsageFlags, VkImageLayout imageLayout)
 	{
+		VKS_PROFILE_ZONE("texture upload");
 		assert(buffer);
 
 		this->device = device;
@@ -508,6 +511,7 @@ namespace vks
 	*/
 	void Texture2DArray::loadFromFile(std::string filename, VkFormat format, vks::VulkanDevice *device, VkQueue copyQueue, VkImageUsageFlags imageUsageFlags, VkImageLayout imageLayout)
 	{
+		VKS_PROFILE_ZONE("texture upload");
 		ktxTexture* ktxTexture;
 		ktxResult result = loadKTXFile(filename, &ktxTexture);
 		assert(result == KTX_SUCCESS);
@@ -692,6 +696,7 @@ namespace vks
 	*/
 	void TextureCubeMap::loadFromFile(std::string filename, VkFormat format, vks::VulkanDevice *device, VkQueue copyQueue, VkImageUsageFlags imageUsageFlags, VkImageLayout imageLayout)
 	{
+		VKS_PROFILE_ZONE("texture upload");
 		ktxTexture* ktxTexture;
 		ktxResult result = loadKTXFile(filename, &ktxTexture);
 		assert(result == KTX_SUCCESS);
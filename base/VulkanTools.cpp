@@ -7,6 +7,7 @@
 */
 
 #include "VulkanTools.h"
+#include "VulkanShaderCache.h"
 
 #if !(defined(VK_USE_PLATFORM_IOS_MVK) || defined(VK_USE_PLATFORM_MACOS_MVK))
 // iOS & macOS: VulkanExampleBase::getAssetPath() implemented externally to allow access to Objective-C components
@@ -356,28 +357,20 @@ namespace vks
 #else
 		VkShaderModule loadShader(const char *fileName, VkDevice device)
 		{
-			std::ifstream is(fileName, std::ios::binary | std::ios::in | std::ios::ate);
-
-			if (is.is_open())
+			// The SPIR-V is passed to the driver directly from the mapped file
+			MappedFile file;
+			if (file.open(fileName))
 			{
-				size_t size = is.tellg();
-				is.seekg(0, std::ios::beg);
-				char* shaderCode = new char[size];
-				is.read(shaderCode, size);
-				is.close();
-
-				assert(size > 0);
+				assert(file.size() % sizeof(uint32_t) == 0);
 
 				VkShaderModule shaderModule;
 				VkShaderModuleCreateInfo moduleCreateInfo{};
 				moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-				moduleCreateInfo.codeSize = size;
-				moduleCreateInfo.pCode = (uint32_t*)shaderCode;
+				moduleCreateInfo.codeSize = file.size();
+				moduleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(file.data());
 
 				VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, NULL, &shaderModule));
 
-				delete[] shaderCode;
-
 				return shaderModule;
 			}
 			else
@@ -0,0 +1,217 @@
+/*
+* Vulkan transient buffer allocator
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include "VulkanTransientAllocator.h"
+
+namespace vks
+{
+	namespace
+	{
+		VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+		{
+			return (alignment > 1) ? ((value + alignment - 1) / alignment) * alignment : value;
+		}
+	}
+
+	/**
+	* Create the transient buffer
+	*
+	* @param device Device to create the buffer on
+	* @param frameSize Number of bytes that can be allocated per frame
+	* @param frameCount Number of frames in flight, each frame gets its own slice of the buffer
+	* @param additionalUsage (Optional) Usage flags added to the default uniform, storage, vertex, index and indirect buffer usage (e.g. VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+	*/
+	void TransientAllocator::create(vks::VulkanDevice* device, VkDeviceSize frameSize, uint32_t frameCount, VkBufferUsageFlags additionalUsage)
+	{
+		this->device = device;
+		const VkPhysicalDeviceLimits& limits = device->properties.limits;
+		// Slices start at an offset that is valid for every kind of allocation
+		const VkDeviceSize sliceAlignment = std::max({ limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment, limits.nonCoherentAtomSize, (VkDeviceSize)16 });
+		this->frameSize = alignUp(frameSize, sliceAlignment);
+		frames.resize(std::max(frameCount, 1u));
+		// Dynamic offsets are 32 bit
+		assert(this->frameSize * frames.size() <= UINT32_MAX);
+
+		const VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | additionalUsage;
+		buffer.device = device->logicalDevice;
+		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usage, this->frameSize * frames.size());
+		VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferCreateInfo, nullptr, &buffer.buffer));
+		VkMemoryRequirements memReqs;
+		vkGetBufferMemoryRequirements(device->logicalDevice, buffer.buffer, &memReqs);
+
+		// Pick the first available memory type in order of preference
+		std::vector<VkMemoryPropertyFlags> candidates;
+		if (preferDeviceLocal) {
+			candidates.push_back(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		}
+		candidates.push_back(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		candidates.push_back(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		for (VkMemoryPropertyFlags memoryProperties : candidates) {
+			VkBool32 found = VK_FALSE;
+			memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, memoryProperties, &found);
+			if (found) {
+				buffer.memoryPropertyFlags = memoryProperties;
+				break;
+			}
+		}
+		coherent = (buffer.memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+		VkMemoryAllocateFlagsInfoKHR allocFlagsInfo{};
+		if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+			allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
+			allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+			memAlloc.pNext = &allocFlagsInfo;
+		}
+		VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &buffer.memory));
+		buffer.size = bufferCreateInfo.size;
+		buffer.alignment = memReqs.alignment;
+		buffer.usageFlags = usage;
+		buffer.setupDescriptor();
+		VK_CHECK_RESULT(buffer.bind());
+		VK_CHECK_RESULT(buffer.map());
+
+		if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+			PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR = reinterpret_cast<PFN_vkGetBufferDeviceAddressKHR>(vkGetDeviceProcAddr(device->logicalDevice, "vkGetBufferDeviceAddressKHR"));
+			VkBufferDeviceAddressInfoKHR bufferDeviceAddressInfo{};
+			bufferDeviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+			bufferDeviceAddressInfo.buffer = buffer.buffer;
+			deviceAddress = vkGetBufferDeviceAddressKHR(device->logicalDevice, &bufferDeviceAddressInfo);
+		}
+
+		statistics = Statistics();
+		statistics.frameSize = this->frameSize;
+	}
+
+	/** @brief Destroys the buffer, the device must no longer use any allocations */
+	void TransientAllocator::destroy()
+	{
+		buffer.unmap();
+		buffer.destroy();
+		buffer.buffer = VK_NULL_HANDLE;
+		buffer.memory = VK_NULL_HANDLE;
+		frames.clear();
+	}
+
+	/**
+	* Start allocating from the given frame's slice, all previous allocations of that frame are released
+	* If a fence has been passed to endFrame() for this frame before, it's waited on so the device no longer reads the slice
+	*
+	* @param frameIndex Index of the frame in flight
+	*/
+	void TransientAllocator::beginFrame(uint32_t frameIndex)
+	{
+		assert(frameIndex < frames.size());
+		Frame& frame = frames[frameIndex];
+		if ((frame.fence != VK_NULL_HANDLE) && (vkGetFenceStatus(device->logicalDevice, frame.fence) == VK_NOT_READY)) {
+			statistics.fenceWaits++;
+			VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &frame.fence, VK_TRUE, UINT64_MAX));
+		}
+		frame.fence = VK_NULL_HANDLE;
+		currentFrame = frameIndex;
+		head = 0;
+		recording = true;
+		statistics.used = 0;
+		statistics.allocations = 0;
+	}
+
+	/**
+	* Finish allocating for the current frame, makes the written data visible to the device
+	*
+	* @param fence (Optional) Fence signaled by the submission that uses this frame's allocations, waited on before the slice is reused
+	*/
+	void TransientAllocator::endFrame(VkFence fence)
+	{
+		assert(recording);
+		if (!coherent && (head > 0)) {
+			VK_CHECK_RESULT(buffer.flush(alignUp(head, device->properties.limits.nonCoherentAtomSize), frameSize * currentFrame));
+		}
+		frames[currentFrame].fence = fence;
+		recording = false;
+	}
+
+	/**
+	* Allocate a range of the current frame's slice
+	*
+	* @param size Size of the allocation in bytes
+	* @param alignment Alignment of the allocation's offset
+	*/
+	TransientAllocation TransientAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment)
+	{
+		assert(recording);
+		const VkDeviceSize offset = alignUp(head, alignment);
+		if (offset + size > frameSize) {
+			vks::tools::exitFatal("Transient allocator out of memory: " + std::to_string(offset + size) + " bytes requested for a frame, but the frame size is " + std::to_string(frameSize) + " bytes", -1);
+		}
+		head = offset + size;
+		statistics.used = head;
+		statistics.peak = std::max(statistics.peak, head);
+		statistics.allocations++;
+
+		TransientAllocation allocation;
+		allocation.buffer = buffer.buffer;
+		allocation.offset = frameSize * currentFrame + offset;
+		allocation.size = size;
+		allocation.data = static_cast<uint8_t*>(buffer.mapped) + allocation.offset;
+		allocation.deviceAddress = (deviceAddress != 0) ? deviceAddress + allocation.offset : 0;
+		return allocation;
+	}
+
+	/** @brief Allocate a range that can be bound as a (dynamic) uniform buffer */
+	TransientAllocation TransientAllocator::allocateUniform(VkDeviceSize size)
+	{
+		return allocate(size, device->properties.limits.minUniformBufferOffsetAlignment);
+	}
+
+	/** @brief Allocate a range that can be bound as a (dynamic) storage buffer */
+	TransientAllocation TransientAllocator::allocateStorage(VkDeviceSize size)
+	{
+		return allocate(size, device->properties.limits.minStorageBufferOffsetAlignment);
+	}
+
+	/** @brief Allocate a range for vertex data, bound with vkCmdBindVertexBuffers at the allocation's offset */
+	TransientAllocation TransientAllocator::allocateVertices(VkDeviceSize size)
+	{
+		return allocate(size, 16);
+	}
+
+	/** @brief Allocate a range for 16 or 32 bit indices, bound with vkCmdBindIndexBuffer at the allocation's offset */
+	TransientAllocation TransientAllocator::allocateIndices(VkDeviceSize size)
+	{
+		return allocate(size, 4);
+	}
+
+	/** @brief Allocate a range and copy data into it */
+	TransientAllocation TransientAllocator::upload(const void* data, VkDeviceSize size, VkDeviceSize alignment)
+	{
+		TransientAllocation allocation = allocate(size, alignment);
+		memcpy(allocation.data, data, size);
+		return allocation;
+	}
+
+	/**
+	* Returns a descriptor for binding the transient buffer as a dynamic uniform or storage buffer
+	* Allocations are selected with their dynamicOffset() when binding the descriptor set
+	*
+	* @param range Size of the block visible to the shader
+	*/
+	VkDescriptorBufferInfo TransientAllocator::getDynamicDescriptor(VkDeviceSize range) const
+	{
+		return { buffer.buffer, 0, range };
+	}
+
+	VkBuffer TransientAllocator::getBuffer() const
+	{
+		return buffer.buffer;
+	}
+
+	TransientAllocator::Statistics TransientAllocator::getStatistics() const
+	{
+		return statistics;
+	}
+}
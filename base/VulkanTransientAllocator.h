@@ -0,0 +1,106 @@
+/*
+* Vulkan transient buffer allocator
+*
+* Linear allocator for data that is only used by a single frame (uniform blocks, per-draw data, dynamic vertices and indices)
+* Every frame in flight owns a slice of one persistently mapped buffer, allocations are bumped from the slice and released all at once when the frame is reused
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.h"
+#include "VulkanBuffer.h"
+#include "VulkanTools.h"
+#include "VulkanInitializers.hpp"
+
+namespace vks
+{
+	/** @brief Range of the transient buffer, only valid for the frame it has been allocated in */
+	struct TransientAllocation
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		/** @brief Offset from the start of the buffer (not the frame), can be used as a dynamic offset or bind offset */
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		/** @brief Host pointer to the allocated range */
+		void* data = nullptr;
+		/** @brief Only set if the allocator has been created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT */
+		VkDeviceAddress deviceAddress = 0;
+
+		uint32_t dynamicOffset() const { return static_cast<uint32_t>(offset); }
+		VkDescriptorBufferInfo descriptor() const { return { buffer, offset, size }; }
+	};
+
+	/**
+	* @brief Per-frame linear allocator for transient buffer data
+	* @note Call beginFrame() with the frame's index before allocating and endFrame() after the last allocation of the frame
+	* @note Allocations are aligned to the device's offset alignment for their usage, so they can be bound with dynamic offsets
+	*/
+	class TransientAllocator
+	{
+	public:
+		struct Statistics
+		{
+			VkDeviceSize frameSize = 0;
+			/** @brief Bytes allocated in the current frame (including alignment padding) */
+			VkDeviceSize used = 0;
+			/** @brief Max. number of bytes allocated in a single frame */
+			VkDeviceSize peak = 0;
+			uint32_t allocations = 0;
+			/** @brief Number of times beginFrame() had to wait for the device to finish a frame */
+			uint32_t fenceWaits = 0;
+		};
+
+		/** @brief Use device local memory that is host visible (if available, e.g. with resizable BAR), must be set before create() */
+		bool preferDeviceLocal = false;
+
+		void create(vks::VulkanDevice* device, VkDeviceSize frameSize, uint32_t frameCount, VkBufferUsageFlags additionalUsage = 0);
+		void destroy();
+		void beginFrame(uint32_t frameIndex);
+		void endFrame(VkFence fence = VK_NULL_HANDLE);
+		TransientAllocation allocate(VkDeviceSize size, VkDeviceSize alignment);
+		TransientAllocation allocateUniform(VkDeviceSize size);
+		TransientAllocation allocateStorage(VkDeviceSize size);
+		TransientAllocation allocateVertices(VkDeviceSize size);
+		TransientAllocation allocateIndices(VkDeviceSize size);
+		TransientAllocation upload(const void* data, VkDeviceSize size, VkDeviceSize alignment);
+		VkDescriptorBufferInfo getDynamicDescriptor(VkDeviceSize range) const;
+		VkBuffer getBuffer() const;
+		Statistics getStatistics() const;
+
+		/** @brief Copy a uniform block into a new allocation */
+		template <typename T>
+		TransientAllocation uploadUniform(const T& value)
+		{
+			TransientAllocation allocation = allocateUniform(sizeof(T));
+			memcpy(allocation.data, &value, sizeof(T));
+			return allocation;
+		}
+	private:
+		struct Frame
+		{
+			/** @brief Signaled once the device has finished the last submission using this frame's slice */
+			VkFence fence = VK_NULL_HANDLE;
+		};
+
+		vks::VulkanDevice* device = nullptr;
+		vks::Buffer buffer;
+		bool coherent = true;
+		VkDeviceAddress deviceAddress = 0;
+		VkDeviceSize frameSize = 0;
+		std::vector<Frame> frames;
+		uint32_t currentFrame = 0;
+		VkDeviceSize head = 0;
+		bool recording = false;
+		Statistics statistics;
+	};
+}
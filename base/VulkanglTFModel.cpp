@@ -12,11 +12,14 @@
 #define TINYGLTF_NO_STB_IMAGE_WRITE
 
 #include "VulkanglTFModel.h"
+#include "profiler.hpp"
 
 VkDescriptorSetLayout vkglTF::descriptorSetLayoutImage = VK_NULL_HANDLE;
-VkDescriptorSetLayout vkglTF::descriptorSetLayoutUbo = VK_NULL_HANDLE;
+VkDescriptorSetLayout vkglTF::descriptorSetLayoutNodes = VK_NULL_HANDLE;
+VkDescriptorSetLayout vkglTF::descriptorSetLayoutMaterials = VK_NULL_HANDLE;
 VkMemoryPropertyFlags vkglTF::memoryPropertyFlags = 0;
 uint32_t vkglTF::descriptorBindingFlags = vkglTF::DescriptorBindingFlags::ImageBaseColor;
+uint32_t vkglTF::nodeBufferFrameCount = 1;
 
 /*
 	We use a custom image loading function with tinyglTF, so we can do custom stuff loading ktx textures
@@ -64,6 +67,7 @@ void vkglTF::Texture::destroy()
 
 void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path, vks::VulkanDevice *device, VkQueue copyQueue)
 {
+	VKS_PROFILE_ZONE("texture upload");
 	this->device = device;
 
 	bool isKtx = false;
@@ -435,14 +439,9 @@ void vkglTF::Texture::fromglTfImage(tinygltf::Image &gltfimage, std::string path
 /*
 	glTF material
 */
-void vkglTF::Material::createDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags)
+void vkglTF::Material::createDescriptorSet(vks::DescriptorAllocator& descriptorAllocator, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags)
 {
-	VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-	descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	descriptorSetAllocInfo.descriptorPool = descriptorPool;
-	descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
-	descriptorSetAllocInfo.descriptorSetCount = 1;
-	VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &descriptorSet));
+	descriptorSet = descriptorAllocator.allocate(descriptorSetLayout);
 	std::vector<VkDescriptorImageInfo> imageDescriptors{};
 	std::vector<VkWriteDescriptorSet> writeDescriptorSets{};
 	if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
@@ -487,21 +486,11 @@ void vkglTF::Primitive::setDimensions(glm::vec3 min, glm::vec3 max) {
 */
 vkglTF::Mesh::Mesh(vks::VulkanDevice *device, glm::mat4 matrix) {
 	this->device = device;
-	this->uniformBlock.matrix = matrix;
-	VK_CHECK_RESULT(device->createBuffer(
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		sizeof(uniformBlock),
-		&uniformBuffer.buffer,
-		&uniformBuffer.memory,
-		&uniformBlock));
-	VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped));
-	uniformBuffer.descriptor = { uniformBuffer.buffer, 0, sizeof(uniformBlock) };
+	this->nodeData.matrix = matrix;
+	this->dirtyFrames = ~0u;
 };
 
 vkglTF::Mesh::~Mesh() {
-	vkDestroyBuffer(device->logicalDevice, uniformBuffer.buffer, nullptr);
-	vkFreeMemory(device->logicalDevice, uniformBuffer.memory, nullptr);
     for(auto primitive : primitives)
     {
         delete primitive;
@@ -528,21 +517,21 @@ glm::mat4 vkglTF::Node::getMatrix() {
 void vkglTF::Node::update() {
 	if (mesh) {
 		glm::mat4 m = getMatrix();
+		mesh->nodeData.matrix = m;
 		if (skin) {
-			mesh->uniformBlock.matrix = m;
 			// Update join matrices
 			glm::mat4 inverseTransform = glm::inverse(m);
+			mesh->jointMatrices.resize(skin->joints.size());
 			for (size_t i = 0; i < skin->joints.size(); i++) {
 				vkglTF::Node *jointNode = skin->joints[i];
 				glm::mat4 jointMat = jointNode->getMatrix() * skin->inverseBindMatrices[i];
 				jointMat = inverseTransform * jointMat;
-				mesh->uniformBlock.jointMatrix[i] = jointMat;
+				mesh->jointMatrices[i] = jointMat;
 			}
-			mesh->uniformBlock.jointcount = (float)skin->joints.size();
-			memcpy(mesh->uniformBuffer.mapped, &mesh->uniformBlock, sizeof(mesh->uniformBlock));
-		} else {
-			memcpy(mesh->uniformBuffer.mapped, &m, sizeof(glm::mat4));
+			mesh->nodeData.jointCount = static_cast<uint32_t>(skin->joints.size());
 		}
+		// Copied to the node buffer by Model::updateNodeBuffer for every frame
+		mesh->dirtyFrames = ~0u;
 	}
 
 	for (auto& child : children) {
@@ -623,6 +612,20 @@ vkglTF::Texture* vkglTF::Model::getTexture(uint32_t index)
 	return nullptr;
 }
 
+/*
+	Returns the index of a texture in the bindless texture array, -1 if the material doesn't use a texture
+*/
+int32_t vkglTF::Model::getTextureIndex(vkglTF::Texture* texture)
+{
+	if (texture == nullptr) {
+		return -1;
+	}
+	if (texture == &emptyTexture) {
+		return static_cast<int32_t>(textures.size());
+	}
+	return static_cast<int32_t>(texture - textures.data());
+}
+
 void vkglTF::Model::createEmptyTexture(VkQueue transferQueue)
 {
 	emptyTexture.device = device;
@@ -744,15 +747,21 @@ vkglTF::Model::~Model()
     for (auto skin : skins) {
         delete skin;
     }
-	if (descriptorSetLayoutUbo != VK_NULL_HANDLE) {
-		vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayoutUbo, nullptr);
-		descriptorSetLayoutUbo = VK_NULL_HANDLE;
+	nodeBuffer.buffer.destroy();
+	bindlessMaterials.buffer.destroy();
+	if (descriptorSetLayoutMaterials != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayoutMaterials, nullptr);
+		descriptorSetLayoutMaterials = VK_NULL_HANDLE;
+	}
+	if (descriptorSetLayoutNodes != VK_NULL_HANDLE) {
+		vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayoutNodes, nullptr);
+		descriptorSetLayoutNodes = VK_NULL_HANDLE;
 	}
 	if (descriptorSetLayoutImage != VK_NULL_HANDLE) {
 		vkDestroyDescriptorSetLayout(device->logicalDevice, descriptorSetLayoutImage, nullptr);
 		descriptorSetLayoutImage = VK_NULL_HANDLE;
 	}
-	vkDestroyDescriptorPool(device->logicalDevice, descriptorPool, nullptr);
+	descriptorAllocator.destroy();
 	emptyTexture.destroy();
 }
 
@@ -800,6 +809,8 @@ void vkglTF::Model::loadNode(vkglTF::Node *parent, const tinygltf::Node &node, u
 		const tinygltf::Mesh mesh = model.meshes[node.mesh];
 		Mesh *newMesh = new Mesh(device, newNode->matrix);
 		newMesh->name = mesh.name;
+		newMesh->index = static_cast<uint32_t>(meshes.size());
+		meshes.push_back(newMesh);
 		for (size_t j = 0; j < mesh.primitives.size(); j++) {
 			const tinygltf::Primitive &primitive = mesh.primitives[j];
 			if (primitive.indices < 0) {
@@ -991,6 +1002,7 @@ void vkglTF::Model::loadSkins(tinygltf::Model &gltfModel)
 
 void vkglTF::Model::loadImages(tinygltf::Model &gltfModel, vks::VulkanDevice *device, VkQueue transferQueue)
 {
+	VKS_PROFILE_ZONE("glTF images");
 	for (tinygltf::Image &image : gltfModel.images) {
 		vkglTF::Texture texture;
 		texture.fromglTfImage(image, path, device, transferQueue);
@@ -1044,10 +1056,12 @@ void vkglTF::Model::loadMaterials(tinygltf::Model &gltfModel)
 			material.alphaCutoff = static_cast<float>(mat.additionalValues["alphaCutoff"].Factor());
 		}
 
+		material.index = static_cast<uint32_t>(materials.size());
 		materials.push_back(material);
 	}
 	// Push a default material at the end of the list for meshes with no material assigned
 	materials.push_back(Material(device));
+	materials.back().index = static_cast<uint32_t>(materials.size() - 1);
 }
 
 void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
@@ -1166,6 +1180,7 @@ void vkglTF::Model::loadAnimations(tinygltf::Model &gltfModel)
 
 void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device, VkQueue transferQueue, uint32_t fileLoadingFlags, float scale)
 {
+	VKS_PROFILE_ZONE("glTF load");
 	tinygltf::Model gltfModel;
 	tinygltf::TinyGLTF gltfContext;
 	if (fileLoadingFlags & FileLoadingFlags::DontLoadImages) {
@@ -1190,7 +1205,11 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 	// We let tinygltf handle this, by passing the asset manager of our app
 	tinygltf::asset_manager = androidApp->activity->assetManager;
 #endif
-	bool fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
+	bool fileLoaded;
+	{
+		VKS_PROFILE_ZONE("glTF parse");
+		fileLoaded = gltfContext.LoadASCIIFromFile(&gltfModel, &error, &warning, filename);
+	}
 
 	std::vector<uint32_t> indexBuffer;
 	std::vector<Vertex> vertexBuffer;
@@ -1200,6 +1219,7 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 			loadImages(gltfModel, device, transferQueue);
 		}
 		loadMaterials(gltfModel);
+		VKS_PROFILE_ZONE("glTF nodes");
 		const tinygltf::Scene &scene = gltfModel.scenes[gltfModel.defaultScene > -1 ? gltfModel.defaultScene : 0];
 		for (size_t i = 0; i < scene.nodes.size(); i++) {
 			const tinygltf::Node node = gltfModel.nodes[scene.nodes[i]];
@@ -1312,94 +1332,84 @@ void vkglTF::Model::loadFromFile(std::string filename, vks::VulkanDevice *device
 		&indices.memory));
 
 	// Copy from staging buffers
-	VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+	{
+		VKS_PROFILE_ZONE("glTF buffer upload");
+		VkCommandBuffer copyCmd = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
-	VkBufferCopy copyRegion = {};
+		VkBufferCopy copyRegion = {};
 
-	copyRegion.size = vertexBufferSize;
-	vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
+		copyRegion.size = vertexBufferSize;
+		vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
 
-	copyRegion.size = indexBufferSize;
-	vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
+		copyRegion.size = indexBufferSize;
+		vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
 
-	device->flushCommandBuffer(copyCmd, transferQueue, true);
+		device->flushCommandBuffer(copyCmd, transferQueue, true);
+	}
 
 	vkDestroyBuffer(device->logicalDevice, vertexStaging.buffer, nullptr);
 	vkFreeMemory(device->logicalDevice, vertexStaging.memory, nullptr);
 	vkDestroyBuffer(device->logicalDevice, indexStaging.buffer, nullptr);
 	vkFreeMemory(device->logicalDevice, indexStaging.memory, nullptr);
 
+	if (fileLoadingFlags & FileLoadingFlags::KeepHostData) {
+		hostVertices = std::move(vertexBuffer);
+		hostIndices = std::move(indexBuffer);
+	}
+
 	getSceneDimensions();
 
 	// Setup descriptors
-	uint32_t uboCount{ 0 };
-	uint32_t imageCount{ 0 };
-	for (auto node : linearNodes) {
-		if (node->mesh) {
-			uboCount++;
-		}
-	}
-	for (auto material : materials) {
-		if (material.baseColorTexture != nullptr) {
-			imageCount++;
-		}
-	}
-	std::vector<VkDescriptorPoolSize> poolSizes = {
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uboCount },
-	};
-	if (imageCount > 0) {
-		if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
-			poolSizes.push_back({ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageCount });
-		}
-		if (descriptorBindingFlags & DescriptorBindingFlags::ImageNormalMap) {
-			poolSizes.push_back({ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageCount });
-		}
-	}
-	VkDescriptorPoolCreateInfo descriptorPoolCI{};
-	descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	descriptorPoolCI.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-	descriptorPoolCI.pPoolSizes = poolSizes.data();
-	descriptorPoolCI.maxSets = uboCount + imageCount;
-	VK_CHECK_RESULT(vkCreateDescriptorPool(device->logicalDevice, &descriptorPoolCI, nullptr, &descriptorPool));
+	// Pools are created by the allocator as needed, so descriptors don't need to be counted up front
+	const bool bindless = (descriptorBindingFlags & DescriptorBindingFlags::BindlessMaterials);
+	descriptorAllocator.create(device->logicalDevice);
 
-	// Descriptors for per-node uniform buffers
+	// Descriptor for the node matrices of all meshes
 	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0),
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 1),
+		};
 		// Layout is global, so only create if it hasn't already been created before
-		if (descriptorSetLayoutUbo == VK_NULL_HANDLE) {
-			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
-			};
+		if (descriptorSetLayoutNodes == VK_NULL_HANDLE) {
 			VkDescriptorSetLayoutCreateInfo descriptorLayoutCI{};
 			descriptorLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 			descriptorLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
-			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutUbo));
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutNodes));
 		}
-		for (auto node : nodes) {
-			prepareNodeDescriptor(node, descriptorSetLayoutUbo);
+		descriptorAllocator.registerLayout(descriptorSetLayoutNodes, setLayoutBindings);
+		if (!meshes.empty()) {
+			prepareNodeBuffer();
 		}
 	}
 
+	// Descriptor for all materials and textures
+	if (bindless) {
+		prepareBindlessMaterials(transferQueue);
+	}
+
 	// Descriptors for per-material images
-	{
+	if (!bindless) {
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings{};
+		if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
+			setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, static_cast<uint32_t>(setLayoutBindings.size())));
+		}
+		if (descriptorBindingFlags & DescriptorBindingFlags::ImageNormalMap) {
+			setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, static_cast<uint32_t>(setLayoutBindings.size())));
+		}
 		// Layout is global, so only create if it hasn't already been created before
 		if (descriptorSetLayoutImage == VK_NULL_HANDLE) {
-			std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings{};
-			if (descriptorBindingFlags & DescriptorBindingFlags::ImageBaseColor) {
-				setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, static_cast<uint32_t>(setLayoutBindings.size())));
-			}
-			if (descriptorBindingFlags & DescriptorBindingFlags::ImageNormalMap) {
-				setLayoutBindings.push_back(vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, static_cast<uint32_t>(setLayoutBindings.size())));
-			}
 			VkDescriptorSetLayoutCreateInfo descriptorLayoutCI{};
 			descriptorLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 			descriptorLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
 			descriptorLayoutCI.pBindings = setLayoutBindings.data();
 			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutImage));
 		}
+		descriptorAllocator.registerLayout(descriptorSetLayoutImage, setLayoutBindings);
 		for (auto& material : materials) {
 			if (material.baseColorTexture != nullptr) {
-				material.createDescriptorSet(descriptorPool, vkglTF::descriptorSetLayoutImage, descriptorBindingFlags);
+				material.createDescriptorSet(descriptorAllocator, vkglTF::descriptorSetLayoutImage, descriptorBindingFlags);
 			}
 		}
 	}
@@ -1430,7 +1440,15 @@ void vkglTF::Model::drawNode(Node *node, VkCommandBuffer commandBuffer, uint32_t
 			}
 			if (!skip) {
 				if (renderFlags & RenderFlags::BindImages) {
-					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &material.descriptorSet, 0, nullptr);
+					if (bindlessMaterials.descriptorSet != VK_NULL_HANDLE) {
+						// The material set has been bound by draw(), only the index changes
+						if (material.index != boundMaterialIndex) {
+							vkCmdPushConstants(commandBuffer, pipelineLayout, bindlessMaterials.pushConstantStages, bindlessMaterials.pushConstantOffset, sizeof(uint32_t), &material.index);
+							boundMaterialIndex = material.index;
+						}
+					} else {
+						vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &material.descriptorSet, 0, nullptr);
+					}
 				}
 				vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
 			}
@@ -1448,6 +1466,10 @@ void vkglTF::Model::draw(VkCommandBuffer commandBuffer, uint32_t renderFlags, Vk
 		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices.buffer, offsets);
 		vkCmdBindIndexBuffer(commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 	}
+	if ((renderFlags & RenderFlags::BindImages) && (bindlessMaterials.descriptorSet != VK_NULL_HANDLE)) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &bindlessMaterials.descriptorSet, 0, nullptr);
+		boundMaterialIndex = UINT32_MAX;
+	}
 	for (auto& node : nodes) {
 		drawNode(node, commandBuffer, renderFlags, pipelineLayout, bindImageSet);
 	}
@@ -1569,26 +1591,245 @@ vkglTF::Node* vkglTF::Model::nodeFromIndex(uint32_t index) {
 	return nodeFound;
 }
 
-void vkglTF::Model::prepareNodeDescriptor(vkglTF::Node* node, VkDescriptorSetLayout descriptorSetLayout) {
-	if (node->mesh) {
-		VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-		descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-		descriptorSetAllocInfo.descriptorPool = descriptorPool;
-		descriptorSetAllocInfo.pSetLayouts = &descriptorSetLayout;
-		descriptorSetAllocInfo.descriptorSetCount = 1;
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(device->logicalDevice, &descriptorSetAllocInfo, &node->mesh->uniformBuffer.descriptorSet));
+/*
+	Puts all textures into a single descriptor array and the parameters of all materials into a storage buffer
+	The layout is global and its texture array is sized for the device limit, each model only allocates as many descriptors as it has textures
+	The texture binding is update-after-bind, so the (much higher) update-after-bind limits apply instead of the regular per-stage limits
+	Requires the descriptorBindingVariableDescriptorCount, descriptorBindingPartiallyBound and descriptorBindingSampledImageUpdateAfterBind features
+*/
+void vkglTF::Model::prepareBindlessMaterials(VkQueue transferQueue)
+{
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties{};
+	descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+	VkPhysicalDeviceProperties2 deviceProperties2{};
+	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	deviceProperties2.pNext = &descriptorIndexingProperties;
+	vkGetPhysicalDeviceProperties2(device->physicalDevice, &deviceProperties2);
+	// Leave room for the samplers of the other sets of a pipeline layout, as they count against the same limits (16 is the guaranteed per-stage minimum)
+	const uint32_t reservedSamplerCount = 16;
+	const uint32_t maxTextureCount = std::min({
+		descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		descriptorIndexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		descriptorIndexingProperties.maxPerStageUpdateAfterBindResources,
+		descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+		descriptorIndexingProperties.maxDescriptorSetUpdateAfterBindSampledImages }) - reservedSamplerCount;
+	const uint32_t textureCount = static_cast<uint32_t>(textures.size()) + 1;
+	if (textureCount > maxTextureCount) {
+		vks::tools::exitFatal("Model \"" + path + "\" uses " + std::to_string(textureCount) + " textures, the device only supports " + std::to_string(maxTextureCount) + " in a bindless material set", -1);
+		return;
+	}
 
-		VkWriteDescriptorSet writeDescriptorSet{};
-		writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		writeDescriptorSet.descriptorCount = 1;
-		writeDescriptorSet.dstSet = node->mesh->uniformBuffer.descriptorSet;
-		writeDescriptorSet.dstBinding = 0;
-		writeDescriptorSet.pBufferInfo = &node->mesh->uniformBuffer.descriptor;
+	std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+		vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+		vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1, maxTextureCount),
+	};
+	// The texture array is sized per model and textures not used by any material don't need to be valid
+	const std::vector<VkDescriptorBindingFlagsEXT> bindingFlags = {
+		0,
+		VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT
+	};
+	// Layout is global, so only create if it hasn't already been created before
+	if (descriptorSetLayoutMaterials == VK_NULL_HANDLE) {
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT setLayoutBindingFlags{};
+		setLayoutBindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		setLayoutBindingFlags.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+		setLayoutBindingFlags.pBindingFlags = bindingFlags.data();
+		VkDescriptorSetLayoutCreateInfo descriptorLayoutCI{};
+		descriptorLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		descriptorLayoutCI.pNext = &setLayoutBindingFlags;
+		descriptorLayoutCI.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		descriptorLayoutCI.bindingCount = static_cast<uint32_t>(setLayoutBindings.size());
+		descriptorLayoutCI.pBindings = setLayoutBindings.data();
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device->logicalDevice, &descriptorLayoutCI, nullptr, &descriptorSetLayoutMaterials));
+	}
+	descriptorAllocator.registerLayout(descriptorSetLayoutMaterials, setLayoutBindings, bindingFlags);
+
+	// Material parameters
+	std::vector<Material::ShaderData> shaderMaterials(materials.size());
+	for (auto& material : materials) {
+		Material::ShaderData& shaderMaterial = shaderMaterials[material.index];
+		shaderMaterial.baseColorFactor = material.baseColorFactor;
+		shaderMaterial.metallicFactor = material.metallicFactor;
+		shaderMaterial.roughnessFactor = material.roughnessFactor;
+		shaderMaterial.alphaCutoff = material.alphaCutoff;
+		shaderMaterial.alphaMode = static_cast<uint32_t>(material.alphaMode);
+		shaderMaterial.baseColorTexture = getTextureIndex(material.baseColorTexture);
+		shaderMaterial.metallicRoughnessTexture = getTextureIndex(material.metallicRoughnessTexture);
+		shaderMaterial.normalTexture = getTextureIndex(material.normalTexture);
+		shaderMaterial.occlusionTexture = getTextureIndex(material.occlusionTexture);
+		shaderMaterial.emissiveTexture = getTextureIndex(material.emissiveTexture);
+	}
+	const VkDeviceSize bufferSize = shaderMaterials.size() * sizeof(Material::ShaderData);
+	vks::Buffer stagingBuffer;
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer,
+		bufferSize,
+		shaderMaterials.data()));
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | memoryPropertyFlags,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		&bindlessMaterials.buffer,
+		bufferSize));
+	device->copyBuffer(&stagingBuffer, &bindlessMaterials.buffer, transferQueue);
+	stagingBuffer.destroy();
+
+	bindlessMaterials.descriptorSet = descriptorAllocator.allocate(descriptorSetLayoutMaterials, textureCount);
 
-		vkUpdateDescriptorSets(device->logicalDevice, 1, &writeDescriptorSet, 0, nullptr);
+	std::vector<VkDescriptorImageInfo> textureDescriptors;
+	textureDescriptors.reserve(textureCount);
+	for (auto& texture : textures) {
+		textureDescriptors.push_back(texture.descriptor);
 	}
-	for (auto& child : node->children) {
-		prepareNodeDescriptor(child, descriptorSetLayout);
+	// The empty texture isn't created if images aren't loaded, the array is partially bound so it can stay empty
+	if (emptyTexture.device != nullptr) {
+		textureDescriptors.push_back(emptyTexture.descriptor);
+	}
+	std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+		vks::initializers::writeDescriptorSet(bindlessMaterials.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bindlessMaterials.buffer.descriptor),
+	};
+	if (!textureDescriptors.empty()) {
+		VkWriteDescriptorSet writeDescriptorSet = vks::initializers::writeDescriptorSet(bindlessMaterials.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, textureDescriptors.data(), static_cast<uint32_t>(textureDescriptors.size()));
+		writeDescriptorSets.push_back(writeDescriptorSet);
 	}
+	vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+}
+
+/*
+	Creates the storage buffer for the matrices of all meshes and the joint matrices of all skins
+	Each frame gets its own copy of the data, so the host can update one while the others are still in use by the device
+*/
+void vkglTF::Model::prepareNodeBuffer()
+{
+	nodeBuffer.frameCount = std::max(std::min(nodeBufferFrameCount, 32u), 1u);
+	nodeBuffer.nonCoherentAtomSize = device->properties.limits.nonCoherentAtomSize;
+	const VkDeviceSize storageAlignment = device->properties.limits.minStorageBufferOffsetAlignment;
+	auto alignTo = [](VkDeviceSize size, VkDeviceSize alignment) { return (size + alignment - 1) & ~(alignment - 1); };
+
+	// Assign each mesh its range of the joint matrix array
+	uint32_t jointCount = 0;
+	for (auto mesh : meshes) {
+		mesh->nodeData.firstJoint = jointCount;
+		jointCount += static_cast<uint32_t>(mesh->jointMatrices.size());
+	}
+	// Descriptor ranges can't be empty
+	const VkDeviceSize jointsSize = std::max(jointCount, 1u) * sizeof(glm::mat4);
+	nodeBuffer.jointsOffset = alignTo(meshes.size() * sizeof(Mesh::NodeData), storageAlignment);
+	nodeBuffer.frameSize = alignTo(nodeBuffer.jointsOffset + jointsSize, std::max(storageAlignment, nodeBuffer.nonCoherentAtomSize));
+
+	// Persistently mapped, not necessarily coherent, only ranges that changed are flushed
+	VK_CHECK_RESULT(device->createBuffer(
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+		&nodeBuffer.buffer,
+		nodeBuffer.frameSize * nodeBuffer.frameCount));
+	VK_CHECK_RESULT(nodeBuffer.buffer.map());
+
+	nodeBuffer.descriptorSet = descriptorAllocator.allocate(descriptorSetLayoutNodes);
+
+	// Dynamic offsets select the frame
+	VkDescriptorBufferInfo meshesDescriptor{ nodeBuffer.buffer.buffer, 0, meshes.size() * sizeof(Mesh::NodeData) };
+	VkDescriptorBufferInfo jointsDescriptor{ nodeBuffer.buffer.buffer, nodeBuffer.jointsOffset, jointsSize };
+	std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+		vks::initializers::writeDescriptorSet(nodeBuffer.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 0, &meshesDescriptor),
+		vks::initializers::writeDescriptorSet(nodeBuffer.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, &jointsDescriptor),
+	};
+	vkUpdateDescriptorSets(device->logicalDevice, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+	// Initial upload for all frames
+	for (uint32_t i = 0; i < nodeBuffer.frameCount; i++) {
+		updateNodeBuffer(i);
+	}
+}
+
+/*
+	Copies the data of all meshes that changed since the given frame's copy was last updated
+	Must only be called once the device has finished using that frame (e.g. after the frame's fence has been waited on)
+*/
+void vkglTF::Model::updateNodeBuffer(uint32_t frameIndex)
+{
+	if (!nodeBuffer.buffer.mapped) {
+		return;
+	}
+	assert(frameIndex < nodeBuffer.frameCount);
+	const uint32_t frameBit = 1u << frameIndex;
+	const VkDeviceSize frameOffset = nodeBuffer.frameSize * frameIndex;
+	uint8_t* frameData = static_cast<uint8_t*>(nodeBuffer.buffer.mapped) + frameOffset;
+
+	// Consecutive dirty meshes are merged into a single range, separately for the mesh and the joint arrays
+	// Ranges are not necessarily added in offset order, so they are sorted and coalesced before flushing
+	std::vector<VkMappedMemoryRange> ranges;
+	auto addRange = [&](VkDeviceSize start, VkDeviceSize end) {
+		const VkDeviceSize atom = nodeBuffer.nonCoherentAtomSize;
+		start = frameOffset + (start / atom) * atom;
+		end = std::min(frameOffset + ((end + atom - 1) / atom) * atom, nodeBuffer.buffer.size);
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = nodeBuffer.buffer.memory;
+		range.offset = start;
+		range.size = end - start;
+		ranges.push_back(range);
+	};
+
+	VkDeviceSize meshStart = 0, meshEnd = 0;
+	VkDeviceSize jointStart = 0, jointEnd = 0;
+	for (auto mesh : meshes) {
+		if ((mesh->dirtyFrames & frameBit) == 0) {
+			continue;
+		}
+		mesh->dirtyFrames &= ~frameBit;
+		const VkDeviceSize offset = mesh->index * sizeof(Mesh::NodeData);
+		memcpy(frameData + offset, &mesh->nodeData, sizeof(Mesh::NodeData));
+		if (offset != meshEnd) {
+			if (meshEnd > meshStart) {
+				addRange(meshStart, meshEnd);
+			}
+			meshStart = offset;
+		}
+		meshEnd = offset + sizeof(Mesh::NodeData);
+		if (!mesh->jointMatrices.empty()) {
+			const VkDeviceSize jointsOffset = nodeBuffer.jointsOffset + mesh->nodeData.firstJoint * sizeof(glm::mat4);
+			const VkDeviceSize jointsSize = mesh->jointMatrices.size() * sizeof(glm::mat4);
+			memcpy(frameData + jointsOffset, mesh->jointMatrices.data(), jointsSize);
+			if (jointsOffset != jointEnd) {
+				if (jointEnd > jointStart) {
+					addRange(jointStart, jointEnd);
+				}
+				jointStart = jointsOffset;
+			}
+			jointEnd = jointsOffset + jointsSize;
+		}
+	}
+	if (meshEnd > meshStart) {
+		addRange(meshStart, meshEnd);
+	}
+	if (jointEnd > jointStart) {
+		addRange(jointStart, jointEnd);
+	}
+	if (ranges.empty()) {
+		return;
+	}
+	std::sort(ranges.begin(), ranges.end(), [](const VkMappedMemoryRange& a, const VkMappedMemoryRange& b) { return a.offset < b.offset; });
+	std::vector<VkMappedMemoryRange> flushRanges = { ranges.front() };
+	for (size_t i = 1; i < ranges.size(); i++) {
+		VkMappedMemoryRange& last = flushRanges.back();
+		if (last.offset + last.size >= ranges[i].offset) {
+			last.size = std::max(last.offset + last.size, ranges[i].offset + ranges[i].size) - last.offset;
+		} else {
+			flushRanges.push_back(ranges[i]);
+		}
+	}
+	VK_CHECK_RESULT(vkFlushMappedMemoryRanges(device->logicalDevice, static_cast<uint32_t>(flushRanges.size()), flushRanges.data()));
+}
+
+/*
+	Binds the node descriptor set with the dynamic offsets of the given frame
+	Shaders index the mesh array with the mesh index (see Mesh::index) and the joint array with NodeData::firstJoint
+*/
+void vkglTF::Model::bindNodeBuffer(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t set, uint32_t frameIndex)
+{
+	const uint32_t dynamicOffset = static_cast<uint32_t>(nodeBuffer.frameSize * frameIndex);
+	const uint32_t dynamicOffsets[2] = { dynamicOffset, dynamicOffset };
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, set, 1, &nodeBuffer.descriptorSet, 2, dynamicOffsets);
 }
@@ -15,6 +15,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanDevice.h"
+#include "VulkanDescriptorAllocator.h"
 
 #include <ktx.h>
 #include <ktxvulkan.h>
@@ -39,13 +40,17 @@ namespace vkglTF
 {
 	enum DescriptorBindingFlags {
 		ImageBaseColor = 0x00000001,
-		ImageNormalMap = 0x00000002
+		ImageNormalMap = 0x00000002,
+		/** @brief Create one descriptor set per model with all textures in a single array and all materials in a storage buffer (requires descriptor indexing) instead of one set per material */
+		BindlessMaterials = 0x00000004
 	};
 
 	extern VkDescriptorSetLayout descriptorSetLayoutImage;
-	extern VkDescriptorSetLayout descriptorSetLayoutUbo;
+	extern VkDescriptorSetLayout descriptorSetLayoutMaterials;
+	extern VkDescriptorSetLayout descriptorSetLayoutNodes;
 	extern VkMemoryPropertyFlags memoryPropertyFlags;
 	extern uint32_t descriptorBindingFlags;
+	extern uint32_t nodeBufferFrameCount;
 
 	struct Node;
 
@@ -89,9 +94,26 @@ namespace vkglTF
 		vkglTF::Texture* diffuseTexture;
 
 		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		/** @brief Index into the model's material storage buffer */
+		uint32_t index = 0;
+
+		/** @brief Material as stored in the material storage buffer (std430 layout), texture indices are -1 if not present */
+		struct ShaderData {
+			glm::vec4 baseColorFactor;
+			float metallicFactor;
+			float roughnessFactor;
+			float alphaCutoff;
+			uint32_t alphaMode;
+			int32_t baseColorTexture;
+			int32_t metallicRoughnessTexture;
+			int32_t normalTexture;
+			int32_t occlusionTexture;
+			int32_t emissiveTexture;
+			int32_t _pad[3];
+		};
 
 		Material(vks::VulkanDevice* device) : device(device) {};
-		void createDescriptorSet(VkDescriptorPool descriptorPool, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags);
+		void createDescriptorSet(vks::DescriptorAllocator& descriptorAllocator, VkDescriptorSetLayout descriptorSetLayout, uint32_t descriptorBindingFlags);
 	};
 
 	/*
@@ -125,19 +147,20 @@ namespace vkglTF
 		std::vector<Primitive*> primitives;
 		std::string name;
 
-		struct UniformBuffer {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-			VkDescriptorBufferInfo descriptor;
-			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
-			void* mapped;
-		} uniformBuffer;
-
-		struct UniformBlock {
+		/** @brief Entry of this mesh in the model's node storage buffer (std430 layout) */
+		struct NodeData {
 			glm::mat4 matrix;
-			glm::mat4 jointMatrix[64]{};
-			float jointcount{ 0 };
-		} uniformBlock;
+			/** @brief First matrix of this mesh in the joint matrix array */
+			uint32_t firstJoint{ 0 };
+			uint32_t jointCount{ 0 };
+			uint32_t _pad[2];
+		} nodeData;
+		std::vector<glm::mat4> jointMatrices;
+
+		/** @brief Index into the node storage buffer */
+		uint32_t index{ 0 };
+		/** @brief One bit per frame copy of the node storage buffer that doesn't contain the current data yet */
+		uint32_t dirtyFrames{ 0 };
 
 		Mesh(vks::VulkanDevice* device, glm::mat4 matrix);
 		~Mesh();
@@ -233,7 +256,9 @@ namespace vkglTF
 		PreTransformVertices = 0x00000001,
 		PreMultiplyVertexColors = 0x00000002,
 		FlipY = 0x00000004,
-		DontLoadImages = 0x00000008
+		DontLoadImages = 0x00000008,
+		/** @brief Keep a copy of the vertex and index data in host memory (e.g. for building acceleration structures on the CPU) */
+		KeepHostData = 0x00000010
 	};
 
 	enum RenderFlags {
@@ -249,11 +274,15 @@ namespace vkglTF
 	class Model {
 	private:
 		vkglTF::Texture* getTexture(uint32_t index);
+		int32_t getTextureIndex(vkglTF::Texture* texture);
 		vkglTF::Texture emptyTexture;
 		void createEmptyTexture(VkQueue transferQueue);
+		void prepareBindlessMaterials(VkQueue transferQueue);
+		uint32_t boundMaterialIndex = UINT32_MAX;
 	public:
 		vks::VulkanDevice* device;
-		VkDescriptorPool descriptorPool;
+		/** @brief All descriptor sets of the model are allocated from this */
+		vks::DescriptorAllocator descriptorAllocator;
 
 		struct Vertices {
 			int count;
@@ -266,8 +295,41 @@ namespace vkglTF
 			VkDeviceMemory memory;
 		} indices;
 
+		/** @brief Host copies of the vertex and index buffers, only filled when loading with FileLoadingFlags::KeepHostData */
+		std::vector<Vertex> hostVertices;
+		std::vector<uint32_t> hostIndices;
+
 		std::vector<Node*> nodes;
 		std::vector<Node*> linearNodes;
+		/** @brief All meshes by their node buffer index */
+		std::vector<Mesh*> meshes;
+
+		/**
+		* @brief Matrices of all meshes and joint matrices of all skins in one persistently mapped storage buffer
+		* @note Contains nodeBufferFrameCount copies, each one is selected with dynamic offsets when binding the descriptor set
+		* @note Binding 0 holds one Mesh::NodeData per mesh, binding 1 the joint matrices
+		*/
+		struct NodeBuffer {
+			vks::Buffer buffer;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+			uint32_t frameCount = 1;
+			VkDeviceSize frameSize = 0;
+			VkDeviceSize jointsOffset = 0;
+			VkDeviceSize nonCoherentAtomSize = 1;
+		} nodeBuffer;
+
+		/**
+		* @brief Single descriptor set for all materials, only created with DescriptorBindingFlags::BindlessMaterials
+		* @note Binding 0 is a storage buffer with one Material::ShaderData per material, binding 1 an array with all textures (the empty texture comes last)
+		* @note Drawing with RenderFlags::BindImages binds the set once and passes Material::index to the shaders as a push constant
+		*/
+		struct BindlessMaterials {
+			vks::Buffer buffer;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+			/** @brief Push constant range the material index is written to */
+			VkShaderStageFlags pushConstantStages = VK_SHADER_STAGE_FRAGMENT_BIT;
+			uint32_t pushConstantOffset = 0;
+		} bindlessMaterials;
 
 		std::vector<Skin*> skins;
 
@@ -303,6 +365,8 @@ namespace vkglTF
 		void updateAnimation(uint32_t index, float time);
 		Node* findNode(Node* parent, uint32_t index);
 		Node* nodeFromIndex(uint32_t index);
-		void prepareNodeDescriptor(vkglTF::Node* node, VkDescriptorSetLayout descriptorSetLayout);
+		void prepareNodeBuffer();
+		void updateNodeBuffer(uint32_t frameIndex = 0);
+		void bindNodeBuffer(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t set, uint32_t frameIndex = 0);
 	};
 }
\ No newline at end of file
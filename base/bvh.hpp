@@ -0,0 +1,447 @@
+/*
+* Bounding volume hierarchy
+*
+* Binned surface area heuristic (SAH) builder with parallel subtree construction, flattened into a GPU friendly node layout
+* Supports refitting the bounds for moving primitives without rebuilding the tree
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <float.h>
+#include <glm/glm.hpp>
+
+namespace vks
+{
+	/** @brief Axis aligned bounding box, an empty box has inverted bounds */
+	struct AABB
+	{
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+
+		AABB() = default;
+		AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+		void grow(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+
+		void grow(const AABB& aabb)
+		{
+			min = glm::min(min, aabb.min);
+			max = glm::max(max, aabb.max);
+		}
+
+		glm::vec3 center() const
+		{
+			return (min + max) * 0.5f;
+		}
+
+		/** @brief Surface area, zero for empty boxes */
+		float area() const
+		{
+			const glm::vec3 extent = max - min;
+			if ((extent.x < 0.0f) || (extent.y < 0.0f) || (extent.z < 0.0f)) {
+				return 0.0f;
+			}
+			return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+
+		/** @brief Slab test, returns the entry distance along the ray or FLT_MAX if the box is missed or farther away than tMax */
+		float intersect(const glm::vec3& origin, const glm::vec3& invDirection, float tMax) const
+		{
+			const glm::vec3 t0 = (min - origin) * invDirection;
+			const glm::vec3 t1 = (max - origin) * invDirection;
+			const glm::vec3 tNear = glm::min(t0, t1);
+			const glm::vec3 tFar = glm::max(t0, t1);
+			const float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+			const float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+			return (tEnter <= tExit) ? tEnter : FLT_MAX;
+		}
+	};
+
+	/**
+	* @brief Bounding volume hierarchy over an arbitrary list of primitives, built from their bounding boxes
+	* @note Nodes are stored depth first: the first child of an inner node directly follows it, the second one is referenced by index
+	* @note Leaves reference a contiguous range of primitives, so primitive data must be stored in the order given by primitiveIndices (see reorder())
+	*/
+	class BVH
+	{
+	public:
+		/** @brief Flattened node, matches a std430 struct with { vec3 aabbMin; uint offset; vec3 aabbMax; uint count; } */
+		struct Node
+		{
+			glm::vec3 aabbMin;
+			/** @brief Index of the first primitive for leaves, index of the second child for inner nodes */
+			uint32_t offset;
+			glm::vec3 aabbMax;
+			/** @brief Number of primitives, zero for inner nodes */
+			uint32_t count;
+		};
+
+		struct Settings
+		{
+			/** @brief Number of bins per axis used to evaluate split candidates */
+			uint32_t binCount = 16;
+			/** @brief Nodes with more primitives are always split */
+			uint32_t maxLeafSize = 8;
+			/** @brief Cost of traversing an inner node relative to intersecting a single primitive */
+			float traversalCost = 1.0f;
+			/** @brief Subtrees with at least this many primitives are built on a separate thread */
+			uint32_t parallelThreshold = 8192;
+			/** @brief Maximum number of threads used for building, zero uses all hardware threads and one builds serially */
+			uint32_t threadCount = 0;
+		};
+
+		struct Statistics
+		{
+			/** @brief Build time in milliseconds */
+			double buildTime = 0.0;
+			/** @brief Time of the last refit in milliseconds */
+			double refitTime = 0.0;
+			uint32_t nodeCount = 0;
+			uint32_t leafCount = 0;
+			uint32_t depth = 0;
+			/** @brief Expected cost of a ray query relative to intersecting a single primitive */
+			float sahCost = 0.0f;
+		};
+
+		/** @brief Maximum tree depth, deeper nodes are turned into leaves so traversal stacks with this many entries never overflow */
+		static const uint32_t maxDepth = 64;
+
+		Settings settings;
+		std::vector<Node> nodes;
+		/** @brief Primitive i in BVH order is input primitive primitiveIndices[i] */
+		std::vector<uint32_t> primitiveIndices;
+		Statistics statistics;
+
+		/** @brief Build the hierarchy from per primitive bounds */
+		void build(const std::vector<AABB>& primitiveBounds)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			nodes.clear();
+			primitiveIndices.clear();
+			statistics = Statistics();
+			const uint32_t primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+			if (primitiveCount == 0) {
+				return;
+			}
+
+			BuildContext context(primitiveBounds);
+			context.settings = settings;
+			context.settings.binCount = std::max(context.settings.binCount, 2u);
+			context.settings.maxLeafSize = std::max(context.settings.maxLeafSize, 1u);
+			context.threadBudget = (settings.threadCount == 0) ? std::max(std::thread::hardware_concurrency(), 1u) : settings.threadCount;
+			context.threadBudget--;
+			context.indices.resize(primitiveCount);
+			context.centroids.resize(primitiveCount);
+			for (uint32_t i = 0; i < primitiveCount; i++) {
+				context.indices[i] = i;
+				context.centroids[i] = primitiveBounds[i].center();
+			}
+			// A binary tree with one primitive per leaf has at most 2n-1 nodes
+			context.buildNodes.resize(2 * primitiveCount - 1);
+			context.nodeCount = 1;
+			buildRecursive(context, 0, 0, primitiveCount, 0);
+
+			flatten(context);
+			primitiveIndices = std::move(context.indices);
+
+			statistics.buildTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			statistics.nodeCount = static_cast<uint32_t>(nodes.size());
+			statistics.depth = context.depth;
+			calculateStatistics();
+		}
+
+		/** @brief Recalculate all node bounds for primitives that moved, bounds are indexed like the input of build() */
+		void refit(const std::vector<AABB>& primitiveBounds)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			// Children are always stored after their parent, so a reverse pass updates bottom up
+			for (size_t i = nodes.size(); i-- > 0;) {
+				Node& node = nodes[i];
+				AABB bounds;
+				if (node.count > 0) {
+					for (uint32_t p = 0; p < node.count; p++) {
+						bounds.grow(primitiveBounds[primitiveIndices[node.offset + p]]);
+					}
+				} else {
+					const Node& left = nodes[i + 1];
+					const Node& right = nodes[node.offset];
+					bounds.grow(AABB(left.aabbMin, left.aabbMax));
+					bounds.grow(AABB(right.aabbMin, right.aabbMax));
+				}
+				node.aabbMin = bounds.min;
+				node.aabbMax = bounds.max;
+			}
+			statistics.refitTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		}
+
+		/** @brief Returns a copy of the primitive data in BVH order */
+		template <typename T>
+		std::vector<T> reorder(const std::vector<T>& primitives) const
+		{
+			std::vector<T> ordered(primitiveIndices.size());
+			for (size_t i = 0; i < primitiveIndices.size(); i++) {
+				ordered[i] = primitives[primitiveIndices[i]];
+			}
+			return ordered;
+		}
+
+		/**
+		* Find the closest intersection along a ray (CPU reference of the shader traversal)
+		*
+		* @param origin Ray origin
+		* @param direction Ray direction
+		* @param tMax Maximum distance, updated with the distance of the closest hit
+		* @param intersect Callback bool(uint32_t primitive, float& tMax) for primitives in BVH order, returns true and shortens tMax on a closer hit
+		*
+		* @return Index of the closest primitive (in BVH order) or UINT32_MAX if nothing was hit
+		*/
+		template <typename IntersectFunc>
+		uint32_t traverse(const glm::vec3& origin, const glm::vec3& direction, float& tMax, IntersectFunc intersect) const
+		{
+			uint32_t hit = UINT32_MAX;
+			if (nodes.empty()) {
+				return hit;
+			}
+			const glm::vec3 invDirection = 1.0f / direction;
+			if (AABB(nodes[0].aabbMin, nodes[0].aabbMax).intersect(origin, invDirection, tMax) == FLT_MAX) {
+				return hit;
+			}
+			uint32_t stack[maxDepth];
+			uint32_t stackSize = 0;
+			uint32_t nodeIndex = 0;
+			while (true) {
+				const Node& node = nodes[nodeIndex];
+				if (node.count > 0) {
+					for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+						if (intersect(i, tMax)) {
+							hit = i;
+						}
+					}
+				} else {
+					// Visit the closer child first, so hits found there cull the farther one
+					uint32_t nearChild = nodeIndex + 1;
+					uint32_t farChild = node.offset;
+					float nearDistance = AABB(nodes[nearChild].aabbMin, nodes[nearChild].aabbMax).intersect(origin, invDirection, tMax);
+					float farDistance = AABB(nodes[farChild].aabbMin, nodes[farChild].aabbMax).intersect(origin, invDirection, tMax);
+					if (farDistance < nearDistance) {
+						std::swap(nearChild, farChild);
+						std::swap(nearDistance, farDistance);
+					}
+					if (nearDistance != FLT_MAX) {
+						if (farDistance != FLT_MAX) {
+							stack[stackSize++] = farChild;
+						}
+						nodeIndex = nearChild;
+						continue;
+					}
+				}
+				if (stackSize == 0) {
+					break;
+				}
+				nodeIndex = stack[--stackSize];
+			}
+			return hit;
+		}
+
+	private:
+		struct BuildNode
+		{
+			AABB bounds;
+			uint32_t children[2];
+			uint32_t first;
+			uint32_t count;
+		};
+
+		struct BuildContext
+		{
+			const std::vector<AABB>& bounds;
+			Settings settings;
+			std::vector<uint32_t> indices;
+			std::vector<glm::vec3> centroids;
+			std::vector<BuildNode> buildNodes;
+			std::atomic<uint32_t> nodeCount;
+			std::atomic<int32_t> threadBudget;
+			std::atomic<uint32_t> depth;
+			BuildContext(const std::vector<AABB>& bounds) : bounds(bounds), nodeCount(0), threadBudget(0), depth(0) {}
+		};
+
+		struct Bin
+		{
+			AABB bounds;
+			uint32_t count = 0;
+		};
+
+		// Subtrees work on disjoint index ranges and node slots, so they can be built concurrently without locking
+		static void buildRecursive(BuildContext& context, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+		{
+			BuildNode& node = context.buildNodes[nodeIndex];
+			node.first = first;
+			node.count = count;
+			node.bounds = AABB();
+			AABB centroidBounds;
+			for (uint32_t i = first; i < first + count; i++) {
+				node.bounds.grow(context.bounds[context.indices[i]]);
+				centroidBounds.grow(context.centroids[context.indices[i]]);
+			}
+			uint32_t currentDepth = context.depth;
+			while ((depth > currentDepth) && !context.depth.compare_exchange_weak(currentDepth, depth)) {}
+
+			// Stop subdividing at the maximum depth to keep traversal stacks bounded
+			if ((count == 1) || (depth >= maxDepth - 1)) {
+				return;
+			}
+
+			// Evaluate the binned SAH along all axes
+			const uint32_t binCount = context.settings.binCount;
+			const float leafCost = static_cast<float>(count);
+			float bestCost = FLT_MAX;
+			int32_t bestAxis = -1;
+			uint32_t bestBin = 0;
+			const glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+			std::vector<Bin> bins(binCount);
+			std::vector<float> rightAreas(binCount);
+			std::vector<uint32_t> rightCounts(binCount);
+			for (int32_t axis = 0; axis < 3; axis++) {
+				if (extent[axis] <= 0.0f) {
+					continue;
+				}
+				std::fill(bins.begin(), bins.end(), Bin());
+				const float scale = static_cast<float>(binCount) / extent[axis];
+				for (uint32_t i = first; i < first + count; i++) {
+					const uint32_t primitive = context.indices[i];
+					const uint32_t bin = std::min(binCount - 1, static_cast<uint32_t>((context.centroids[primitive][axis] - centroidBounds.min[axis]) * scale));
+					bins[bin].count++;
+					bins[bin].bounds.grow(context.bounds[primitive]);
+				}
+				// Sweep from the right to get the cost of everything right of each split plane
+				AABB rightBounds;
+				uint32_t rightCount = 0;
+				for (uint32_t i = binCount - 1; i > 0; i--) {
+					rightBounds.grow(bins[i].bounds);
+					rightCount += bins[i].count;
+					rightAreas[i] = rightBounds.area();
+					rightCounts[i] = rightCount;
+				}
+				AABB leftBounds;
+				uint32_t leftCount = 0;
+				for (uint32_t i = 0; i < binCount - 1; i++) {
+					leftBounds.grow(bins[i].bounds);
+					leftCount += bins[i].count;
+					if ((leftCount == 0) || (rightCounts[i + 1] == 0)) {
+						continue;
+					}
+					const float cost = leftBounds.area() * leftCount + rightAreas[i + 1] * rightCounts[i + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestBin = i;
+					}
+				}
+			}
+
+			const float parentArea = node.bounds.area();
+			bestCost = (parentArea > 0.0f) ? context.settings.traversalCost + bestCost / parentArea : FLT_MAX;
+			const bool forceSplit = (count > context.settings.maxLeafSize);
+			if ((bestCost >= leafCost) && !forceSplit) {
+				return;
+			}
+
+			uint32_t mid;
+			if (bestAxis != -1) {
+				const float scale = static_cast<float>(binCount) / extent[bestAxis];
+				const float axisMin = centroidBounds.min[bestAxis];
+				auto it = std::partition(context.indices.begin() + first, context.indices.begin() + first + count, [&](uint32_t primitive) {
+					return std::min(binCount - 1, static_cast<uint32_t>((context.centroids[primitive][bestAxis] - axisMin) * scale)) <= bestBin;
+				});
+				mid = static_cast<uint32_t>(it - context.indices.begin());
+			} else {
+				// All centroids coincide, split at the object median
+				mid = first + count / 2;
+			}
+
+			const uint32_t leftChild = context.nodeCount.fetch_add(2);
+			const uint32_t rightChild = leftChild + 1;
+			node.children[0] = leftChild;
+			node.children[1] = rightChild;
+			node.count = 0;
+			const uint32_t leftCount = mid - first;
+			const uint32_t rightCount = count - leftCount;
+
+			bool spawned = false;
+			std::thread thread;
+			if (std::min(leftCount, rightCount) >= context.settings.parallelThreshold) {
+				if (context.threadBudget.fetch_sub(1) > 0) {
+					thread = std::thread(buildRecursive, std::ref(context), leftChild, first, leftCount, depth + 1);
+					spawned = true;
+				} else {
+					context.threadBudget++;
+				}
+			}
+			if (!spawned) {
+				buildRecursive(context, leftChild, first, leftCount, depth + 1);
+			}
+			buildRecursive(context, rightChild, mid, rightCount, depth + 1);
+			if (spawned) {
+				thread.join();
+				context.threadBudget++;
+			}
+		}
+
+		void flatten(const BuildContext& context)
+		{
+			nodes.reserve(context.nodeCount);
+			// Pairs of build node and the flat node whose offset needs to point at it
+			std::vector<std::pair<uint32_t, uint32_t>> stack;
+			stack.reserve(maxDepth * 2);
+			stack.push_back(std::make_pair(0u, UINT32_MAX));
+			while (!stack.empty()) {
+				const std::pair<uint32_t, uint32_t> entry = stack.back();
+				stack.pop_back();
+				const BuildNode& buildNode = context.buildNodes[entry.first];
+				const uint32_t flatIndex = static_cast<uint32_t>(nodes.size());
+				if (entry.second != UINT32_MAX) {
+					nodes[entry.second].offset = flatIndex;
+				}
+				Node node;
+				node.aabbMin = buildNode.bounds.min;
+				node.aabbMax = buildNode.bounds.max;
+				node.count = buildNode.count;
+				// Leaf ranges are already contiguous in the partitioned index list
+				node.offset = buildNode.first;
+				nodes.push_back(node);
+				if (buildNode.count == 0) {
+					stack.push_back(std::make_pair(buildNode.children[1], flatIndex));
+					stack.push_back(std::make_pair(buildNode.children[0], UINT32_MAX));
+				}
+			}
+		}
+
+		void calculateStatistics()
+		{
+			const float rootArea = AABB(nodes[0].aabbMin, nodes[0].aabbMax).area();
+			statistics.sahCost = 0.0f;
+			for (const Node& node : nodes) {
+				const float relativeArea = (rootArea > 0.0f) ? AABB(node.aabbMin, node.aabbMax).area() / rootArea : 1.0f;
+				if (node.count > 0) {
+					statistics.leafCount++;
+					statistics.sahCost += relativeArea * node.count;
+				} else {
+					statistics.sahCost += relativeArea * settings.traversalCost;
+				}
+			}
+		}
+	};
+}
@@ -0,0 +1,431 @@
+/*
+* CPU software occlusion culling
+*
+* Rasterizes occluder triangles into a low resolution depth buffer that is split into tiles, which are processed in parallel by the threads of a vks::ThreadPool
+* Bounding boxes of occludees are then tested against that depth buffer, so hidden objects can be skipped before their commands are recorded
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <float.h>
+#include <glm/glm.hpp>
+
+#include "threadpool.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define OCCLUSION_SIMD_SSE
+#endif
+
+namespace vks
+{
+	/**
+	* @brief Software depth rasterizer for occlusion culling on the CPU
+	* @note Usage per frame: beginFrame(), addOccluder() for all occluders, rasterize(), then isVisible() for the occludees (thread safe)
+	* @note Depth follows the Vulkan convention (0.0 = near, 1.0 = far), occluder triangles that cross the near plane are skipped
+	*/
+	class OcclusionCuller
+	{
+	public:
+		/** @brief Size of a tile in pixels, the width must be a multiple of four (the SIMD width) */
+		static const uint32_t TILE_WIDTH = 32;
+		static const uint32_t TILE_HEIGHT = 16;
+
+		struct Statistics
+		{
+			uint32_t occluders = 0;
+			/** @brief Occluder triangles that passed setup (in front of the near plane, non-degenerate and on screen) */
+			uint32_t rasterizedTriangles = 0;
+			uint32_t testedObjects = 0;
+			uint32_t culledObjects = 0;
+			/** @brief Time spent in rasterize() in milliseconds */
+			float rasterizeTime = 0.0f;
+			/** @brief Time spent in isVisible() in milliseconds, summed over all calling threads */
+			float testTime = 0.0f;
+		};
+
+		/** @brief Set the size of the depth buffer, it's rounded up to a multiple of the tile size */
+		void setResolution(uint32_t width, uint32_t height)
+		{
+			tilesX = std::max((width + TILE_WIDTH - 1) / TILE_WIDTH, 1u);
+			tilesY = std::max((height + TILE_HEIGHT - 1) / TILE_HEIGHT, 1u);
+			this->width = tilesX * TILE_WIDTH;
+			this->height = tilesY * TILE_HEIGHT;
+			depthBuffer.assign(this->width * this->height, 1.0f);
+		}
+
+		/** @brief Worker threads used for rasterization, without a thread pool everything runs on the calling thread */
+		void setThreadPool(vks::ThreadPool* threadPool)
+		{
+			this->threadPool = threadPool;
+		}
+
+		/** @brief Start a new frame, removes all occluders */
+		void beginFrame(const glm::mat4& viewProjection)
+		{
+			this->viewProjection = viewProjection;
+			occluders.clear();
+			testedObjects = 0;
+			culledObjects = 0;
+			testTime = 0;
+		}
+
+		/**
+		* Add an occluder mesh for this frame
+		* The vertex and index data is only referenced and needs to stay valid until rasterize() has finished
+		*
+		* @param positions Pointer to the position of the first vertex
+		* @param stride Distance between two vertex positions in bytes (e.g. sizeof(vkglTF::Vertex))
+		* @param indices Triangle list indices
+		* @param indexCount Number of indices
+		* @param transform Model matrix of the occluder
+		*/
+		void addOccluder(const glm::vec3* positions, size_t stride, const uint32_t* indices, uint32_t indexCount, const glm::mat4& transform)
+		{
+			Occluder occluder;
+			occluder.positions = reinterpret_cast<const uint8_t*>(positions);
+			occluder.stride = stride;
+			occluder.indices = indices;
+			occluder.triangleCount = indexCount / 3;
+			occluder.mvp = viewProjection * transform;
+			occluders.push_back(occluder);
+		}
+
+		/** @brief Rasterize all occluders added for this frame into the depth buffer */
+		void rasterize()
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+
+			const uint32_t workerCount = threadPool ? std::max(static_cast<uint32_t>(threadPool->threads.size()), 1u) : 1u;
+			const uint32_t tileCount = tilesX * tilesY;
+			workers.resize(workerCount);
+
+			// Triangles are distributed evenly across the workers, each worker sets up its triangles and bins them into the tiles they overlap
+			uint32_t triangleCount = 0;
+			for (auto& occluder : occluders) {
+				occluder.firstTriangle = triangleCount;
+				triangleCount += occluder.triangleCount;
+			}
+			for (uint32_t w = 0; w < workerCount; w++) {
+				const uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(triangleCount) * w / workerCount);
+				const uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(triangleCount) * (w + 1) / workerCount);
+				runJob(w, [this, w, first, last, tileCount] { setupTriangles(workers[w], first, last, tileCount); });
+			}
+			waitForJobs();
+
+			// Every tile is owned by a single worker, so no synchronization is required for writing depth
+			for (uint32_t w = 0; w < workerCount; w++) {
+				runJob(w, [this, w, workerCount, tileCount] {
+					for (uint32_t tile = w; tile < tileCount; tile += workerCount) {
+						rasterizeTile(tile);
+					}
+				});
+			}
+			waitForJobs();
+
+			rasterizedTriangles = 0;
+			for (auto& worker : workers) {
+				rasterizedTriangles += static_cast<uint32_t>(worker.triangles.size());
+			}
+			rasterizeTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		}
+
+		/**
+		* Test a bounding box against the depth buffer
+		* Can be called from multiple threads after rasterize() has finished
+		*
+		* @param min Minimum corner of the (object space) bounding box
+		* @param max Maximum corner of the (object space) bounding box
+		* @param transform Model matrix of the object
+		*
+		* @return False if the box is completely hidden behind the occluders
+		*/
+		bool isVisible(const glm::vec3& min, const glm::vec3& max, const glm::mat4& transform)
+		{
+			auto tStart = std::chrono::high_resolution_clock::now();
+			const bool visible = testBox(min, max, viewProjection * transform);
+			testTime += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - tStart).count());
+			testedObjects++;
+			if (!visible) {
+				culledObjects++;
+			}
+			return visible;
+		}
+
+		Statistics getStatistics() const
+		{
+			Statistics statistics;
+			statistics.occluders = static_cast<uint32_t>(occluders.size());
+			statistics.rasterizedTriangles = rasterizedTriangles;
+			statistics.testedObjects = testedObjects;
+			statistics.culledObjects = culledObjects;
+			statistics.rasterizeTime = rasterizeTime;
+			statistics.testTime = static_cast<float>(testTime) / 1000000.0f;
+			return statistics;
+		}
+
+		uint32_t getWidth() const { return width; }
+		uint32_t getHeight() const { return height; }
+		/** @brief Returns the depth at the given pixel (e.g. for visualizing the depth buffer) */
+		float getDepth(uint32_t x, uint32_t y) const { return depthBuffer[pixelOffset(x, y)]; }
+
+	private:
+		struct Occluder
+		{
+			const uint8_t* positions;
+			size_t stride;
+			const uint32_t* indices;
+			uint32_t triangleCount;
+			uint32_t firstTriangle;
+			glm::mat4 mvp;
+		};
+
+		/** @brief Screen space triangle, edge functions and depth are planes in pixel coordinates */
+		struct Triangle
+		{
+			std::array<float, 3> edgeA, edgeB, edgeC;
+			float depthA, depthB, depthC;
+			int32_t minX, minY, maxX, maxY;
+		};
+
+		struct Worker
+		{
+			std::vector<Triangle> triangles;
+			/** @brief Indices into triangles for every tile */
+			std::vector<std::vector<uint32_t>> bins;
+		};
+
+		vks::ThreadPool* threadPool = nullptr;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t tilesX = 0;
+		uint32_t tilesY = 0;
+		/** @brief Tiles are stored contiguously, with rows of TILE_WIDTH depth values */
+		std::vector<float> depthBuffer;
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+		std::vector<Occluder> occluders;
+		std::vector<Worker> workers;
+		uint32_t rasterizedTriangles = 0;
+		float rasterizeTime = 0.0f;
+		std::atomic<uint32_t> testedObjects{ 0 };
+		std::atomic<uint32_t> culledObjects{ 0 };
+		std::atomic<uint64_t> testTime{ 0 };
+
+		size_t pixelOffset(uint32_t x, uint32_t y) const
+		{
+			const uint32_t tile = (y / TILE_HEIGHT) * tilesX + (x / TILE_WIDTH);
+			return static_cast<size_t>(tile) * TILE_WIDTH * TILE_HEIGHT + (y % TILE_HEIGHT) * TILE_WIDTH + (x % TILE_WIDTH);
+		}
+
+		void runJob(uint32_t worker, std::function<void()> job)
+		{
+			if (threadPool && !threadPool->threads.empty()) {
+				threadPool->threads[worker]->addJob(std::move(job));
+			} else {
+				job();
+			}
+		}
+
+		void waitForJobs()
+		{
+			if (threadPool) {
+				threadPool->wait();
+			}
+		}
+
+		void setupTriangles(Worker& worker, uint32_t first, uint32_t last, uint32_t tileCount)
+		{
+			worker.triangles.clear();
+			worker.bins.resize(tileCount);
+			for (auto& bin : worker.bins) {
+				bin.clear();
+			}
+			for (const Occluder& occluder : occluders) {
+				const uint32_t begin = std::max(first, occluder.firstTriangle);
+				const uint32_t end = std::min(last, occluder.firstTriangle + occluder.triangleCount);
+				for (uint32_t t = begin; t < end; t++) {
+					const uint32_t* index = &occluder.indices[(t - occluder.firstTriangle) * 3];
+					std::array<glm::vec3, 3> screen;
+					bool valid = true;
+					for (uint32_t i = 0; i < 3; i++) {
+						const glm::vec3& position = *reinterpret_cast<const glm::vec3*>(occluder.positions + occluder.stride * index[i]);
+						const glm::vec4 clip = occluder.mvp * glm::vec4(position, 1.0f);
+						// Clipping against the near plane is not implemented, skipping those triangles only removes occlusion
+						if ((clip.w <= 0.0f) || (clip.z < 0.0f)) {
+							valid = false;
+							break;
+						}
+						screen[i] = glm::vec3((clip.x / clip.w * 0.5f + 0.5f) * width, (clip.y / clip.w * 0.5f + 0.5f) * height, clip.z / clip.w);
+					}
+					if (valid) {
+						addTriangle(worker, screen);
+					}
+				}
+			}
+		}
+
+		void addTriangle(Worker& worker, std::array<glm::vec3, 3>& v)
+		{
+			float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+			if (std::abs(area) < 1e-6f) {
+				return;
+			}
+			// Both windings are rasterized, so occluders don't depend on the culling mode of their pipeline
+			if (area < 0.0f) {
+				std::swap(v[1], v[2]);
+				area = -area;
+			}
+
+			Triangle triangle;
+			triangle.minX = std::max(static_cast<int32_t>(std::floor(std::min({ v[0].x, v[1].x, v[2].x }))), 0);
+			triangle.minY = std::max(static_cast<int32_t>(std::floor(std::min({ v[0].y, v[1].y, v[2].y }))), 0);
+			triangle.maxX = std::min(static_cast<int32_t>(std::ceil(std::max({ v[0].x, v[1].x, v[2].x }))), static_cast<int32_t>(width) - 1);
+			triangle.maxY = std::min(static_cast<int32_t>(std::ceil(std::max({ v[0].y, v[1].y, v[2].y }))), static_cast<int32_t>(height) - 1);
+			if ((triangle.minX > triangle.maxX) || (triangle.minY > triangle.maxY)) {
+				return;
+			}
+
+			// Edge i is opposite of vertex i, all edge functions are positive inside the triangle
+			for (uint32_t i = 0; i < 3; i++) {
+				const glm::vec3& a = v[(i + 1) % 3];
+				const glm::vec3& b = v[(i + 2) % 3];
+				triangle.edgeA[i] = a.y - b.y;
+				triangle.edgeB[i] = b.x - a.x;
+				triangle.edgeC[i] = a.x * b.y - a.y * b.x;
+			}
+			// Depth is linear in screen space, interpolated with the normalized edge functions (barycentrics)
+			const float invArea = 1.0f / area;
+			triangle.depthA = (triangle.edgeA[0] * v[0].z + triangle.edgeA[1] * v[1].z + triangle.edgeA[2] * v[2].z) * invArea;
+			triangle.depthB = (triangle.edgeB[0] * v[0].z + triangle.edgeB[1] * v[1].z + triangle.edgeB[2] * v[2].z) * invArea;
+			triangle.depthC = (triangle.edgeC[0] * v[0].z + triangle.edgeC[1] * v[1].z + triangle.edgeC[2] * v[2].z) * invArea;
+
+			const uint32_t triangleIndex = static_cast<uint32_t>(worker.triangles.size());
+			worker.triangles.push_back(triangle);
+			for (int32_t ty = triangle.minY / TILE_HEIGHT; ty <= triangle.maxY / static_cast<int32_t>(TILE_HEIGHT); ty++) {
+				for (int32_t tx = triangle.minX / TILE_WIDTH; tx <= triangle.maxX / static_cast<int32_t>(TILE_WIDTH); tx++) {
+					worker.bins[ty * tilesX + tx].push_back(triangleIndex);
+				}
+			}
+		}
+
+		void rasterizeTile(uint32_t tile)
+		{
+			float* tileDepth = &depthBuffer[static_cast<size_t>(tile) * TILE_WIDTH * TILE_HEIGHT];
+			std::fill(tileDepth, tileDepth + TILE_WIDTH * TILE_HEIGHT, 1.0f);
+			const int32_t tileX = (tile % tilesX) * TILE_WIDTH;
+			const int32_t tileY = (tile / tilesX) * TILE_HEIGHT;
+
+			for (const Worker& worker : workers) {
+				for (uint32_t triangleIndex : worker.bins[tile]) {
+					const Triangle& triangle = worker.triangles[triangleIndex];
+					// Start at a multiple of four so every group of pixels lies within the tile row
+					const int32_t minX = std::max(triangle.minX, tileX) & ~3;
+					const int32_t maxX = std::min(triangle.maxX, tileX + static_cast<int32_t>(TILE_WIDTH) - 1);
+					const int32_t minY = std::max(triangle.minY, tileY);
+					const int32_t maxY = std::min(triangle.maxY, tileY + static_cast<int32_t>(TILE_HEIGHT) - 1);
+					for (int32_t y = minY; y <= maxY; y++) {
+						float* row = tileDepth + (y - tileY) * TILE_WIDTH;
+						const float py = static_cast<float>(y) + 0.5f;
+						for (int32_t x = minX; x <= maxX; x += 4) {
+							rasterizePixels(triangle, row + (x - tileX), static_cast<float>(x) + 0.5f, py);
+						}
+					}
+				}
+			}
+		}
+
+		/** @brief Rasterize four horizontally adjacent pixels, testing against the pixel centers */
+		inline void rasterizePixels(const Triangle& triangle, float* depth, float px, float py)
+		{
+#if defined(OCCLUSION_SIMD_SSE)
+			const __m128 x = _mm_add_ps(_mm_set1_ps(px), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+			const __m128 y = _mm_set1_ps(py);
+			const __m128 zero = _mm_setzero_ps();
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (uint32_t i = 0; i < 3; i++) {
+				const __m128 edge = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.edgeA[i]), x), _mm_mul_ps(_mm_set1_ps(triangle.edgeB[i]), y)), _mm_set1_ps(triangle.edgeC[i]));
+				inside = _mm_and_ps(inside, _mm_cmpgt_ps(edge, zero));
+			}
+			if (_mm_movemask_ps(inside) == 0) {
+				return;
+			}
+			const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthA), x), _mm_mul_ps(_mm_set1_ps(triangle.depthB), y)), _mm_set1_ps(triangle.depthC));
+			const __m128 current = _mm_loadu_ps(depth);
+			const __m128 closest = _mm_min_ps(current, z);
+			_mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, current)));
+#else
+			for (uint32_t lane = 0; lane < 4; lane++) {
+				const float x = px + static_cast<float>(lane);
+				bool inside = true;
+				for (uint32_t i = 0; i < 3; i++) {
+					inside = inside && (triangle.edgeA[i] * x + triangle.edgeB[i] * py + triangle.edgeC[i] > 0.0f);
+				}
+				if (inside) {
+					depth[lane] = std::min(depth[lane], triangle.depthA * x + triangle.depthB * py + triangle.depthC);
+				}
+			}
+#endif
+		}
+
+		bool testBox(const glm::vec3& min, const glm::vec3& max, const glm::mat4& mvp) const
+		{
+			glm::vec2 screenMin(FLT_MAX);
+			glm::vec2 screenMax(-FLT_MAX);
+			float minDepth = 1.0f;
+			for (uint32_t i = 0; i < 8; i++) {
+				const glm::vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+				const glm::vec4 clip = mvp * glm::vec4(corner, 1.0f);
+				// Boxes crossing the near plane can't be projected, treat them as visible
+				if ((clip.w <= 0.0f) || (clip.z < 0.0f)) {
+					return true;
+				}
+				const glm::vec2 screen((clip.x / clip.w * 0.5f + 0.5f) * width, (clip.y / clip.w * 0.5f + 0.5f) * height);
+				screenMin = glm::min(screenMin, screen);
+				screenMax = glm::max(screenMax, screen);
+				minDepth = std::min(minDepth, clip.z / clip.w);
+			}
+
+			// All pixels touched by the box are tested
+			const int32_t minX = std::max(static_cast<int32_t>(std::floor(screenMin.x)), 0);
+			const int32_t minY = std::max(static_cast<int32_t>(std::floor(screenMin.y)), 0);
+			const int32_t maxX = std::min(static_cast<int32_t>(std::floor(screenMax.x)), static_cast<int32_t>(width) - 1);
+			const int32_t maxY = std::min(static_cast<int32_t>(std::floor(screenMax.y)), static_cast<int32_t>(height) - 1);
+			if ((minX > maxX) || (minY > maxY)) {
+				// Off screen, that's left to frustum culling
+				return true;
+			}
+
+			for (int32_t y = minY; y <= maxY; y++) {
+				for (int32_t x = minX & ~3; x <= maxX; x += 4) {
+					const float* depth = &depthBuffer[pixelOffset(x, y)];
+#if defined(OCCLUSION_SIMD_SSE)
+					const __m128 lanes = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+					const __m128 inRange = _mm_and_ps(_mm_cmpge_ps(lanes, _mm_set1_ps(static_cast<float>(minX))), _mm_cmple_ps(lanes, _mm_set1_ps(static_cast<float>(maxX))));
+					const __m128 notOccluded = _mm_cmpge_ps(_mm_loadu_ps(depth), _mm_set1_ps(minDepth));
+					if (_mm_movemask_ps(_mm_and_ps(inRange, notOccluded)) != 0) {
+						return true;
+					}
+#else
+					for (int32_t lane = 0; lane < 4; lane++) {
+						if ((x + lane >= minX) && (x + lane <= maxX) && (depth[lane] >= minDepth)) {
+							return true;
+						}
+					}
+#endif
+				}
+			}
+			return false;
+		}
+	};
+}
@@ -0,0 +1,252 @@
+/*
+* Lightweight CPU profiler with scoped trace zones
+*
+* Zones are recorded into per-thread ring buffers without taking any locks, can be
+* summarized as rolling per-zone statistics (e.g. for the UI overlay) and exported
+* as a Chrome trace file that can be loaded in chrome://tracing or ui.perfetto.dev
+*
+* Profiling is a compile time option: Unless VKS_PROFILER is defined (cmake option
+* USE_CPU_PROFILER), the zone macros expand to nothing
+*
+* Copyright (C) 2023 by Sascha Willems - www.saschawillems.de
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#define VKS_PROFILER_CONCAT_INNER(a, b) a##b
+#define VKS_PROFILER_CONCAT(a, b) VKS_PROFILER_CONCAT_INNER(a, b)
+
+#if defined(VKS_PROFILER)
+// Records the time spent in the enclosing scope, name must be a string literal
+#define VKS_PROFILE_ZONE(name) vks::profiler::ScopedZone VKS_PROFILER_CONCAT(profilerZone, __LINE__)(name)
+// Sets the name displayed for the calling thread in the trace
+#define VKS_PROFILE_THREAD(name) vks::profiler::setThreadName(name)
+// Accumulates the zones of the previous frame, must be used before the zone of the next frame is opened
+#define VKS_PROFILE_NEXT_FRAME() vks::profiler::nextFrame()
+#else
+#define VKS_PROFILE_ZONE(name)
+#define VKS_PROFILE_THREAD(name)
+#define VKS_PROFILE_NEXT_FRAME()
+#endif
+
+namespace vks
+{
+	namespace profiler
+	{
+		/** @brief Number of zones kept per thread, older zones are overwritten */
+		const uint32_t threadBufferCapacity = 1 << 16;
+		/** @brief Number of frames the rolling zone statistics are calculated over */
+		const uint32_t statisticsFrameCount = 64;
+
+		struct Zone
+		{
+			const char* name;
+			uint64_t start;
+			uint64_t end;
+		};
+
+		/**
+		* @brief Single producer ring buffer storing the zones of one thread
+		* @note Only the owning thread writes, readers use the published head to find complete zones
+		*/
+		struct ThreadBuffer
+		{
+			std::array<Zone, threadBufferCapacity> zones;
+			std::atomic<uint64_t> head{ 0 };
+			uint32_t threadId = 0;
+			std::string name;
+			// Read position of the statistics collector (only accessed by the collecting thread)
+			uint64_t collected = 0;
+		};
+
+		struct ZoneStatistics
+		{
+			std::array<double, statisticsFrameCount> frameTimes{};
+			double currentFrame = 0.0;
+			uint32_t currentCalls = 0;
+			uint32_t calls = 0;
+			double average = 0.0;
+			double max = 0.0;
+		};
+
+		struct Registry
+		{
+			std::mutex mutex;
+			std::vector<std::unique_ptr<ThreadBuffer>> threads;
+			std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+			std::unordered_map<std::string, ZoneStatistics> statistics;
+			uint32_t frameIndex = 0;
+		};
+
+		inline Registry& registry()
+		{
+			static Registry instance;
+			return instance;
+		}
+
+		inline uint64_t now()
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+		}
+
+		/** @brief Returns the zone buffer of the calling thread, the buffer is registered (once) on first use and outlives the thread */
+		inline ThreadBuffer* threadBuffer()
+		{
+			static thread_local ThreadBuffer* buffer = nullptr;
+			if (!buffer) {
+				Registry& reg = registry();
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				reg.threads.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+				buffer = reg.threads.back().get();
+				buffer->threadId = static_cast<uint32_t>(reg.threads.size());
+				buffer->name = "Thread " + std::to_string(buffer->threadId);
+			}
+			return buffer;
+		}
+
+		inline void setThreadName(const std::string& name)
+		{
+			ThreadBuffer* buffer = threadBuffer();
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			buffer->name = name;
+		}
+
+		inline void record(const char* name, uint64_t start, uint64_t end)
+		{
+			ThreadBuffer* buffer = threadBuffer();
+			const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+			Zone& zone = buffer->zones[head % threadBufferCapacity];
+			zone.name = name;
+			zone.start = start;
+			zone.end = end;
+			// Publish the zone to readers
+			buffer->head.store(head + 1, std::memory_order_release);
+		}
+
+		class ScopedZone
+		{
+		private:
+			const char* name;
+			uint64_t start;
+		public:
+			explicit ScopedZone(const char* name) : name(name), start(now()) {}
+			~ScopedZone()
+			{
+				record(name, start, now());
+			}
+		};
+
+		/** @brief Copies all zones still held in the ring buffer of the given thread that were published after the given position */
+		inline void readZones(ThreadBuffer* buffer, uint64_t from, std::vector<Zone>& target, uint64_t& to)
+		{
+			to = buffer->head.load(std::memory_order_acquire);
+			from = std::max(from, (to > threadBufferCapacity) ? to - threadBufferCapacity : 0);
+			const size_t first = target.size();
+			for (uint64_t i = from; i < to; i++) {
+				target.push_back(buffer->zones[i % threadBufferCapacity]);
+			}
+			// Discard zones that were overwritten by the producer while copying
+			const uint64_t head = buffer->head.load(std::memory_order_acquire);
+			// The producer may be writing zone head, which reuses the slot of zone head - capacity
+			if ((head >= threadBufferCapacity) && (head - threadBufferCapacity >= from)) {
+				const size_t overwritten = (size_t)std::min(head - threadBufferCapacity + 1 - from, to - from);
+				target.erase(target.begin() + first, target.begin() + first + overwritten);
+			}
+		}
+
+		/**
+		* @brief Accumulates the zones recorded since the last call into the rolling per-zone statistics
+		* @note Should be called once per frame from a single thread (done by the example base class)
+		*/
+		inline void nextFrame()
+		{
+			Registry& reg = registry();
+			std::vector<ThreadBuffer*> threads;
+			{
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				for (auto& thread : reg.threads) {
+					threads.push_back(thread.get());
+				}
+			}
+			std::vector<Zone> zones;
+			for (ThreadBuffer* thread : threads) {
+				readZones(thread, thread->collected, zones, thread->collected);
+			}
+			for (const Zone& zone : zones) {
+				ZoneStatistics& stats = reg.statistics[zone.name];
+				stats.currentFrame += (double)(zone.end - zone.start) / 1000000.0;
+				stats.currentCalls++;
+			}
+			const uint32_t slot = reg.frameIndex % statisticsFrameCount;
+			const uint32_t frameCount = std::min(reg.frameIndex + 1, statisticsFrameCount);
+			for (auto& entry : reg.statistics) {
+				ZoneStatistics& stats = entry.second;
+				stats.frameTimes[slot] = stats.currentFrame;
+				stats.calls = stats.currentCalls;
+				stats.currentFrame = 0.0;
+				stats.currentCalls = 0;
+				double sum = 0.0;
+				stats.max = 0.0;
+				for (uint32_t i = 0; i < frameCount; i++) {
+					sum += stats.frameTimes[i];
+					stats.max = std::max(stats.max, stats.frameTimes[i]);
+				}
+				stats.average = sum / (double)frameCount;
+			}
+			reg.frameIndex++;
+		}
+
+		/** @brief Returns the rolling statistics of all zones sorted by name */
+		inline std::vector<std::pair<std::string, ZoneStatistics>> statistics()
+		{
+			std::vector<std::pair<std::string, ZoneStatistics>> result(registry().statistics.begin(), registry().statistics.end());
+			std::sort(result.begin(), result.end(), [](const std::pair<std::string, ZoneStatistics>& a, const std::pair<std::string, ZoneStatistics>& b) { return a.first < b.first; });
+			return result;
+		}
+
+		/**
+		* @brief Writes all zones still held in the per-thread ring buffers to a Chrome trace (json) file
+		* @note Zones are written as complete ("X") events with microsecond timestamps
+		*/
+		inline bool writeChromeTrace(const std::string& filename)
+		{
+			std::ofstream file(filename, std::ios::out);
+			if (!file.is_open()) {
+				std::cerr << "Could not write profiler trace to \"" << filename << "\"\n";
+				return false;
+			}
+			Registry& reg = registry();
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+			bool first = true;
+			for (auto& thread : reg.threads) {
+				file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread->threadId << ",\"args\":{\"name\":\"" << thread->name << "\"}}";
+				first = false;
+				std::vector<Zone> zones;
+				uint64_t head;
+				readZones(thread.get(), 0, zones, head);
+				for (const Zone& zone : zones) {
+					file << ",\n{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread->threadId
+						<< ",\"ts\":" << (double)zone.start / 1000.0 << ",\"dur\":" << (double)(zone.end - zone.start) / 1000.0 << "}";
+				}
+			}
+			file << "\n]}\n";
+			std::cout << "Profiler trace written to \"" << filename << "\"\n";
+			return true;
+		}
+	}
+}
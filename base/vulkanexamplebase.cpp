@@ -148,7 +148,10 @@ void VulkanExampleBase::renderFrame()
 	VulkanExampleBase::prepareFrame();
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	{
+		VKS_PROFILE_ZONE("submit");
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	}
 	VulkanExampleBase::submitFrame();
 }
 
@@ -231,22 +234,26 @@ VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileNa
 	VkPipelineShaderStageCreateInfo shaderStage = {};
 	shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStage.stage = stage;
-#if defined(VK_USE_PLATFORM_ANDROID_KHR)
-	shaderStage.module = vks::tools::loadShader(androidApp->activity->assetManager, fileName.c_str(), device);
-#else
-	shaderStage.module = vks::tools::loadShader(fileName.c_str(), device);
-#endif
+	shaderStage.module = shaderCache.get(fileName);
 	shaderStage.pName = "main";
 	assert(shaderStage.module != VK_NULL_HANDLE);
 	shaderModules.push_back(shaderStage.module);
 	return shaderStage;
 }
 
+void VulkanExampleBase::preloadShaders(const std::vector<std::string>& fileNames)
+{
+	shaderCache.preload(fileNames);
+}
+
 void VulkanExampleBase::nextFrame()
 {
+	VKS_PROFILE_NEXT_FRAME();
+	VKS_PROFILE_ZONE("frame");
 	auto tStart = std::chrono::high_resolution_clock::now();
 	if (viewUpdated)
 	{
+		VKS_PROFILE_ZONE("update");
 		viewUpdated = false;
 		viewChanged();
 	}
@@ -364,6 +371,8 @@ void VulkanExampleBase::renderLoop()
 		// Render frame
 		if (prepared)
 		{
+			VKS_PROFILE_NEXT_FRAME();
+			VKS_PROFILE_ZONE("frame");
 			auto tStart = std::chrono::high_resolution_clock::now();
 			render();
 			frameCounter++;
@@ -443,9 +452,12 @@ void VulkanExampleBase::renderLoop()
 #elif defined(_DIRECT2DISPLAY)
 	while (!quit)
 	{
+		VKS_PROFILE_NEXT_FRAME();
+		VKS_PROFILE_ZONE("frame");
 		auto tStart = std::chrono::high_resolution_clock::now();
 		if (viewUpdated)
 		{
+			VKS_PROFILE_ZONE("update");
 			viewUpdated = false;
 			viewChanged();
 		}
@@ -480,9 +492,12 @@ void VulkanExampleBase::renderLoop()
 #elif defined(VK_USE_PLATFORM_DIRECTFB_EXT)
 	while (!quit)
 	{
+		VKS_PROFILE_NEXT_FRAME();
+		VKS_PROFILE_ZONE("frame");
 		auto tStart = std::chrono::high_resolution_clock::now();
 		if (viewUpdated)
 		{
+			VKS_PROFILE_ZONE("update");
 			viewUpdated = false;
 			viewChanged();
 		}
@@ -522,9 +537,12 @@ void VulkanExampleBase::renderLoop()
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
 	while (!quit)
 	{
+		VKS_PROFILE_NEXT_FRAME();
+		VKS_PROFILE_ZONE("frame");
 		auto tStart = std::chrono::high_resolution_clock::now();
 		if (viewUpdated)
 		{
+			VKS_PROFILE_ZONE("update");
 			viewUpdated = false;
 			viewChanged();
 		}
@@ -574,9 +592,12 @@ void VulkanExampleBase::renderLoop()
 	xcb_flush(connection);
 	while (!quit)
 	{
+		VKS_PROFILE_NEXT_FRAME();
+		VKS_PROFILE_ZONE("frame");
 		auto tStart = std::chrono::high_resolution_clock::now();
 		if (viewUpdated)
 		{
+			VKS_PROFILE_ZONE("update");
 			viewUpdated = false;
 			viewChanged();
 		}
@@ -624,9 +645,12 @@ void VulkanExampleBase::renderLoop()
 #elif defined(VK_USE_PLATFORM_HEADLESS_EXT)
 	while (!quit)
 	{
+		VKS_PROFILE_NEXT_FRAME();
+		VKS_PROFILE_ZONE("frame");
 		auto tStart = std::chrono::high_resolution_clock::now();
 		if (viewUpdated)
 		{
+			VKS_PROFILE_ZONE("update");
 			viewUpdated = false;
 			viewChanged();
 		}
@@ -669,6 +693,8 @@ void VulkanExampleBase::updateOverlay()
 	if (!settings.overlay)
 		return;
 
+	VKS_PROFILE_ZONE("overlay");
+
 	ImGuiIO& io = ImGui::GetIO();
 
 	io.DisplaySize = ImVec2((float)width, (float)height);
@@ -689,6 +715,22 @@ void VulkanExampleBase::updateOverlay()
 	ImGui::TextUnformatted(deviceProperties.deviceName);
 	ImGui::Text("%.2f ms/frame (%.1d fps)", (1000.0f / lastFPS), lastFPS);
 
+#if defined(VKS_PROFILER)
+	if (UIOverlay.header("CPU zones (avg/max ms)")) {
+		for (auto& zone : vks::profiler::statistics()) {
+			ImGui::Text("%s: %.3f / %.3f (%dx)", zone.first.c_str(), zone.second.average, zone.second.max, zone.second.calls);
+		}
+	}
+#endif
+
+	if (UIOverlay.header("Shader cache")) {
+		vks::ShaderCache::Statistics statistics = shaderCache.getStatistics();
+		const uint32_t hits = statistics.pathHits + statistics.contentHits;
+		ImGui::Text("%d modules, %d requests (%.1f%% hits)", shaderCache.getModuleCount(), statistics.requests, statistics.requests > 0 ? 100.0f * hits / statistics.requests : 0.0f);
+		ImGui::Text("%.1f KB read in %.2f ms", statistics.bytesRead / 1024.0f, statistics.readTime);
+		ImGui::Text("Module creation: %.2f ms", statistics.createTime);
+	}
+
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0.0f, 5.0f * UIOverlay.scale));
 #endif
@@ -704,6 +746,7 @@ void VulkanExampleBase::updateOverlay()
 	ImGui::Render();
 
 	if (UIOverlay.update() || UIOverlay.updated) {
+		VKS_PROFILE_ZONE("record");
 		buildCommandBuffers();
 		UIOverlay.updated = false;
 	}
@@ -729,6 +772,7 @@ void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer)
 
 void VulkanExampleBase::prepareFrame()
 {
+	VKS_PROFILE_ZONE("acquire");
 	// Acquire the next image from the swap chain
 	VkResult result = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
 	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE)
@@ -746,6 +790,7 @@ void VulkanExampleBase::prepareFrame()
 
 void VulkanExampleBase::submitFrame()
 {
+	VKS_PROFILE_ZONE("present");
 	VkResult result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete);
 	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
 	if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
@@ -760,7 +805,7 @@ void VulkanExampleBase::submitFrame()
 	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 }
 
-VulkanExampleBase::VulkanExampleBase(bool enableValidation)
+VulkanExampleBase::VulkanExampleBase(bool enableValidation, std::function<void(CommandLineParser&)> addCommandLineOptions)
 {
 #if !defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// Check for a valid asset path
@@ -795,8 +840,13 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 	commandLineParser.add("benchmarkresultfile", { "-bf", "--benchfilename" }, 1, "Set file name for benchmark results");
 	commandLineParser.add("benchmarkresultframes", { "-bt", "--benchframetimes" }, 0, "Save frame times to benchmark results file");
 	commandLineParser.add("benchmarkframes", { "-bfs", "--benchmarkframes" }, 1, "Only render the given number of frames");
+	commandLineParser.add("profilertrace", { "-pt", "--profilertrace" }, 1, "Write CPU profiler zones to the given Chrome trace file (requires USE_CPU_PROFILER)");
+	if (addCommandLineOptions) {
+		addCommandLineOptions(commandLineParser);
+	}
 
 	commandLineParser.parse(args);
+	VKS_PROFILE_THREAD("Main");
 	if (commandLineParser.isSet("help")) {
 #if defined(_WIN32)
 		setupConsole("Vulkan example");
@@ -873,6 +923,12 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 
 VulkanExampleBase::~VulkanExampleBase()
 {
+#if defined(VKS_PROFILER)
+	if (commandLineParser.isSet("profilertrace")) {
+		vks::profiler::writeChromeTrace(commandLineParser.getValueAsString("profilertrace", "trace.json"));
+	}
+#endif
+
 	// Clean up Vulkan resources
 	swapChain.cleanup();
 	if (descriptorPool != VK_NULL_HANDLE)
@@ -889,10 +945,7 @@ VulkanExampleBase::~VulkanExampleBase()
 		vkDestroyFramebuffer(device, frameBuffers[i], nullptr);
 	}
 
-	for (auto& shaderModule : shaderModules)
-	{
-		vkDestroyShaderModule(device, shaderModule, nullptr);
-	}
+	shaderCache.destroy();
 	vkDestroyImageView(device, depthStencil.view, nullptr);
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
@@ -1044,6 +1097,7 @@ bool VulkanExampleBase::initVulkan()
 		return false;
 	}
 	device = vulkanDevice->logicalDevice;
+	shaderCache.create(device);
 
 	// Get a graphics queue from the device
 	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.graphics, 0, &queue);
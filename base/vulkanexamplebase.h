@@ -44,6 +44,7 @@
 #include <chrono>
 #include <random>
 #include <algorithm>
+#include <functional>
 #include <sys/stat.h>
 
 #define GLM_FORCE_RADIANS
@@ -68,10 +69,12 @@
 #include "VulkanBuffer.h"
 #include "VulkanDevice.h"
 #include "VulkanTexture.h"
+#include "VulkanShaderCache.h"
 
 #include "VulkanInitializers.hpp"
 #include "camera.hpp"
 #include "benchmark.hpp"
+#include "profiler.hpp"
 
 class VulkanExampleBase
 {
@@ -141,8 +144,10 @@ protected:
 	uint32_t currentBuffer = 0;
 	// Descriptor set pool
 	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
-	// List of shader modules created (stored for cleanup)
+	// List of shader modules returned by loadShader (owned by the shader cache)
 	std::vector<VkShaderModule> shaderModules;
+	// Deduplicates shader modules loaded by loadShader
+	vks::ShaderCache shaderCache;
 	// Pipeline cache object
 	VkPipelineCache pipelineCache;
 	// Wraps the swap chain to present images (framebuffers) to the windowing system
@@ -272,7 +277,11 @@ public:
 	bool quit = false;
 #endif
 
-	VulkanExampleBase(bool enableValidation = false);
+	/**
+	* @param enableValidation Enable validation layers
+	* @param addCommandLineOptions (Optional) Adds example specific command line options, called before the arguments are parsed so the options are listed by --help
+	*/
+	VulkanExampleBase(bool enableValidation = false, std::function<void(CommandLineParser&)> addCommandLineOptions = nullptr);
 	virtual ~VulkanExampleBase();
 	/** @brief Setup the vulkan instance, enable required extensions and connect to the physical device (GPU) */
 	bool initVulkan();
@@ -376,6 +385,8 @@ public:
 
 	/** @brief Loads a SPIR-V shader file for the given shader stage */
 	VkPipelineShaderStageCreateInfo loadShader(std::string fileName, VkShaderStageFlagBits stage);
+	/** @brief Loads a list of shader files into the shader cache using multiple threads, later calls to loadShader for these files don't need to access the files */
+	void preloadShaders(const std::vector<std::string>& fileNames);
 
 	/** @brief Entry point for the main render loop */
 	void renderLoop();
@@ -0,0 +1,25 @@
+#version 450
+
+// Binding 1: First level of the mip chain, containing the accumulated result of all levels
+layout (binding = 1) uniform sampler2D samplerBloom;
+
+layout (binding = 0) uniform UBO
+{
+	float blurScale;
+	float blurStrength;
+	float threshold;
+	float knee;
+	float intensity;
+	float mipCount;
+} ubo;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+	// Every level adds its own copy of the glow, normalize so the brightness doesn't change with the chain length
+	vec3 bloom = texture(samplerBloom, inUV).rgb * ubo.intensity / ubo.mipCount;
+	outFragColor = vec4(bloom, 1.0);
+}
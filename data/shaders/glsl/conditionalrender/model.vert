@@ -10,12 +10,19 @@ layout (set = 0, binding = 0) uniform UBO {
 	mat4 model;
 } ubo;
 
-layout (set = 1, binding = 0) uniform Node {
+struct NodeData {
 	mat4 matrix;
-} node;
+	uint firstJoint;
+	uint jointCount;
+};
+
+layout (set = 1, binding = 0) readonly buffer Nodes {
+	NodeData nodes[];
+};
 
 layout(push_constant) uniform PushBlock {
 	vec4 baseColorFactor;
+	uint meshIndex;
 } material;
 
 layout (location = 0) out vec3 outNormal;
@@ -30,14 +37,15 @@ out gl_PerVertex
 
 void main() 
 {
+	mat4 nodeMatrix = nodes[material.meshIndex].matrix;
 	outNormal = inNormal;
 	outColor = material.baseColorFactor.rgb;
 	vec4 pos = vec4(inPos, 1.0);
-	gl_Position = ubo.projection * ubo.view * ubo.model * node.matrix * pos;
+	gl_Position = ubo.projection * ubo.view * ubo.model * nodeMatrix * pos;
 
-	outNormal = mat3(ubo.view * ubo.model * node.matrix) * inNormal;
+	outNormal = mat3(ubo.view * ubo.model * nodeMatrix) * inNormal;
 
-	vec4 localpos = ubo.view * ubo.model * node.matrix * pos;
+	vec4 localpos = ubo.view * ubo.model * nodeMatrix * pos;
 	vec3 lightPos = vec3(10.0f, -10.0f, 10.0f);
 	outLightVec = lightPos.xyz - localpos.xyz;
 	outViewVec = -localpos.xyz;		
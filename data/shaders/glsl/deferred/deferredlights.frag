@@ -0,0 +1,138 @@
+#version 450
+
+// Cluster grid, must match the defines in deferred.cpp
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+layout (binding = 1) uniform sampler2D samplerposition;
+layout (binding = 2) uniform sampler2D samplerNormal;
+layout (binding = 3) uniform sampler2D samplerAlbedo;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragcolor;
+
+struct Light {
+	vec4 position;
+	vec3 color;
+	float radius;
+};
+
+layout (binding = 5) uniform UBO
+{
+	mat4 view;
+	vec4 projectionParams;
+	vec4 viewPos;
+	uint lightCount;
+	uint screenWidth;
+	uint screenHeight;
+	int displayDebugTarget;
+} ubo;
+
+// Binding 6: All lights, the w component of the position is the range of the light
+layout (binding = 6, std430) readonly buffer Lights
+{
+	Light lights[ ];
+};
+
+// Binding 7: Offset into the light index list and light count per cluster
+layout (binding = 7, std430) readonly buffer ClusterGrid
+{
+	uvec2 clusters[ ];
+};
+
+// Binding 8: Compact list of light indices for all clusters
+layout (binding = 8, std430) readonly buffer LightIndices
+{
+	uint lightIndices[ ];
+};
+
+// Shade only the lights assigned to the fragment's cluster, or all lights if disabled
+layout (constant_id = 0) const int clustered = 1;
+
+#define ambient 0.0
+
+vec3 shadeLight(Light light, vec3 fragPos, vec3 N, vec3 V, vec4 albedo)
+{
+	// Vector to light
+	vec3 L = light.position.xyz - fragPos;
+	// Distance from light to fragment position
+	float dist = length(L);
+	L = normalize(L);
+
+	// Same attenuation as the uniform block path, faded out towards the range used for culling
+	float window = clamp(1.0 - pow(dist / light.position.w, 4.0), 0.0, 1.0);
+	float atten = light.radius / (pow(dist, 2.0) + 1.0) * window * window;
+
+	// Diffuse part
+	float NdotL = max(0.0, dot(N, L));
+	vec3 diff = light.color * albedo.rgb * NdotL * atten;
+
+	// Specular part
+	// Specular map values are stored in alpha of albedo mrt
+	vec3 R = reflect(-L, N);
+	float NdotR = max(0.0, dot(R, V));
+	vec3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten;
+
+	return diff + spec;
+}
+
+void main()
+{
+	// Get G-Buffer values
+	vec3 fragPos = texture(samplerposition, inUV).rgb;
+	vec3 normal = texture(samplerNormal, inUV).rgb;
+	vec4 albedo = texture(samplerAlbedo, inUV);
+
+	// Debug display
+	if (ubo.displayDebugTarget > 0) {
+		switch (ubo.displayDebugTarget) {
+			case 1:
+				outFragcolor.rgb = fragPos;
+				break;
+			case 2:
+				outFragcolor.rgb = normal;
+				break;
+			case 3:
+				outFragcolor.rgb = albedo.rgb;
+				break;
+			case 4:
+				outFragcolor.rgb = albedo.aaa;
+				break;
+		}
+		outFragcolor.a = 1.0;
+		return;
+	}
+
+	// Ambient part
+	vec3 fragcolor = albedo.rgb * ambient;
+
+	vec3 N = normalize(normal);
+	vec3 V = normalize(ubo.viewPos.xyz - fragPos);
+
+	if (clustered == 1)
+	{
+		// Find the cluster from the screen tile and the exponential depth slice of the fragment
+		float near = ubo.projectionParams.z;
+		float far = ubo.projectionParams.w;
+		float depth = max(-(ubo.view * vec4(fragPos, 1.0)).z, near);
+		uint slice = min(uint(log(depth / near) / log(far / near) * float(CLUSTER_Z)), CLUSTER_Z - 1);
+		uvec2 tile = min(uvec2(gl_FragCoord.xy * vec2(CLUSTER_X, CLUSTER_Y) / vec2(ubo.screenWidth, ubo.screenHeight)), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+		uvec2 cluster = clusters[tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y];
+
+		for (uint i = 0; i < cluster.y; i++)
+		{
+			fragcolor += shadeLight(lights[lightIndices[cluster.x + i]], fragPos, N, V, albedo);
+		}
+	}
+	else
+	{
+		for (uint i = 0; i < ubo.lightCount; i++)
+		{
+			fragcolor += shadeLight(lights[i], fragPos, N, V, albedo);
+		}
+	}
+
+	outFragcolor = vec4(fragcolor, 1.0);
+}
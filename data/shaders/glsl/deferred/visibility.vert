@@ -0,0 +1,26 @@
+#version 450
+
+layout (location = 0) in vec4 inPos;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 projection;
+	mat4 model;
+	mat4 view;
+	vec4 instancePos[3];
+} ubo;
+
+// Object index of the first instance, the floor is object 0 and the instances of the model follow
+layout (push_constant) uniform PushConsts
+{
+	uint objectOffset;
+} pushConsts;
+
+layout (location = 0) flat out uint outObject;
+
+void main()
+{
+	vec4 tmpPos = inPos + ubo.instancePos[gl_InstanceIndex];
+	gl_Position = ubo.projection * ubo.view * ubo.model * tmpPos;
+	outObject = pushConsts.objectOffset + gl_InstanceIndex;
+}
@@ -0,0 +1,298 @@
+#version 450
+
+// Cluster grid, must match the defines in deferred.cpp
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+// Floats per vkglTF::Vertex and offsets of the attributes used for shading
+#define VERTEX_STRIDE 24
+#define VERTEX_NORMAL 3
+#define VERTEX_UV 6
+#define VERTEX_TANGENT 20
+
+#define EMPTY_PIXEL 0xFFFFFFFF
+
+struct Light {
+	vec4 position;
+	vec3 color;
+	float radius;
+};
+
+layout (binding = 0) uniform UBOScene
+{
+	mat4 projection;
+	mat4 model;
+	mat4 view;
+	vec4 instancePos[3];
+} uboScene;
+
+layout (binding = 4) uniform UBOComposition
+{
+	Light lights[6];
+	vec4 viewPos;
+	int displayDebugTarget;
+} uboComposition;
+
+layout (binding = 5) uniform UBO
+{
+	mat4 view;
+	vec4 projectionParams;
+	vec4 viewPos;
+	uint lightCount;
+	uint screenWidth;
+	uint screenHeight;
+	int displayDebugTarget;
+} ubo;
+
+layout (binding = 6, std430) readonly buffer Lights
+{
+	Light lights[ ];
+};
+
+layout (binding = 7, std430) readonly buffer ClusterGrid
+{
+	uvec2 clusters[ ];
+};
+
+layout (binding = 8, std430) readonly buffer LightIndices
+{
+	uint lightIndices[ ];
+};
+
+// Set 1: Visibility buffer and the geometry and textures of both objects
+layout (set = 1, binding = 0) uniform usampler2D samplerVisibility;
+layout (set = 1, binding = 1, std430) readonly buffer FloorVertices
+{
+	float floorVertices[ ];
+};
+layout (set = 1, binding = 2, std430) readonly buffer FloorIndices
+{
+	uint floorIndices[ ];
+};
+layout (set = 1, binding = 3, std430) readonly buffer ModelVertices
+{
+	float modelVertices[ ];
+};
+layout (set = 1, binding = 4, std430) readonly buffer ModelIndices
+{
+	uint modelIndices[ ];
+};
+layout (set = 1, binding = 5) uniform sampler2D samplerFloorColor;
+layout (set = 1, binding = 6) uniform sampler2D samplerFloorNormalMap;
+layout (set = 1, binding = 7) uniform sampler2D samplerModelColor;
+layout (set = 1, binding = 8) uniform sampler2D samplerModelNormalMap;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragcolor;
+
+// 0 = uniform block lights, 1 = all lights of the storage buffer, 2 = clustered
+layout (constant_id = 0) const int lightingMode = 0;
+
+#define ambient 0.0
+
+struct Barycentrics {
+	vec3 lambda;
+	vec3 ddx;
+	vec3 ddy;
+};
+
+// Perspective correct barycentrics of the pixel and their screen space derivatives, from the clip space positions of the triangle
+Barycentrics calcBarycentrics(vec4 pt0, vec4 pt1, vec4 pt2, vec2 pixelNdc, vec2 screenSize)
+{
+	Barycentrics ret;
+	vec3 invW = 1.0 / vec3(pt0.w, pt1.w, pt2.w);
+	vec2 ndc0 = pt0.xy * invW.x;
+	vec2 ndc1 = pt1.xy * invW.y;
+	vec2 ndc2 = pt2.xy * invW.z;
+
+	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+	ret.ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	ret.ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = dot(ret.ddx, vec3(1.0));
+	float ddySum = dot(ret.ddy, vec3(1.0));
+
+	vec2 delta = pixelNdc - ndc0;
+	float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+	float interpW = 1.0 / interpInvW;
+	ret.lambda.x = interpW * (invW.x + delta.x * ret.ddx.x + delta.y * ret.ddy.x);
+	ret.lambda.y = interpW * (delta.x * ret.ddx.y + delta.y * ret.ddy.y);
+	ret.lambda.z = interpW * (delta.x * ret.ddx.z + delta.y * ret.ddy.z);
+
+	// From NDC to pixel steps, NDC and pixel y both point down in Vulkan
+	ret.ddx *= 2.0 / screenSize.x;
+	ret.ddy *= 2.0 / screenSize.y;
+	ddxSum *= 2.0 / screenSize.x;
+	ddySum *= 2.0 / screenSize.y;
+
+	float interpWddx = 1.0 / (interpInvW + ddxSum);
+	float interpWddy = 1.0 / (interpInvW + ddySum);
+	ret.ddx = interpWddx * (ret.lambda * interpInvW + ret.ddx) - ret.lambda;
+	ret.ddy = interpWddy * (ret.lambda * interpInvW + ret.ddy) - ret.lambda;
+	return ret;
+}
+
+float vertexData(bool isFloor, uint offset)
+{
+	return isFloor ? floorVertices[offset] : modelVertices[offset];
+}
+
+vec3 loadVec3(bool isFloor, uvec3 vertices, uint attribute, uint component)
+{
+	return vec3(vertexData(isFloor, vertices.x * VERTEX_STRIDE + attribute + component), vertexData(isFloor, vertices.y * VERTEX_STRIDE + attribute + component), vertexData(isFloor, vertices.z * VERTEX_STRIDE + attribute + component));
+}
+
+mat3 loadAttribute3(bool isFloor, uvec3 vertices, uint attribute)
+{
+	// Columns are the vertices
+	return transpose(mat3(loadVec3(isFloor, vertices, attribute, 0), loadVec3(isFloor, vertices, attribute, 1), loadVec3(isFloor, vertices, attribute, 2)));
+}
+
+vec3 shadeLight(Light light, vec3 fragPos, vec3 N, vec3 V, vec4 albedo, bool window)
+{
+	// Vector to light
+	vec3 L = light.position.xyz - fragPos;
+	// Distance from light to fragment position
+	float dist = length(L);
+	L = normalize(L);
+
+	// Attenuation, storage buffer lights fade out towards the range used for culling
+	float atten = light.radius / (pow(dist, 2.0) + 1.0);
+	if (window)
+	{
+		float fade = clamp(1.0 - pow(dist / light.position.w, 4.0), 0.0, 1.0);
+		atten *= fade * fade;
+	}
+
+	// Diffuse part
+	float NdotL = max(0.0, dot(N, L));
+	vec3 diff = light.color * albedo.rgb * NdotL * atten;
+
+	// Specular part
+	vec3 R = reflect(-L, N);
+	float NdotR = max(0.0, dot(R, V));
+	vec3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten;
+
+	return diff + spec;
+}
+
+void main()
+{
+	uint visibility = texelFetch(samplerVisibility, ivec2(gl_FragCoord.xy), 0).r;
+	if (visibility == EMPTY_PIXEL)
+	{
+		outFragcolor = vec4(0.0, 0.0, 0.0, 1.0);
+		return;
+	}
+
+	uint object = visibility >> 24;
+	uint triangleIndex = visibility & 0xFFFFFF;
+	bool isFloor = (object == 0);
+	uint instance = isFloor ? 0 : object - 1;
+
+	uvec3 vertices = isFloor ?
+		uvec3(floorIndices[triangleIndex * 3], floorIndices[triangleIndex * 3 + 1], floorIndices[triangleIndex * 3 + 2]) :
+		uvec3(modelIndices[triangleIndex * 3], modelIndices[triangleIndex * 3 + 1], modelIndices[triangleIndex * 3 + 2]);
+
+	// Same transformation as the geometry pass
+	mat3 positions = loadAttribute3(isFloor, vertices, 0);
+	vec4 worldPos0 = uboScene.model * vec4(positions[0] + uboScene.instancePos[instance].xyz, 1.0);
+	vec4 worldPos1 = uboScene.model * vec4(positions[1] + uboScene.instancePos[instance].xyz, 1.0);
+	vec4 worldPos2 = uboScene.model * vec4(positions[2] + uboScene.instancePos[instance].xyz, 1.0);
+	mat4 viewProjection = uboScene.projection * uboScene.view;
+
+	vec2 screenSize = vec2(ubo.screenWidth, ubo.screenHeight);
+	vec2 pixelNdc = gl_FragCoord.xy / screenSize * 2.0 - 1.0;
+	Barycentrics bary = calcBarycentrics(viewProjection * worldPos0, viewProjection * worldPos1, viewProjection * worldPos2, pixelNdc, screenSize);
+
+	vec3 fragPos = mat3(worldPos0.xyz, worldPos1.xyz, worldPos2.xyz) * bary.lambda;
+
+	// Texture coordinates with derivatives for mip selection, as there are no screen space derivatives across triangles in a fullscreen pass
+	mat3x2 uvs = mat3x2(
+		vec2(vertexData(isFloor, vertices.x * VERTEX_STRIDE + VERTEX_UV), vertexData(isFloor, vertices.x * VERTEX_STRIDE + VERTEX_UV + 1)),
+		vec2(vertexData(isFloor, vertices.y * VERTEX_STRIDE + VERTEX_UV), vertexData(isFloor, vertices.y * VERTEX_STRIDE + VERTEX_UV + 1)),
+		vec2(vertexData(isFloor, vertices.z * VERTEX_STRIDE + VERTEX_UV), vertexData(isFloor, vertices.z * VERTEX_STRIDE + VERTEX_UV + 1)));
+	vec2 uv = uvs * bary.lambda;
+	vec2 uvDdx = uvs * bary.ddx;
+	vec2 uvDdy = uvs * bary.ddy;
+
+	// Normal in world space, the model matrix only contains rotation and translation
+	mat3 mNormal = transpose(inverse(mat3(uboScene.model)));
+	vec3 N = normalize(mNormal * (loadAttribute3(isFloor, vertices, VERTEX_NORMAL) * bary.lambda));
+	vec3 T = normalize(mNormal * (loadAttribute3(isFloor, vertices, VERTEX_TANGENT) * bary.lambda));
+	vec3 B = cross(N, T);
+	mat3 TBN = mat3(T, B, N);
+
+	vec4 albedo;
+	vec3 normalSample;
+	if (isFloor)
+	{
+		albedo = textureGrad(samplerFloorColor, uv, uvDdx, uvDdy);
+		normalSample = textureGrad(samplerFloorNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	else
+	{
+		albedo = textureGrad(samplerModelColor, uv, uvDdx, uvDdy);
+		normalSample = textureGrad(samplerModelNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	vec3 normal = TBN * normalize(normalSample * 2.0 - vec3(1.0));
+
+	// Debug display
+	if (uboComposition.displayDebugTarget > 0) {
+		switch (uboComposition.displayDebugTarget) {
+			case 1:
+				outFragcolor.rgb = fragPos;
+				break;
+			case 2:
+				outFragcolor.rgb = normal;
+				break;
+			case 3:
+				outFragcolor.rgb = albedo.rgb;
+				break;
+			case 4:
+				outFragcolor.rgb = albedo.aaa;
+				break;
+		}
+		outFragcolor.a = 1.0;
+		return;
+	}
+
+	// Ambient part
+	vec3 fragcolor = albedo.rgb * ambient;
+
+	N = normalize(normal);
+	vec3 V = normalize(uboComposition.viewPos.xyz - fragPos);
+
+	if (lightingMode == 0)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			fragcolor += shadeLight(uboComposition.lights[i], fragPos, N, V, albedo, false);
+		}
+	}
+	else if (lightingMode == 1)
+	{
+		for (uint i = 0; i < ubo.lightCount; i++)
+		{
+			fragcolor += shadeLight(lights[i], fragPos, N, V, albedo, true);
+		}
+	}
+	else
+	{
+		// Find the cluster from the screen tile and the exponential depth slice of the fragment
+		float near = ubo.projectionParams.z;
+		float far = ubo.projectionParams.w;
+		float depth = max(-(ubo.view * vec4(fragPos, 1.0)).z, near);
+		uint slice = min(uint(log(depth / near) / log(far / near) * float(CLUSTER_Z)), CLUSTER_Z - 1);
+		uvec2 tile = min(uvec2(gl_FragCoord.xy * vec2(CLUSTER_X, CLUSTER_Y) / screenSize), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+		uvec2 cluster = clusters[tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y];
+
+		for (uint i = 0; i < cluster.y; i++)
+		{
+			fragcolor += shadeLight(lights[lightIndices[cluster.x + i]], fragPos, N, V, albedo, true);
+		}
+	}
+
+	outFragcolor = vec4(fragcolor, 1.0);
+}
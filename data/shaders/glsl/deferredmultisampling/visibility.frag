@@ -0,0 +1,11 @@
+#version 450
+
+layout (location = 0) flat in uint inObject;
+
+layout (location = 0) out uint outVisibility;
+
+void main()
+{
+	// Object in the upper 8 bits, triangle within the object's index buffer in the lower 24 bits
+	outVisibility = (inObject << 24) | (uint(gl_PrimitiveID) & 0xFFFFFF);
+}
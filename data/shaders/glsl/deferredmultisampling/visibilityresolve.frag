@@ -0,0 +1,274 @@
+#version 450
+
+// Floats per vkglTF::Vertex and offsets of the attributes used for shading
+#define VERTEX_STRIDE 24
+#define VERTEX_NORMAL 3
+#define VERTEX_UV 6
+#define VERTEX_TANGENT 20
+
+#define EMPTY_PIXEL 0xFFFFFFFF
+
+struct Light {
+	vec4 position;
+	vec3 color;
+	float radius;
+};
+
+layout (binding = 0) uniform UBOScene
+{
+	mat4 projection;
+	mat4 model;
+	mat4 view;
+	vec4 instancePos[3];
+} uboScene;
+
+layout (binding = 4) uniform UBO
+{
+	Light lights[6];
+	vec4 viewPos;
+	int debugDisplayTarget;
+} ubo;
+
+// Set 1: Visibility buffer and the geometry and textures of both objects
+layout (set = 1, binding = 0) uniform usampler2DMS samplerVisibility;
+layout (set = 1, binding = 1, std430) readonly buffer BackgroundVertices
+{
+	float backgroundVertices[ ];
+};
+layout (set = 1, binding = 2, std430) readonly buffer BackgroundIndices
+{
+	uint backgroundIndices[ ];
+};
+layout (set = 1, binding = 3, std430) readonly buffer ModelVertices
+{
+	float modelVertices[ ];
+};
+layout (set = 1, binding = 4, std430) readonly buffer ModelIndices
+{
+	uint modelIndices[ ];
+};
+layout (set = 1, binding = 5) uniform sampler2D samplerBackgroundColor;
+layout (set = 1, binding = 6) uniform sampler2D samplerBackgroundNormalMap;
+layout (set = 1, binding = 7) uniform sampler2D samplerModelColor;
+layout (set = 1, binding = 8) uniform sampler2D samplerModelNormalMap;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragcolor;
+
+layout (constant_id = 0) const int NUM_SAMPLES = 8;
+
+#define NUM_LIGHTS 6
+#define ambient 0.15
+
+struct Barycentrics {
+	vec3 lambda;
+	vec3 ddx;
+	vec3 ddy;
+};
+
+struct Surface {
+	vec3 pos;
+	vec3 normal;
+	vec4 albedo;
+};
+
+// Perspective correct barycentrics of the pixel and their screen space derivatives, from the clip space positions of the triangle
+Barycentrics calcBarycentrics(vec4 pt0, vec4 pt1, vec4 pt2, vec2 pixelNdc, vec2 screenSize)
+{
+	Barycentrics ret;
+	vec3 invW = 1.0 / vec3(pt0.w, pt1.w, pt2.w);
+	vec2 ndc0 = pt0.xy * invW.x;
+	vec2 ndc1 = pt1.xy * invW.y;
+	vec2 ndc2 = pt2.xy * invW.z;
+
+	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+	ret.ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	ret.ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = dot(ret.ddx, vec3(1.0));
+	float ddySum = dot(ret.ddy, vec3(1.0));
+
+	vec2 delta = pixelNdc - ndc0;
+	float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+	float interpW = 1.0 / interpInvW;
+	ret.lambda.x = interpW * (invW.x + delta.x * ret.ddx.x + delta.y * ret.ddy.x);
+	ret.lambda.y = interpW * (delta.x * ret.ddx.y + delta.y * ret.ddy.y);
+	ret.lambda.z = interpW * (delta.x * ret.ddx.z + delta.y * ret.ddy.z);
+
+	// From NDC to pixel steps, NDC and pixel y both point down in Vulkan
+	ret.ddx *= 2.0 / screenSize.x;
+	ret.ddy *= 2.0 / screenSize.y;
+	ddxSum *= 2.0 / screenSize.x;
+	ddySum *= 2.0 / screenSize.y;
+
+	float interpWddx = 1.0 / (interpInvW + ddxSum);
+	float interpWddy = 1.0 / (interpInvW + ddySum);
+	ret.ddx = interpWddx * (ret.lambda * interpInvW + ret.ddx) - ret.lambda;
+	ret.ddy = interpWddy * (ret.lambda * interpInvW + ret.ddy) - ret.lambda;
+	return ret;
+}
+
+float vertexData(bool isBackground, uint offset)
+{
+	return isBackground ? backgroundVertices[offset] : modelVertices[offset];
+}
+
+vec3 loadVec3(bool isBackground, uvec3 vertices, uint attribute, uint component)
+{
+	return vec3(vertexData(isBackground, vertices.x * VERTEX_STRIDE + attribute + component), vertexData(isBackground, vertices.y * VERTEX_STRIDE + attribute + component), vertexData(isBackground, vertices.z * VERTEX_STRIDE + attribute + component));
+}
+
+mat3 loadAttribute3(bool isBackground, uvec3 vertices, uint attribute)
+{
+	// Columns are the vertices
+	return transpose(mat3(loadVec3(isBackground, vertices, attribute, 0), loadVec3(isBackground, vertices, attribute, 1), loadVec3(isBackground, vertices, attribute, 2)));
+}
+
+// Reconstructs the attributes of the visible triangle at the center of a visibility buffer texel
+Surface reconstructSurface(uint visibility, ivec2 texel, vec2 screenSize, vec2 texelsPerPixel)
+{
+	uint object = visibility >> 24;
+	uint triangleIndex = visibility & 0xFFFFFF;
+	bool isBackground = (object == 0);
+	uint instance = isBackground ? 0 : object - 1;
+
+	uvec3 vertices = isBackground ?
+		uvec3(backgroundIndices[triangleIndex * 3], backgroundIndices[triangleIndex * 3 + 1], backgroundIndices[triangleIndex * 3 + 2]) :
+		uvec3(modelIndices[triangleIndex * 3], modelIndices[triangleIndex * 3 + 1], modelIndices[triangleIndex * 3 + 2]);
+
+	// Same transformation as the geometry pass
+	mat3 positions = loadAttribute3(isBackground, vertices, 0);
+	vec4 worldPos0 = uboScene.model * vec4(positions[0] + uboScene.instancePos[instance].xyz, 1.0);
+	vec4 worldPos1 = uboScene.model * vec4(positions[1] + uboScene.instancePos[instance].xyz, 1.0);
+	vec4 worldPos2 = uboScene.model * vec4(positions[2] + uboScene.instancePos[instance].xyz, 1.0);
+	mat4 viewProjection = uboScene.projection * uboScene.view;
+
+	vec2 pixelNdc = (vec2(texel) + 0.5) / screenSize * 2.0 - 1.0;
+	Barycentrics bary = calcBarycentrics(viewProjection * worldPos0, viewProjection * worldPos1, viewProjection * worldPos2, pixelNdc, screenSize);
+
+	Surface surface;
+	surface.pos = mat3(worldPos0.xyz, worldPos1.xyz, worldPos2.xyz) * bary.lambda;
+
+	// Texture coordinates with derivatives for mip selection, scaled by the visibility buffer texels covered by a screen pixel
+	mat3x2 uvs = mat3x2(
+		vec2(vertexData(isBackground, vertices.x * VERTEX_STRIDE + VERTEX_UV), vertexData(isBackground, vertices.x * VERTEX_STRIDE + VERTEX_UV + 1)),
+		vec2(vertexData(isBackground, vertices.y * VERTEX_STRIDE + VERTEX_UV), vertexData(isBackground, vertices.y * VERTEX_STRIDE + VERTEX_UV + 1)),
+		vec2(vertexData(isBackground, vertices.z * VERTEX_STRIDE + VERTEX_UV), vertexData(isBackground, vertices.z * VERTEX_STRIDE + VERTEX_UV + 1)));
+	vec2 uv = uvs * bary.lambda;
+	vec2 uvDdx = uvs * bary.ddx * texelsPerPixel.x;
+	vec2 uvDdy = uvs * bary.ddy * texelsPerPixel.y;
+
+	// Normal in world space
+	mat3 mNormal = transpose(inverse(mat3(uboScene.model)));
+	vec3 N = normalize(mNormal * (loadAttribute3(isBackground, vertices, VERTEX_NORMAL) * bary.lambda));
+	vec3 T = normalize(mNormal * (loadAttribute3(isBackground, vertices, VERTEX_TANGENT) * bary.lambda));
+	vec3 B = cross(N, T);
+	mat3 TBN = mat3(T, B, N);
+
+	vec3 normalSample;
+	if (isBackground)
+	{
+		surface.albedo = textureGrad(samplerBackgroundColor, uv, uvDdx, uvDdy);
+		normalSample = textureGrad(samplerBackgroundNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	else
+	{
+		surface.albedo = textureGrad(samplerModelColor, uv, uvDdx, uvDdy);
+		normalSample = textureGrad(samplerModelNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	surface.normal = TBN * normalize(normalSample * 2.0 - vec3(1.0));
+	return surface;
+}
+
+vec3 calculateLighting(vec3 pos, vec3 normal, vec4 albedo)
+{
+	vec3 result = vec3(0.0);
+
+	for(int i = 0; i < NUM_LIGHTS; ++i)
+	{
+		// Vector to light
+		vec3 L = ubo.lights[i].position.xyz - pos;
+		// Distance from light to fragment position
+		float dist = length(L);
+
+		// Viewer to fragment
+		vec3 V = ubo.viewPos.xyz - pos;
+		V = normalize(V);
+
+		// Light to fragment
+		L = normalize(L);
+
+		// Attenuation
+		float atten = ubo.lights[i].radius / (pow(dist, 2.0) + 1.0);
+
+		// Diffuse part
+		vec3 N = normalize(normal);
+		float NdotL = max(0.0, dot(N, L));
+		vec3 diff = ubo.lights[i].color * albedo.rgb * NdotL * atten;
+
+		// Specular part
+		vec3 R = reflect(-L, N);
+		float NdotR = max(0.0, dot(R, V));
+		vec3 spec = ubo.lights[i].color * albedo.a * pow(NdotR, 8.0) * atten;
+
+		result += diff + spec;
+	}
+	return result;
+}
+
+void main()
+{
+	ivec2 attDim = textureSize(samplerVisibility);
+	ivec2 UV = ivec2(inUV * attDim);
+	vec2 screenSize = vec2(attDim);
+	// The visibility buffer doesn't match the window size, so the texture derivatives need to be scaled
+	vec2 texelsPerPixel = abs(vec2(dFdx(inUV.x), dFdy(inUV.y))) * screenSize;
+
+	// Debug display
+	if (ubo.debugDisplayTarget > 0) {
+		uint visibility = texelFetch(samplerVisibility, UV, 0).r;
+		if (visibility == EMPTY_PIXEL) {
+			outFragcolor = vec4(0.0, 0.0, 0.0, 1.0);
+			return;
+		}
+		Surface surface = reconstructSurface(visibility, UV, screenSize, texelsPerPixel);
+		switch (ubo.debugDisplayTarget) {
+			case 1:
+				outFragcolor.rgb = surface.pos;
+				break;
+			case 2:
+				outFragcolor.rgb = surface.normal;
+				break;
+			case 3:
+				outFragcolor.rgb = surface.albedo.rgb;
+				break;
+			case 4:
+				outFragcolor.rgb = surface.albedo.aaa;
+				break;
+		}
+		outFragcolor.a = 1.0;
+		return;
+	}
+
+	// Shade every MSAA sample, consecutive samples covered by the same triangle reuse the result so pixels inside a triangle are only shaded once
+	vec3 fragColor = vec3(0.0);
+	uint shadedVisibility = EMPTY_PIXEL;
+	vec3 shadedColor = vec3(0.0);
+	for (int i = 0; i < NUM_SAMPLES; i++)
+	{
+		uint visibility = texelFetch(samplerVisibility, UV, i).r;
+		if (visibility != shadedVisibility)
+		{
+			shadedVisibility = visibility;
+			shadedColor = vec3(0.0);
+			if (visibility != EMPTY_PIXEL)
+			{
+				Surface surface = reconstructSurface(visibility, UV, screenSize, texelsPerPixel);
+				shadedColor = surface.albedo.rgb * ambient + calculateLighting(surface.pos, surface.normal, surface.albedo);
+			}
+		}
+		fragColor += shadedColor;
+	}
+
+	outFragcolor = vec4(fragColor / float(NUM_SAMPLES), 1.0);
+}
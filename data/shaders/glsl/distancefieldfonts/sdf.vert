@@ -1,7 +1,8 @@
 #version 450
 
-layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec2 inUV;
+// Per glyph instance
+layout (location = 0) in vec4 inRect;
+layout (location = 1) in vec4 inUV;
 
 layout (binding = 0) uniform UBO 
 {
@@ -13,6 +14,8 @@ layout (location = 0) out vec2 outUV;
 
 void main() 
 {
-	outUV = inUV;
-	gl_Position = ubo.projection * ubo.model * vec4(inPos.xyz, 1.0);
+	// Generate the corners of the glyph quad (triangle strip) from the vertex index
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+	outUV = mix(inUV.xy, inUV.zw, corner);
+	gl_Position = ubo.projection * ubo.model * vec4(mix(inRect.xy, inRect.zw, corner), 0.0, 1.0);
 }
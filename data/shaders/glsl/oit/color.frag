@@ -2,9 +2,10 @@
 
 #define MAX_FRAGMENT_COUNT 128
 
+// Color is packed to RGBA8 to keep nodes at 12 bytes
 struct Node
 {
-    vec4 color;
+    uint color;
     float depth;
     uint next;
 };
@@ -49,7 +50,8 @@ void main()
     vec4 color = vec4(0.025, 0.025, 0.025, 1.0f);
     for (int i = 0; i < count; ++i)
     {
-        color = mix(color, fragments[i].color, fragments[i].color.a);
+        vec4 fragmentColor = unpackUnorm4x8(fragments[i].color);
+        color = mix(color, fragmentColor, fragmentColor.a);
     }
 
     outFragColor = color;
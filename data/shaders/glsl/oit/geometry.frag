@@ -2,9 +2,10 @@
 
 layout (early_fragment_tests) in;
 
+// Color is packed to RGBA8 to keep nodes at 12 bytes
 struct Node
 {
-    vec4 color;
+    uint color;
     float depth;
     uint next;
 };
@@ -39,7 +40,7 @@ void main()
         uint prevHeadIdx = imageAtomicExchange(headIndexImage, ivec2(gl_FragCoord.xy), nodeIdx);
 
         // Store node data
-        nodes[nodeIdx].color = pushConsts.color;
+        nodes[nodeIdx].color = packUnorm4x8(pushConsts.color);
         nodes[nodeIdx].depth = gl_FragCoord.z;
         nodes[nodeIdx].next = prevHeadIdx;
     }
@@ -0,0 +1,22 @@
+#version 450
+
+layout (location = 0) in float inViewDepth;
+
+// Both attachments use the same blend state (no independent blending required):
+// color channels are summed up, alpha is multiplied by (1 - alpha) to get the revealage
+layout (location = 0) out vec4 outAccumulation;
+layout (location = 1) out vec4 outWeight;
+
+layout(push_constant) uniform PushConsts {
+	mat4 model;
+    vec4 color;
+} pushConsts;
+
+void main()
+{
+    vec4 color = pushConsts.color;
+    // Depth based weight from McGuire and Bavoil, "Weighted Blended Order-Independent Transparency" (eq. 9)
+    float weight = color.a * clamp(0.03 / (1e-5 + pow(inViewDepth / 200.0, 4.0)), 1e-2, 3e3);
+    outAccumulation = vec4(color.rgb * color.a * weight, color.a);
+    outWeight = vec4(color.a * weight);
+}
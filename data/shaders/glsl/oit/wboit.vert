@@ -0,0 +1,23 @@
+#version 450
+
+layout (location = 0) in vec3 inPos;
+
+layout (set = 0, binding = 0) uniform RenderPassUBO
+{
+    mat4 projection;
+    mat4 view;
+} renderPassUBO;
+
+layout(push_constant) uniform PushConsts {
+	mat4 model;
+    vec4 color;
+} pushConsts;
+
+layout (location = 0) out float outViewDepth;
+
+void main()
+{
+    vec4 viewPos = renderPassUBO.view * pushConsts.model * vec4(inPos, 1.0);
+    outViewDepth = abs(viewPos.z);
+    gl_Position = renderPassUBO.projection * viewPos;
+}
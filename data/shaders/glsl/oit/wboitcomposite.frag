@@ -0,0 +1,19 @@
+#version 450
+
+layout (set = 0, binding = 0) uniform sampler2D samplerAccumulation;
+layout (set = 0, binding = 1) uniform sampler2D samplerWeight;
+
+layout (location = 0) out vec4 outFragColor;
+
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec4 accumulation = texelFetch(samplerAccumulation, coord, 0);
+    float weight = texelFetch(samplerWeight, coord, 0).r;
+    float revealage = accumulation.a;
+
+    // Same background as the linked list resolve
+    vec3 background = vec3(0.025);
+    vec3 average = accumulation.rgb / max(weight, 1e-5);
+    outFragColor = vec4(mix(average, background, revealage), 1.0);
+}
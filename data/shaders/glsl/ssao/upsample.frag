@@ -0,0 +1,35 @@
+#version 450
+
+layout (binding = 0) uniform sampler2D samplerSSAO;
+layout (binding = 1) uniform sampler2D samplerPositionDepthLowRes;
+layout (binding = 2) uniform sampler2D samplerPositionDepth;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out float outFragColor;
+
+void main()
+{
+	float depth = texture(samplerPositionDepth, inUV).w;
+
+	// Joint bilateral upsampling: the four low resolution texels surrounding the fragment are weighted bilinearly and by how close their depth is to the fragment's
+	// so occlusion doesn't bleed across depth discontinuities
+	ivec2 lowResDim = textureSize(samplerSSAO, 0);
+	vec2 lowResPos = inUV * vec2(lowResDim) - 0.5;
+	ivec2 base = ivec2(floor(lowResPos));
+	vec2 f = fract(lowResPos);
+	float result = 0.0;
+	float weightSum = 0.0;
+	for (int y = 0; y < 2; y++) {
+		for (int x = 0; x < 2; x++) {
+			ivec2 texel = clamp(base + ivec2(x, y), ivec2(0), lowResDim - 1);
+			float bilinear = ((x == 0) ? 1.0 - f.x : f.x) * ((y == 0) ? 1.0 - f.y : f.y);
+			float sampleDepth = texelFetch(samplerPositionDepthLowRes, texel, 0).w;
+			float weight = bilinear / (0.001 + abs(sampleDepth - depth) / depth);
+			result += texelFetch(samplerSSAO, texel, 0).r * weight;
+			weightSum += weight;
+		}
+	}
+
+	outFragColor = result / weightSum;
+}
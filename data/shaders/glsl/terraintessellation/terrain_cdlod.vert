@@ -0,0 +1,80 @@
+#version 450
+
+layout (set = 0, binding = 0) uniform UBO
+{
+	mat4 projection;
+	mat4 modelview;
+	vec4 lightPos;
+	vec4 cameraPos;
+	float heightScale;
+	float tileSize;
+} ubo;
+
+// Streamed tiles, one tile per layer
+layout (set = 0, binding = 1) uniform sampler2DArray samplerTiles;
+
+struct Instance
+{
+	// xy = world space origin, z = world space grid spacing
+	vec4 node;
+	// xy = texel offset in the cached tile, z = texels per grid step, w = tile cache layer
+	vec4 texel;
+	// x = morph start distance, y = morph end distance
+	vec4 morph;
+};
+
+layout (std430, set = 0, binding = 3) readonly buffer Instances
+{
+	Instance instances[];
+};
+
+layout (location = 0) in vec2 inGridPos;
+
+layout (location = 0) out vec3 outNormal;
+layout (location = 1) out vec2 outUV;
+layout (location = 2) out vec3 outViewVec;
+layout (location = 3) out vec3 outLightVec;
+layout (location = 4) out vec3 outEyePos;
+layout (location = 5) out vec3 outWorldPos;
+layout (location = 6) out float outHeight;
+
+float sampleHeight(Instance instance, vec2 gridPos)
+{
+	// Tiles store (tileSize + 1)^2 samples, sample at texel centers
+	vec2 texel = instance.texel.xy + gridPos * instance.texel.z;
+	return textureLod(samplerTiles, vec3((texel + 0.5) / (ubo.tileSize + 1.0), instance.texel.w), 0.0).r;
+}
+
+void main(void)
+{
+	Instance instance = instances[gl_InstanceIndex];
+	float gridSpacing = instance.node.z;
+
+	// Morph factor is based on the distance of the unmorphed vertex, so it's the same for vertices shared by neighbouring nodes
+	vec2 worldXZ = instance.node.xy + inGridPos * gridSpacing;
+	vec3 pos = vec3(worldXZ.x, -sampleHeight(instance, inGridPos) * ubo.heightScale, worldXZ.y);
+	float morphK = clamp((distance(pos, ubo.cameraPos.xyz) - instance.morph.x) / (instance.morph.y - instance.morph.x), 0.0, 1.0);
+
+	// Move odd grid vertices onto the edges of the next coarser grid
+	vec2 gridPos = inGridPos - fract(inGridPos * 0.5) * 2.0 * morphK;
+	worldXZ = instance.node.xy + gridPos * gridSpacing;
+	float height = sampleHeight(instance, gridPos);
+	pos = vec3(worldXZ.x, -height * ubo.heightScale, worldXZ.y);
+
+	// Normal from neighbouring samples, same orientation as the normals of the tessellated patch
+	float hL = sampleHeight(instance, gridPos - vec2(1.0, 0.0));
+	float hR = sampleHeight(instance, gridPos + vec2(1.0, 0.0));
+	float hD = sampleHeight(instance, gridPos - vec2(0.0, 1.0));
+	float hU = sampleHeight(instance, gridPos + vec2(0.0, 1.0));
+	outNormal = normalize(vec3(hL - hR, 2.0 * gridSpacing / ubo.heightScale, hD - hU));
+
+	// Same texture coordinates as the tessellated patch, which covers [-64, 64]
+	outUV = worldXZ / 128.0 + 0.5;
+	outHeight = height;
+
+	gl_Position = ubo.projection * ubo.modelview * vec4(pos, 1.0);
+	outViewVec = -pos;
+	outLightVec = normalize(ubo.lightPos.xyz + outViewVec);
+	outWorldPos = pos;
+	outEyePos = vec3(ubo.modelview * vec4(pos, 1.0));
+}
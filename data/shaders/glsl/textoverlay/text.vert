@@ -1,7 +1,8 @@
 #version 450 core
 
-layout (location = 0) in vec2 inPos;
-layout (location = 1) in vec2 inUV;
+// Per glyph instance
+layout (location = 0) in vec4 inRect;
+layout (location = 1) in vec4 inUV;
 
 layout (location = 0) out vec2 outUV;
 
@@ -12,6 +13,8 @@ out gl_PerVertex
 
 void main(void)
 {
-	gl_Position = vec4(inPos, 0.0, 1.0);
-	outUV = inUV;
+	// Generate the corners of the glyph quad (triangle strip) from the vertex index
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+	gl_Position = vec4(mix(inRect.xy, inRect.zw, corner), 0.0, 1.0);
+	outUV = mix(inUV.xy, inUV.zw, corner);
 }
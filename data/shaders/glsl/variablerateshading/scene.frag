@@ -1,9 +1,29 @@
 #version 450
 
 #extension GL_NV_shading_rate_image : require
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout (set = 1, binding = 0) uniform sampler2D samplerColorMap;
-layout (set = 1, binding = 1) uniform sampler2D samplerNormalMap;
+struct Material {
+	vec4 baseColorFactor;
+	float metallicFactor;
+	float roughnessFactor;
+	float alphaCutoff;
+	uint alphaMode;
+	int baseColorTexture;
+	int metallicRoughnessTexture;
+	int normalTexture;
+	int occlusionTexture;
+	int emissiveTexture;
+};
+
+layout (set = 1, binding = 0) readonly buffer Materials {
+	Material materials[];
+};
+layout (set = 1, binding = 1) uniform sampler2D textures[];
+
+layout (push_constant) uniform PushConsts {
+	uint materialIndex;
+} pushConsts;
 
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
@@ -25,14 +45,18 @@ layout (set = 0, binding = 0) uniform UBOScene
 layout (location = 0) out vec4 outFragColor;
 
 layout (constant_id = 0) const bool ALPHA_MASK = false;
-layout (constant_id = 1) const float ALPHA_MASK_CUTOFF = 0.0f;
 
 void main() 
 {
-	vec4 color = texture(samplerColorMap, inUV) * vec4(inColor, 1.0);
+	Material material = materials[pushConsts.materialIndex];
+
+	vec4 color = material.baseColorFactor * vec4(inColor, 1.0);
+	if (material.baseColorTexture >= 0) {
+		color *= texture(textures[material.baseColorTexture], inUV);
+	}
 
 	if (ALPHA_MASK) {
-		if (color.a < ALPHA_MASK_CUTOFF) {
+		if (color.a < material.alphaCutoff) {
 			discard;
 		}
 	}
@@ -41,7 +65,9 @@ void main()
 	vec3 T = normalize(inTangent.xyz);
 	vec3 B = cross(inNormal, inTangent.xyz) * inTangent.w;
 	mat3 TBN = mat3(T, B, N);
-	N = TBN * normalize(texture(samplerNormalMap, inUV).xyz * 2.0 - vec3(1.0));
+	if (material.normalTexture >= 0) {
+		N = TBN * normalize(texture(textures[material.normalTexture], inUV).xyz * 2.0 - vec3(1.0));
+	}
 
 	const float ambient = 0.25;
 	vec3 L = normalize(inLightVec);
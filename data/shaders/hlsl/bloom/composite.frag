@@ -0,0 +1,22 @@
+// Copyright 2020 Google LLC
+
+// Binding 1: First level of the mip chain, containing the accumulated result of all levels
+Texture2D textureBloom : register(t1);
+SamplerState samplerBloom : register(s1);
+
+cbuffer UBO : register(b0)
+{
+	float blurScale;
+	float blurStrength;
+	float threshold;
+	float knee;
+	float intensity;
+	float mipCount;
+};
+
+float4 main([[vk::location(0)]] float2 inUV : TEXCOORD0) : SV_TARGET
+{
+	// Every level adds its own copy of the glow, normalize so the brightness doesn't change with the chain length
+	float3 bloom = textureBloom.Sample(samplerBloom, inUV).rgb * intensity / mipCount;
+	return float4(bloom, 1.0);
+}
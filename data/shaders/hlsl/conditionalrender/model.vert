@@ -16,16 +16,20 @@ struct UBO
 
 cbuffer ubo : register(b0) { UBO ubo; }
 
-struct Node
+struct NodeData
 {
 	float4x4 transform;
+	uint firstJoint;
+	uint jointCount;
+	uint2 _pad;
 };
 
-cbuffer NodeBuf : register(b0, space1) { Node node; }
+StructuredBuffer<NodeData> nodes : register(t0, space1);
 
 struct PushConstant
 {
 	float4 baseColorFactor;
+	uint meshIndex;
 };
 
 [[vk::push_constant]] PushConstant material;
@@ -42,14 +46,15 @@ struct VSOutput
 VSOutput main(VSInput input)
 {
 	VSOutput output = (VSOutput)0;
+	float4x4 nodeTransform = nodes[material.meshIndex].transform;
 	output.Normal = input.Normal;
 	output.Color = material.baseColorFactor.rgb;
 	float4 pos = float4(input.Pos, 1.0);
-	output.Pos = mul(ubo.projection, mul(ubo.view, mul(ubo.model, mul(node.transform, pos))));
+	output.Pos = mul(ubo.projection, mul(ubo.view, mul(ubo.model, mul(nodeTransform, pos))));
 
-	output.Normal = mul((float4x3)mul(ubo.view, mul(ubo.model, node.transform)), input.Normal).xyz;
+	output.Normal = mul((float4x3)mul(ubo.view, mul(ubo.model, nodeTransform)), input.Normal).xyz;
 
-	float4 localpos = mul(ubo.view, mul(ubo.model, mul(node.transform, pos)));
+	float4 localpos = mul(ubo.view, mul(ubo.model, mul(nodeTransform, pos)));
 	float3 lightPos = float3(10.0f, -10.0f, 10.0f);
 	output.LightVec = lightPos.xyz - localpos.xyz;
 	output.ViewVec = -localpos.xyz;
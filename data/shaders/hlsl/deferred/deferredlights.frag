@@ -0,0 +1,130 @@
+// Copyright 2020 Google LLC
+
+// Cluster grid, must match the defines in deferred.cpp
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+Texture2D textureposition : register(t1);
+SamplerState samplerposition : register(s1);
+Texture2D textureNormal : register(t2);
+SamplerState samplerNormal : register(s2);
+Texture2D textureAlbedo : register(t3);
+SamplerState samplerAlbedo : register(s3);
+
+struct Light {
+	float4 position;
+	float3 color;
+	float radius;
+};
+
+struct UBO
+{
+	float4x4 view;
+	float4 projectionParams;
+	float4 viewPos;
+	uint lightCount;
+	uint screenWidth;
+	uint screenHeight;
+	int displayDebugTarget;
+};
+cbuffer ubo : register(b5) { UBO ubo; }
+
+// Binding 6: All lights, the w component of the position is the range of the light
+StructuredBuffer<Light> lights : register(t6);
+
+// Binding 7: Offset into the light index list and light count per cluster
+StructuredBuffer<uint2> clusters : register(t7);
+
+// Binding 8: Compact list of light indices for all clusters
+StructuredBuffer<uint> lightIndices : register(t8);
+
+// Shade only the lights assigned to the fragment's cluster, or all lights if disabled
+[[vk::constant_id(0)]] const int clustered = 1;
+
+#define ambient 0.0
+
+float3 shadeLight(Light light, float3 fragPos, float3 N, float3 V, float4 albedo)
+{
+	// Vector to light
+	float3 L = light.position.xyz - fragPos;
+	// Distance from light to fragment position
+	float dist = length(L);
+	L = normalize(L);
+
+	// Same attenuation as the uniform block path, faded out towards the range used for culling
+	float window = clamp(1.0 - pow(dist / light.position.w, 4.0), 0.0, 1.0);
+	float atten = light.radius / (pow(dist, 2.0) + 1.0) * window * window;
+
+	// Diffuse part
+	float NdotL = max(0.0, dot(N, L));
+	float3 diff = light.color * albedo.rgb * NdotL * atten;
+
+	// Specular part
+	// Specular map values are stored in alpha of albedo mrt
+	float3 R = reflect(-L, N);
+	float NdotR = max(0.0, dot(R, V));
+	float3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten;
+
+	return diff + spec;
+}
+
+float4 main([[vk::location(0)]] float2 inUV : TEXCOORD0, float4 FragCoord : SV_Position) : SV_TARGET
+{
+	// Get G-Buffer values
+	float3 fragPos = textureposition.Sample(samplerposition, inUV).rgb;
+	float3 normal = textureNormal.Sample(samplerNormal, inUV).rgb;
+	float4 albedo = textureAlbedo.Sample(samplerAlbedo, inUV);
+
+	float3 fragcolor;
+
+	// Debug display
+	if (ubo.displayDebugTarget > 0) {
+		switch (ubo.displayDebugTarget) {
+			case 1:
+				fragcolor.rgb = fragPos;
+				break;
+			case 2:
+				fragcolor.rgb = normal;
+				break;
+			case 3:
+				fragcolor.rgb = albedo.rgb;
+				break;
+			case 4:
+				fragcolor.rgb = albedo.aaa;
+				break;
+		}
+		return float4(fragcolor, 1.0);
+	}
+
+	// Ambient part
+	fragcolor = albedo.rgb * ambient;
+
+	float3 N = normalize(normal);
+	float3 V = normalize(ubo.viewPos.xyz - fragPos);
+
+	if (clustered == 1)
+	{
+		// Find the cluster from the screen tile and the exponential depth slice of the fragment
+		float near = ubo.projectionParams.z;
+		float far = ubo.projectionParams.w;
+		float depth = max(-mul(ubo.view, float4(fragPos, 1.0)).z, near);
+		uint slice = min(uint(log(depth / near) / log(far / near) * float(CLUSTER_Z)), CLUSTER_Z - 1);
+		uint2 tile = min(uint2(FragCoord.xy * float2(CLUSTER_X, CLUSTER_Y) / float2(ubo.screenWidth, ubo.screenHeight)), uint2(CLUSTER_X - 1, CLUSTER_Y - 1));
+		uint2 cluster = clusters[tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y];
+
+		for (uint i = 0; i < cluster.y; i++)
+		{
+			fragcolor += shadeLight(lights[lightIndices[cluster.x + i]], fragPos, N, V, albedo);
+		}
+	}
+	else
+	{
+		for (uint i = 0; i < ubo.lightCount; i++)
+		{
+			fragcolor += shadeLight(lights[i], fragPos, N, V, albedo);
+		}
+	}
+
+	return float4(fragcolor, 1.0);
+}
@@ -0,0 +1,279 @@
+// Copyright 2020 Google LLC
+
+// Cluster grid, must match the defines in deferred.cpp
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+
+// Floats per vkglTF::Vertex and offsets of the attributes used for shading
+#define VERTEX_STRIDE 24
+#define VERTEX_NORMAL 3
+#define VERTEX_UV 6
+#define VERTEX_TANGENT 20
+
+#define EMPTY_PIXEL 0xFFFFFFFF
+
+struct Light {
+	float4 position;
+	float3 color;
+	float radius;
+};
+
+struct UBOScene
+{
+	float4x4 projection;
+	float4x4 model;
+	float4x4 view;
+	float4 instancePos[3];
+};
+cbuffer uboScene : register(b0) { UBOScene uboScene; }
+
+struct UBOComposition
+{
+	Light lights[6];
+	float4 viewPos;
+	int displayDebugTarget;
+};
+cbuffer uboComposition : register(b4) { UBOComposition uboComposition; }
+
+struct UBO
+{
+	float4x4 view;
+	float4 projectionParams;
+	float4 viewPos;
+	uint lightCount;
+	uint screenWidth;
+	uint screenHeight;
+	int displayDebugTarget;
+};
+cbuffer ubo : register(b5) { UBO ubo; }
+
+StructuredBuffer<Light> lights : register(t6);
+StructuredBuffer<uint2> clusters : register(t7);
+StructuredBuffer<uint> lightIndices : register(t8);
+
+// Set 1: Visibility buffer and the geometry and textures of both objects
+Texture2D<uint> textureVisibility : register(t0, space1);
+StructuredBuffer<float> floorVertices : register(t1, space1);
+StructuredBuffer<uint> floorIndices : register(t2, space1);
+StructuredBuffer<float> modelVertices : register(t3, space1);
+StructuredBuffer<uint> modelIndices : register(t4, space1);
+Texture2D textureFloorColor : register(t5, space1);
+SamplerState samplerFloorColor : register(s5, space1);
+Texture2D textureFloorNormalMap : register(t6, space1);
+SamplerState samplerFloorNormalMap : register(s6, space1);
+Texture2D textureModelColor : register(t7, space1);
+SamplerState samplerModelColor : register(s7, space1);
+Texture2D textureModelNormalMap : register(t8, space1);
+SamplerState samplerModelNormalMap : register(s8, space1);
+
+// 0 = uniform block lights, 1 = all lights of the storage buffer, 2 = clustered
+[[vk::constant_id(0)]] const int lightingMode = 0;
+
+#define ambient 0.0
+
+struct Barycentrics {
+	float3 lambda;
+	float3 ddx;
+	float3 ddy;
+};
+
+// Perspective correct barycentrics of the pixel and their screen space derivatives, from the clip space positions of the triangle
+Barycentrics calcBarycentrics(float4 pt0, float4 pt1, float4 pt2, float2 pixelNdc, float2 screenSize)
+{
+	Barycentrics ret;
+	float3 invW = 1.0 / float3(pt0.w, pt1.w, pt2.w);
+	float2 ndc0 = pt0.xy * invW.x;
+	float2 ndc1 = pt1.xy * invW.y;
+	float2 ndc2 = pt2.xy * invW.z;
+
+	float2 e0 = ndc2 - ndc1;
+	float2 e1 = ndc0 - ndc1;
+	float invDet = 1.0 / (e0.x * e1.y - e1.x * e0.y);
+	ret.ddx = float3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	ret.ddy = float3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = dot(ret.ddx, float3(1.0, 1.0, 1.0));
+	float ddySum = dot(ret.ddy, float3(1.0, 1.0, 1.0));
+
+	float2 delta = pixelNdc - ndc0;
+	float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+	float interpW = 1.0 / interpInvW;
+	ret.lambda.x = interpW * (invW.x + delta.x * ret.ddx.x + delta.y * ret.ddy.x);
+	ret.lambda.y = interpW * (delta.x * ret.ddx.y + delta.y * ret.ddy.y);
+	ret.lambda.z = interpW * (delta.x * ret.ddx.z + delta.y * ret.ddy.z);
+
+	// From NDC to pixel steps, NDC and pixel y both point down in Vulkan
+	ret.ddx *= 2.0 / screenSize.x;
+	ret.ddy *= 2.0 / screenSize.y;
+	ddxSum *= 2.0 / screenSize.x;
+	ddySum *= 2.0 / screenSize.y;
+
+	float interpWddx = 1.0 / (interpInvW + ddxSum);
+	float interpWddy = 1.0 / (interpInvW + ddySum);
+	ret.ddx = interpWddx * (ret.lambda * interpInvW + ret.ddx) - ret.lambda;
+	ret.ddy = interpWddy * (ret.lambda * interpInvW + ret.ddy) - ret.lambda;
+	return ret;
+}
+
+float vertexData(bool isFloor, uint offset)
+{
+	return isFloor ? floorVertices[offset] : modelVertices[offset];
+}
+
+// Rows are the vertices
+float3x3 loadAttribute3(bool isFloor, uint3 vertices, uint attribute)
+{
+	float3x3 ret;
+	for (uint i = 0; i < 3; i++)
+	{
+		uint offset = vertices[i] * VERTEX_STRIDE + attribute;
+		ret[i] = float3(vertexData(isFloor, offset), vertexData(isFloor, offset + 1), vertexData(isFloor, offset + 2));
+	}
+	return ret;
+}
+
+float3 shadeLight(Light light, float3 fragPos, float3 N, float3 V, float4 albedo, bool window)
+{
+	// Vector to light
+	float3 L = light.position.xyz - fragPos;
+	// Distance from light to fragment position
+	float dist = length(L);
+	L = normalize(L);
+
+	// Attenuation, storage buffer lights fade out towards the range used for culling
+	float atten = light.radius / (pow(dist, 2.0) + 1.0);
+	if (window)
+	{
+		float fade = clamp(1.0 - pow(dist / light.position.w, 4.0), 0.0, 1.0);
+		atten *= fade * fade;
+	}
+
+	// Diffuse part
+	float NdotL = max(0.0, dot(N, L));
+	float3 diff = light.color * albedo.rgb * NdotL * atten;
+
+	// Specular part
+	float3 R = reflect(-L, N);
+	float NdotR = max(0.0, dot(R, V));
+	float3 spec = light.color * albedo.a * pow(NdotR, 16.0) * atten;
+
+	return diff + spec;
+}
+
+float4 main([[vk::location(0)]] float2 inUV : TEXCOORD0, float4 FragCoord : SV_Position) : SV_TARGET
+{
+	uint visibility = textureVisibility.Load(int3(FragCoord.xy, 0));
+	if (visibility == EMPTY_PIXEL)
+	{
+		return float4(0.0, 0.0, 0.0, 1.0);
+	}
+
+	uint object = visibility >> 24;
+	uint triangleIndex = visibility & 0xFFFFFF;
+	bool isFloor = (object == 0);
+	uint instance = isFloor ? 0 : object - 1;
+
+	uint3 vertices = isFloor ?
+		uint3(floorIndices[triangleIndex * 3], floorIndices[triangleIndex * 3 + 1], floorIndices[triangleIndex * 3 + 2]) :
+		uint3(modelIndices[triangleIndex * 3], modelIndices[triangleIndex * 3 + 1], modelIndices[triangleIndex * 3 + 2]);
+
+	// Same transformation as the geometry pass
+	float3x3 positions = loadAttribute3(isFloor, vertices, 0);
+	float4 worldPos0 = mul(uboScene.model, float4(positions[0] + uboScene.instancePos[instance].xyz, 1.0));
+	float4 worldPos1 = mul(uboScene.model, float4(positions[1] + uboScene.instancePos[instance].xyz, 1.0));
+	float4 worldPos2 = mul(uboScene.model, float4(positions[2] + uboScene.instancePos[instance].xyz, 1.0));
+	float4x4 viewProjection = mul(uboScene.projection, uboScene.view);
+
+	float2 screenSize = float2(ubo.screenWidth, ubo.screenHeight);
+	float2 pixelNdc = FragCoord.xy / screenSize * 2.0 - 1.0;
+	Barycentrics bary = calcBarycentrics(mul(viewProjection, worldPos0), mul(viewProjection, worldPos1), mul(viewProjection, worldPos2), pixelNdc, screenSize);
+
+	float3 fragPos = worldPos0.xyz * bary.lambda.x + worldPos1.xyz * bary.lambda.y + worldPos2.xyz * bary.lambda.z;
+
+	// Texture coordinates with derivatives for mip selection, as there are no screen space derivatives across triangles in a fullscreen pass
+	float2 uv0 = float2(vertexData(isFloor, vertices.x * VERTEX_STRIDE + VERTEX_UV), vertexData(isFloor, vertices.x * VERTEX_STRIDE + VERTEX_UV + 1));
+	float2 uv1 = float2(vertexData(isFloor, vertices.y * VERTEX_STRIDE + VERTEX_UV), vertexData(isFloor, vertices.y * VERTEX_STRIDE + VERTEX_UV + 1));
+	float2 uv2 = float2(vertexData(isFloor, vertices.z * VERTEX_STRIDE + VERTEX_UV), vertexData(isFloor, vertices.z * VERTEX_STRIDE + VERTEX_UV + 1));
+	float2 uv = uv0 * bary.lambda.x + uv1 * bary.lambda.y + uv2 * bary.lambda.z;
+	float2 uvDdx = uv0 * bary.ddx.x + uv1 * bary.ddx.y + uv2 * bary.ddx.z;
+	float2 uvDdy = uv0 * bary.ddy.x + uv1 * bary.ddy.y + uv2 * bary.ddy.z;
+
+	// Normal in world space
+	float3 N = normalize(mul((float3x3)uboScene.model, mul(bary.lambda, loadAttribute3(isFloor, vertices, VERTEX_NORMAL))));
+	float3 T = normalize(mul((float3x3)uboScene.model, mul(bary.lambda, loadAttribute3(isFloor, vertices, VERTEX_TANGENT))));
+	float3 B = cross(N, T);
+	float3x3 TBN = float3x3(T, B, N);
+
+	float4 albedo;
+	float3 normalSample;
+	if (isFloor)
+	{
+		albedo = textureFloorColor.SampleGrad(samplerFloorColor, uv, uvDdx, uvDdy);
+		normalSample = textureFloorNormalMap.SampleGrad(samplerFloorNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	else
+	{
+		albedo = textureModelColor.SampleGrad(samplerModelColor, uv, uvDdx, uvDdy);
+		normalSample = textureModelNormalMap.SampleGrad(samplerModelNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	float3 normal = mul(normalize(normalSample * 2.0 - float3(1.0, 1.0, 1.0)), TBN);
+
+	float3 fragcolor;
+
+	// Debug display
+	if (uboComposition.displayDebugTarget > 0) {
+		switch (uboComposition.displayDebugTarget) {
+			case 1:
+				fragcolor.rgb = fragPos;
+				break;
+			case 2:
+				fragcolor.rgb = normal;
+				break;
+			case 3:
+				fragcolor.rgb = albedo.rgb;
+				break;
+			case 4:
+				fragcolor.rgb = albedo.aaa;
+				break;
+		}
+		return float4(fragcolor, 1.0);
+	}
+
+	// Ambient part
+	fragcolor = albedo.rgb * ambient;
+
+	N = normalize(normal);
+	float3 V = normalize(uboComposition.viewPos.xyz - fragPos);
+
+	if (lightingMode == 0)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			fragcolor += shadeLight(uboComposition.lights[i], fragPos, N, V, albedo, false);
+		}
+	}
+	else if (lightingMode == 1)
+	{
+		for (uint i = 0; i < ubo.lightCount; i++)
+		{
+			fragcolor += shadeLight(lights[i], fragPos, N, V, albedo, true);
+		}
+	}
+	else
+	{
+		// Find the cluster from the screen tile and the exponential depth slice of the fragment
+		float near = ubo.projectionParams.z;
+		float far = ubo.projectionParams.w;
+		float depth = max(-mul(ubo.view, float4(fragPos, 1.0)).z, near);
+		uint slice = min(uint(log(depth / near) / log(far / near) * float(CLUSTER_Z)), CLUSTER_Z - 1);
+		uint2 tile = min(uint2(FragCoord.xy * float2(CLUSTER_X, CLUSTER_Y) / screenSize), uint2(CLUSTER_X - 1, CLUSTER_Y - 1));
+		uint2 cluster = clusters[tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y];
+
+		for (uint i = 0; i < cluster.y; i++)
+		{
+			fragcolor += shadeLight(lights[lightIndices[cluster.x + i]], fragPos, N, V, albedo, true);
+		}
+	}
+
+	return float4(fragcolor, 1.0);
+}
@@ -0,0 +1,12 @@
+// Copyright 2020 Google LLC
+
+struct VSOutput
+{
+[[vk::location(0)]] nointerpolation uint Object : TEXCOORD0;
+};
+
+uint main(VSOutput input, uint PrimitiveID : SV_PrimitiveID) : SV_TARGET
+{
+	// Object in the upper 8 bits, triangle within the object's index buffer in the lower 24 bits
+	return (input.Object << 24) | (PrimitiveID & 0xFFFFFF);
+}
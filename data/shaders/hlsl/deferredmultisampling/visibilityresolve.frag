@@ -0,0 +1,266 @@
+// Copyright 2020 Google LLC
+
+// Floats per vkglTF::Vertex and offsets of the attributes used for shading
+#define VERTEX_STRIDE 24
+#define VERTEX_NORMAL 3
+#define VERTEX_UV 6
+#define VERTEX_TANGENT 20
+
+#define EMPTY_PIXEL 0xFFFFFFFF
+
+struct Light {
+	float4 position;
+	float3 color;
+	float radius;
+};
+
+struct UBOScene
+{
+	float4x4 projection;
+	float4x4 model;
+	float4x4 view;
+	float4 instancePos[3];
+};
+cbuffer uboScene : register(b0) { UBOScene uboScene; }
+
+struct UBO
+{
+	Light lights[6];
+	float4 viewPos;
+	int debugDisplayTarget;
+};
+cbuffer ubo : register(b4) { UBO ubo; }
+
+// Set 1: Visibility buffer and the geometry and textures of both objects
+Texture2DMS<uint> textureVisibility : register(t0, space1);
+StructuredBuffer<float> backgroundVertices : register(t1, space1);
+StructuredBuffer<uint> backgroundIndices : register(t2, space1);
+StructuredBuffer<float> modelVertices : register(t3, space1);
+StructuredBuffer<uint> modelIndices : register(t4, space1);
+Texture2D textureBackgroundColor : register(t5, space1);
+SamplerState samplerBackgroundColor : register(s5, space1);
+Texture2D textureBackgroundNormalMap : register(t6, space1);
+SamplerState samplerBackgroundNormalMap : register(s6, space1);
+Texture2D textureModelColor : register(t7, space1);
+SamplerState samplerModelColor : register(s7, space1);
+Texture2D textureModelNormalMap : register(t8, space1);
+SamplerState samplerModelNormalMap : register(s8, space1);
+
+[[vk::constant_id(0)]] const int NUM_SAMPLES = 8;
+
+#define NUM_LIGHTS 6
+#define ambient 0.15
+
+struct Barycentrics {
+	float3 lambda;
+	float3 ddx;
+	float3 ddy;
+};
+
+struct Surface {
+	float3 pos;
+	float3 normal;
+	float4 albedo;
+};
+
+// Perspective correct barycentrics of the pixel and their screen space derivatives, from the clip space positions of the triangle
+Barycentrics calcBarycentrics(float4 pt0, float4 pt1, float4 pt2, float2 pixelNdc, float2 screenSize)
+{
+	Barycentrics ret;
+	float3 invW = 1.0 / float3(pt0.w, pt1.w, pt2.w);
+	float2 ndc0 = pt0.xy * invW.x;
+	float2 ndc1 = pt1.xy * invW.y;
+	float2 ndc2 = pt2.xy * invW.z;
+
+	float2 e0 = ndc2 - ndc1;
+	float2 e1 = ndc0 - ndc1;
+	float invDet = 1.0 / (e0.x * e1.y - e1.x * e0.y);
+	ret.ddx = float3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	ret.ddy = float3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = dot(ret.ddx, float3(1.0, 1.0, 1.0));
+	float ddySum = dot(ret.ddy, float3(1.0, 1.0, 1.0));
+
+	float2 delta = pixelNdc - ndc0;
+	float interpInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+	float interpW = 1.0 / interpInvW;
+	ret.lambda.x = interpW * (invW.x + delta.x * ret.ddx.x + delta.y * ret.ddy.x);
+	ret.lambda.y = interpW * (delta.x * ret.ddx.y + delta.y * ret.ddy.y);
+	ret.lambda.z = interpW * (delta.x * ret.ddx.z + delta.y * ret.ddy.z);
+
+	// From NDC to pixel steps, NDC and pixel y both point down in Vulkan
+	ret.ddx *= 2.0 / screenSize.x;
+	ret.ddy *= 2.0 / screenSize.y;
+	ddxSum *= 2.0 / screenSize.x;
+	ddySum *= 2.0 / screenSize.y;
+
+	float interpWddx = 1.0 / (interpInvW + ddxSum);
+	float interpWddy = 1.0 / (interpInvW + ddySum);
+	ret.ddx = interpWddx * (ret.lambda * interpInvW + ret.ddx) - ret.lambda;
+	ret.ddy = interpWddy * (ret.lambda * interpInvW + ret.ddy) - ret.lambda;
+	return ret;
+}
+
+float vertexData(bool isBackground, uint offset)
+{
+	return isBackground ? backgroundVertices[offset] : modelVertices[offset];
+}
+
+// Rows are the vertices
+float3x3 loadAttribute3(bool isBackground, uint3 vertices, uint attribute)
+{
+	float3x3 ret;
+	for (uint i = 0; i < 3; i++)
+	{
+		uint offset = vertices[i] * VERTEX_STRIDE + attribute;
+		ret[i] = float3(vertexData(isBackground, offset), vertexData(isBackground, offset + 1), vertexData(isBackground, offset + 2));
+	}
+	return ret;
+}
+
+// Reconstructs the attributes of the visible triangle at the center of a visibility buffer texel
+Surface reconstructSurface(uint visibility, int2 texel, float2 screenSize, float2 texelsPerPixel)
+{
+	uint object = visibility >> 24;
+	uint triangleIndex = visibility & 0xFFFFFF;
+	bool isBackground = (object == 0);
+	uint instance = isBackground ? 0 : object - 1;
+
+	uint3 vertices = isBackground ?
+		uint3(backgroundIndices[triangleIndex * 3], backgroundIndices[triangleIndex * 3 + 1], backgroundIndices[triangleIndex * 3 + 2]) :
+		uint3(modelIndices[triangleIndex * 3], modelIndices[triangleIndex * 3 + 1], modelIndices[triangleIndex * 3 + 2]);
+
+	// Same transformation as the geometry pass
+	float3x3 positions = loadAttribute3(isBackground, vertices, 0);
+	float4 worldPos0 = mul(uboScene.model, float4(positions[0] + uboScene.instancePos[instance].xyz, 1.0));
+	float4 worldPos1 = mul(uboScene.model, float4(positions[1] + uboScene.instancePos[instance].xyz, 1.0));
+	float4 worldPos2 = mul(uboScene.model, float4(positions[2] + uboScene.instancePos[instance].xyz, 1.0));
+	float4x4 viewProjection = mul(uboScene.projection, uboScene.view);
+
+	float2 pixelNdc = (float2(texel) + 0.5) / screenSize * 2.0 - 1.0;
+	Barycentrics bary = calcBarycentrics(mul(viewProjection, worldPos0), mul(viewProjection, worldPos1), mul(viewProjection, worldPos2), pixelNdc, screenSize);
+
+	Surface surface;
+	surface.pos = worldPos0.xyz * bary.lambda.x + worldPos1.xyz * bary.lambda.y + worldPos2.xyz * bary.lambda.z;
+
+	// Texture coordinates with derivatives for mip selection, scaled by the visibility buffer texels covered by a screen pixel
+	float2 uv0 = float2(vertexData(isBackground, vertices.x * VERTEX_STRIDE + VERTEX_UV), vertexData(isBackground, vertices.x * VERTEX_STRIDE + VERTEX_UV + 1));
+	float2 uv1 = float2(vertexData(isBackground, vertices.y * VERTEX_STRIDE + VERTEX_UV), vertexData(isBackground, vertices.y * VERTEX_STRIDE + VERTEX_UV + 1));
+	float2 uv2 = float2(vertexData(isBackground, vertices.z * VERTEX_STRIDE + VERTEX_UV), vertexData(isBackground, vertices.z * VERTEX_STRIDE + VERTEX_UV + 1));
+	float2 uv = uv0 * bary.lambda.x + uv1 * bary.lambda.y + uv2 * bary.lambda.z;
+	float2 uvDdx = (uv0 * bary.ddx.x + uv1 * bary.ddx.y + uv2 * bary.ddx.z) * texelsPerPixel.x;
+	float2 uvDdy = (uv0 * bary.ddy.x + uv1 * bary.ddy.y + uv2 * bary.ddy.z) * texelsPerPixel.y;
+
+	// Normal in world space
+	float3 N = normalize(mul((float3x3)uboScene.model, mul(bary.lambda, loadAttribute3(isBackground, vertices, VERTEX_NORMAL))));
+	float3 T = normalize(mul((float3x3)uboScene.model, mul(bary.lambda, loadAttribute3(isBackground, vertices, VERTEX_TANGENT))));
+	float3 B = cross(N, T);
+	float3x3 TBN = float3x3(T, B, N);
+
+	float3 normalSample;
+	if (isBackground)
+	{
+		surface.albedo = textureBackgroundColor.SampleGrad(samplerBackgroundColor, uv, uvDdx, uvDdy);
+		normalSample = textureBackgroundNormalMap.SampleGrad(samplerBackgroundNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	else
+	{
+		surface.albedo = textureModelColor.SampleGrad(samplerModelColor, uv, uvDdx, uvDdy);
+		normalSample = textureModelNormalMap.SampleGrad(samplerModelNormalMap, uv, uvDdx, uvDdy).xyz;
+	}
+	surface.normal = mul(normalize(normalSample * 2.0 - float3(1.0, 1.0, 1.0)), TBN);
+	return surface;
+}
+
+float3 calculateLighting(float3 pos, float3 normal, float4 albedo)
+{
+	float3 result = float3(0.0, 0.0, 0.0);
+
+	for(int i = 0; i < NUM_LIGHTS; ++i)
+	{
+		// Vector to light
+		float3 L = ubo.lights[i].position.xyz - pos;
+		// Distance from light to fragment position
+		float dist = length(L);
+
+		// Viewer to fragment
+		float3 V = ubo.viewPos.xyz - pos;
+		V = normalize(V);
+
+		// Light to fragment
+		L = normalize(L);
+
+		// Attenuation
+		float atten = ubo.lights[i].radius / (pow(dist, 2.0) + 1.0);
+
+		// Diffuse part
+		float3 N = normalize(normal);
+		float NdotL = max(0.0, dot(N, L));
+		float3 diff = ubo.lights[i].color * albedo.rgb * NdotL * atten;
+
+		// Specular part
+		float3 R = reflect(-L, N);
+		float NdotR = max(0.0, dot(R, V));
+		float3 spec = ubo.lights[i].color * albedo.a * pow(NdotR, 8.0) * atten;
+
+		result += diff + spec;
+	}
+	return result;
+}
+
+float4 main([[vk::location(0)]] float2 inUV : TEXCOORD0) : SV_TARGET
+{
+	int2 attDim; int sampleCount;
+	textureVisibility.GetDimensions(attDim.x, attDim.y, sampleCount);
+	int2 UV = int2(inUV * attDim);
+	float2 screenSize = float2(attDim);
+	// The visibility buffer doesn't match the window size, so the texture derivatives need to be scaled
+	float2 texelsPerPixel = abs(float2(ddx(inUV.x), ddy(inUV.y))) * screenSize;
+
+	float3 fragColor;
+
+	// Debug display
+	if (ubo.debugDisplayTarget > 0) {
+		uint visibility = textureVisibility.Load(UV, 0);
+		if (visibility == EMPTY_PIXEL) {
+			return float4(0.0, 0.0, 0.0, 1.0);
+		}
+		Surface surface = reconstructSurface(visibility, UV, screenSize, texelsPerPixel);
+		switch (ubo.debugDisplayTarget) {
+			case 1:
+				fragColor.rgb = surface.pos;
+				break;
+			case 2:
+				fragColor.rgb = surface.normal;
+				break;
+			case 3:
+				fragColor.rgb = surface.albedo.rgb;
+				break;
+			case 4:
+				fragColor.rgb = surface.albedo.aaa;
+				break;
+		}
+		return float4(fragColor, 1.0);
+	}
+
+	// Shade every MSAA sample, consecutive samples covered by the same triangle reuse the result so pixels inside a triangle are only shaded once
+	fragColor = float3(0.0, 0.0, 0.0);
+	uint shadedVisibility = EMPTY_PIXEL;
+	float3 shadedColor = float3(0.0, 0.0, 0.0);
+	for (int i = 0; i < NUM_SAMPLES; i++)
+	{
+		uint visibility = textureVisibility.Load(UV, i);
+		if (visibility != shadedVisibility)
+		{
+			shadedVisibility = visibility;
+			shadedColor = float3(0.0, 0.0, 0.0);
+			if (visibility != EMPTY_PIXEL)
+			{
+				Surface surface = reconstructSurface(visibility, UV, screenSize, texelsPerPixel);
+				shadedColor = surface.albedo.rgb * ambient + calculateLighting(surface.pos, surface.normal, surface.albedo);
+			}
+		}
+		fragColor += shadedColor;
+	}
+
+	return float4(fragColor / float(NUM_SAMPLES), 1.0);
+}
@@ -2,8 +2,10 @@
 
 struct VSInput
 {
-[[vk::location(0)]] float3 Pos : POSITION0;
-[[vk::location(1)]] float2 UV : TEXCOORD0;
+// Per glyph instance
+[[vk::location(0)]] float4 Rect : POSITION0;
+[[vk::location(1)]] float4 UV : TEXCOORD0;
+uint VertexIndex : SV_VertexID;
 };
 
 struct UBO
@@ -23,7 +25,9 @@ struct VSOutput
 VSOutput main(VSInput input)
 {
 	VSOutput output = (VSOutput)0;
-	output.UV = input.UV;
-	output.Pos = mul(ubo.projection, mul(ubo.model, float4(input.Pos.xyz, 1.0)));
+	// Generate the corners of the glyph quad (triangle strip) from the vertex index
+	float2 corner = float2(input.VertexIndex & 1, input.VertexIndex >> 1);
+	output.UV = lerp(input.UV.xy, input.UV.zw, corner);
+	output.Pos = mul(ubo.projection, mul(ubo.model, float4(lerp(input.Rect.xy, input.Rect.zw, corner), 0.0, 1.0)));
 	return output;
 }
@@ -7,9 +7,10 @@ struct VSOutput
 	float4 Pos : SV_POSITION;
 };
 
+// Color is packed to RGBA8 to keep nodes at 12 bytes
 struct Node
 {
-    float4 color;
+    uint color;
     float depth;
     uint next;
 };
@@ -26,6 +27,11 @@ struct Particle
 // Binding 0 : Position storage buffer
 RWStructuredBuffer<Node> nodes : register(u1);
 
+float4 unpackUnorm4x8(uint value)
+{
+    return float4(value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, value >> 24) / 255.0;
+}
+
 float4 main(VSOutput input) : SV_TARGET
 {
     Node fragments[MAX_FRAGMENT_COUNT];
@@ -57,7 +63,8 @@ float4 main(VSOutput input) : SV_TARGET
     float4 color = float4(0.025, 0.025, 0.025, 1.0f);
     for (uint f = 0; f < count; ++f)
     {
-        color = lerp(color, fragments[f].color, fragments[f].color.a);
+        float4 fragmentColor = unpackUnorm4x8(fragments[f].color);
+        color = lerp(color, fragmentColor, fragmentColor.a);
     }
 
     return color;
@@ -5,9 +5,10 @@ struct VSOutput
 	float4 Pos : SV_POSITION;
 };
 
+// Color is packed to RGBA8 to keep nodes at 12 bytes
 struct Node
 {
-    float4 color;
+    uint color;
     float depth;
     uint next;
 };
@@ -30,6 +31,12 @@ struct PushConsts {
 };
 [[vk::push_constant]] PushConsts pushConsts;
 
+uint packUnorm4x8(float4 value)
+{
+    uint4 packed = uint4(round(saturate(value) * 255.0));
+    return packed.r | (packed.g << 8) | (packed.b << 16) | (packed.a << 24);
+}
+
 [earlydepthstencil]
 void main(VSOutput input)
 {
@@ -45,7 +52,7 @@ void main(VSOutput input)
         InterlockedExchange(headIndexImage[uint2(input.Pos.xy)], nodeIdx, prevHeadIdx);
 
         // Store node data
-        nodes[nodeIdx].color = pushConsts.color;
+        nodes[nodeIdx].color = packUnorm4x8(pushConsts.color);
         nodes[nodeIdx].depth = input.Pos.z;
         nodes[nodeIdx].next = prevHeadIdx;
     }
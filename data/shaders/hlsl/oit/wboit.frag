@@ -0,0 +1,32 @@
+// Copyright 2020 Sascha Willems
+
+struct VSOutput
+{
+	float4 Pos : SV_POSITION;
+[[vk::location(0)]] float ViewDepth : TEXCOORD0;
+};
+
+struct PushConsts {
+	float4x4 model;
+	float4 color;
+};
+[[vk::push_constant]] PushConsts pushConsts;
+
+// Both attachments use the same blend state (no independent blending required):
+// color channels are summed up, alpha is multiplied by (1 - alpha) to get the revealage
+struct FSOutput
+{
+	float4 Accumulation : SV_TARGET0;
+	float4 Weight : SV_TARGET1;
+};
+
+FSOutput main(VSOutput input)
+{
+	FSOutput output = (FSOutput)0;
+	float4 color = pushConsts.color;
+	// Depth based weight from McGuire and Bavoil, "Weighted Blended Order-Independent Transparency" (eq. 9)
+	float weight = color.a * clamp(0.03 / (1e-5 + pow(input.ViewDepth / 200.0, 4.0)), 1e-2, 3e3);
+	output.Accumulation = float4(color.rgb * color.a * weight, color.a);
+	output.Weight = (color.a * weight).xxxx;
+	return output;
+}
@@ -0,0 +1,24 @@
+// Copyright 2020 Sascha Willems
+
+Texture2D textureAccumulation : register(t0);
+SamplerState samplerAccumulation : register(s0);
+Texture2D textureWeight : register(t1);
+SamplerState samplerWeight : register(s1);
+
+struct VSOutput
+{
+	float4 Pos : SV_POSITION;
+};
+
+float4 main(VSOutput input) : SV_TARGET
+{
+	int3 coord = int3(input.Pos.xy, 0);
+	float4 accumulation = textureAccumulation.Load(coord);
+	float weight = textureWeight.Load(coord).r;
+	float revealage = accumulation.a;
+
+	// Same background as the linked list resolve
+	float3 background = float3(0.025, 0.025, 0.025);
+	float3 average = accumulation.rgb / max(weight, 1e-5);
+	return float4(lerp(average, background, revealage), 1.0);
+}
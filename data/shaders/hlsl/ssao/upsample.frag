@@ -0,0 +1,35 @@
+// Copyright 2020 Google LLC
+
+Texture2D textureSSAO : register(t0);
+SamplerState samplerSSAO : register(s0);
+Texture2D texturePositionDepthLowRes : register(t1);
+SamplerState samplerPositionDepthLowRes : register(s1);
+Texture2D texturePositionDepth : register(t2);
+SamplerState samplerPositionDepth : register(s2);
+
+float main([[vk::location(0)]] float2 inUV : TEXCOORD0) : SV_TARGET
+{
+	float depth = texturePositionDepth.Sample(samplerPositionDepth, inUV).w;
+
+	// Joint bilateral upsampling: the four low resolution texels surrounding the fragment are weighted bilinearly and by how close their depth is to the fragment's
+	// so occlusion doesn't bleed across depth discontinuities
+	int2 lowResDim;
+	textureSSAO.GetDimensions(lowResDim.x, lowResDim.y);
+	float2 lowResPos = inUV * float2(lowResDim) - 0.5;
+	int2 base = int2(floor(lowResPos));
+	float2 f = frac(lowResPos);
+	float result = 0.0;
+	float weightSum = 0.0;
+	for (int y = 0; y < 2; y++) {
+		for (int x = 0; x < 2; x++) {
+			int2 texel = clamp(base + int2(x, y), int2(0, 0), lowResDim - 1);
+			float bilinear = ((x == 0) ? 1.0 - f.x : f.x) * ((y == 0) ? 1.0 - f.y : f.y);
+			float sampleDepth = texturePositionDepthLowRes.Load(int3(texel, 0)).w;
+			float weight = bilinear / (0.001 + abs(sampleDepth - depth) / depth);
+			result += textureSSAO.Load(int3(texel, 0)).r * weight;
+			weightSum += weight;
+		}
+	}
+
+	return result / weightSum;
+}
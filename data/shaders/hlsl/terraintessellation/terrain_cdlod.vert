@@ -0,0 +1,88 @@
+// Copyright 2020 Google LLC
+
+struct UBO
+{
+	float4x4 projection;
+	float4x4 modelview;
+	float4 lightPos;
+	float4 cameraPos;
+	float heightScale;
+	float tileSize;
+};
+cbuffer ubo : register(b0) { UBO ubo; };
+
+// Streamed tiles, one tile per layer
+Texture2DArray textureTiles : register(t1);
+SamplerState samplerTiles : register(s1);
+
+struct Instance
+{
+	// xy = world space origin, z = world space grid spacing
+	float4 node;
+	// xy = texel offset in the cached tile, z = texels per grid step, w = tile cache layer
+	float4 texel;
+	// x = morph start distance, y = morph end distance
+	float4 morph;
+};
+StructuredBuffer<Instance> instances : register(t3);
+
+struct VSInput
+{
+[[vk::location(0)]] float2 GridPos : POSITION0;
+uint InstanceIndex : SV_InstanceID;
+};
+
+struct VSOutput
+{
+	float4 Pos : SV_POSITION;
+[[vk::location(0)]] float3 Normal : NORMAL0;
+[[vk::location(1)]] float2 UV : TEXCOORD0;
+[[vk::location(2)]] float3 ViewVec : TEXCOORD1;
+[[vk::location(3)]] float3 LightVec : TEXCOORD2;
+[[vk::location(4)]] float3 EyePos : POSITION1;
+[[vk::location(5)]] float3 WorldPos : POSITION0;
+[[vk::location(6)]] float Height : TEXCOORD3;
+};
+
+float sampleHeight(Instance instance, float2 gridPos)
+{
+	// Tiles store (tileSize + 1)^2 samples, sample at texel centers
+	float2 texel = instance.texel.xy + gridPos * instance.texel.z;
+	return textureTiles.SampleLevel(samplerTiles, float3((texel + 0.5) / (ubo.tileSize + 1.0), instance.texel.w), 0.0).r;
+}
+
+VSOutput main(VSInput input)
+{
+	VSOutput output = (VSOutput)0;
+	Instance instance = instances[input.InstanceIndex];
+	float gridSpacing = instance.node.z;
+
+	// Morph factor is based on the distance of the unmorphed vertex, so it's the same for vertices shared by neighbouring nodes
+	float2 worldXZ = instance.node.xy + input.GridPos * gridSpacing;
+	float3 pos = float3(worldXZ.x, -sampleHeight(instance, input.GridPos) * ubo.heightScale, worldXZ.y);
+	float morphK = saturate((distance(pos, ubo.cameraPos.xyz) - instance.morph.x) / (instance.morph.y - instance.morph.x));
+
+	// Move odd grid vertices onto the edges of the next coarser grid
+	float2 gridPos = input.GridPos - frac(input.GridPos * 0.5) * 2.0 * morphK;
+	worldXZ = instance.node.xy + gridPos * gridSpacing;
+	float height = sampleHeight(instance, gridPos);
+	pos = float3(worldXZ.x, -height * ubo.heightScale, worldXZ.y);
+
+	// Normal from neighbouring samples, same orientation as the normals of the tessellated patch
+	float hL = sampleHeight(instance, gridPos - float2(1.0, 0.0));
+	float hR = sampleHeight(instance, gridPos + float2(1.0, 0.0));
+	float hD = sampleHeight(instance, gridPos - float2(0.0, 1.0));
+	float hU = sampleHeight(instance, gridPos + float2(0.0, 1.0));
+	output.Normal = normalize(float3(hL - hR, 2.0 * gridSpacing / ubo.heightScale, hD - hU));
+
+	// Same texture coordinates as the tessellated patch, which covers [-64, 64]
+	output.UV = worldXZ / 128.0 + 0.5;
+	output.Height = height;
+
+	output.Pos = mul(ubo.projection, mul(ubo.modelview, float4(pos, 1.0)));
+	output.ViewVec = -pos;
+	output.LightVec = normalize(ubo.lightPos.xyz + output.ViewVec);
+	output.WorldPos = pos;
+	output.EyePos = mul(ubo.modelview, float4(pos, 1.0)).xyz;
+	return output;
+}
@@ -2,8 +2,10 @@
 
 struct VSInput
 {
-[[vk::location(0)]] float2 Pos : POSITION0;
-[[vk::location(1)]] float2 UV : TEXCOORD0;
+// Per glyph instance
+[[vk::location(0)]] float4 Rect : POSITION0;
+[[vk::location(1)]] float4 UV : TEXCOORD0;
+uint VertexIndex : SV_VertexID;
 };
 
 struct VSOutput
@@ -15,7 +17,9 @@ struct VSOutput
 VSOutput main(VSInput input)
 {
 	VSOutput output = (VSOutput)0;
-	output.Pos = float4(input.Pos, 0.0, 1.0);
-	output.UV = input.UV;
+	// Generate the corners of the glyph quad (triangle strip) from the vertex index
+	float2 corner = float2(input.VertexIndex & 1, input.VertexIndex >> 1);
+	output.Pos = float4(lerp(input.Rect.xy, input.Rect.zw, corner), 0.0, 1.0);
+	output.UV = lerp(input.UV.xy, input.UV.zw, corner);
 	return output;
 }
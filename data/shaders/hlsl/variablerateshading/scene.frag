@@ -1,9 +1,32 @@
 // Copyright 2020 Sascha Willems
 
-Texture2D textureColorMap : register(t0, space1);
-SamplerState samplerColorMap : register(s0, space1);
-Texture2D textureNormalMap : register(t1, space1);
-SamplerState samplerNormalMap : register(s1, space1);
+struct Material
+{
+	float4 baseColorFactor;
+	float metallicFactor;
+	float roughnessFactor;
+	float alphaCutoff;
+	uint alphaMode;
+	int baseColorTexture;
+	int metallicRoughnessTexture;
+	int normalTexture;
+	int occlusionTexture;
+	int emissiveTexture;
+	int3 _pad;
+};
+
+StructuredBuffer<Material> materials : register(t0, space1);
+// The layout has a single combined image sampler array at binding 1
+[[vk::combinedImageSampler]][[vk::binding(1, 1)]]
+Texture2D textures[];
+[[vk::combinedImageSampler]][[vk::binding(1, 1)]]
+SamplerState samplers[];
+
+struct PushConsts
+{
+	uint materialIndex;
+};
+[[vk::push_constant]] PushConsts pushConsts;
 
 struct UBO
 {
@@ -17,7 +40,6 @@ struct UBO
 cbuffer ubo : register(b0) { UBO ubo; };
 
 [[vk::constant_id(0)]] const bool ALPHA_MASK = false;
-[[vk::constant_id(1)]] const float ALPHA_MASK_CUTOFF = 0.0;
 
 struct VSOutput
 {
@@ -31,10 +53,15 @@ struct VSOutput
 
 float4 main(VSOutput input, uint shadingRate : SV_ShadingRate) : SV_TARGET
 {
-	float4 color = textureColorMap.Sample(samplerColorMap, input.UV) * float4(input.Color, 1.0);
+	Material material = materials[pushConsts.materialIndex];
+
+	float4 color = material.baseColorFactor * float4(input.Color, 1.0);
+	if (material.baseColorTexture >= 0) {
+		color *= textures[material.baseColorTexture].Sample(samplers[material.baseColorTexture], input.UV);
+	}
 
 	if (ALPHA_MASK) {
-		if (color.a < ALPHA_MASK_CUTOFF) {
+		if (color.a < material.alphaCutoff) {
 			discard;
 		}
 	}
@@ -43,7 +70,9 @@ float4 main(VSOutput input, uint shadingRate : SV_ShadingRate) : SV_TARGET
 	float3 T = normalize(input.Tangent.xyz);
 	float3 B = cross(input.Normal, input.Tangent.xyz) * input.Tangent.w;
 	float3x3 TBN = float3x3(T, B, N);
-	N = mul(normalize(textureNormalMap.Sample(samplerNormalMap, input.UV).xyz * 2.0 - float3(1.0, 1.0, 1.0)), TBN);
+	if (material.normalTexture >= 0) {
+		N = mul(normalize(textures[material.normalTexture].Sample(samplers[material.normalTexture], input.UV).xyz * 2.0 - float3(1.0, 1.0, 1.0)), TBN);
+	}
 
 	const float ambient = 0.1;
 	float3 L = normalize(input.LightVec);
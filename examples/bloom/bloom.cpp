@@ -1,6 +1,8 @@
 /*
 * Vulkan Example - Implements a separable two-pass fullscreen blur (also known as bloom)
 *
+* Alternatively builds the bloom from a compute mip chain that is downsampled from the full resolution glow target and accumulated back up
+*
 * Copyright (C) Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
@@ -8,6 +10,7 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include <map>
 
 #define ENABLE_VALIDATION false
 
@@ -15,11 +18,19 @@
 #define FB_DIM 256
 #define FB_COLOR_FORMAT VK_FORMAT_R8G8B8A8_UNORM
 
+// Compute mip chain properties
+#define BLOOM_MAX_MIPS 8
+#define BLOOM_MIN_MIP_SIZE 8
+#define BLOOM_CHAIN_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+
 class VulkanExample : public VulkanExampleBase
 {
 public:
 	bool bloom = true;
 
+	enum BloomMode { BloomSeparable = 0, BloomMipChain = 1 };
+	int32_t bloomMode = BloomMipChain;
+
 	vks::TextureCubeMap cubemap;
 
 	struct {
@@ -43,6 +54,11 @@ public:
 	struct UBOBlurParams {
 		float blurScale = 1.0f;
 		float blurStrength = 1.5f;
+		// Mip chain only
+		float threshold = 0.2f;
+		float knee = 0.1f;
+		float intensity = 1.5f;
+		float mipCount = 1.0f;
 	};
 
 	struct {
@@ -56,11 +72,15 @@ public:
 		VkPipeline glowPass;
 		VkPipeline phongPass;
 		VkPipeline skyBox;
+		VkPipeline bloomDownsample;
+		VkPipeline bloomUpsample;
+		VkPipeline bloomComposite;
 	} pipelines;
 
 	struct {
 		VkPipelineLayout blur;
 		VkPipelineLayout scene;
+		VkPipelineLayout bloomCompute;
 	} pipelineLayouts;
 
 	struct {
@@ -68,11 +88,13 @@ public:
 		VkDescriptorSet blurHorz;
 		VkDescriptorSet scene;
 		VkDescriptorSet skyBox;
+		VkDescriptorSet bloomComposite;
 	} descriptorSets;
 
 	struct {
 		VkDescriptorSetLayout blur;
 		VkDescriptorSetLayout scene;
+		VkDescriptorSetLayout bloomCompute;
 	} descriptorSetLayouts;
 
 	// Framebuffer for offscreen rendering
@@ -90,9 +112,34 @@ public:
 		int32_t width, height;
 		VkRenderPass renderPass;
 		VkSampler sampler;
+		VkFormat depthFormat;
 		std::array<FrameBuffer, 2> framebuffers;
 	} offscreenPass;
 
+	// Full resolution glow target and the compute mip chain, both are recreated when the window is resized
+	// The first level is half the output resolution, the chain length depends on the output size
+	struct {
+		FrameBuffer glow;
+		VkExtent2D extent = {};
+		uint32_t mipCount = 0;
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory mem = VK_NULL_HANDLE;
+		std::vector<VkImageView> views;
+		// Downsample set i writes level i, upsample set i reads level i and accumulates into level i - 1
+		std::array<VkDescriptorSet, BLOOM_MAX_MIPS> downsampleSets;
+		std::array<VkDescriptorSet, BLOOM_MAX_MIPS> upsampleSets;
+	} bloomChain;
+
+	// Timestamps are written at the start of the frame, after the offscreen bloom work and around the bloom composite in the scene pass
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		double bloomTime = 0.0;
+		// Averaged bloom times of both modes for every output resolution used so far
+		std::map<std::pair<uint32_t, uint32_t>, std::array<double, 2>> results;
+	} timing;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		title = "Bloom (offscreen rendering)";
@@ -113,16 +160,9 @@ public:
 		// Frame buffer
 		for (auto& framebuffer : offscreenPass.framebuffers)
 		{
-			// Attachments
-			vkDestroyImageView(device, framebuffer.color.view, nullptr);
-			vkDestroyImage(device, framebuffer.color.image, nullptr);
-			vkFreeMemory(device, framebuffer.color.mem, nullptr);
-			vkDestroyImageView(device, framebuffer.depth.view, nullptr);
-			vkDestroyImage(device, framebuffer.depth.image, nullptr);
-			vkFreeMemory(device, framebuffer.depth.mem, nullptr);
-
-			vkDestroyFramebuffer(device, framebuffer.framebuffer, nullptr);
+			destroyOffscreenFramebuffer(framebuffer);
 		}
+		destroyBloomChain();
 		vkDestroyRenderPass(device, offscreenPass.renderPass, nullptr);
 
 		vkDestroyPipeline(device, pipelines.blurHorz, nullptr);
@@ -130,12 +170,21 @@ public:
 		vkDestroyPipeline(device, pipelines.phongPass, nullptr);
 		vkDestroyPipeline(device, pipelines.glowPass, nullptr);
 		vkDestroyPipeline(device, pipelines.skyBox, nullptr);
+		vkDestroyPipeline(device, pipelines.bloomDownsample, nullptr);
+		vkDestroyPipeline(device, pipelines.bloomUpsample, nullptr);
+		vkDestroyPipeline(device, pipelines.bloomComposite, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayouts.blur , nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.scene, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.bloomCompute, nullptr);
 
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.blur, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.scene, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.bloomCompute, nullptr);
+
+		if (timing.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timing.queryPool, nullptr);
+		}
 
 		// Uniform buffers
 		uniformBuffers.scene.destroy();
@@ -147,14 +196,14 @@ public:
 
 	// Setup the offscreen framebuffer for rendering the mirrored scene
 	// The color attachment of this framebuffer will then be sampled from
-	void prepareOffscreenFramebuffer(FrameBuffer *frameBuf, VkFormat colorFormat, VkFormat depthFormat)
+	void prepareOffscreenFramebuffer(FrameBuffer *frameBuf, VkFormat colorFormat, VkFormat depthFormat, uint32_t fbWidth, uint32_t fbHeight)
 	{
 		// Color attachment
 		VkImageCreateInfo image = vks::initializers::imageCreateInfo();
 		image.imageType = VK_IMAGE_TYPE_2D;
 		image.format = colorFormat;
-		image.extent.width = FB_DIM;
-		image.extent.height = FB_DIM;
+		image.extent.width = fbWidth;
+		image.extent.height = fbHeight;
 		image.extent.depth = 1;
 		image.mipLevels = 1;
 		image.arrayLayers = 1;
@@ -223,8 +272,8 @@ public:
 		fbufCreateInfo.renderPass = offscreenPass.renderPass;
 		fbufCreateInfo.attachmentCount = 2;
 		fbufCreateInfo.pAttachments = attachments;
-		fbufCreateInfo.width = FB_DIM;
-		fbufCreateInfo.height = FB_DIM;
+		fbufCreateInfo.width = fbWidth;
+		fbufCreateInfo.height = fbHeight;
 		fbufCreateInfo.layers = 1;
 
 		VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &frameBuf->framebuffer));
@@ -235,6 +284,19 @@ public:
 		frameBuf->descriptor.sampler = offscreenPass.sampler;
 	}
 
+	void destroyOffscreenFramebuffer(FrameBuffer& frameBuf)
+	{
+		// Attachments
+		vkDestroyImageView(device, frameBuf.color.view, nullptr);
+		vkDestroyImage(device, frameBuf.color.image, nullptr);
+		vkFreeMemory(device, frameBuf.color.mem, nullptr);
+		vkDestroyImageView(device, frameBuf.depth.view, nullptr);
+		vkDestroyImage(device, frameBuf.depth.image, nullptr);
+		vkFreeMemory(device, frameBuf.depth.mem, nullptr);
+
+		vkDestroyFramebuffer(device, frameBuf.framebuffer, nullptr);
+	}
+
 	// Prepare the offscreen framebuffers used for the vertical- and horizontal blur
 	void prepareOffscreen()
 	{
@@ -245,6 +307,7 @@ public:
 		VkFormat fbDepthFormat;
 		VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &fbDepthFormat);
 		assert(validDepthFormat);
+		offscreenPass.depthFormat = fbDepthFormat;
 
 		// Create a separate render pass for the offscreen rendering as it may differ from the one used for scene rendering
 
@@ -324,8 +387,82 @@ public:
 		VK_CHECK_RESULT(vkCreateSampler(device, &sampler, nullptr, &offscreenPass.sampler));
 
 		// Create two frame buffers
-		prepareOffscreenFramebuffer(&offscreenPass.framebuffers[0], FB_COLOR_FORMAT, fbDepthFormat);
-		prepareOffscreenFramebuffer(&offscreenPass.framebuffers[1], FB_COLOR_FORMAT, fbDepthFormat);
+		prepareOffscreenFramebuffer(&offscreenPass.framebuffers[0], FB_COLOR_FORMAT, fbDepthFormat, FB_DIM, FB_DIM);
+		prepareOffscreenFramebuffer(&offscreenPass.framebuffers[1], FB_COLOR_FORMAT, fbDepthFormat, FB_DIM, FB_DIM);
+	}
+
+	// Halve the output size until the smaller side drops below BLOOM_MIN_MIP_SIZE, so the widest blur covers about the same part of the screen at every resolution
+	uint32_t getBloomMipCount()
+	{
+		uint32_t mipCount = 0;
+		uint32_t size = std::min(width, height) / 2;
+		while (mipCount < BLOOM_MAX_MIPS && size >= BLOOM_MIN_MIP_SIZE) {
+			mipCount++;
+			size /= 2;
+		}
+		return std::max(mipCount, 1u);
+	}
+
+	VkExtent2D getBloomMipExtent(uint32_t level)
+	{
+		return { std::max((width / 2) >> level, 1u), std::max((height / 2) >> level, 1u) };
+	}
+
+	// Prepare the full resolution glow target and the mip chain used by the compute bloom
+	void prepareBloomChain()
+	{
+		// The glow target uses the same render pass as the fixed size offscreen framebuffers
+		prepareOffscreenFramebuffer(&bloomChain.glow, FB_COLOR_FORMAT, offscreenPass.depthFormat, width, height);
+		bloomChain.extent = { width, height };
+
+		bloomChain.mipCount = getBloomMipCount();
+		VkExtent2D extent = getBloomMipExtent(0);
+
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = BLOOM_CHAIN_FORMAT;
+		imageCI.extent = { extent.width, extent.height, 1 };
+		imageCI.mipLevels = bloomChain.mipCount;
+		imageCI.arrayLayers = 1;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &bloomChain.image));
+
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, bloomChain.image, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &bloomChain.mem));
+		VK_CHECK_RESULT(vkBindImageMemory(device, bloomChain.image, bloomChain.mem, 0));
+
+		// One view per level, as every level is written as a storage image and sampled by the next step
+		bloomChain.views.resize(bloomChain.mipCount);
+		for (uint32_t i = 0; i < bloomChain.mipCount; i++) {
+			VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+			viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewCI.format = BLOOM_CHAIN_FORMAT;
+			viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+			viewCI.image = bloomChain.image;
+			VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &bloomChain.views[i]));
+		}
+
+		// The chain stays in the general layout, so levels can be both written and sampled without layout transitions
+		VkCommandBuffer layoutCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		vks::tools::setImageLayout(layoutCmd, bloomChain.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, { VK_IMAGE_ASPECT_COLOR_BIT, 0, bloomChain.mipCount, 0, 1 });
+		vulkanDevice->flushCommandBuffer(layoutCmd, queue, true);
+	}
+
+	void destroyBloomChain()
+	{
+		destroyOffscreenFramebuffer(bloomChain.glow);
+		for (auto& view : bloomChain.views) {
+			vkDestroyImageView(device, view, nullptr);
+		}
+		bloomChain.views.clear();
+		vkDestroyImage(device, bloomChain.image, nullptr);
+		vkFreeMemory(device, bloomChain.mem, nullptr);
 	}
 
 	void buildCommandBuffers()
@@ -345,7 +482,12 @@ public:
 		{
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
-			if (bloom) {
+			if (timing.available) {
+				vkCmdResetQueryPool(drawCmdBuffers[i], timing.queryPool, 0, 4);
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timing.queryPool, 0);
+			}
+
+			if (bloom && bloomMode == BloomSeparable) {
 				clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
 				clearValues[1].depthStencil = { 1.0f, 0 };
 
@@ -394,6 +536,14 @@ public:
 				vkCmdEndRenderPass(drawCmdBuffers[i]);
 			}
 
+			if (bloom && bloomMode == BloomMipChain) {
+				buildBloomChainCommands(drawCmdBuffers[i]);
+			}
+
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 1);
+			}
+
 			/*
 				Note: Explicit synchronization is not required between the render pass, as this is done implicit via sub pass dependencies
 			*/
@@ -434,13 +584,28 @@ public:
 				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.phongPass);
 				models.ufo.draw(drawCmdBuffers[i]);
 
-				if (bloom)
+				if (timing.available) {
+					vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 2);
+				}
+
+				if (bloom && bloomMode == BloomSeparable)
 				{
 					vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.blur, 0, 1, &descriptorSets.blurHorz, 0, NULL);
 					vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.blurHorz);
 					vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
 				}
 
+				if (bloom && bloomMode == BloomMipChain)
+				{
+					vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.blur, 0, 1, &descriptorSets.bloomComposite, 0, NULL);
+					vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.bloomComposite);
+					vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
+				}
+
+				if (timing.available) {
+					vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 3);
+				}
+
 				drawUI(drawCmdBuffers[i]);
 
 				vkCmdEndRenderPass(drawCmdBuffers[i]);
@@ -451,6 +616,67 @@ public:
 		}
 	}
 
+	/*
+		Mip chain bloom: Render the glow parts at full resolution, then build the chain with compute
+		Each downsample step filters the previous level into the next smaller one (the first step also applies the threshold)
+		The upsample steps then walk back up the chain and add a tent filtered copy of each level to the next larger one
+	*/
+	void buildBloomChainCommands(VkCommandBuffer commandBuffer)
+	{
+		VkClearValue clearValues[2];
+		clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		clearValues[1].depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+		renderPassBeginInfo.renderPass = offscreenPass.renderPass;
+		renderPassBeginInfo.framebuffer = bloomChain.glow.framebuffer;
+		renderPassBeginInfo.renderArea.extent = bloomChain.extent;
+		renderPassBeginInfo.clearValueCount = 2;
+		renderPassBeginInfo.pClearValues = clearValues;
+
+		VkViewport viewport = vks::initializers::viewport((float)bloomChain.extent.width, (float)bloomChain.extent.height, 0.0f, 1.0f);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		VkRect2D scissor = vks::initializers::rect2D(bloomChain.extent.width, bloomChain.extent.height, 0, 0);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.scene, 0, 1, &descriptorSets.scene, 0, NULL);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.glowPass);
+		models.ufoGlow.draw(commandBuffer);
+		vkCmdEndRenderPass(commandBuffer);
+
+		// The render pass dependency only covers fragment shader reads, the glow target is read by compute
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		// Every step depends on the level written by the previous one
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.bloomDownsample);
+		for (uint32_t level = 0; level < bloomChain.mipCount; level++) {
+			uint32_t prefilter = (level == 0) ? 1 : 0;
+			VkExtent2D extent = getBloomMipExtent(level);
+			vkCmdPushConstants(commandBuffer, pipelineLayouts.bloomCompute, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &prefilter);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.bloomCompute, 0, 1, &bloomChain.downsampleSets[level], 0, nullptr);
+			vkCmdDispatch(commandBuffer, (extent.width + 7) / 8, (extent.height + 7) / 8, 1);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.bloomUpsample);
+		for (uint32_t level = bloomChain.mipCount - 1; level > 0; level--) {
+			VkExtent2D extent = getBloomMipExtent(level - 1);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.bloomCompute, 0, 1, &bloomChain.upsampleSets[level], 0, nullptr);
+			vkCmdDispatch(commandBuffer, (extent.width + 7) / 8, (extent.height + 7) / 8, 1);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		// The first level is sampled by the composite in the scene render pass
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
 	void loadAssets()
 	{
 		const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::PreMultiplyVertexColors | vkglTF::FileLoadingFlags::FlipY;
@@ -463,10 +689,11 @@ public:
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 9 + BLOOM_MAX_MIPS * 2),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 7 + BLOOM_MAX_MIPS * 2),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, BLOOM_MAX_MIPS * 2)
 		};
-		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 5);
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 6 + BLOOM_MAX_MIPS * 2);
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
 
@@ -497,6 +724,21 @@ public:
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayouts.scene));
 		pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.scene, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.scene));
+
+		// Mip chain downsample and upsample
+		setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),			// Binding 0 : Compute shader uniform buffer
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1),	// Binding 1 : Source level
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 2),			// Binding 2 : Destination level
+		};
+		descriptorSetLayoutCreateInfo = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayouts.bloomCompute));
+		// Push constant selects the thresholding for the first downsample step
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(uint32_t), 0);
+		pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.bloomCompute, 1);
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.bloomCompute));
 	}
 
 	void setupDescriptorSet()
@@ -537,6 +779,46 @@ public:
 			vks::initializers::writeDescriptorSet(descriptorSets.skyBox, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,	1, &cubemap.descriptor),							// Binding 1: Fragment shader texture sampler
 		};
 		vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
+
+		// Mip chain sets are allocated for the maximum chain length and written in updateBloomDescriptorSets
+		descriptorSetAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayouts.blur, 1);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, &descriptorSets.bloomComposite));
+		std::array<VkDescriptorSetLayout, BLOOM_MAX_MIPS> computeLayouts;
+		computeLayouts.fill(descriptorSetLayouts.bloomCompute);
+		descriptorSetAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, computeLayouts.data(), BLOOM_MAX_MIPS);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, bloomChain.downsampleSets.data()));
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorSetAllocInfo, bloomChain.upsampleSets.data()));
+		updateBloomDescriptorSets();
+	}
+
+	// The mip chain views change with the window size
+	void updateBloomDescriptorSets()
+	{
+		std::vector<VkDescriptorImageInfo> levelDescriptors(bloomChain.mipCount);
+		for (uint32_t i = 0; i < bloomChain.mipCount; i++) {
+			levelDescriptors[i] = vks::initializers::descriptorImageInfo(offscreenPass.sampler, bloomChain.views[i], VK_IMAGE_LAYOUT_GENERAL);
+		}
+
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+		for (uint32_t i = 0; i < bloomChain.mipCount; i++) {
+			// Downsample into level i from the previous level, or from the glow target for the first level
+			VkDescriptorImageInfo* source = (i == 0) ? &bloomChain.glow.descriptor : &levelDescriptors[i - 1];
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(bloomChain.downsampleSets[i], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.blurParams.descriptor));
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(bloomChain.downsampleSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, source));
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(bloomChain.downsampleSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2, &levelDescriptors[i]));
+			// Upsample level i into level i - 1
+			if (i > 0) {
+				writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(bloomChain.upsampleSets[i], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.blurParams.descriptor));
+				writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(bloomChain.upsampleSets[i], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &levelDescriptors[i]));
+				writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(bloomChain.upsampleSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2, &levelDescriptors[i - 1]));
+			}
+		}
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.bloomComposite, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.blurParams.descriptor));
+		writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.bloomComposite, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &levelDescriptors[0]));
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		ubos.blurParams.mipCount = (float)bloomChain.mipCount;
+		updateUniformBuffersBlur();
 	}
 
 	void preparePipelines()
@@ -592,6 +874,9 @@ public:
 		blurdirection = 1;
 		pipelineCI.renderPass = renderPass;
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.blurHorz));
+		// Mip chain composite, drawn on top of the scene like the horizontal blur
+		shaderStages[1] = loadShader(getShadersPath() + "bloom/composite.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.bloomComposite));
 
 		// Phong pass (3D model)
 		pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({vkglTF::VertexComponent::Position, vkglTF::VertexComponent::UV, vkglTF::VertexComponent::Color, vkglTF::VertexComponent::Normal});
@@ -617,6 +902,13 @@ public:
 		rasterizationStateCI.cullMode = VK_CULL_MODE_FRONT_BIT;
 		pipelineCI.renderPass = renderPass;
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.skyBox));
+
+		// Mip chain downsample and upsample
+		VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(pipelineLayouts.bloomCompute, 0);
+		computePipelineCI.stage = loadShader(getShadersPath() + "bloom/downsample.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &pipelines.bloomDownsample));
+		computePipelineCI.stage = loadShader(getShadersPath() + "bloom/upsample.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &pipelines.bloomUpsample));
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -687,14 +979,43 @@ public:
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 		VulkanExampleBase::submitFrame();
+		// The queue is idle after submitting the frame, so the timestamps of this frame are available
+		getTimings();
+	}
+
+	void getTimings()
+	{
+		if (!timing.available) {
+			return;
+		}
+		uint64_t timestamps[4];
+		if (vkGetQueryPoolResults(device, timing.queryPool, 0, 4, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+			return;
+		}
+		// Offscreen work before the scene render pass plus the fullscreen draw on top of the scene
+		timing.bloomTime = (double)((timestamps[1] - timestamps[0]) + (timestamps[3] - timestamps[2])) * timing.timestampPeriod / 1000000.0;
+		if (bloom) {
+			double& average = timing.results[std::make_pair(width, height)][bloomMode];
+			average = (average == 0.0) ? timing.bloomTime : average * 0.95 + timing.bloomTime * 0.05;
+		}
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 4;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timing.queryPool));
+			timing.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			timing.available = true;
+		}
 		prepareUniformBuffers();
 		prepareOffscreen();
+		prepareBloomChain();
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
@@ -714,15 +1035,53 @@ public:
 		}
 	}
 
+	// The glow target and the mip chain length depend on the window size
+	// The chain is recreated along with the swap chain framebuffers, as the base class records the command buffers right after this on resize
+	virtual void setupFrameBuffer()
+	{
+		VulkanExampleBase::setupFrameBuffer();
+		// Not created yet when this is called from the base class' prepare()
+		if (bloomChain.image != VK_NULL_HANDLE) {
+			destroyBloomChain();
+			prepareBloomChain();
+			updateBloomDescriptorSets();
+		}
+	}
+
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
 		if (overlay->header("Settings")) {
 			if (overlay->checkBox("Bloom", &bloom)) {
 				buildCommandBuffers();
 			}
+			if (overlay->comboBox("Mode", &bloomMode, { "Separable blur (256x256)", "Mip chain (compute)" })) {
+				buildCommandBuffers();
+			}
 			if (overlay->inputFloat("Scale", &ubos.blurParams.blurScale, 0.1f, 2)) {
 				updateUniformBuffersBlur();
 			}
+			if (bloomMode == BloomMipChain) {
+				if (overlay->sliderFloat("Threshold", &ubos.blurParams.threshold, 0.0f, 1.0f)) {
+					updateUniformBuffersBlur();
+				}
+				if (overlay->sliderFloat("Knee", &ubos.blurParams.knee, 0.0f, 0.5f)) {
+					updateUniformBuffersBlur();
+				}
+				if (overlay->sliderFloat("Intensity", &ubos.blurParams.intensity, 0.0f, 4.0f)) {
+					updateUniformBuffersBlur();
+				}
+			}
+		}
+		if (timing.available && overlay->header("GPU timings")) {
+			overlay->text("Resolution: %dx%d", width, height);
+			if (bloomMode == BloomMipChain) {
+				overlay->text("Mip levels: %d", bloomChain.mipCount);
+			}
+			overlay->text("Bloom: %.3f ms", timing.bloomTime);
+			// Resize the window to compare both modes at other resolutions
+			for (auto& result : timing.results) {
+				overlay->text("%dx%d: separable %.3f ms, mip chain %.3f ms", result.first.first, result.first.second, result.second[BloomSeparable], result.second[BloomMipChain]);
+			}
 		}
 	}
 };
@@ -8,6 +8,7 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "VulkanAsyncCompute.h"
 
 #define ENABLE_VALIDATION false
 
@@ -15,10 +16,8 @@ class VulkanExample : public VulkanExampleBase
 {
 public:
 	uint32_t sceneSetup = 0;
-	uint32_t readSet = 0;
 	uint32_t indexCount;
 	bool simulateWind = false;
-	bool specializedComputeQueue = false;
 
 	vks::Texture2D textureCloth;
 	vkglTF::Model modelSphere;
@@ -43,20 +42,18 @@ public:
 
 	// Resources for the compute part of the example
 	struct {
-		struct StorageBuffers {
-			vks::Buffer input;
-			vks::Buffer output;
-		} storageBuffers;
-		struct Semaphores {
-			VkSemaphore ready{ 0L };
-			VkSemaphore complete{ 0L };
-		} semaphores;
+		// Results of every other iteration of a step, only accessed by the compute queue
+		// The other iterations write to the frame buffers of the async compute helper, which graphics draws from
+		vks::Buffer scratchBuffer;
 		vks::Buffer uniformBuffer;
-		VkQueue queue;
-		VkCommandPool commandPool;
-		std::array<VkCommandBuffer,2> commandBuffers;
 		VkDescriptorSetLayout descriptorSetLayout;
-		std::array<VkDescriptorSet,2> descriptorSets;
+		// The iterations of a step ping-pong between the scratch buffer and the frame buffer, starting with the frame buffer of the previous step
+		struct DescriptorSets {
+			VkDescriptorSet previousToScratch;
+			VkDescriptorSet scratchToFrame;
+			VkDescriptorSet frameToScratch;
+		};
+		std::array<DescriptorSets, vks::AsyncCompute::frameCount> descriptorSets;
 		VkPipelineLayout pipelineLayout;
 		VkPipeline pipeline;
 		struct computeUBO {
@@ -74,6 +71,9 @@ public:
 		} ubo;
 	} compute;
 
+	// Runs the simulation step for the next frame on the compute queue while the current frame is drawn
+	vks::AsyncCompute asyncCompute;
+
 	// SSBO cloth grid particle declaration
 	struct Particle {
 		glm::vec4 pos;
@@ -89,17 +89,25 @@ public:
 		glm::vec2 size = glm::vec2(5.0f);
 	} cloth;
 
-	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
+	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION, [](CommandLineParser& commandLineParser) {
+		commandLineParser.add("serialcompute", { "-sc", "--serialcompute" }, 0, "Serialize compute and graphics instead of overlapping them");
+	})
 	{
 		title = "Compute shader cloth simulation";
 		camera.type = Camera::CameraType::lookat;
 		camera.setPerspective(60.0f, (float)width / (float)height, 0.1f, 512.0f);
 		camera.setRotation(glm::vec3(-30.0f, -45.0f, 0.0f));
 		camera.setTranslation(glm::vec3(0.0f, 0.0f, -5.0f));
+		asyncCompute.async = !commandLineParser.isSet("serialcompute");
 	}
 
 	~VulkanExample()
 	{
+		if (benchmark.active) {
+			asyncCompute.printStatistics();
+		}
+		asyncCompute.destroy();
+
 		// Graphics
 		graphics.indices.destroy();
 		graphics.uniformBuffer.destroy();
@@ -110,15 +118,11 @@ public:
 		textureCloth.destroy();
 
 		// Compute
-		compute.storageBuffers.input.destroy();
-		compute.storageBuffers.output.destroy();
+		compute.scratchBuffer.destroy();
 		compute.uniformBuffer.destroy();
 		vkDestroyPipelineLayout(device, compute.pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
 		vkDestroyPipeline(device, compute.pipeline, nullptr);
-		vkDestroySemaphore(device, compute.semaphores.ready, nullptr);
-		vkDestroySemaphore(device, compute.semaphores.complete, nullptr);
-		vkDestroyCommandPool(device, compute.commandPool, nullptr);
 	}
 
 	// Enable physical device features required for this example
@@ -136,32 +140,7 @@ public:
 		textureCloth.loadFromFile(getAssetPath() + "textures/vulkan_cloth_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
 	}
 
-	void addGraphicsToComputeBarriers(VkCommandBuffer commandBuffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
-	{
-		if (specializedComputeQueue) {
-			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
-			bufferBarrier.srcAccessMask = srcAccessMask;
-			bufferBarrier.dstAccessMask = dstAccessMask;
-			bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
-			bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
-			bufferBarrier.size = VK_WHOLE_SIZE;
-
-			std::vector<VkBufferMemoryBarrier> bufferBarriers;
-			bufferBarrier.buffer = compute.storageBuffers.input.buffer;
-			bufferBarriers.push_back(bufferBarrier);
-			bufferBarrier.buffer = compute.storageBuffers.output.buffer;
-			bufferBarriers.push_back(bufferBarrier);
-			vkCmdPipelineBarrier(commandBuffer,
-				srcStageMask,
-				dstStageMask,
-				VK_FLAGS_NONE,
-				0, nullptr,
-				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
-				0, nullptr);
-		}
-	}
-
-	void addComputeToComputeBarriers(VkCommandBuffer commandBuffer)
+	void addComputeToComputeBarriers(VkCommandBuffer commandBuffer, uint32_t frame)
 	{
 		VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
 		bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
@@ -170,9 +149,9 @@ public:
 		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 		bufferBarrier.size = VK_WHOLE_SIZE;
 		std::vector<VkBufferMemoryBarrier> bufferBarriers;
-		bufferBarrier.buffer = compute.storageBuffers.input.buffer;
+		bufferBarrier.buffer = compute.scratchBuffer.buffer;
 		bufferBarriers.push_back(bufferBarrier);
-		bufferBarrier.buffer = compute.storageBuffers.output.buffer;
+		bufferBarrier.buffer = asyncCompute.frames[frame].buffer.buffer;
 		bufferBarriers.push_back(bufferBarrier);
 		vkCmdPipelineBarrier(
 			commandBuffer,
@@ -184,32 +163,16 @@ public:
 			0, nullptr);
 	}
 
-	void addComputeToGraphicsBarriers(VkCommandBuffer commandBuffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask)
+	void buildCommandBuffers()
 	{
-		if (specializedComputeQueue) {
-			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
-			bufferBarrier.srcAccessMask = srcAccessMask;
-			bufferBarrier.dstAccessMask = dstAccessMask;
-			bufferBarrier.srcQueueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
-			bufferBarrier.dstQueueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
-			bufferBarrier.size = VK_WHOLE_SIZE;
-			std::vector<VkBufferMemoryBarrier> bufferBarriers;
-			bufferBarrier.buffer = compute.storageBuffers.input.buffer;
-			bufferBarriers.push_back(bufferBarrier);
-			bufferBarrier.buffer = compute.storageBuffers.output.buffer;
-			bufferBarriers.push_back(bufferBarrier);
-			vkCmdPipelineBarrier(
-				commandBuffer,
-				srcStageMask,
-				dstStageMask,
-				VK_FLAGS_NONE,
-				0, nullptr,
-				static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
-				0, nullptr);
+		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
+		{
+			buildCommandBuffer(i);
 		}
 	}
 
-	void buildCommandBuffers()
+	// The frame buffer drawn changes every frame, so the command buffer for the current swap chain image is recorded right before submission
+	void buildCommandBuffer(uint32_t index)
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
@@ -225,96 +188,85 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = height;
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
+		renderPassBeginInfo.framebuffer = frameBuffers[index];
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-		{
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+		VkCommandBuffer commandBuffer = drawCmdBuffers[index];
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-			// Acquire storage buffers from compute queue
-			addComputeToGraphicsBarriers(drawCmdBuffers[i], 0, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+		// Acquire the cloth vertices written by compute (if queue families differ)
+		asyncCompute.cmdBeginGraphics(commandBuffer);
 
-			// Draw the particle system using the update vertex buffer
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+		VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-			VkDeviceSize offsets[1] = { 0 };
-
-			// Render sphere
-			if (sceneSetup == 0) {
-				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelines.sphere);
-				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
-				modelSphere.draw(drawCmdBuffers[i]);
-			}
+		VkDeviceSize offsets[1] = { 0 };
 
-			// Render cloth
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelines.cloth);
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], graphics.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], 0, 1, &compute.storageBuffers.output.buffer, offsets);
-			vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
+		// Render sphere
+		if (sceneSetup == 0) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelines.sphere);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+			modelSphere.draw(commandBuffer);
+		}
 
-			drawUI(drawCmdBuffers[i]);
+		// Render cloth
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelines.cloth);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+		vkCmdBindIndexBuffer(commandBuffer, graphics.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &asyncCompute.frames[asyncCompute.graphicsFrame].buffer.buffer, offsets);
+		vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+		drawUI(commandBuffer);
 
-			// release the storage buffers to the compute queue
-			addGraphicsToComputeBarriers(drawCmdBuffers[i], VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, 0, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+		vkCmdEndRenderPass(commandBuffer);
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-		}
+		asyncCompute.cmdEndGraphics(commandBuffer);
 
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
 	}
 
-	// todo: check barriers (validation, separate compute queue)
-	void buildComputeCommandBuffer()
+	// One command buffer per frame buffer, each step writes the cloth to its frame buffer
+	void buildComputeCommandBuffers()
 	{
-		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
-		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-
-		for (uint32_t i = 0; i < 2; i++) {
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffers[i], &cmdBufInfo));
-
-			// Acquire the storage buffers from the graphics queue
-			addGraphicsToComputeBarriers(compute.commandBuffers[i], 0, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		for (uint32_t i = 0; i < vks::AsyncCompute::frameCount; i++) {
+			VkCommandBuffer commandBuffer = asyncCompute.frames[i].commandBuffer;
+			asyncCompute.beginCommandBuffer(i);
 
-			vkCmdBindPipeline(compute.commandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
 
 			uint32_t calculateNormals = 0;
-			vkCmdPushConstants(compute.commandBuffers[i], compute.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &calculateNormals);
+			vkCmdPushConstants(commandBuffer, compute.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &calculateNormals);
 
 			// Dispatch the compute job
 			const uint32_t iterations = 64;
 			for (uint32_t j = 0; j < iterations; j++) {
-				readSet = 1 - readSet;
-				vkCmdBindDescriptorSets(compute.commandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSets[readSet], 0, 0);
+				VkDescriptorSet descriptorSet = compute.descriptorSets[i].previousToScratch;
+				if (j > 0) {
+					descriptorSet = (j % 2 == 1) ? compute.descriptorSets[i].scratchToFrame : compute.descriptorSets[i].frameToScratch;
+				}
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &descriptorSet, 0, 0);
 
 				if (j == iterations - 1) {
 					calculateNormals = 1;
-					vkCmdPushConstants(compute.commandBuffers[i], compute.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &calculateNormals);
+					vkCmdPushConstants(commandBuffer, compute.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &calculateNormals);
 				}
 
-				vkCmdDispatch(compute.commandBuffers[i], cloth.gridsize.x / 10, cloth.gridsize.y / 10, 1);
+				vkCmdDispatch(commandBuffer, cloth.gridsize.x / 10, cloth.gridsize.y / 10, 1);
 
-				// Don't add a barrier on the last iteration of the loop, since we'll have an explicit release to the graphics queue
+				// Don't add a barrier on the last iteration of the loop, the next step is synchronized by the async compute helper
 				if (j != iterations - 1) {
-					addComputeToComputeBarriers(compute.commandBuffers[i]);
+					addComputeToComputeBarriers(commandBuffer, i);
 				}
 
 			}
 
-			// release the storage buffers back to the graphics queue
-			addComputeToGraphicsBarriers(compute.commandBuffers[i], VK_ACCESS_SHADER_WRITE_BIT, 0, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-			vkEndCommandBuffer(compute.commandBuffers[i]);
+			// With an even number of iterations the results always end up in the frame buffer
+			// Release the cloth read by the first iteration to the graphics queue
+			asyncCompute.endCommandBuffer(i);
 		}
 	}
 
@@ -376,27 +328,21 @@ public:
 			particleBuffer.data());
 
 		vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			&compute.storageBuffers.input,
+			&compute.scratchBuffer,
 			storageBufferSize);
 
-		vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			&compute.storageBuffers.output,
-			storageBufferSize);
+		// Storage buffers for the cloth of each frame, also used as vertex buffers in the graphics pipeline
+		asyncCompute.create(vulkanDevice, queue, storageBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
 
-		// Copy from staging buffer
-		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		// Copy from staging buffer to the buffer read by the first simulation step
+		// This is done on the compute queue, so the initial cloth doesn't need to change queue family ownership
+		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, asyncCompute.commandPool, true);
 		VkBufferCopy copyRegion = {};
 		copyRegion.size = storageBufferSize;
-		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffers.output.buffer, 1, &copyRegion);
-		// Add an initial release barrier to the graphics queue,
-		// so that when the compute command buffer executes for the first time
-		// it doesn't complain about a lack of a corresponding "release" to its "acquire"
-		addGraphicsToComputeBarriers(copyCmd, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, 0, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, asyncCompute.stateBuffer().buffer, 1, &copyRegion);
+		vulkanDevice->flushCommandBuffer(copyCmd, asyncCompute.queue, asyncCompute.commandPool);
 
 		stagingBuffer.destroy();
 
@@ -439,13 +385,14 @@ public:
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 + 3 * vks::AsyncCompute::frameCount),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * 3 * vks::AsyncCompute::frameCount),
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2)
 		};
 
+		// One graphics set and three compute sets per frame buffer
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
-			vks::initializers::descriptorPoolCreateInfo(poolSizes, 3);
+			vks::initializers::descriptorPoolCreateInfo(poolSizes, 1 + 3 * vks::AsyncCompute::frameCount);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -562,9 +509,6 @@ public:
 
 	void prepareCompute()
 	{
-		// Create a compute capable device queue
-		vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.compute, 0, &compute.queue);
-
 		// Create compute pipeline
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
@@ -591,47 +535,41 @@ public:
 		VkDescriptorSetAllocateInfo allocInfo =
 			vks::initializers::descriptorSetAllocateInfo(descriptorPool, &compute.descriptorSetLayout, 1);
 
-		// Create two descriptor sets with input and output buffers switched
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSets[0]));
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSets[1]));
-
-		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = {
-			vks::initializers::writeDescriptorSet(compute.descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &compute.storageBuffers.input.descriptor),
-			vks::initializers::writeDescriptorSet(compute.descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.storageBuffers.output.descriptor),
-			vks::initializers::writeDescriptorSet(compute.descriptorSets[0], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &compute.uniformBuffer.descriptor),
-
-			vks::initializers::writeDescriptorSet(compute.descriptorSets[1], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &compute.storageBuffers.output.descriptor),
-			vks::initializers::writeDescriptorSet(compute.descriptorSets[1], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.storageBuffers.input.descriptor),
-			vks::initializers::writeDescriptorSet(compute.descriptorSets[1], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &compute.uniformBuffer.descriptor)
-		};
-
-		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+		// Create descriptor sets with input and output buffers for each iteration type of each frame
+		for (uint32_t i = 0; i < vks::AsyncCompute::frameCount; i++) {
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSets[i].previousToScratch));
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSets[i].scratchToFrame));
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSets[i].frameToScratch));
+
+			vks::Buffer& previous = asyncCompute.frames[vks::AsyncCompute::previousFrame(i)].buffer;
+			vks::Buffer& frame = asyncCompute.frames[i].buffer;
+			std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets = {
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].previousToScratch, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &previous.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].previousToScratch, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.scratchBuffer.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].previousToScratch, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &compute.uniformBuffer.descriptor),
+
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].scratchToFrame, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &compute.scratchBuffer.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].scratchToFrame, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &frame.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].scratchToFrame, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &compute.uniformBuffer.descriptor),
+
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].frameToScratch, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &frame.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].frameToScratch, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.scratchBuffer.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[i].frameToScratch, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &compute.uniformBuffer.descriptor)
+			};
+
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+		}
 
 		// Create pipeline
 		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
 		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computecloth/cloth.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
 
-		// Separate command pool as queue family for compute may be different than graphics
-		VkCommandPoolCreateInfo cmdPoolInfo = {};
-		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmdPoolInfo.queueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
+		// Build the command buffers containing the compute dispatch commands for each frame buffer
+		buildComputeCommandBuffers();
 
-		// Create a command buffer for compute operations
-		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-			vks::initializers::commandBufferAllocateInfo(compute.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 2);
-
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &compute.commandBuffers[0]));
-
-		// Semaphores for graphics / compute synchronization
-		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &compute.semaphores.ready));
-		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &compute.semaphores.complete));
-
-		// Build a single command buffer containing the compute dispatch commands
-		buildComputeCommandBuffer();
+		// Start the frame sequence (submits the first simulation step when running async)
+		asyncCompute.reset();
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -701,45 +639,19 @@ public:
 
 	void draw()
 	{
-		static bool firstDraw = true;
-		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
-		// FIXME find a better way to do this (without using fences, which is much slower)
-		VkPipelineStageFlags computeWaitDstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-		if (!firstDraw) {
-			computeSubmitInfo.waitSemaphoreCount = 1;
-			computeSubmitInfo.pWaitSemaphores = &compute.semaphores.ready;
-			computeSubmitInfo.pWaitDstStageMask = &computeWaitDstStageMask;
-		} else {
-			firstDraw = false;
-		}
-		computeSubmitInfo.signalSemaphoreCount = 1;
-		computeSubmitInfo.pSignalSemaphores = &compute.semaphores.complete;
-		computeSubmitInfo.commandBufferCount = 1;
-		computeSubmitInfo.pCommandBuffers = &compute.commandBuffers[readSet];
-
-		VK_CHECK_RESULT( vkQueueSubmit( compute.queue, 1, &computeSubmitInfo, VK_NULL_HANDLE) );
-
-		// Submit graphics commands
 		VulkanExampleBase::prepareFrame();
 
-		VkPipelineStageFlags waitDstStageMask[2] = {
-			submitPipelineStages, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
-		};
-		VkSemaphore waitSemaphores[2] = {
-			semaphores.presentComplete, compute.semaphores.complete
-		};
-		VkSemaphore signalSemaphores[2] = {
-			semaphores.renderComplete, compute.semaphores.ready
-		};
+		// Wait for the previous simulation step before updating its parameters and submit the next one
+		asyncCompute.beginFrame();
+		updateComputeUBO();
+		asyncCompute.submitCompute();
 
-		submitInfo.waitSemaphoreCount = 2;
-		submitInfo.pWaitDstStageMask = waitDstStageMask;
-		submitInfo.pWaitSemaphores = waitSemaphores;
-		submitInfo.signalSemaphoreCount = 2;
-		submitInfo.pSignalSemaphores = signalSemaphores;
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		// Draw the cloth from the frame buffer selected by the async compute helper
+		buildCommandBuffer(currentBuffer);
+		VkSubmitInfo graphicsSubmitInfo = submitInfo;
+		graphicsSubmitInfo.commandBufferCount = 1;
+		graphicsSubmitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+		asyncCompute.submitGraphics(graphicsSubmitInfo);
 
 		VulkanExampleBase::submitFrame();
 	}
@@ -751,8 +663,6 @@ public:
 #ifdef DEBUG_FORCE_SHARED_GRAPHICS_COMPUTE_QUEUE
 		vulkanDevice->queueFamilyIndices.compute = vulkanDevice->queueFamilyIndices.graphics;
 #endif
-		// Check whether the compute queue family is distinct from the graphics queue family
-		specializedComputeQueue = vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute;
 		loadAssets();
 		prepareStorageBuffers();
 		prepareUniformBuffers();
@@ -769,8 +679,6 @@ public:
 		if (!prepared)
 			return;
 		draw();
-
-		updateComputeUBO();
 	}
 
 	virtual void viewChanged()
@@ -783,6 +691,7 @@ public:
 		if (overlay->header("Settings")) {
 			overlay->checkBox("Simulate wind", &simulateWind);
 		}
+		asyncCompute.updateUIOverlay(overlay);
 	}
 };
 
@@ -5,6 +5,9 @@
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 *
+* Occlusion culling uses two phases and a hierarchical depth (Hi-Z) pyramid:
+* Phase one (on the compute queue) tests instances against the pyramid of the previous frame, the survivors are drawn
+* The pyramid is then rebuilt from the depth of that draw, and phase two re-tests only the instances occluded in phase one, drawing those that became visible
 */
 
 #include "vulkanexamplebase.h"
@@ -28,6 +31,7 @@ class VulkanExample : public VulkanExampleBase
 {
 public:
 	bool fixedFrustum = false;
+	bool occlusionCulling = true;
 
 	// The model contains multiple versions of a single object with different levels of detail
 	vkglTF::Model lodModel;
@@ -43,12 +47,19 @@ public:
 	// Contains the indirect drawing commands
 	vks::Buffer indirectCommandsBuffer;
 	vks::Buffer indirectDrawCountBuffer;
+	// Contains the indirect drawing commands for instances that became visible in the second culling phase
+	vks::Buffer lateIndirectCommandsBuffer;
+	vks::Buffer lateIndirectDrawCountBuffer;
 
 	// Indirect draw statistics (updated via compute)
-	struct {
+	struct IndirectStats {
 		uint32_t drawCount;						// Total number of indirect draw counts to be issued
+		uint32_t occludedCount;					// Number of instances inside the frustum that were occlusion culled
 		uint32_t lodCount[MAX_LOD_LEVEL + 1];	// Statistics for number of draws per LOD level (written by compute shader)
-	} indirectStats;
+	};
+	// First phase (tested against the previous frame's depth) and second phase (re-tests the first phase's occluded instances)
+	IndirectStats indirectStats;
+	IndirectStats lateIndirectStats;
 
 	// Store the indirect draw commands containing index offsets and instance count per object
 	std::vector<VkDrawIndexedIndirectCommand> indirectCommands;
@@ -58,7 +69,11 @@ public:
 		glm::mat4 modelview;
 		glm::vec4 cameraPos;
 		glm::vec4 frustumPlanes[6];
+		glm::mat4 prevViewProjection;
+		uint32_t occlusionCulling;
 	} uboScene;
+	// View projection of the last submitted frame, i.e. the one the Hi-Z pyramid is built with
+	glm::mat4 renderedViewProjection = glm::mat4(1.0f);
 
 	struct {
 		vks::Buffer scene;
@@ -84,8 +99,32 @@ public:
 		VkDescriptorSet descriptorSet;				// Compute shader bindings
 		VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
 		VkPipeline pipeline;						// Compute pipeline for updating particle positions
+		VkDescriptorSet lateDescriptorSet;			// Bindings for the second culling phase (recorded into the graphics command buffers)
+		VkPipeline latePipeline;					// Compute pipeline for the second culling phase
 	} compute;
 
+	// Hierarchical depth pyramid used for occlusion culling
+	// Level 0 is a copy of the scene's depth buffer, each following level contains the max. depth of the texels it covers
+	struct {
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;			// All levels, sampled by the culling shader
+		std::vector<VkImageView> levelViews;		// Single level views, written (storage) and read (sampled) by the downsample shader
+		VkImageView depthView = VK_NULL_HANDLE;		// Depth only view of the depth attachment, used as the input for level 0
+		VkSampler sampler = VK_NULL_HANDLE;
+		uint32_t levelCount = 0;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+		VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+		std::vector<VkDescriptorSet> descriptorSets;	// One per level
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+	} hiz;
+
+	// Render pass continuing the frame after the Hi-Z pyramid has been built (loads color and depth)
+	VkRenderPass lateRenderPass = VK_NULL_HANDLE;
+
 	// View frustum for culling invisible objects
 	vks::Frustum frustum;
 
@@ -99,6 +138,7 @@ public:
 		camera.setTranslation(glm::vec3(0.5f, 0.0f, 0.0f));
 		camera.movementSpeed = 5.0f;
 		memset(&indirectStats, 0, sizeof(indirectStats));
+		memset(&lateIndirectStats, 0, sizeof(lateIndirectStats));
 	}
 
 	~VulkanExample()
@@ -110,10 +150,21 @@ public:
 		indirectCommandsBuffer.destroy();
 		uniformData.scene.destroy();
 		indirectDrawCountBuffer.destroy();
+		lateIndirectCommandsBuffer.destroy();
+		lateIndirectDrawCountBuffer.destroy();
 		compute.lodLevelsBuffers.destroy();
 		vkDestroyPipelineLayout(device, compute.pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
 		vkDestroyPipeline(device, compute.pipeline, nullptr);
+		vkDestroyPipeline(device, compute.latePipeline, nullptr);
+		destroyHiZPyramid();
+		vkDestroyImageView(device, hiz.depthView, nullptr);
+		vkDestroySampler(device, hiz.sampler, nullptr);
+		vkDestroyDescriptorPool(device, hiz.descriptorPool, nullptr);
+		vkDestroyDescriptorSetLayout(device, hiz.descriptorSetLayout, nullptr);
+		vkDestroyPipelineLayout(device, hiz.pipelineLayout, nullptr);
+		vkDestroyPipeline(device, hiz.pipeline, nullptr);
+		vkDestroyRenderPass(device, lateRenderPass, nullptr);
 		vkDestroyFence(device, compute.fence, nullptr);
 		vkDestroyCommandPool(device, compute.commandPool, nullptr);
 		vkDestroySemaphore(device, compute.semaphore, nullptr);
@@ -127,6 +178,180 @@ public:
 		}
 	}
 
+	// The depth attachment needs to be sampled to build the Hi-Z pyramid, so it's created with an additional depth only view
+	void setupDepthStencil()
+	{
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = depthFormat;
+		imageCI.extent = { width, height, 1 };
+		imageCI.mipLevels = 1;
+		imageCI.arrayLayers = 1;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &depthStencil.image));
+
+		VkMemoryRequirements memReqs{};
+		vkGetImageMemoryRequirements(device, depthStencil.image, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &depthStencil.mem));
+		VK_CHECK_RESULT(vkBindImageMemory(device, depthStencil.image, depthStencil.mem, 0));
+
+		VkImageViewCreateInfo imageViewCI = vks::initializers::imageViewCreateInfo();
+		imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageViewCI.image = depthStencil.image;
+		imageViewCI.format = depthFormat;
+		imageViewCI.subresourceRange = { getDepthAspectMask(), 0, 1, 0, 1 };
+		VK_CHECK_RESULT(vkCreateImageView(device, &imageViewCI, nullptr, &depthStencil.view));
+
+		// Views used for sampling may only contain a single aspect
+		if (hiz.depthView != VK_NULL_HANDLE) {
+			vkDestroyImageView(device, hiz.depthView, nullptr);
+		}
+		imageViewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		VK_CHECK_RESULT(vkCreateImageView(device, &imageViewCI, nullptr, &hiz.depthView));
+
+		// On resize the pyramid needs to match the new depth buffer (the command buffers are rebuilt by the base class after this)
+		if (hiz.pipeline != VK_NULL_HANDLE) {
+			prepareHiZPyramid();
+			updateHiZDescriptors();
+			buildComputeCommandBuffer();
+		}
+	}
+
+	VkImageAspectFlags getDepthAspectMask()
+	{
+		VkImageAspectFlags aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		// Stencil aspect should only be set on depth + stencil formats (VK_FORMAT_D16_UNORM_S8_UINT..VK_FORMAT_D32_SFLOAT_S8_UINT
+		if (depthFormat >= VK_FORMAT_D16_UNORM_S8_UINT) {
+			aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+		}
+		return aspectMask;
+	}
+
+	// Render pass for the second phase, continues rendering into the color and depth attachments of the first phase
+	void prepareLateRenderPass()
+	{
+		std::array<VkAttachmentDescription, 2> attachments = {};
+		attachments[0].format = swapChain.colorFormat;
+		attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[0].initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		attachments[1].format = depthFormat;
+		attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpassDescription = {};
+		subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpassDescription.colorAttachmentCount = 1;
+		subpassDescription.pColorAttachments = &colorReference;
+		subpassDescription.pDepthStencilAttachment = &depthReference;
+
+		// Color written by the first phase's render pass needs to be visible to this render pass (depth is covered by the explicit barrier after the Hi-Z build)
+		VkSubpassDependency dependency{};
+		dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependency.dstSubpass = 0;
+		dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+		VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpassDescription;
+		renderPassInfo.dependencyCount = 1;
+		renderPassInfo.pDependencies = &dependency;
+		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &lateRenderPass));
+	}
+
+	void drawIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer)
+	{
+		if (vulkanDevice->features.multiDrawIndirect)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, buffer, 0, static_cast<uint32_t>(indirectCommands.size()), sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			// If multi draw is not available, we must issue separate draw commands
+			for (auto j = 0; j < indirectCommands.size(); j++)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, buffer, j * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+			}
+		}
+	}
+
+	// Builds the Hi-Z pyramid from the depth attachment and runs the second culling phase against it
+	void recordOcclusionPass(VkCommandBuffer commandBuffer)
+	{
+		// Depth attachment becomes the input of the downsample
+		VkImageMemoryBarrier depthBarrier = vks::initializers::imageMemoryBarrier();
+		depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		depthBarrier.image = depthStencil.image;
+		depthBarrier.subresourceRange = { getDepthAspectMask(), 0, 1, 0, 1 };
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+		// Each level reads the one above, so levels are separated by barriers
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz.pipeline);
+		for (uint32_t level = 0; level < hiz.levelCount; level++) {
+			const uint32_t levelWidth = std::max(hiz.width >> level, 1u);
+			const uint32_t levelHeight = std::max(hiz.height >> level, 1u);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiz.pipelineLayout, 0, 1, &hiz.descriptorSets[level], 0, nullptr);
+			vkCmdDispatch(commandBuffer, (levelWidth + 15) / 16, (levelHeight + 15) / 16, 1);
+
+			VkImageMemoryBarrier levelBarrier = vks::initializers::imageMemoryBarrier();
+			levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			levelBarrier.image = hiz.image;
+			levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+		}
+
+		// Second culling phase, writes the late indirect draws and statistics (cleared at the start of the command buffer)
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.latePipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.lateDescriptorSet, 0, nullptr);
+		vkCmdDispatch(commandBuffer, objectCount / 16, 1, 1);
+
+		VkBufferMemoryBarrier lateDrawsBarrier = vks::initializers::bufferMemoryBarrier();
+		lateDrawsBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		lateDrawsBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+		lateDrawsBarrier.buffer = lateIndirectCommandsBuffer.buffer;
+		lateDrawsBarrier.size = VK_WHOLE_SIZE;
+		VkBufferMemoryBarrier lateStatsBarrier = lateDrawsBarrier;
+		lateStatsBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		lateStatsBarrier.buffer = lateIndirectDrawCountBuffer.buffer;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, 1, &lateDrawsBarrier, 0, nullptr);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &lateStatsBarrier, 0, nullptr);
+
+		// Depth goes back to being an attachment for the second phase's draws
+		depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+		depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+	}
+
 	void buildCommandBuffers()
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
@@ -136,11 +361,8 @@ public:
 		clearValues[1].depthStencil = { 1.0f, 0 };
 
 		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-		renderPassBeginInfo.renderPass = renderPass;
 		renderPassBeginInfo.renderArea.extent.width = width;
 		renderPassBeginInfo.renderArea.extent.height = height;
-		renderPassBeginInfo.clearValueCount = 2;
-		renderPassBeginInfo.pClearValues = clearValues;
 
 		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
 		{
@@ -150,6 +372,7 @@ public:
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
 			// Acquire barrier
+			// The indirect draws are also read by the second culling phase
 			if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute)
 			{
 				VkBufferMemoryBarrier buffer_barrier =
@@ -157,7 +380,7 @@ public:
 					VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
 					nullptr,
 					0,
-					VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+					VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
 					vulkanDevice->queueFamilyIndices.compute,
 					vulkanDevice->queueFamilyIndices.graphics,
 					indirectCommandsBuffer.buffer,
@@ -168,43 +391,60 @@ public:
 				vkCmdPipelineBarrier(
 					drawCmdBuffers[i],
 					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 					0,
 					0, nullptr,
 					1, &buffer_barrier,
 					0, nullptr);
 			}
 
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			// Clear the statistics of the second culling phase
+			vkCmdFillBuffer(drawCmdBuffers[i], lateIndirectDrawCountBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+			VkBufferMemoryBarrier fillBarrier = vks::initializers::bufferMemoryBarrier();
+			fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+			fillBarrier.buffer = lateIndirectDrawCountBuffer.buffer;
+			fillBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(drawCmdBuffers[i], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &fillBarrier, 0, nullptr);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
 			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
 			VkDeviceSize offsets[1] = { 0 };
+
+			// First phase: Draw the instances that passed culling against the previous frame's depth
+			renderPassBeginInfo.renderPass = renderPass;
+			renderPassBeginInfo.clearValueCount = 2;
+			renderPassBeginInfo.pClearValues = clearValues;
+			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
 			// Mesh containing the LODs
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.plants);
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &lodModel.vertices.buffer, offsets);
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
-
 			vkCmdBindIndexBuffer(drawCmdBuffers[i], lodModel.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			drawIndirect(drawCmdBuffers[i], indirectCommandsBuffer.buffer);
 
-			if (vulkanDevice->features.multiDrawIndirect)
-			{
-				vkCmdDrawIndexedIndirect(drawCmdBuffers[i], indirectCommandsBuffer.buffer, 0, static_cast<uint32_t>(indirectCommands.size()), sizeof(VkDrawIndexedIndirectCommand));
-			}
-			else
-			{
-				// If multi draw is not available, we must issue separate draw commands
-				for (auto j = 0; j < indirectCommands.size(); j++)
-				{
-					vkCmdDrawIndexedIndirect(drawCmdBuffers[i], indirectCommandsBuffer.buffer, j * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
-				}
-			}
+			vkCmdEndRenderPass(drawCmdBuffers[i]);
+
+			// Build the Hi-Z pyramid from this depth and re-test the occluded instances
+			recordOcclusionPass(drawCmdBuffers[i]);
+
+			// Second phase: Draw the instances that became visible (and the UI)
+			renderPassBeginInfo.renderPass = lateRenderPass;
+			renderPassBeginInfo.clearValueCount = 0;
+			renderPassBeginInfo.pClearValues = nullptr;
+			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.plants);
+			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &lodModel.vertices.buffer, offsets);
+			vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
+			vkCmdBindIndexBuffer(drawCmdBuffers[i], lodModel.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+			drawIndirect(drawCmdBuffers[i], lateIndirectCommandsBuffer.buffer);
 
 			drawUI(drawCmdBuffers[i]);
 
@@ -217,7 +457,7 @@ public:
 				{
 					VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
 					nullptr,
-					VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+					VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
 					0,
 					vulkanDevice->queueFamilyIndices.graphics,
 					vulkanDevice->queueFamilyIndices.compute,
@@ -228,7 +468,7 @@ public:
 
 				vkCmdPipelineBarrier(
 					drawCmdBuffers[i],
-					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+					VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 					VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
 					0,
 					0, nullptr,
@@ -283,7 +523,7 @@ public:
 		vkCmdBindDescriptorSets(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
 
 		// Clear the buffer that the compute shader pass will write statistics and draw calls to
-		vkCmdFillBuffer(compute.commandBuffer, indirectDrawCountBuffer.buffer, 0, indirectCommandsBuffer.descriptor.range, 0);
+		vkCmdFillBuffer(compute.commandBuffer, indirectDrawCountBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
 
 		// This barrier ensures that the fill command is finished before the compute shader can start writing to the buffer
 		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
@@ -300,8 +540,9 @@ public:
 			0, nullptr);
 
 		// Dispatch the compute job
-		// The compute shader will do the frustum culling and adjust the indirect draw calls depending on object visibility.
+		// The compute shader will do the frustum and occlusion culling and adjust the indirect draw calls depending on object visibility.
 		// It also determines the lod to use depending on distance to the viewer.
+		// Occlusion is tested against the Hi-Z pyramid built by the graphics command buffer of the previous frame, which has finished before this is submitted
 		vkCmdDispatch(compute.commandBuffer, objectCount / 16, 1, 1);
 
 		// Release barrier
@@ -339,10 +580,11 @@ public:
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2)
 		};
-		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 2);
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 3);
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
 
@@ -485,6 +727,20 @@ public:
 		// Map for host access
 		VK_CHECK_RESULT(indirectDrawCountBuffer.map());
 
+		// Second culling phase, only used on the graphics queue
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&lateIndirectCommandsBuffer,
+			indirectCommands.size() * sizeof(VkDrawIndexedIndirectCommand)));
+
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&lateIndirectDrawCountBuffer,
+			sizeof(lateIndirectStats)));
+		VK_CHECK_RESULT(lateIndirectDrawCountBuffer.map());
+
 		// Instance data
 		for (uint32_t x = 0; x < OBJECT_COUNT; x++)
 		{
@@ -596,6 +852,147 @@ public:
 		updateUniformBuffer(true);
 	}
 
+	void destroyHiZPyramid()
+	{
+		for (auto& levelView : hiz.levelViews) {
+			vkDestroyImageView(device, levelView, nullptr);
+		}
+		hiz.levelViews.clear();
+		if (hiz.image != VK_NULL_HANDLE) {
+			vkDestroyImageView(device, hiz.view, nullptr);
+			vkDestroyImage(device, hiz.image, nullptr);
+			vkFreeMemory(device, hiz.memory, nullptr);
+			hiz.image = VK_NULL_HANDLE;
+		}
+	}
+
+	// (Re)creates the Hi-Z pyramid for the current depth buffer size, including the per-level descriptor sets of the downsample
+	void prepareHiZPyramid()
+	{
+		destroyHiZPyramid();
+
+		hiz.width = width;
+		hiz.height = height;
+		hiz.levelCount = static_cast<uint32_t>(floor(log2(std::max(width, height)))) + 1;
+
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = VK_FORMAT_R32_SFLOAT;
+		imageCI.extent = { hiz.width, hiz.height, 1 };
+		imageCI.mipLevels = hiz.levelCount;
+		imageCI.arrayLayers = 1;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		// Written on the graphics queue and read by the first culling phase on the compute queue
+		std::vector<uint32_t> queueFamilyIndices = { vulkanDevice->queueFamilyIndices.graphics, vulkanDevice->queueFamilyIndices.compute };
+		if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute) {
+			imageCI.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			imageCI.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilyIndices.size());
+			imageCI.pQueueFamilyIndices = queueFamilyIndices.data();
+		}
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &hiz.image));
+
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, hiz.image, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &hiz.memory));
+		VK_CHECK_RESULT(vkBindImageMemory(device, hiz.image, hiz.memory, 0));
+
+		VkImageViewCreateInfo viewCI = vks::initializers::imageViewCreateInfo();
+		viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCI.format = VK_FORMAT_R32_SFLOAT;
+		viewCI.image = hiz.image;
+		viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, hiz.levelCount, 0, 1 };
+		VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &hiz.view));
+		hiz.levelViews.resize(hiz.levelCount);
+		for (uint32_t level = 0; level < hiz.levelCount; level++) {
+			viewCI.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+			VK_CHECK_RESULT(vkCreateImageView(device, &viewCI, nullptr, &hiz.levelViews[level]));
+		}
+
+		// The pyramid stays in the general layout, it's cleared to the far plane so nothing is occluded until the first frame has been rendered
+		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, hiz.levelCount, 0, 1 };
+		vks::tools::setImageLayout(copyCmd, hiz.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, subresourceRange);
+		VkClearColorValue clearValue = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+		vkCmdClearColorImage(copyCmd, hiz.image, VK_IMAGE_LAYOUT_GENERAL, &clearValue, 1, &subresourceRange);
+		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+
+		// Level 0 reads the depth attachment, all other levels read the level above
+		VK_CHECK_RESULT(vkResetDescriptorPool(device, hiz.descriptorPool, 0));
+		hiz.descriptorSets.resize(hiz.levelCount);
+		std::vector<VkDescriptorSetLayout> layouts(hiz.levelCount, hiz.descriptorSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(hiz.descriptorPool, layouts.data(), hiz.levelCount);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, hiz.descriptorSets.data()));
+		for (uint32_t level = 0; level < hiz.levelCount; level++) {
+			VkDescriptorImageInfo inputDescriptor = (level == 0) ?
+				vks::initializers::descriptorImageInfo(hiz.sampler, hiz.depthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL) :
+				vks::initializers::descriptorImageInfo(hiz.sampler, hiz.levelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL);
+			VkDescriptorImageInfo outputDescriptor = vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, hiz.levelViews[level], VK_IMAGE_LAYOUT_GENERAL);
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(hiz.descriptorSets[level], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &inputDescriptor),
+				vks::initializers::writeDescriptorSet(hiz.descriptorSets[level], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &outputDescriptor),
+			};
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		}
+	}
+
+	void prepareHiZ()
+	{
+		// Texels are only fetched, never filtered
+		VkSamplerCreateInfo samplerCI = vks::initializers::samplerCreateInfo();
+		samplerCI.magFilter = VK_FILTER_NEAREST;
+		samplerCI.minFilter = VK_FILTER_NEAREST;
+		samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerCI.maxLod = VK_LOD_CLAMP_NONE;
+		samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		VK_CHECK_RESULT(vkCreateSampler(device, &samplerCI, nullptr, &hiz.sampler));
+
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			// Binding 0: Input (depth attachment or level above)
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+			// Binding 1: Output level
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		};
+		VkDescriptorSetLayoutCreateInfo descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &hiz.descriptorSetLayout));
+
+		// Enough sets for one per level of the largest possible pyramid
+		const uint32_t maxLevels = 16;
+		std::vector<VkDescriptorPoolSize> poolSizes = {
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxLevels),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, maxLevels)
+		};
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, maxLevels);
+		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &hiz.descriptorPool));
+
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&hiz.descriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &hiz.pipelineLayout));
+
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(hiz.pipelineLayout, 0);
+		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computecullandlod/hizdownsample.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &hiz.pipeline));
+
+		prepareHiZPyramid();
+	}
+
+	// Both culling phases sample the (whole) pyramid
+	void updateHiZDescriptors()
+	{
+		VkDescriptorImageInfo hizDescriptor = vks::initializers::descriptorImageInfo(hiz.sampler, hiz.view, VK_IMAGE_LAYOUT_GENERAL);
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &hizDescriptor),
+			vks::initializers::writeDescriptorSet(compute.lateDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &hizDescriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	}
+
 	void prepareCompute()
 	{
 		// Get a compute capable device queue
@@ -630,6 +1027,16 @@ public:
 				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 				VK_SHADER_STAGE_COMPUTE_BIT,
 				4),
+			// Binding 5: Hi-Z pyramid (input)
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				5),
+			// Binding 6: Indirect draw commands of the second phase (output)
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				6),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -685,33 +1092,54 @@ public:
 				compute.descriptorSet,
 				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 				4,
-				&compute.lodLevelsBuffers.descriptor)
+				&compute.lodLevelsBuffers.descriptor),
+			// Binding 6: Indirect draw commands of the second phase (not written by the first phase)
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				6,
+				&lateIndirectCommandsBuffer.descriptor)
 		};
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
 
+		// The second phase uses the same bindings, but writes its own statistics
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.lateDescriptorSet));
+		for (auto& writeDescriptorSet : computeWriteDescriptorSets) {
+			writeDescriptorSet.dstSet = compute.lateDescriptorSet;
+			if (writeDescriptorSet.dstBinding == 3) {
+				writeDescriptorSet.pBufferInfo = &lateIndirectDrawCountBuffer.descriptor;
+			}
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+		updateHiZDescriptors();
+
 		// Create pipeline
 		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
 		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computecullandlod/cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 
-		// Use specialization constants to pass max. level of detail (determined by no. of meshes)
-		VkSpecializationMapEntry specializationEntry{};
-		specializationEntry.constantID = 0;
-		specializationEntry.offset = 0;
-		specializationEntry.size = sizeof(uint32_t);
-
-		uint32_t specializationData = static_cast<uint32_t>(lodModel.nodes.size()) - 1;
+		// Use specialization constants to pass max. level of detail (determined by no. of meshes) and the culling phase
+		struct SpecializationData {
+			uint32_t maxLodLevel;
+			uint32_t phase;
+		} specializationData;
+		std::array<VkSpecializationMapEntry, 2> specializationEntries = {
+			vks::initializers::specializationMapEntry(0, offsetof(SpecializationData, maxLodLevel), sizeof(uint32_t)),
+			vks::initializers::specializationMapEntry(1, offsetof(SpecializationData, phase), sizeof(uint32_t)),
+		};
+		specializationData.maxLodLevel = static_cast<uint32_t>(lodModel.nodes.size()) - 1;
+		specializationData.phase = 0;
 
-		VkSpecializationInfo specializationInfo;
-		specializationInfo.mapEntryCount = 1;
-		specializationInfo.pMapEntries = &specializationEntry;
-		specializationInfo.dataSize = sizeof(specializationData);
-		specializationInfo.pData = &specializationData;
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(specializationEntries.size()), specializationEntries.data(), sizeof(specializationData), &specializationData);
 
 		computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
 
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
 
+		// Second phase pipeline (recorded into the graphics command buffers)
+		specializationData.phase = 1;
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.latePipeline));
+
 		// Separate command pool as queue family for compute may be different than graphics
 		VkCommandPoolCreateInfo cmdPoolInfo = {};
 		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -752,6 +1180,7 @@ public:
 				memcpy(uboScene.frustumPlanes, frustum.planes.data(), sizeof(glm::vec4) * 6);
 			}
 		}
+		uboScene.occlusionCulling = occlusionCulling ? 1 : 0;
 
 		memcpy(uniformData.scene.mapped, &uboScene, sizeof(uboScene));
 	}
@@ -766,6 +1195,11 @@ public:
 		vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX);
 		vkResetFences(device, 1, &compute.fence);
 
+		// The first phase tests against the Hi-Z pyramid of the last frame, which has been rendered with that frame's matrices
+		uboScene.prevViewProjection = renderedViewProjection;
+		memcpy(uniformData.scene.mapped, &uboScene, sizeof(uboScene));
+		renderedViewProjection = uboScene.projection * uboScene.modelview;
+
 		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
 		computeSubmitInfo.commandBufferCount = 1;
 		computeSubmitInfo.pCommandBuffers = &compute.commandBuffer;
@@ -780,9 +1214,10 @@ public:
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 
 		// Wait on present and compute semaphores
+		// The indirect draws are consumed and the Hi-Z pyramid that the compute queue reads is overwritten by the graphics command buffer
 		std::array<VkPipelineStageFlags,2> stageFlags = {
 			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 		};
 		std::array<VkSemaphore,2> waitSemaphores = {
 			semaphores.presentComplete,						// Wait for presentation to finished
@@ -800,6 +1235,7 @@ public:
 
 		// Get draw count from compute
 		memcpy(&indirectStats, indirectDrawCountBuffer.mapped, sizeof(indirectStats));
+		memcpy(&lateIndirectStats, lateIndirectDrawCountBuffer.mapped, sizeof(lateIndirectStats));
 	}
 
 	void prepare()
@@ -809,8 +1245,10 @@ public:
 		prepareBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
+		prepareLateRenderPass();
 		setupDescriptorPool();
 		setupDescriptorSet();
+		prepareHiZ();
 		prepareCompute();
 		buildCommandBuffers();
 		prepared = true;
@@ -840,11 +1278,19 @@ public:
 			if (overlay->checkBox("Freeze frustum", &fixedFrustum)) {
 				updateUniformBuffer(true);
 			}
+			if (overlay->checkBox("Occlusion culling", &occlusionCulling)) {
+				updateUniformBuffer(true);
+			}
 		}
 		if (overlay->header("Statistics")) {
-			overlay->text("Visible objects: %d", indirectStats.drawCount);
+			const uint32_t frustumCulled = objectCount - indirectStats.drawCount - indirectStats.occludedCount;
+			overlay->text("Visible objects: %d", indirectStats.drawCount + lateIndirectStats.drawCount);
+			overlay->text("Drawn in phase 1: %d", indirectStats.drawCount);
+			overlay->text("Drawn in phase 2: %d", lateIndirectStats.drawCount);
+			overlay->text("Frustum culled: %d", frustumCulled);
+			overlay->text("Occlusion culled: %d", lateIndirectStats.occludedCount);
 			for (uint32_t i = 0; i < MAX_LOD_LEVEL + 1; i++) {
-				overlay->text("LOD %d: %d", i, indirectStats.lodCount[i]);
+				overlay->text("LOD %d: %d", i, indirectStats.lodCount[i] + lateIndirectStats.lodCount[i]);
 			}
 		}
 	}
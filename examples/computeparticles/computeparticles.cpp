@@ -9,6 +9,7 @@
 */
 
 #include "vulkanexamplebase.h"
+#include "VulkanAsyncCompute.h"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -39,25 +40,17 @@ public:
 
 	// Resources for the graphics part of the example
 	struct {
-		uint32_t queueFamilyIndex;					// Used to check if compute and graphics queue families differ and require additional barriers
 		VkDescriptorSetLayout descriptorSetLayout;	// Particle system rendering shader binding layout
 		VkDescriptorSet descriptorSet;				// Particle system rendering shader bindings
 		VkPipelineLayout pipelineLayout;			// Layout of the graphics pipeline
 		VkPipeline pipeline;						// Particle rendering pipeline
-		VkSemaphore semaphore;                      // Execution dependency between compute & graphic submission
 	} graphics;
 
 	// Resources for the compute part of the example
 	struct {
-		uint32_t queueFamilyIndex;					// Used to check if compute and graphics queue families differ and require additional barriers
-		vks::Buffer storageBuffer;					// (Shader) storage buffer object containing the particles
 		vks::Buffer uniformBuffer;					// Uniform buffer object containing particle system parameters
-		VkQueue queue;								// Separate queue for compute commands (queue family may differ from the one used for graphics)
-		VkCommandPool commandPool;					// Use a separate command pool (queue family may differ from the one used for graphics)
-		VkCommandBuffer commandBuffer;				// Command buffer storing the dispatch commands and barriers
-		VkSemaphore semaphore;                      // Execution dependency between compute & graphic submission
 		VkDescriptorSetLayout descriptorSetLayout;	// Compute shader binding layout
-		VkDescriptorSet descriptorSet;				// Compute shader bindings
+		std::array<VkDescriptorSet, vks::AsyncCompute::frameCount> descriptorSets;	// Compute shader bindings for each frame buffer (reading the particles of the previous frame)
 		VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
 		VkPipeline pipeline;						// Compute pipeline for updating particle positions
 		struct computeUBO {							// Compute shader uniform block object
@@ -68,6 +61,10 @@ public:
 		} ubo;
 	} compute;
 
+	// Runs the simulation step for the next frame on the compute queue while the current frame is drawn
+	// The particles are stored in the frame buffers of the helper, each step reads the particles of the previous step and writes new ones
+	vks::AsyncCompute asyncCompute;
+
 	// SSBO particle declaration
 	struct Particle {
 		glm::vec2 pos;								// Particle position
@@ -75,27 +72,31 @@ public:
 		glm::vec4 gradientPos;						// Texture coordinates for the gradient ramp map
 	};
 
-	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
+	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION, [](CommandLineParser& commandLineParser) {
+		commandLineParser.add("serialcompute", { "-sc", "--serialcompute" }, 0, "Serialize compute and graphics instead of overlapping them");
+	})
 	{
 		title = "Compute shader particle system";
+		asyncCompute.async = !commandLineParser.isSet("serialcompute");
 	}
 
 	~VulkanExample()
 	{
+		if (benchmark.active) {
+			asyncCompute.printStatistics();
+		}
+		asyncCompute.destroy();
+
 		// Graphics
 		vkDestroyPipeline(device, graphics.pipeline, nullptr);
 		vkDestroyPipelineLayout(device, graphics.pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, graphics.descriptorSetLayout, nullptr);
-		vkDestroySemaphore(device, graphics.semaphore, nullptr);
 
 		// Compute
-		compute.storageBuffer.destroy();
 		compute.uniformBuffer.destroy();
 		vkDestroyPipelineLayout(device, compute.pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
 		vkDestroyPipeline(device, compute.pipeline, nullptr);
-		vkDestroySemaphore(device, compute.semaphore, nullptr);
-		vkDestroyCommandPool(device, compute.commandPool, nullptr);
 
 		textures.particle.destroy();
 		textures.gradient.destroy();
@@ -108,6 +109,15 @@ public:
 	}
 
 	void buildCommandBuffers()
+	{
+		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
+		{
+			buildCommandBuffer(i);
+		}
+	}
+
+	// The frame buffer drawn changes every frame, so the command buffer for the current swap chain image is recorded right before submission
+	void buildCommandBuffer(uint32_t index)
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
@@ -123,158 +133,55 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = height;
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
+		renderPassBeginInfo.framebuffer = frameBuffers[index];
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-		{
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+		VkCommandBuffer commandBuffer = drawCmdBuffers[index];
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
 
-			// Acquire barrier
-			if (graphics.queueFamilyIndex != compute.queueFamilyIndex)
-			{
-				VkBufferMemoryBarrier buffer_barrier =
-				{
-					VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					nullptr,
-					0,
-					VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-					compute.queueFamilyIndex,
-					graphics.queueFamilyIndex,
-					compute.storageBuffer.buffer,
-					0,
-					compute.storageBuffer.size
-				};
-
-				vkCmdPipelineBarrier(
-					drawCmdBuffers[i],
-					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-					VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-					0,
-					0, nullptr,
-					1, &buffer_barrier,
-					0, nullptr);
-			}
+		// Acquire the particle buffer written by compute (if queue families differ)
+		asyncCompute.cmdBeginGraphics(commandBuffer);
 
-			// Draw the particle system using the update vertex buffer
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		// Draw the particle system using the update vertex buffer
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+		VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+		VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
 
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &compute.storageBuffer.buffer, offsets);
-			vkCmdDraw(drawCmdBuffers[i], PARTICLE_COUNT, 1, 0, 0);
+		VkDeviceSize offsets[1] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, VERTEX_BUFFER_BIND_ID, 1, &asyncCompute.frames[asyncCompute.graphicsFrame].buffer.buffer, offsets);
+		vkCmdDraw(commandBuffer, PARTICLE_COUNT, 1, 0, 0);
 
-			drawUI(drawCmdBuffers[i]);
+		drawUI(commandBuffer);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+		vkCmdEndRenderPass(commandBuffer);
 
-			// Release barrier
-			if (graphics.queueFamilyIndex != compute.queueFamilyIndex)
-			{
-				VkBufferMemoryBarrier buffer_barrier =
-				{
-					VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-					nullptr,
-					VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-					0,
-					graphics.queueFamilyIndex,
-					compute.queueFamilyIndex,
-					compute.storageBuffer.buffer,
-					0,
-					compute.storageBuffer.size
-				};
-
-				vkCmdPipelineBarrier(
-					drawCmdBuffers[i],
-					VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-					VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-					0,
-					0, nullptr,
-					1, &buffer_barrier,
-					0, nullptr);
-			}
-
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-		}
+		asyncCompute.cmdEndGraphics(commandBuffer);
 
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
 	}
 
-	void buildComputeCommandBuffer()
+	// One command buffer per frame buffer, each step writes the particles to its frame buffer
+	void buildComputeCommandBuffers()
 	{
-		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
-
-		VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffer, &cmdBufInfo));
-
-		// Compute particle movement
-
-		// Add memory barrier to ensure that the (graphics) vertex shader has fetched attributes before compute starts to write to the buffer
-		if (graphics.queueFamilyIndex != compute.queueFamilyIndex)
+		for (uint32_t i = 0; i < vks::AsyncCompute::frameCount; i++)
 		{
-			VkBufferMemoryBarrier buffer_barrier =
-			{
-				VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-				nullptr,
-				0,
-				VK_ACCESS_SHADER_WRITE_BIT,
-				graphics.queueFamilyIndex,
-				compute.queueFamilyIndex,
-				compute.storageBuffer.buffer,
-				0,
-				compute.storageBuffer.size
-			};
+			VkCommandBuffer commandBuffer = asyncCompute.frames[i].commandBuffer;
+			asyncCompute.beginCommandBuffer(i);
 
-			vkCmdPipelineBarrier(
-				compute.commandBuffer,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				0,
-				0, nullptr,
-				1, &buffer_barrier,
-				0, nullptr);
-		}
+			// Dispatch the compute job
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSets[i], 0, 0);
+			vkCmdDispatch(commandBuffer, PARTICLE_COUNT / 256, 1, 1);
 
-		// Dispatch the compute job
-		vkCmdBindPipeline(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
-		vkCmdBindDescriptorSets(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
-		vkCmdDispatch(compute.commandBuffer, PARTICLE_COUNT / 256, 1, 1);
-
-		// Add barrier to ensure that compute shader has finished writing to the buffer
-		// Without this the (rendering) vertex shader may display incomplete results (partial data from last frame)
-		if (graphics.queueFamilyIndex != compute.queueFamilyIndex)
-		{
-			VkBufferMemoryBarrier buffer_barrier =
-			{
-				VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-				nullptr,
-				VK_ACCESS_SHADER_WRITE_BIT,
-				0,
-				compute.queueFamilyIndex,
-				graphics.queueFamilyIndex,
-				compute.storageBuffer.buffer,
-				0,
-				compute.storageBuffer.size
-			};
-
-			vkCmdPipelineBarrier(
-				compute.commandBuffer,
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-				0,
-				0, nullptr,
-				1, &buffer_barrier,
-				0, nullptr);
+			// Release the particles read by this step to the graphics queue
+			asyncCompute.endCommandBuffer(i);
 		}
-
-		vkEndCommandBuffer(compute.commandBuffer);
 	}
 
 	// Setup and fill the compute shader storage buffers containing the particles
@@ -305,44 +212,16 @@ public:
 			storageBufferSize,
 			particleBuffer.data());
 
-		vulkanDevice->createBuffer(
-			// The SSBO will be used as a storage buffer for the compute pipeline and as a vertex buffer in the graphics pipeline
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			&compute.storageBuffer,
-			storageBufferSize);
-
-		// Copy from staging buffer to storage buffer
-		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		// Storage buffers for the particles of each frame, also used as vertex buffers in the graphics pipeline
+		asyncCompute.create(vulkanDevice, queue, storageBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+		// Copy from staging buffer to the buffer read by the first simulation step
+		// This is done on the compute queue, so the initial particles don't need to change queue family ownership
+		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, asyncCompute.commandPool, true);
 		VkBufferCopy copyRegion = {};
 		copyRegion.size = storageBufferSize;
-		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffer.buffer, 1, &copyRegion);
-		// Execute a transfer barrier to the compute queue, if necessary
-		if (graphics.queueFamilyIndex != compute.queueFamilyIndex)
-		{
-			VkBufferMemoryBarrier buffer_barrier =
-			{
-				VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-				nullptr,
-				VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-				0,
-				graphics.queueFamilyIndex,
-				compute.queueFamilyIndex,
-				compute.storageBuffer.buffer,
-				0,
-				compute.storageBuffer.size
-			};
-
-			vkCmdPipelineBarrier(
-				copyCmd,
-				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-				0,
-				0, nullptr,
-				1, &buffer_barrier,
-				0, nullptr);
-		}
-		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, asyncCompute.stateBuffer().buffer, 1, &copyRegion);
+		vulkanDevice->flushCommandBuffer(copyCmd, asyncCompute.queue, asyncCompute.commandPool);
 
 		stagingBuffer.destroy();
 
@@ -384,8 +263,8 @@ public:
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, vks::AsyncCompute::frameCount),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * vks::AsyncCompute::frameCount),
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2)
 		};
 
@@ -393,7 +272,7 @@ public:
 			vks::initializers::descriptorPoolCreateInfo(
 				static_cast<uint32_t>(poolSizes.size()),
 				poolSizes.data(),
-				2);
+				1 + vks::AsyncCompute::frameCount);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -548,32 +427,20 @@ public:
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorSet();
-
-		// Semaphore for compute & graphics sync
-		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &graphics.semaphore));
-		
-		// Signal the semaphore
-		VkSubmitInfo submitInfo = vks::initializers::submitInfo();
-		submitInfo.signalSemaphoreCount = 1;
-		submitInfo.pSignalSemaphores = &graphics.semaphore;
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 	}
 
 	void prepareCompute()
 	{
-		// Create a compute capable device queue
+		// The compute queue is selected by the async compute helper
 		// The VulkanDevice::createLogicalDevice functions finds a compute capable queue and prefers queue families that only support compute
 		// Depending on the implementation this may result in different queue family indices for graphics and computes,
-		// requiring proper synchronization (see the memory and pipeline barriers)
-		vkGetDeviceQueue(device, compute.queueFamilyIndex, 0, &compute.queue);
+		// requiring queue family ownership transfers (done by the async compute helper)
 
 		// Create compute pipeline
 		// Compute pipelines are created separate from graphics pipelines even if they use the same queue (family index)
 
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-			// Binding 0 : Particle position storage buffer
+			// Binding 0 : Particle position storage buffer written by the step
 			vks::initializers::descriptorSetLayoutBinding(
 				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 				VK_SHADER_STAGE_COMPUTE_BIT,
@@ -583,6 +450,11 @@ public:
 				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 				VK_SHADER_STAGE_COMPUTE_BIT,
 				1),
+			// Binding 2 : Particle position storage buffer written by the previous step
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				2),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -605,101 +477,46 @@ public:
 				&compute.descriptorSetLayout,
 				1);
 
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSet));
-
-		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets =
+		// The step of each frame reads the particles of the previous frame and writes its own
+		for (uint32_t i = 0; i < vks::AsyncCompute::frameCount; i++)
 		{
-			// Binding 0 : Particle position storage buffer
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				0,
-				&compute.storageBuffer.descriptor),
-			// Binding 1 : Uniform buffer
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				1,
-				&compute.uniformBuffer.descriptor)
-		};
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSets[i]));
+
+			std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets =
+			{
+				// Binding 0 : Particle position storage buffer written by the step
+				vks::initializers::writeDescriptorSet(
+					compute.descriptorSets[i],
+					VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+					0,
+					&asyncCompute.frames[i].buffer.descriptor),
+				// Binding 1 : Uniform buffer
+				vks::initializers::writeDescriptorSet(
+					compute.descriptorSets[i],
+					VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+					1,
+					&compute.uniformBuffer.descriptor),
+				// Binding 2 : Particle position storage buffer written by the previous step
+				vks::initializers::writeDescriptorSet(
+					compute.descriptorSets[i],
+					VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+					2,
+					&asyncCompute.frames[vks::AsyncCompute::previousFrame(i)].buffer.descriptor)
+			};
 
-		vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(computeWriteDescriptorSets.size()), computeWriteDescriptorSets.data(), 0, NULL);
+		}
 
 		// Create pipeline
 		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
 		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computeparticles/particle.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
 
-		// Separate command pool as queue family for compute may be different than graphics
-		VkCommandPoolCreateInfo cmdPoolInfo = {};
-		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-		cmdPoolInfo.queueFamilyIndex = compute.queueFamilyIndex;
-		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
+		// Build the command buffers containing the compute dispatch commands for each frame buffer
+		buildComputeCommandBuffers();
 
-		// Create a command buffer for compute operations
-		compute.commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, compute.commandPool);
-
-		// Semaphore for compute & graphics sync
-		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &compute.semaphore));
-
-		// Build a single command buffer containing the compute dispatch commands
-		buildComputeCommandBuffer();
-
-		// SRS - By reordering compute and graphics within draw(), the following code is no longer needed:
-		// If graphics and compute queue family indices differ, acquire and immediately release the storage buffer, so that the initial acquire from the graphics command buffers are matched up properly
-		/*
-		if (graphics.queueFamilyIndex != compute.queueFamilyIndex)
-		{
-			// Create a transient command buffer for setting up the initial buffer transfer state
-			VkCommandBuffer transferCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, compute.commandPool, true);
-
-			VkBufferMemoryBarrier acquire_buffer_barrier =
-			{
-				VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-				nullptr,
-				0,
-				VK_ACCESS_SHADER_WRITE_BIT,
-				graphics.queueFamilyIndex,
-				compute.queueFamilyIndex,
-				compute.storageBuffer.buffer,
-				0,
-				compute.storageBuffer.size
-			};
-			vkCmdPipelineBarrier(
-				transferCmd,
-				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				0,
-				0, nullptr,
-				1, &acquire_buffer_barrier,
-				0, nullptr);
-
-			VkBufferMemoryBarrier release_buffer_barrier =
-			{
-				VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-				nullptr,
-				VK_ACCESS_SHADER_WRITE_BIT,
-				0,
-				compute.queueFamilyIndex,
-				graphics.queueFamilyIndex,
-				compute.storageBuffer.buffer,
-				0,
-				compute.storageBuffer.size
-			};
-			vkCmdPipelineBarrier(
-				transferCmd,
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-				0,
-				0, nullptr,
-				1, &release_buffer_barrier,
-				0, nullptr);
-
-			vulkanDevice->flushCommandBuffer(transferCmd, compute.queue, compute.commandPool);
-		}
-		*/
+		// Start the frame sequence (submits the first simulation step when running async)
+		asyncCompute.reset();
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -739,35 +556,19 @@ public:
 
 	void draw()
 	{
-		// Wait for rendering finished
-		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-
-		// Submit compute commands
-		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
-		computeSubmitInfo.commandBufferCount = 1;
-		computeSubmitInfo.pCommandBuffers = &compute.commandBuffer;
-		computeSubmitInfo.waitSemaphoreCount = 1;
-		computeSubmitInfo.pWaitSemaphores = &graphics.semaphore;
-		computeSubmitInfo.pWaitDstStageMask = &waitStageMask;
-		computeSubmitInfo.signalSemaphoreCount = 1;
-		computeSubmitInfo.pSignalSemaphores = &compute.semaphore;
-		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, VK_NULL_HANDLE));
-
 		VulkanExampleBase::prepareFrame();
 
-		VkPipelineStageFlags graphicsWaitStageMasks[] = { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-		VkSemaphore graphicsWaitSemaphores[] = { compute.semaphore, semaphores.presentComplete };
-		VkSemaphore graphicsSignalSemaphores[] = { graphics.semaphore, semaphores.renderComplete };
+		// Wait for the previous simulation step before updating its parameters and submit the next one
+		asyncCompute.beginFrame();
+		updateUniformBuffers();
+		asyncCompute.submitCompute();
 
-		// Submit graphics commands
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		submitInfo.waitSemaphoreCount = 2;
-		submitInfo.pWaitSemaphores = graphicsWaitSemaphores;
-		submitInfo.pWaitDstStageMask = graphicsWaitStageMasks;
-		submitInfo.signalSemaphoreCount = 2;
-		submitInfo.pSignalSemaphores = graphicsSignalSemaphores;
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		// Draw the particles from the frame buffer selected by the async compute helper
+		buildCommandBuffer(currentBuffer);
+		VkSubmitInfo graphicsSubmitInfo = submitInfo;
+		graphicsSubmitInfo.commandBufferCount = 1;
+		graphicsSubmitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+		asyncCompute.submitGraphics(graphicsSubmitInfo);
 
 		VulkanExampleBase::submitFrame();
 	}
@@ -775,10 +576,6 @@ public:
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
-		// We will be using the queue family indices to check if graphics and compute queue families differ
-		// If that's the case, we need additional barriers for acquiring and releasing resources
-		graphics.queueFamilyIndex = vulkanDevice->queueFamilyIndices.graphics;
-		compute.queueFamilyIndex = vulkanDevice->queueFamilyIndices.compute;
 		loadAssets();
 		setupDescriptorPool();
 		prepareGraphics();
@@ -791,7 +588,6 @@ public:
 	{
 		if (!prepared)
 			return;
-		draw();
 
 		if (!attachToCursor)
 		{
@@ -807,7 +603,7 @@ public:
 			}
 		}
 
-		updateUniformBuffers();
+		draw();
 	}
 
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
@@ -815,6 +611,7 @@ public:
 		if (overlay->header("Settings")) {
 			overlay->checkBox("Attach attractor to cursor", &attachToCursor);
 		}
+		asyncCompute.updateUIOverlay(overlay);
 	}
 };
 
@@ -7,6 +7,10 @@
 */
 
 #include "vulkanexamplebase.h"
+#include "VulkanglTFModel.h"
+#include "bvh.hpp"
+#include <random>
+#include <iomanip>
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -17,6 +21,9 @@
 #define TEX_DIM 2048
 #endif
 
+// Each pixel traces a primary and two reflection rays, each followed by a shadow ray
+#define RAYS_PER_PIXEL 6
+
 class VulkanExample : public VulkanExampleBase
 {
 public:
@@ -34,8 +41,11 @@ public:
 	// Resources for the compute part of the example
 	struct {
 		struct {
-			vks::Buffer spheres;						// (Shader) storage buffer object with scene spheres
+			vks::Buffer spheres;						// (Shader) storage buffer object with scene spheres in BVH order (host visible, animated every frame)
 			vks::Buffer planes;						// (Shader) storage buffer object with scene planes
+			vks::Buffer sphereNodes;				// (Shader) storage buffer object with the BVH nodes of the spheres (host visible, refitted every frame)
+			vks::Buffer triangleNodes;				// (Shader) storage buffer object with the BVH nodes of the mesh triangles
+			vks::Buffer triangles;					// (Shader) storage buffer object with the mesh triangles in BVH order
 		} storageBuffers;
 		vks::Buffer uniformBuffer;					// Uniform buffer object containing scene data
 		VkQueue queue;								// Separate queue for compute commands (queue family may differ from the one used for graphics)
@@ -46,6 +56,7 @@ public:
 		VkDescriptorSet descriptorSet;				// Compute shader bindings
 		VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
 		VkPipeline pipeline;						// Compute raytracing pipeline
+		VkQueryPool queryPool = VK_NULL_HANDLE;		// Timestamps for measuring the ray tracing dispatch
 		struct UBOCompute {							// Compute shader uniform block object
 			glm::vec3 lightPos;
 			float aspectRatio;						// Aspect ratio of the viewport
@@ -79,7 +90,43 @@ public:
 		glm::ivec3 _pad;
 	};
 
-	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
+	// SSBO triangle declaration, stores the first vertex and two edges for the ray/triangle test (std430, so vec3 is padded to vec4)
+	struct Triangle {
+		glm::vec4 v0;
+		glm::vec4 e1;
+		glm::vec4 e2;
+	};
+
+	const float roomDim = 4.0f;
+
+	// Source of the triangles, instanced in a grid on the floor of the room
+	vkglTF::Model model;
+	int32_t sceneSize = 0;
+	const std::vector<uint32_t> sceneTriangleCounts = { 0, 100000, 250000, 1000000 };
+	const std::vector<std::string> sceneSizeNames = { "Single mesh", "100k triangles", "250k triangles", "1M triangles" };
+	uint32_t triangleCount = 0;
+
+	// Acceleration structures built on the CPU and traversed by the compute shader
+	struct {
+		vks::BVH spheres;
+		vks::BVH triangles;
+	} bvh;
+
+	// Spheres in input order, animated on the CPU and copied to the storage buffer in BVH order
+	std::vector<Sphere> spheres;
+	std::vector<glm::vec3> sphereOrigins;
+
+	struct {
+		bool available = false;
+		bool written = false;
+		float timestampPeriod = 1.0f;
+		// Smoothed duration of the ray tracing dispatch in milliseconds
+		double dispatchTime = 0.0;
+	} timing;
+
+	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION, [](CommandLineParser& commandLineParser) {
+		commandLineParser.add("bvhbenchmark", { "-bvh", "--bvhbenchmark" }, 0, "Print BVH build and CPU traversal timings for increasing triangle counts");
+	})
 	{
 		title = "Compute shader ray tracing";
 		compute.ubo.aspectRatio = (float)width / (float)height;
@@ -114,6 +161,12 @@ public:
 		compute.uniformBuffer.destroy();
 		compute.storageBuffers.spheres.destroy();
 		compute.storageBuffers.planes.destroy();
+		compute.storageBuffers.sphereNodes.destroy();
+		compute.storageBuffers.triangleNodes.destroy();
+		compute.storageBuffers.triangles.destroy();
+		if (compute.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, compute.queryPool, nullptr);
+		}
 
 		textureComputeTarget.destroy();
 	}
@@ -333,8 +386,17 @@ public:
 		vkCmdBindPipeline(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
 		vkCmdBindDescriptorSets(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
 
+		if (timing.available) {
+			vkCmdResetQueryPool(compute.commandBuffer, compute.queryPool, 0, 2);
+			vkCmdWriteTimestamp(compute.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, compute.queryPool, 0);
+		}
+
 		vkCmdDispatch(compute.commandBuffer, textureComputeTarget.width / 16, textureComputeTarget.height / 16, 1);
 
+		if (timing.available) {
+			vkCmdWriteTimestamp(compute.commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, compute.queryPool, 1);
+		}
+
 		if (vulkanDevice->queueFamilyIndices.graphics != vulkanDevice->queueFamilyIndices.compute)
 		{
 			// Release barrier from compute queue
@@ -379,45 +441,179 @@ public:
 		return plane;
 	}
 
+	// Möller-Trumbore ray/triangle intersection, same as in the compute shader
+	static float intersectTriangle(const Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction)
+	{
+		const glm::vec3 e1 = glm::vec3(triangle.e1);
+		const glm::vec3 e2 = glm::vec3(triangle.e2);
+		const glm::vec3 p = glm::cross(direction, e2);
+		const float det = glm::dot(e1, p);
+		if (std::abs(det) < 1.0e-8f) {
+			return -1.0f;
+		}
+		const float invDet = 1.0f / det;
+		const glm::vec3 s = origin - glm::vec3(triangle.v0);
+		const float u = glm::dot(s, p) * invDet;
+		if ((u < 0.0f) || (u > 1.0f)) {
+			return -1.0f;
+		}
+		const glm::vec3 q = glm::cross(s, e1);
+		const float v = glm::dot(direction, q) * invDet;
+		if ((v < 0.0f) || (u + v > 1.0f)) {
+			return -1.0f;
+		}
+		return glm::dot(e2, q) * invDet;
+	}
+
+	static std::vector<vks::AABB> getTriangleBounds(const std::vector<Triangle>& triangles)
+	{
+		std::vector<vks::AABB> bounds(triangles.size());
+		for (size_t i = 0; i < triangles.size(); i++) {
+			const glm::vec3 v0 = glm::vec3(triangles[i].v0);
+			bounds[i].grow(v0);
+			bounds[i].grow(v0 + glm::vec3(triangles[i].e1));
+			bounds[i].grow(v0 + glm::vec3(triangles[i].e2));
+		}
+		return bounds;
+	}
+
+	std::vector<vks::AABB> getSphereBounds()
+	{
+		std::vector<vks::AABB> bounds(spheres.size());
+		for (size_t i = 0; i < spheres.size(); i++) {
+			bounds[i] = vks::AABB(spheres[i].pos - glm::vec3(spheres[i].radius), spheres[i].pos + glm::vec3(spheres[i].radius));
+		}
+		return bounds;
+	}
+
+	// Instance the mesh in a grid on the floor of the room until at least the requested number of triangles is reached
+	std::vector<Triangle> generateTriangles(uint32_t targetCount)
+	{
+		std::vector<Triangle> triangles;
+		const uint32_t meshTriangleCount = static_cast<uint32_t>(model.hostIndices.size() / 3);
+		if (meshTriangleCount == 0) {
+			return triangles;
+		}
+		const uint32_t instanceCount = std::max(1u, (targetCount + meshTriangleCount - 1) / meshTriangleCount);
+		const uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(instanceCount))));
+
+		vks::AABB meshBounds;
+		for (const vkglTF::Vertex& vertex : model.hostVertices) {
+			meshBounds.grow(vertex.pos);
+		}
+		const glm::vec3 meshSize = meshBounds.max - meshBounds.min;
+		const glm::vec3 meshOrigin = glm::vec3(meshBounds.center().x, meshBounds.min.y, meshBounds.center().z);
+		const float gridExtent = roomDim - 0.5f;
+		const float cellSize = gridExtent * 2.0f / static_cast<float>(gridSize);
+		const float scale = std::min(cellSize * 0.9f / std::max(meshSize.x, meshSize.z), 1.5f / meshSize.y);
+
+		triangles.resize(instanceCount * meshTriangleCount);
+		for (uint32_t instance = 0; instance < instanceCount; instance++) {
+			const glm::vec3 offset = glm::vec3(-gridExtent + cellSize * (instance % gridSize + 0.5f), -roomDim, -gridExtent + cellSize * (instance / gridSize + 0.5f));
+			for (uint32_t i = 0; i < meshTriangleCount; i++) {
+				glm::vec3 v[3];
+				for (uint32_t j = 0; j < 3; j++) {
+					v[j] = (model.hostVertices[model.hostIndices[i * 3 + j]].pos - meshOrigin) * scale + offset;
+				}
+				Triangle& triangle = triangles[instance * meshTriangleCount + i];
+				triangle.v0 = glm::vec4(v[0], 0.0f);
+				triangle.e1 = glm::vec4(v[1] - v[0], 0.0f);
+				triangle.e2 = glm::vec4(v[2] - v[0], 0.0f);
+			}
+		}
+		return triangles;
+	}
+
+	// Upload data to a device local storage buffer
+	void createStorageBuffer(vks::Buffer* buffer, VkDeviceSize size, void* data)
+	{
+		vks::Buffer stagingBuffer;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&stagingBuffer,
+			size,
+			data));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			buffer,
+			size));
+		vulkanDevice->copyBuffer(&stagingBuffer, buffer, queue);
+		stagingBuffer.destroy();
+	}
+
+	// (Re)build the triangle BVH for the selected scene size and upload nodes and triangles in BVH order
+	void prepareTriangles()
+	{
+		const std::vector<Triangle> triangles = generateTriangles(sceneTriangleCounts[sceneSize]);
+		triangleCount = static_cast<uint32_t>(triangles.size());
+		bvh.triangles.build(getTriangleBounds(triangles));
+		std::vector<Triangle> orderedTriangles = bvh.triangles.reorder(triangles);
+
+		compute.storageBuffers.triangleNodes.destroy();
+		compute.storageBuffers.triangles.destroy();
+		createStorageBuffer(&compute.storageBuffers.triangleNodes, bvh.triangles.nodes.size() * sizeof(vks::BVH::Node), bvh.triangles.nodes.data());
+		createStorageBuffer(&compute.storageBuffers.triangles, orderedTriangles.size() * sizeof(Triangle), orderedTriangles.data());
+	}
+
+	// Animate the spheres and refit their BVH, the tree topology stays the same so only the node bounds change
+	void updateSpheres()
+	{
+		for (size_t i = 0; i < spheres.size(); i++) {
+			spheres[i].pos = sphereOrigins[i] + glm::vec3(0.0f, sin(glm::radians(timer * 360.0f) + i * 0.5f) * 0.25f, 0.0f);
+		}
+		bvh.spheres.refit(getSphereBounds());
+		const std::vector<Sphere> orderedSpheres = bvh.spheres.reorder(spheres);
+		memcpy(compute.storageBuffers.spheres.mapped, orderedSpheres.data(), orderedSpheres.size() * sizeof(Sphere));
+		memcpy(compute.storageBuffers.sphereNodes.mapped, bvh.spheres.nodes.data(), bvh.spheres.nodes.size() * sizeof(vks::BVH::Node));
+	}
+
 	// Setup and fill the compute shader storage buffers containing primitives for the raytraced scene
 	void prepareStorageBuffers()
 	{
 		// Spheres
-		std::vector<Sphere> spheres;
 		spheres.push_back(newSphere(glm::vec3(1.75f, -0.5f, 0.0f), 1.0f, glm::vec3(0.0f, 1.0f, 0.0f), 32.0f));
 		spheres.push_back(newSphere(glm::vec3(0.0f, 1.0f, -0.5f), 1.0f, glm::vec3(0.65f, 0.77f, 0.97f), 32.0f));
 		spheres.push_back(newSphere(glm::vec3(-1.75f, -0.75f, -0.5f), 1.25f, glm::vec3(0.9f, 0.76f, 0.46f), 32.0f));
-		VkDeviceSize storageBufferSize = spheres.size() * sizeof(Sphere);
-
-		// Stage
-		vks::Buffer stagingBuffer;
+		// Ring of small spheres below the ceiling
+		const uint32_t ringSphereCount = 48;
+		for (uint32_t i = 0; i < ringSphereCount; i++) {
+			const float angle = glm::radians(360.0f * i / ringSphereCount);
+			const glm::vec3 color = glm::vec3(0.5f) + 0.5f * glm::vec3(cos(angle), cos(angle + 2.1f), cos(angle + 4.2f));
+			spheres.push_back(newSphere(glm::vec3(cos(angle) * 3.0f, 2.75f, sin(angle) * 3.0f), 0.2f, color, 64.0f));
+		}
+		for (const Sphere& sphere : spheres) {
+			sphereOrigins.push_back(sphere.pos);
+		}
+		// Spheres only move slightly, so the BVH is built once and refitted every frame
+		bvh.spheres.build(getSphereBounds());
 
-		vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		// Both are host visible as they're updated by the CPU every frame
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&stagingBuffer,
-			storageBufferSize,
-			spheres.data());
-
-		vulkanDevice->createBuffer(
-			// The SSBO will be used as a storage buffer for the compute pipeline and as a vertex buffer in the graphics pipeline
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 			&compute.storageBuffers.spheres,
-			storageBufferSize);
+			spheres.size() * sizeof(Sphere)));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&compute.storageBuffers.sphereNodes,
+			bvh.spheres.nodes.size() * sizeof(vks::BVH::Node)));
+		VK_CHECK_RESULT(compute.storageBuffers.spheres.map());
+		VK_CHECK_RESULT(compute.storageBuffers.sphereNodes.map());
+		updateSpheres();
 
-		// Copy to staging buffer
-		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		VkBufferCopy copyRegion = {};
-		copyRegion.size = storageBufferSize;
-		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffers.spheres.buffer, 1, &copyRegion);
-		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+		// Triangles
+		prepareTriangles();
 
-		stagingBuffer.destroy();
+		vks::Buffer stagingBuffer;
+		VkDeviceSize storageBufferSize;
+		VkCommandBuffer copyCmd;
+		VkBufferCopy copyRegion = {};
 
 		// Planes
 		std::vector<Plane> planes;
-		const float roomDim = 4.0f;
 		planes.push_back(newPlane(glm::vec3(0.0f, 1.0f, 0.0f), roomDim, glm::vec3(1.0f), 32.0f));
 		planes.push_back(newPlane(glm::vec3(0.0f, -1.0f, 0.0f), roomDim, glm::vec3(1.0f), 32.0f));
 		planes.push_back(newPlane(glm::vec3(0.0f, 0.0f, 1.0f), roomDim, glm::vec3(1.0f), 32.0f));
@@ -481,7 +677,7 @@ public:
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),			// Compute UBO
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4),	// Graphics image samplers
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),				// Storage image for ray traced image output
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2),			// Storage buffer for the scene primitives
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5),			// Storage buffers for the scene primitives and BVH nodes
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
@@ -625,6 +821,58 @@ public:
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
 	}
 
+	// Point the compute descriptors at the current buffers, the triangle buffers are recreated when the scene size changes
+	void updateComputeDescriptorSet()
+	{
+		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets =
+		{
+			// Binding 0: Output storage image
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+				0,
+				&textureComputeTarget.descriptor),
+			// Binding 1: Uniform buffer block
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				1,
+				&compute.uniformBuffer.descriptor),
+			// Binding 2: Shader storage buffer for the spheres
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				2,
+				&compute.storageBuffers.spheres.descriptor),
+			// Binding 2: Shader storage buffer for the planes
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				3,
+				&compute.storageBuffers.planes.descriptor),
+			// Binding 4: Shader storage buffer for the sphere BVH nodes
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				4,
+				&compute.storageBuffers.sphereNodes.descriptor),
+			// Binding 5: Shader storage buffer for the triangle BVH nodes
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				5,
+				&compute.storageBuffers.triangleNodes.descriptor),
+			// Binding 6: Shader storage buffer for the triangles
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				6,
+				&compute.storageBuffers.triangles.descriptor)
+		};
+
+		vkUpdateDescriptorSets(device, computeWriteDescriptorSets.size(), computeWriteDescriptorSets.data(), 0, NULL);
+	}
+
 	// Prepare the compute pipeline that generates the ray traced image
 	void prepareCompute()
 	{
@@ -659,7 +907,22 @@ public:
 			vks::initializers::descriptorSetLayoutBinding(
 				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 				VK_SHADER_STAGE_COMPUTE_BIT,
-				3)
+				3),
+			// Binding 4: Shader storage buffer for the sphere BVH nodes
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				4),
+			// Binding 5: Shader storage buffer for the triangle BVH nodes
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				5),
+			// Binding 6: Shader storage buffer for the triangles
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				6)
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout =
@@ -683,36 +946,7 @@ public:
 				1);
 
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &compute.descriptorSet));
-
-		std::vector<VkWriteDescriptorSet> computeWriteDescriptorSets =
-		{
-			// Binding 0: Output storage image
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-				0,
-				&textureComputeTarget.descriptor),
-			// Binding 1: Uniform buffer block
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				1,
-				&compute.uniformBuffer.descriptor),
-			// Binding 2: Shader storage buffer for the spheres
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				2,
-				&compute.storageBuffers.spheres.descriptor),
-			// Binding 2: Shader storage buffer for the planes
-			vks::initializers::writeDescriptorSet(
-				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-				3,
-				&compute.storageBuffers.planes.descriptor)
-		};
-
-		vkUpdateDescriptorSets(device, computeWriteDescriptorSets.size(), computeWriteDescriptorSets.data(), 0, NULL);
+		updateComputeDescriptorSet();
 
 		// Create compute shader pipelines
 		VkComputePipelineCreateInfo computePipelineCreateInfo =
@@ -723,6 +957,17 @@ public:
 		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computeraytracing/raytracing.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
 		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
 
+		// Timestamps for measuring the ray tracing performance, if the compute queue supports them
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.compute].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo{};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 2;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &compute.queryPool));
+			timing.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			timing.available = true;
+		}
+
 		// Separate command pool as queue family for compute may be different than graphics
 		VkCommandPoolCreateInfo cmdPoolInfo = {};
 		cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -778,11 +1023,24 @@ public:
 		vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX);
 		vkResetFences(device, 1, &compute.fence);
 
+		// Timestamps of the previous dispatch are available once its fence has been signaled
+		if (timing.available && timing.written) {
+			uint64_t timestamps[2];
+			if (vkGetQueryPoolResults(device, compute.queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				const double dispatchTime = (double)(timestamps[1] - timestamps[0]) * timing.timestampPeriod / 1000000.0;
+				timing.dispatchTime = (timing.dispatchTime == 0.0) ? dispatchTime : timing.dispatchTime * 0.95 + dispatchTime * 0.05;
+			}
+		}
+
+		// The sphere buffers are no longer in use by the compute queue
+		updateSpheres();
+
 		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
 		computeSubmitInfo.commandBufferCount = 1;
 		computeSubmitInfo.pCommandBuffers = &compute.commandBuffer;
 
 		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, compute.fence));
+		timing.written = true;
 		
 		VulkanExampleBase::prepareFrame();
 
@@ -794,9 +1052,63 @@ public:
 		VulkanExampleBase::submitFrame();		
 	}
 
+	// Compare serial and parallel BVH builds and measure the CPU traversal for increasing triangle counts
+	void runBVHBenchmark()
+	{
+		const std::vector<uint32_t> triangleCounts = { 10000, 100000, 250000, 1000000 };
+		const uint32_t rayCount = 100000;
+		std::mt19937 rng(0);
+		std::uniform_real_distribution<float> distribution(-roomDim, roomDim);
+		std::cout << "BVH benchmark (" << std::thread::hardware_concurrency() << " hardware threads, " << rayCount << " rays per scene)\n";
+		std::cout << std::fixed << std::setprecision(2);
+		for (uint32_t targetCount : triangleCounts) {
+			const std::vector<Triangle> triangles = generateTriangles(targetCount);
+			const std::vector<vks::AABB> bounds = getTriangleBounds(triangles);
+			vks::BVH serialBVH;
+			serialBVH.settings.threadCount = 1;
+			serialBVH.build(bounds);
+			vks::BVH parallelBVH;
+			parallelBVH.build(bounds);
+			parallelBVH.refit(bounds);
+			const std::vector<Triangle> orderedTriangles = parallelBVH.reorder(triangles);
+
+			// Rays from the default camera position towards random points on the floor covered by the meshes
+			const glm::vec3 origin = glm::vec3(0.0f, 0.0f, roomDim);
+			uint32_t hits = 0;
+			auto tStart = std::chrono::high_resolution_clock::now();
+			for (uint32_t i = 0; i < rayCount; i++) {
+				const glm::vec3 direction = glm::normalize(glm::vec3(distribution(rng), -roomDim, distribution(rng)) - origin);
+				float tMax = 1000.0f;
+				const uint32_t hit = parallelBVH.traverse(origin, direction, tMax, [&](uint32_t index, float& t) {
+					const float tTriangle = intersectTriangle(orderedTriangles[index], origin, direction);
+					if ((tTriangle > 0.0001f) && (tTriangle < t)) {
+						t = tTriangle;
+						return true;
+					}
+					return false;
+				});
+				if (hit != UINT32_MAX) {
+					hits++;
+				}
+			}
+			const double traceTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+			std::cout << triangles.size() << " triangles: ";
+			std::cout << "build " << serialBVH.statistics.buildTime << " ms serial, " << parallelBVH.statistics.buildTime << " ms parallel (" << serialBVH.statistics.buildTime / parallelBVH.statistics.buildTime << "x), ";
+			std::cout << "refit " << parallelBVH.statistics.refitTime << " ms, ";
+			std::cout << parallelBVH.statistics.nodeCount << " nodes, depth " << parallelBVH.statistics.depth << ", SAH cost " << parallelBVH.statistics.sahCost << ", ";
+			std::cout << (double)rayCount / traceTime / 1000.0 << " Mrays/s on one thread (" << hits * 100 / rayCount << "% hits)\n";
+		}
+	}
+
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
+		// The triangles for the BVH are taken from the host copy of the mesh
+		model.loadFromFile(getAssetPath() + "models/chinesedragon.gltf", vulkanDevice, queue, vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::KeepHostData);
+		if (commandLineParser.isSet("bvhbenchmark")) {
+			runBVHBenchmark();
+		}
 		prepareTextureTarget(&textureComputeTarget, TEX_DIM, TEX_DIM, VK_FORMAT_R8G8B8A8_UNORM);
 		prepareStorageBuffers();
 		prepareUniformBuffers();
@@ -825,6 +1137,32 @@ public:
 		compute.ubo.aspectRatio = (float)width / (float)height;
 		updateUniformBuffers();
 	}
+
+	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
+	{
+		if (overlay->header("Settings")) {
+			if (overlay->comboBox("Scene", &sceneSize, sceneSizeNames)) {
+				vkQueueWaitIdle(compute.queue);
+				vkQueueWaitIdle(queue);
+				prepareTriangles();
+				updateComputeDescriptorSet();
+				// Updating the descriptor set invalidates the compute command buffer that uses it
+				buildComputeCommandBuffer();
+			}
+		}
+		if (overlay->header("BVH")) {
+			overlay->text("Triangles: %u", triangleCount);
+			overlay->text("Nodes: %u (depth %u)", bvh.triangles.statistics.nodeCount, bvh.triangles.statistics.depth);
+			overlay->text("SAH cost: %.1f", bvh.triangles.statistics.sahCost);
+			overlay->text("Build: %.1f ms", bvh.triangles.statistics.buildTime);
+			overlay->text("Sphere refit: %.3f ms", bvh.spheres.statistics.refitTime);
+			if (timing.available && (timing.dispatchTime > 0.0)) {
+				overlay->text("Ray tracing: %.2f ms", timing.dispatchTime);
+				// Not every pixel traces all rays, so this is an upper bound
+				overlay->text("Up to %.0f Mrays/s", (double)TEX_DIM * TEX_DIM * RAYS_PER_PIXEL / timing.dispatchTime / 1000.0);
+			}
+		}
+	}
 };
 
 VULKAN_EXAMPLE_MAIN()
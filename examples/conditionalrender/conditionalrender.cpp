@@ -40,6 +40,11 @@ public:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSet descriptorSet;
 
+	struct PushConstants {
+		glm::vec4 baseColorFactor;
+		uint32_t meshIndex;
+	};
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		title = "Conditional rendering";
@@ -67,13 +72,9 @@ public:
 	void renderNode(vkglTF::Node *node, VkCommandBuffer commandBuffer) {
 		if (node->mesh) {
 			for (vkglTF::Primitive * primitive : node->mesh->primitives) {
-				const std::vector<VkDescriptorSet> descriptorsets = {
-					descriptorSet,
-					node->mesh->uniformBuffer.descriptorSet
-				};
-				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorsets.size()), descriptorsets.data(), 0, NULL);
-
-				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(primitive->material.baseColorFactor), &primitive->material.baseColorFactor);
+				// The node matrix is fetched from the model's node buffer using the mesh index
+				PushConstants pushConstants{ primitive->material.baseColorFactor, node->mesh->index };
+				vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pushConstants);
 
 				/*
 					[POI] Setup the conditional rendering
@@ -132,6 +133,8 @@ public:
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+			// Node matrices of all meshes, each command buffer uses its own copy
+			scene.bindNodeBuffer(drawCmdBuffers[i], pipelineLayout, 1, i);
 
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
@@ -152,6 +155,8 @@ public:
 
 	void loadAssets()
 	{
+		// One copy of the node buffer per command buffer, so the copy for the next frame can be updated while the others are in use
+		vkglTF::nodeBufferFrameCount = static_cast<uint32_t>(drawCmdBuffers.size());
 		scene.loadFromFile(getAssetPath() + "models/gltf/glTF-Embedded/Buggy.gltf", vulkanDevice, queue);
 	}
 
@@ -173,10 +178,10 @@ public:
 		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayoutCI, nullptr, &descriptorSetLayout));
 
 		std::array<VkDescriptorSetLayout, 2> setLayouts = {
-			descriptorSetLayout, vkglTF::descriptorSetLayoutUbo
+			descriptorSetLayout, vkglTF::descriptorSetLayoutNodes
 		};
 		VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(setLayouts.data(), 2);
-		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::vec4),	0);
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(PushConstants), 0);
 		pipelineLayoutCI.pushConstantRangeCount = 1;
 		pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayout));
@@ -297,6 +302,8 @@ public:
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
+		// Only copies and flushes node data that changed since this command buffer was last submitted
+		scene.updateNodeBuffer(currentBuffer);
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
@@ -1,6 +1,9 @@
 /*
 * Vulkan Example - Deferred shading with multiple render targets (aka G-Buffer) example
 *
+* Optionally shades thousands of lights from a storage buffer, with a compute pass assigning the lights to clusters
+* A visibility buffer mode replaces the G-Buffer with a single packed object/triangle id per pixel and reconstructs the attributes in the resolve
+*
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
@@ -8,21 +11,39 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "VulkanRenderGraph.h"
 
 #define ENABLE_VALIDATION false
 
-// Texture properties
-#define TEX_DIM 2048
-#define TEX_FILTER VK_FILTER_LINEAR
-
-// Offscreen frame buffer properties
-#define FB_DIM TEX_DIM
+// Clustered lighting uses a fixed grid of screen tiles and exponential depth slices, must match the shaders
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_LIGHTS_PER_CLUSTER 256
+// Size of the compact light index list shared by all clusters
+#define LIGHT_INDEX_CAPACITY (CLUSTER_COUNT * 128)
+#define MAX_LIGHTS 4096
+// Lights of the storage buffer paths are cut off where their attenuation drops below this value
+#define LIGHT_CUTOFF 0.02f
 
 class VulkanExample : public VulkanExampleBase
 {
 public:
 	int32_t debugDisplayTarget = 0;
 
+	// The uniform block path shades the six scene lights for every pixel, the storage buffer paths scale to thousands of lights
+	enum LightingMode { LightingUniformBlock = 0, LightingAllLights = 1, LightingClustered = 2 };
+	int32_t lightingMode = LightingClustered;
+	std::vector<uint32_t> lightCounts = { 6, 64, 256, 1024, 2048, 4096 };
+	int32_t lightCountIndex = 3;
+
+	// The G-Buffer path writes position, normal and albedo per pixel, the visibility buffer path only writes an object and triangle id
+	enum GeometryMode { GeometryGBuffer = 0, GeometryVisibility = 1 };
+	int32_t geometryMode = GeometryGBuffer;
+	// Reading gl_PrimitiveID in the fragment shader requires the geometry shader feature
+	bool visibilityBufferSupported = false;
+
 	struct {
 		struct {
 			vks::Texture2D colorMap;
@@ -58,16 +79,51 @@ public:
 		int debugDisplayTarget = 0;
 	} uboComposition;
 
+	// Parameters of the storage buffer paths, shared by the light culling and the composition
+	struct {
+		glm::mat4 view;
+		// x = projection[0][0], y = projection[1][1], z = near plane, w = far plane
+		glm::vec4 projectionParams;
+		glm::vec4 viewPos;
+		uint32_t lightCount;
+		uint32_t screenWidth;
+		uint32_t screenHeight;
+		int32_t debugDisplayTarget;
+	} uboLighting;
+
+	// The first lights are the animated scene lights, the rest are generated once
+	// The w component of the position is the range used for culling
+	std::vector<Light> lights;
+
 	struct {
 		vks::Buffer offscreen;
 		vks::Buffer composition;
+		vks::Buffer lighting;
 	} uniformBuffers;
 
+	struct {
+		vks::Buffer lights;
+		// Offset into the light index list and light count per cluster
+		vks::Buffer clusters;
+		vks::Buffer lightIndices;
+		vks::Buffer lightIndexCounter;
+	} storageBuffers;
+
 	struct {
 		VkPipeline offscreen;
 		VkPipeline composition;
+		VkPipeline compositionAllLights;
+		VkPipeline compositionClustered;
+		VkPipeline lightCulling;
+		VkPipeline visibilityResolve;
+		VkPipeline visibilityResolveAllLights;
+		VkPipeline visibilityResolveClustered;
+		// Created on first use, as it needs the render pass of the visibility buffer pass
+		VkPipeline visibility = VK_NULL_HANDLE;
 	} pipelines;
 	VkPipelineLayout pipelineLayout;
+	// Set 0 is shared with the other pipelines, set 1 contains the visibility buffer and the vertex data of the models
+	VkPipelineLayout visibilityPipelineLayout;
 
 	struct {
 		VkDescriptorSet model;
@@ -76,29 +132,59 @@ public:
 
 	VkDescriptorSet descriptorSet;
 	VkDescriptorSetLayout descriptorSetLayout;
+	VkDescriptorSet visibilityDescriptorSet;
+	VkDescriptorSetLayout visibilityDescriptorSetLayout;
 
-	// Framebuffer for offscreen rendering
-	struct FrameBufferAttachment {
-		VkImage image;
-		VkDeviceMemory mem;
-		VkImageView view;
-		VkFormat format;
-	};
-	struct FrameBuffer {
-		int32_t width, height;
-		VkFramebuffer frameBuffer;
-		FrameBufferAttachment position, normal, albedo;
-		FrameBufferAttachment depth;
-		VkRenderPass renderPass;
-	} offScreenFrameBuf;
+	// The G-Buffer images, render passes and barriers are owned by the render graph
+	vks::RenderGraph renderGraph;
+	struct {
+		vks::RenderGraph::Resource position, normal, albedo, depth;
+	} gBuffer;
+	vks::RenderGraph::Pass* gBufferPass = nullptr;
+	// Object index in the upper 8 bits and triangle index in the lower 24 bits
+	struct {
+		vks::RenderGraph::Resource ids, depth;
+	} visibilityBuffer;
+	vks::RenderGraph::Pass* visibilityPass = nullptr;
+	// Swap chain framebuffer the composition pass renders to, set before executing the graph
+	VkFramebuffer compositionFramebuffer = VK_NULL_HANDLE;
 
 	// One sampler for the frame buffer color attachments
 	VkSampler colorSampler;
 
-	VkCommandBuffer offScreenCmdBuffer = VK_NULL_HANDLE;
-
-	// Semaphore used to synchronize between offscreen and final scene rendering
-	VkSemaphore offscreenSemaphore = VK_NULL_HANDLE;
+	// Timestamps are written at the start of the frame, after the light culling, around the composition draw and at the end of the frame
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		double cullingTime = 0.0;
+		double geometryTime = 0.0;
+		double lightingTime = 0.0;
+		double frameTime = 0.0;
+	} timing;
+
+	// Sweeps the light count with and without clustering for both geometry modes at the current resolution
+	struct BenchmarkResult {
+		uint32_t lightCount;
+		int32_t lightingMode;
+		int32_t geometryMode;
+		double cullingTime;
+		double geometryTime;
+		double lightingTime;
+		double frameTime;
+	};
+	struct {
+		bool active = false;
+		uint32_t step = 0;
+		uint32_t frame = 0;
+		double cullingTime = 0.0;
+		double geometryTime = 0.0;
+		double lightingTime = 0.0;
+		double frameTime = 0.0;
+		std::vector<BenchmarkResult> results;
+	} lightBenchmark;
+	const uint32_t benchmarkWarmupFrames = 16;
+	const uint32_t benchmarkFrames = 64;
 
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
@@ -120,47 +206,46 @@ public:
 
 		vkDestroySampler(device, colorSampler, nullptr);
 
-		// Frame buffer
-
-		// Color attachments
-		vkDestroyImageView(device, offScreenFrameBuf.position.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.position.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.position.mem, nullptr);
-
-		vkDestroyImageView(device, offScreenFrameBuf.normal.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.normal.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.normal.mem, nullptr);
-
-		vkDestroyImageView(device, offScreenFrameBuf.albedo.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.albedo.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.albedo.mem, nullptr);
-
-		// Depth attachment
-		vkDestroyImageView(device, offScreenFrameBuf.depth.view, nullptr);
-		vkDestroyImage(device, offScreenFrameBuf.depth.image, nullptr);
-		vkFreeMemory(device, offScreenFrameBuf.depth.mem, nullptr);
-
-		vkDestroyFramebuffer(device, offScreenFrameBuf.frameBuffer, nullptr);
+		renderGraph.destroy();
 
 		vkDestroyPipeline(device, pipelines.composition, nullptr);
+		vkDestroyPipeline(device, pipelines.compositionAllLights, nullptr);
+		vkDestroyPipeline(device, pipelines.compositionClustered, nullptr);
+		vkDestroyPipeline(device, pipelines.lightCulling, nullptr);
 		vkDestroyPipeline(device, pipelines.offscreen, nullptr);
+		if (pipelines.visibility != VK_NULL_HANDLE) {
+			vkDestroyPipeline(device, pipelines.visibility, nullptr);
+		}
+		if (visibilityBufferSupported) {
+			vkDestroyPipeline(device, pipelines.visibilityResolve, nullptr);
+			vkDestroyPipeline(device, pipelines.visibilityResolveAllLights, nullptr);
+			vkDestroyPipeline(device, pipelines.visibilityResolveClustered, nullptr);
+		}
 
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyPipelineLayout(device, visibilityPipelineLayout, nullptr);
 
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, visibilityDescriptorSetLayout, nullptr);
 
 		// Uniform buffers
 		uniformBuffers.offscreen.destroy();
 		uniformBuffers.composition.destroy();
+		uniformBuffers.lighting.destroy();
 
-		vkDestroyRenderPass(device, offScreenFrameBuf.renderPass, nullptr);
+		storageBuffers.lights.destroy();
+		storageBuffers.clusters.destroy();
+		storageBuffers.lightIndices.destroy();
+		storageBuffers.lightIndexCounter.destroy();
+
+		if (timing.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timing.queryPool, nullptr);
+		}
 
 		textures.model.colorMap.destroy();
 		textures.model.normalMap.destroy();
 		textures.floor.colorMap.destroy();
 		textures.floor.normalMap.destroy();
-
-		vkDestroySemaphore(device, offscreenSemaphore, nullptr);
 	}
 
 	// Enable physical device features required for this example
@@ -170,198 +255,170 @@ public:
 		if (deviceFeatures.samplerAnisotropy) {
 			enabledFeatures.samplerAnisotropy = VK_TRUE;
 		}
+		// The visibility buffer pass writes gl_PrimitiveID, which requires geometry shader support
+		if (deviceFeatures.geometryShader) {
+			enabledFeatures.geometryShader = VK_TRUE;
+			visibilityBufferSupported = true;
+		}
 	};
 
-	// Create a frame buffer attachment
-	void createAttachment(
-		VkFormat format,
-		VkImageUsageFlagBits usage,
-		FrameBufferAttachment *attachment)
+	/*
+		The render graph creates the G-Buffer images at the size of the window, derives the layout transitions and barriers between
+		filling the G-Buffer and the composition, and only keeps the depth attachment within the G-Buffer render pass (it's never stored)
+	*/
+	void buildRenderGraph()
 	{
-		VkImageAspectFlags aspectMask = 0;
-		VkImageLayout imageLayout;
+		renderGraph.reset();
+		renderGraph.setExtent(width, height);
 
-		attachment->format = format;
+		// Find a suitable depth format
+		VkFormat attDepthFormat;
+		VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &attDepthFormat);
+		assert(validDepthFormat);
 
-		if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
-		{
-			aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		if (geometryMode == GeometryVisibility) {
+			addVisibilityPass(attDepthFormat);
+		} else {
+			addGBufferPass(attDepthFormat);
 		}
-		if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
-		{
-			aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-			if (format >= VK_FORMAT_D16_UNORM_S8_UINT)
-				aspectMask |=VK_IMAGE_ASPECT_STENCIL_BIT;
-			imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		// Final composition into the swap chain, which is outside of the graph, so the pass is marked as having side effects
+		vks::RenderGraph::Pass& compositionPass = renderGraph.addPass("Composition");
+		if (geometryMode == GeometryVisibility) {
+			compositionPass.addSampledInput(visibilityBuffer.ids);
+		} else {
+			compositionPass.addSampledInput(gBuffer.position);
+			compositionPass.addSampledInput(gBuffer.normal);
+			compositionPass.addSampledInput(gBuffer.albedo);
 		}
+		compositionPass.setSideEffect();
+		compositionPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+			VkClearValue clearValues[2];
+			clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 0.0f } };
+			clearValues[1].depthStencil = { 1.0f, 0 };
+
+			VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+			renderPassBeginInfo.renderPass = renderPass;
+			renderPassBeginInfo.framebuffer = compositionFramebuffer;
+			renderPassBeginInfo.renderArea.offset.x = 0;
+			renderPassBeginInfo.renderArea.offset.y = 0;
+			renderPassBeginInfo.renderArea.extent.width = width;
+			renderPassBeginInfo.renderArea.extent.height = height;
+			renderPassBeginInfo.clearValueCount = 2;
+			renderPassBeginInfo.pClearValues = clearValues;
+
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-		assert(aspectMask > 0);
-
-		VkImageCreateInfo image = vks::initializers::imageCreateInfo();
-		image.imageType = VK_IMAGE_TYPE_2D;
-		image.format = format;
-		image.extent.width = offScreenFrameBuf.width;
-		image.extent.height = offScreenFrameBuf.height;
-		image.extent.depth = 1;
-		image.mipLevels = 1;
-		image.arrayLayers = 1;
-		image.samples = VK_SAMPLE_COUNT_1_BIT;
-		image.tiling = VK_IMAGE_TILING_OPTIMAL;
-		image.usage = usage | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		VkMemoryRequirements memReqs;
-
-		VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &attachment->image));
-		vkGetImageMemoryRequirements(device, attachment->image, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &attachment->mem));
-		VK_CHECK_RESULT(vkBindImageMemory(device, attachment->image, attachment->mem, 0));
-
-		VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
-		imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		imageView.format = format;
-		imageView.subresourceRange = {};
-		imageView.subresourceRange.aspectMask = aspectMask;
-		imageView.subresourceRange.baseMipLevel = 0;
-		imageView.subresourceRange.levelCount = 1;
-		imageView.subresourceRange.baseArrayLayer = 0;
-		imageView.subresourceRange.layerCount = 1;
-		imageView.image = attachment->image;
-		VK_CHECK_RESULT(vkCreateImageView(device, &imageView, nullptr, &attachment->view));
-	}
-
-	// Prepare a new framebuffer and attachments for offscreen rendering (G-Buffer)
-	void prepareOffscreenFramebuffer()
-	{
-		offScreenFrameBuf.width = FB_DIM;
-		offScreenFrameBuf.height = FB_DIM;
-
-		// Color attachments
+			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-		// (World space) Positions
-		createAttachment(
-			VK_FORMAT_R16G16B16A16_SFLOAT,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-			&offScreenFrameBuf.position);
+			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		// (World space) Normals
-		createAttachment(
-			VK_FORMAT_R16G16B16A16_SFLOAT,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-			&offScreenFrameBuf.normal);
+			if (timing.available) {
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 2);
+			}
 
-		// Albedo (color)
-		createAttachment(
-			VK_FORMAT_R8G8B8A8_UNORM,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-			&offScreenFrameBuf.albedo);
+			if (geometryMode == GeometryVisibility) {
+				// The resolve reconstructs the attributes of the visible triangle and shades it with the same lighting as the composition
+				VkDescriptorSet sets[] = { descriptorSet, visibilityDescriptorSet };
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipelineLayout, 0, 2, sets, 0, nullptr);
+				VkPipeline resolvePipelines[] = { pipelines.visibilityResolve, pipelines.visibilityResolveAllLights, pipelines.visibilityResolveClustered };
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, resolvePipelines[lightingMode]);
+			} else {
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+				VkPipeline compositionPipelines[] = { pipelines.composition, pipelines.compositionAllLights, pipelines.compositionClustered };
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, compositionPipelines[lightingMode]);
+			}
+			// Final composition as full screen quad
+			// Note: Also used for debug display if debugDisplayTarget > 0
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
-		// Depth attachment
+			if (timing.available) {
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 3);
+			}
 
-		// Find a suitable depth format
-		VkFormat attDepthFormat;
-		VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &attDepthFormat);
-		assert(validDepthFormat);
+			drawUI(commandBuffer);
 
-		createAttachment(
-			attDepthFormat,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-			&offScreenFrameBuf.depth);
+			vkCmdEndRenderPass(commandBuffer);
+		});
 
-		// Set up separate renderpass with references to the color and depth attachments
-		std::array<VkAttachmentDescription, 4> attachmentDescs = {};
+		renderGraph.compile();
+	}
 
-		// Init attachment properties
-		for (uint32_t i = 0; i < 4; ++i)
-		{
-			attachmentDescs[i].samples = VK_SAMPLE_COUNT_1_BIT;
-			attachmentDescs[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			attachmentDescs[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-			attachmentDescs[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-			attachmentDescs[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			if (i == 3)
-			{
-				attachmentDescs[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				attachmentDescs[i].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-			}
-			else
-			{
-				attachmentDescs[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				attachmentDescs[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			}
-		}
+	void addGBufferPass(VkFormat depthFormat)
+	{
+		// (World space) Positions
+		gBuffer.position = renderGraph.createImage("Position", VK_FORMAT_R16G16B16A16_SFLOAT);
+		// (World space) Normals
+		gBuffer.normal = renderGraph.createImage("Normals", VK_FORMAT_R16G16B16A16_SFLOAT);
+		// Albedo (color)
+		gBuffer.albedo = renderGraph.createImage("Albedo", VK_FORMAT_R8G8B8A8_UNORM);
+		gBuffer.depth = renderGraph.createImage("Depth", depthFormat);
+
+		// Fill the G-Buffer
+		vks::RenderGraph::Pass& offscreenPass = renderGraph.addPass("G-Buffer");
+		offscreenPass.addColorOutput(gBuffer.position);
+		offscreenPass.addColorOutput(gBuffer.normal);
+		offscreenPass.addColorOutput(gBuffer.albedo);
+		offscreenPass.setDepthStencilOutput(gBuffer.depth);
+		offscreenPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.offscreen);
+
+			// Background
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.floor, 0, nullptr);
+			models.floor.draw(commandBuffer);
+
+			// Instanced object
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.model, 0, nullptr);
+			models.model.bindBuffers(commandBuffer);
+			vkCmdDrawIndexed(commandBuffer, models.model.indices.count, 3, 0, 0, 0);
+		});
+		gBufferPass = &offscreenPass;
+		visibilityPass = nullptr;
+	}
 
-		// Formats
-		attachmentDescs[0].format = offScreenFrameBuf.position.format;
-		attachmentDescs[1].format = offScreenFrameBuf.normal.format;
-		attachmentDescs[2].format = offScreenFrameBuf.albedo.format;
-		attachmentDescs[3].format = offScreenFrameBuf.depth.format;
-
-		std::vector<VkAttachmentReference> colorReferences;
-		colorReferences.push_back({ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-		colorReferences.push_back({ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-		colorReferences.push_back({ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-
-		VkAttachmentReference depthReference = {};
-		depthReference.attachment = 3;
-		depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.pColorAttachments = colorReferences.data();
-		subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
-		subpass.pDepthStencilAttachment = &depthReference;
-
-		// Use subpass dependencies for attachment layout transitions
-		std::array<VkSubpassDependency, 2> dependencies;
-
-		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-		dependencies[0].dstSubpass = 0;
-		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-		dependencies[1].srcSubpass = 0;
-		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-		VkRenderPassCreateInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		renderPassInfo.pAttachments = attachmentDescs.data();
-		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentDescs.size());
-		renderPassInfo.subpassCount = 1;
-		renderPassInfo.pSubpasses = &subpass;
-		renderPassInfo.dependencyCount = 2;
-		renderPassInfo.pDependencies = dependencies.data();
-
-		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &offScreenFrameBuf.renderPass));
-
-		std::array<VkImageView,4> attachments;
-		attachments[0] = offScreenFrameBuf.position.view;
-		attachments[1] = offScreenFrameBuf.normal.view;
-		attachments[2] = offScreenFrameBuf.albedo.view;
-		attachments[3] = offScreenFrameBuf.depth.view;
-
-		VkFramebufferCreateInfo fbufCreateInfo = {};
-		fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		fbufCreateInfo.pNext = NULL;
-		fbufCreateInfo.renderPass = offScreenFrameBuf.renderPass;
-		fbufCreateInfo.pAttachments = attachments.data();
-		fbufCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-		fbufCreateInfo.width = offScreenFrameBuf.width;
-		fbufCreateInfo.height = offScreenFrameBuf.height;
-		fbufCreateInfo.layers = 1;
-		VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &offScreenFrameBuf.frameBuffer));
+	/*
+		The visibility buffer only stores which triangle of which object is visible (4 bytes per pixel instead of 20 for the G-Buffer)
+		Vertices are pre-transformed, so each model is drawn with a single indexed draw and gl_PrimitiveID is the triangle's index in the model's index buffer
+	*/
+	void addVisibilityPass(VkFormat depthFormat)
+	{
+		visibilityBuffer.ids = renderGraph.createImage("Visibility", VK_FORMAT_R32_UINT);
+		visibilityBuffer.depth = renderGraph.createImage("Depth", depthFormat);
+
+		// Pixels not covered by any triangle keep the clear value and are skipped by the resolve
+		VkClearColorValue emptyPixel;
+		emptyPixel.uint32[0] = 0xFFFFFFFF;
+		emptyPixel.uint32[1] = 0;
+		emptyPixel.uint32[2] = 0;
+		emptyPixel.uint32[3] = 0;
+
+		vks::RenderGraph::Pass& pass = renderGraph.addPass("Visibility");
+		pass.addColorOutput(visibilityBuffer.ids, VK_ATTACHMENT_LOAD_OP_CLEAR, emptyPixel);
+		pass.setDepthStencilOutput(visibilityBuffer.depth);
+		pass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.visibility);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+			// Background is object 0
+			uint32_t objectOffset = 0;
+			vkCmdPushConstants(commandBuffer, visibilityPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &objectOffset);
+			models.floor.bindBuffers(commandBuffer);
+			vkCmdDrawIndexed(commandBuffer, models.floor.indices.count, 1, 0, 0, 0);
+
+			// Instances of the model are objects 1 to 3
+			objectOffset = 1;
+			vkCmdPushConstants(commandBuffer, visibilityPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &objectOffset);
+			models.model.bindBuffers(commandBuffer);
+			vkCmdDrawIndexed(commandBuffer, models.model.indices.count, 3, 0, 0, 0);
+		});
+		visibilityPass = &pass;
+		gBufferPass = nullptr;
+	}
 
+	void prepareSampler()
+	{
 		// Create sampler to sample from the color attachments
 		VkSamplerCreateInfo sampler = vks::initializers::samplerCreateInfo();
 		sampler.magFilter = VK_FILTER_NEAREST;
@@ -378,64 +435,11 @@ public:
 		VK_CHECK_RESULT(vkCreateSampler(device, &sampler, nullptr, &colorSampler));
 	}
 
-	// Build command buffer for rendering the scene to the offscreen frame buffer attachments
-	void buildDeferredCommandBuffer()
-	{
-		if (offScreenCmdBuffer == VK_NULL_HANDLE)
-		{
-			offScreenCmdBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
-		}
-
-		// Create a semaphore used to synchronize offscreen rendering and usage
-		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &offscreenSemaphore));
-
-		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
-
-		// Clear values for all attachments written in the fragment shader
-		std::array<VkClearValue,4> clearValues;
-		clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
-		clearValues[1].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
-		clearValues[2].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
-		clearValues[3].depthStencil = { 1.0f, 0 };
-
-		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-		renderPassBeginInfo.renderPass =  offScreenFrameBuf.renderPass;
-		renderPassBeginInfo.framebuffer = offScreenFrameBuf.frameBuffer;
-		renderPassBeginInfo.renderArea.extent.width = offScreenFrameBuf.width;
-		renderPassBeginInfo.renderArea.extent.height = offScreenFrameBuf.height;
-		renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassBeginInfo.pClearValues = clearValues.data();
-
-		VK_CHECK_RESULT(vkBeginCommandBuffer(offScreenCmdBuffer, &cmdBufInfo));
-
-		vkCmdBeginRenderPass(offScreenCmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-		VkViewport viewport = vks::initializers::viewport((float)offScreenFrameBuf.width, (float)offScreenFrameBuf.height, 0.0f, 1.0f);
-		vkCmdSetViewport(offScreenCmdBuffer, 0, 1, &viewport);
-
-		VkRect2D scissor = vks::initializers::rect2D(offScreenFrameBuf.width, offScreenFrameBuf.height, 0, 0);
-		vkCmdSetScissor(offScreenCmdBuffer, 0, 1, &scissor);
-
-		vkCmdBindPipeline(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.offscreen);
-
-		// Background
-		vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.floor, 0, nullptr);
-		models.floor.draw(offScreenCmdBuffer);
-
-		// Instanced object
-		vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.model, 0, nullptr);
-		models.model.bindBuffers(offScreenCmdBuffer);
-		vkCmdDrawIndexed(offScreenCmdBuffer, models.model.indices.count, 3, 0, 0, 0);
-
-		vkCmdEndRenderPass(offScreenCmdBuffer);
-
-		VK_CHECK_RESULT(vkEndCommandBuffer(offScreenCmdBuffer));
-	}
-
 	void loadAssets()
 	{
 		const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::PreMultiplyVertexColors | vkglTF::FileLoadingFlags::FlipY;
+		// The visibility buffer resolve reads the vertex and index buffers as storage buffers
+		vkglTF::memoryPropertyFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 		models.model.loadFromFile(getAssetPath() + "models/armor/armor.gltf", vulkanDevice, queue, glTFLoadingFlags);
 		models.floor.loadFromFile(getAssetPath() + "models/deferred_floor.gltf", vulkanDevice, queue, glTFLoadingFlags);
 		textures.model.colorMap.loadFromFile(getAssetPath() + "models/armor/colormap_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
@@ -448,56 +452,70 @@ public:
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-		VkClearValue clearValues[2];
-		clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 0.0f } };
-		clearValues[1].depthStencil = { 1.0f, 0 };
-
-		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-		renderPassBeginInfo.renderPass = renderPass;
-		renderPassBeginInfo.renderArea.offset.x = 0;
-		renderPassBeginInfo.renderArea.offset.y = 0;
-		renderPassBeginInfo.renderArea.extent.width = width;
-		renderPassBeginInfo.renderArea.extent.height = height;
-		renderPassBeginInfo.clearValueCount = 2;
-		renderPassBeginInfo.pClearValues = clearValues;
-
 		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
 		{
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+			if (timing.available) {
+				vkCmdResetQueryPool(drawCmdBuffers[i], timing.queryPool, 0, 5);
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timing.queryPool, 0);
+			}
 
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+			// Light culling only depends on the lights and the camera, so it runs before the G-Buffer is filled
+			if (lightingMode == LightingClustered) {
+				buildLightCullingCommands(drawCmdBuffers[i]);
+			}
 
-   			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.composition);
-			// Final composition as full screen quad
-			// Note: Also used for debug display if debugDisplayTarget > 0
-			vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 1);
+			}
 
-			drawUI(drawCmdBuffers[i]);
+			// Records the G-Buffer (or visibility buffer) and composition passes, including all barriers between them
+			compositionFramebuffer = frameBuffers[i];
+			renderGraph.execute(drawCmdBuffers[i]);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 4);
+			}
 
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
 
+	/*
+		Assigns the lights to clusters (screen tiles x exponential depth slices) with one workgroup per cluster
+		The light indices of all clusters are packed into a single list, so the composition only loops over the lights of its cluster
+	*/
+	void buildLightCullingCommands(VkCommandBuffer commandBuffer)
+	{
+		vkCmdFillBuffer(commandBuffer, storageBuffers.lightIndexCounter.buffer, 0, sizeof(uint32_t), 0);
+
+		// The reset has to be visible to the culling, which also must not overwrite the lists before the previous composition has read them
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.lightCulling);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+		vkCmdDispatch(commandBuffer, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
 	void setupDescriptorPool()
 	{
+		// Composition, model and floor sets use the shared layout with 3 uniform buffers, 3 images and 4 storage buffers each
+		// The visibility buffer set adds 5 images and 4 storage buffers
 		std::vector<VkDescriptorPoolSize> poolSizes = {
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 9),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 14),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 16)
 		};
 
-		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 3);
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 4);
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
 
@@ -505,8 +523,8 @@ public:
 	{
 		// Deferred shading layout
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-			// Binding 0 : Vertex shader uniform buffer
-			vks::initializers::descriptorSetLayoutBinding( VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+			// Binding 0 : Vertex shader uniform buffer, also read by the visibility buffer resolve
+			vks::initializers::descriptorSetLayoutBinding( VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0),
 			// Binding 1 : Position texture target / Scene colormap
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
 			// Binding 2 : Normals texture target
@@ -515,6 +533,16 @@ public:
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 3),
 			// Binding 4 : Fragment shader uniform buffer
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 4),
+			// Binding 5 : Storage buffer lighting parameters
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 5),
+			// Binding 6 : Lights
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 6),
+			// Binding 7 : Cluster grid
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 7),
+			// Binding 8 : Light index list
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, 8),
+			// Binding 9 : Light index list counter
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 9),
 		};
 
 		VkDescriptorSetLayoutCreateInfo descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
@@ -523,35 +551,75 @@ public:
 		// Shared pipeline layout used by all pipelines
 		VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+		// Visibility buffer layout
+		setLayoutBindings = {
+			// Binding 0 : Visibility buffer
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+			// Binding 1 : Floor vertices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+			// Binding 2 : Floor indices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+			// Binding 3 : Model vertices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 3),
+			// Binding 4 : Model indices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 4),
+			// Binding 5 : Floor color map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 5),
+			// Binding 6 : Floor normal map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 6),
+			// Binding 7 : Model color map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 7),
+			// Binding 8 : Model normal map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 8),
+		};
+		descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &visibilityDescriptorSetLayout));
+
+		// The visibility buffer pass passes the object index of the first instance of a draw as a push constant
+		std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, visibilityDescriptorSetLayout };
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(uint32_t), 0);
+		pPipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(setLayouts.data(), static_cast<uint32_t>(setLayouts.size()));
+		pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &visibilityPipelineLayout));
 	}
 
-	void setupDescriptorSet()
+	// The G-Buffer (or visibility buffer) images are recreated whenever the render graph is compiled
+	void updateCompositionDescriptorSet()
 	{
-		std::vector<VkWriteDescriptorSet> writeDescriptorSets;
-		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+		if (geometryMode == GeometryVisibility) {
+			VkDescriptorImageInfo texDescriptorVisibility =
+				vks::initializers::descriptorImageInfo(
+					colorSampler,
+					renderGraph.getImageView(visibilityBuffer.ids),
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			// Binding 0 : Visibility buffer
+			VkWriteDescriptorSet writeDescriptorSet = vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &texDescriptorVisibility);
+			vkUpdateDescriptorSets(device, 1, &writeDescriptorSet, 0, nullptr);
+			return;
+		}
 
 		// Image descriptors for the offscreen color attachments
 		VkDescriptorImageInfo texDescriptorPosition =
 			vks::initializers::descriptorImageInfo(
 				colorSampler,
-				offScreenFrameBuf.position.view,
+				renderGraph.getImageView(gBuffer.position),
 				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		VkDescriptorImageInfo texDescriptorNormal =
 			vks::initializers::descriptorImageInfo(
 				colorSampler,
-				offScreenFrameBuf.normal.view,
+				renderGraph.getImageView(gBuffer.normal),
 				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		VkDescriptorImageInfo texDescriptorAlbedo =
 			vks::initializers::descriptorImageInfo(
 				colorSampler,
-				offScreenFrameBuf.albedo.view,
+				renderGraph.getImageView(gBuffer.albedo),
 				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-		// Deferred composition
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
-		writeDescriptorSets = {
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
 			// Binding 1 : Position texture target
 			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorPosition),
 			// Binding 2 : Normals texture target
@@ -562,6 +630,32 @@ public:
 			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &uniformBuffers.composition.descriptor),
 		};
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	}
+
+	void setupDescriptorSet()
+	{
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+
+		// Deferred composition
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+		updateCompositionDescriptorSet();
+		// Storage buffer lighting, also used by the light culling
+		writeDescriptorSets = {
+			// Binding 0 : Scene matrices for the visibility buffer pass and resolve
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.offscreen.descriptor),
+			// Binding 5 : Storage buffer lighting parameters
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &uniformBuffers.lighting.descriptor),
+			// Binding 6 : Lights
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &storageBuffers.lights.descriptor),
+			// Binding 7 : Cluster grid
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &storageBuffers.clusters.descriptor),
+			// Binding 8 : Light index list
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8, &storageBuffers.lightIndices.descriptor),
+			// Binding 9 : Light index list counter
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &storageBuffers.lightIndexCounter.descriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 
 		// Offscreen (scene)
 
@@ -588,6 +682,33 @@ public:
 			vks::initializers::writeDescriptorSet(descriptorSets.floor, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.floor.normalMap.descriptor)
 		};
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		// Visibility buffer resolve, the visibility buffer itself is written once the render graph contains it
+		VkDescriptorSetAllocateInfo visibilityAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &visibilityDescriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &visibilityAllocInfo, &visibilityDescriptorSet));
+		VkDescriptorBufferInfo floorVertices = { models.floor.vertices.buffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorBufferInfo floorIndices = { models.floor.indices.buffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorBufferInfo modelVertices = { models.model.vertices.buffer, 0, VK_WHOLE_SIZE };
+		VkDescriptorBufferInfo modelIndices = { models.model.indices.buffer, 0, VK_WHOLE_SIZE };
+		writeDescriptorSets = {
+			// Binding 1 : Floor vertices
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &floorVertices),
+			// Binding 2 : Floor indices
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &floorIndices),
+			// Binding 3 : Model vertices
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &modelVertices),
+			// Binding 4 : Model indices
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &modelIndices),
+			// Binding 5 : Floor color map
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &textures.floor.colorMap.descriptor),
+			// Binding 6 : Floor normal map
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &textures.floor.normalMap.descriptor),
+			// Binding 7 : Model color map
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 7, &textures.model.colorMap.descriptor),
+			// Binding 8 : Model normal map
+			vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &textures.model.normalMap.descriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
 	}
 
 	void preparePipelines()
@@ -623,6 +744,36 @@ public:
 		pipelineCI.pVertexInputState = &emptyInputState;
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.composition));
 
+		// Storage buffer composition pipelines, a specialization constant selects between looping over all lights and the lights of the fragment's cluster
+		shaderStages[1] = loadShader(getShadersPath() + "deferred/deferredlights.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		int32_t clustered = 0;
+		VkSpecializationMapEntry specializationMapEntry = vks::initializers::specializationMapEntry(0, 0, sizeof(int32_t));
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(int32_t), &clustered);
+		shaderStages[1].pSpecializationInfo = &specializationInfo;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.compositionAllLights));
+		clustered = 1;
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.compositionClustered));
+
+		// Visibility buffer resolve pipelines, with the same lighting modes as the composition
+		if (visibilityBufferSupported) {
+			shaderStages[1] = loadShader(getShadersPath() + "deferred/visibilityresolve.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+			int32_t resolveLightingMode = LightingUniformBlock;
+			VkSpecializationInfo resolveSpecializationInfo = vks::initializers::specializationInfo(1, &specializationMapEntry, sizeof(int32_t), &resolveLightingMode);
+			shaderStages[1].pSpecializationInfo = &resolveSpecializationInfo;
+			pipelineCI.layout = visibilityPipelineLayout;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibilityResolve));
+			resolveLightingMode = LightingAllLights;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibilityResolveAllLights));
+			resolveLightingMode = LightingClustered;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibilityResolveClustered));
+			pipelineCI.layout = pipelineLayout;
+		}
+
+		// Light culling
+		VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(pipelineLayout, 0);
+		computePipelineCI.stage = loadShader(getShadersPath() + "deferred/lightculling.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &pipelines.lightCulling));
+
 		// Vertex input state from glTF model for pipeline rendering models
 		pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({vkglTF::VertexComponent::Position, vkglTF::VertexComponent::UV, vkglTF::VertexComponent::Color, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::Tangent});
 		rasterizationState.cullMode = VK_CULL_MODE_BACK_BIT;
@@ -631,8 +782,8 @@ public:
 		shaderStages[0] = loadShader(getShadersPath() + "deferred/mrt.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
 		shaderStages[1] = loadShader(getShadersPath() + "deferred/mrt.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 
-		// Separate render pass
-		pipelineCI.renderPass = offScreenFrameBuf.renderPass;
+		// Render pass of the G-Buffer pass created by the render graph
+		pipelineCI.renderPass = gBufferPass->getRenderPass();
 
 		// Blend attachment states required for all color attachments
 		// This is important, as color write mask will otherwise be 0x0 and you
@@ -649,6 +800,57 @@ public:
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.offscreen));
 	}
 
+	// Only positions are read when filling the visibility buffer, all other attributes are fetched by the resolve
+	void prepareVisibilityPipeline()
+	{
+		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+		VkPipelineRasterizationStateCreateInfo rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+		VkPipelineColorBlendAttachmentState blendAttachmentState = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
+		VkPipelineColorBlendStateCreateInfo colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentState);
+		VkPipelineDepthStencilStateCreateInfo depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+		VkPipelineViewportStateCreateInfo viewportState = vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+		VkPipelineMultisampleStateCreateInfo multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+		std::vector<VkDynamicState> dynamicStateEnables = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+		VkPipelineDynamicStateCreateInfo dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
+		shaderStages[0] = loadShader(getShadersPath() + "deferred/visibility.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+		shaderStages[1] = loadShader(getShadersPath() + "deferred/visibility.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+
+		VkGraphicsPipelineCreateInfo pipelineCI = vks::initializers::pipelineCreateInfo(visibilityPipelineLayout, visibilityPass->getRenderPass());
+		pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({vkglTF::VertexComponent::Position});
+		pipelineCI.pInputAssemblyState = &inputAssemblyState;
+		pipelineCI.pRasterizationState = &rasterizationState;
+		pipelineCI.pColorBlendState = &colorBlendState;
+		pipelineCI.pMultisampleState = &multisampleState;
+		pipelineCI.pViewportState = &viewportState;
+		pipelineCI.pDepthStencilState = &depthStencilState;
+		pipelineCI.pDynamicState = &dynamicState;
+		pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCI.pStages = shaderStages.data();
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibility));
+	}
+
+	// Rebuilds the render graph with the G-Buffer or the visibility buffer pass
+	void changeGeometryMode()
+	{
+		// The images of the current graph are released when it's rebuilt
+		vkDeviceWaitIdle(device);
+		buildRenderGraph();
+		if ((geometryMode == GeometryVisibility) && (pipelines.visibility == VK_NULL_HANDLE)) {
+			prepareVisibilityPipeline();
+		}
+		updateCompositionDescriptorSet();
+		buildCommandBuffers();
+	}
+
+	// Bytes per frame written to the geometry pass attachments and read back by the composition, depth is never stored by either path
+	VkDeviceSize getAttachmentTraffic(int32_t mode)
+	{
+		// Position and normal (RGBA16F) and albedo (RGBA8) vs. a single R32 id
+		const VkDeviceSize bytesPerPixel = (mode == GeometryVisibility) ? 4 : 8 + 8 + 4;
+		return static_cast<VkDeviceSize>(width) * height * bytesPerPixel * 2;
+	}
+
 	// Prepare and initialize uniform buffer containing shader uniforms
 	void prepareUniformBuffers()
 	{
@@ -666,9 +868,17 @@ public:
 		    &uniformBuffers.composition,
 			sizeof(uboComposition)));
 
+		// Storage buffer lighting parameters
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&uniformBuffers.lighting,
+			sizeof(uboLighting)));
+
 		// Map persistent
 		VK_CHECK_RESULT(uniformBuffers.offscreen.map());
 		VK_CHECK_RESULT(uniformBuffers.composition.map());
+		VK_CHECK_RESULT(uniformBuffers.lighting.map());
 
 		// Setup instanced model positions
 		uboOffscreenVS.instancePos[0] = glm::vec4(0.0f);
@@ -680,6 +890,53 @@ public:
 		updateUniformBufferComposition();
 	}
 
+	// Distance at which the attenuation of a light drops below LIGHT_CUTOFF
+	float getLightRange(const Light& light)
+	{
+		float intensity = light.radius * std::max(light.color.r, std::max(light.color.g, light.color.b));
+		return sqrtf(std::max(intensity / LIGHT_CUTOFF - 1.0f, 0.0f));
+	}
+
+	// Lights and clustering buffers of the storage buffer paths
+	void prepareStorageBuffers()
+	{
+		// Small, dim lights scattered over the scene with a fixed seed, so benchmark runs are comparable
+		std::default_random_engine rndEngine(0);
+		std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
+		lights.resize(MAX_LIGHTS);
+		for (uint32_t i = 6; i < MAX_LIGHTS; i++) {
+			Light& light = lights[i];
+			light.position = glm::vec4(rndDist(rndEngine) * 24.0f - 12.0f, -rndDist(rndEngine) * 3.0f, rndDist(rndEngine) * 24.0f - 12.0f, 0.0f);
+			light.color = glm::vec3(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine));
+			light.color /= std::max(light.color.r, std::max(light.color.g, std::max(light.color.b, 0.01f)));
+			light.radius = 0.02f + rndDist(rndEngine) * 0.04f;
+			light.position.w = getLightRange(light);
+		}
+
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&storageBuffers.lights,
+			MAX_LIGHTS * sizeof(Light)));
+		VK_CHECK_RESULT(storageBuffers.lights.map());
+
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&storageBuffers.clusters,
+			CLUSTER_COUNT * 2 * sizeof(uint32_t)));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&storageBuffers.lightIndices,
+			LIGHT_INDEX_CAPACITY * sizeof(uint32_t)));
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&storageBuffers.lightIndexCounter,
+			sizeof(uint32_t)));
+	}
+
 	// Update matrices used for the offscreen rendering of the scene
 	void updateUniformBufferOffscreen()
 	{
@@ -687,6 +944,19 @@ public:
 		uboOffscreenVS.view = camera.matrices.view;
 		uboOffscreenVS.model = glm::mat4(1.0f);
 		memcpy(uniformBuffers.offscreen.mapped, &uboOffscreenVS, sizeof(uboOffscreenVS));
+		updateUniformBufferLighting();
+	}
+
+	void updateUniformBufferLighting()
+	{
+		uboLighting.view = camera.matrices.view;
+		uboLighting.projectionParams = glm::vec4(camera.matrices.perspective[0][0], camera.matrices.perspective[1][1], camera.getNearClip(), camera.getFarClip());
+		uboLighting.viewPos = uboComposition.viewPos;
+		uboLighting.lightCount = lightCounts[lightCountIndex];
+		uboLighting.screenWidth = width;
+		uboLighting.screenHeight = height;
+		uboLighting.debugDisplayTarget = debugDisplayTarget;
+		memcpy(uniformBuffers.lighting.mapped, &uboLighting, sizeof(uboLighting));
 	}
 
 	// Update lights and parameters passed to the composition shaders
@@ -738,61 +1008,144 @@ public:
 		uboComposition.debugDisplayTarget = debugDisplayTarget;
 
 		memcpy(uniformBuffers.composition.mapped, &uboComposition, sizeof(uboComposition));
+
+		// The animated scene lights are the first lights of the storage buffer paths
+		for (uint32_t i = 0; i < 6; i++) {
+			lights[i] = uboComposition.lights[i];
+			lights[i].position.w = getLightRange(lights[i]);
+		}
+		memcpy(storageBuffers.lights.mapped, lights.data(), lights.size() * sizeof(Light));
+		updateUniformBufferLighting();
 	}
 
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
-
-		// The scene render command buffer has to wait for the offscreen
-		// rendering to be finished before we can use the framebuffer
-		// color image for sampling during final rendering
-		// To ensure this we use a dedicated offscreen synchronization
-		// semaphore that will be signaled when offscreen rendering
-		// has been finished
-		// This is necessary as an implementation may start both
-		// command buffers at the same time, there is no guarantee
-		// that command buffers will be executed in the order they
-		// have been submitted by the application
-
-		// Offscreen rendering
-
-		// Wait for swap chain presentation to finish
-		submitInfo.pWaitSemaphores = &semaphores.presentComplete;
-		// Signal ready with offscreen semaphore
-		submitInfo.pSignalSemaphores = &offscreenSemaphore;
-
-		// Submit work
 		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &offScreenCmdBuffer;
+		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+		VulkanExampleBase::submitFrame();
+		// The queue is idle after submitting the frame, so the timestamps of this frame are available
+		getTimings();
+	}
 
-		// Scene rendering
+	void getTimings()
+	{
+		if (!timing.available) {
+			return;
+		}
+		uint64_t timestamps[5];
+		if (vkGetQueryPoolResults(device, timing.queryPool, 0, 5, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+			return;
+		}
+		timing.cullingTime = (double)(timestamps[1] - timestamps[0]) * timing.timestampPeriod / 1000000.0;
+		// Includes the barriers between the geometry pass and the composition
+		timing.geometryTime = (double)(timestamps[2] - timestamps[1]) * timing.timestampPeriod / 1000000.0;
+		timing.lightingTime = timing.cullingTime + (double)(timestamps[3] - timestamps[2]) * timing.timestampPeriod / 1000000.0;
+		timing.frameTime = (double)(timestamps[4] - timestamps[0]) * timing.timestampPeriod / 1000000.0;
+	}
 
-		// Wait for offscreen semaphore
-		submitInfo.pWaitSemaphores = &offscreenSemaphore;
-		// Signal ready with render complete semaphore
-		submitInfo.pSignalSemaphores = &semaphores.renderComplete;
+	uint32_t getBenchmarkStepCount()
+	{
+		// All light counts except the six scene lights, with and without clustering, for each supported geometry mode
+		return static_cast<uint32_t>(lightCounts.size() - 1) * 2 * (visibilityBufferSupported ? 2 : 1);
+	}
 
-		// Submit work
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	void applyBenchmarkStep()
+	{
+		const uint32_t geometryModes = visibilityBufferSupported ? 2 : 1;
+		const int32_t stepGeometryMode = lightBenchmark.step % geometryModes;
+		lightCountIndex = 1 + lightBenchmark.step / (geometryModes * 2);
+		lightingMode = ((lightBenchmark.step / geometryModes) % 2 == 0) ? LightingAllLights : LightingClustered;
+		lightBenchmark.frame = 0;
+		lightBenchmark.cullingTime = 0.0;
+		lightBenchmark.geometryTime = 0.0;
+		lightBenchmark.lightingTime = 0.0;
+		lightBenchmark.frameTime = 0.0;
+		updateUniformBufferLighting();
+		if (stepGeometryMode != geometryMode) {
+			geometryMode = stepGeometryMode;
+			changeGeometryMode();
+		} else {
+			buildCommandBuffers();
+		}
+	}
 
-		VulkanExampleBase::submitFrame();
+	void startLightBenchmark()
+	{
+		lightBenchmark.active = true;
+		lightBenchmark.step = 0;
+		lightBenchmark.results.clear();
+		applyBenchmarkStep();
+	}
+
+	void updateLightBenchmark()
+	{
+		lightBenchmark.frame++;
+		if (lightBenchmark.frame <= benchmarkWarmupFrames) {
+			return;
+		}
+		lightBenchmark.cullingTime += timing.cullingTime;
+		lightBenchmark.geometryTime += timing.geometryTime;
+		lightBenchmark.lightingTime += timing.lightingTime;
+		lightBenchmark.frameTime += timing.frameTime;
+		if (lightBenchmark.frame < benchmarkWarmupFrames + benchmarkFrames) {
+			return;
+		}
+
+		BenchmarkResult result;
+		result.lightCount = lightCounts[lightCountIndex];
+		result.lightingMode = lightingMode;
+		result.geometryMode = geometryMode;
+		result.cullingTime = lightBenchmark.cullingTime / benchmarkFrames;
+		result.geometryTime = lightBenchmark.geometryTime / benchmarkFrames;
+		result.lightingTime = lightBenchmark.lightingTime / benchmarkFrames;
+		result.frameTime = lightBenchmark.frameTime / benchmarkFrames;
+		lightBenchmark.results.push_back(result);
+
+		lightBenchmark.step++;
+		if (lightBenchmark.step < getBenchmarkStepCount()) {
+			applyBenchmarkStep();
+			return;
+		}
+
+		std::cout << "Resolution " << width << "x" << height << "\n";
+		std::cout << "Attachment traffic (MB): G-Buffer " << getAttachmentTraffic(GeometryGBuffer) / (1024.0 * 1024.0);
+		if (visibilityBufferSupported) {
+			std::cout << ", visibility buffer " << getAttachmentTraffic(GeometryVisibility) / (1024.0 * 1024.0);
+		}
+		std::cout << "\n";
+		std::cout << "Lights\tMode\tGeometry\tCulling (ms)\tGeometry (ms)\tLighting (ms)\tFrame (ms)\n";
+		for (const BenchmarkResult& r : lightBenchmark.results) {
+			std::cout << r.lightCount << "\t" << ((r.lightingMode == LightingClustered) ? "clustered" : "all") << "\t" << ((r.geometryMode == GeometryVisibility) ? "visibility" : "gbuffer") << "\t";
+			std::cout << r.cullingTime << "\t" << r.geometryTime << "\t" << r.lightingTime << "\t" << r.frameTime << "\n";
+		}
+		lightBenchmark.active = false;
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
-		prepareOffscreenFramebuffer();
+		renderGraph.create(vulkanDevice);
+		buildRenderGraph();
+		prepareSampler();
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 5;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timing.queryPool));
+			timing.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			timing.available = true;
+		}
+		prepareStorageBuffers();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
 		setupDescriptorSet();
 		buildCommandBuffers();
-		buildDeferredCommandBuffer();
 		prepared = true;
 	}
 
@@ -801,6 +1154,10 @@ public:
 		if (!prepared)
 			return;
 		draw();
+		if (lightBenchmark.active)
+		{
+			updateLightBenchmark();
+		}
 		if (!paused)
 		{
 			updateUniformBufferComposition();
@@ -816,13 +1173,66 @@ public:
 		updateUniformBufferOffscreen();
 	}
 
+	virtual void windowResized()
+	{
+		// The G-Buffer matches the window size, the render passes are cached so the pipelines stay valid
+		renderGraph.setExtent(width, height);
+		renderGraph.compile();
+		updateCompositionDescriptorSet();
+		updateUniformBufferLighting();
+		buildCommandBuffers();
+	}
+
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
-		if (overlay->header("Settings")) {
+		if (!lightBenchmark.active && overlay->header("Settings")) {
 			if (overlay->comboBox("Display", &debugDisplayTarget, {"Final composition", "Position", "Normals", "Albedo", "Specular" }))
 			{
 				updateUniformBufferComposition();
 			}
+			if (visibilityBufferSupported && overlay->comboBox("Geometry", &geometryMode, { "G-Buffer", "Visibility buffer" })) {
+				changeGeometryMode();
+			}
+			if (overlay->comboBox("Lighting", &lightingMode, { "Uniform block (6 lights)", "All lights", "Clustered" })) {
+				buildCommandBuffers();
+			}
+			if (lightingMode != LightingUniformBlock) {
+				std::vector<std::string> lightCountNames;
+				for (uint32_t count : lightCounts) {
+					lightCountNames.push_back(std::to_string(count));
+				}
+				if (overlay->comboBox("Lights", &lightCountIndex, lightCountNames)) {
+					updateUniformBufferLighting();
+				}
+			}
+		}
+		if (timing.available && overlay->header("GPU timings")) {
+			if (lightingMode == LightingClustered) {
+				overlay->text("Light culling: %.3f ms", timing.cullingTime);
+			}
+			overlay->text("Geometry: %.3f ms", timing.geometryTime);
+			overlay->text("Lighting: %.3f ms", timing.lightingTime);
+			overlay->text("Frame: %.3f ms", timing.frameTime);
+		}
+		if (timing.available && overlay->header("Benchmark")) {
+			if (lightBenchmark.active) {
+				overlay->text("Running %d / %d", lightBenchmark.step + 1, getBenchmarkStepCount());
+			} else if (overlay->button("Run")) {
+				startLightBenchmark();
+			}
+			overlay->text("Resolution: %dx%d", width, height);
+			for (const BenchmarkResult& result : lightBenchmark.results) {
+				overlay->text("%d %s %s: %.3f ms (frame %.3f ms)", result.lightCount, (result.lightingMode == LightingClustered) ? "clustered" : "all", (result.geometryMode == GeometryVisibility) ? "vis" : "gbuf", result.lightingTime, result.frameTime);
+			}
+		}
+		if (overlay->header("Render graph")) {
+			const vks::RenderGraph::Statistics statistics = renderGraph.getStatistics();
+			overlay->text("Passes: %d (%d culled)", statistics.passes, statistics.culledPasses);
+			overlay->text("Render passes: %d", statistics.renderPasses);
+			overlay->text("Image barriers: %d (%d batches)", statistics.imageBarriers, statistics.barrierBatches);
+			overlay->text("Images: %d (%d lazily allocated)", statistics.images, statistics.lazyImages);
+			overlay->text("Memory: %.2f MB (unaliased %.2f MB)", statistics.memory / (1024.0f * 1024.0f), statistics.unaliasedMemory / (1024.0f * 1024.0f));
+			overlay->text("Attachment traffic: %.2f MB / frame", getAttachmentTraffic(geometryMode) / (1024.0f * 1024.0f));
 		}
 	}
 };
@@ -1,6 +1,8 @@
 /*
 * Vulkan Example - Multi sampling with explicit resolve for deferred shading example
 *
+* A visibility buffer mode replaces the G-Buffer with a single packed object/triangle id per sample and reconstructs the attributes in the resolve
+*
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
@@ -27,6 +29,12 @@ public:
 	bool useSampleShading = true;
 	VkSampleCountFlagBits sampleCount = VK_SAMPLE_COUNT_1_BIT;
 
+	// The G-Buffer path writes position, normal and albedo per sample, the visibility buffer path only writes an object and triangle id
+	enum GeometryMode { GeometryGBuffer = 0, GeometryVisibility = 1 };
+	int32_t geometryMode = GeometryGBuffer;
+	// Writing gl_PrimitiveID from the fragment shader requires the geometry shader feature
+	bool visibilityBufferSupported = false;
+
 	struct {
 		struct {
 			vks::Texture2D colorMap;
@@ -72,8 +80,13 @@ public:
 		VkPipeline deferredNoMSAA;			// Deferred lighting calculation with explicit MSAA resolve
 		VkPipeline offscreen;				// (Offscreen) scene rendering (fill G-Buffers)
 		VkPipeline offscreenSampleShading;	// (Offscreen) scene rendering (fill G-Buffers) with sample shading rate enabled
+		VkPipeline visibility;				// (Offscreen) scene rendering (fill visibility buffer)
+		VkPipeline visibilityResolve;		// Attribute reconstruction and lighting from the visibility buffer
+		VkPipeline visibilityResolveNoMSAA;	// Attribute reconstruction and lighting from the first sample of the visibility buffer
 	} pipelines;
 	VkPipelineLayout pipelineLayout;
+	// Set 0 is shared with the other pipelines, set 1 contains the visibility buffer and the vertex data of the models
+	VkPipelineLayout visibilityPipelineLayout;
 
 	struct {
 		VkDescriptorSet model;
@@ -83,7 +96,20 @@ public:
 	VkDescriptorSet descriptorSet;
 	VkDescriptorSetLayout descriptorSetLayout;
 
+	VkDescriptorSet visibilityDescriptorSet;
+	VkDescriptorSetLayout visibilityDescriptorSetLayout;
+
 	vks::Framebuffer* offscreenframeBuffers;
+	vks::Framebuffer* visibilityFrameBuffer = nullptr;
+
+	// Timestamps are written around the geometry pass and around the composition draw
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		double geometryTime = 0.0;
+		double compositionTime = 0.0;
+	} timing;
 
 	VkCommandBuffer offScreenCmdBuffer = VK_NULL_HANDLE;
 
@@ -114,15 +140,26 @@ public:
 		{
 			delete offscreenframeBuffers;
 		}
+		if (visibilityFrameBuffer)
+		{
+			delete visibilityFrameBuffer;
+		}
 
 		vkDestroyPipeline(device, pipelines.deferred, nullptr);
 		vkDestroyPipeline(device, pipelines.deferredNoMSAA, nullptr);
 		vkDestroyPipeline(device, pipelines.offscreen, nullptr);
 		vkDestroyPipeline(device, pipelines.offscreenSampleShading, nullptr);
+		if (visibilityBufferSupported) {
+			vkDestroyPipeline(device, pipelines.visibility, nullptr);
+			vkDestroyPipeline(device, pipelines.visibilityResolve, nullptr);
+			vkDestroyPipeline(device, pipelines.visibilityResolveNoMSAA, nullptr);
+		}
 
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyPipelineLayout(device, visibilityPipelineLayout, nullptr);
 
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, visibilityDescriptorSetLayout, nullptr);
 
 		// Uniform buffers
 		uniformBuffers.offscreen.destroy();
@@ -134,6 +171,10 @@ public:
 		textures.background.normalMap.destroy();
 
 		vkDestroySemaphore(device, offscreenSemaphore, nullptr);
+
+		if (timing.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timing.queryPool, nullptr);
+		}
 	}
 
 	// Enable physical device features required for this example
@@ -147,6 +188,11 @@ public:
 		if (deviceFeatures.samplerAnisotropy) {
 			enabledFeatures.samplerAnisotropy = VK_TRUE;
 		}
+		// The visibility buffer pass writes gl_PrimitiveID, which requires geometry shader support
+		if (deviceFeatures.geometryShader) {
+			enabledFeatures.geometryShader = VK_TRUE;
+			visibilityBufferSupported = true;
+		}
 	};
 
 	// Prepare the framebuffer for offscreen rendering with multiple attachments used as render targets inside the fragment shaders
@@ -186,6 +232,8 @@ public:
 
 		attachmentInfo.format = attDepthFormat;
 		attachmentInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		// Depth is only used within the G-Buffer pass, so it doesn't need to be backed by actual memory on tile based GPUs
+		attachmentInfo.transient = true;
 		offscreenframeBuffers->addAttachment(attachmentInfo);
 
 		// Create sampler to sample from the color attachments
@@ -193,6 +241,34 @@ public:
 
 		// Create default renderpass for the framebuffer
 		VK_CHECK_RESULT(offscreenframeBuffers->createRenderPass());
+
+		/*
+			The visibility buffer only stores which triangle of which object covers a sample (4 bytes per sample instead of 20 for the G-Buffer)
+			Only one of the two paths renders in a frame, so the ids can use the memory of the albedo attachment, which has the same size
+		*/
+		if (visibilityBufferSupported) {
+			visibilityFrameBuffer = new vks::Framebuffer(vulkanDevice);
+
+			visibilityFrameBuffer->width = FB_DIM;
+			visibilityFrameBuffer->height = FB_DIM;
+
+			// Attachment 0: Object and triangle id
+			attachmentInfo.format = VK_FORMAT_R32_UINT;
+			attachmentInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			attachmentInfo.transient = false;
+			attachmentInfo.aliasAttachment = &offscreenframeBuffers->attachments[2];
+			visibilityFrameBuffer->addAttachment(attachmentInfo);
+
+			// Depth attachment
+			attachmentInfo.format = attDepthFormat;
+			attachmentInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+			attachmentInfo.transient = true;
+			attachmentInfo.aliasAttachment = nullptr;
+			visibilityFrameBuffer->addAttachment(attachmentInfo);
+
+			VK_CHECK_RESULT(visibilityFrameBuffer->createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE));
+			VK_CHECK_RESULT(visibilityFrameBuffer->createRenderPass());
+		}
 	}
 
 	// Build command buffer for rendering the scene to the offscreen frame buffer attachments
@@ -216,6 +292,14 @@ public:
 		clearValues[2].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
 		clearValues[3].depthStencil = { 1.0f, 0 };
 
+		// Samples not covered by any triangle keep the clear value and are skipped by the resolve
+		std::array<VkClearValue, 2> visibilityClearValues;
+		visibilityClearValues[0].color.uint32[0] = 0xFFFFFFFF;
+		visibilityClearValues[0].color.uint32[1] = 0;
+		visibilityClearValues[0].color.uint32[2] = 0;
+		visibilityClearValues[0].color.uint32[3] = 0;
+		visibilityClearValues[1].depthStencil = { 1.0f, 0 };
+
 		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
 		renderPassBeginInfo.renderPass = offscreenframeBuffers->renderPass;
 		renderPassBeginInfo.framebuffer = offscreenframeBuffers->framebuffer;
@@ -223,9 +307,21 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = offscreenframeBuffers->height;
 		renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 		renderPassBeginInfo.pClearValues = clearValues.data();
+		if (geometryMode == GeometryVisibility) {
+			renderPassBeginInfo.renderPass = visibilityFrameBuffer->renderPass;
+			renderPassBeginInfo.framebuffer = visibilityFrameBuffer->framebuffer;
+			renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(visibilityClearValues.size());
+			renderPassBeginInfo.pClearValues = visibilityClearValues.data();
+		}
 
 		VK_CHECK_RESULT(vkBeginCommandBuffer(offScreenCmdBuffer, &cmdBufInfo));
 
+		// The offscreen command buffer is submitted first, so it resets the queries of the frame
+		if (timing.available) {
+			vkCmdResetQueryPool(offScreenCmdBuffer, timing.queryPool, 0, 4);
+			vkCmdWriteTimestamp(offScreenCmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timing.queryPool, 0);
+		}
+
 		vkCmdBeginRenderPass(offScreenCmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 		VkViewport viewport = vks::initializers::viewport((float)offscreenframeBuffers->width, (float)offscreenframeBuffers->height, 0.0f, 1.0f);
@@ -234,19 +330,42 @@ public:
 		VkRect2D scissor = vks::initializers::rect2D(offscreenframeBuffers->width, offscreenframeBuffers->height, 0, 0);
 		vkCmdSetScissor(offScreenCmdBuffer, 0, 1, &scissor);
 
-		vkCmdBindPipeline(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, useSampleShading ? pipelines.offscreenSampleShading : pipelines.offscreen);
-
-		// Background
-		vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.background, 0, nullptr);
-		models.background.draw(offScreenCmdBuffer);
-
-		// Object
-		vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.model, 0, nullptr);
-		models.model.bindBuffers(offScreenCmdBuffer);
-		vkCmdDrawIndexed(offScreenCmdBuffer, models.model.indices.count, 3, 0, 0, 0);
+		if (geometryMode == GeometryVisibility) {
+			// Vertices are pre-transformed, so each model is drawn with a single indexed draw and gl_PrimitiveID is the triangle's index in the model's index buffer
+			// Coverage is per sample, so no sample rate shading is required to get the id of every sample
+			vkCmdBindPipeline(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.visibility);
+			vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+
+			// Background is object 0
+			uint32_t objectOffset = 0;
+			vkCmdPushConstants(offScreenCmdBuffer, visibilityPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &objectOffset);
+			models.background.bindBuffers(offScreenCmdBuffer);
+			vkCmdDrawIndexed(offScreenCmdBuffer, models.background.indices.count, 1, 0, 0, 0);
+
+			// Instances of the model are objects 1 to 3
+			objectOffset = 1;
+			vkCmdPushConstants(offScreenCmdBuffer, visibilityPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &objectOffset);
+			models.model.bindBuffers(offScreenCmdBuffer);
+			vkCmdDrawIndexed(offScreenCmdBuffer, models.model.indices.count, 3, 0, 0, 0);
+		} else {
+			vkCmdBindPipeline(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, useSampleShading ? pipelines.offscreenSampleShading : pipelines.offscreen);
+
+			// Background
+			vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.background, 0, nullptr);
+			models.background.draw(offScreenCmdBuffer);
+
+			// Object
+			vkCmdBindDescriptorSets(offScreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.model, 0, nullptr);
+			models.model.bindBuffers(offScreenCmdBuffer);
+			vkCmdDrawIndexed(offScreenCmdBuffer, models.model.indices.count, 3, 0, 0, 0);
+		}
 
 		vkCmdEndRenderPass(offScreenCmdBuffer);
 
+		if (timing.available) {
+			vkCmdWriteTimestamp(offScreenCmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 1);
+		}
+
 		VK_CHECK_RESULT(vkEndCommandBuffer(offScreenCmdBuffer));
 	}
 
@@ -282,13 +401,27 @@ public:
 			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 2);
+			}
 
 			// Final composition as full screen quad
 			// Note: Also used for debug display if debugDisplayTarget > 0
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, useMSAA ? pipelines.deferred : pipelines.deferredNoMSAA);
+			if (geometryMode == GeometryVisibility) {
+				// The resolve reconstructs the attributes of the visible triangles and shades them with the same lighting as the composition
+				VkDescriptorSet sets[] = { descriptorSet, visibilityDescriptorSet };
+				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, visibilityPipelineLayout, 0, 2, sets, 0, nullptr);
+				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, useMSAA ? pipelines.visibilityResolve : pipelines.visibilityResolveNoMSAA);
+			} else {
+				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, useMSAA ? pipelines.deferred : pipelines.deferredNoMSAA);
+			}
 			vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
 
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 3);
+			}
+
 			drawUI(drawCmdBuffers[i]);
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
@@ -300,6 +433,10 @@ public:
 	void loadAssets()
 	{
 		const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::PreMultiplyVertexColors | vkglTF::FileLoadingFlags::FlipY;
+		// The visibility buffer resolve reads the vertex and index buffers as storage buffers
+		if (visibilityBufferSupported) {
+			vkglTF::memoryPropertyFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		}
 		models.model.loadFromFile(getAssetPath() + "models/armor/armor.gltf", vulkanDevice, queue, glTFLoadingFlags);
 		models.background.loadFromFile(getAssetPath() + "models/deferred_box.gltf", vulkanDevice, queue, glTFLoadingFlags);
 		textures.model.colorMap.loadFromFile(getAssetPath() + "models/armor/colormap_rgba.ktx", VK_FORMAT_R8G8B8A8_UNORM, vulkanDevice, queue);
@@ -312,10 +449,12 @@ public:
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes = {
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9)
+			// The visibility buffer set adds 5 images and 4 storage buffers
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 14),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4)
 		};
 
-		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 3);
+		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes, 4);
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
 
@@ -323,8 +462,8 @@ public:
 	{
 		// Deferred shading layout
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
-			// Binding 0 : Vertex shader uniform buffer
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+			// Binding 0 : Vertex shader uniform buffer, also read by the visibility buffer resolve
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0),
 			// Binding 1 : Position texture target / Scene colormap
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
 			// Binding 2 : Normals texture target
@@ -341,6 +480,38 @@ public:
 		// Shared pipeline layout used by all pipelines
 		VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+		// Visibility buffer layout
+		setLayoutBindings = {
+			// Binding 0 : Visibility buffer
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+			// Binding 1 : Background vertices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+			// Binding 2 : Background indices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+			// Binding 3 : Model vertices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 3),
+			// Binding 4 : Model indices
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 4),
+			// Binding 5 : Background color map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 5),
+			// Binding 6 : Background normal map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 6),
+			// Binding 7 : Model color map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 7),
+			// Binding 8 : Model normal map
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 8),
+		};
+		descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &visibilityDescriptorSetLayout));
+
+		// The visibility buffer pass passes the object index of the first instance of a draw as a push constant
+		std::array<VkDescriptorSetLayout, 2> setLayouts = { descriptorSetLayout, visibilityDescriptorSetLayout };
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(uint32_t), 0);
+		pPipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(setLayouts.data(), static_cast<uint32_t>(setLayouts.size()));
+		pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &visibilityPipelineLayout));
 	}
 
 	void setupDescriptorSet()
@@ -370,6 +541,8 @@ public:
 		// Deferred composition
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
 		writeDescriptorSets = {
+			// Binding 0: Scene matrices for the visibility buffer pass and resolve
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.offscreen.descriptor),
 			// Binding 1: World space position texture
 			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorPosition),
 			// Binding 2: World space normals texture
@@ -406,6 +579,42 @@ public:
 			vks::initializers::writeDescriptorSet(descriptorSets.background, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.background.normalMap.descriptor)
 		};
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		// Visibility buffer resolve
+		if (visibilityBufferSupported) {
+			VkDescriptorSetAllocateInfo visibilityAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &visibilityDescriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &visibilityAllocInfo, &visibilityDescriptorSet));
+			VkDescriptorImageInfo texDescriptorVisibility =
+				vks::initializers::descriptorImageInfo(
+					visibilityFrameBuffer->sampler,
+					visibilityFrameBuffer->attachments[0].view,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			VkDescriptorBufferInfo backgroundVertices = { models.background.vertices.buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo backgroundIndices = { models.background.indices.buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo modelVertices = { models.model.vertices.buffer, 0, VK_WHOLE_SIZE };
+			VkDescriptorBufferInfo modelIndices = { models.model.indices.buffer, 0, VK_WHOLE_SIZE };
+			writeDescriptorSets = {
+				// Binding 0: Visibility buffer
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &texDescriptorVisibility),
+				// Binding 1: Background vertices
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &backgroundVertices),
+				// Binding 2: Background indices
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &backgroundIndices),
+				// Binding 3: Model vertices
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &modelVertices),
+				// Binding 4: Model indices
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &modelIndices),
+				// Binding 5: Background color map
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &textures.background.colorMap.descriptor),
+				// Binding 6: Background normal map
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &textures.background.normalMap.descriptor),
+				// Binding 7: Model color map
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 7, &textures.model.colorMap.descriptor),
+				// Binding 8: Model normal map
+				vks::initializers::writeDescriptorSet(visibilityDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &textures.model.normalMap.descriptor),
+			};
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+		}
 	}
 
 	void preparePipelines()
@@ -464,6 +673,18 @@ public:
 		specializationData = 1;
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.deferredNoMSAA));
 
+		// Visibility buffer resolve, with and without MSAA like the composition
+		if (visibilityBufferSupported) {
+			pipelineCI.layout = visibilityPipelineLayout;
+			shaderStages[1] = loadShader(getShadersPath() + "deferredmultisampling/visibilityresolve.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+			shaderStages[1].pSpecializationInfo = &specializationInfo;
+			specializationData = sampleCount;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibilityResolve));
+			specializationData = 1;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibilityResolveNoMSAA));
+			pipelineCI.layout = pipelineLayout;
+		}
+
 		// Vertex input state from glTF model for pipeline rendering models
 		pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position, vkglTF::VertexComponent::UV, vkglTF::VertexComponent::Color, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::Tangent });
 		rasterizationState.cullMode = VK_CULL_MODE_BACK_BIT;
@@ -497,6 +718,44 @@ public:
 		multisampleState.sampleShadingEnable = VK_TRUE;
 		multisampleState.minSampleShading = 0.25f;
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.offscreenSampleShading));
+
+		// Visibility buffer pass, only positions are read, all other attributes are fetched by the resolve
+		if (visibilityBufferSupported) {
+			pipelineCI.layout = visibilityPipelineLayout;
+			pipelineCI.renderPass = visibilityFrameBuffer->renderPass;
+			pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position });
+			// Ids can't be blended or converted to coverage, and every sample already gets the id of the triangle covering it
+			multisampleState.alphaToCoverageEnable = VK_FALSE;
+			multisampleState.sampleShadingEnable = VK_FALSE;
+			colorBlendState.attachmentCount = 1;
+			colorBlendState.pAttachments = &blendAttachmentState;
+			shaderStages[0] = loadShader(getShadersPath() + "deferredmultisampling/visibility.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+			shaderStages[1] = loadShader(getShadersPath() + "deferredmultisampling/visibility.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.visibility));
+		}
+	}
+
+	// Bytes per frame written to the geometry pass attachments and read back by the composition, depth is never stored by either path
+	VkDeviceSize getAttachmentTraffic(int32_t mode)
+	{
+		// Position and normal (RGBA16F) and albedo (RGBA8) vs. a single R32 id per sample
+		const VkDeviceSize bytesPerSample = (mode == GeometryVisibility) ? 4 : 8 + 8 + 4;
+		// All samples are written, without MSAA the composition only reads the first one
+		const VkDeviceSize samples = sampleCount + (useMSAA ? sampleCount : 1);
+		return static_cast<VkDeviceSize>(FB_DIM) * FB_DIM * bytesPerSample * samples;
+	}
+
+	void getTimings()
+	{
+		if (!timing.available) {
+			return;
+		}
+		uint64_t timestamps[4];
+		if (vkGetQueryPoolResults(device, timing.queryPool, 0, 4, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+			return;
+		}
+		timing.geometryTime = (double)(timestamps[1] - timestamps[0]) * timing.timestampPeriod / 1000000.0;
+		timing.compositionTime = (double)(timestamps[3] - timestamps[2]) * timing.timestampPeriod / 1000000.0;
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -623,6 +882,15 @@ public:
 		VulkanExampleBase::prepare();
 		sampleCount = getMaxUsableSampleCount();
 		loadAssets();
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 4;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timing.queryPool));
+			timing.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			timing.available = true;
+		}
 		deferredSetup();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -639,6 +907,8 @@ public:
 		if (!prepared)
 			return;
 		draw();
+		// The queue is idle after submitting the frame, so the timestamps of this frame are available
+		getTimings();
 		if (camera.updated) 
 		{
 			updateUniformBufferOffscreen();
@@ -657,15 +927,40 @@ public:
 			{
 				updateUniformBufferDeferredLights();
 			}
+			if (visibilityBufferSupported && overlay->comboBox("Geometry", &geometryMode, { "G-Buffer", "Visibility buffer" })) {
+				buildCommandBuffers();
+				buildDeferredCommandBuffer();
+			}
 			if (overlay->checkBox("MSAA", &useMSAA)) {
 				buildCommandBuffers();
 			}
-			if (vulkanDevice->features.sampleRateShading) {
+			if ((geometryMode == GeometryGBuffer) && vulkanDevice->features.sampleRateShading) {
 				if (overlay->checkBox("Sample rate shading", &useSampleShading)) {
 					buildDeferredCommandBuffer();
 				}
 			}
 		}
+		if (overlay->header("Framebuffer memory")) {
+			const vks::FramebufferMemoryStatistics memory = offscreenframeBuffers->getMemoryStatistics();
+			overlay->text("Allocated: %.2f MB", memory.allocated / (1024.0f * 1024.0f));
+			overlay->text("Lazily allocated: %.2f MB (%.2f MB committed)", memory.lazilyAllocated / (1024.0f * 1024.0f), memory.lazilyCommitted / (1024.0f * 1024.0f));
+			overlay->text("Aliased: %.2f MB", memory.aliased / (1024.0f * 1024.0f));
+			if (visibilityFrameBuffer) {
+				const vks::FramebufferMemoryStatistics visibilityMemory = visibilityFrameBuffer->getMemoryStatistics();
+				overlay->text("Visibility buffer allocated: %.2f MB, aliased: %.2f MB", visibilityMemory.allocated / (1024.0f * 1024.0f), visibilityMemory.aliased / (1024.0f * 1024.0f));
+			}
+		}
+		if (overlay->header("Attachment traffic")) {
+			// Estimate, doesn't include framebuffer compression or caches
+			overlay->text("G-Buffer: %.1f MB", getAttachmentTraffic(GeometryGBuffer) / (1024.0 * 1024.0));
+			if (visibilityBufferSupported) {
+				overlay->text("Visibility buffer: %.1f MB", getAttachmentTraffic(GeometryVisibility) / (1024.0 * 1024.0));
+			}
+		}
+		if (timing.available && overlay->header("GPU timings")) {
+			overlay->text("Geometry: %.3f ms", timing.geometryTime);
+			overlay->text("Composition: %.3f ms", timing.compositionTime);
+		}
 	}
 
 	// Returns the maximum sample count usable by the platform
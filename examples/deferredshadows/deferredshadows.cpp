@@ -277,6 +277,8 @@ public:
 
 		attachmentInfo.format = attDepthFormat;
 		attachmentInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		// Depth is only used within the G-Buffer pass, so it doesn't need to be backed by actual memory on tile based GPUs
+		attachmentInfo.transient = true;
 		frameBuffers.deferred->addAttachment(attachmentInfo);
 
 		// Create sampler to sample from the color attachments
@@ -823,6 +825,19 @@ public:
 				updateUniformBufferDeferredLights();
 			}
 		}
+		if (overlay->header("Framebuffer memory")) {
+			vks::FramebufferMemoryStatistics memory;
+			for (vks::Framebuffer* framebuffer : { frameBuffers.deferred, frameBuffers.shadow }) {
+				const vks::FramebufferMemoryStatistics statistics = framebuffer->getMemoryStatistics();
+				memory.allocated += statistics.allocated;
+				memory.lazilyAllocated += statistics.lazilyAllocated;
+				memory.lazilyCommitted += statistics.lazilyCommitted;
+				memory.aliased += statistics.aliased;
+			}
+			overlay->text("Allocated: %.2f MB", memory.allocated / (1024.0f * 1024.0f));
+			overlay->text("Lazily allocated: %.2f MB (%.2f MB committed)", memory.lazilyAllocated / (1024.0f * 1024.0f), memory.lazilyCommitted / (1024.0f * 1024.0f));
+			overlay->text("Aliased: %.2f MB", memory.aliased / (1024.0f * 1024.0f));
+		}
 	}
 };
 
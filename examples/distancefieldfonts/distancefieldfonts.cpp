@@ -9,15 +9,12 @@
 */
 
 #include "vulkanexamplebase.h"
+#include "VulkanGlyphBatch.h"
 
-#define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
 
-// Vertex layout for this example
-struct Vertex {
-	float pos[3];
-	float uv[2];
-};
+// Max. number of glyphs that can be displayed per frame
+#define MAX_GLYPH_COUNT 16384
 
 // AngelCode .fnt format structs and classes
 struct bmchar {
@@ -48,21 +45,18 @@ class VulkanExample : public VulkanExampleBase
 {
 public:
 	bool splitScreen = true;
+	// Text is written to the glyph batch every frame, so it can be changed without rebuilding the command buffers
+	char text[64] = "Vulkan";
+	int32_t lineCount = 1;
+	bool showFrameCounter = false;
 
 	struct {
 		vks::Texture2D fontSDF;
 		vks::Texture2D fontBitmap;
 	} textures;
 
-	struct {
-		VkPipelineVertexInputStateCreateInfo inputState;
-		std::vector<VkVertexInputBindingDescription> bindingDescriptions;
-		std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
-	} vertices;
-
-	vks::Buffer vertexBuffer;
-	vks::Buffer indexBuffer;
-	uint32_t indexCount;
+	// Glyph instances with one region per command buffer
+	vks::GlyphBatch glyphBatch;
 
 	struct {
 		vks::Buffer vs;
@@ -117,8 +111,7 @@ public:
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-		vertexBuffer.destroy();
-		indexBuffer.destroy();
+		glyphBatch.destroy();
 
 		uniformBuffers.vs.destroy();
 		uniformBuffers.fs.destroy();
@@ -218,14 +211,10 @@ public:
 			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-			VkDeviceSize offsets[1] = { 0 };
-
 			// Signed distance field font
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.sdf, 0, NULL);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.sdf);
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &vertexBuffer.buffer, offsets);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
+			glyphBatch.draw(drawCmdBuffers[i], i);
 
 			// Linear filtered bitmap font
 			if (splitScreen)
@@ -234,7 +223,7 @@ public:
 				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
 				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.bitmap, 0, NULL);
 				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.bitmap);
-				vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
+				glyphBatch.draw(drawCmdBuffers[i], i);
 			}
 
 			drawUI(drawCmdBuffers[i]);
@@ -245,114 +234,47 @@ public:
 		}
 	}
 
-	// Creates a vertex buffer containing quads for the passed text
-	void generateText(std:: string text)
+	// Creates the glyph batch and fills it's glyph metrics from the parsed font (normalized to the font size of 36)
+	void prepareGlyphBatch()
 	{
-		std::vector<Vertex> vertices;
-		std::vector<uint32_t> indices;
-		uint32_t indexOffset = 0;
+		glyphBatch.create(vulkanDevice, static_cast<uint32_t>(drawCmdBuffers.size()), MAX_GLYPH_COUNT);
 
 		float w = textures.fontSDF.width;
 
-		float posx = 0.0f;
-		float posy = 0.0f;
-
-		for (uint32_t i = 0; i < text.size(); i++)
+		for (uint32_t i = 0; i < fontChars.size(); i++)
 		{
-			bmchar *charInfo = &fontChars[(int)text[i]];
+			bmchar *charInfo = &fontChars[i];
 
 			if (charInfo->width == 0)
 				charInfo->width = 36;
 
-			float charw = ((float)(charInfo->width) / 36.0f);
-			float dimx = 1.0f * charw;
-			float charh = ((float)(charInfo->height) / 36.0f);
-			float dimy = 1.0f * charh;
-
-			float us = charInfo->x / w;
-			float ue = (charInfo->x + charInfo->width) / w;
-			float ts = charInfo->y / w;
-			float te = (charInfo->y + charInfo->height) / w;
-
-			float xo = charInfo->xoffset / 36.0f;
-			float yo = charInfo->yoffset / 36.0f;
-
-			posy = yo;
-
-			vertices.push_back({ { posx + dimx + xo,  posy + dimy, 0.0f }, { ue, te } });
-			vertices.push_back({ { posx + xo,         posy + dimy, 0.0f }, { us, te } });
-			vertices.push_back({ { posx + xo,         posy,        0.0f }, { us, ts } });
-			vertices.push_back({ { posx + dimx + xo,  posy,        0.0f }, { ue, ts } });
-
-			std::array<uint32_t, 6> letterIndices = { 0,1,2, 2,3,0 };
-			for (auto& index : letterIndices)
-			{
-				indices.push_back(indexOffset + index);
-			}
-			indexOffset += 4;
-
-			float advance = ((float)(charInfo->xadvance) / 36.0f);
-			posx += advance;
+			vks::Glyph& glyph = glyphBatch.glyphs[i];
+			glyph.rect = glm::vec4(
+				charInfo->xoffset / 36.0f,
+				charInfo->yoffset / 36.0f,
+				(charInfo->xoffset + (float)charInfo->width) / 36.0f,
+				(charInfo->yoffset + (float)charInfo->height) / 36.0f);
+			glyph.uv = glm::vec4(
+				charInfo->x / w,
+				charInfo->y / w,
+				(charInfo->x + charInfo->width) / w,
+				(charInfo->y + charInfo->height) / w);
+			glyph.advance = ((float)(charInfo->xadvance) / 36.0f);
 		}
-		indexCount = indices.size();
-
-		// Center
-		for (auto& v : vertices)
-		{
-			v.pos[0] -= posx / 2.0f;
-			v.pos[1] -= 0.5f;
-		}
-
-		// Generate host accessible buffers for the text vertices and indices and upload the data
-
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&vertexBuffer,
-			vertices.size() * sizeof(Vertex),
-			vertices.data()));
-
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&indexBuffer,
-			indices.size() * sizeof(uint32_t),
-			indices.data()));
 	}
 
-	void setupVertexDescriptions()
+	// Writes the text for the given command buffer, each line is centered
+	void updateText(uint32_t frame)
 	{
-		// Binding description
-		vertices.bindingDescriptions.resize(1);
-		vertices.bindingDescriptions[0] =
-			vks::initializers::vertexInputBindingDescription(
-				VERTEX_BUFFER_BIND_ID,
-				sizeof(Vertex),
-				VK_VERTEX_INPUT_RATE_VERTEX);
-
-		// Attribute descriptions
-		// Describes memory layout and shader positions
-		vertices.attributeDescriptions.resize(2);
-		// Location 0 : Position
-		vertices.attributeDescriptions[0] =
-			vks::initializers::vertexInputAttributeDescription(
-				VERTEX_BUFFER_BIND_ID,
-				0,
-				VK_FORMAT_R32G32B32_SFLOAT,
-				0);
-		// Location 1 : Texture coordinates
-		vertices.attributeDescriptions[1] =
-			vks::initializers::vertexInputAttributeDescription(
-				VERTEX_BUFFER_BIND_ID,
-				1,
-				VK_FORMAT_R32G32_SFLOAT,
-				sizeof(float) * 3);
-
-		vertices.inputState = vks::initializers::pipelineVertexInputStateCreateInfo();
-		vertices.inputState.vertexBindingDescriptionCount = vertices.bindingDescriptions.size();
-		vertices.inputState.pVertexBindingDescriptions = vertices.bindingDescriptions.data();
-		vertices.inputState.vertexAttributeDescriptionCount = vertices.attributeDescriptions.size();
-		vertices.inputState.pVertexAttributeDescriptions = vertices.attributeDescriptions.data();
+		glyphBatch.begin(frame);
+		std::string line(text);
+		if (showFrameCounter) {
+			line += " " + std::to_string(frameCounter);
+		}
+		for (int32_t i = 0; i < lineCount; i++) {
+			glyphBatch.addText(line, 0.0f, (float)i - 0.5f, glm::vec2(1.0f), vks::GlyphBatch::alignCenter);
+		}
+		glyphBatch.end();
 	}
 
 	void setupDescriptorPool()
@@ -481,7 +403,7 @@ public:
 	{
 		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
 			vks::initializers::pipelineInputAssemblyStateCreateInfo(
-				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
 				0,
 				VK_FALSE);
 
@@ -547,7 +469,8 @@ public:
 				renderPass,
 				0);
 
-		pipelineCreateInfo.pVertexInputState = &vertices.inputState;
+		// One instance per glyph, the vertex shaders generate the quad corners from the vertex index
+		pipelineCreateInfo.pVertexInputState = vks::GlyphBatch::getPipelineVertexInputState();
 		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
 		pipelineCreateInfo.pRasterizationState = &rasterizationState;
 		pipelineCreateInfo.pColorBlendState = &colorBlendState;
@@ -608,6 +531,9 @@ public:
 	{
 		VulkanExampleBase::prepareFrame();
 
+		// The glyph instances of the current command buffer are no longer in use at this point
+		updateText(currentBuffer);
+
 		// Command buffer to be submitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -623,8 +549,7 @@ public:
 		VulkanExampleBase::prepare();
 		parsebmFont();
 		loadAssets();
-		generateText("Vulkan");
-		setupVertexDescriptions();
+		prepareGlyphBatch();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
@@ -641,6 +566,16 @@ public:
 		draw();
 	}
 
+	virtual void windowResized()
+	{
+		// The glyph batch holds one region per command buffer, so it needs to be recreated if the number of swapchain images has changed
+		if (glyphBatch.getFrameCount() != drawCmdBuffers.size()) {
+			glyphBatch.destroy();
+			prepareGlyphBatch();
+			buildCommandBuffers();
+		}
+	}
+
 	virtual void viewChanged()
 	{
 		camera.setPerspective(splitScreen ? 30.0f : 45.0f, (float)width / (float)(height * ((splitScreen) ? 0.5f : 1.0f)), 1.0f, 256.0f);
@@ -661,6 +596,12 @@ public:
 				updateUniformBuffers();
 			}
 		}
+		if (overlay->header("Text")) {
+			ImGui::InputText("Text", text, sizeof(text));
+			overlay->sliderInt("Lines", &lineCount, 1, 256);
+			overlay->checkBox("Frame counter", &showFrameCounter);
+			overlay->text("%d glyphs, %d cached layouts", glyphBatch.statistics.glyphs, glyphBatch.getCachedLayoutCount());
+		}
 	}
 };
 
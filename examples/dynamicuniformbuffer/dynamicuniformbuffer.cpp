@@ -14,9 +14,14 @@
 *
 * The used descriptor type VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC then allows to set a dynamic
 * offset used to pass data from the single uniform buffer to the connected shader binding point.
+*
+* The uniform data is allocated from a vks::TransientAllocator, which hands out aligned ranges of a persistently mapped
+* buffer with one slice per frame in flight, so the host never writes to data the device may still be reading.
+* As the offsets change every frame, the command buffer is recorded per frame.
 */
 
 #include "vulkanexamplebase.h"
+#include "VulkanTransientAllocator.h"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -28,30 +33,6 @@ struct Vertex {
 	float color[3];
 };
 
-// Wrapper functions for aligned memory allocation
-// There is currently no standard for this in C++ that works across all platforms and vendors, so we abstract this
-void* alignedAlloc(size_t size, size_t alignment)
-{
-	void *data = nullptr;
-#if defined(_MSC_VER) || defined(__MINGW32__)
-	data = _aligned_malloc(size, alignment);
-#else
-	int res = posix_memalign(&data, alignment, size);
-	if (res != 0)
-		data = nullptr;
-#endif
-	return data;
-}
-
-void alignedFree(void* data)
-{
-#if	defined(_MSC_VER) || defined(__MINGW32__)
-	_aligned_free(data);
-#else
-	free(data);
-#endif
-}
-
 class VulkanExample : public VulkanExampleBase
 {
 public:
@@ -65,10 +46,8 @@ public:
 	vks::Buffer indexBuffer;
 	uint32_t indexCount;
 
-	struct {
-		vks::Buffer view;
-		vks::Buffer dynamic;
-	} uniformBuffers;
+	// Uniform data for each frame in flight is allocated from this, the allocator takes care of GPU-specific uniform buffer offset alignments
+	vks::TransientAllocator transientAllocator;
 
 	struct {
 		glm::mat4 projection;
@@ -78,12 +57,7 @@ public:
 	// Store random per-object rotations
 	glm::vec3 rotations[OBJECT_INSTANCES];
 	glm::vec3 rotationSpeeds[OBJECT_INSTANCES];
-
-	// One big uniform buffer that contains all matrices
-	// Note that we need to manually allocate the data to cope for GPU-specific uniform buffer offset alignments
-	struct UboDataDynamic {
-		glm::mat4 *model = nullptr;
-	} uboDataDynamic;
+	glm::mat4 modelMatrices[OBJECT_INSTANCES];
 
 	VkPipeline pipeline;
 	VkPipelineLayout pipelineLayout;
@@ -92,8 +66,6 @@ public:
 
 	float animationTimer = 0.0f;
 
-	size_t dynamicAlignment;
-
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		title = "Dynamic uniform buffers";
@@ -105,10 +77,6 @@ public:
 
 	~VulkanExample()
 	{
-		if (uboDataDynamic.model) {
-			alignedFree(uboDataDynamic.model);
-		}
-
 		// Clean up used Vulkan resources
 		// Note : Inherited destructor cleans up resources stored in base class
 		vkDestroyPipeline(device, pipeline, nullptr);
@@ -119,12 +87,18 @@ public:
 		vertexBuffer.destroy();
 		indexBuffer.destroy();
 
-		uniformBuffers.view.destroy();
-		uniformBuffers.dynamic.destroy();
+		transientAllocator.destroy();
 	}
 
-	void buildCommandBuffers()
+	// Allocates this frame's uniform data and records the command buffer for the current swap chain image
+	void buildCommandBuffer()
 	{
+		VkCommandBuffer cmdBuffer = drawCmdBuffers[currentBuffer];
+
+		// Releases the allocations of the frame that last used this slice
+		transientAllocator.beginFrame(currentBuffer);
+		const vks::TransientAllocation viewAllocation = transientAllocator.uploadUniform(uboVS);
+
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
 		VkClearValue clearValues[2];
@@ -139,50 +113,53 @@ public:
 		renderPassBeginInfo.renderArea.extent.height = height;
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
+		renderPassBeginInfo.framebuffer = frameBuffers[currentBuffer];
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-		{
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+		VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
 
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+		VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+		vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
 
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+		VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+		vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
 
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-			VkDeviceSize offsets[1] = { 0 };
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &vertexBuffer.buffer, offsets);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+		VkDeviceSize offsets[1] = { 0 };
+		vkCmdBindVertexBuffers(cmdBuffer, VERTEX_BUFFER_BIND_ID, 1, &vertexBuffer.buffer, offsets);
+		vkCmdBindIndexBuffer(cmdBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-			// Render multiple objects using different model matrices by dynamically offsetting into one uniform buffer
-			for (uint32_t j = 0; j < OBJECT_INSTANCES; j++)
-			{
-				// One dynamic offset per dynamic descriptor to offset into the ubo containing all model matrices
-				uint32_t dynamicOffset = j * static_cast<uint32_t>(dynamicAlignment);
-				// Bind the descriptor set for rendering a mesh using the dynamic offset
-				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
+		// Render multiple objects using different model matrices by dynamically offsetting into one uniform buffer
+		for (uint32_t j = 0; j < OBJECT_INSTANCES; j++)
+		{
+			// Each object's matrix gets its own aligned range of the transient buffer
+			const vks::TransientAllocation modelAllocation = transientAllocator.uploadUniform(modelMatrices[j]);
+			// One dynamic offset per dynamic descriptor, in binding order
+			std::array<uint32_t, 2> dynamicOffsets = { viewAllocation.dynamicOffset(), modelAllocation.dynamicOffset() };
+			// Bind the descriptor set for rendering a mesh using the dynamic offsets
+			vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+
+			vkCmdDrawIndexed(cmdBuffer, indexCount, 1, 0, 0, 0);
+		}
 
-				vkCmdDrawIndexed(drawCmdBuffers[i], indexCount, 1, 0, 0, 0);
-			}
+		drawUI(cmdBuffer);
 
-			drawUI(drawCmdBuffers[i]);
+		vkCmdEndRenderPass(cmdBuffer);
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+		VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-		}
+		// The base class waits for the queue to become idle after each frame, so no fence is required to guard the slice
+		transientAllocator.endFrame();
 	}
 
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
 
+		buildCommandBuffer();
+
 		// Command buffer to be submitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -253,18 +230,17 @@ public:
 
 	void setupDescriptorPool()
 	{
-		// Example uses one ubo and one image sampler
+		// Example uses two dynamic ubos
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2)
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
 			vks::initializers::descriptorPoolCreateInfo(
 				static_cast<uint32_t>(poolSizes.size()),
 				poolSizes.data(),
-				2);
+				1);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -273,7 +249,7 @@ public:
 	{
 		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings =
 		{
-			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0),
 			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 1)
 		};
 
@@ -302,11 +278,14 @@ public:
 
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
 
+		// Both bindings point at the start of the transient buffer, the actual ranges are selected with dynamic offsets at bind time
+		VkDescriptorBufferInfo viewDescriptor = transientAllocator.getDynamicDescriptor(sizeof(uboVS));
+		VkDescriptorBufferInfo modelDescriptor = transientAllocator.getDynamicDescriptor(sizeof(glm::mat4));
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
-			// Binding 0 : Projection/View matrix uniform buffer
-			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.view.descriptor),
+			// Binding 0 : Projection/View matrix as dynamic uniform buffer
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, &viewDescriptor),
 			// Binding 1 : Instance matrix as dynamic uniform buffer
-			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, &uniformBuffers.dynamic.descriptor),
+			vks::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, &modelDescriptor),
 		};
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
@@ -387,49 +366,18 @@ public:
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
 	}
 
-	// Prepare and initialize uniform buffer containing shader uniforms
+	// Prepare the transient buffer that per-frame shader uniforms are allocated from
 	void prepareUniformBuffers()
 	{
-		// Allocate data for the dynamic uniform buffer object
-		// We allocate this manually as the alignment of the offset differs between GPUs
-
-		// Calculate required alignment based on minimum device offset alignment
-		size_t minUboAlignment = vulkanDevice->properties.limits.minUniformBufferOffsetAlignment;
-		dynamicAlignment = sizeof(glm::mat4);
-		if (minUboAlignment > 0) {
-			dynamicAlignment = (dynamicAlignment + minUboAlignment - 1) & ~(minUboAlignment - 1);
-		}
-
-		size_t bufferSize = OBJECT_INSTANCES * dynamicAlignment;
-
-		uboDataDynamic.model = (glm::mat4*)alignedAlloc(bufferSize, dynamicAlignment);
-		assert(uboDataDynamic.model);
+		// Each frame allocates the view block and one matrix per object, each starting at an offset aligned to minUniformBufferOffsetAlignment
+		const VkDeviceSize minUboAlignment = vulkanDevice->properties.limits.minUniformBufferOffsetAlignment;
+		const VkDeviceSize uboAlignment = std::max(minUboAlignment, (VkDeviceSize)1);
+		const VkDeviceSize frameSize = (OBJECT_INSTANCES + 1) * ((std::max(sizeof(uboVS), sizeof(glm::mat4)) + uboAlignment - 1) / uboAlignment * uboAlignment);
+		transientAllocator.preferDeviceLocal = true;
+		transientAllocator.create(vulkanDevice, frameSize, static_cast<uint32_t>(drawCmdBuffers.size()));
 
 		std::cout << "minUniformBufferOffsetAlignment = " << minUboAlignment << std::endl;
-		std::cout << "dynamicAlignment = " << dynamicAlignment << std::endl;
-
-		// Vertex shader uniform buffer block
-
-		// Static shared uniform buffer object with projection and view matrix
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&uniformBuffers.view,
-			sizeof(uboVS)));
-
-		// Uniform buffer object with per-object matrices
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-			&uniformBuffers.dynamic,
-			bufferSize));
-
-		// Override descriptor range to [base, base + dynamicAlignment]
-		uniformBuffers.dynamic.descriptor.range = dynamicAlignment;
-
-		// Map persistent
-		VK_CHECK_RESULT(uniformBuffers.view.map());
-		VK_CHECK_RESULT(uniformBuffers.dynamic.map());
+		std::cout << "transient frame size = " << transientAllocator.getStatistics().frameSize << std::endl;
 
 		// Prepare per-object matrices with offsets and random rotations
 		std::default_random_engine rndEngine(benchmark.active ? 0 : (unsigned)time(nullptr));
@@ -449,7 +397,6 @@ public:
 		uboVS.projection = camera.matrices.perspective;
 		uboVS.view = camera.matrices.view;
 
-		memcpy(uniformBuffers.view.mapped, &uboVS, sizeof(uboVS));
 	}
 
 	void updateDynamicUniformBuffer(bool force = false)
@@ -472,8 +419,7 @@ public:
 				{
 					uint32_t index = x * dim * dim + y * dim + z;
 
-					// Aligned offset
-					glm::mat4* modelMat = (glm::mat4*)(((uint64_t)uboDataDynamic.model + (index * dynamicAlignment)));
+					glm::mat4* modelMat = &modelMatrices[index];
 
 					// Update rotations
 					rotations[index] += animationTimer * rotationSpeeds[index];
@@ -488,14 +434,8 @@ public:
 			}
 		}
 
+		// The matrices are copied to the transient buffer when the next frame is recorded
 		animationTimer = 0.0f;
-
-		memcpy(uniformBuffers.dynamic.mapped, uboDataDynamic.model, uniformBuffers.dynamic.size);
-		// Flush to make changes visible to the host
-		VkMappedMemoryRange memoryRange = vks::initializers::mappedMemoryRange();
-		memoryRange.memory = uniformBuffers.dynamic.memory;
-		memoryRange.size = uniformBuffers.dynamic.size;
-		vkFlushMappedMemoryRanges(device, 1, &memoryRange);
 	}
 
 	void prepare()
@@ -508,7 +448,6 @@ public:
 		preparePipelines();
 		setupDescriptorPool();
 		setupDescriptorSet();
-		buildCommandBuffers();
 		prepared = true;
 	}
 
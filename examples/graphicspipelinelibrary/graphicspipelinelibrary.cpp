@@ -8,16 +8,13 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
-#include <thread>
-#include <mutex>
+#include "VulkanPipelineService.h"
 
 #define ENABLE_VALIDATION false
 
 class VulkanExample: public VulkanExampleBase
 {
 public:
-	bool linkTimeOptimization = true;
-
 	vkglTF::Model scene;
 
 	struct UBOVS {
@@ -33,24 +30,14 @@ public:
 
 	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphicsPipelineLibraryFeatures{};
 
-	struct PipelineLibrary {
-		VkPipeline vertexInputInterface;
-		VkPipeline preRasterizationShaders;
-		VkPipeline fragmentOutputInterface;
-		std::vector<VkPipeline> fragmentShaders;
-	} pipelineLibrary;
-
-	std::vector<VkPipeline> pipelines{};
-
-	struct ShaderInfo {
-		uint32_t* code;
-		size_t size;
-	};
+	// Pipelines are compiled in the background, the service hands out fast-linked pipelines first and swaps in link time optimized ones once they're ready
+	vks::PipelineService pipelineService;
+	std::vector<uint32_t> pipelines{};
 
-	std::mutex mutex;
-	VkPipelineCache threadPipelineCache{ VK_NULL_HANDLE };
-
-	bool  newPipelineCreated = false;
+	struct ShaderModules {
+		VkPipelineShaderStageCreateInfo vertex;
+		VkPipelineShaderStageCreateInfo fragment;
+	} shaders;
 
 	uint32_t splitX{ 2 };
 	uint32_t splitY{ 2 };
@@ -80,16 +67,7 @@ public:
 	~VulkanExample()
 	{
 		if (device) {
-			for (auto pipeline : pipelines) {
-				vkDestroyPipeline(device, pipeline, nullptr);
-			}
-			for (auto pipeline : pipelineLibrary.fragmentShaders) {
-				vkDestroyPipeline(device, pipeline, nullptr);
-			}
-			vkDestroyPipeline(device, pipelineLibrary.fragmentOutputInterface, nullptr);
-			vkDestroyPipeline(device, pipelineLibrary.preRasterizationShaders, nullptr);
-			vkDestroyPipeline(device, pipelineLibrary.vertexInputInterface, nullptr);
-			vkDestroyPipelineCache(device, threadPipelineCache, nullptr);
+			pipelineService.destroy();
 			vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 			vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 			uniformBuffer.destroy();
@@ -146,8 +124,10 @@ public:
 					scissor.offset.y = (uint32_t)h * y;
 					vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-					if (pipelines.size() > idx) {
-						vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[idx]);
+					// Viewports of pipelines still being compiled stay empty
+					VkPipeline pipeline = (pipelines.size() > idx) ? pipelineService.get(pipelines[idx]) : VK_NULL_HANDLE;
+					if (pipeline != VK_NULL_HANDLE) {
+						vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 						scene.draw(drawCmdBuffers[i]);
 					}
 
@@ -201,247 +181,32 @@ public:
 		vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
 	}
 
-	// With VK_EXT_graphics_pipeline_library we don't need to create the shader module when loading it, but instead have the driver create it at linking time
-	// So we use a custom function that only loads the required shader information without actually creating the shader module
-	bool loadShaderFile(std::string fileName, ShaderInfo &shaderInfo)
-	{
-#if defined(__ANDROID__)
-		// Load shader from compressed asset
-		// @todo
-		AAsset* asset = AAssetManager_open(androidApp->activity->assetManager, fileName, AASSET_MODE_STREAMING);
-		assert(asset);
-		size_t size = AAsset_getLength(asset);
-		assert(size > 0);
-
-		shaderInfo.size = size;
-		shaderInfo.code = new uint32_t[size / 4];
-		AAsset_read(asset, shaderCode, size);
-		AAsset_close(asset);
-#else
-		std::ifstream is(fileName, std::ios::binary | std::ios::in | std::ios::ate);
-
-		if (is.is_open())
-		{
-			shaderInfo.size = is.tellg();
-			is.seekg(0, std::ios::beg);
-			shaderInfo.code = new uint32_t[shaderInfo.size];
-			is.read(reinterpret_cast<char*>(shaderInfo.code), shaderInfo.size);
-			is.close();
-			return true;
-		} else {
-			std::cerr << "Error: Could not open shader file \"" << fileName << "\"" << "\n";
-			throw std::runtime_error("Could open shader file");
-			return false;
-		}
-#endif
-	}
-
-	// Create the shared pipeline parts up-front
-	void preparePipelineLibrary()
-	{
-		// Create a pipeline library for the vertex input interface
-		{
-			VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
-			libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
-			libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
-
-			VkPipelineVertexInputStateCreateInfo vertexInputState = *vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::Color });
-			VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
-
-			VkGraphicsPipelineCreateInfo pipelineLibraryCI{};
-			pipelineLibraryCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-			pipelineLibraryCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
-			pipelineLibraryCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-			pipelineLibraryCI.pNext = &libraryInfo;
-			pipelineLibraryCI.pInputAssemblyState = &inputAssemblyState;
-			pipelineLibraryCI.pVertexInputState = &vertexInputState;
-			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineLibraryCI, nullptr, &pipelineLibrary.vertexInputInterface));
-		}
-
-		// Creata a pipeline library for the vertex shader stage
-		{
-			VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
-			libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
-			libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
-
-			VkDynamicState vertexDynamicStates[2] = {
-				VK_DYNAMIC_STATE_VIEWPORT,
-				VK_DYNAMIC_STATE_SCISSOR };
-
-			VkPipelineDynamicStateCreateInfo dynamicInfo{};
-			dynamicInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-			dynamicInfo.dynamicStateCount = 2;
-			dynamicInfo.pDynamicStates = vertexDynamicStates;
-
-			VkPipelineViewportStateCreateInfo viewportState = {};
-			viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-			viewportState.viewportCount = 1;
-			viewportState.scissorCount = 1;
-
-			VkPipelineRasterizationStateCreateInfo rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
-
-			// @todo: we can skip the pipeline shader module info and directly consume the shader module
-			ShaderInfo shaderInfo{};
-			loadShaderFile(getShadersPath() + "graphicspipelinelibrary/shared.vert.spv", shaderInfo);
-
-			VkShaderModuleCreateInfo shaderModuleCI{};
-			shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-			shaderModuleCI.codeSize = shaderInfo.size;
-			shaderModuleCI.pCode = shaderInfo.code;
-
-			VkPipelineShaderStageCreateInfo shaderStageCI{};
-			shaderStageCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-			shaderStageCI.pNext = &shaderModuleCI;
-			shaderStageCI.stage = VK_SHADER_STAGE_VERTEX_BIT;
-			shaderStageCI.pName = "main";
-
-			VkGraphicsPipelineCreateInfo pipelineLibraryCI{};
-			pipelineLibraryCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-			pipelineLibraryCI.pNext = &libraryInfo;
-			pipelineLibraryCI.renderPass = renderPass;
-			pipelineLibraryCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
-			pipelineLibraryCI.stageCount = 1;
-			pipelineLibraryCI.pStages = &shaderStageCI;
-			pipelineLibraryCI.layout = pipelineLayout;
-			pipelineLibraryCI.pDynamicState = &dynamicInfo;
-			pipelineLibraryCI.pViewportState = &viewportState;
-			pipelineLibraryCI.pRasterizationState = &rasterizationState;
-			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineLibraryCI, nullptr, &pipelineLibrary.preRasterizationShaders));
-		}
-
-		// Create a pipeline library for the fragment output interface
-		{
-			VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
-			libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
-			libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
-
-			VkPipelineColorBlendAttachmentState  blendAttachmentSstate = vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE);
-			VkPipelineColorBlendStateCreateInfo  colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(1, &blendAttachmentSstate);
-			VkPipelineMultisampleStateCreateInfo multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT);
-
-			VkGraphicsPipelineCreateInfo pipelineLibraryCI{};
-			pipelineLibraryCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-			pipelineLibraryCI.pNext = &libraryInfo;
-			pipelineLibraryCI.layout = pipelineLayout;
-			pipelineLibraryCI.renderPass = renderPass;
-			pipelineLibraryCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
-			pipelineLibraryCI.pColorBlendState = &colorBlendState;
-			pipelineLibraryCI.pMultisampleState = &multisampleState;
-			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineLibraryCI, nullptr, &pipelineLibrary.fragmentOutputInterface));
-		}
-	}
-
-	void threadFn()
+	// Request a new pipeline using a customized fragment shader from the pipeline service
+	// The request returns immediately, the pipeline is compiled by one of the service's worker threads
+	void requestPipeline()
 	{
-		const std::lock_guard<std::mutex> lock(mutex);
+		vks::PipelineDescription description;
+		description.layout = pipelineLayout;
+		description.renderPass = renderPass;
+		description.setVertexInputState(vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position, vkglTF::VertexComponent::Normal, vkglTF::VertexComponent::Color }));
+		description.rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+		description.depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
 
-		auto start = std::chrono::steady_clock::now();
+		// Select lighting model using a specialization constant
+		uint32_t lightingModel = (uint32_t)(rand() % 4);
+		const std::string lightingModelNames[] = { "Phong", "Toon", "No shading", "Greyscale" };
+		description.name = "#" + std::to_string(pipelines.size()) + " " + lightingModelNames[lightingModel];
+		description.addShaderStage(VK_SHADER_STAGE_VERTEX_BIT, shaders.vertex.module);
+		description.addShaderStage(VK_SHADER_STAGE_FRAGMENT_BIT, shaders.fragment.module, &lightingModel, sizeof(uint32_t));
 
-		prepareNewPipeline();
-		newPipelineCreated = true;
+		pipelines.push_back(pipelineService.request(description));
 
 		// Change viewport/draw count
 		if (pipelines.size() > splitX * splitY) {
 			splitX++;
 			splitY++;
 		}
-
-		auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
-		std::cout << "Pipeline created in " << delta.count() << " microseconds\n";
-	}
-
-	// Create a new pipeline using the pipeline library and a customized fragment shader
-	// Used from a thread
-	void prepareNewPipeline()
-	{
-		// Create the fragment shader part of the pipeline library with some random options
-		VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo{};
-		libraryInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
-		libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
-
-		VkPipelineDepthStencilStateCreateInfo depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
-		VkPipelineMultisampleStateCreateInfo  multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT);
-
-		// Using the pipeline library extension, we can skip the pipeline shader module creation and directly pass the shader code to the pipeline
-		ShaderInfo shaderInfo{};
-		loadShaderFile(getShadersPath() + "graphicspipelinelibrary/uber.frag.spv", shaderInfo);
-
-		VkShaderModuleCreateInfo shaderModuleCI{};
-		shaderModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-		shaderModuleCI.codeSize = shaderInfo.size;
-		shaderModuleCI.pCode = shaderInfo.code;
-
-		VkPipelineShaderStageCreateInfo shaderStageCI{};
-		shaderStageCI.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-		shaderStageCI.pNext = &shaderModuleCI;
-		shaderStageCI.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-		shaderStageCI.pName = "main";
-
-		// Select lighting model using a specialization constant
-		srand((unsigned int)time(NULL));
-		uint32_t lighting_model = (int)(rand() % 4);
-
-		// Each shader constant of a shader stage corresponds to one map entry
-		VkSpecializationMapEntry specializationMapEntry{};
-		specializationMapEntry.constantID = 0;
-		specializationMapEntry.size = sizeof(uint32_t);
-
-		VkSpecializationInfo specializationInfo{};
-		specializationInfo.mapEntryCount = 1;
-		specializationInfo.pMapEntries = &specializationMapEntry;
-		specializationInfo.dataSize = sizeof(uint32_t);
-		specializationInfo.pData = &lighting_model;
-
-		shaderStageCI.pSpecializationInfo = &specializationInfo;
-
-		VkGraphicsPipelineCreateInfo pipelineCI{};
-		pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		pipelineCI.pNext = &libraryInfo;
-		pipelineCI.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
-		pipelineCI.stageCount = 1;
-		pipelineCI.pStages = &shaderStageCI;
-		pipelineCI.layout = pipelineLayout;
-		pipelineCI.renderPass = renderPass;
-		pipelineCI.pDepthStencilState = &depthStencilState;
-		pipelineCI.pMultisampleState = &multisampleState;
-		VkPipeline fragmentShader = VK_NULL_HANDLE;
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, threadPipelineCache, 1, &pipelineCI, nullptr, &fragmentShader));
-
-		// Create the pipeline using the pre-built pipeline library parts
-		// Except for above fragment shader part all parts have been pre-built and will be re-used
-		std::vector<VkPipeline> libraries = {
-			pipelineLibrary.vertexInputInterface,
-			pipelineLibrary.preRasterizationShaders,
-			fragmentShader,
-			pipelineLibrary.fragmentOutputInterface };
-
-		// Link the library parts into a graphics pipeline
-		VkPipelineLibraryCreateInfoKHR pipelineLibraryCI{};
-		pipelineLibraryCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
-		pipelineLibraryCI.libraryCount = static_cast<uint32_t>(libraries.size());
-		pipelineLibraryCI.pLibraries = libraries.data();
-
-		// If set to true, we pass VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT which will let the implementation do additional optimizations at link time
-		// This trades in pipeline creation time for run-time performance
-		bool optimized = true;
-
-		VkGraphicsPipelineCreateInfo executablePipelineCI{};
-		executablePipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-		executablePipelineCI.pNext = &pipelineLibraryCI;
-		executablePipelineCI.layout = pipelineLayout;
-		if (linkTimeOptimization)
-		{
-			// If link time optimization is activated in the UI, we set the VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT flag which will let the implementation do additional optimizations at link time
-			// This trades in pipeline creation time for run-time performance
-			executablePipelineCI.flags = VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT;
-		}
-
-		VkPipeline executable = VK_NULL_HANDLE;
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, threadPipelineCache, 1, &executablePipelineCI, nullptr, &executable));
-
-		pipelines.push_back(executable);
-		// Push fragment shader to list for deletion in the sample's destructor
-		pipelineLibrary.fragmentShaders.push_back(fragmentShader);
+		buildCommandBuffers();
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
@@ -488,19 +253,17 @@ public:
 		loadAssets();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
-		preparePipelineLibrary();
 		setupDescriptorPool();
 		setupDescriptorSet();
-		buildCommandBuffers();
 
-		// Create a separate pipeline cache for the pipeline creation thread
-		VkPipelineCacheCreateInfo pipelineCachCI = {};
-		pipelineCachCI.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-		vkCreatePipelineCache(device, &pipelineCachCI, nullptr, &threadPipelineCache);
+		// All workers share the example's pipeline cache
+		pipelineService.create(device, pipelineCache, true, static_cast<uint32_t>(drawCmdBuffers.size()));
+		shaders.vertex = loadShader(getShadersPath() + "graphicspipelinelibrary/shared.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+		shaders.fragment = loadShader(getShadersPath() + "graphicspipelinelibrary/uber.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 
-		// Create first pipeline using a background thread
-		std::thread pipelineGenerationThread(&VulkanExample::threadFn, this);
-		pipelineGenerationThread.detach();
+		// Create first pipeline in the background
+		srand((unsigned int)time(NULL));
+		requestPipeline();
 
 		prepared = true;
 	}
@@ -509,10 +272,8 @@ public:
 	{
 		if (!prepared)
 			return;
-		if (newPipelineCreated)
-		{
-			newPipelineCreated = false;
-			vkQueueWaitIdle(queue);
+		// Picks up pipelines finished by the workers since the last frame, this never waits for a compilation
+		if (pipelineService.update()) {
 			buildCommandBuffers();
 		}
 		draw();
@@ -521,11 +282,24 @@ public:
 
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
-		overlay->checkBox("Link time optimization", &linkTimeOptimization);
+		overlay->checkBox("Link time optimization", &pipelineService.linkTimeOptimization);
 		if (overlay->button("New pipeline")) {
-			// Spwan a thread to create a new pipeline in the background
-			std::thread pipelineGenerationThread(&VulkanExample::threadFn, this);
-			pipelineGenerationThread.detach();
+			requestPipeline();
+		}
+		if (overlay->button("New pipelines (x8)")) {
+			for (uint32_t i = 0; i < 8; i++) {
+				requestPipeline();
+			}
+		}
+		if (overlay->header("Pipelines")) {
+			overlay->text("%d worker threads, %d jobs pending", pipelineService.getThreadCount(), pipelineService.getPendingCount());
+			const char* stateNames[] = { "pending", "fast-linked", "optimized" };
+			for (auto& statistics : pipelineService.getStatistics()) {
+				overlay->text("%s: %s", statistics.name.c_str(), stateNames[statistics.state]);
+				if (statistics.state != vks::PipelineService::statePending) {
+					overlay->text("  ready after %.2f ms, compile %.2f ms, optimize %.2f ms", statistics.latency, statistics.compileTime, statistics.optimizeTime);
+				}
+			}
 		}
 	}
 };
@@ -8,15 +8,39 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "frustum.hpp"
+#include "threadpool.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define INSTANCE_BUFFER_BIND_ID 1
 #define ENABLE_VALIDATION false
 #if defined(__ANDROID__)
 #define INSTANCE_COUNT 4096
+#define MAX_INSTANCE_COUNT (1 << 20)
 #else
 #define INSTANCE_COUNT 8192
+#define MAX_INSTANCE_COUNT (1 << 22)
 #endif
+// Instances per buffer in the scalable mode, 1M instances (32 MB) stay below the guaranteed minimum maxStorageBufferRange of 128 MB
+#define INSTANCE_CHUNK_SIZE (1 << 20)
+#define MAX_INSTANCE_CHUNKS (MAX_INSTANCE_COUNT / INSTANCE_CHUNK_SIZE)
+#define MAX_CULL_THREADS 16
+
+// Counter-based random number generator ("Squares: A Fast Counter-Based RNG", Widynski)
+// Every number only depends on its counter, so instances can be generated in any order on any number of threads with identical results
+inline uint32_t squares32(uint64_t counter, uint64_t key)
+{
+	uint64_t x = counter * key;
+	uint64_t y = x;
+	uint64_t z = y + key;
+	x = x * x + y;
+	x = (x >> 32) | (x << 32);
+	x = x * x + z;
+	x = (x >> 32) | (x << 32);
+	x = x * x + y;
+	x = (x >> 32) | (x << 32);
+	return (uint32_t)((x * x + z) >> 32);
+}
 
 class VulkanExample : public VulkanExampleBase
 {
@@ -57,8 +81,99 @@ public:
 
 	struct {
 		vks::Buffer scene;
+		vks::Buffer cull;
 	} uniformBuffers;
 
+	// The static mode draws INSTANCE_COUNT instances from a single buffer, the scalable mode draws up to MAX_INSTANCE_COUNT instances split into chunks
+	enum Mode { ModeStatic = 0, ModeScalable = 1 };
+	enum Culling { CullingNone = 0, CullingCPU = 1, CullingGPU = 2 };
+	int32_t mode = ModeStatic;
+	int32_t culling = CullingGPU;
+	int32_t instanceCountIndex = 2;
+	std::vector<uint32_t> instanceCounts;
+	std::vector<std::string> instanceCountNames;
+	float cullDistance = 96.0f;
+
+	// Seed for the counter-based random number generator
+	uint64_t rngKey = 0;
+	// Used for parallel generation and CPU culling
+	vks::ThreadPool threadPool;
+	vks::Frustum frustum;
+
+	struct InstanceChunk {
+		uint32_t first = 0;
+		uint32_t count = 0;
+		// All instances of this chunk, input for GPU culling and drawn directly without culling
+		vks::Buffer instances;
+		// Instances that passed GPU culling
+		vks::Buffer visible;
+		// Instances that passed CPU culling, each culling thread writes to its own slice
+		vks::Buffer hostVisible;
+	};
+
+	struct {
+		uint32_t instanceCount = 0;
+		std::vector<InstanceChunk> chunks;
+		// Host copy of all instances for CPU culling
+		std::vector<InstanceData> hostInstances;
+		// Host visible indirect draws, one per chunk for GPU culling followed by one per chunk slice for CPU culling
+		vks::Buffer indirectCommands;
+	} scalable;
+
+	// Frustum and distance culling in a compute shader, compacts visible instances of each chunk and writes the chunk's indirect draw
+	struct {
+		VkDescriptorSetLayout descriptorSetLayout;
+		std::array<VkDescriptorSet, MAX_INSTANCE_CHUNKS> descriptorSets;
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline;
+	} compute;
+
+	struct UBOCull {
+		glm::vec4 frustumPlanes[6];
+		glm::vec4 cameraPos;
+		float globSpeed;
+		float cullDistance;
+		float radius;
+	} uboCull;
+
+	struct PushConsts {
+		uint32_t chunk;
+		uint32_t instanceCount;
+	};
+
+	// Timestamps are written at the start of the frame, after culling and at the end of the frame
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		double generationTime = 0.0;
+		double cpuCullTime = 0.0;
+		double gpuCullTime = 0.0;
+		double gpuFrameTime = 0.0;
+		uint32_t visibleInstances = 0;
+	} timing;
+
+	// Runs all instance counts with all culling modes to find the instance count from which culling on the GPU is cheaper than on the CPU
+	struct BenchmarkResult {
+		uint32_t instanceCount;
+		int32_t culling;
+		double generationTime;
+		double cpuTime;
+		double gpuTime;
+		uint32_t visibleInstances;
+	};
+	struct {
+		bool active = false;
+		uint32_t step = 0;
+		uint32_t frame = 0;
+		double cpuTime = 0.0;
+		double gpuTime = 0.0;
+		uint32_t crossover = 0;
+		std::vector<BenchmarkResult> results;
+	} instanceBenchmark;
+	const uint32_t benchmarkWarmupFrames = 16;
+	const uint32_t benchmarkFrames = 64;
+
 	VkPipelineLayout pipelineLayout;
 	struct {
 		VkPipeline instancedRocks;
@@ -79,6 +194,11 @@ public:
 		camera.setPosition(glm::vec3(5.5f, -1.85f, -18.5f));
 		camera.setRotation(glm::vec3(-17.2f, -4.7f, 0.0f));
 		camera.setPerspective(60.0f, (float)width / (float)height, 1.0f, 256.0f);
+		for (uint32_t count = 1 << 16; count <= MAX_INSTANCE_COUNT; count <<= 2) {
+			instanceCounts.push_back(count);
+			instanceCountNames.push_back((count >= (1 << 20)) ? std::to_string(count >> 20) + "M" : std::to_string(count >> 10) + "K");
+		}
+		instanceCountIndex = std::min(instanceCountIndex, static_cast<int32_t>(instanceCounts.size()) - 1);
 	}
 
 	~VulkanExample()
@@ -93,6 +213,15 @@ public:
 		textures.rocks.destroy();
 		textures.planet.destroy();
 		uniformBuffers.scene.destroy();
+		uniformBuffers.cull.destroy();
+		destroyInstanceChunks();
+		scalable.indirectCommands.destroy();
+		vkDestroyPipeline(device, compute.pipeline, nullptr);
+		vkDestroyPipelineLayout(device, compute.pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
+		if (timing.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timing.queryPool, nullptr);
+		}
 	}
 
 	// Enable physical device features required for this example
@@ -126,6 +255,17 @@ public:
 
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
+			if (timing.available) {
+				vkCmdResetQueryPool(drawCmdBuffers[i], timing.queryPool, 0, 3);
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timing.queryPool, 0);
+			}
+			if (mode == ModeScalable && culling == CullingGPU) {
+				recordCulling(drawCmdBuffers[i]);
+			}
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, timing.queryPool, 1);
+			}
+
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
@@ -151,22 +291,82 @@ public:
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.instancedRocks);
 			// Binding point 0 : Mesh vertex buffer
 			vkCmdBindVertexBuffers(drawCmdBuffers[i], VERTEX_BUFFER_BIND_ID, 1, &models.rock.vertices.buffer, offsets);
-			// Binding point 1 : Instance data buffer
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
 			// Bind index buffer
 			vkCmdBindIndexBuffer(drawCmdBuffers[i], models.rock.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-			// Render instances
-			vkCmdDrawIndexed(drawCmdBuffers[i], models.rock.indices.count, INSTANCE_COUNT, 0, 0, 0);
+			if (mode == ModeScalable) {
+				drawInstanceChunks(drawCmdBuffers[i]);
+			} else {
+				// Binding point 1 : Instance data buffer
+				vkCmdBindVertexBuffers(drawCmdBuffers[i], INSTANCE_BUFFER_BIND_ID, 1, &instanceBuffer.buffer, offsets);
+				// Render instances
+				vkCmdDrawIndexed(drawCmdBuffers[i], models.rock.indices.count, INSTANCE_COUNT, 0, 0, 0);
+			}
 
 			drawUI(drawCmdBuffers[i]);
 
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+			if (timing.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, 2);
+			}
+
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
 
+	// Reset the instance counts of the per-chunk indirect draws and cull all chunks
+	void recordCulling(VkCommandBuffer commandBuffer)
+	{
+		for (uint32_t c = 0; c < scalable.chunks.size(); c++) {
+			vkCmdFillBuffer(commandBuffer, scalable.indirectCommands.buffer, c * sizeof(VkDrawIndexedIndirectCommand) + offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+		}
+		VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+		memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+		for (uint32_t c = 0; c < scalable.chunks.size(); c++) {
+			PushConsts pushConsts = { c, scalable.chunks[c].count };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSets[c], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, compute.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConsts), &pushConsts);
+			vkCmdDispatch(commandBuffer, (scalable.chunks[c].count + 63) / 64, 1, 1);
+		}
+
+		// Compacted instances are read as per-instance vertex attributes, the instance counts by the indirect draws
+		memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		memoryBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	// Draw all chunks of the scalable mode, culled instances are drawn with indirect draws so the command buffers don't depend on the visible instance count
+	void drawInstanceChunks(VkCommandBuffer commandBuffer)
+	{
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		VkDeviceSize offsets[1] = { 0 };
+		for (uint32_t c = 0; c < scalable.chunks.size(); c++) {
+			InstanceChunk& chunk = scalable.chunks[c];
+			if (culling == CullingNone) {
+				vkCmdBindVertexBuffers(commandBuffer, INSTANCE_BUFFER_BIND_ID, 1, &chunk.instances.buffer, offsets);
+				vkCmdDrawIndexed(commandBuffer, models.rock.indices.count, chunk.count, 0, 0, 0);
+			}
+			if (culling == CullingCPU) {
+				// Slices are bound at their offset, so the draws don't need a first instance (which requires the drawIndirectFirstInstance feature)
+				const uint32_t sliceSize = getCullSliceSize(chunk.count);
+				for (uint32_t t = 0; t * sliceSize < chunk.count; t++) {
+					VkDeviceSize sliceOffset = (VkDeviceSize)t * sliceSize * sizeof(InstanceData);
+					vkCmdBindVertexBuffers(commandBuffer, INSTANCE_BUFFER_BIND_ID, 1, &chunk.hostVisible.buffer, &sliceOffset);
+					vkCmdDrawIndexedIndirect(commandBuffer, scalable.indirectCommands.buffer, getCullSliceCommandIndex(c, t) * stride, 1, stride);
+				}
+			}
+			if (culling == CullingGPU) {
+				vkCmdBindVertexBuffers(commandBuffer, INSTANCE_BUFFER_BIND_ID, 1, &chunk.visible.buffer, offsets);
+				vkCmdDrawIndexedIndirect(commandBuffer, scalable.indirectCommands.buffer, c * stride, 1, stride);
+			}
+		}
+	}
+
 	void loadAssets()
 	{
 		const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::PreMultiplyVertexColors | vkglTF::FileLoadingFlags::FlipY;
@@ -182,15 +382,16 @@ public:
 		// Example uses one ubo
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 + MAX_INSTANCE_CHUNKS),
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * MAX_INSTANCE_CHUNKS),
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
 			vks::initializers::descriptorPoolCreateInfo(
 				poolSizes.size(),
 				poolSizes.data(),
-				2);
+				2 + MAX_INSTANCE_CHUNKS);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -209,6 +410,26 @@ public:
 
 		VkPipelineLayoutCreateInfo pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayout));
+
+		// Culling
+		setLayoutBindings = {
+			// Binding 0 : All instances of a chunk
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+			// Binding 1 : Visible instances of a chunk
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+			// Binding 2 : Indirect draws
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+			// Binding 3 : Culling uniform buffer
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+		};
+		descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &compute.descriptorSetLayout));
+
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(PushConsts), 0);
+		pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&compute.descriptorSetLayout, 1);
+		pipelineLayoutCI.pushConstantRangeCount = 1;
+		pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &compute.pipelineLayout));
 	}
 
 	void setupDescriptorSet()
@@ -234,6 +455,11 @@ public:
 		};
 		vkUpdateDescriptorSets(device, writeDescriptorSets.size(), writeDescriptorSets.data(), 0, NULL);
 
+		// Culling, one set per chunk (written once the chunks have been created)
+		for (uint32_t c = 0; c < MAX_INSTANCE_CHUNKS; c++) {
+			descripotrSetAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &compute.descriptorSetLayout, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descripotrSetAllocInfo, &compute.descriptorSets[c]));
+		}
 	}
 
 	void preparePipelines()
@@ -324,42 +550,52 @@ public:
 		inputState.vertexBindingDescriptionCount = 0;
 		inputState.vertexAttributeDescriptionCount = 0;
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.starfield));
+
+		// Culling compute pipeline
+		VkComputePipelineCreateInfo computePipelineCI = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
+		computePipelineCI.stage = loadShader(getShadersPath() + "instancing/cull.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCI, nullptr, &compute.pipeline));
+	}
+
+	// Generate a range of instances, the random numbers of an instance only depend on its index
+	void generateInstances(InstanceData* instances, uint32_t first, uint32_t count)
+	{
+		const glm::vec2 rings[2] = { { 7.0f, 11.0f }, { 14.0f, 18.0f } };
+		const uint32_t layerCount = textures.rocks.layerCount;
+		for (uint32_t i = 0; i < count; i++) {
+			const uint32_t index = first + i;
+			const uint64_t counter = (uint64_t)index * 16;
+			auto random = [&](uint32_t n) { return (float)(squares32(counter + n, rngKey) >> 8) / 16777216.0f; };
+
+			// Distribute rocks randomly on two different rings, even instances on the inner ring, odd ones on the outer ring
+			const glm::vec2& ring = rings[index & 1];
+			float rho = sqrt((pow(ring[1], 2.0f) - pow(ring[0], 2.0f)) * random(0) + pow(ring[0], 2.0f));
+			float theta = 2.0f * (float)M_PI * random(1);
+			instances[i].pos = glm::vec3(rho * cos(theta), random(2) * 0.5f - 0.25f, rho * sin(theta));
+			instances[i].rot = glm::vec3((float)M_PI * random(3), (float)M_PI * random(4), (float)M_PI * random(5));
+			instances[i].scale = (1.5f + random(6) - random(7)) * 0.75f;
+			instances[i].texIndex = std::min((uint32_t)(random(8) * layerCount), layerCount - 1);
+		}
+	}
+
+	// Split generation into one contiguous range per worker thread
+	void generateInstancesParallel(InstanceData* instances, uint32_t count)
+	{
+		const uint32_t threadCount = static_cast<uint32_t>(threadPool.threads.size());
+		const uint32_t rangeSize = (count + threadCount - 1) / threadCount;
+		for (uint32_t t = 0; t < threadCount && t * rangeSize < count; t++) {
+			const uint32_t first = t * rangeSize;
+			const uint32_t rangeCount = std::min(rangeSize, count - first);
+			threadPool.threads[t]->addJob([this, instances, first, rangeCount] { generateInstances(instances + first, first, rangeCount); });
+		}
+		threadPool.wait();
 	}
 
 	void prepareInstanceData()
 	{
 		std::vector<InstanceData> instanceData;
 		instanceData.resize(INSTANCE_COUNT);
-
-		std::default_random_engine rndGenerator(benchmark.active ? 0 : (unsigned)time(nullptr));
-		std::uniform_real_distribution<float> uniformDist(0.0, 1.0);
-		std::uniform_int_distribution<uint32_t> rndTextureIndex(0, textures.rocks.layerCount);
-
-		// Distribute rocks randomly on two different rings
-		for (auto i = 0; i < INSTANCE_COUNT / 2; i++) {
-			glm::vec2 ring0 { 7.0f, 11.0f };
-			glm::vec2 ring1 { 14.0f, 18.0f };
-
-			float rho, theta;
-
-			// Inner ring
-			rho = sqrt((pow(ring0[1], 2.0f) - pow(ring0[0], 2.0f)) * uniformDist(rndGenerator) + pow(ring0[0], 2.0f));
-			theta = 2.0 * M_PI * uniformDist(rndGenerator);
-			instanceData[i].pos = glm::vec3(rho*cos(theta), uniformDist(rndGenerator) * 0.5f - 0.25f, rho*sin(theta));
-			instanceData[i].rot = glm::vec3(M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator));
-			instanceData[i].scale = 1.5f + uniformDist(rndGenerator) - uniformDist(rndGenerator);
-			instanceData[i].texIndex = rndTextureIndex(rndGenerator);
-			instanceData[i].scale *= 0.75f;
-
-			// Outer ring
-			rho = sqrt((pow(ring1[1], 2.0f) - pow(ring1[0], 2.0f)) * uniformDist(rndGenerator) + pow(ring1[0], 2.0f));
-			theta = 2.0 * M_PI * uniformDist(rndGenerator);
-			instanceData[i + INSTANCE_COUNT / 2].pos = glm::vec3(rho*cos(theta), uniformDist(rndGenerator) * 0.5f - 0.25f, rho*sin(theta));
-			instanceData[i + INSTANCE_COUNT / 2].rot = glm::vec3(M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator), M_PI * uniformDist(rndGenerator));
-			instanceData[i + INSTANCE_COUNT / 2].scale = 1.5f + uniformDist(rndGenerator) - uniformDist(rndGenerator);
-			instanceData[i + INSTANCE_COUNT / 2].texIndex = rndTextureIndex(rndGenerator);
-			instanceData[i + INSTANCE_COUNT / 2].scale *= 0.75f;
-		}
+		generateInstances(instanceData.data(), 0, INSTANCE_COUNT);
 
 		instanceBuffer.size = instanceData.size() * sizeof(InstanceData);
 
@@ -410,6 +646,243 @@ public:
 		vkFreeMemory(device, stagingBuffer.memory, nullptr);
 	}
 
+	void destroyInstanceChunks()
+	{
+		for (InstanceChunk& chunk : scalable.chunks) {
+			chunk.instances.destroy();
+			chunk.visible.destroy();
+			chunk.hostVisible.destroy();
+		}
+		scalable.chunks.clear();
+		scalable.hostInstances.clear();
+		scalable.instanceCount = 0;
+	}
+
+	// Number of instances of a chunk culled by each CPU culling thread
+	uint32_t getCullSliceSize(uint32_t chunkInstanceCount)
+	{
+		const uint32_t threadCount = static_cast<uint32_t>(threadPool.threads.size());
+		return (chunkInstanceCount + threadCount - 1) / threadCount;
+	}
+
+	// Indirect draws for CPU culling are stored after the ones for GPU culling
+	uint32_t getCullSliceCommandIndex(uint32_t chunk, uint32_t slice)
+	{
+		return MAX_INSTANCE_CHUNKS + chunk * MAX_CULL_THREADS + slice;
+	}
+
+	// Indirect draws for both culling modes, the instance counts are written by the culling shader or the CPU culling threads
+	void prepareIndirectCommands()
+	{
+		std::vector<VkDrawIndexedIndirectCommand> commands(MAX_INSTANCE_CHUNKS * (1 + MAX_CULL_THREADS));
+		for (VkDrawIndexedIndirectCommand& command : commands) {
+			command = {};
+			command.indexCount = models.rock.indices.count;
+		}
+		// Host visible, so visible instance counts can be read back and CPU culling can write them directly
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&scalable.indirectCommands,
+			commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+			commands.data()));
+		VK_CHECK_RESULT(scalable.indirectCommands.map());
+	}
+
+	// (Re)generate the instances of the scalable mode and split them into chunks
+	void prepareScalableInstances()
+	{
+		vkDeviceWaitIdle(device);
+		destroyInstanceChunks();
+
+		const uint32_t instanceCount = instanceCounts[instanceCountIndex];
+		scalable.instanceCount = instanceCount;
+		scalable.hostInstances.resize(instanceCount);
+		auto tStart = std::chrono::high_resolution_clock::now();
+		generateInstancesParallel(scalable.hostInstances.data(), instanceCount);
+		timing.generationTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+		for (uint32_t first = 0; first < instanceCount; first += INSTANCE_CHUNK_SIZE) {
+			InstanceChunk chunk;
+			chunk.first = first;
+			chunk.count = std::min((uint32_t)INSTANCE_CHUNK_SIZE, instanceCount - first);
+			const VkDeviceSize chunkSize = chunk.count * sizeof(InstanceData);
+
+			vks::Buffer stagingBuffer;
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, chunkSize, scalable.hostInstances.data() + first));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &chunk.instances, chunkSize));
+			vulkanDevice->copyBuffer(&stagingBuffer, &chunk.instances, queue);
+			stagingBuffer.destroy();
+
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &chunk.visible, chunkSize));
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &chunk.hostVisible, chunkSize));
+			VK_CHECK_RESULT(chunk.hostVisible.map());
+
+			const uint32_t c = static_cast<uint32_t>(scalable.chunks.size());
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[c], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &chunk.instances.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[c], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &chunk.visible.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[c], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &scalable.indirectCommands.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSets[c], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &uniformBuffers.cull.descriptor),
+			};
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+			scalable.chunks.push_back(chunk);
+		}
+	}
+
+	// Same test as the culling shader
+	bool isInstanceVisible(const InstanceData& instance)
+	{
+		const float s = sin(instance.rot.y + uboCull.globSpeed);
+		const float c = cos(instance.rot.y + uboCull.globSpeed);
+		const glm::vec3 pos = glm::vec3(c * instance.pos.x - s * instance.pos.z, instance.pos.y, s * instance.pos.x + c * instance.pos.z);
+		const float radius = uboCull.radius * instance.scale;
+		if (glm::distance(pos, glm::vec3(uboCull.cameraPos)) - radius > uboCull.cullDistance) {
+			return false;
+		}
+		for (uint32_t i = 0; i < 6; i++) {
+			if (glm::dot(glm::vec4(pos, 1.0f), uboCull.frustumPlanes[i]) + radius < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Cull on the host, each thread compacts one slice of every chunk into the same slice of the chunk's host visible buffer and writes the slice's indirect draw
+	void cullInstancesCPU()
+	{
+		auto tStart = std::chrono::high_resolution_clock::now();
+		VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*)scalable.indirectCommands.mapped;
+		for (uint32_t c = 0; c < scalable.chunks.size(); c++) {
+			const InstanceChunk* chunk = &scalable.chunks[c];
+			const uint32_t sliceSize = getCullSliceSize(chunk->count);
+			for (uint32_t t = 0; t * sliceSize < chunk->count; t++) {
+				const uint32_t first = t * sliceSize;
+				const uint32_t count = std::min(sliceSize, chunk->count - first);
+				VkDrawIndexedIndirectCommand* command = &commands[getCullSliceCommandIndex(c, t)];
+				threadPool.threads[t]->addJob([this, chunk, first, count, command] {
+					const InstanceData* src = scalable.hostInstances.data() + chunk->first + first;
+					InstanceData* dst = (InstanceData*)chunk->hostVisible.mapped + first;
+					uint32_t visibleCount = 0;
+					for (uint32_t i = 0; i < count; i++) {
+						if (isInstanceVisible(src[i])) {
+							dst[visibleCount++] = src[i];
+						}
+					}
+					command->instanceCount = visibleCount;
+				});
+			}
+		}
+		threadPool.wait();
+		timing.cpuCullTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+	}
+
+	// Called after the frame has finished executing
+	void getFrameResults()
+	{
+		if (timing.available) {
+			uint64_t timestamps[3];
+			if (vkGetQueryPoolResults(device, timing.queryPool, 0, 3, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				timing.gpuCullTime = (double)(timestamps[1] - timestamps[0]) * timing.timestampPeriod / 1000000.0;
+				timing.gpuFrameTime = (double)(timestamps[2] - timestamps[0]) * timing.timestampPeriod / 1000000.0;
+			}
+		}
+		if (mode == ModeStatic) {
+			timing.visibleInstances = INSTANCE_COUNT;
+			return;
+		}
+		if (culling == CullingNone) {
+			timing.visibleInstances = scalable.instanceCount;
+			return;
+		}
+		const VkDrawIndexedIndirectCommand* commands = (const VkDrawIndexedIndirectCommand*)scalable.indirectCommands.mapped;
+		timing.visibleInstances = 0;
+		for (uint32_t c = 0; c < scalable.chunks.size(); c++) {
+			if (culling == CullingGPU) {
+				timing.visibleInstances += commands[c].instanceCount;
+			} else {
+				const uint32_t sliceSize = getCullSliceSize(scalable.chunks[c].count);
+				for (uint32_t t = 0; t * sliceSize < scalable.chunks[c].count; t++) {
+					timing.visibleInstances += commands[getCullSliceCommandIndex(c, t)].instanceCount;
+				}
+			}
+		}
+	}
+
+	// Benchmark steps run all culling modes for every instance count
+	void applyBenchmarkStep()
+	{
+		const int32_t countIndex = instanceBenchmark.step / 3;
+		culling = instanceBenchmark.step % 3;
+		if (countIndex != instanceCountIndex || scalable.chunks.empty()) {
+			instanceCountIndex = countIndex;
+			prepareScalableInstances();
+		}
+		instanceBenchmark.frame = 0;
+		instanceBenchmark.cpuTime = 0.0;
+		instanceBenchmark.gpuTime = 0.0;
+		buildCommandBuffers();
+	}
+
+	void startInstanceBenchmark()
+	{
+		instanceBenchmark.active = true;
+		instanceBenchmark.step = 0;
+		instanceBenchmark.crossover = 0;
+		instanceBenchmark.results.clear();
+		mode = ModeScalable;
+		applyBenchmarkStep();
+	}
+
+	void updateInstanceBenchmark()
+	{
+		instanceBenchmark.frame++;
+		if (instanceBenchmark.frame <= benchmarkWarmupFrames) {
+			return;
+		}
+		instanceBenchmark.cpuTime += (culling == CullingCPU) ? timing.cpuCullTime : 0.0;
+		instanceBenchmark.gpuTime += timing.gpuFrameTime;
+		if (instanceBenchmark.frame < benchmarkWarmupFrames + benchmarkFrames) {
+			return;
+		}
+
+		BenchmarkResult result;
+		result.instanceCount = scalable.instanceCount;
+		result.culling = culling;
+		result.generationTime = timing.generationTime;
+		result.cpuTime = instanceBenchmark.cpuTime / benchmarkFrames;
+		result.gpuTime = instanceBenchmark.gpuTime / benchmarkFrames;
+		result.visibleInstances = timing.visibleInstances;
+		instanceBenchmark.results.push_back(result);
+
+		instanceBenchmark.step++;
+		if (instanceBenchmark.step < instanceCounts.size() * 3) {
+			applyBenchmarkStep();
+			return;
+		}
+
+		// Report the first instance count at which the frame cost (CPU culling time + GPU time) of GPU culling is lower than that of CPU culling
+		const char* cullingNames[] = { "none", "CPU", "GPU" };
+		std::cout << "Instances\tCulling\tGeneration (ms)\tCPU (ms)\tGPU (ms)\tVisible\n";
+		for (size_t i = 0; i < instanceBenchmark.results.size(); i++) {
+			const BenchmarkResult& r = instanceBenchmark.results[i];
+			std::cout << r.instanceCount << "\t" << cullingNames[r.culling] << "\t" << r.generationTime << "\t" << r.cpuTime << "\t" << r.gpuTime << "\t" << r.visibleInstances << "\n";
+			if (r.culling == CullingGPU && instanceBenchmark.crossover == 0) {
+				const BenchmarkResult& cpu = instanceBenchmark.results[i - 1];
+				if (r.cpuTime + r.gpuTime < cpu.cpuTime + cpu.gpuTime) {
+					instanceBenchmark.crossover = r.instanceCount;
+				}
+			}
+		}
+		if (instanceBenchmark.crossover > 0) {
+			std::cout << "GPU culling is cheaper than CPU culling from " << instanceBenchmark.crossover << " instances\n";
+		} else {
+			std::cout << "CPU culling is cheaper than GPU culling for all instance counts\n";
+		}
+		instanceBenchmark.active = false;
+	}
+
 	void prepareUniformBuffers()
 	{
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
@@ -418,8 +891,15 @@ public:
 			&uniformBuffers.scene,
 			sizeof(uboVS)));
 
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&uniformBuffers.cull,
+			sizeof(uboCull)));
+
 		// Map persistent
 		VK_CHECK_RESULT(uniformBuffers.scene.map());
+		VK_CHECK_RESULT(uniformBuffers.cull.map());
 
 		updateUniformBuffer(true);
 	}
@@ -439,12 +919,26 @@ public:
 		}
 
 		memcpy(uniformBuffers.scene.mapped, &uboVS, sizeof(uboVS));
+
+		// Rocks rotate around the planet, so culling needs to be updated every frame
+		frustum.update(camera.matrices.perspective * camera.matrices.view);
+		memcpy(uboCull.frustumPlanes, frustum.planes.data(), sizeof(glm::vec4) * 6);
+		uboCull.cameraPos = glm::inverse(camera.matrices.view)[3];
+		uboCull.globSpeed = uboVS.globSpeed;
+		uboCull.cullDistance = cullDistance;
+		// Rocks rotate around their origin, so the bounding sphere needs to contain the rock in any orientation
+		uboCull.radius = glm::length(models.rock.dimensions.center) + models.rock.dimensions.radius;
+		memcpy(uniformBuffers.cull.mapped, &uboCull, sizeof(uboCull));
 	}
 
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
 
+		if (mode == ModeScalable && culling == CullingCPU) {
+			cullInstancesCPU();
+		}
+
 		// Command buffer to be sumitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -453,13 +947,28 @@ public:
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
 		VulkanExampleBase::submitFrame();
+
+		// The queue is idle after submitting the frame, so timestamps and visible instance counts of this frame are available
+		getFrameResults();
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
+		threadPool.setThreadCount(std::max(1u, std::min(std::thread::hardware_concurrency(), (uint32_t)MAX_CULL_THREADS)));
+		rngKey = (benchmark.active ? 0x9E3779B97F4A7C15ull : (uint64_t)time(nullptr) * 0x9E3779B97F4A7C15ull) | 1;
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 3;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timing.queryPool));
+			timing.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			timing.available = true;
+		}
 		prepareInstanceData();
+		prepareIndirectCommands();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
 		preparePipelines();
@@ -476,6 +985,9 @@ public:
 			return;
 		}
 		draw();
+		if (instanceBenchmark.active) {
+			updateInstanceBenchmark();
+		}
 		if ((!paused) || (camera.updated))
 		{			
 			updateUniformBuffer(camera.updated);
@@ -489,8 +1001,60 @@ public:
 
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
+		if (!instanceBenchmark.active && overlay->header("Settings")) {
+			if (overlay->comboBox("Mode", &mode, { "Static", "Scalable" })) {
+				if (mode == ModeScalable && scalable.chunks.empty()) {
+					prepareScalableInstances();
+				}
+				buildCommandBuffers();
+			}
+			if (mode == ModeScalable) {
+				if (overlay->comboBox("Instances", &instanceCountIndex, instanceCountNames)) {
+					prepareScalableInstances();
+					buildCommandBuffers();
+				}
+				if (overlay->comboBox("Culling", &culling, { "None", "CPU", "GPU" })) {
+					buildCommandBuffers();
+				}
+				if (overlay->sliderFloat("Cull distance", &cullDistance, 8.0f, 256.0f)) {
+					updateUniformBuffer(false);
+				}
+			}
+		}
 		if (overlay->header("Statistics")) {
-			overlay->text("Instances: %d", INSTANCE_COUNT);
+			overlay->text("Instances: %d", (mode == ModeScalable) ? scalable.instanceCount : INSTANCE_COUNT);
+			overlay->text("Visible: %d", timing.visibleInstances);
+			if (mode == ModeScalable) {
+				overlay->text("Chunks: %d", static_cast<uint32_t>(scalable.chunks.size()));
+				overlay->text("Generation: %.2f ms (%d threads)", timing.generationTime, static_cast<uint32_t>(threadPool.threads.size()));
+				if (culling == CullingCPU) {
+					overlay->text("CPU culling: %.3f ms", timing.cpuCullTime);
+				}
+			}
+			if (timing.available) {
+				if (mode == ModeScalable && culling == CullingGPU) {
+					overlay->text("GPU culling: %.3f ms", timing.gpuCullTime);
+				}
+				overlay->text("GPU frame: %.3f ms", timing.gpuFrameTime);
+			}
+		}
+		if (timing.available && overlay->header("Benchmark")) {
+			if (instanceBenchmark.active) {
+				overlay->text("Running %d / %d", instanceBenchmark.step + 1, static_cast<uint32_t>(instanceCounts.size() * 3));
+			} else if (overlay->button("Run")) {
+				startInstanceBenchmark();
+			}
+			const char* cullingNames[] = { "none", "CPU", "GPU" };
+			for (const BenchmarkResult& result : instanceBenchmark.results) {
+				overlay->text("%d %s: %.3f ms CPU, %.3f ms GPU", result.instanceCount, cullingNames[result.culling], result.cpuTime, result.gpuTime);
+			}
+			if (!instanceBenchmark.active && !instanceBenchmark.results.empty()) {
+				if (instanceBenchmark.crossover > 0) {
+					overlay->text("GPU culling cheaper from %d instances", instanceBenchmark.crossover);
+				} else {
+					overlay->text("CPU culling cheaper for all counts");
+				}
+			}
 		}
 	}
 };
@@ -10,6 +10,7 @@
 
 #include "threadpool.hpp"
 #include "frustum.hpp"
+#include "occlusionculler.hpp"
 
 #include "VulkanglTFModel.h"
 
@@ -19,6 +20,9 @@ class VulkanExample : public VulkanExampleBase
 {
 public:
 	bool displayStarSphere = true;
+	bool occlusionCulling = true;
+	// Number of objects closest to the camera that are rasterized as occluders
+	int32_t occluderCount = 24;
 
 	struct {
 		vkglTF::Model ufo;
@@ -92,6 +96,9 @@ public:
 
 	// View frustum for culling invisible objects
 	vks::Frustum frustum;
+	// Software rasterized depth buffer for culling objects hidden behind other objects before recording their command buffers
+	vks::OcclusionCuller occlusionCuller;
+	uint32_t frustumCulledObjects = 0;
 
 	std::default_random_engine rndEngine;
 
@@ -112,7 +119,14 @@ public:
 		std::cout << "numThreads = " << numThreads << std::endl;
 #endif
 		threadPool.setThreadCount(numThreads);
+#if defined(VKS_PROFILER)
+		for (uint32_t i = 0; i < numThreads; i++) {
+			threadPool.threads[i]->addJob([i] { VKS_PROFILE_THREAD("Worker " + std::to_string(i)); });
+		}
+#endif
 		numObjectsPerThread = 512 / numThreads;
+		occlusionCuller.setResolution(320, 192);
+		occlusionCuller.setThreadPool(&threadPool);
 		rndEngine.seed(benchmark.active ? 0 : (unsigned)time(nullptr));
 	}
 
@@ -202,9 +216,58 @@ public:
 
 	}
 
+	// Animates the objects of a thread, done before recording so the occluders use the current frame's matrices
+	void threadUpdateCode(uint32_t threadIndex)
+	{
+		ThreadData *thread = &threadData[threadIndex];
+		for (ObjectData& object : thread->objectData) {
+			ObjectData *objectData = &object;
+			if (!paused) {
+				objectData->rotation.y += 2.5f * objectData->rotationSpeed * frameTimer;
+				if (objectData->rotation.y > 360.0f) {
+					objectData->rotation.y -= 360.0f;
+				}
+				objectData->deltaT += 0.15f * frameTimer;
+				if (objectData->deltaT > 1.0f)
+					objectData->deltaT -= 1.0f;
+				objectData->pos.y = sin(glm::radians(objectData->deltaT * 360.0f)) * 2.5f;
+			}
+
+			objectData->model = glm::translate(glm::mat4(1.0f), objectData->pos);
+			objectData->model = glm::rotate(objectData->model, -sinf(glm::radians(objectData->deltaT * 360.0f)) * 0.25f, glm::vec3(objectData->rotationDir, 0.0f, 0.0f));
+			objectData->model = glm::rotate(objectData->model, glm::radians(objectData->rotation.y), glm::vec3(0.0f, objectData->rotationDir, 0.0f));
+			objectData->model = glm::rotate(objectData->model, glm::radians(objectData->deltaT * 360.0f), glm::vec3(0.0f, objectData->rotationDir, 0.0f));
+			objectData->model = glm::scale(objectData->model, glm::vec3(objectData->scale));
+		}
+	}
+
+	// Rasterizes the objects closest to the camera into the software depth buffer used for occlusion culling
+	void rasterizeOccluders()
+	{
+		VKS_PROFILE_ZONE("rasterize occluders");
+		std::vector<std::pair<float, const ObjectData*>> candidates;
+		for (auto& thread : threadData) {
+			for (auto& objectData : thread.objectData) {
+				if (frustum.checkSphere(objectData.pos, models.ufo.dimensions.radius * 0.5f)) {
+					candidates.push_back(std::make_pair(glm::length(glm::vec3(matrices.view * glm::vec4(objectData.pos, 1.0f))), &objectData));
+				}
+			}
+		}
+		const size_t count = std::min(candidates.size(), static_cast<size_t>(occluderCount));
+		std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+			[](const std::pair<float, const ObjectData*>& a, const std::pair<float, const ObjectData*>& b) { return a.first < b.first; });
+
+		occlusionCuller.beginFrame(matrices.projection * matrices.view);
+		for (size_t i = 0; i < count; i++) {
+			occlusionCuller.addOccluder(&models.ufo.hostVertices[0].pos, sizeof(vkglTF::Vertex), models.ufo.hostIndices.data(), static_cast<uint32_t>(models.ufo.hostIndices.size()), candidates[i].second->model);
+		}
+		occlusionCuller.rasterize();
+	}
+
 	// Builds the secondary command buffer for each thread
 	void threadRenderCode(uint32_t threadIndex, uint32_t cmdBufferIndex, VkCommandBufferInheritanceInfo inheritanceInfo)
 	{
+		VKS_PROFILE_ZONE("object record");
 		ThreadData *thread = &threadData[threadIndex];
 		ObjectData *objectData = &thread->objectData[cmdBufferIndex];
 
@@ -216,6 +279,14 @@ public:
 			return;
 		}
 
+		// Objects hidden behind the occluders are neither recorded nor submitted
+		if (occlusionCulling) {
+			objectData->visible = occlusionCuller.isVisible(models.ufo.dimensions.min, models.ufo.dimensions.max, objectData->model);
+			if (!objectData->visible) {
+				return;
+			}
+		}
+
 		VkCommandBufferBeginInfo commandBufferBeginInfo = vks::initializers::commandBufferBeginInfo();
 		commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
 		commandBufferBeginInfo.pInheritanceInfo = &inheritanceInfo;
@@ -232,24 +303,6 @@ public:
 
 		vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.phong);
 
-		// Update
-		if (!paused) {
-			objectData->rotation.y += 2.5f * objectData->rotationSpeed * frameTimer;
-			if (objectData->rotation.y > 360.0f) {
-				objectData->rotation.y -= 360.0f;
-			}
-			objectData->deltaT += 0.15f * frameTimer;
-			if (objectData->deltaT > 1.0f)
-				objectData->deltaT -= 1.0f;
-			objectData->pos.y = sin(glm::radians(objectData->deltaT * 360.0f)) * 2.5f;
-		}
-
-		objectData->model = glm::translate(glm::mat4(1.0f), objectData->pos);
-		objectData->model = glm::rotate(objectData->model, -sinf(glm::radians(objectData->deltaT * 360.0f)) * 0.25f, glm::vec3(objectData->rotationDir, 0.0f, 0.0f));
-		objectData->model = glm::rotate(objectData->model, glm::radians(objectData->rotation.y), glm::vec3(0.0f, objectData->rotationDir, 0.0f));
-		objectData->model = glm::rotate(objectData->model, glm::radians(objectData->deltaT * 360.0f), glm::vec3(0.0f, objectData->rotationDir, 0.0f));
-		objectData->model = glm::scale(objectData->model, glm::vec3(objectData->scale));
-
 		thread->pushConstBlock[cmdBufferIndex].mvp = matrices.projection * matrices.view * objectData->model;
 
 		// Update shader push constant block
@@ -331,6 +384,7 @@ public:
 	// lat submitted to the queue for rendering
 	void updateCommandBuffers(VkFramebuffer frameBuffer)
 	{
+		VKS_PROFILE_ZONE("record");
 		// Contains the list of secondary command buffers to be submitted
 		std::vector<VkCommandBuffer> commandBuffers;
 
@@ -371,6 +425,17 @@ public:
 			commandBuffers.push_back(secondaryCommandBuffers.background);
 		}
 
+		// Animate all objects first, the occlusion culler needs the current matrices of the occluders
+		for (uint32_t t = 0; t < numThreads; t++)
+		{
+			threadPool.threads[t]->addJob([=] { threadUpdateCode(t); });
+		}
+		threadPool.wait();
+
+		if (occlusionCulling) {
+			rasterizeOccluders();
+		}
+
 		// Add a job to the thread's queue for each object to be rendered
 		for (uint32_t t = 0; t < numThreads; t++)
 		{
@@ -380,9 +445,12 @@ public:
 			}
 		}
 
-		threadPool.wait();
+		{
+			VKS_PROFILE_ZONE("wait for workers");
+			threadPool.wait();
+		}
 
-		// Only submit if object is within the current view frustum
+		// Only submit if object is within the current view frustum and not occluded
 		for (uint32_t t = 0; t < numThreads; t++)
 		{
 			for (uint32_t i = 0; i < numObjectsPerThread; i++)
@@ -393,6 +461,10 @@ public:
 				}
 			}
 		}
+		frustumCulledObjects = numThreads * numObjectsPerThread - static_cast<uint32_t>(commandBuffers.size()) + (displayStarSphere ? 1 : 0);
+		if (occlusionCulling) {
+			frustumCulledObjects -= occlusionCuller.getStatistics().culledObjects;
+		}
 
 		// Render ui last
 		if (UIOverlay.visible) {
@@ -410,7 +482,8 @@ public:
 	void loadAssets()
 	{
 		const uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::PreMultiplyVertexColors | vkglTF::FileLoadingFlags::FlipY;
-		models.ufo.loadFromFile(getAssetPath() + "models/retroufo_red_lowpoly.gltf",vulkanDevice, queue,glTFLoadingFlags);
+		// The ufo's vertices and indices are also used by the software occlusion culler
+		models.ufo.loadFromFile(getAssetPath() + "models/retroufo_red_lowpoly.gltf",vulkanDevice, queue,glTFLoadingFlags | vkglTF::FileLoadingFlags::KeepHostData);
 		models.starSphere.loadFromFile(getAssetPath() + "models/sphere.gltf", vulkanDevice, queue, glTFLoadingFlags);
 	}
 
@@ -481,12 +554,15 @@ public:
 	void draw()
 	{
 		// Wait for fence to signal that all command buffers are ready
-		VkResult fenceRes;
-		do {
-			fenceRes = vkWaitForFences(device, 1, &renderFence, VK_TRUE, 100000000);
-		} while (fenceRes == VK_TIMEOUT);
-		VK_CHECK_RESULT(fenceRes);
-		vkResetFences(device, 1, &renderFence);
+		{
+			VKS_PROFILE_ZONE("wait for fence");
+			VkResult fenceRes;
+			do {
+				fenceRes = vkWaitForFences(device, 1, &renderFence, VK_TRUE, 100000000);
+			} while (fenceRes == VK_TIMEOUT);
+			VK_CHECK_RESULT(fenceRes);
+			vkResetFences(device, 1, &renderFence);
+		}
 
 		VulkanExampleBase::prepareFrame();
 
@@ -495,7 +571,10 @@ public:
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &primaryCommandBuffer;
 
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, renderFence));
+		{
+			VKS_PROFILE_ZONE("submit");
+			VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, renderFence));
+		}
 
 		VulkanExampleBase::submitFrame();
 	}
@@ -534,9 +613,20 @@ public:
 	{
 		if (overlay->header("Statistics")) {
 			overlay->text("Active threads: %d", numThreads);
+			const uint32_t objectCount = numThreads * numObjectsPerThread;
+			overlay->text("Frustum culled: %d / %d", frustumCulledObjects, objectCount);
+			if (occlusionCulling) {
+				const vks::OcclusionCuller::Statistics statistics = occlusionCuller.getStatistics();
+				overlay->text("Occlusion culled: %d / %d (%.1f%%)", statistics.culledObjects, statistics.testedObjects, statistics.testedObjects > 0 ? 100.0f * statistics.culledObjects / statistics.testedObjects : 0.0f);
+				overlay->text("Occluder triangles: %d", statistics.rasterizedTriangles);
+				overlay->text("Rasterize: %.3f ms", statistics.rasterizeTime);
+				overlay->text("Test: %.3f ms (all threads)", statistics.testTime);
+			}
 		}
 		if (overlay->header("Settings")) {
 			overlay->checkBox("Stars", &displayStarSphere);
+			overlay->checkBox("Occlusion culling", &occlusionCulling);
+			overlay->sliderInt("Occluders", &occluderCount, 1, 64);
 		}
 
 	}
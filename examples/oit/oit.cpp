@@ -27,8 +27,9 @@ public:
 		vks::Buffer renderPass;
 	} uniformBuffers;
 
+	// Color is packed to RGBA8 to keep nodes at 12 bytes
 	struct Node {
-		glm::vec4 color;
+		uint32_t color;
 		float depth;
 		uint32_t next;
 	};
@@ -44,8 +45,46 @@ public:
 		vks::Buffer geometry;
 		vks::Texture headIndex;
 		vks::Buffer linkedList;
+		// Host visible copy of the node counter to report fragments that didn't fit into the linked list
+		vks::Buffer readback;
+		VkDeviceSize memorySize;
 	} geometryPass;
 
+	// Linked lists store all fragments but need memory for a fixed number of nodes per pixel (fragments beyond that are dropped)
+	// Weighted blended OIT approximates the result with two blended render targets at fixed memory per pixel
+	enum Mode { ModeLinkedList = 0, ModeWeightedBlended = 1 };
+	int32_t mode = ModeLinkedList;
+	int32_t nodesPerPixelIndex = 3;
+	const std::vector<uint32_t> nodesPerPixelOptions = { 4, 8, 12, NODE_COUNT };
+
+	struct FrameBufferAttachment {
+		VkImage image;
+		VkDeviceMemory memory;
+		VkImageView view;
+		VkFormat format;
+	};
+
+	struct WeightedBlendedPass {
+		VkRenderPass renderPass;
+		VkFramebuffer framebuffer;
+		// RGB = sum of weighted colors, A = revealage (product of 1 - alpha)
+		FrameBufferAttachment accumulation;
+		// Sum of weights
+		FrameBufferAttachment weight;
+		VkSampler sampler = VK_NULL_HANDLE;
+		VkDeviceSize memorySize;
+	} weightedBlendedPass;
+
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		// Last GPU frame time of each mode in ms
+		std::array<float, 2> gpuTime = { 0.0f, 0.0f };
+		uint32_t fragmentCount = 0;
+		uint32_t overflowCount = 0;
+	} stats;
+
 	struct {
 		glm::mat4 projection;
 		glm::mat4 view;
@@ -59,21 +98,26 @@ public:
 	struct {
 		VkDescriptorSetLayout geometry;
 		VkDescriptorSetLayout color;
+		VkDescriptorSetLayout composite;
 	} descriptorSetLayouts;
 
 	struct {
 		VkPipelineLayout geometry;
 		VkPipelineLayout color;
+		VkPipelineLayout composite;
 	} pipelineLayouts;
 
 	struct {
 		VkPipeline geometry;
 		VkPipeline color;
+		VkPipeline weightedBlended;
+		VkPipeline composite;
 	} pipelines;
 
 	struct {
 		VkDescriptorSet geometry;
 		VkDescriptorSet color;
+		VkDescriptorSet composite;
 	} descriptorSets;
 
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
@@ -89,14 +133,23 @@ public:
 	{
 		vkDestroyPipeline(device, pipelines.geometry, nullptr);
 		vkDestroyPipeline(device, pipelines.color, nullptr);
+		vkDestroyPipeline(device, pipelines.weightedBlended, nullptr);
+		vkDestroyPipeline(device, pipelines.composite, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayouts.geometry, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.color, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.composite, nullptr);
 
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.geometry, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.color, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.composite, nullptr);
 
 		destroyGeometryPass();
+		destroyWeightedBlendedPass();
+		vkDestroySampler(device, weightedBlendedPass.sampler, nullptr);
+		if (stats.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, stats.queryPool, nullptr);
+		}
 
 		uniformBuffers.renderPass.destroy();
 	}
@@ -115,7 +168,9 @@ public:
 		VulkanExampleBase::prepare();
 		loadAssets();
 		prepareUniformBuffers();
+		prepareTimestamps();
 		prepareGeometryPass();
+		prepareWeightedBlendedPass();
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
@@ -133,14 +188,54 @@ public:
 	}
 
 	void windowResized() override
+	{
+		recreatePasses();
+		resized = false;
+		buildCommandBuffers();
+	}
+
+	// Both passes depend on the framebuffer size, the linked list also on the number of nodes per pixel
+	void recreatePasses()
 	{
 		destroyGeometryPass();
 		prepareGeometryPass();
+		destroyWeightedBlendedPass();
+		prepareWeightedBlendedPass();
 		vkResetDescriptorPool(device, descriptorPool, 0);
 		setupDescriptorSets();
+	}
 
-		resized = false;
-		buildCommandBuffers();
+	void OnUpdateUIOverlay(vks::UIOverlay *overlay) override
+	{
+		if (overlay->header("Settings")) {
+			if (overlay->comboBox("Mode", &mode, { "Linked list", "Weighted blended" })) {
+				buildCommandBuffers();
+			}
+			if (mode == ModeLinkedList) {
+				std::vector<std::string> nodeCountNames;
+				for (uint32_t nodeCount : nodesPerPixelOptions) {
+					nodeCountNames.push_back(std::to_string(nodeCount));
+				}
+				if (overlay->comboBox("Nodes per pixel", &nodesPerPixelIndex, nodeCountNames)) {
+					vkDeviceWaitIdle(device);
+					recreatePasses();
+					buildCommandBuffers();
+				}
+			}
+		}
+		if (overlay->header("Statistics")) {
+			if (mode == ModeLinkedList) {
+				overlay->text("Memory: %.2f MB", (float)geometryPass.memorySize / (1024.0f * 1024.0f));
+				overlay->text("Fragments: %d", stats.fragmentCount);
+				overlay->text("Dropped fragments: %d", stats.overflowCount);
+			} else {
+				overlay->text("Memory: %.2f MB", (float)weightedBlendedPass.memorySize / (1024.0f * 1024.0f));
+			}
+			if (stats.available) {
+				overlay->text("GPU time linked list: %.3f ms", stats.gpuTime[ModeLinkedList]);
+				overlay->text("GPU time weighted blended: %.3f ms", stats.gpuTime[ModeWeightedBlended]);
+			}
+		}
 	}
 
 	void viewChanged() override
@@ -168,6 +263,20 @@ private:
 		VK_CHECK_RESULT(uniformBuffers.renderPass.map());
 	}
 
+	void prepareTimestamps()
+	{
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits == 0) {
+			return;
+		}
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2;
+		VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &stats.queryPool));
+		stats.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+		stats.available = true;
+	}
+
 	void prepareGeometryPass()
 	{
 		VkSubpassDescription subpassDescription = {};
@@ -202,14 +311,21 @@ private:
 		VK_CHECK_RESULT(stagingBuffer.map());
 
 		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 			&geometryPass.geometry,
 			sizeof(geometrySBO)));
 
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&geometryPass.readback,
+			sizeof(geometrySBO)));
+		VK_CHECK_RESULT(geometryPass.readback.map());
+
 		// Set up GeometrySBO data.
 		geometrySBO.count = 0;
-		geometrySBO.maxNodeCount = NODE_COUNT * width * height;
+		geometrySBO.maxNodeCount = nodesPerPixelOptions[nodesPerPixelIndex] * width * height;
 		memcpy(stagingBuffer.mapped, &geometrySBO, sizeof(geometrySBO));
 
 		// Copy data to device
@@ -284,6 +400,8 @@ private:
 			&geometryPass.linkedList,
 			sizeof(Node) * geometrySBO.maxNodeCount));
 
+		geometryPass.memorySize = memReqs.size + geometryPass.linkedList.size;
+
 		// Change HeadIndex image's layout from UNDEFINED to GENERAL
 		VkCommandBufferAllocateInfo cmdBufAllocInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
 
@@ -312,6 +430,120 @@ private:
 
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 		VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+		vkFreeCommandBuffers(device, cmdPool, 1, &cmdBuf);
+	}
+
+	void createAttachment(VkFormat format, FrameBufferAttachment *attachment)
+	{
+		attachment->format = format;
+
+		VkImageCreateInfo imageInfo = vks::initializers::imageCreateInfo();
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = format;
+		imageInfo.extent = { width, height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &attachment->image));
+
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, attachment->image, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &attachment->memory));
+		VK_CHECK_RESULT(vkBindImageMemory(device, attachment->image, attachment->memory, 0));
+		weightedBlendedPass.memorySize += memReqs.size;
+
+		VkImageViewCreateInfo imageViewInfo = vks::initializers::imageViewCreateInfo();
+		imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageViewInfo.format = format;
+		imageViewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		imageViewInfo.image = attachment->image;
+		VK_CHECK_RESULT(vkCreateImageView(device, &imageViewInfo, nullptr, &attachment->view));
+	}
+
+	// Weighted blended OIT renders into an accumulation and a weight target, resolved in the color pass
+	void prepareWeightedBlendedPass()
+	{
+		weightedBlendedPass.memorySize = 0;
+		createAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, &weightedBlendedPass.accumulation);
+		createAttachment(VK_FORMAT_R16_SFLOAT, &weightedBlendedPass.weight);
+
+		std::array<VkAttachmentDescription, 2> attachments = {};
+		attachments[0].format = weightedBlendedPass.accumulation.format;
+		attachments[1].format = weightedBlendedPass.weight.format;
+		for (VkAttachmentDescription& attachment : attachments) {
+			attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+			attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+			attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+			attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+			attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+			attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		}
+
+		std::array<VkAttachmentReference, 2> colorReferences = {};
+		colorReferences[0] = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		colorReferences[1] = { 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpassDescription = {};
+		subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpassDescription.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+		subpassDescription.pColorAttachments = colorReferences.data();
+
+		// Use subpass dependencies for layout transitions
+		std::array<VkSubpassDependency, 2> dependencies;
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+		dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+		VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+		renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+		renderPassInfo.pAttachments = attachments.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpassDescription;
+		renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+		renderPassInfo.pDependencies = dependencies.data();
+		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &weightedBlendedPass.renderPass));
+
+		std::array<VkImageView, 2> views = { weightedBlendedPass.accumulation.view, weightedBlendedPass.weight.view };
+		VkFramebufferCreateInfo fbufCreateInfo = vks::initializers::framebufferCreateInfo();
+		fbufCreateInfo.renderPass = weightedBlendedPass.renderPass;
+		fbufCreateInfo.attachmentCount = static_cast<uint32_t>(views.size());
+		fbufCreateInfo.pAttachments = views.data();
+		fbufCreateInfo.width = width;
+		fbufCreateInfo.height = height;
+		fbufCreateInfo.layers = 1;
+		VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &weightedBlendedPass.framebuffer));
+
+		// Attachments are fetched per pixel, the sampler is only required for the combined image sampler descriptors
+		if (weightedBlendedPass.sampler == VK_NULL_HANDLE) {
+			VkSamplerCreateInfo sampler = vks::initializers::samplerCreateInfo();
+			sampler.magFilter = VK_FILTER_NEAREST;
+			sampler.minFilter = VK_FILTER_NEAREST;
+			sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+			sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			sampler.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			sampler.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+			sampler.maxLod = 1.0f;
+			sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+			VK_CHECK_RESULT(vkCreateSampler(device, &sampler, nullptr, &weightedBlendedPass.sampler));
+		}
 	}
 
 	void setupDescriptorSetLayout()
@@ -371,6 +603,26 @@ private:
 		// Create a color pipeline layout.
 		pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.color, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayouts.color));
+
+		// Create a weighted blended composition descriptor set layout.
+		setLayoutBindings = {
+			// Accumulation
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				0),
+			// Weight
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				1),
+		};
+
+		descriptorLayoutCI = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayoutCI, nullptr, &descriptorSetLayouts.composite));
+
+		pipelineLayoutCI = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.composite, 1);
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCI, nullptr, &pipelineLayouts.composite));
 	}
 
 	void preparePipelines()
@@ -428,6 +680,41 @@ private:
 		rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 
 		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.color));
+
+		// Create a weighted blended composition pipeline (same fullscreen triangle as the color pipeline)
+		pipelineCI.layout = pipelineLayouts.composite;
+		shaderStages[1] = loadShader(getShadersPath() + "oit/wboitcomposite.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.composite));
+
+		// Create a weighted blended geometry pipeline.
+		// Both targets share one blend state, so no independent blending is required: colors are summed up, alpha is multiplied by (1 - alpha)
+		blendAttachmentState.blendEnable = VK_TRUE;
+		blendAttachmentState.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blendAttachmentState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+		blendAttachmentState.colorBlendOp = VK_BLEND_OP_ADD;
+		blendAttachmentState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		blendAttachmentState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+		blendAttachmentState.alphaBlendOp = VK_BLEND_OP_ADD;
+		std::array<VkPipelineColorBlendAttachmentState, 2> blendAttachmentStates = { blendAttachmentState, blendAttachmentState };
+		colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(static_cast<uint32_t>(blendAttachmentStates.size()), blendAttachmentStates.data());
+		rasterizationState.cullMode = VK_CULL_MODE_BACK_BIT;
+
+		pipelineCI = vks::initializers::pipelineCreateInfo(pipelineLayouts.geometry, weightedBlendedPass.renderPass);
+		pipelineCI.pInputAssemblyState = &inputAssemblyState;
+		pipelineCI.pRasterizationState = &rasterizationState;
+		pipelineCI.pColorBlendState = &colorBlendState;
+		pipelineCI.pMultisampleState = &multisampleState;
+		pipelineCI.pViewportState = &viewportState;
+		pipelineCI.pDepthStencilState = &depthStencilState;
+		pipelineCI.pDynamicState = &dynamicState;
+		pipelineCI.stageCount = static_cast<uint32_t>(shaderStages.size());
+		pipelineCI.pStages = shaderStages.data();
+		pipelineCI.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position });
+
+		shaderStages[0] = loadShader(getShadersPath() + "oit/wboit.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+		shaderStages[1] = loadShader(getShadersPath() + "oit/wboit.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+
+		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.weightedBlended));
 	}
 
 	void setupDescriptorPool()
@@ -437,10 +724,11 @@ private:
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1),
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3),
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2),
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
-			vks::initializers::descriptorPoolCreateInfo(poolSizes, 2);
+			vks::initializers::descriptorPoolCreateInfo(poolSizes, 3);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -510,6 +798,34 @@ private:
 		};
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+
+		// Update a weighted blended composition descriptor set.
+		allocInfo =
+			vks::initializers::descriptorSetAllocateInfo(
+				descriptorPool,
+				&descriptorSetLayouts.composite,
+				1);
+
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.composite));
+
+		VkDescriptorImageInfo accumulationDescriptor = vks::initializers::descriptorImageInfo(weightedBlendedPass.sampler, weightedBlendedPass.accumulation.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		VkDescriptorImageInfo weightDescriptor = vks::initializers::descriptorImageInfo(weightedBlendedPass.sampler, weightedBlendedPass.weight.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		writeDescriptorSets = {
+			// Binding 0: Accumulation
+			vks::initializers::writeDescriptorSet(
+				descriptorSets.composite,
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				0,
+				&accumulationDescriptor),
+			// Binding 1: Weight
+			vks::initializers::writeDescriptorSet(
+				descriptorSets.composite,
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				1,
+				&weightDescriptor)
+		};
+
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 	}
 
 	void buildCommandBuffers() override
@@ -542,6 +858,48 @@ private:
 			// Update dynamic scissor state
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
+			if (stats.available) {
+				vkCmdResetQueryPool(drawCmdBuffers[i], stats.queryPool, 0, 2);
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, stats.queryPool, 0);
+			}
+
+			if (mode == ModeWeightedBlended) {
+				// Begin the weighted blended render pass
+				VkClearValue weightedBlendedClearValues[2];
+				weightedBlendedClearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+				weightedBlendedClearValues[1].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+				renderPassBeginInfo.renderPass = weightedBlendedPass.renderPass;
+				renderPassBeginInfo.framebuffer = weightedBlendedPass.framebuffer;
+				renderPassBeginInfo.clearValueCount = 2;
+				renderPassBeginInfo.pClearValues = weightedBlendedClearValues;
+
+				vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.weightedBlended);
+				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.geometry, 0, 1, &descriptorSets.geometry, 0, nullptr);
+				drawScene(drawCmdBuffers[i]);
+				vkCmdEndRenderPass(drawCmdBuffers[i]);
+
+				// Begin the color render pass
+				renderPassBeginInfo.renderPass = renderPass;
+				renderPassBeginInfo.framebuffer = frameBuffers[i];
+				renderPassBeginInfo.clearValueCount = 2;
+				renderPassBeginInfo.pClearValues = clearValues;
+
+				vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.composite);
+				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.composite, 0, 1, &descriptorSets.composite, 0, nullptr);
+				vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
+				drawUI(drawCmdBuffers[i]);
+				vkCmdEndRenderPass(drawCmdBuffers[i]);
+
+				if (stats.available) {
+					vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, stats.queryPool, 1);
+				}
+
+				VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
+				continue;
+			}
+
 			VkClearColorValue clearColor;
 			clearColor.uint32[0] = 0xffffffff;
 
@@ -570,40 +928,8 @@ private:
 
 			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.geometry);
-			uint32_t dynamicOffset = 0;
-			models.sphere.bindBuffers(drawCmdBuffers[i]);
-
-			// Render the scene
-			ObjectData objectData;
-
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.geometry, 0, 1, &descriptorSets.geometry, 0, nullptr);
-			objectData.color = glm::vec4(1.0f, 0.0f, 0.0f, 0.5f);
-			for (int32_t x = 0; x < 5; x++)
-			{
-				for (int32_t y = 0; y < 5; y++)
-				{
-					for (int32_t z = 0; z < 5; z++)
-					{
-						glm::mat4 T = glm::translate(glm::mat4(1.0f), glm::vec3(x - 2, y - 2, z - 2));
-						glm::mat4 S = glm::scale(glm::mat4(1.0f), glm::vec3(0.3f));
-						objectData.model = T * S;
-						vkCmdPushConstants(drawCmdBuffers[i], pipelineLayouts.geometry, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ObjectData), &objectData);
-						models.sphere.draw(drawCmdBuffers[i]);
-					}
-				}
-			}
-
-			models.cube.bindBuffers(drawCmdBuffers[i]);
-			objectData.color = glm::vec4(0.0f, 0.0f, 1.0f, 0.5f);
-			for (uint32_t x = 0; x < 2; x++)
-			{
-				glm::mat4 T = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * x - 1.5f, 0.0f, 0.0f));
-				glm::mat4 S = glm::scale(glm::mat4(1.0f), glm::vec3(0.2f));
-				objectData.model = T * S;
-				vkCmdPushConstants(drawCmdBuffers[i], pipelineLayouts.geometry, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ObjectData), &objectData);
-				models.cube.draw(drawCmdBuffers[i]);
-			}
-
+			drawScene(drawCmdBuffers[i]);
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
 			// Make a pipeline barrier to guarantee the geometry pass is done
@@ -628,10 +954,56 @@ private:
 			drawUI(drawCmdBuffers[i]);
 			vkCmdEndRenderPass(drawCmdBuffers[i]);
 
+			// Copy the node counter to the host, nodes beyond the maximum node count have been dropped
+			memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			vkCmdPipelineBarrier(drawCmdBuffers[i], VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+			VkBufferCopy copyRegion = {};
+			copyRegion.size = sizeof(geometrySBO);
+			vkCmdCopyBuffer(drawCmdBuffers[i], geometryPass.geometry.buffer, geometryPass.readback.buffer, 1, &copyRegion);
+
+			if (stats.available) {
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, stats.queryPool, 1);
+			}
+
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
 	}
 
+	// Render the transparent scene with the currently bound geometry pipeline
+	void drawScene(VkCommandBuffer commandBuffer)
+	{
+		ObjectData objectData;
+
+		models.sphere.bindBuffers(commandBuffer);
+		objectData.color = glm::vec4(1.0f, 0.0f, 0.0f, 0.5f);
+		for (int32_t x = 0; x < 5; x++)
+		{
+			for (int32_t y = 0; y < 5; y++)
+			{
+				for (int32_t z = 0; z < 5; z++)
+				{
+					glm::mat4 T = glm::translate(glm::mat4(1.0f), glm::vec3(x - 2, y - 2, z - 2));
+					glm::mat4 S = glm::scale(glm::mat4(1.0f), glm::vec3(0.3f));
+					objectData.model = T * S;
+					vkCmdPushConstants(commandBuffer, pipelineLayouts.geometry, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ObjectData), &objectData);
+					models.sphere.draw(commandBuffer);
+				}
+			}
+		}
+
+		models.cube.bindBuffers(commandBuffer);
+		objectData.color = glm::vec4(0.0f, 0.0f, 1.0f, 0.5f);
+		for (uint32_t x = 0; x < 2; x++)
+		{
+			glm::mat4 T = glm::translate(glm::mat4(1.0f), glm::vec3(3.0f * x - 1.5f, 0.0f, 0.0f));
+			glm::mat4 S = glm::scale(glm::mat4(1.0f), glm::vec3(0.2f));
+			objectData.model = T * S;
+			vkCmdPushConstants(commandBuffer, pipelineLayouts.geometry, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ObjectData), &objectData);
+			models.cube.draw(commandBuffer);
+		}
+	}
+
 	void updateUniformBuffers()
 	{
 		renderPassUBO.projection = camera.matrices.perspective;
@@ -646,6 +1018,19 @@ private:
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 		VulkanExampleBase::submitFrame();
+
+		// The queue is idle after submitting the frame, so timestamps and the node counter of this frame are available
+		if (stats.available) {
+			uint64_t timestamps[2];
+			if (vkGetQueryPoolResults(device, stats.queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				stats.gpuTime[mode] = (float)(timestamps[1] - timestamps[0]) * stats.timestampPeriod / 1000000.0f;
+			}
+		}
+		if (mode == ModeLinkedList) {
+			const uint32_t* counter = (const uint32_t*)geometryPass.readback.mapped;
+			stats.fragmentCount = counter[0];
+			stats.overflowCount = (counter[0] > counter[1]) ? counter[0] - counter[1] : 0;
+		}
 	}
 
 	void destroyGeometryPass()
@@ -655,6 +1040,18 @@ private:
 		geometryPass.geometry.destroy();
 		geometryPass.headIndex.destroy();
 		geometryPass.linkedList.destroy();
+		geometryPass.readback.destroy();
+	}
+
+	void destroyWeightedBlendedPass()
+	{
+		vkDestroyRenderPass(device, weightedBlendedPass.renderPass, nullptr);
+		vkDestroyFramebuffer(device, weightedBlendedPass.framebuffer, nullptr);
+		for (FrameBufferAttachment* attachment : { &weightedBlendedPass.accumulation, &weightedBlendedPass.weight }) {
+			vkDestroyImageView(device, attachment->view, nullptr);
+			vkDestroyImage(device, attachment->image, nullptr);
+			vkFreeMemory(device, attachment->memory, nullptr);
+		}
 	}
 
 private:
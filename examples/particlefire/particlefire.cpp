@@ -1,6 +1,10 @@
 /*
 * Vulkan Example - CPU based fire particle system
 *
+* The particles are simulated on the CPU and written to a host visible vertex buffer each frame
+* Besides the original (array of structures) update loop, the simulation can be run on structure of arrays storage with SIMD kernels (SSE/AVX with scalar fallback),
+* split into chunks that are updated in parallel on a thread pool and written directly into the vertex buffer of the current frame
+*
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
@@ -8,6 +12,16 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "threadpool.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PARTICLE_SIMD_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define PARTICLE_SIMD_SSE
+#endif
 
 #define ENABLE_VALIDATION false
 #define PARTICLE_COUNT 512
@@ -18,6 +32,22 @@
 #define PARTICLE_TYPE_FLAME 0
 #define PARTICLE_TYPE_SMOKE 1
 
+// Number of particles simulated and written in one go, so the written data is still in cache
+#define PARTICLE_BLOCK_SIZE 1024
+// Minimum number of particles per thread pool job
+#define PARTICLE_MIN_CHUNK_SIZE 8192
+
+// Vertex layout consumed by the particle shaders
+struct ParticleVertex {
+	glm::vec4 pos;
+	glm::vec4 color;
+	float alpha;
+	float size;
+	float rotation;
+	uint32_t type;
+};
+
+// Particle layout used by the original update loop, starts with the vertex attributes
 struct Particle {
 	glm::vec4 pos;
 	glm::vec4 color;
@@ -30,6 +60,47 @@ struct Particle {
 	float rotationSpeed;
 };
 
+/*
+	Structure of arrays particle storage used by the chunked CPU simulation
+	All color channels of a particle are always equal, so only one color value is stored
+	The type is stored as a float (0.0 = flame, 1.0 = smoke) so the kernels can blend the per-type constants without branches or integer compares
+*/
+struct ParticleSystem {
+	std::vector<float> posX, posY, posZ;
+	std::vector<float> velX, velY, velZ;
+	std::vector<float> color;
+	std::vector<float> alpha;
+	std::vector<float> size;
+	std::vector<float> rotation;
+	std::vector<float> rotationSpeed;
+	std::vector<float> type;
+
+	void resize(uint32_t count)
+	{
+		for (std::vector<float>* attribute : { &posX, &posY, &posZ, &velX, &velY, &velZ, &color, &alpha, &size, &rotation, &rotationSpeed, &type }) {
+			attribute->resize(count);
+			attribute->shrink_to_fit();
+		}
+	}
+};
+
+// Per frame simulation constants, the flame values are used for type 0.0, flame + delta for type 1.0
+struct ParticleStep {
+	float particleTimer;
+	float posYFlame, posYDelta;
+	float posXZ;
+	float alphaFlame, alphaDelta;
+	float sizeFlame, sizeDelta;
+	float color;
+};
+
+// Range of particles updated by a single thread pool job, each chunk has it's own random engine for respawning particles
+struct ParticleChunk {
+	uint32_t first;
+	uint32_t count;
+	std::default_random_engine rndEngine;
+};
+
 class VulkanExample : public VulkanExampleBase
 {
 public:
@@ -52,14 +123,8 @@ public:
 	glm::vec3 minVel = glm::vec3(-3.0f, 0.5f, -3.0f);
 	glm::vec3 maxVel = glm::vec3(3.0f, 7.0f, 3.0f);
 
-	struct {
-		VkBuffer buffer;
-		VkDeviceMemory memory;
-		// Store the mapped address of the particle data for reuse
-		void *mappedMemory;
-		// Size of the particle buffer in bytes
-		size_t size;
-	} particles;
+	// One persistently mapped vertex buffer per command buffer, the particles for a frame are written directly into it right before submission
+	std::vector<vks::Buffer> vertexBuffers;
 
 	struct {
 		vks::Buffer fire;
@@ -93,11 +158,43 @@ public:
 		VkDescriptorSet environment;
 	} descriptorSets;
 
+	// Storage for the original update loop
 	std::vector<Particle> particleBuffer;
+	// Storage for the chunked (scalar and SIMD) backends
+	ParticleSystem particleSystem;
+	std::vector<ParticleChunk> chunks;
 
 	std::default_random_engine rndEngine;
 
-	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
+	vks::ThreadPool threadPool;
+
+	enum ParticleBackend { Legacy = 0, Scalar = 1, SIMD = 2 };
+	const std::vector<std::string> backendNames = { "legacy", "scalar", "simd" };
+	const std::vector<uint32_t> particleCounts = { PARTICLE_COUNT, 16384, 262144, 1048576, 4194304 };
+
+	struct {
+		int32_t backend = SIMD;
+		bool multiThreaded = true;
+		uint32_t particleCount = PARTICLE_COUNT;
+		int32_t particleCountIndex = 0;
+		// Storage currently initialized (legacy or structure of arrays)
+		bool legacyStorage = false;
+	} simulation;
+
+	// CPU time spent in updating the particles and writing the vertices, accumulated per backend
+	struct Statistics {
+		double time = 0.0;
+		uint64_t particles = 0;
+		uint32_t frames = 0;
+	};
+	std::array<Statistics, 3> statistics;
+	double lastUpdateTime = 0.0;
+
+	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION, [](CommandLineParser& commandLineParser) {
+		commandLineParser.add("particlecount", { "-pc", "--particlecount" }, 1, "Number of simulated particles");
+		commandLineParser.add("particlebackend", { "-pb", "--particlebackend" }, 1, "Particle simulation backend (legacy, scalar or simd)");
+		commandLineParser.add("particlethreads", { "-pth", "--particlethreads" }, 1, "Number of threads used for the particle simulation");
+	})
 	{
 		title = "CPU based particle system";
 		camera.type = Camera::CameraType::lookat;
@@ -106,10 +203,25 @@ public:
 		camera.setPerspective(60.0f, (float)width / (float)height, 1.0f, 256.0f);
 		timerSpeed *= 8.0f;
 		rndEngine.seed(benchmark.active ? 0 : (unsigned)time(nullptr));
+
+		simulation.particleCount = std::max(commandLineParser.getValueAsInt("particlecount", PARTICLE_COUNT), 1);
+		auto countIt = std::find(particleCounts.begin(), particleCounts.end(), simulation.particleCount);
+		simulation.particleCountIndex = (countIt != particleCounts.end()) ? static_cast<int32_t>(countIt - particleCounts.begin()) : -1;
+		auto backendIt = std::find(backendNames.begin(), backendNames.end(), commandLineParser.getValueAsString("particlebackend", "simd"));
+		if (backendIt != backendNames.end()) {
+			simulation.backend = static_cast<int32_t>(backendIt - backendNames.begin());
+		}
+		uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		threadCount = std::max(commandLineParser.getValueAsInt("particlethreads", threadCount), 1);
+		threadPool.setThreadCount(threadCount);
 	}
 
 	~VulkanExample()
 	{
+		if (benchmark.active) {
+			printStatistics();
+		}
+
 		// Clean up used Vulkan resources
 		// Note : Inherited destructor cleans up resources stored in base class
 
@@ -124,9 +236,9 @@ public:
 		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
-		vkUnmapMemory(device, particles.memory);
-		vkDestroyBuffer(device, particles.buffer, nullptr);
-		vkFreeMemory(device, particles.memory, nullptr);
+		for (auto& buffer : vertexBuffers) {
+			buffer.destroy();
+		}
 
 		uniformBuffers.environment.destroy();
 		uniformBuffers.fire.destroy();
@@ -184,8 +296,8 @@ public:
 			// Particle system (no index buffer)
 			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets.particles, 0, nullptr);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.particles);
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], 0, 1, &particles.buffer, offsets);
-			vkCmdDraw(drawCmdBuffers[i], PARTICLE_COUNT, 1, 0, 0);
+			vkCmdBindVertexBuffers(drawCmdBuffers[i], 0, 1, &vertexBuffers[i].buffer, offsets);
+			vkCmdDraw(drawCmdBuffers[i], simulation.particleCount, 1, 0, 0);
 
 			drawUI(drawCmdBuffers[i]);
 
@@ -252,32 +364,138 @@ public:
 		}
 	}
 
-	void prepareParticles()
+	float rnd(std::default_random_engine &engine, float range)
 	{
-		particleBuffer.resize(PARTICLE_COUNT);
-		for (auto& particle : particleBuffer)
+		std::uniform_real_distribution<float> rndDist(0.0f, range);
+		return rndDist(engine);
+	}
+
+	// Same as initParticle above for the structure of arrays storage
+	void initParticle(uint32_t index, std::default_random_engine &engine)
+	{
+		ParticleSystem &ps = particleSystem;
+		ps.velX[index] = 0.0f;
+		ps.velY[index] = minVel.y + rnd(engine, maxVel.y - minVel.y);
+		ps.velZ[index] = 0.0f;
+		ps.alpha[index] = rnd(engine, 0.75f);
+		ps.size[index] = 1.0f + rnd(engine, 0.5f);
+		ps.color[index] = 1.0f;
+		ps.type[index] = float(PARTICLE_TYPE_FLAME);
+		ps.rotation[index] = rnd(engine, 2.0f * float(M_PI));
+		ps.rotationSpeed[index] = rnd(engine, 2.0f) - rnd(engine, 2.0f);
+
+		// Get random sphere point
+		float theta = rnd(engine, 2.0f * float(M_PI));
+		float phi = rnd(engine, float(M_PI)) - float(M_PI) / 2.0f;
+		float r = rnd(engine, FLAME_RADIUS);
+
+		ps.posX[index] = r * cos(theta) * cos(phi) + emitterPos.x;
+		ps.posY[index] = r * sin(phi) + emitterPos.y;
+		ps.posZ[index] = r * sin(theta) * cos(phi) + emitterPos.z;
+	}
+
+	// Same as transitionParticle above for the structure of arrays storage
+	void transitionParticle(uint32_t index, std::default_random_engine &engine)
+	{
+		ParticleSystem &ps = particleSystem;
+		// Flame particles have a chance of turning into smoke, smoke particles respawn at end of life
+		if ((ps.type[index] == float(PARTICLE_TYPE_FLAME)) && (rnd(engine, 1.0f) < 0.05f))
 		{
-			initParticle(&particle, emitterPos);
-			particle.alpha = 1.0f - (abs(particle.pos.y) / (FLAME_RADIUS * 2.0f));
+			ps.alpha[index] = 0.0f;
+			ps.color[index] = 0.25f + rnd(engine, 0.25f);
+			ps.posX[index] *= 0.5f;
+			ps.posZ[index] *= 0.5f;
+			ps.velX[index] = rnd(engine, 1.0f) - rnd(engine, 1.0f);
+			ps.velY[index] = (minVel.y * 2) + rnd(engine, maxVel.y - minVel.y);
+			ps.velZ[index] = rnd(engine, 1.0f) - rnd(engine, 1.0f);
+			ps.size[index] = 1.0f + rnd(engine, 0.5f);
+			ps.rotationSpeed[index] = rnd(engine, 1.0f) - rnd(engine, 1.0f);
+			ps.type[index] = float(PARTICLE_TYPE_SMOKE);
 		}
+		else
+		{
+			initParticle(index, engine);
+		}
+	}
 
-		particles.size = particleBuffer.size() * sizeof(Particle);
+	const char* simdName()
+	{
+#if defined(PARTICLE_SIMD_AVX)
+		return "AVX";
+#elif defined(PARTICLE_SIMD_SSE)
+		return "SSE2";
+#else
+		return "scalar fallback";
+#endif
+	}
 
-		VK_CHECK_RESULT(vulkanDevice->createBuffer(
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			particles.size,
-			&particles.buffer,
-			&particles.memory,
-			particleBuffer.data()));
+	void prepareVertexBuffers()
+	{
+		for (auto& buffer : vertexBuffers) {
+			buffer.destroy();
+		}
+		vertexBuffers.resize(drawCmdBuffers.size());
+		for (auto& buffer : vertexBuffers) {
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&buffer,
+				simulation.particleCount * sizeof(ParticleVertex)));
+			// Map the memory and store the pointer for reuse
+			VK_CHECK_RESULT(buffer.map());
+		}
+	}
 
-		// Map the memory and store the pointer for reuse
-		VK_CHECK_RESULT(vkMapMemory(device, particles.memory, 0, particles.size, 0, &particles.mappedMemory));
+	// Splits the particles into ranges that are updated by the thread pool
+	void prepareChunks()
+	{
+		const uint32_t threadCount = simulation.multiThreaded ? static_cast<uint32_t>(threadPool.threads.size()) : 1;
+		const uint32_t chunkCount = std::max(std::min(threadCount, simulation.particleCount / PARTICLE_MIN_CHUNK_SIZE), 1u);
+		// Keep chunk boundaries aligned to the SIMD width (and the vertex writes 16 byte aligned)
+		const uint32_t chunkSize = ((simulation.particleCount + chunkCount - 1) / chunkCount + 7) & ~7u;
+		chunks.clear();
+		for (uint32_t first = 0; first < simulation.particleCount; first += chunkSize)
+		{
+			ParticleChunk chunk;
+			chunk.first = first;
+			chunk.count = std::min(chunkSize, simulation.particleCount - first);
+			chunk.rndEngine.seed(rndEngine());
+			chunks.push_back(chunk);
+		}
+	}
+
+	// (Re)initializes the particle storage used by the current backend and releases the other one
+	void prepareParticles()
+	{
+		simulation.legacyStorage = (simulation.backend == Legacy);
+		if (simulation.legacyStorage)
+		{
+			particleSystem.resize(0);
+			particleBuffer.resize(simulation.particleCount);
+			for (auto& particle : particleBuffer)
+			{
+				initParticle(&particle, emitterPos);
+				particle.alpha = 1.0f - (abs(particle.pos.y) / (FLAME_RADIUS * 2.0f));
+			}
+		}
+		else
+		{
+			particleBuffer.clear();
+			particleBuffer.shrink_to_fit();
+			particleSystem.resize(simulation.particleCount);
+			for (uint32_t i = 0; i < simulation.particleCount; i++)
+			{
+				initParticle(i, rndEngine);
+				particleSystem.alpha[i] = 1.0f - (abs(particleSystem.posY[i]) / (FLAME_RADIUS * 2.0f));
+			}
+		}
+		prepareChunks();
 	}
 
-	void updateParticles()
+	// Original update loop, walks the array of particles and copies them to the vertex buffer
+	void updateParticlesLegacy(float dt, ParticleVertex* vertices)
 	{
-		float particleTimer = frameTimer * 0.45f;
+		float particleTimer = dt * 0.45f;
 		for (auto& particle : particleBuffer)
 		{
 			switch (particle.type)
@@ -288,7 +506,7 @@ public:
 				particle.size -= particleTimer * 0.5f;
 				break;
 			case PARTICLE_TYPE_SMOKE:
-				particle.pos -= particle.vel * frameTimer * 1.0f;
+				particle.pos -= particle.vel * dt * 1.0f;
 				particle.alpha += particleTimer * 1.25f;
 				particle.size += particleTimer * 0.125f;
 				particle.color -= particleTimer * 0.05f;
@@ -301,8 +519,260 @@ public:
 				transitionParticle(&particle);
 			}
 		}
-		size_t size = particleBuffer.size() * sizeof(Particle);
-		memcpy(particles.mappedMemory, particleBuffer.data(), size);
+		// The vertex attributes are stored at the start of each particle
+		for (size_t i = 0; i < particleBuffer.size(); i++)
+		{
+			memcpy(&vertices[i], &particleBuffer[i], sizeof(ParticleVertex));
+		}
+	}
+
+	/*
+		Chunked simulation kernels
+		All kernels apply the same per type update as the original loop, but select the per type constants arithmetically (flame + type * delta) instead of branching
+		Particles reaching the end of their current state need random numbers and are transitioned in scalar code
+	*/
+
+	void simulateScalar(const ParticleStep &step, uint32_t first, uint32_t last, std::default_random_engine &engine)
+	{
+		ParticleSystem &ps = particleSystem;
+		for (uint32_t i = first; i < last; i++)
+		{
+			const float t = ps.type[i];
+			const float xz = t * step.posXZ;
+			ps.posX[i] -= ps.velX[i] * xz;
+			ps.posY[i] -= ps.velY[i] * (step.posYFlame + t * step.posYDelta);
+			ps.posZ[i] -= ps.velZ[i] * xz;
+			ps.alpha[i] += step.alphaFlame + t * step.alphaDelta;
+			ps.size[i] += step.sizeFlame + t * step.sizeDelta;
+			ps.color[i] -= t * step.color;
+			ps.rotation[i] += step.particleTimer * ps.rotationSpeed[i];
+			if (ps.alpha[i] > 2.0f)
+			{
+				transitionParticle(i, engine);
+			}
+		}
+	}
+
+#if defined(PARTICLE_SIMD_AVX)
+	// Simulates eight particles at a time, returns the index of the first particle not simulated
+	uint32_t simulateAVX(const ParticleStep &step, uint32_t first, uint32_t last, std::default_random_engine &engine)
+	{
+		ParticleSystem &ps = particleSystem;
+		const __m256 particleTimer = _mm256_set1_ps(step.particleTimer);
+		const __m256 posYFlame = _mm256_set1_ps(step.posYFlame);
+		const __m256 posYDelta = _mm256_set1_ps(step.posYDelta);
+		const __m256 posXZ = _mm256_set1_ps(step.posXZ);
+		const __m256 alphaFlame = _mm256_set1_ps(step.alphaFlame);
+		const __m256 alphaDelta = _mm256_set1_ps(step.alphaDelta);
+		const __m256 sizeFlame = _mm256_set1_ps(step.sizeFlame);
+		const __m256 sizeDelta = _mm256_set1_ps(step.sizeDelta);
+		const __m256 color = _mm256_set1_ps(step.color);
+		const __m256 maxAlpha = _mm256_set1_ps(2.0f);
+		uint32_t i = first;
+		for (; i + 8 <= last; i += 8)
+		{
+			const __m256 t = _mm256_loadu_ps(&ps.type[i]);
+			const __m256 xz = _mm256_mul_ps(t, posXZ);
+			_mm256_storeu_ps(&ps.posX[i], _mm256_sub_ps(_mm256_loadu_ps(&ps.posX[i]), _mm256_mul_ps(_mm256_loadu_ps(&ps.velX[i]), xz)));
+			_mm256_storeu_ps(&ps.posY[i], _mm256_sub_ps(_mm256_loadu_ps(&ps.posY[i]), _mm256_mul_ps(_mm256_loadu_ps(&ps.velY[i]), _mm256_add_ps(posYFlame, _mm256_mul_ps(t, posYDelta)))));
+			_mm256_storeu_ps(&ps.posZ[i], _mm256_sub_ps(_mm256_loadu_ps(&ps.posZ[i]), _mm256_mul_ps(_mm256_loadu_ps(&ps.velZ[i]), xz)));
+			const __m256 alpha = _mm256_add_ps(_mm256_loadu_ps(&ps.alpha[i]), _mm256_add_ps(alphaFlame, _mm256_mul_ps(t, alphaDelta)));
+			_mm256_storeu_ps(&ps.alpha[i], alpha);
+			_mm256_storeu_ps(&ps.size[i], _mm256_add_ps(_mm256_loadu_ps(&ps.size[i]), _mm256_add_ps(sizeFlame, _mm256_mul_ps(t, sizeDelta))));
+			_mm256_storeu_ps(&ps.color[i], _mm256_sub_ps(_mm256_loadu_ps(&ps.color[i]), _mm256_mul_ps(t, color)));
+			_mm256_storeu_ps(&ps.rotation[i], _mm256_add_ps(_mm256_loadu_ps(&ps.rotation[i]), _mm256_mul_ps(particleTimer, _mm256_loadu_ps(&ps.rotationSpeed[i]))));
+			const int transitions = _mm256_movemask_ps(_mm256_cmp_ps(alpha, maxAlpha, _CMP_GT_OQ));
+			if (transitions != 0)
+			{
+				for (uint32_t lane = 0; lane < 8; lane++)
+				{
+					if (transitions & (1 << lane))
+					{
+						transitionParticle(i + lane, engine);
+					}
+				}
+			}
+		}
+		return i;
+	}
+#endif
+
+#if defined(PARTICLE_SIMD_SSE)
+	// Simulates four particles at a time, returns the index of the first particle not simulated
+	uint32_t simulateSSE(const ParticleStep &step, uint32_t first, uint32_t last, std::default_random_engine &engine)
+	{
+		ParticleSystem &ps = particleSystem;
+		const __m128 particleTimer = _mm_set1_ps(step.particleTimer);
+		const __m128 posYFlame = _mm_set1_ps(step.posYFlame);
+		const __m128 posYDelta = _mm_set1_ps(step.posYDelta);
+		const __m128 posXZ = _mm_set1_ps(step.posXZ);
+		const __m128 alphaFlame = _mm_set1_ps(step.alphaFlame);
+		const __m128 alphaDelta = _mm_set1_ps(step.alphaDelta);
+		const __m128 sizeFlame = _mm_set1_ps(step.sizeFlame);
+		const __m128 sizeDelta = _mm_set1_ps(step.sizeDelta);
+		const __m128 color = _mm_set1_ps(step.color);
+		const __m128 maxAlpha = _mm_set1_ps(2.0f);
+		uint32_t i = first;
+		for (; i + 4 <= last; i += 4)
+		{
+			const __m128 t = _mm_loadu_ps(&ps.type[i]);
+			const __m128 xz = _mm_mul_ps(t, posXZ);
+			_mm_storeu_ps(&ps.posX[i], _mm_sub_ps(_mm_loadu_ps(&ps.posX[i]), _mm_mul_ps(_mm_loadu_ps(&ps.velX[i]), xz)));
+			_mm_storeu_ps(&ps.posY[i], _mm_sub_ps(_mm_loadu_ps(&ps.posY[i]), _mm_mul_ps(_mm_loadu_ps(&ps.velY[i]), _mm_add_ps(posYFlame, _mm_mul_ps(t, posYDelta)))));
+			_mm_storeu_ps(&ps.posZ[i], _mm_sub_ps(_mm_loadu_ps(&ps.posZ[i]), _mm_mul_ps(_mm_loadu_ps(&ps.velZ[i]), xz)));
+			const __m128 alpha = _mm_add_ps(_mm_loadu_ps(&ps.alpha[i]), _mm_add_ps(alphaFlame, _mm_mul_ps(t, alphaDelta)));
+			_mm_storeu_ps(&ps.alpha[i], alpha);
+			_mm_storeu_ps(&ps.size[i], _mm_add_ps(_mm_loadu_ps(&ps.size[i]), _mm_add_ps(sizeFlame, _mm_mul_ps(t, sizeDelta))));
+			_mm_storeu_ps(&ps.color[i], _mm_sub_ps(_mm_loadu_ps(&ps.color[i]), _mm_mul_ps(t, color)));
+			_mm_storeu_ps(&ps.rotation[i], _mm_add_ps(_mm_loadu_ps(&ps.rotation[i]), _mm_mul_ps(particleTimer, _mm_loadu_ps(&ps.rotationSpeed[i]))));
+			const int transitions = _mm_movemask_ps(_mm_cmpgt_ps(alpha, maxAlpha));
+			if (transitions != 0)
+			{
+				for (uint32_t lane = 0; lane < 4; lane++)
+				{
+					if (transitions & (1 << lane))
+					{
+						transitionParticle(i + lane, engine);
+					}
+				}
+			}
+		}
+		return i;
+	}
+#endif
+
+	// Converts a range of particles to the interleaved vertex layout and writes them to the (mapped) vertex buffer
+	void writeVertices(ParticleVertex* vertices, uint32_t first, uint32_t last, bool simd)
+	{
+		const ParticleSystem &ps = particleSystem;
+		uint32_t i = first;
+#if defined(PARTICLE_SIMD_SSE)
+		if (simd)
+		{
+			// Transpose four particles at a time, the vertex buffer is only written to, so non-temporal stores are used to bypass the cache
+			for (; i + 4 <= last; i += 4)
+			{
+				__m128 pos0 = _mm_loadu_ps(&ps.posX[i]);
+				__m128 pos1 = _mm_loadu_ps(&ps.posY[i]);
+				__m128 pos2 = _mm_loadu_ps(&ps.posZ[i]);
+				__m128 pos3 = _mm_setzero_ps();
+				_MM_TRANSPOSE4_PS(pos0, pos1, pos2, pos3);
+				__m128 attr0 = _mm_loadu_ps(&ps.alpha[i]);
+				__m128 attr1 = _mm_loadu_ps(&ps.size[i]);
+				__m128 attr2 = _mm_loadu_ps(&ps.rotation[i]);
+				__m128 attr3 = _mm_castsi128_ps(_mm_cvttps_epi32(_mm_loadu_ps(&ps.type[i])));
+				_MM_TRANSPOSE4_PS(attr0, attr1, attr2, attr3);
+				const __m128 color = _mm_loadu_ps(&ps.color[i]);
+				float* dst = reinterpret_cast<float*>(&vertices[i]);
+				_mm_stream_ps(dst, pos0);
+				_mm_stream_ps(dst + 4, _mm_shuffle_ps(color, color, _MM_SHUFFLE(0, 0, 0, 0)));
+				_mm_stream_ps(dst + 8, attr0);
+				_mm_stream_ps(dst + 12, pos1);
+				_mm_stream_ps(dst + 16, _mm_shuffle_ps(color, color, _MM_SHUFFLE(1, 1, 1, 1)));
+				_mm_stream_ps(dst + 20, attr1);
+				_mm_stream_ps(dst + 24, pos2);
+				_mm_stream_ps(dst + 28, _mm_shuffle_ps(color, color, _MM_SHUFFLE(2, 2, 2, 2)));
+				_mm_stream_ps(dst + 32, attr2);
+				_mm_stream_ps(dst + 36, pos3);
+				_mm_stream_ps(dst + 40, _mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3)));
+				_mm_stream_ps(dst + 44, attr3);
+			}
+			// Make the non-temporal stores visible before the frame is submitted
+			_mm_sfence();
+		}
+#endif
+		for (; i < last; i++)
+		{
+			ParticleVertex &vertex = vertices[i];
+			vertex.pos = glm::vec4(ps.posX[i], ps.posY[i], ps.posZ[i], 0.0f);
+			vertex.color = glm::vec4(ps.color[i]);
+			vertex.alpha = ps.alpha[i];
+			vertex.size = ps.size[i];
+			vertex.rotation = ps.rotation[i];
+			vertex.type = static_cast<uint32_t>(ps.type[i]);
+		}
+	}
+
+	// Simulates the particles of a chunk in small blocks and writes each block to the vertex buffer while it's still in the cache
+	void updateChunk(ParticleChunk &chunk, const ParticleStep &step, ParticleVertex* vertices, bool simd)
+	{
+		VKS_PROFILE_ZONE("particle chunk");
+		const uint32_t end = chunk.first + chunk.count;
+		for (uint32_t first = chunk.first; first < end; first += PARTICLE_BLOCK_SIZE)
+		{
+			const uint32_t last = std::min(first + PARTICLE_BLOCK_SIZE, end);
+			uint32_t i = first;
+			if (simd)
+			{
+#if defined(PARTICLE_SIMD_AVX)
+				i = simulateAVX(step, i, last, chunk.rndEngine);
+#elif defined(PARTICLE_SIMD_SSE)
+				i = simulateSSE(step, i, last, chunk.rndEngine);
+#endif
+			}
+			simulateScalar(step, i, last, chunk.rndEngine);
+			writeVertices(vertices, first, last, simd);
+		}
+	}
+
+	void updateParticles(float dt, ParticleVertex* vertices)
+	{
+		VKS_PROFILE_ZONE("update particles");
+		auto tStart = std::chrono::high_resolution_clock::now();
+		if (simulation.backend == Legacy)
+		{
+			updateParticlesLegacy(dt, vertices);
+		}
+		else
+		{
+			ParticleStep step;
+			step.particleTimer = dt * 0.45f;
+			step.posYFlame = step.particleTimer * 3.5f;
+			step.posYDelta = dt - step.posYFlame;
+			step.posXZ = dt;
+			step.alphaFlame = step.particleTimer * 2.5f;
+			step.alphaDelta = step.particleTimer * 1.25f - step.alphaFlame;
+			step.sizeFlame = -step.particleTimer * 0.5f;
+			step.sizeDelta = step.particleTimer * 0.125f - step.sizeFlame;
+			step.color = step.particleTimer * 0.05f;
+			const bool simd = (simulation.backend == SIMD);
+			if (chunks.size() == 1)
+			{
+				updateChunk(chunks[0], step, vertices, simd);
+			}
+			else
+			{
+				for (size_t i = 0; i < chunks.size(); i++)
+				{
+					ParticleChunk* chunk = &chunks[i];
+					threadPool.threads[i % threadPool.threads.size()]->addJob([=] { updateChunk(*chunk, step, vertices, simd); });
+				}
+				threadPool.wait();
+			}
+		}
+		auto tEnd = std::chrono::high_resolution_clock::now();
+		lastUpdateTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+		if (dt > 0.0f)
+		{
+			Statistics &stats = statistics[simulation.backend];
+			stats.time += lastUpdateTime;
+			stats.particles += simulation.particleCount;
+			stats.frames++;
+		}
+	}
+
+	void printStatistics()
+	{
+		for (size_t i = 0; i < statistics.size(); i++)
+		{
+			const Statistics &stats = statistics[i];
+			if (stats.frames == 0)
+			{
+				continue;
+			}
+			std::cout << "Particle update (" << backendNames[i] << ((i == SIMD) ? std::string(", ") + simdName() : "") << ", " << simulation.particleCount << " particles): "
+				<< stats.time / stats.frames << " ms/frame, " << (double)stats.particles / stats.time << " particles/ms\n";
+		}
 	}
 
 	void loadAssets()
@@ -446,15 +916,15 @@ public:
 		{
 			// Vertex input state
 			VkVertexInputBindingDescription vertexInputBinding =
-				vks::initializers::vertexInputBindingDescription(0, sizeof(Particle), VK_VERTEX_INPUT_RATE_VERTEX);
+				vks::initializers::vertexInputBindingDescription(0, sizeof(ParticleVertex), VK_VERTEX_INPUT_RATE_VERTEX);
 
 			std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
-				vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32A32_SFLOAT,	offsetof(Particle, pos)),	// Location 0: Position
-				vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32A32_SFLOAT,	offsetof(Particle, color)),	// Location 1: Color
-				vks::initializers::vertexInputAttributeDescription(0, 2, VK_FORMAT_R32_SFLOAT, offsetof(Particle, alpha)),			// Location 2: Alpha
-				vks::initializers::vertexInputAttributeDescription(0, 3, VK_FORMAT_R32_SFLOAT, offsetof(Particle, size)),			// Location 3: Size
-				vks::initializers::vertexInputAttributeDescription(0, 4, VK_FORMAT_R32_SFLOAT, offsetof(Particle, rotation)),		// Location 4: Rotation
-				vks::initializers::vertexInputAttributeDescription(0, 5, VK_FORMAT_R32_SINT, offsetof(Particle, type)),				// Location 5: Particle type
+				vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32A32_SFLOAT,	offsetof(ParticleVertex, pos)),	// Location 0: Position
+				vks::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32A32_SFLOAT,	offsetof(ParticleVertex, color)),	// Location 1: Color
+				vks::initializers::vertexInputAttributeDescription(0, 2, VK_FORMAT_R32_SFLOAT, offsetof(ParticleVertex, alpha)),			// Location 2: Alpha
+				vks::initializers::vertexInputAttributeDescription(0, 3, VK_FORMAT_R32_SFLOAT, offsetof(ParticleVertex, size)),			// Location 3: Size
+				vks::initializers::vertexInputAttributeDescription(0, 4, VK_FORMAT_R32_SFLOAT, offsetof(ParticleVertex, rotation)),		// Location 4: Rotation
+				vks::initializers::vertexInputAttributeDescription(0, 5, VK_FORMAT_R32_SINT, offsetof(ParticleVertex, type)),				// Location 5: Particle type
 			};
 
 			VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
@@ -554,6 +1024,10 @@ public:
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 
+		// Simulate and write the particles into the vertex buffer used by this frame's command buffer
+		// If paused, the current state is still written as the buffer may contain the particles of an older frame
+		updateParticles(paused ? 0.0f : frameTimer, static_cast<ParticleVertex*>(vertexBuffers[currentBuffer].mapped));
+
 		// Submit to queue
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 
@@ -564,6 +1038,7 @@ public:
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
+		prepareVertexBuffers();
 		prepareParticles();
 		prepareUniformBuffers();
 		setupDescriptorSetLayout();
@@ -582,7 +1057,6 @@ public:
 		if (!paused)
 		{
 			updateUniformBufferLight();
-			updateParticles();
 		}
 		if (camera.updated)
 		{
@@ -594,6 +1068,37 @@ public:
 	{
 		updateUniformBuffers();
 	}
+
+	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
+	{
+		if (overlay->header("Particle simulation")) {
+			if (overlay->comboBox("Backend", &simulation.backend, { "Legacy loop", "SoA scalar", std::string("SoA ") + simdName() })) {
+				if (simulation.legacyStorage != (simulation.backend == Legacy)) {
+					prepareParticles();
+				}
+			}
+			std::vector<std::string> countNames;
+			for (uint32_t count : particleCounts) {
+				countNames.push_back(std::to_string(count));
+			}
+			if (overlay->comboBox("Particles", &simulation.particleCountIndex, countNames)) {
+				simulation.particleCount = particleCounts[simulation.particleCountIndex];
+				vkDeviceWaitIdle(device);
+				prepareVertexBuffers();
+				prepareParticles();
+				statistics = {};
+			}
+			if (simulation.backend != Legacy) {
+				if (overlay->checkBox("Multi-threaded", &simulation.multiThreaded)) {
+					prepareChunks();
+				}
+				overlay->text("%d chunk(s) on %d thread(s)", (int32_t)chunks.size(), (int32_t)threadPool.threads.size());
+			}
+			const Statistics& stats = statistics[simulation.backend];
+			overlay->text("Update: %.3f ms", lastUpdateTime);
+			overlay->text("%.0f particles/ms", (stats.time > 0.0) ? (double)stats.particles / stats.time : 0.0);
+		}
+	}
 };
 
 VULKAN_EXAMPLE_MAIN()
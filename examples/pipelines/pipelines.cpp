@@ -249,6 +249,12 @@ public:
 		// switching and faster creation time
 		pipelineCI.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
 
+		// Load all shaders up-front on multiple threads, the loadShader calls below are then served from the shader cache
+		preloadShaders({
+			getShadersPath() + "pipelines/phong.vert.spv", getShadersPath() + "pipelines/phong.frag.spv",
+			getShadersPath() + "pipelines/toon.vert.spv", getShadersPath() + "pipelines/toon.frag.spv",
+			getShadersPath() + "pipelines/wireframe.vert.spv", getShadersPath() + "pipelines/wireframe.frag.spv" });
+
 		// Textured pipeline
 		// Phong shading pipeline
 		shaderStages[0] = loadShader(getShadersPath() + "pipelines/phong.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
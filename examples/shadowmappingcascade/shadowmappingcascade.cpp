@@ -15,10 +15,15 @@
 
 	A further optimization could be done using a geometry shader to do a single-pass render for the depth map
 	cascades instead of multiple passes (geometry shaders are not supported on all target devices).
+
+	To lower the cost of the shadow passes, objects are culled against each cascade's light space bounds and
+	cascade projections are snapped to shadow map texels. Snapped cascades only change when the camera or light
+	moves far enough, so unchanged cascades are reused and far cascades are only re-rendered every few frames.
 */
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "frustum.hpp"
 
 #define ENABLE_VALIDATION false
 
@@ -37,6 +42,13 @@ public:
 	int32_t displayDepthMapCascadeIndex = 0;
 	bool colorCascades = false;
 	bool filterPCF = false;
+	bool cullCascades = true;
+	bool cacheCascades = true;
+	// Far cascades cover large areas at low resolution, so they can be updated less frequently
+	const std::array<uint32_t, SHADOW_MAP_CASCADE_COUNT> cascadeUpdateIntervals = { 1, 1, 2, 4 };
+	// Cached cascades are re-rendered immediately if their center moved by more than this fraction of their radius
+	float cascadeCacheTolerance = 0.02f;
+	uint32_t shadowFrameIndex = 0;
 
 	float cascadeSplitLambda = 0.95f;
 
@@ -50,6 +62,24 @@ public:
 		vkglTF::Model tree;
 	} models;
 
+	// Bounding spheres used for culling against the cascades, in the space of the pre-transformed and y-flipped vertices
+	struct BoundingSphere {
+		glm::vec3 center;
+		float radius;
+	};
+	struct {
+		BoundingSphere terrain;
+		BoundingSphere tree;
+	} bounds;
+
+	const std::vector<glm::vec3> treePositions = {
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(1.25f, 0.25f, 1.25f),
+		glm::vec3(-1.25f, -0.2f, 1.25f),
+		glm::vec3(1.25f, 0.1f, -1.25f),
+		glm::vec3(-1.25f, -0.25f, -1.25f),
+	};
+
 	struct uniformBuffers {
 		vks::Buffer VS;
 		vks::Buffer FS;
@@ -95,6 +125,8 @@ public:
 		VkPipelineLayout pipelineLayout;
 		VkPipeline pipeline;
 		vks::Buffer uniformBuffer;
+		// Recorded every frame, as the cascades to render and their draw lists change
+		VkCommandBuffer commandBuffer;
 
 		struct UniformBlock {
 			std::array<glm::mat4, SHADOW_MAP_CASCADE_COUNT> cascadeViewProjMat;
@@ -124,6 +156,17 @@ public:
 
 		float splitDepth;
 		glm::mat4 viewProjMatrix;
+		glm::vec3 center;
+		float radius;
+
+		// State of the cascade's depth layer, shadow lookups use the matrix the layer has been rendered with
+		glm::mat4 renderedViewProjMatrix;
+		glm::vec3 renderedCenter;
+		float renderedRadius;
+		uint32_t renderedFrameIndex;
+		bool valid = false;
+		bool render;
+		vks::Frustum frustum;
 
 		void destroy(VkDevice device) {
 			vkDestroyImageView(device, view, nullptr);
@@ -132,6 +175,16 @@ public:
 	};
 	std::array<Cascade, SHADOW_MAP_CASCADE_COUNT> cascades;
 
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		float gpuTime = 0.0f;
+		uint32_t cascadesRendered = 0;
+		uint32_t draws = 0;
+		uint32_t drawsCulled = 0;
+	} shadowStats;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		title = "Cascaded shadow mapping";
@@ -166,6 +219,11 @@ public:
 		depthPass.uniformBuffer.destroy();
 		uniformBuffers.VS.destroy();
 		uniformBuffers.FS.destroy();
+
+		vkFreeCommandBuffers(device, cmdPool, 1, &depthPass.commandBuffer);
+		if (shadowStats.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, shadowStats.queryPool, nullptr);
+		}
 	}
 
 	virtual void getEnabledFeatures()
@@ -175,11 +233,32 @@ public:
 		enabledFeatures.depthClamp = deviceFeatures.depthClamp;
 	}
 
+	/*
+		Check if a bounding sphere is inside the light space bounds of a cascade
+		The near plane is ignored, as casters between the light and the cascade still cast shadows into it
+	*/
+	bool isVisibleInCascade(const Cascade& cascade, const glm::vec3& center, float radius)
+	{
+		for (uint32_t i = 0; i < cascade.frustum.planes.size(); i++) {
+			if (i == vks::Frustum::BACK) {
+				continue;
+			}
+			const glm::vec4& plane = cascade.frustum.planes[i];
+			if ((plane.x * center.x) + (plane.y * center.y) + (plane.z * center.z) + plane.w <= -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
 	/*
 		Render the example scene with given command buffer, pipeline layout and descriptor set
 		Used by the scene rendering and depth pass generation command buffer
+		If culling is enabled, objects outside of the cascade's bounds are skipped, returns the number of draws
 	*/
-	void renderScene(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkDescriptorSet descriptorSet, uint32_t cascadeIndex = 0) {
+	uint32_t renderScene(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, VkDescriptorSet descriptorSet, uint32_t cascadeIndex = 0, bool cull = false) {
+		uint32_t drawCount = 0;
+
 		// We use push constants for passing shadow cascade info to the shaders
 		PushConstBlock pushConstBlock = { glm::vec4(0.0f), cascadeIndex };
 
@@ -187,24 +266,25 @@ public:
 		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
 		// Floor
-		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
-		models.terrain.draw(commandBuffer, vkglTF::RenderFlags::BindImages, pipelineLayout);
+		if (!cull || isVisibleInCascade(cascades[cascadeIndex], bounds.terrain.center, bounds.terrain.radius)) {
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
+			models.terrain.draw(commandBuffer, vkglTF::RenderFlags::BindImages, pipelineLayout);
+			drawCount++;
+		}
 
 		// Trees
-		const std::vector<glm::vec3> positions = {
-			glm::vec3(0.0f, 0.0f, 0.0f),
-			glm::vec3(1.25f, 0.25f, 1.25f),
-			glm::vec3(-1.25f, -0.2f, 1.25f),
-			glm::vec3(1.25f, 0.1f, -1.25f),
-			glm::vec3(-1.25f, -0.25f, -1.25f),
-		};
-
-		for (auto position : positions) {
+		for (auto position : treePositions) {
+			if (cull && !isVisibleInCascade(cascades[cascadeIndex], bounds.tree.center + position, bounds.tree.radius)) {
+				continue;
+			}
 			pushConstBlock.position = glm::vec4(position, 0.0f);
 			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
 			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 			models.tree.draw(commandBuffer, vkglTF::RenderFlags::BindImages, pipelineLayout);
+			drawCount++;
 		}
+
+		return drawCount;
 	}
 
 	/*
@@ -343,54 +423,123 @@ public:
 		sampler.maxLod = 1.0f;
 		sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
 		VK_CHECK_RESULT(vkCreateSampler(device, &sampler, nullptr, &depth.sampler));
+
+		depthPass.commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, cmdPool, false);
+
+		// Timestamps for measuring the cost of the shadow passes
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = 2;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &shadowStats.queryPool));
+			shadowStats.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			shadowStats.available = true;
+		}
 	}
 
-	void buildCommandBuffers()
+	/*
+		Select the cascades that need to be rendered this frame
+		Cascades with unchanged matrices are reused, cached cascades with changed matrices are re-rendered once their
+		update interval has passed or if they moved too far to still cover their split
+	*/
+	void selectCascadeUpdates()
 	{
-		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		shadowStats.cascadesRendered = 0;
+		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
+			Cascade& cascade = cascades[i];
+			if (!cascade.valid || !cacheCascades) {
+				cascade.render = true;
+			} else if (cascade.viewProjMatrix == cascade.renderedViewProjMatrix) {
+				cascade.render = false;
+			} else {
+				bool due = (shadowFrameIndex - cascade.renderedFrameIndex) >= cascadeUpdateIntervals[i];
+				bool outOfBounds = (cascade.radius != cascade.renderedRadius) || (glm::distance(cascade.center, cascade.renderedCenter) > cascade.radius * cascadeCacheTolerance);
+				cascade.render = due || outOfBounds;
+			}
+			if (cascade.render) {
+				cascade.renderedViewProjMatrix = cascade.viewProjMatrix;
+				cascade.renderedCenter = cascade.center;
+				cascade.renderedRadius = cascade.radius;
+				cascade.renderedFrameIndex = shadowFrameIndex;
+				cascade.frustum.update(cascade.viewProjMatrix);
+				cascade.valid = true;
+				shadowStats.cascadesRendered++;
+			}
+		}
+		shadowFrameIndex++;
+	}
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); i++) {
+	/*
+		Generate depth map cascades
 
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+		Uses multiple passes with each pass rendering the scene to the cascade's depth image layer
+		Could be optimized using a geometry shader (and layered frame buffer) on devices that support geometry shaders
+		Only cascades selected for this frame are rendered, all others keep their depth layer from a previous frame
+	*/
+	void buildShadowCommandBuffer()
+	{
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(depthPass.commandBuffer, &cmdBufInfo));
 
-			/*
-				Generate depth map cascades
+		if (shadowStats.available) {
+			vkCmdResetQueryPool(depthPass.commandBuffer, shadowStats.queryPool, 0, 2);
+			vkCmdWriteTimestamp(depthPass.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, shadowStats.queryPool, 0);
+		}
 
-				Uses multiple passes with each pass rendering the scene to the cascade's depth image layer
-				Could be optimized using a geometry shader (and layered frame buffer) on devices that support geometry shaders
-			*/
-			{
-				VkClearValue clearValues[1];
-				clearValues[0].depthStencil = { 1.0f, 0 };
+		VkClearValue clearValues[1];
+		clearValues[0].depthStencil = { 1.0f, 0 };
+
+		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+		renderPassBeginInfo.renderPass = depthPass.renderPass;
+		renderPassBeginInfo.renderArea.offset.x = 0;
+		renderPassBeginInfo.renderArea.offset.y = 0;
+		renderPassBeginInfo.renderArea.extent.width = SHADOWMAP_DIM;
+		renderPassBeginInfo.renderArea.extent.height = SHADOWMAP_DIM;
+		renderPassBeginInfo.clearValueCount = 1;
+		renderPassBeginInfo.pClearValues = clearValues;
+
+		VkViewport viewport = vks::initializers::viewport((float)SHADOWMAP_DIM, (float)SHADOWMAP_DIM, 0.0f, 1.0f);
+		vkCmdSetViewport(depthPass.commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = vks::initializers::rect2D(SHADOWMAP_DIM, SHADOWMAP_DIM, 0, 0);
+		vkCmdSetScissor(depthPass.commandBuffer, 0, 1, &scissor);
+
+		// One pass per cascade
+		// The layer that this pass renders to is defined by the cascade's image view (selected via the cascade's descriptor set)
+		shadowStats.draws = 0;
+		shadowStats.drawsCulled = 0;
+		for (uint32_t j = 0; j < SHADOW_MAP_CASCADE_COUNT; j++) {
+			if (!cascades[j].render) {
+				continue;
+			}
+			renderPassBeginInfo.framebuffer = cascades[j].frameBuffer;
+			vkCmdBeginRenderPass(depthPass.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+			vkCmdBindPipeline(depthPass.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPass.pipeline);
+			uint32_t drawCount = renderScene(depthPass.commandBuffer, depthPass.pipelineLayout, cascades[j].descriptorSet, j, cullCascades);
+			vkCmdEndRenderPass(depthPass.commandBuffer);
+			shadowStats.draws += drawCount;
+			shadowStats.drawsCulled += 1 + static_cast<uint32_t>(treePositions.size()) - drawCount;
+		}
 
-				VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-				renderPassBeginInfo.renderPass = depthPass.renderPass;
-				renderPassBeginInfo.renderArea.offset.x = 0;
-				renderPassBeginInfo.renderArea.offset.y = 0;
-				renderPassBeginInfo.renderArea.extent.width = SHADOWMAP_DIM;
-				renderPassBeginInfo.renderArea.extent.height = SHADOWMAP_DIM;
-				renderPassBeginInfo.clearValueCount = 1;
-				renderPassBeginInfo.pClearValues = clearValues;
+		if (shadowStats.available) {
+			vkCmdWriteTimestamp(depthPass.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, shadowStats.queryPool, 1);
+		}
 
-				VkViewport viewport = vks::initializers::viewport((float)SHADOWMAP_DIM, (float)SHADOWMAP_DIM, 0.0f, 1.0f);
-				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+		VK_CHECK_RESULT(vkEndCommandBuffer(depthPass.commandBuffer));
+	}
 
-				VkRect2D scissor = vks::initializers::rect2D(SHADOWMAP_DIM, SHADOWMAP_DIM, 0, 0);
-				vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+	void buildCommandBuffers()
+	{
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-				// One pass per cascade
-				// The layer that this pass renders to is defined by the cascade's image view (selected via the cascade's descriptor set)
-				for (uint32_t j = 0; j < SHADOW_MAP_CASCADE_COUNT; j++) {
-					renderPassBeginInfo.framebuffer = cascades[j].frameBuffer;
-					vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-					vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, depthPass.pipeline);
-					renderScene(drawCmdBuffers[i], depthPass.pipelineLayout, cascades[j].descriptorSet, j);
-					vkCmdEndRenderPass(drawCmdBuffers[i]);
-				}
-			}
+		for (int32_t i = 0; i < drawCmdBuffers.size(); i++) {
+
+			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
 			/*
-				Note: Explicit synchronization is not required between the render pass, as this is done implicit via sub pass dependencies
+				Note: The depth map cascades are rendered by a separate command buffer submitted before this one
+				Explicit synchronization is not required between the render pass, as this is done implicit via sub pass dependencies
 			*/
 
 			/*
@@ -448,6 +597,39 @@ public:
 		uint32_t glTFLoadingFlags = vkglTF::FileLoadingFlags::PreTransformVertices | vkglTF::FileLoadingFlags::FlipY;
 		models.terrain.loadFromFile(getAssetPath() + "models/terrain_gridlines.gltf", vulkanDevice, queue, glTFLoadingFlags);
 		models.tree.loadFromFile(getAssetPath() + "models/oaktree.gltf", vulkanDevice, queue, glTFLoadingFlags);
+		bounds.terrain = getBoundingSphere(models.terrain);
+		bounds.tree = getBoundingSphere(models.tree);
+	}
+
+	/*
+		The model's dimensions are taken from the glTF accessors and don't include the y flip applied to the vertices at load time
+		So the bounds are computed from the primitive bounds transformed the same way as the vertices
+	*/
+	BoundingSphere getBoundingSphere(vkglTF::Model& model)
+	{
+		glm::vec3 min(FLT_MAX);
+		glm::vec3 max(-FLT_MAX);
+		for (vkglTF::Node* node : model.linearNodes) {
+			if (!node->mesh) {
+				continue;
+			}
+			const glm::mat4 matrix = node->getMatrix();
+			for (vkglTF::Primitive* primitive : node->mesh->primitives) {
+				const glm::vec3& pMin = primitive->dimensions.min;
+				const glm::vec3& pMax = primitive->dimensions.max;
+				for (uint32_t i = 0; i < 8; i++) {
+					const glm::vec3 corner((i & 1) ? pMax.x : pMin.x, (i & 2) ? pMax.y : pMin.y, (i & 4) ? pMax.z : pMin.z);
+					glm::vec3 pos = glm::vec3(matrix * glm::vec4(corner, 1.0f));
+					pos.y = -pos.y;
+					min = glm::min(min, pos);
+					max = glm::max(max, pos);
+				}
+			}
+		}
+		BoundingSphere sphere;
+		sphere.center = (min + max) * 0.5f;
+		sphere.radius = glm::distance(min, max) * 0.5f;
+		return sphere;
 	}
 
 	void setupLayoutsAndDescriptors()
@@ -657,6 +839,13 @@ public:
 			cascadeSplits[i] = (d - nearClip) / clipRange;
 		}
 
+		// Project frustum corners into world space
+		glm::mat4 invCam = glm::inverse(camera.matrices.perspective * camera.matrices.view);
+
+		// Light view is a pure rotation, so cascades can be snapped to texels in light space
+		glm::vec3 lightDir = normalize(-lightPos);
+		glm::mat4 lightViewMatrix = glm::lookAt(glm::vec3(0.0f), lightDir, glm::vec3(0.0f, 1.0f, 0.0f));
+
 		// Calculate orthographic projection matrix for each cascade
 		float lastSplitDist = 0.0;
 		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
@@ -673,8 +862,6 @@ public:
 				glm::vec3(-1.0f, -1.0f,  1.0f),
 			};
 
-			// Project frustum corners into world space
-			glm::mat4 invCam = glm::inverse(camera.matrices.perspective * camera.matrices.view);
 			for (uint32_t i = 0; i < 8; i++) {
 				glm::vec4 invCorner = invCam * glm::vec4(frustumCorners[i], 1.0f);
 				frustumCorners[i] = invCorner / invCorner.w;
@@ -700,16 +887,26 @@ public:
 			}
 			radius = std::ceil(radius * 16.0f) / 16.0f;
 
-			glm::vec3 maxExtents = glm::vec3(radius);
-			glm::vec3 minExtents = -maxExtents;
-
-			glm::vec3 lightDir = normalize(-lightPos);
-			glm::mat4 lightViewMatrix = glm::lookAt(frustumCenter - lightDir * -minExtents.z, frustumCenter, glm::vec3(0.0f, 1.0f, 0.0f));
-			glm::mat4 lightOrthoMatrix = glm::ortho(minExtents.x, maxExtents.x, minExtents.y, maxExtents.y, 0.0f, maxExtents.z - minExtents.z);
+			// Snap the cascade center to shadow map texels, so the projection only changes in whole texel steps when the camera moves
+			// This avoids shimmering shadow edges and keeps the matrix of a cascade unchanged for small camera movements
+			// Depth is snapped to a coarser step and the depth range is extended by that step to still cover the whole split
+			float texelSize = 2.0f * radius / static_cast<float>(SHADOWMAP_DIM);
+			float depthStep = radius / 8.0f;
+			glm::vec3 lightSpaceCenter = glm::vec3(lightViewMatrix * glm::vec4(frustumCenter, 1.0f));
+			lightSpaceCenter.x = std::floor(lightSpaceCenter.x / texelSize) * texelSize;
+			lightSpaceCenter.y = std::floor(lightSpaceCenter.y / texelSize) * texelSize;
+			lightSpaceCenter.z = std::floor(lightSpaceCenter.z / depthStep) * depthStep;
+
+			glm::mat4 lightOrthoMatrix = glm::ortho(
+				lightSpaceCenter.x - radius, lightSpaceCenter.x + radius,
+				lightSpaceCenter.y - radius, lightSpaceCenter.y + radius,
+				-lightSpaceCenter.z - radius - depthStep, -lightSpaceCenter.z + radius + depthStep);
 
 			// Store split distance and matrix in cascade
 			cascades[i].splitDepth = (camera.getNearClip() + splitDist * clipRange) * -1.0f;
 			cascades[i].viewProjMatrix = lightOrthoMatrix * lightViewMatrix;
+			cascades[i].center = frustumCenter;
+			cascades[i].radius = radius;
 
 			lastSplitDist = cascadeSplits[i];
 		}
@@ -728,7 +925,7 @@ public:
 			Depth rendering
 		*/
 		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
-			depthPass.ubo.cascadeViewProjMat[i] = cascades[i].viewProjMatrix;
+			depthPass.ubo.cascadeViewProjMat[i] = cascades[i].renderedViewProjMatrix;
 		}
 		memcpy(depthPass.uniformBuffer.mapped, &depthPass.ubo, sizeof(depthPass.ubo));
 
@@ -745,7 +942,7 @@ public:
 
 		for (uint32_t i = 0; i < SHADOW_MAP_CASCADE_COUNT; i++) {
 			uboFS.cascadeSplits[i] = cascades[i].splitDepth;
-			uboFS.cascadeViewProjMat[i] = cascades[i].viewProjMatrix;
+			uboFS.cascadeViewProjMat[i] = cascades[i].renderedViewProjMatrix;
 		}
 		uboFS.inverseViewMat = glm::inverse(camera.matrices.view);
 		uboFS.lightDir = normalize(-lightPos);
@@ -756,10 +953,24 @@ public:
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+
+		// The previous frame has finished executing, so the shadow command buffer and uniform buffers can be updated
+		selectCascadeUpdates();
+		updateUniformBuffers();
+		buildShadowCommandBuffer();
+
+		std::array<VkCommandBuffer, 2> commandBuffers = { depthPass.commandBuffer, drawCmdBuffers[currentBuffer] };
+		submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+		submitInfo.pCommandBuffers = commandBuffers.data();
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 		VulkanExampleBase::submitFrame();
+
+		if (shadowStats.available) {
+			uint64_t timestamps[2];
+			if (vkGetQueryPoolResults(device, shadowStats.queryPool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				shadowStats.gpuTime = (float)(timestamps[1] - timestamps[0]) * shadowStats.timestampPeriod / 1000000.0f;
+			}
+		}
 	}
 
 	void prepare()
@@ -784,7 +995,6 @@ public:
 		if (!paused || camera.updated) {
 			updateLight();
 			updateCascades();
-			updateUniformBuffers();
 		}
 	}
 
@@ -809,6 +1019,15 @@ public:
 			if (overlay->checkBox("PCF filtering", &filterPCF)) {
 				buildCommandBuffers();
 			}
+			overlay->checkBox("Cull cascades", &cullCascades);
+			overlay->checkBox("Cache cascades", &cacheCascades);
+		}
+		if (overlay->header("Shadow statistics")) {
+			overlay->text("Cascades rendered: %d / %d", shadowStats.cascadesRendered, SHADOW_MAP_CASCADE_COUNT);
+			overlay->text("Draws: %d (%d culled)", shadowStats.draws, shadowStats.drawsCulled);
+			if (shadowStats.available) {
+				overlay->text("Shadow passes: %.3f ms", shadowStats.gpuTime);
+			}
 		}
 	}
 };
@@ -8,11 +8,17 @@
 
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "VulkanRenderGraph.h"
 
 #define ENABLE_VALIDATION false
 
 #define SSAO_KERNEL_SIZE 64
 #define SSAO_RADIUS 0.3f
+// Kernel samples per pixel for the reduced resolution modes, neighbouring pixels (and frames) use interleaved subsets of the kernel
+#define SSAO_PERFORMANCE_SAMPLES 16
+#define SSAO_TEMPORAL_SAMPLES 8
+// Weight of the current frame when accumulating occlusion over multiple frames
+#define SSAO_TEMPORAL_BLEND 0.1f
 
 #if defined(__ANDROID__)
 #define SSAO_NOISE_DIM 8
@@ -42,13 +48,52 @@ public:
 		int32_t ssao = true;
 		int32_t ssaoOnly = false;
 		int32_t ssaoBlur = true;
+		int32_t sampleCount = SSAO_KERNEL_SIZE;
+		// Transforms view space positions of the current frame to clip space of the previous frame
+		glm::mat4 reprojection;
+		uint32_t frameIndex = 0;
+		float temporalBlend = 1.0f;
 	} uboSSAOParams;
 
+	/*
+		Full resolution uses the fragment shader passes with the full kernel
+		Half and quarter resolution downsample the G-Buffer and compute occlusion with fewer samples in compute shaders, followed by a separable bilateral blur
+		and a depth-aware upsample to full resolution
+	*/
+	enum SSAOQuality { QualityFull = 0, QualityHalf = 1, QualityQuarter = 2 };
+	int32_t ssaoQuality = QualityFull;
+	bool temporalAccumulation = false;
+
+	// Occlusion of the previous frame for temporal accumulation, this has to outlive a frame so it's not owned by the render graph
+	// Layers are used alternately, the layer of the previous frame is read while the other one is written
+	struct {
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+		VkExtent2D extent = {};
+		glm::mat4 previousView;
+	} history;
+
+	// Each pass writes a timestamp after it has finished, so the time of a pass also includes the barriers recorded before it
+	enum TimedPass { TimedGBuffer = 0, TimedDownsample, TimedSSAO, TimedTemporal, TimedBlurHorizontal, TimedBlurVertical, TimedBlur, TimedUpsample, TimedComposition, TimedPassCount };
+	struct {
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		float timestampPeriod = 1.0f;
+		bool available = false;
+		// Negative for passes that were not executed
+		std::array<double, TimedPassCount> passTimes;
+	} timing;
+
 	struct {
 		VkPipeline offscreen;
 		VkPipeline composition;
 		VkPipeline ssao;
 		VkPipeline ssaoBlur;
+		VkPipeline downsample;
+		VkPipeline ssaoCompute;
+		VkPipeline temporal;
+		VkPipeline bilateralBlur;
+		VkPipeline upsample;
 	} pipelines;
 
 	struct {
@@ -56,15 +101,26 @@ public:
 		VkPipelineLayout ssao;
 		VkPipelineLayout ssaoBlur;
 		VkPipelineLayout composition;
+		VkPipelineLayout downsample;
+		VkPipelineLayout ssaoCompute;
+		VkPipelineLayout temporal;
+		VkPipelineLayout bilateralBlur;
+		VkPipelineLayout upsample;
 	} pipelineLayouts;
 
 	struct {
-		const uint32_t count = 5;
+		const uint32_t count = 11;
 		VkDescriptorSet model;
 		VkDescriptorSet floor;
 		VkDescriptorSet ssao;
 		VkDescriptorSet ssaoBlur;
 		VkDescriptorSet composition;
+		VkDescriptorSet downsample;
+		VkDescriptorSet ssaoCompute;
+		VkDescriptorSet temporal;
+		VkDescriptorSet blurHorizontal;
+		VkDescriptorSet blurVertical;
+		VkDescriptorSet upsample;
 	} descriptorSets;
 
 	struct {
@@ -72,6 +128,11 @@ public:
 		VkDescriptorSetLayout ssao;
 		VkDescriptorSetLayout ssaoBlur;
 		VkDescriptorSetLayout composition;
+		VkDescriptorSetLayout downsample;
+		VkDescriptorSetLayout ssaoCompute;
+		VkDescriptorSetLayout temporal;
+		VkDescriptorSetLayout bilateralBlur;
+		VkDescriptorSetLayout upsample;
 	} descriptorSetLayouts;
 
 	struct {
@@ -80,46 +141,36 @@ public:
 		vks::Buffer ssaoParams;
 	} uniformBuffers;
 
-	// Framebuffer for offscreen rendering
-	struct FrameBufferAttachment {
-		VkImage image;
-		VkDeviceMemory mem;
-		VkImageView view;
-		VkFormat format;
-		void destroy(VkDevice device)
-		{
-			vkDestroyImage(device, image, nullptr);
-			vkDestroyImageView(device, view, nullptr);
-			vkFreeMemory(device, mem, nullptr);
-		}
-	};
-	struct FrameBuffer {
-		int32_t width, height;
-		VkFramebuffer frameBuffer;
-		VkRenderPass renderPass;
-		void setSize(int32_t w, int32_t h)
-		{
-			this->width = w;
-			this->height = h;
-		}
-		void destroy(VkDevice device)
-		{
-			vkDestroyFramebuffer(device, frameBuffer, nullptr);
-			vkDestroyRenderPass(device, renderPass, nullptr);
-		}
-	};
-
+	// All offscreen images, render passes and barriers are owned by the render graph
+	vks::RenderGraph renderGraph;
+	struct {
+		vks::RenderGraph::Resource position, normal, albedo, depth;
+		vks::RenderGraph::Resource ssao, ssaoBlur;
+		// Reduced resolution path
+		vks::RenderGraph::Resource lowResPosition, lowResNormal;
+		vks::RenderGraph::Resource ssaoLowRes, ssaoTemporal, ssaoBlurHorizontal, ssaoBlurVertical, ssaoUpsampled;
+		// Occlusion read by the bilateral blur and by the upsample, depends on the settings
+		vks::RenderGraph::Resource blurSource, upsampleSource;
+	} images;
 	struct {
-		struct Offscreen : public FrameBuffer {
-			FrameBufferAttachment position, normal, albedo, depth;
-		} offscreen;
-		struct SSAO : public FrameBuffer {
-			FrameBufferAttachment color;
-		} ssao, ssaoBlur;
-	} frameBuffers;
+		vks::RenderGraph::Pass* gBuffer = nullptr;
+		vks::RenderGraph::Pass* ssao = nullptr;
+		vks::RenderGraph::Pass* ssaoBlur = nullptr;
+		vks::RenderGraph::Pass* downsample = nullptr;
+		vks::RenderGraph::Pass* ssaoCompute = nullptr;
+		vks::RenderGraph::Pass* temporal = nullptr;
+		vks::RenderGraph::Pass* blurHorizontal = nullptr;
+		vks::RenderGraph::Pass* blurVertical = nullptr;
+		vks::RenderGraph::Pass* upsample = nullptr;
+	} passes;
+	// Swap chain framebuffer the composition pass renders to, set before executing the graph
+	VkFramebuffer compositionFramebuffer = VK_NULL_HANDLE;
 
 	// One sampler for the frame buffer color attachments
 	VkSampler colorSampler;
+	// Single R8 color attachment render pass the fullscreen SSAO pipelines are created against
+	// It's compatible with the graph's SSAO, blur and upsample passes, which only exist (and aren't culled) for some of the settings
+	VkRenderPass occlusionRenderPass = VK_NULL_HANDLE;
 
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
@@ -136,34 +187,44 @@ public:
 	~VulkanExample()
 	{
 		vkDestroySampler(device, colorSampler, nullptr);
+		vkDestroyRenderPass(device, occlusionRenderPass, nullptr);
 
-		// Attachments
-		frameBuffers.offscreen.position.destroy(device);
-		frameBuffers.offscreen.normal.destroy(device);
-		frameBuffers.offscreen.albedo.destroy(device);
-		frameBuffers.offscreen.depth.destroy(device);
-		frameBuffers.ssao.color.destroy(device);
-		frameBuffers.ssaoBlur.color.destroy(device);
-
-		// Framebuffers
-		frameBuffers.offscreen.destroy(device);
-		frameBuffers.ssao.destroy(device);
-		frameBuffers.ssaoBlur.destroy(device);
+		renderGraph.destroy();
 
 		vkDestroyPipeline(device, pipelines.offscreen, nullptr);
 		vkDestroyPipeline(device, pipelines.composition, nullptr);
 		vkDestroyPipeline(device, pipelines.ssao, nullptr);
 		vkDestroyPipeline(device, pipelines.ssaoBlur, nullptr);
+		vkDestroyPipeline(device, pipelines.downsample, nullptr);
+		vkDestroyPipeline(device, pipelines.ssaoCompute, nullptr);
+		vkDestroyPipeline(device, pipelines.temporal, nullptr);
+		vkDestroyPipeline(device, pipelines.bilateralBlur, nullptr);
+		vkDestroyPipeline(device, pipelines.upsample, nullptr);
 
 		vkDestroyPipelineLayout(device, pipelineLayouts.gBuffer, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.ssao, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.ssaoBlur, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.composition, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.downsample, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.ssaoCompute, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.temporal, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.bilateralBlur, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayouts.upsample, nullptr);
 
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.gBuffer, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.ssao, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.ssaoBlur, nullptr);
 		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.composition, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.downsample, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.ssaoCompute, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.temporal, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.bilateralBlur, nullptr);
+		vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.upsample, nullptr);
+
+		destroyHistory();
+		if (timing.queryPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(device, timing.queryPool, nullptr);
+		}
 
 		// Uniform buffers
 		uniformBuffers.sceneParams.destroy();
@@ -178,295 +239,441 @@ public:
 		enabledFeatures.samplerAnisotropy = deviceFeatures.samplerAnisotropy;
 	}
 
-	// Create a frame buffer attachment
-	void createAttachment(
-		VkFormat format,
-		VkImageUsageFlagBits usage,
-		FrameBufferAttachment *attachment,
-		uint32_t width,
-		uint32_t height)
+	/*
+		Passes only declare the images they write and read, the render graph derives render passes, layout transitions and barriers from that
+		Passes whose results aren't used by the composition (e.g. the blur with blurring disabled) are culled, and images whose lifetimes
+		don't overlap (e.g. the G-Buffer depth and the SSAO images) share memory
+	*/
+	void buildRenderGraph()
 	{
-		VkImageAspectFlags aspectMask = 0;
+		renderGraph.reset();
+		renderGraph.setExtent(width, height);
+		passes = {};
 
-		attachment->format = format;
+#if defined(__ANDROID__)
+		const float ssaoScale = 0.5f;
+#else
+		const float ssaoScale = 1.0f;
+#endif
 
-		if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
-		{
-			aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		// Find a suitable depth format
+		VkFormat attDepthFormat;
+		VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &attDepthFormat);
+		assert(validDepthFormat);
+
+		// G-Buffer
+		images.position = renderGraph.createImage("Position", VK_FORMAT_R32G32B32A32_SFLOAT);	// Position + Depth
+		images.normal = renderGraph.createImage("Normals", VK_FORMAT_R8G8B8A8_UNORM);			// Normals
+		images.albedo = renderGraph.createImage("Albedo", VK_FORMAT_R8G8B8A8_UNORM);				// Albedo (color)
+		images.depth = renderGraph.createImage("Depth", attDepthFormat);						// Depth
+		// SSAO
+		images.ssao = renderGraph.createImage("SSAO", VK_FORMAT_R8_UNORM, ssaoScale);
+		// SSAO blur
+		images.ssaoBlur = renderGraph.createImage("SSAO blur", VK_FORMAT_R8_UNORM);
+		// Reduced resolution SSAO, images written by compute shaders use formats with mandatory storage image support
+		const float lowResScale = (ssaoQuality == QualityQuarter) ? 0.25f : 0.5f;
+		images.lowResPosition = renderGraph.createImage("Position (low resolution)", VK_FORMAT_R32G32B32A32_SFLOAT, lowResScale);
+		images.lowResNormal = renderGraph.createImage("Normals (low resolution)", VK_FORMAT_R8G8B8A8_UNORM, lowResScale);
+		images.ssaoLowRes = renderGraph.createImage("SSAO (low resolution)", VK_FORMAT_R32_SFLOAT, lowResScale);
+		images.ssaoTemporal = renderGraph.createImage("SSAO temporal", VK_FORMAT_R32_SFLOAT, lowResScale);
+		images.ssaoBlurHorizontal = renderGraph.createImage("SSAO blur horizontal", VK_FORMAT_R32_SFLOAT, lowResScale);
+		images.ssaoBlurVertical = renderGraph.createImage("SSAO blur vertical", VK_FORMAT_R32_SFLOAT, lowResScale);
+		images.ssaoUpsampled = renderGraph.createImage("SSAO upsampled", VK_FORMAT_R8_UNORM);
+		images.blurSource = temporalAccumulation ? images.ssaoTemporal : images.ssaoLowRes;
+		images.upsampleSource = uboSSAOParams.ssaoBlur ? images.ssaoBlurVertical : images.blurSource;
+
+		/*
+			First pass: Fill G-Buffer components (positions+depth, normals, albedo) using MRT
+		*/
+		vks::RenderGraph::Pass& gBufferPass = renderGraph.addPass("G-Buffer");
+		gBufferPass.addColorOutput(images.position, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+		gBufferPass.addColorOutput(images.normal, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+		gBufferPass.addColorOutput(images.albedo, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+		gBufferPass.setDepthStencilOutput(images.depth);
+		gBufferPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.offscreen);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.gBuffer, 0, 1, &descriptorSets.floor, 0, NULL);
+			scene.draw(commandBuffer, vkglTF::RenderFlags::BindImages, pipelineLayouts.gBuffer);
+			writeTimestamp(commandBuffer, TimedGBuffer);
+		});
+		passes.gBuffer = &gBufferPass;
+
+		if (ssaoQuality == QualityFull) {
+			/*
+				Second pass: SSAO generation
+			*/
+			vks::RenderGraph::Pass& ssaoPass = renderGraph.addPass("SSAO");
+			ssaoPass.addColorOutput(images.ssao, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+			ssaoPass.addSampledInput(images.position);
+			ssaoPass.addSampledInput(images.normal);
+			ssaoPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.ssao, 0, 1, &descriptorSets.ssao, 0, NULL);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.ssao);
+				vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+				writeTimestamp(commandBuffer, TimedSSAO);
+			});
+			passes.ssao = &ssaoPass;
+
+			/*
+				Third pass: SSAO blur
+			*/
+			vks::RenderGraph::Pass& ssaoBlurPass = renderGraph.addPass("SSAO blur");
+			ssaoBlurPass.addColorOutput(images.ssaoBlur, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+			ssaoBlurPass.addSampledInput(images.ssao);
+			ssaoBlurPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.ssaoBlur, 0, 1, &descriptorSets.ssaoBlur, 0, NULL);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.ssaoBlur);
+				vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+				writeTimestamp(commandBuffer, TimedBlur);
+			});
+			passes.ssaoBlur = &ssaoBlurPass;
+		} else {
+			/*
+				Reduced resolution: Downsample positions and normals, taking the sample closest to the camera for each low resolution pixel
+			*/
+			vks::RenderGraph::Pass& downsamplePass = renderGraph.addPass("Downsample");
+			downsamplePass.addSampledInput(images.position, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			downsamplePass.addSampledInput(images.normal, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			downsamplePass.addStorageOutput(images.lowResPosition);
+			downsamplePass.addStorageOutput(images.lowResNormal);
+			downsamplePass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.downsample);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.downsample, 0, 1, &descriptorSets.downsample, 0, NULL);
+				dispatchImage(commandBuffer, images.lowResPosition, 8);
+				writeTimestamp(commandBuffer, TimedDownsample);
+			});
+			passes.downsample = &downsamplePass;
+
+			/*
+				SSAO generation at reduced resolution with interleaved subsets of the kernel
+			*/
+			vks::RenderGraph::Pass& ssaoPass = renderGraph.addPass("SSAO (compute)");
+			ssaoPass.addSampledInput(images.lowResPosition, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			ssaoPass.addSampledInput(images.lowResNormal, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			ssaoPass.addStorageOutput(images.ssaoLowRes);
+			ssaoPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.ssaoCompute);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.ssaoCompute, 0, 1, &descriptorSets.ssaoCompute, 0, NULL);
+				dispatchImage(commandBuffer, images.ssaoLowRes, 8);
+				writeTimestamp(commandBuffer, TimedSSAO);
+			});
+			passes.ssaoCompute = &ssaoPass;
+
+			/*
+				Optional temporal accumulation: blends the occlusion with the reprojected result of the previous frames
+			*/
+			if (temporalAccumulation) {
+				vks::RenderGraph::Pass& temporalPass = renderGraph.addPass("SSAO temporal");
+				temporalPass.addSampledInput(images.ssaoLowRes, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+				temporalPass.addSampledInput(images.lowResPosition, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+				temporalPass.addStorageOutput(images.ssaoTemporal);
+				temporalPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+					// The history is outside of the graph, its layer written in the previous frame needs to be visible to this frame's reads
+					VkMemoryBarrier memoryBarrier = vks::initializers::memoryBarrier();
+					memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+					memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+					vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.temporal);
+					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.temporal, 0, 1, &descriptorSets.temporal, 0, NULL);
+					dispatchImage(commandBuffer, images.ssaoTemporal, 8);
+					writeTimestamp(commandBuffer, TimedTemporal);
+				});
+				passes.temporal = &temporalPass;
+			}
+
+			/*
+				Separable bilateral blur, both directions use the same shader with tiles in shared memory
+			*/
+			vks::RenderGraph::Pass& blurHorizontalPass = renderGraph.addPass("SSAO blur horizontal");
+			blurHorizontalPass.addSampledInput(images.blurSource, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			blurHorizontalPass.addSampledInput(images.lowResPosition, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			blurHorizontalPass.addStorageOutput(images.ssaoBlurHorizontal);
+			blurHorizontalPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				const glm::ivec2 direction(1, 0);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.bilateralBlur);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.bilateralBlur, 0, 1, &descriptorSets.blurHorizontal, 0, NULL);
+				vkCmdPushConstants(commandBuffer, pipelineLayouts.bilateralBlur, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(glm::ivec2), &direction);
+				dispatchImage(commandBuffer, images.ssaoBlurHorizontal, 16);
+				writeTimestamp(commandBuffer, TimedBlurHorizontal);
+			});
+			passes.blurHorizontal = &blurHorizontalPass;
+
+			vks::RenderGraph::Pass& blurVerticalPass = renderGraph.addPass("SSAO blur vertical");
+			blurVerticalPass.addSampledInput(images.ssaoBlurHorizontal, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			blurVerticalPass.addSampledInput(images.lowResPosition, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+			blurVerticalPass.addStorageOutput(images.ssaoBlurVertical);
+			blurVerticalPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				const glm::ivec2 direction(0, 1);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.bilateralBlur);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayouts.bilateralBlur, 0, 1, &descriptorSets.blurVertical, 0, NULL);
+				vkCmdPushConstants(commandBuffer, pipelineLayouts.bilateralBlur, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(glm::ivec2), &direction);
+				dispatchImage(commandBuffer, images.ssaoBlurVertical, 16);
+				writeTimestamp(commandBuffer, TimedBlurVertical);
+			});
+			passes.blurVertical = &blurVerticalPass;
+
+			/*
+				Depth-aware upsample to full resolution
+			*/
+			vks::RenderGraph::Pass& upsamplePass = renderGraph.addPass("SSAO upsample");
+			upsamplePass.addColorOutput(images.ssaoUpsampled, VK_ATTACHMENT_LOAD_OP_CLEAR, { { 0.0f, 0.0f, 0.0f, 1.0f } });
+			upsamplePass.addSampledInput(images.upsampleSource);
+			upsamplePass.addSampledInput(images.lowResPosition);
+			upsamplePass.addSampledInput(images.position);
+			upsamplePass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.upsample, 0, 1, &descriptorSets.upsample, 0, NULL);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.upsample);
+				vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+				writeTimestamp(commandBuffer, TimedUpsample);
+			});
+			passes.upsample = &upsamplePass;
 		}
-		if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
-		{
-			aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-			if (format >= VK_FORMAT_D16_UNORM_S8_UINT)
-				aspectMask |=VK_IMAGE_ASPECT_STENCIL_BIT;
+
+		/*
+			Final pass: Composition into the swap chain, which is outside of the graph, so the pass is marked as having side effects
+			Only the SSAO image that's actually displayed is read, which culls the passes that aren't required for the current settings
+		*/
+		vks::RenderGraph::Pass& compositionPass = renderGraph.addPass("Composition");
+		compositionPass.addSampledInput(images.position);
+		compositionPass.addSampledInput(images.normal);
+		compositionPass.addSampledInput(images.albedo);
+		if (uboSSAOParams.ssao || uboSSAOParams.ssaoOnly) {
+			compositionPass.addSampledInput(compositionSSAOImage());
 		}
+		compositionPass.setSideEffect();
+		compositionPass.setRecordCallback([this](VkCommandBuffer commandBuffer) {
+			VkClearValue clearValues[2];
+			clearValues[0].color = defaultClearColor;
+			clearValues[1].depthStencil = { 1.0f, 0 };
 
-		assert(aspectMask > 0);
+			VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+			renderPassBeginInfo.renderPass = renderPass;
+			renderPassBeginInfo.framebuffer = compositionFramebuffer;
+			renderPassBeginInfo.renderArea.extent.width = width;
+			renderPassBeginInfo.renderArea.extent.height = height;
+			renderPassBeginInfo.clearValueCount = 2;
+			renderPassBeginInfo.pClearValues = clearValues;
 
-		VkImageCreateInfo image = vks::initializers::imageCreateInfo();
-		image.imageType = VK_IMAGE_TYPE_2D;
-		image.format = format;
-		image.extent.width = width;
-		image.extent.height = height;
-		image.extent.depth = 1;
-		image.mipLevels = 1;
-		image.arrayLayers = 1;
-		image.samples = VK_SAMPLE_COUNT_1_BIT;
-		image.tiling = VK_IMAGE_TILING_OPTIMAL;
-		image.usage = usage | VK_IMAGE_USAGE_SAMPLED_BIT;
+			vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
-		VkMemoryRequirements memReqs;
+			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+			vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-		VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &attachment->image));
-		vkGetImageMemoryRequirements(device, attachment->image, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &attachment->mem));
-		VK_CHECK_RESULT(vkBindImageMemory(device, attachment->image, attachment->mem, 0));
+			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+			vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		VkImageViewCreateInfo imageView = vks::initializers::imageViewCreateInfo();
-		imageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		imageView.format = format;
-		imageView.subresourceRange = {};
-		imageView.subresourceRange.aspectMask = aspectMask;
-		imageView.subresourceRange.baseMipLevel = 0;
-		imageView.subresourceRange.levelCount = 1;
-		imageView.subresourceRange.baseArrayLayer = 0;
-		imageView.subresourceRange.layerCount = 1;
-		imageView.image = attachment->image;
-		VK_CHECK_RESULT(vkCreateImageView(device, &imageView, nullptr, &attachment->view));
-	}
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.composition, 0, 1, &descriptorSets.composition, 0, NULL);
 
-	void prepareOffscreenFramebuffers()
-	{
-		// Attachments
-#if defined(__ANDROID__)
-		const uint32_t ssaoWidth = width / 2;
-		const uint32_t ssaoHeight = height / 2;
-#else
-		const uint32_t ssaoWidth = width;
-		const uint32_t ssaoHeight = height;
-#endif
+			// Final composition pass
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.composition);
+			vkCmdDraw(commandBuffer, 3, 1, 0, 0);
 
-		frameBuffers.offscreen.setSize(width, height);
-		frameBuffers.ssao.setSize(ssaoWidth, ssaoHeight);
-		frameBuffers.ssaoBlur.setSize(width, height);
+			drawUI(commandBuffer);
 
-		// Find a suitable depth format
-		VkFormat attDepthFormat;
-		VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &attDepthFormat);
-		assert(validDepthFormat);
+			writeTimestamp(commandBuffer, TimedComposition);
 
-		// G-Buffer
-		createAttachment(VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &frameBuffers.offscreen.position, width, height);	// Position + Depth
-		createAttachment(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &frameBuffers.offscreen.normal, width, height);			// Normals
-		createAttachment(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &frameBuffers.offscreen.albedo, width, height);			// Albedo (color)
-		createAttachment(attDepthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, &frameBuffers.offscreen.depth, width, height);			// Depth
+			vkCmdEndRenderPass(commandBuffer);
+		});
 
-		// SSAO
-		createAttachment(VK_FORMAT_R8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &frameBuffers.ssao.color, ssaoWidth, ssaoHeight);				// Color
+		renderGraph.compile();
+		prepareHistory();
+	}
 
-		// SSAO blur
-		createAttachment(VK_FORMAT_R8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &frameBuffers.ssaoBlur.color, width, height);					// Color
+	// Full resolution occlusion displayed by the composition
+	vks::RenderGraph::Resource compositionSSAOImage()
+	{
+		if (ssaoQuality != QualityFull) {
+			return images.ssaoUpsampled;
+		}
+		return uboSSAOParams.ssaoBlur ? images.ssaoBlur : images.ssao;
+	}
 
-		// Render passes
+	bool passActive(const vks::RenderGraph::Pass* pass)
+	{
+		return (pass != nullptr) && !pass->isCulled();
+	}
 
-		// G-Buffer creation
-		{
-			std::array<VkAttachmentDescription, 4> attachmentDescs = {};
-
-			// Init attachment properties
-			for (uint32_t i = 0; i < static_cast<uint32_t>(attachmentDescs.size()); i++)
-			{
-				attachmentDescs[i].samples = VK_SAMPLE_COUNT_1_BIT;
-				attachmentDescs[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-				attachmentDescs[i].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-				attachmentDescs[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-				attachmentDescs[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-				attachmentDescs[i].finalLayout = (i == 3) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			}
+	// Dispatch one invocation per texel of the image written by a compute pass
+	void dispatchImage(VkCommandBuffer commandBuffer, vks::RenderGraph::Resource image, uint32_t workGroupSize)
+	{
+		const VkExtent2D extent = renderGraph.getImageExtent(image);
+		vkCmdDispatch(commandBuffer, (extent.width + workGroupSize - 1) / workGroupSize, (extent.height + workGroupSize - 1) / workGroupSize, 1);
+	}
 
-			// Formats
-			attachmentDescs[0].format = frameBuffers.offscreen.position.format;
-			attachmentDescs[1].format = frameBuffers.offscreen.normal.format;
-			attachmentDescs[2].format = frameBuffers.offscreen.albedo.format;
-			attachmentDescs[3].format = frameBuffers.offscreen.depth.format;
-
-			std::vector<VkAttachmentReference> colorReferences;
-			colorReferences.push_back({ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-			colorReferences.push_back({ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-			colorReferences.push_back({ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-
-			VkAttachmentReference depthReference = {};
-			depthReference.attachment = 3;
-			depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-			VkSubpassDescription subpass = {};
-			subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-			subpass.pColorAttachments = colorReferences.data();
-			subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
-			subpass.pDepthStencilAttachment = &depthReference;
-
-			// Use subpass dependencies for attachment layout transitions
-			std::array<VkSubpassDependency, 2> dependencies;
-
-			dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[0].dstSubpass = 0;
-			dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-			dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			dependencies[1].srcSubpass = 0;
-			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-			dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			VkRenderPassCreateInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-			renderPassInfo.pAttachments = attachmentDescs.data();
-			renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentDescs.size());
-			renderPassInfo.subpassCount = 1;
-			renderPassInfo.pSubpasses = &subpass;
-			renderPassInfo.dependencyCount = 2;
-			renderPassInfo.pDependencies = dependencies.data();
-			VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &frameBuffers.offscreen.renderPass));
-
-			std::array<VkImageView, 4> attachments;
-			attachments[0] = frameBuffers.offscreen.position.view;
-			attachments[1] = frameBuffers.offscreen.normal.view;
-			attachments[2] = frameBuffers.offscreen.albedo.view;
-			attachments[3] = frameBuffers.offscreen.depth.view;
-
-			VkFramebufferCreateInfo fbufCreateInfo = vks::initializers::framebufferCreateInfo();
-			fbufCreateInfo.renderPass = frameBuffers.offscreen.renderPass;
-			fbufCreateInfo.pAttachments = attachments.data();
-			fbufCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-			fbufCreateInfo.width = frameBuffers.offscreen.width;
-			fbufCreateInfo.height = frameBuffers.offscreen.height;
-			fbufCreateInfo.layers = 1;
-			VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &frameBuffers.offscreen.frameBuffer));
+	void writeTimestamp(VkCommandBuffer commandBuffer, TimedPass pass)
+	{
+		if (timing.available) {
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timing.queryPool, pass + 1);
 		}
+	}
 
-		// SSAO
-		{
-			VkAttachmentDescription attachmentDescription{};
-			attachmentDescription.format = frameBuffers.ssao.color.format;
-			attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-			attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-			attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-			attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-			VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-
-			VkSubpassDescription subpass = {};
-			subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-			subpass.pColorAttachments = &colorReference;
-			subpass.colorAttachmentCount = 1;
-
-			std::array<VkSubpassDependency, 2> dependencies;
-
-			dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[0].dstSubpass = 0;
-			dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-			dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			dependencies[1].srcSubpass = 0;
-			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-			dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			VkRenderPassCreateInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-			renderPassInfo.pAttachments = &attachmentDescription;
-			renderPassInfo.attachmentCount = 1;
-			renderPassInfo.subpassCount = 1;
-			renderPassInfo.pSubpasses = &subpass;
-			renderPassInfo.dependencyCount = 2;
-			renderPassInfo.pDependencies = dependencies.data();
-			VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &frameBuffers.ssao.renderPass));
-
-			VkFramebufferCreateInfo fbufCreateInfo = vks::initializers::framebufferCreateInfo();
-			fbufCreateInfo.renderPass = frameBuffers.ssao.renderPass;
-			fbufCreateInfo.pAttachments = &frameBuffers.ssao.color.view;
-			fbufCreateInfo.attachmentCount = 1;
-			fbufCreateInfo.width = frameBuffers.ssao.width;
-			fbufCreateInfo.height = frameBuffers.ssao.height;
-			fbufCreateInfo.layers = 1;
-			VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &frameBuffers.ssao.frameBuffer));
+	void destroyHistory()
+	{
+		if (history.image == VK_NULL_HANDLE) {
+			return;
 		}
+		vkDestroyImageView(device, history.view, nullptr);
+		vkDestroyImage(device, history.image, nullptr);
+		vkFreeMemory(device, history.memory, nullptr);
+		history.view = VK_NULL_HANDLE;
+		history.image = VK_NULL_HANDLE;
+		history.memory = VK_NULL_HANDLE;
+	}
 
-		// SSAO Blur
-		{
-			VkAttachmentDescription attachmentDescription{};
-			attachmentDescription.format = frameBuffers.ssaoBlur.color.format;
-			attachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-			attachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-			attachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-			attachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-			attachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-			attachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			attachmentDescription.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-			VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-
-			VkSubpassDescription subpass = {};
-			subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-			subpass.pColorAttachments = &colorReference;
-			subpass.colorAttachmentCount = 1;
-
-			std::array<VkSubpassDependency, 2> dependencies;
-
-			dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[0].dstSubpass = 0;
-			dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-			dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			dependencies[1].srcSubpass = 0;
-			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-			dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-			dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-			dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-			dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-			dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-			VkRenderPassCreateInfo renderPassInfo = {};
-			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-			renderPassInfo.pAttachments = &attachmentDescription;
-			renderPassInfo.attachmentCount = 1;
-			renderPassInfo.subpassCount = 1;
-			renderPassInfo.pSubpasses = &subpass;
-			renderPassInfo.dependencyCount = 2;
-			renderPassInfo.pDependencies = dependencies.data();
-			VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &frameBuffers.ssaoBlur.renderPass));
-
-			VkFramebufferCreateInfo fbufCreateInfo = vks::initializers::framebufferCreateInfo();
-			fbufCreateInfo.renderPass = frameBuffers.ssaoBlur.renderPass;
-			fbufCreateInfo.pAttachments = &frameBuffers.ssaoBlur.color.view;
-			fbufCreateInfo.attachmentCount = 1;
-			fbufCreateInfo.width = frameBuffers.ssaoBlur.width;
-			fbufCreateInfo.height = frameBuffers.ssaoBlur.height;
-			fbufCreateInfo.layers = 1;
-			VK_CHECK_RESULT(vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &frameBuffers.ssaoBlur.frameBuffer));
+	// (Re)creates the history at the size of the reduced resolution occlusion, it's cleared to a depth of zero so the first frame rejects it
+	void prepareHistory()
+	{
+		destroyHistory();
+		if (!passActive(passes.temporal)) {
+			return;
+		}
+		history.extent = renderGraph.getImageExtent(images.ssaoTemporal);
+
+		VkImageCreateInfo imageCI = vks::initializers::imageCreateInfo();
+		imageCI.imageType = VK_IMAGE_TYPE_2D;
+		imageCI.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+		imageCI.extent = { history.extent.width, history.extent.height, 1 };
+		imageCI.mipLevels = 1;
+		imageCI.arrayLayers = 2;
+		imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCI, nullptr, &history.image));
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, history.image, &memReqs);
+		VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &history.memory));
+		VK_CHECK_RESULT(vkBindImageMemory(device, history.image, history.memory, 0));
+
+		VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 2 };
+		VkImageViewCreateInfo imageViewCI = vks::initializers::imageViewCreateInfo();
+		imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		imageViewCI.format = imageCI.format;
+		imageViewCI.subresourceRange = subresourceRange;
+		imageViewCI.image = history.image;
+		VK_CHECK_RESULT(vkCreateImageView(device, &imageViewCI, nullptr, &history.view));
+
+		// The history is sampled and written as a storage image, so it stays in the general layout
+		VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkImageMemoryBarrier imageMemoryBarrier = vks::initializers::imageMemoryBarrier();
+		imageMemoryBarrier.srcAccessMask = 0;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageMemoryBarrier.image = history.image;
+		imageMemoryBarrier.subresourceRange = subresourceRange;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+		VkClearColorValue clearColor = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+		vkCmdClearColorImage(commandBuffer, history.image, VK_IMAGE_LAYOUT_GENERAL, &clearColor, 1, &subresourceRange);
+		vulkanDevice->flushCommandBuffer(commandBuffer, queue, true);
+
+		history.previousView = uboSceneParams.view;
+		uboSSAOParams.frameIndex = 0;
+	}
+
+	// Images of culled passes aren't created, descriptors referencing them point to another (unused) image instead
+	VkDescriptorImageInfo graphImageDescriptor(vks::RenderGraph::Resource image)
+	{
+		VkImageView view = renderGraph.getImageView(image);
+		if (view == VK_NULL_HANDLE) {
+			view = renderGraph.getImageView(images.albedo);
 		}
+		return vks::initializers::descriptorImageInfo(colorSampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	}
+
+	VkDescriptorImageInfo graphStorageImageDescriptor(vks::RenderGraph::Resource image)
+	{
+		return vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, renderGraph.getImageView(image), VK_IMAGE_LAYOUT_GENERAL);
+	}
+
+	// The render graph's images are recreated on every compile (resize, settings change)
+	void updateImageDescriptors()
+	{
+		std::vector<VkDescriptorImageInfo> imageDescriptors = {
+			graphImageDescriptor(images.position),
+			graphImageDescriptor(images.normal),
+			graphImageDescriptor(images.albedo),
+			graphImageDescriptor((ssaoQuality == QualityFull) ? images.ssao : images.ssaoUpsampled),
+			graphImageDescriptor((ssaoQuality == QualityFull) ? images.ssaoBlur : images.ssaoUpsampled),
+		};
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			// SSAO Generation
+			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[0]),					// FS Position+Depth
+			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &imageDescriptors[1]),					// FS Normals
+			// SSAO Blur
+			vks::initializers::writeDescriptorSet(descriptorSets.ssaoBlur, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[3]),				// FS Sampler SSAO
+			// Composition
+			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[0]),			// FS Sampler Position+Depth
+			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &imageDescriptors[1]),			// FS Sampler Normals
+			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &imageDescriptors[2]),			// FS Sampler Albedo
+			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &imageDescriptors[3]),			// FS Sampler SSAO
+			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, &imageDescriptors[4]),			// FS Sampler SSAO blurred
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 
+		// Reduced resolution passes, storage images can't point to another image, so only sets of passes that weren't culled are updated
+		if (ssaoQuality == QualityFull) {
+			return;
+		}
+		std::vector<VkDescriptorImageInfo> lowResDescriptors = {
+			graphImageDescriptor(images.lowResPosition),
+			graphImageDescriptor(images.lowResNormal),
+			graphImageDescriptor(images.ssaoLowRes),
+			graphImageDescriptor(images.blurSource),
+			graphImageDescriptor(images.ssaoBlurHorizontal),
+			graphImageDescriptor(images.upsampleSource),
+		};
+		std::vector<VkDescriptorImageInfo> storageDescriptors = {
+			graphStorageImageDescriptor(images.lowResPosition),
+			graphStorageImageDescriptor(images.lowResNormal),
+			graphStorageImageDescriptor(images.ssaoLowRes),
+			graphStorageImageDescriptor(images.ssaoTemporal),
+			graphStorageImageDescriptor(images.ssaoBlurHorizontal),
+			graphStorageImageDescriptor(images.ssaoBlurVertical),
+		};
+		writeDescriptorSets.clear();
+		if (passActive(passes.downsample)) {
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.downsample, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[0]));		// CS Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.downsample, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &imageDescriptors[1]));		// CS Normals
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.downsample, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2, &storageDescriptors[0]));				// CS Low resolution Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.downsample, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3, &storageDescriptors[1]));				// CS Low resolution Normals
+		}
+		if (passActive(passes.ssaoCompute)) {
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.ssaoCompute, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &lowResDescriptors[0]));	// CS Low resolution Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.ssaoCompute, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &lowResDescriptors[1]));	// CS Low resolution Normals
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.ssaoCompute, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 5, &storageDescriptors[2]));			// CS SSAO
+		}
+		VkDescriptorImageInfo historySampledDescriptor = vks::initializers::descriptorImageInfo(colorSampler, history.view, VK_IMAGE_LAYOUT_GENERAL);
+		VkDescriptorImageInfo historyStorageDescriptor = vks::initializers::descriptorImageInfo(VK_NULL_HANDLE, history.view, VK_IMAGE_LAYOUT_GENERAL);
+		if (passActive(passes.temporal)) {
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.temporal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &lowResDescriptors[2]));		// CS SSAO
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.temporal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &lowResDescriptors[0]));		// CS Low resolution Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.temporal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &historySampledDescriptor));	// CS History (previous frame)
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.temporal, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3, &historyStorageDescriptor));				// CS History (current frame)
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.temporal, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4, &storageDescriptors[3]));				// CS Accumulated SSAO
+		}
+		if (passActive(passes.blurHorizontal)) {
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.blurHorizontal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &lowResDescriptors[3]));	// CS SSAO
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.blurHorizontal, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &lowResDescriptors[0]));	// CS Low resolution Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.blurHorizontal, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2, &storageDescriptors[4]));			// CS Blurred SSAO
+		}
+		if (passActive(passes.blurVertical)) {
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.blurVertical, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &lowResDescriptors[4]));	// CS SSAO
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.blurVertical, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &lowResDescriptors[0]));	// CS Low resolution Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.blurVertical, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2, &storageDescriptors[5]));			// CS Blurred SSAO
+		}
+		if (passActive(passes.upsample)) {
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.upsample, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &lowResDescriptors[5]));		// FS Low resolution SSAO
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.upsample, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &lowResDescriptors[0]));		// FS Low resolution Position+Depth
+			writeDescriptorSets.push_back(vks::initializers::writeDescriptorSet(descriptorSets.upsample, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &imageDescriptors[0]));		// FS Position+Depth
+		}
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+	}
+
+	void prepareSampler()
+	{
 		// Shared sampler used for all color attachments
 		VkSamplerCreateInfo sampler = vks::initializers::samplerCreateInfo();
 		sampler.magFilter = VK_FILTER_NEAREST;
@@ -483,6 +690,34 @@ public:
 		VK_CHECK_RESULT(vkCreateSampler(device, &sampler, nullptr, &colorSampler));
 	}
 
+	// Render pass compatibility only depends on the attachment formats and sample counts, so load/store ops and layouts don't need to match the graph's
+	void prepareOcclusionRenderPass()
+	{
+		VkAttachmentDescription attachment{};
+		attachment.format = VK_FORMAT_R8_UNORM;
+		attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+		VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+		VkSubpassDescription subpass{};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorReference;
+
+		VkRenderPassCreateInfo renderPassInfo = vks::initializers::renderPassCreateInfo();
+		renderPassInfo.attachmentCount = 1;
+		renderPassInfo.pAttachments = &attachment;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &occlusionRenderPass));
+	}
+
 	void loadAssets()
 	{
 		vkglTF::descriptorBindingFlags  = vkglTF::DescriptorBindingFlags::ImageBaseColor;
@@ -498,132 +733,14 @@ public:
 		{
 			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
 
-			/*
-				Offscreen SSAO generation
-			*/
-			{
-				// Clear values for all attachments written in the fragment shader
-				std::vector<VkClearValue> clearValues(4);
-				clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
-				clearValues[1].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
-				clearValues[2].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
-				clearValues[3].depthStencil = { 1.0f, 0 };
-
-				VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-				renderPassBeginInfo.renderPass = frameBuffers.offscreen.renderPass;
-				renderPassBeginInfo.framebuffer = frameBuffers.offscreen.frameBuffer;
-				renderPassBeginInfo.renderArea.extent.width = frameBuffers.offscreen.width;
-				renderPassBeginInfo.renderArea.extent.height = frameBuffers.offscreen.height;
-				renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-				renderPassBeginInfo.pClearValues = clearValues.data();
-
-				/*
-					First pass: Fill G-Buffer components (positions+depth, normals, albedo) using MRT
-				*/
-
-				vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-				VkViewport viewport = vks::initializers::viewport((float)frameBuffers.offscreen.width, (float)frameBuffers.offscreen.height, 0.0f, 1.0f);
-				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
-				VkRect2D scissor = vks::initializers::rect2D(frameBuffers.offscreen.width, frameBuffers.offscreen.height, 0, 0);
-				vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.offscreen);
-
-				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.gBuffer, 0, 1, &descriptorSets.floor, 0, NULL);
-				scene.draw(drawCmdBuffers[i], vkglTF::RenderFlags::BindImages, pipelineLayouts.gBuffer);
-
-				vkCmdEndRenderPass(drawCmdBuffers[i]);
-
-				/*
-					Second pass: SSAO generation
-				*/
-
-				clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
-				clearValues[1].depthStencil = { 1.0f, 0 };
-
-				renderPassBeginInfo.framebuffer = frameBuffers.ssao.frameBuffer;
-				renderPassBeginInfo.renderPass = frameBuffers.ssao.renderPass;
-				renderPassBeginInfo.renderArea.extent.width = frameBuffers.ssao.width;
-				renderPassBeginInfo.renderArea.extent.height = frameBuffers.ssao.height;
-				renderPassBeginInfo.clearValueCount = 2;
-				renderPassBeginInfo.pClearValues = clearValues.data();
-
-				vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-				viewport = vks::initializers::viewport((float)frameBuffers.ssao.width, (float)frameBuffers.ssao.height, 0.0f, 1.0f);
-				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-				scissor = vks::initializers::rect2D(frameBuffers.ssao.width, frameBuffers.ssao.height, 0, 0);
-				vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.ssao, 0, 1, &descriptorSets.ssao, 0, NULL);
-				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.ssao);
-				vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
-
-				vkCmdEndRenderPass(drawCmdBuffers[i]);
-
-				/*
-					Third pass: SSAO blur
-				*/
-
-				renderPassBeginInfo.framebuffer = frameBuffers.ssaoBlur.frameBuffer;
-				renderPassBeginInfo.renderPass = frameBuffers.ssaoBlur.renderPass;
-				renderPassBeginInfo.renderArea.extent.width = frameBuffers.ssaoBlur.width;
-				renderPassBeginInfo.renderArea.extent.height = frameBuffers.ssaoBlur.height;
-
-				vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-				viewport = vks::initializers::viewport((float)frameBuffers.ssaoBlur.width, (float)frameBuffers.ssaoBlur.height, 0.0f, 1.0f);
-				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-				scissor = vks::initializers::rect2D(frameBuffers.ssaoBlur.width, frameBuffers.ssaoBlur.height, 0, 0);
-				vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.ssaoBlur, 0, 1, &descriptorSets.ssaoBlur, 0, NULL);
-				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.ssaoBlur);
-				vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
-
-				vkCmdEndRenderPass(drawCmdBuffers[i]);
+			if (timing.available) {
+				vkCmdResetQueryPool(drawCmdBuffers[i], timing.queryPool, 0, TimedPassCount + 1);
+				vkCmdWriteTimestamp(drawCmdBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timing.queryPool, 0);
 			}
 
-			/*
-				Note: Explicit synchronization is not required between the render pass, as this is done implicit via sub pass dependencies
-			*/
-
-			/*
-				Final render pass: Scene rendering with applied radial blur
-			*/
-			{
-				std::vector<VkClearValue> clearValues(2);
-				clearValues[0].color = defaultClearColor;
-				clearValues[1].depthStencil = { 1.0f, 0 };
-
-				VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
-				renderPassBeginInfo.renderPass = renderPass;
-				renderPassBeginInfo.framebuffer = VulkanExampleBase::frameBuffers[i];
-				renderPassBeginInfo.renderArea.extent.width = width;
-				renderPassBeginInfo.renderArea.extent.height = height;
-				renderPassBeginInfo.clearValueCount = 2;
-				renderPassBeginInfo.pClearValues = clearValues.data();
-
-				vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-				VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-				vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
-				VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-				vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.composition, 0, 1, &descriptorSets.composition, 0, NULL);
-
-				// Final composition pass
-				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.composition);
-				vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
-
-				drawUI(drawCmdBuffers[i]);
-
-				vkCmdEndRenderPass(drawCmdBuffers[i]);
-			}
+			// Records all passes that weren't culled, including the barriers between them
+			compositionFramebuffer = VulkanExampleBase::frameBuffers[i];
+			renderGraph.execute(drawCmdBuffers[i]);
 
 			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
 		}
@@ -633,7 +750,8 @@ public:
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes = {
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 12)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 28),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 7)
 		};
 		VkDescriptorPoolCreateInfo descriptorPoolInfo = vks::initializers::descriptorPoolCreateInfo(poolSizes,  descriptorSets.count);
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
@@ -646,7 +764,6 @@ public:
 		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo();
 		VkDescriptorSetAllocateInfo descriptorAllocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, nullptr, 1);
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets;
-		std::vector<VkDescriptorImageInfo> imageDescriptors;
 
 		// G-Buffer creation (offscreen scene rendering)
 		setLayoutBindings = {
@@ -681,13 +798,7 @@ public:
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.ssao));
 		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.ssao;
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.ssao));
-		imageDescriptors = {
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.offscreen.position.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.offscreen.normal.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-		};
 		writeDescriptorSets = {
-			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[0]),					// FS Position+Depth
-			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &imageDescriptors[1]),					// FS Normals
 			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.ssaoNoise.descriptor),		// FS SSAO Noise
 			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &uniformBuffers.ssaoKernel.descriptor),		// FS SSAO Kernel UBO
 			vks::initializers::writeDescriptorSet(descriptorSets.ssao, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &uniformBuffers.ssaoParams.descriptor),		// FS SSAO Params UBO
@@ -704,13 +815,6 @@ public:
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.ssaoBlur));
 		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.ssaoBlur;
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.ssaoBlur));
-		imageDescriptors = {
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.ssao.color.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-		};
-		writeDescriptorSets = {
-			vks::initializers::writeDescriptorSet(descriptorSets.ssaoBlur, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[0]),
-		};
-		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 
 		// Composition
 		setLayoutBindings = {
@@ -727,24 +831,104 @@ public:
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.composition));
 		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.composition;
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.composition));
-		imageDescriptors = {
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.offscreen.position.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.offscreen.normal.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.offscreen.albedo.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.ssao.color.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-			vks::initializers::descriptorImageInfo(colorSampler, frameBuffers.ssaoBlur.color.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL),
-		};
 		writeDescriptorSets = {
-			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &imageDescriptors[0]),			// FS Sampler Position+Depth
-			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &imageDescriptors[1]),			// FS Sampler Normals
-			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &imageDescriptors[2]),			// FS Sampler Albedo
-			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &imageDescriptors[3]),			// FS Sampler SSAO
-			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, &imageDescriptors[4]),			// FS Sampler SSAO blurred
 			vks::initializers::writeDescriptorSet(descriptorSets.composition, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &uniformBuffers.ssaoParams.descriptor),	// FS SSAO Params UBO
 		};
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+
+		// Reduced resolution: Downsample
+		setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),						// CS Position+Depth
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1),						// CS Normals
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 2),								// CS Low resolution Position+Depth
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 3),								// CS Low resolution Normals
+		};
+		setLayoutCreateInfo = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr, &descriptorSetLayouts.downsample));
+		pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayouts.downsample;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.downsample));
+		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.downsample;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.downsample));
+
+		// Reduced resolution: SSAO generation
+		setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),						// CS Low resolution Position+Depth
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1),						// CS Low resolution Normals
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 2),						// CS SSAO Noise
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),								// CS SSAO Kernel UBO
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4),								// CS Params UBO
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 5),								// CS SSAO
+		};
+		setLayoutCreateInfo = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr, &descriptorSetLayouts.ssaoCompute));
+		pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayouts.ssaoCompute;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.ssaoCompute));
+		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.ssaoCompute;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.ssaoCompute));
+		writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(descriptorSets.ssaoCompute, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.ssaoNoise.descriptor),	// CS SSAO Noise
+			vks::initializers::writeDescriptorSet(descriptorSets.ssaoCompute, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &uniformBuffers.ssaoKernel.descriptor),	// CS SSAO Kernel UBO
+			vks::initializers::writeDescriptorSet(descriptorSets.ssaoCompute, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &uniformBuffers.ssaoParams.descriptor),	// CS SSAO Params UBO
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+
+		// Reduced resolution: Temporal accumulation
+		setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),						// CS SSAO
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1),						// CS Low resolution Position+Depth
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 2),						// CS History (previous frame)
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 3),								// CS History (current frame)
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 4),								// CS Accumulated SSAO
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 5),								// CS Params UBO
+		};
+		setLayoutCreateInfo = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr, &descriptorSetLayouts.temporal));
+		pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayouts.temporal;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.temporal));
+		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.temporal;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.temporal));
+		writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(descriptorSets.temporal, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &uniformBuffers.ssaoParams.descriptor),		// CS SSAO Params UBO
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+
+		// Reduced resolution: Bilateral blur, the direction is passed as a push constant
+		setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),						// CS SSAO
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1),						// CS Low resolution Position+Depth
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 2),								// CS Blurred SSAO
+		};
+		setLayoutCreateInfo = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr, &descriptorSetLayouts.bilateralBlur));
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(glm::ivec2), 0);
+		pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayouts.bilateralBlur;
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.bilateralBlur));
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+		pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.bilateralBlur;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.blurHorizontal));
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.blurVertical));
+
+		// Reduced resolution: Depth-aware upsample
+		setLayoutBindings = {
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0),						// FS Low resolution SSAO
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),						// FS Low resolution Position+Depth
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),						// FS Position+Depth
+		};
+		setLayoutCreateInfo = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &setLayoutCreateInfo, nullptr, &descriptorSetLayouts.upsample));
+		pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayouts.upsample;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.upsample));
+		descriptorAllocInfo.pSetLayouts = &descriptorSetLayouts.upsample;
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &descriptorAllocInfo, &descriptorSets.upsample));
+
+		// Images owned by the render graph
+		updateImageDescriptors();
 	}
 
+	// Render passes are requested from the graph's passes, so all passes need to be active when this is called (default settings)
 	void preparePipelines()
 	{
 		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
@@ -781,7 +965,7 @@ public:
 
 		// SSAO generation pipeline
 		{
-			pipelineCreateInfo.renderPass = frameBuffers.ssao.renderPass;
+			pipelineCreateInfo.renderPass = occlusionRenderPass;
 			pipelineCreateInfo.layout = pipelineLayouts.ssao;
 			// SSAO Kernel size and radius are constant for this pipeline, so we set them using specialization constants
 			struct SpecializationData {
@@ -800,17 +984,25 @@ public:
 
 		// SSAO blur pipeline
 		{
-			pipelineCreateInfo.renderPass = frameBuffers.ssaoBlur.renderPass;
+			pipelineCreateInfo.renderPass = occlusionRenderPass;
 			pipelineCreateInfo.layout = pipelineLayouts.ssaoBlur;
 			shaderStages[1] = loadShader(getShadersPath() + "ssao/blur.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.ssaoBlur));
 		}
 
+		// Depth-aware upsample pipeline
+		{
+			pipelineCreateInfo.renderPass = occlusionRenderPass;
+			pipelineCreateInfo.layout = pipelineLayouts.upsample;
+			shaderStages[1] = loadShader(getShadersPath() + "ssao/upsample.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.upsample));
+		}
+
 		// Fill G-Buffer pipeline
 		{
 			// Vertex input state from glTF model loader
 			pipelineCreateInfo.pVertexInputState = vkglTF::Vertex::getPipelineVertexInputState({ vkglTF::VertexComponent::Position, vkglTF::VertexComponent::UV, vkglTF::VertexComponent::Color, vkglTF::VertexComponent::Normal });
-			pipelineCreateInfo.renderPass = frameBuffers.offscreen.renderPass;
+			pipelineCreateInfo.renderPass = passes.gBuffer->getRenderPass();
 			pipelineCreateInfo.layout = pipelineLayouts.gBuffer;
 			// Blend attachment states required for all color attachments
 			// This is important, as color write mask will otherwise be 0x0 and you
@@ -827,6 +1019,32 @@ public:
 			shaderStages[1] = loadShader(getShadersPath() + "ssao/gbuffer.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipelines.offscreen));
 		}
+
+		// Compute pipelines of the reduced resolution passes
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(pipelineLayouts.downsample, 0);
+		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "ssao/downsample.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipelines.downsample));
+		{
+			struct SpecializationData {
+				uint32_t kernelSize = SSAO_KERNEL_SIZE;
+				float radius = SSAO_RADIUS;
+			} specializationData;
+			std::array<VkSpecializationMapEntry, 2> specializationMapEntries = {
+				vks::initializers::specializationMapEntry(0, offsetof(SpecializationData, kernelSize), sizeof(SpecializationData::kernelSize)),
+				vks::initializers::specializationMapEntry(1, offsetof(SpecializationData, radius), sizeof(SpecializationData::radius))
+			};
+			VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(2, specializationMapEntries.data(), sizeof(specializationData), &specializationData);
+			computePipelineCreateInfo.layout = pipelineLayouts.ssaoCompute;
+			computePipelineCreateInfo.stage = loadShader(getShadersPath() + "ssao/ssao.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+			computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+			VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipelines.ssaoCompute));
+		}
+		computePipelineCreateInfo.layout = pipelineLayouts.temporal;
+		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "ssao/temporal.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipelines.temporal));
+		computePipelineCreateInfo.layout = pipelineLayouts.bilateralBlur;
+		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "ssao/blur.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipelines.bilateralBlur));
 	}
 
 	float lerp(float a, float b, float f)
@@ -903,12 +1121,45 @@ public:
 	void updateUniformBufferSSAOParams()
 	{
 		uboSSAOParams.projection = camera.matrices.perspective;
+		if (ssaoQuality == QualityFull) {
+			uboSSAOParams.sampleCount = SSAO_KERNEL_SIZE;
+		} else {
+			uboSSAOParams.sampleCount = temporalAccumulation ? SSAO_TEMPORAL_SAMPLES : SSAO_PERFORMANCE_SAMPLES;
+		}
+		uboSSAOParams.temporalBlend = SSAO_TEMPORAL_BLEND;
 
 		VK_CHECK_RESULT(uniformBuffers.ssaoParams.map());
 		uniformBuffers.ssaoParams.copyTo(&uboSSAOParams, sizeof(uboSSAOParams));
 		uniformBuffers.ssaoParams.unmap();
 	}
 
+	// Advances the interleaved sampling pattern and passes the transformation from the current view to the previous frame's clip space
+	void updateTemporalParams()
+	{
+		uboSSAOParams.reprojection = camera.matrices.perspective * history.previousView * glm::inverse(uboSceneParams.view);
+		history.previousView = uboSceneParams.view;
+		uboSSAOParams.frameIndex++;
+		updateUniformBufferSSAOParams();
+	}
+
+	// The queue is idle after submitting the frame, so the timestamps of this frame are available, passes that weren't recorded have no timestamp
+	void getTimings()
+	{
+		std::array<uint64_t, (TimedPassCount + 1) * 2> results;
+		const VkResult result = vkGetQueryPoolResults(device, timing.queryPool, 0, TimedPassCount + 1, sizeof(results), results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		if ((result != VK_SUCCESS) && (result != VK_NOT_READY)) {
+			return;
+		}
+		uint64_t previous = results[0];
+		for (uint32_t i = 0; i < TimedPassCount; i++) {
+			timing.passTimes[i] = -1.0;
+			if (results[(i + 1) * 2 + 1] != 0) {
+				timing.passTimes[i] = (double)(results[(i + 1) * 2] - previous) * timing.timestampPeriod / 1000000.0;
+				previous = results[(i + 1) * 2];
+			}
+		}
+	}
+
 	void draw()
 	{
 		VulkanExampleBase::prepareFrame();
@@ -916,13 +1167,29 @@ public:
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
 		VulkanExampleBase::submitFrame();
+		if (timing.available) {
+			getTimings();
+		}
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
 		loadAssets();
-		prepareOffscreenFramebuffers();
+		timing.passTimes.fill(-1.0);
+		if (vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.graphics].timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = TimedPassCount + 1;
+			VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timing.queryPool));
+			timing.timestampPeriod = vulkanDevice->properties.limits.timestampPeriod;
+			timing.available = true;
+		}
+		renderGraph.create(vulkanDevice);
+		buildRenderGraph();
+		prepareSampler();
+		prepareOcclusionRenderPass();
 		prepareUniformBuffers();
 		setupDescriptorPool();
 		setupLayoutsAndDescriptors();
@@ -936,6 +1203,9 @@ public:
 		if (!prepared) {
 			return;
 		}
+		if (passActive(passes.temporal)) {
+			updateTemporalParams();
+		}
 		draw();
 		if (camera.updated) {
 			updateUniformBufferMatrices();
@@ -949,19 +1219,70 @@ public:
 		updateUniformBufferSSAOParams();
 	}
 
+	virtual void windowResized()
+	{
+		// Render passes are cached by the graph, so the pipelines stay valid
+		renderGraph.setExtent(width, height);
+		renderGraph.compile();
+		prepareHistory();
+		updateImageDescriptors();
+		buildCommandBuffers();
+	}
+
+	// Settings change which passes are required, rebuild the graph so unused passes are culled and their images freed
+	void rebuildRenderGraph()
+	{
+		vkDeviceWaitIdle(device);
+		buildRenderGraph();
+		updateImageDescriptors();
+	}
+
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
 		if (overlay->header("Settings")) {
 			if (overlay->checkBox("Enable SSAO", &uboSSAOParams.ssao)) {
 				updateUniformBufferSSAOParams();
+				rebuildRenderGraph();
 			}
 			if (overlay->checkBox("SSAO blur", &uboSSAOParams.ssaoBlur)) {
 				updateUniformBufferSSAOParams();
+				rebuildRenderGraph();
 			}
 			if (overlay->checkBox("SSAO pass only", &uboSSAOParams.ssaoOnly)) {
 				updateUniformBufferSSAOParams();
+				rebuildRenderGraph();
+			}
+			if (overlay->comboBox("Quality", &ssaoQuality, { "Full resolution", "Half resolution", "Quarter resolution" })) {
+				updateUniformBufferSSAOParams();
+				rebuildRenderGraph();
+			}
+			if (ssaoQuality != QualityFull) {
+				if (overlay->checkBox("Temporal accumulation", &temporalAccumulation)) {
+					updateUniformBufferSSAOParams();
+					rebuildRenderGraph();
+				}
+				overlay->text("Samples per pixel: %d", uboSSAOParams.sampleCount);
 			}
 		}
+		if (timing.available && overlay->header("GPU timings")) {
+			const char* passNames[TimedPassCount] = { "G-Buffer", "Downsample", "SSAO", "Temporal", "Blur horizontal", "Blur vertical", "Blur", "Upsample", "Composition" };
+			double total = 0.0;
+			for (uint32_t i = 0; i < TimedPassCount; i++) {
+				if (timing.passTimes[i] >= 0.0) {
+					overlay->text("%s: %.3f ms", passNames[i], timing.passTimes[i]);
+					total += timing.passTimes[i];
+				}
+			}
+			overlay->text("Total: %.3f ms", total);
+		}
+		if (overlay->header("Render graph")) {
+			const vks::RenderGraph::Statistics statistics = renderGraph.getStatistics();
+			overlay->text("Passes: %d (%d culled)", statistics.passes, statistics.culledPasses);
+			overlay->text("Render passes: %d", statistics.renderPasses);
+			overlay->text("Image barriers: %d (%d batches)", statistics.imageBarriers, statistics.barrierBatches);
+			overlay->text("Images: %d (%d lazily allocated)", statistics.images, statistics.lazyImages);
+			overlay->text("Memory: %.2f MB (unaliased %.2f MB)", statistics.memory / (1024.0f * 1024.0f), statistics.unaliasedMemory / (1024.0f * 1024.0f));
+		}
 	}
 };
 
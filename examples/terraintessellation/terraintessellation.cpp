@@ -9,17 +9,30 @@
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
 #include "frustum.hpp"
+#include "VulkanTerrain.h"
 #include <ktx.h>
 #include <ktxvulkan.h>
 
 #define ENABLE_VALIDATION false
 
+// Samples per side of the streaming terrain, a 16384 x 16384 terrain (~740 MB tile file) only changes the size of the file, not the memory used for rendering
+#define TERRAIN_DIM 4096
+#define TERRAIN_TILE_SIZE 64
+
 class VulkanExample : public VulkanExampleBase
 {
 public:
 	bool wireframe = false;
 	bool tessellation = true;
 
+	enum TerrainMode { Tessellated = 0, Quadtree = 1 };
+	int32_t terrainMode = Tessellated;
+
+	// Streaming quadtree terrain with heights from a memory mapped tile file
+	vks::TerrainTileFile tileFile;
+	vks::QuadtreeTerrain quadtreeTerrain;
+	bool quadtreeAvailable = false;
+
 	// Holds the buffers for rendering the tessellated terrain
 	struct {
 		struct Vertices {
@@ -45,6 +58,7 @@ public:
 
 	struct {
 		vks::Buffer terrainTessellation;
+		vks::Buffer terrainQuadtree;
 		vks::Buffer skysphereVertex;
 	} uniformBuffers;
 
@@ -61,6 +75,16 @@ public:
 		float tessellatedEdgeSize = 20.0f;
 	} uboTess;
 
+	// Streaming quadtree terrain vertex shader
+	struct {
+		glm::mat4 projection;
+		glm::mat4 modelview;
+		glm::vec4 lightPos;
+		glm::vec4 cameraPos;
+		float heightScale;
+		float tileSize;
+	} uboQuadtree;
+
 	// Skysphere vertex shader stage
 	struct {
 		glm::mat4 mvp;
@@ -69,21 +93,26 @@ public:
 	struct Pipelines {
 		VkPipeline terrain;
 		VkPipeline wireframe = VK_NULL_HANDLE;
+		VkPipeline quadtree = VK_NULL_HANDLE;
+		VkPipeline quadtreeWireframe = VK_NULL_HANDLE;
 		VkPipeline skysphere;
 	} pipelines;
 
 	struct {
 		VkDescriptorSetLayout terrain;
+		VkDescriptorSetLayout quadtree = VK_NULL_HANDLE;
 		VkDescriptorSetLayout skysphere;
 	} descriptorSetLayouts;
 
 	struct {
 		VkPipelineLayout terrain;
+		VkPipelineLayout quadtree = VK_NULL_HANDLE;
 		VkPipelineLayout skysphere;
 	} pipelineLayouts;
 
 	struct {
 		VkDescriptorSet terrain;
+		VkDescriptorSet quadtree;
 		VkDescriptorSet skysphere;
 	} descriptorSets;
 
@@ -118,6 +147,17 @@ public:
 		}
 		vkDestroyPipeline(device, pipelines.skysphere, nullptr);
 
+		if (quadtreeAvailable) {
+			vkDestroyPipeline(device, pipelines.quadtree, nullptr);
+			if (pipelines.quadtreeWireframe != VK_NULL_HANDLE) {
+				vkDestroyPipeline(device, pipelines.quadtreeWireframe, nullptr);
+			}
+			vkDestroyPipelineLayout(device, pipelineLayouts.quadtree, nullptr);
+			vkDestroyDescriptorSetLayout(device, descriptorSetLayouts.quadtree, nullptr);
+			uniformBuffers.terrainQuadtree.destroy();
+			quadtreeTerrain.destroy();
+		}
+
 		vkDestroyPipelineLayout(device, pipelineLayouts.skysphere, nullptr);
 		vkDestroyPipelineLayout(device, pipelineLayouts.terrain, nullptr);
 
@@ -326,11 +366,18 @@ public:
 				vkCmdBeginQuery(drawCmdBuffers[i], queryPool, 0, 0);
 			}
 			// Render
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, wireframe ? pipelines.wireframe : pipelines.terrain);
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.terrain, 0, 1, &descriptorSets.terrain, 0, nullptr);
-			vkCmdBindVertexBuffers(drawCmdBuffers[i], 0, 1, &terrain.vertices.buffer, offsets);
-			vkCmdBindIndexBuffer(drawCmdBuffers[i], terrain.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-			vkCmdDrawIndexed(drawCmdBuffers[i], terrain.indices.count, 1, 0, 0, 0);
+			if (terrainMode == Quadtree) {
+				// The selected nodes and their count are updated every frame by the host, so this doesn't need to be re-recorded
+				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, wireframe ? pipelines.quadtreeWireframe : pipelines.quadtree);
+				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.quadtree, 0, 1, &descriptorSets.quadtree, 0, nullptr);
+				quadtreeTerrain.draw(drawCmdBuffers[i]);
+			} else {
+				vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, wireframe ? pipelines.wireframe : pipelines.terrain);
+				vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayouts.terrain, 0, 1, &descriptorSets.terrain, 0, nullptr);
+				vkCmdBindVertexBuffers(drawCmdBuffers[i], 0, 1, &terrain.vertices.buffer, offsets);
+				vkCmdBindIndexBuffer(drawCmdBuffers[i], terrain.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+				vkCmdDrawIndexed(drawCmdBuffers[i], terrain.indices.count, 1, 0, 0, 0);
+			}
 			if (deviceFeatures.pipelineStatisticsQuery) {
 				// End pipeline statistics query
 				vkCmdEndQuery(drawCmdBuffers[i], queryPool, 0);
@@ -547,19 +594,41 @@ public:
 		delete[] indices;
 	}
 
+	// Tiled heights for the streaming quadtree terrain are generated from the heightmap on the first run and mapped on subsequent runs
+	void prepareQuadtreeTerrain()
+	{
+#if defined(__ANDROID__)
+		const std::string tileFilename = std::string(androidApp->activity->internalDataPath) + "/terrain_" + std::to_string(TERRAIN_DIM) + ".tiles";
+#else
+		const std::string tileFilename = "terrain_" + std::to_string(TERRAIN_DIM) + ".tiles";
+#endif
+		if (!tileFile.open(tileFilename, TERRAIN_DIM, TERRAIN_TILE_SIZE)) {
+			std::cout << "Generating terrain tile file " << tileFilename << "\n";
+			// The heightmap repeats every 512 samples (128 units at the default sample spacing), same as the tessellated patch
+			if (!vks::TerrainTileFile::create(tileFilename, getAssetPath() + "textures/terrain_heightmap_r16.ktx", TERRAIN_DIM, TERRAIN_TILE_SIZE, 512.0f) || !tileFile.open(tileFilename, TERRAIN_DIM, TERRAIN_TILE_SIZE)) {
+				std::cerr << "Could not create terrain tile file " << tileFilename << ", streaming terrain is not available\n";
+				return;
+			}
+		}
+		quadtreeTerrain.heightScale = uboTess.displacementFactor;
+		quadtreeTerrain.create(vulkanDevice, queue, &tileFile);
+		quadtreeAvailable = true;
+	}
+
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
 			vks::initializers::descriptorPoolCreateInfo(
 				static_cast<uint32_t>(poolSizes.size()),
 				poolSizes.data(),
-				2);
+				3);
 
 		VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &descriptorPool));
 	}
@@ -595,6 +664,25 @@ public:
 		pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.terrain, 1);
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.terrain));
 
+		// Streaming quadtree terrain
+		if (quadtreeAvailable) {
+			setLayoutBindings =
+			{
+				// Binding 0 : Vertex shader ubo
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+				// Binding 1 : Tile cache
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_VERTEX_BIT, 1),
+				// Binding 2 : Terrain texture array layers
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+				// Binding 3 : Selected node instances
+				vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 3),
+			};
+			descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+			VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &descriptorSetLayouts.quadtree));
+			pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&descriptorSetLayouts.quadtree, 1);
+			VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayouts.quadtree));
+		}
+
 		// Skysphere
 		setLayoutBindings =
 		{
@@ -648,6 +736,24 @@ public:
 		};
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
 
+		// Streaming quadtree terrain
+		if (quadtreeAvailable) {
+			allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayouts.quadtree, 1);
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.quadtree));
+			writeDescriptorSets =
+			{
+				// Binding 0 : Vertex shader ubo
+				vks::initializers::writeDescriptorSet(descriptorSets.quadtree, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &uniformBuffers.terrainQuadtree.descriptor),
+				// Binding 1 : Tile cache
+				vks::initializers::writeDescriptorSet(descriptorSets.quadtree, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &quadtreeTerrain.tileCacheDescriptor),
+				// Binding 2 : Terrain texture array layers
+				vks::initializers::writeDescriptorSet(descriptorSets.quadtree, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &textures.terrainArray.descriptor),
+				// Binding 3 : Selected node instances
+				vks::initializers::writeDescriptorSet(descriptorSets.quadtree, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &quadtreeTerrain.instanceBuffer.descriptor),
+			};
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+		}
+
 		// Skysphere
 		allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayouts.skysphere, 1);
 		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets.skysphere));
@@ -711,6 +817,35 @@ public:
 			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCI, nullptr, &pipelines.wireframe));
 		};
 
+		// Streaming quadtree terrain pipelines, renders indexed triangle lists of a node quadrant's grid instanced for all selected nodes
+		if (quadtreeAvailable) {
+			VkVertexInputBindingDescription vertexInputBinding = vks::QuadtreeTerrain::getVertexInputBinding();
+			VkVertexInputAttributeDescription vertexInputAttribute = vks::QuadtreeTerrain::getVertexInputAttribute();
+			VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+			vertexInputState.vertexBindingDescriptionCount = 1;
+			vertexInputState.pVertexBindingDescriptions = &vertexInputBinding;
+			vertexInputState.vertexAttributeDescriptionCount = 1;
+			vertexInputState.pVertexAttributeDescriptions = &vertexInputAttribute;
+			VkPipelineInputAssemblyStateCreateInfo quadtreeInputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+			std::array<VkPipelineShaderStageCreateInfo, 2> quadtreeShaderStages;
+			quadtreeShaderStages[0] = loadShader(getShadersPath() + "terraintessellation/terrain_cdlod.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+			quadtreeShaderStages[1] = loadShader(getShadersPath() + "terraintessellation/terrain_cdlod.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+
+			VkGraphicsPipelineCreateInfo quadtreePipelineCI = pipelineCI;
+			quadtreePipelineCI.layout = pipelineLayouts.quadtree;
+			quadtreePipelineCI.pVertexInputState = &vertexInputState;
+			quadtreePipelineCI.pInputAssemblyState = &quadtreeInputAssemblyState;
+			quadtreePipelineCI.pTessellationState = nullptr;
+			quadtreePipelineCI.stageCount = static_cast<uint32_t>(quadtreeShaderStages.size());
+			quadtreePipelineCI.pStages = quadtreeShaderStages.data();
+			rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &quadtreePipelineCI, nullptr, &pipelines.quadtree));
+			if (deviceFeatures.fillModeNonSolid) {
+				rasterizationState.polygonMode = VK_POLYGON_MODE_LINE;
+				VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &quadtreePipelineCI, nullptr, &pipelines.quadtreeWireframe));
+			}
+		}
+
 		// Skysphere pipeline
 		rasterizationState.cullMode = VK_CULL_MODE_FRONT_BIT;
 		rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
@@ -744,6 +879,16 @@ public:
 			&uniformBuffers.skysphereVertex,
 			sizeof(uboVS)));
 
+		// Streaming quadtree terrain vertex shader uniform buffer
+		if (quadtreeAvailable) {
+			VK_CHECK_RESULT(vulkanDevice->createBuffer(
+				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				&uniformBuffers.terrainQuadtree,
+				sizeof(uboQuadtree)));
+			VK_CHECK_RESULT(uniformBuffers.terrainQuadtree.map());
+		}
+
 		// Map persistent
 		VK_CHECK_RESULT(uniformBuffers.terrainTessellation.map());
 		VK_CHECK_RESULT(uniformBuffers.skysphereVertex.map());
@@ -777,6 +922,17 @@ public:
 			uboTess.tessellationFactor = savedFactor;
 		}
 
+		// Streaming quadtree terrain
+		if (quadtreeAvailable) {
+			uboQuadtree.projection = uboTess.projection;
+			uboQuadtree.modelview = uboTess.modelview;
+			uboQuadtree.lightPos = uboTess.lightPos;
+			uboQuadtree.cameraPos = glm::inverse(camera.matrices.view)[3];
+			uboQuadtree.heightScale = quadtreeTerrain.heightScale;
+			uboQuadtree.tileSize = (float)quadtreeTerrain.getTileSize();
+			memcpy(uniformBuffers.terrainQuadtree.mapped, &uboQuadtree, sizeof(uboQuadtree));
+		}
+
 		// Skysphere vertex shader
 		uboVS.mvp = camera.matrices.perspective * glm::mat4(glm::mat3(camera.matrices.view));
 		memcpy(uniformBuffers.skysphereVertex.mapped, &uboVS, sizeof(uboVS));
@@ -786,6 +942,11 @@ public:
 	{
 		VulkanExampleBase::prepareFrame();
 
+		// Node selection and tile streaming need to progress every frame, even if the camera doesn't move
+		if (terrainMode == Quadtree) {
+			quadtreeTerrain.update(glm::vec3(uboQuadtree.cameraPos), frustum);
+		}
+
 		// Command buffer to be submitted to the queue
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
@@ -806,6 +967,7 @@ public:
 		VulkanExampleBase::prepare();
 		loadAssets();
 		generateTerrain();
+		prepareQuadtreeTerrain();
 		if (deviceFeatures.pipelineStatisticsQuery) {
 			setupQueryResultBuffer();
 		}
@@ -836,7 +998,14 @@ public:
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
 		if (overlay->header("Settings")) {
-
+			if (quadtreeAvailable) {
+				if (overlay->comboBox("Terrain", &terrainMode, { "Tessellated patch", "Streaming quadtree" })) {
+					buildCommandBuffers();
+				}
+			}
+			if (terrainMode == Quadtree) {
+				overlay->sliderFloat("LOD distance", &quadtreeTerrain.lodDistance, 8.0f, 64.0f);
+			}
 			if (overlay->checkBox("Tessellation", &tessellation)) {
 				updateUniformBuffers();
 			}
@@ -855,6 +1024,18 @@ public:
 				overlay->text("TE invocations: %d", pipelineStats[1]);
 			}
 		}
+		if (terrainMode == Quadtree) {
+			if (overlay->header("Terrain streaming")) {
+				vks::QuadtreeTerrain::Statistics stats = quadtreeTerrain.getStatistics();
+				overlay->text("Levels: %d (%d x %d samples)", stats.levels, tileFile.getDim(), tileFile.getDim());
+				overlay->text("Nodes: %d selected, %d culled", stats.selectedNodes, stats.culledNodes);
+				overlay->text("Instances: %d (%d fallback)", stats.instances, stats.fallbackInstances);
+				overlay->text("Tiles: %d resident, %d pending", stats.residentTiles, stats.pendingTiles);
+				overlay->text("Uploads: %d (%llu total)", stats.uploadsLastFrame, (unsigned long long)stats.streamedTiles);
+				overlay->text("Tile cache: %.2f MB", (float)stats.cacheMemory / (1024.0f * 1024.0f));
+				overlay->text("Tile file: %.2f MB", (float)tileFile.getFileSize() / (1024.0f * 1024.0f));
+			}
+		}
 	}
 };
 
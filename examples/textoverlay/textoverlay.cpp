@@ -10,15 +10,17 @@
 #include <iomanip>
 #include "vulkanexamplebase.h"
 #include "VulkanglTFModel.h"
+#include "VulkanGlyphBatch.h"
 #include "../external/stb/stb_font_consolas_24_latin1.inl"
 
 #define ENABLE_VALIDATION false
 
-// Max. number of chars the text overlay buffer can hold
-#define TEXTOVERLAY_MAX_CHAR_COUNT 2048
+// Max. number of chars the text overlay can display per frame
+#define TEXTOVERLAY_MAX_CHAR_COUNT 65536
 
 /*
 	Mostly self-contained text overlay class
+	Glyphs are drawn as instances of a single indirect draw, so the text can be updated every frame without recording the command buffers again
 */
 class TextOverlay
 {
@@ -36,8 +38,6 @@ private:
 	VkSampler sampler;
 	VkImage image;
 	VkImageView view;
-	VkBuffer buffer;
-	VkDeviceMemory memory;
 	VkDeviceMemory imageMemory;
 	VkDescriptorPool descriptorPool;
 	VkDescriptorSetLayout descriptorSetLayout;
@@ -50,17 +50,16 @@ private:
 	std::vector<VkFramebuffer*> frameBuffers;
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 
-	// Pointer to mapped vertex buffer
-	glm::vec4 *mapped = nullptr;
-
 	stb_fontchar stbFontData[STB_FONT_consolas_24_latin1_NUM_CHARS];
-	uint32_t numLetters;
 public:
 
 	enum TextAlign { alignLeft, alignCenter, alignRight };
 
 	bool visible = true;
 
+	// Persistently mapped glyph instances with one region per command buffer
+	vks::GlyphBatch glyphBatch;
+
 	std::vector<VkCommandBuffer> cmdBuffers;
 
 	TextOverlay(
@@ -95,6 +94,7 @@ public:
 		prepareResources();
 		prepareRenderPass();
 		preparePipeline();
+		updateCommandBuffers();
 	}
 
 	~TextOverlay()
@@ -103,8 +103,7 @@ public:
 		vkDestroySampler(vulkanDevice->logicalDevice, sampler, nullptr);
 		vkDestroyImage(vulkanDevice->logicalDevice, image, nullptr);
 		vkDestroyImageView(vulkanDevice->logicalDevice, view, nullptr);
-		vkDestroyBuffer(vulkanDevice->logicalDevice, buffer, nullptr);
-		vkFreeMemory(vulkanDevice->logicalDevice, memory, nullptr);
+		glyphBatch.destroy();
 		vkFreeMemory(vulkanDevice->logicalDevice, imageMemory, nullptr);
 		vkDestroyDescriptorSetLayout(vulkanDevice->logicalDevice, descriptorSetLayout, nullptr);
 		vkDestroyDescriptorPool(vulkanDevice->logicalDevice, descriptorPool, nullptr);
@@ -142,22 +141,21 @@ public:
 
 		VK_CHECK_RESULT(vkAllocateCommandBuffers(vulkanDevice->logicalDevice, &cmdBufAllocateInfo, cmdBuffers.data()));
 
-		// Vertex buffer
-		VkDeviceSize bufferSize = TEXTOVERLAY_MAX_CHAR_COUNT * sizeof(glm::vec4);
+		// Glyph instance buffer
+		glyphBatch.create(vulkanDevice, static_cast<uint32_t>(cmdBuffers.size()), TEXTOVERLAY_MAX_CHAR_COUNT);
 
-		VkBufferCreateInfo bufferInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, bufferSize);
-		VK_CHECK_RESULT(vkCreateBuffer(vulkanDevice->logicalDevice, &bufferInfo, nullptr, &buffer));
+		// Glyph metrics (in pixels of the font bitmap)
+		for (uint32_t i = 0; i < STB_FONT_consolas_24_latin1_NUM_CHARS; i++) {
+			const stb_fontchar& charData = stbFontData[i];
+			vks::Glyph& glyph = glyphBatch.glyphs[i + STB_FONT_consolas_24_latin1_FIRST_CHAR];
+			glyph.rect = glm::vec4((float)charData.x0, (float)charData.y0, (float)charData.x1, (float)charData.y1);
+			glyph.uv = glm::vec4(charData.s0, charData.t0, charData.s1, charData.t1);
+			glyph.advance = charData.advance;
+		}
 
 		VkMemoryRequirements memReqs;
 		VkMemoryAllocateInfo allocInfo = vks::initializers::memoryAllocateInfo();
 
-		vkGetBufferMemoryRequirements(vulkanDevice->logicalDevice, buffer, &memReqs);
-		allocInfo.allocationSize = memReqs.size;
-		allocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-		VK_CHECK_RESULT(vkAllocateMemory(vulkanDevice->logicalDevice, &allocInfo, nullptr, &memory));
-		VK_CHECK_RESULT(vkBindBufferMemory(vulkanDevice->logicalDevice, buffer, memory, 0));
-
 		// Font texture
 		VkImageCreateInfo imageInfo = vks::initializers::imageCreateInfo();
 		imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -368,23 +366,9 @@ public:
 		std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
 		VkPipelineDynamicStateCreateInfo dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables);
 
-		std::array<VkVertexInputBindingDescription, 2> vertexInputBindings = {
-			vks::initializers::vertexInputBindingDescription(0, sizeof(glm::vec4), VK_VERTEX_INPUT_RATE_VERTEX),
-			vks::initializers::vertexInputBindingDescription(1, sizeof(glm::vec4), VK_VERTEX_INPUT_RATE_VERTEX),
-		};
-		std::array<VkVertexInputAttributeDescription, 2> vertexInputAttributes = {
-			vks::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32_SFLOAT, 0),					// Location 0: Position
-			vks::initializers::vertexInputAttributeDescription(1, 1, VK_FORMAT_R32G32_SFLOAT, sizeof(glm::vec2)),	// Location 1: UV
-		};
-
-		VkPipelineVertexInputStateCreateInfo vertexInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
-		vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
-		vertexInputState.pVertexBindingDescriptions = vertexInputBindings.data();
-		vertexInputState.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexInputAttributes.size());
-		vertexInputState.pVertexAttributeDescriptions = vertexInputAttributes.data();
-
+		// One instance per glyph, the vertex shader generates the quad corners from the vertex index (see text.vert)
 		VkGraphicsPipelineCreateInfo pipelineCreateInfo = vks::initializers::pipelineCreateInfo(pipelineLayout, renderPass, 0);
-		pipelineCreateInfo.pVertexInputState = &vertexInputState;
+		pipelineCreateInfo.pVertexInputState = vks::GlyphBatch::getPipelineVertexInputState();
 		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
 		pipelineCreateInfo.pRasterizationState = &rasterizationState;
 		pipelineCreateInfo.pColorBlendState = &colorBlendState;
@@ -478,93 +462,31 @@ public:
 		VK_CHECK_RESULT(vkCreateRenderPass(vulkanDevice->logicalDevice, &renderPassInfo, nullptr, &renderPass));
 	}
 
-	// Map buffer
-	void beginTextUpdate()
+	// Start updating the text displayed with the given command buffer
+	// The application must make sure that this command buffer is no longer executed
+	void beginTextUpdate(uint32_t frame)
 	{
-		VK_CHECK_RESULT(vkMapMemory(vulkanDevice->logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, (void **)&mapped));
-		numLetters = 0;
+		glyphBatch.begin(frame);
 	}
 
-	// Add text to the current buffer
+	// Add text to the current frame, position is in pixels
 	// todo : drop shadow? color attribute?
-	void addText(std::string text, float x, float y, TextAlign align)
+	void addText(const std::string& text, float x, float y, TextAlign align)
 	{
-		const uint32_t firstChar = STB_FONT_consolas_24_latin1_FIRST_CHAR;
-
-		assert(mapped != nullptr);
-
-		const float charW = 1.5f * scale / *frameBufferWidth;
-		const float charH = 1.5f * scale / *frameBufferHeight;
-
-		float fbW = (float)*frameBufferWidth;
-		float fbH = (float)*frameBufferHeight;
-		x = (x / fbW * 2.0f) - 1.0f;
-		y = (y / fbH * 2.0f) - 1.0f;
-
-		// Calculate text width
-		float textWidth = 0;
-		for (auto letter : text)
-		{
-			stb_fontchar *charData = &stbFontData[(uint32_t)letter - firstChar];
-			textWidth += charData->advance * charW;
-		}
-
-		switch (align)
-		{
-			case alignRight:
-				x -= textWidth;
-				break;
-			case alignCenter:
-				x -= textWidth / 2.0f;
-				break;
-			case alignLeft:
-				break;
-		}
-
-		// Generate a uv mapped quad per char in the new text
-		for (auto letter : text)
-		{
-			stb_fontchar *charData = &stbFontData[(uint32_t)letter - firstChar];
-
-			mapped->x = (x + (float)charData->x0 * charW);
-			mapped->y = (y + (float)charData->y0 * charH);
-			mapped->z = charData->s0;
-			mapped->w = charData->t0;
-			mapped++;
-
-			mapped->x = (x + (float)charData->x1 * charW);
-			mapped->y = (y + (float)charData->y0 * charH);
-			mapped->z = charData->s1;
-			mapped->w = charData->t0;
-			mapped++;
-
-			mapped->x = (x + (float)charData->x0 * charW);
-			mapped->y = (y + (float)charData->y1 * charH);
-			mapped->z = charData->s0;
-			mapped->w = charData->t1;
-			mapped++;
-
-			mapped->x = (x + (float)charData->x1 * charW);
-			mapped->y = (y + (float)charData->y1 * charH);
-			mapped->z = charData->s1;
-			mapped->w = charData->t1;
-			mapped++;
-
-			x += charData->advance * charW;
-
-			numLetters++;
-		}
+		const float fbW = (float)*frameBufferWidth;
+		const float fbH = (float)*frameBufferHeight;
+		// Font bitmap pixels to normalized device coordinates
+		const glm::vec2 charScale(1.5f * scale / fbW, 1.5f * scale / fbH);
+		glyphBatch.addText(text, (x / fbW * 2.0f) - 1.0f, (y / fbH * 2.0f) - 1.0f, charScale, static_cast<vks::GlyphBatch::TextAlign>(align));
 	}
 
-	// Unmap buffer and update command buffers
+	// Publish the glyph count of the current frame to it's indirect draw
 	void endTextUpdate()
 	{
-		vkUnmapMemory(vulkanDevice->logicalDevice, memory);
-		mapped = nullptr;
-		updateCommandBuffers();
+		glyphBatch.end();
 	}
 
-	// Needs to be called by the application
+	// Only needs to be called if the framebuffers change, as the glyph count is read from the indirect draw buffer
 	void updateCommandBuffers()
 	{
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
@@ -596,14 +518,7 @@ public:
 			vkCmdBindPipeline(cmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 			vkCmdBindDescriptorSets(cmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
 
-			VkDeviceSize offsets = 0;
-			vkCmdBindVertexBuffers(cmdBuffers[i], 0, 1, &buffer, &offsets);
-			vkCmdBindVertexBuffers(cmdBuffers[i], 1, 1, &buffer, &offsets);
-			for (uint32_t j = 0; j < numLetters; j++)
-			{
-				vkCmdDraw(cmdBuffers[i], 4, 1, j * 4, 0);
-			}
-
+			glyphBatch.draw(cmdBuffers[i], i);
 
 			vkCmdEndRenderPass(cmdBuffers[i]);
 
@@ -636,7 +551,12 @@ public:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSet descriptorSet;
 
-	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
+	// Number of additional labels for stress testing the text overlay (some of them changing every frame)
+	uint32_t labelCount = 0;
+
+	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION, [](CommandLineParser& commandLineParser) {
+		commandLineParser.add("textlabels", { "-tl", "--textlabels" }, 1, "Number of additional text labels to display");
+	})
 	{
 		title = "Vulkan Example - Text overlay";
 		camera.type = Camera::CameraType::lookat;
@@ -644,6 +564,7 @@ public:
 		camera.setRotation(glm::vec3(-25.0f, -0.0f, 0.0f));
 		camera.setPerspective(60.0f, (float)width / (float)height, 0.1f, 256.0f);
 		settings.overlay = false;
+		labelCount = std::max(commandLineParser.getValueAsInt("textlabels", 0), 0);
 	}
 
 	~VulkanExample()
@@ -698,10 +619,10 @@ public:
 		vkQueueWaitIdle(queue);
 	}
 
-	// Update the text buffer displayed by the text overlay
-	void updateTextOverlay(void)
+	// Update the text displayed by the text overlay with the given command buffer
+	void updateTextOverlay(uint32_t frame)
 	{
-		textOverlay->beginTextUpdate();
+		textOverlay->beginTextUpdate(frame);
 
 		textOverlay->addText(title, 5.0f * UIOverlay.scale, 5.0f * UIOverlay.scale, TextOverlay::alignLeft);
 
@@ -730,6 +651,26 @@ public:
 		textOverlay->addText("Press \"space\" to toggle text overlay", 5.0f * UIOverlay.scale, 65.0f * UIOverlay.scale, TextOverlay::alignLeft);
 		textOverlay->addText("Hold middle mouse button and drag to move", 5.0f * UIOverlay.scale, 85.0f * UIOverlay.scale, TextOverlay::alignLeft);
 #endif
+
+		if (labelCount > 0) {
+			// Labels are laid out in a grid below the help text, every 16th label changes each frame and needs a new layout
+			const uint32_t columns = std::max(width / (uint32_t)(120.0f * UIOverlay.scale), 1u);
+			for (uint32_t i = 0; i < labelCount; i++) {
+				ss.str("");
+				ss << std::noshowpos << "label " << i;
+				if (i % 16 == 0) {
+					ss << ": " << frameCounter;
+				}
+				const float x = (5.0f + (float)(i % columns) * 120.0f) * UIOverlay.scale;
+				const float y = (125.0f + (float)(i / columns) * 15.0f) * UIOverlay.scale;
+				textOverlay->addText(ss.str(), x, y, TextOverlay::alignLeft);
+			}
+			const vks::GlyphBatch::Statistics& stats = textOverlay->glyphBatch.statistics;
+			ss.str("");
+			ss << std::noshowpos << stats.glyphs << " glyphs in " << stats.texts << " labels, layout cache " << stats.cacheHits << " hits / " << stats.cacheMisses << " misses";
+			textOverlay->addText(ss.str(), 5.0f * UIOverlay.scale, 105.0f * UIOverlay.scale, TextOverlay::alignLeft);
+		}
+
 		textOverlay->endTextUpdate();
 	}
 
@@ -848,7 +789,6 @@ public:
 			UIOverlay.scale,
 			shaderStages
 			);
-		updateTextOverlay();
 	}
 
 	void draw()
@@ -859,6 +799,8 @@ public:
 			drawCmdBuffers[currentBuffer]
 		};
 		if (textOverlay->visible) {
+			// The text is written to the glyph instances of the current command buffer, which is no longer in use at this point
+			updateTextOverlay(currentBuffer);
 			commandBuffers.push_back(textOverlay->cmdBuffers[currentBuffer]);
 		}
 
@@ -895,11 +837,6 @@ public:
 		{
 			updateUniformBuffers();
 		}
-		if (frameCounter == 0)
-		{
-			vkDeviceWaitIdle(device);
-			updateTextOverlay();
-		}
 	}
 
 	virtual void windowResized()
@@ -912,7 +849,6 @@ public:
 	virtual void viewChanged()
 	{
 		updateUniformBuffers();
-		updateTextOverlay();
 	}
 
 	virtual void keyPressed(uint32_t keyCode)
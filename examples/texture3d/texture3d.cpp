@@ -1,16 +1,34 @@
 /*
 * Vulkan Example - 3D texture loading (and generation using perlin noise) example
 *
+* The noise volume is generated in the background: Slabs of slices are generated by a thread pool (evaluating eight voxels per noise call using SIMD),
+* written to a persistently mapped staging ring and uploaded as they finish. The new volume is swapped in once all slabs have been uploaded
+*
 * Copyright (C) 2016 by Sascha Willems - www.saschawillems.de
 *
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
 #include "vulkanexamplebase.h"
+#include "threadpool.hpp"
+#include <map>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define NOISE_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define NOISE_SIMD_SSE
+#endif
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
 
+// Number of slices generated and uploaded as one slab
+#define NOISE_SLAB_DEPTH 16
+// Largest supported volume dimension, the staging ring is sized for slabs of this size
+#define NOISE_MAX_DIMENSION 256
+
 // Vertex layout for this example
 struct Vertex {
 	float pos[3];
@@ -18,12 +36,71 @@ struct Vertex {
 	float normal[3];
 };
 
+/*
+	Eight float lanes used by the batched noise functions
+	Maps to one AVX register, two SSE registers or plain scalar code depending on the target
+*/
+struct float8
+{
+#if defined(NOISE_SIMD_AVX)
+	__m256 v;
+	float8() {}
+	explicit float8(float s) : v(_mm256_set1_ps(s)) {}
+	static float8 load(const float* p) { float8 r; r.v = _mm256_loadu_ps(p); return r; }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+	// Stores the lanes truncated to integers
+	void storeInt(int32_t* p) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_cvttps_epi32(v)); }
+#elif defined(NOISE_SIMD_SSE)
+	__m128 lo, hi;
+	float8() {}
+	explicit float8(float s) : lo(_mm_set1_ps(s)), hi(_mm_set1_ps(s)) {}
+	static float8 load(const float* p) { float8 r; r.lo = _mm_loadu_ps(p); r.hi = _mm_loadu_ps(p + 4); return r; }
+	void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+	void storeInt(int32_t* p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_cvttps_epi32(lo)); _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 4), _mm_cvttps_epi32(hi)); }
+#else
+	float v[8];
+	float8() {}
+	explicit float8(float s) { for (uint32_t i = 0; i < 8; i++) v[i] = s; }
+	static float8 load(const float* p) { float8 r; for (uint32_t i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+	void store(float* p) const { for (uint32_t i = 0; i < 8; i++) p[i] = v[i]; }
+	void storeInt(int32_t* p) const { for (uint32_t i = 0; i < 8; i++) p[i] = static_cast<int32_t>(v[i]); }
+#endif
+};
+
+#if defined(NOISE_SIMD_AVX)
+#define FLOAT8_OPERATOR(op, intrinsic) inline float8 operator op(const float8& a, const float8& b) { float8 r; r.v = intrinsic(a.v, b.v); return r; }
+FLOAT8_OPERATOR(+, _mm256_add_ps)
+FLOAT8_OPERATOR(-, _mm256_sub_ps)
+FLOAT8_OPERATOR(*, _mm256_mul_ps)
+inline float8 floor(const float8& a) { float8 r; r.v = _mm256_floor_ps(a.v); return r; }
+#elif defined(NOISE_SIMD_SSE)
+#define FLOAT8_OPERATOR(op, intrinsic) inline float8 operator op(const float8& a, const float8& b) { float8 r; r.lo = intrinsic(a.lo, b.lo); r.hi = intrinsic(a.hi, b.hi); return r; }
+FLOAT8_OPERATOR(+, _mm_add_ps)
+FLOAT8_OPERATOR(-, _mm_sub_ps)
+FLOAT8_OPERATOR(*, _mm_mul_ps)
+// SSE2 has no floor instruction, so truncate and correct negative values
+inline __m128 floor(const __m128 a)
+{
+	const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+inline float8 floor(const float8& a) { float8 r; r.lo = floor(a.lo); r.hi = floor(a.hi); return r; }
+#else
+#define FLOAT8_OPERATOR(op, intrinsic) inline float8 operator op(const float8& a, const float8& b) { float8 r; for (uint32_t i = 0; i < 8; i++) r.v[i] = a.v[i] op b.v[i]; return r; }
+FLOAT8_OPERATOR(+, )
+FLOAT8_OPERATOR(-, )
+FLOAT8_OPERATOR(*, )
+inline float8 floor(const float8& a) { float8 r; for (uint32_t i = 0; i < 8; i++) r.v[i] = std::floor(a.v[i]); return r; }
+#endif
+
 // Translation of Ken Perlin's JAVA implementation (http://mrl.nyu.edu/~perlin/noise/)
 template <typename T>
 class PerlinNoise
 {
 private:
 	uint32_t permutations[512];
+	// Gradient (x, y, z) selected by the hash at each permutation index, used by the batched noise function
+	float gradients[3][512];
 	T fade(T t)
 	{
 		return t * t * t * (t * (t * (T)6 - (T)15) + (T)10);
@@ -40,6 +117,14 @@ private:
 		T v = h < 4 ? y : h == 12 || h == 14 ? x : z;
 		return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
 	}
+	float8 fade(const float8& t) const
+	{
+		return t * t * t * (t * (t * float8(6.0f) - float8(15.0f)) + float8(10.0f));
+	}
+	float8 lerp(const float8& t, const float8& a, const float8& b) const
+	{
+		return a + t * (b - a);
+	}
 public:
 	PerlinNoise()
 	{
@@ -54,6 +139,14 @@ public:
 		{
 			permutations[i] = permutations[256 + i] = plookup[i];
 		}
+
+		// The gradient function is linear in x, y and z, so it can be tabulated per component
+		for (uint32_t i = 0; i < 512; i++)
+		{
+			gradients[0][i] = (float)grad(permutations[i], (T)1, (T)0, (T)0);
+			gradients[1][i] = (float)grad(permutations[i], (T)0, (T)1, (T)0);
+			gradients[2][i] = (float)grad(permutations[i], (T)0, (T)0, (T)1);
+		}
 	}
 	T noise(T x, T y, T z)
 	{
@@ -85,6 +178,58 @@ public:
 			lerp(v, lerp(u, grad(permutations[AA + 1], x, y, z - 1), grad(permutations[BA + 1], x - 1, y, z - 1)), lerp(u, grad(permutations[AB + 1], x, y - 1, z - 1), grad(permutations[BB + 1], x - 1, y - 1, z - 1))));
 		return res;
 	}
+	// Evaluates the noise for eight points at once, the hashing is done per lane, everything else in SIMD
+	float8 noise(float8 x, float8 y, float8 z) const
+	{
+		const float8 fx = floor(x);
+		const float8 fy = floor(y);
+		const float8 fz = floor(z);
+		x = x - fx;
+		y = y - fy;
+		z = z - fz;
+
+		int32_t X[8], Y[8], Z[8];
+		fx.storeInt(X);
+		fy.storeInt(Y);
+		fz.storeInt(Z);
+
+		// Gather the gradients of the 8 cube corners for each lane
+		float g[3][8][8];
+		for (uint32_t lane = 0; lane < 8; lane++)
+		{
+			const uint32_t A = permutations[X[lane] & 255] + (Y[lane] & 255);
+			const uint32_t B = permutations[(X[lane] & 255) + 1] + (Y[lane] & 255);
+			const uint32_t corners[4] = {
+				permutations[A] + (Z[lane] & 255),
+				permutations[B] + (Z[lane] & 255),
+				permutations[A + 1] + (Z[lane] & 255),
+				permutations[B + 1] + (Z[lane] & 255)
+			};
+			for (uint32_t c = 0; c < 4; c++)
+			{
+				for (uint32_t i = 0; i < 3; i++)
+				{
+					g[i][c][lane] = gradients[i][corners[c]];
+					g[i][c + 4][lane] = gradients[i][corners[c] + 1];
+				}
+			}
+		}
+
+		float8 dots[8];
+		const float8 one(1.0f);
+		for (uint32_t c = 0; c < 8; c++)
+		{
+			const float8 cx = (c & 1) ? x - one : x;
+			const float8 cy = (c & 2) ? y - one : y;
+			const float8 cz = (c & 4) ? z - one : z;
+			dots[c] = float8::load(g[0][c]) * cx + float8::load(g[1][c]) * cy + float8::load(g[2][c]) * cz;
+		}
+
+		const float8 u = fade(x);
+		const float8 v = fade(y);
+		const float8 w = fade(z);
+		return lerp(w, lerp(v, lerp(u, dots[0], dots[1]), lerp(u, dots[2], dots[3])), lerp(v, lerp(u, dots[4], dots[5]), lerp(u, dots[6], dots[7])));
+	}
 };
 
 // Fractal noise generator based on perlin noise above
@@ -123,6 +268,25 @@ public:
 		sum = sum / max;
 		return (sum + (T)1.0) / (T)2.0;
 	}
+
+	// Batched version of the above for eight points
+	float8 noise(const float8& x, const float8& y, const float8& z) const
+	{
+		float8 sum(0.0f);
+		float frequency = 1.0f;
+		float amplitude = 1.0f;
+		float max = 0.0f;
+		for (uint32_t i = 0; i < octaves; i++)
+		{
+			const float8 f(frequency);
+			sum = sum + perlinNoise.noise(x * f, y * f, z * f) * float8(amplitude);
+			max += amplitude;
+			amplitude *= (float)persistence;
+			frequency *= 2.0f;
+		}
+
+		return (sum * float8(1.0f / max) + float8(1.0f)) * float8(0.5f);
+	}
 };
 
 class VulkanExample : public VulkanExampleBase
@@ -139,7 +303,10 @@ public:
 		VkFormat format;
 		uint32_t width, height, depth;
 		uint32_t mipLevels;
-	} texture;
+	};
+	// One texture is displayed while the other one receives a newly generated volume
+	std::array<Texture, 2> textures;
+	uint32_t currentTexture = 1;
 
 	struct {
 		VkPipelineVertexInputStateCreateInfo inputState;
@@ -165,9 +332,61 @@ public:
 	} pipelines;
 
 	VkPipelineLayout pipelineLayout;
-	VkDescriptorSet descriptorSet;
+	// One descriptor set per texture
+	std::array<VkDescriptorSet, 2> descriptorSets;
 	VkDescriptorSetLayout descriptorSetLayout;
 
+	vks::ThreadPool threadPool;
+
+	// Persistently mapped staging buffer split into slots, each slot receives one generated slab
+	struct {
+		vks::Buffer buffer;
+		VkDeviceSize slotSize = 0;
+		std::vector<uint32_t> freeSlots;
+	} stagingRing;
+
+	struct Slab {
+		uint32_t slot;
+		uint32_t z;
+		uint32_t depth;
+	};
+
+	// State of the background noise generation
+	struct {
+		bool active = false;
+		bool simd = true;
+		// Requested volume size, applied when the next generation is started
+		uint32_t size = 128;
+		int32_t sizeIndex = 1;
+		uint32_t slabCount = 0;
+		uint32_t nextSlab = 0;
+		uint32_t uploadedSlabs = 0;
+		std::shared_ptr<FractalNoise<float>> noise;
+		float noiseScale = 1.0f;
+		std::chrono::high_resolution_clock::time_point tStart;
+		// Slabs finished by the worker threads
+		std::mutex mutex;
+		std::vector<Slab> readySlabs;
+		uint32_t generatedSlabs = 0;
+		double generationTime = 0.0;
+		// Slabs copied by the upload command buffer currently in flight
+		std::vector<Slab> uploadingSlabs;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+	} generation;
+
+	const std::vector<uint32_t> volumeSizes = { 64, 128, 256 };
+
+	// Times of the last generation per volume size (in ms)
+	struct GenerationTimes {
+		// Until all slabs were generated
+		double generation;
+		// Until the new volume was swapped in
+		double total;
+		bool simd;
+	};
+	std::map<uint32_t, GenerationTimes> generationTimes;
+
 	VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	{
 		title = "3D textures";
@@ -176,14 +395,25 @@ public:
 		camera.setRotation(glm::vec3(0.0f, 15.0f, 0.0f));
 		camera.setPerspective(60.0f, (float)width / (float)height, 0.1f, 256.0f);
 		srand((unsigned int)time(NULL));
+		threadPool.setThreadCount(std::max(std::thread::hardware_concurrency(), 1u));
 	}
 
 	~VulkanExample()
 	{
+		// Slabs still being generated write to the staging ring
+		threadPool.wait();
+
 		// Clean up used Vulkan resources
 		// Note : Inherited destructor cleans up resources stored in base class
 
-		destroyTextureImage(texture);
+		for (auto& texture : textures) {
+			destroyTextureImage(texture);
+		}
+		stagingRing.buffer.destroy();
+		if (generation.fence != VK_NULL_HANDLE) {
+			vkDestroyFence(device, generation.fence, nullptr);
+			vkFreeCommandBuffers(device, cmdPool, 1, &generation.commandBuffer);
+		}
 
 		vkDestroyPipeline(device, pipelines.solid, nullptr);
 
@@ -197,7 +427,7 @@ public:
 
 	// Prepare all Vulkan resources for the 3D texture (including descriptors)
 	// Does not fill the texture with data
-	void prepareNoiseTexture(uint32_t width, uint32_t height, uint32_t depth)
+	void prepareNoiseTexture(Texture &texture, uint32_t width, uint32_t height, uint32_t depth)
 	{
 		// A 3D texture is described as width x height x depth
 		texture.width = width;
@@ -283,83 +513,187 @@ public:
 		texture.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 		texture.descriptor.imageView = texture.view;
 		texture.descriptor.sampler = texture.sampler;
-
-		updateNoiseTexture();
 	}
 
-	// Generate randomized noise and upload it to the 3D texture using staging
-	void updateNoiseTexture()
+	// The staging ring is sized for the largest supported volume, with two slabs in flight per worker thread
+	void prepareStagingRing()
 	{
-		const uint32_t texMemSize = texture.width * texture.height * texture.depth;
-
-		uint8_t *data = new uint8_t[texMemSize];
-		memset(data, 0, texMemSize);
-
-		// Generate perlin based noise
-		std::cout << "Generating " << texture.width << " x " << texture.height << " x " << texture.depth << " noise texture..." << std::endl;
-
-		auto tStart = std::chrono::high_resolution_clock::now();
-
-		PerlinNoise<float> perlinNoise;
-		FractalNoise<float> fractalNoise(perlinNoise);
-
-		const float noiseScale = static_cast<float>(rand() % 10) + 4.0f;
+		const uint32_t slotCount = static_cast<uint32_t>(threadPool.threads.size()) * 2;
+		stagingRing.slotSize = NOISE_MAX_DIMENSION * NOISE_MAX_DIMENSION * NOISE_SLAB_DEPTH;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&stagingRing.buffer,
+			stagingRing.slotSize * slotCount));
+		VK_CHECK_RESULT(stagingRing.buffer.map());
+		stagingRing.freeSlots.resize(slotCount);
+		std::iota(stagingRing.freeSlots.begin(), stagingRing.freeSlots.end(), 0);
+
+		generation.commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, cmdPool, false);
+		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo();
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &generation.fence));
+	}
 
-#pragma omp parallel for
-		for (int32_t z = 0; z < texture.depth; z++)
+	// Generates the noise for a slab of slices into the given (mapped) staging memory, called from the worker threads
+	void generateSlab(FractalNoise<float> &fractalNoise, float noiseScale, uint32_t width, uint32_t height, uint32_t depth, const Slab &slab, bool simd, uint8_t *data)
+	{
+		VKS_PROFILE_ZONE("generate noise slab");
+		for (uint32_t z = slab.z; z < slab.z + slab.depth; z++)
 		{
-			for (int32_t y = 0; y < texture.height; y++)
+			const float nz = (float)z / (float)depth;
+			for (uint32_t y = 0; y < height; y++)
 			{
-				for (int32_t x = 0; x < texture.width; x++)
+				const float ny = (float)y / (float)height;
+				uint8_t *row = data + (z - slab.z) * width * height + y * width;
+				if (simd)
 				{
-					float nx = (float)x / (float)texture.width;
-					float ny = (float)y / (float)texture.height;
-					float nz = (float)z / (float)texture.depth;
-#define FRACTAL
-#ifdef FRACTAL
-					float n = fractalNoise.noise(nx * noiseScale, ny * noiseScale, nz * noiseScale);
-#else
-					float n = 20.0 * perlinNoise.noise(nx, ny, nz);
-#endif
-					n = n - floor(n);
-
-					data[x + y * texture.width + z * texture.width * texture.height] = static_cast<uint8_t>(floor(n * 255));
+					const float8 sy(ny * noiseScale);
+					const float8 sz(nz * noiseScale);
+					for (uint32_t x = 0; x < width; x += 8)
+					{
+						float sx[8];
+						for (uint32_t lane = 0; lane < 8; lane++)
+						{
+							sx[lane] = ((float)(x + lane) / (float)width) * noiseScale;
+						}
+						float8 n = fractalNoise.noise(float8::load(sx), sy, sz);
+						n = n - floor(n);
+						int32_t values[8];
+						floor(n * float8(255.0f)).storeInt(values);
+						for (uint32_t lane = 0; lane < std::min(8u, width - x); lane++)
+						{
+							row[x + lane] = static_cast<uint8_t>(values[lane]);
+						}
+					}
+				}
+				else
+				{
+					for (uint32_t x = 0; x < width; x++)
+					{
+						float nx = (float)x / (float)width;
+						float n = fractalNoise.noise(nx * noiseScale, ny * noiseScale, nz * noiseScale);
+						n = n - floor(n);
+						row[x] = static_cast<uint8_t>(floor(n * 255));
+					}
 				}
 			}
 		}
+	}
+
+	// Hands out slabs to the worker threads as long as there are free slots in the staging ring
+	void dispatchSlabs()
+	{
+		const Texture &texture = textures[1 - currentTexture];
+		while ((generation.nextSlab < generation.slabCount) && !stagingRing.freeSlots.empty())
+		{
+			Slab slab;
+			slab.slot = stagingRing.freeSlots.back();
+			slab.z = generation.nextSlab * NOISE_SLAB_DEPTH;
+			slab.depth = std::min((uint32_t)NOISE_SLAB_DEPTH, texture.depth - slab.z);
+			stagingRing.freeSlots.pop_back();
+
+			uint8_t *data = static_cast<uint8_t*>(stagingRing.buffer.mapped) + slab.slot * stagingRing.slotSize;
+			std::shared_ptr<FractalNoise<float>> fractalNoise = generation.noise;
+			const float noiseScale = generation.noiseScale;
+			const bool simd = generation.simd;
+			const uint32_t width = texture.width, height = texture.height, depth = texture.depth;
+			threadPool.threads[generation.nextSlab % threadPool.threads.size()]->addJob([=] {
+				generateSlab(*fractalNoise, noiseScale, width, height, depth, slab, simd, data);
+				std::lock_guard<std::mutex> lock(generation.mutex);
+				generation.readySlabs.push_back(slab);
+				if (++generation.generatedSlabs == generation.slabCount) {
+					generation.generationTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - generation.tStart).count();
+				}
+			});
+			generation.nextSlab++;
+		}
+	}
 
-		auto tEnd = std::chrono::high_resolution_clock::now();
-		auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+	// Starts generating a new randomized noise volume in the background, it replaces the current one once all slabs have been uploaded
+	void startNoiseGeneration()
+	{
+		if (generation.active)
+		{
+			return;
+		}
 
-		std::cout << "Done in " << tDiff << "ms" << std::endl;
+		// The texture not currently displayed receives the new volume
+		const uint32_t target = 1 - currentTexture;
+		Texture &texture = textures[target];
+		const uint32_t size = std::min(generation.size, (uint32_t)NOISE_MAX_DIMENSION);
+		if ((texture.image == VK_NULL_HANDLE) || (texture.width != size))
+		{
+			destroyTextureImage(texture);
+			texture = Texture();
+			prepareNoiseTexture(texture, size, size, size);
+			if (descriptorSets[target] != VK_NULL_HANDLE)
+			{
+				updateDescriptorSet(target);
+			}
+		}
 
-		// Create a host-visible staging buffer that contains the raw image data
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
+		// Generate perlin based noise
+		std::cout << "Generating " << texture.width << " x " << texture.height << " x " << texture.depth << " noise texture..." << std::endl;
 
-		// Buffer object
-		VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo();
-		bufferCreateInfo.size = texMemSize;
-		bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &stagingBuffer));
+		generation.noise = std::make_shared<FractalNoise<float>>(PerlinNoise<float>());
+		generation.noiseScale = static_cast<float>(rand() % 10) + 4.0f;
+		generation.slabCount = (texture.depth + NOISE_SLAB_DEPTH - 1) / NOISE_SLAB_DEPTH;
+		generation.nextSlab = 0;
+		generation.uploadedSlabs = 0;
+		generation.generatedSlabs = 0;
+		generation.readySlabs.clear();
+		generation.tStart = std::chrono::high_resolution_clock::now();
+		generation.active = true;
+		dispatchSlabs();
+	}
 
-		// Allocate host visible memory for data upload
-		VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
-		VkMemoryRequirements memReqs = {};
-		vkGetBufferMemoryRequirements(device, stagingBuffer, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &stagingMemory));
-		VK_CHECK_RESULT(vkBindBufferMemory(device, stagingBuffer, stagingMemory, 0));
+	// Uploads slabs finished by the worker threads, called once per frame (or until done if wait is set)
+	void updateNoiseGeneration(bool wait = false)
+	{
+		if (!generation.active)
+		{
+			return;
+		}
 
-		// Copy texture data into staging buffer
-		uint8_t *mapped;
-		VK_CHECK_RESULT(vkMapMemory(device, stagingMemory, 0, memReqs.size, 0, (void **)&mapped));
-		memcpy(mapped, data, texMemSize);
-		vkUnmapMemory(device, stagingMemory);
+		// Staging slots of completed uploads can be reused
+		if (!generation.uploadingSlabs.empty())
+		{
+			if (wait)
+			{
+				VK_CHECK_RESULT(vkWaitForFences(device, 1, &generation.fence, VK_TRUE, UINT64_MAX));
+			}
+			if (vkGetFenceStatus(device, generation.fence) != VK_SUCCESS)
+			{
+				return;
+			}
+			VK_CHECK_RESULT(vkResetFences(device, 1, &generation.fence));
+			for (auto &slab : generation.uploadingSlabs)
+			{
+				stagingRing.freeSlots.push_back(slab.slot);
+			}
+			generation.uploadedSlabs += static_cast<uint32_t>(generation.uploadingSlabs.size());
+			generation.uploadingSlabs.clear();
+			if (generation.uploadedSlabs == generation.slabCount)
+			{
+				finishNoiseGeneration();
+				return;
+			}
+			dispatchSlabs();
+		}
 
-		VkCommandBuffer copyCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		std::vector<Slab> slabs;
+		{
+			std::lock_guard<std::mutex> lock(generation.mutex);
+			slabs.swap(generation.readySlabs);
+		}
+		if (slabs.empty())
+		{
+			return;
+		}
+
+		const Texture &texture = textures[1 - currentTexture];
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(generation.commandBuffer, &cmdBufInfo));
 
 		// The sub resource range describes the regions of the image we will be transitioned
 		VkImageSubresourceRange subresourceRange = {};
@@ -368,52 +702,83 @@ public:
 		subresourceRange.levelCount = 1;
 		subresourceRange.layerCount = 1;
 
-		// Optimal image will be used as destination for the copy, so we must transfer from our
-		// initial undefined image layout to the transfer destination layout
-		vks::tools::setImageLayout(
-			copyCmd,
+		// The previous contents of the image are discarded with the first slab
+		if (generation.uploadedSlabs == 0)
+		{
+			vks::tools::setImageLayout(
+				generation.commandBuffer,
+				texture.image,
+				VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				subresourceRange);
+		}
+
+		// Copy the slabs from their staging slots to the slices of the 3D texture
+		std::vector<VkBufferImageCopy> bufferCopyRegions;
+		for (auto &slab : slabs)
+		{
+			VkBufferImageCopy bufferCopyRegion{};
+			bufferCopyRegion.bufferOffset = slab.slot * stagingRing.slotSize;
+			bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			bufferCopyRegion.imageSubresource.mipLevel = 0;
+			bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
+			bufferCopyRegion.imageSubresource.layerCount = 1;
+			bufferCopyRegion.imageOffset.z = slab.z;
+			bufferCopyRegion.imageExtent.width = texture.width;
+			bufferCopyRegion.imageExtent.height = texture.height;
+			bufferCopyRegion.imageExtent.depth = slab.depth;
+			bufferCopyRegions.push_back(bufferCopyRegion);
+		}
+		vkCmdCopyBufferToImage(
+			generation.commandBuffer,
+			stagingRing.buffer.buffer,
 			texture.image,
-			VK_IMAGE_LAYOUT_UNDEFINED,
 			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			subresourceRange);
+			static_cast<uint32_t>(bufferCopyRegions.size()),
+			bufferCopyRegions.data());
 
-		// Copy 3D noise data to texture
+		// Change texture image layout to shader read after the last slab has been copied
+		if (generation.uploadedSlabs + slabs.size() == generation.slabCount)
+		{
+			vks::tools::setImageLayout(
+				generation.commandBuffer,
+				texture.image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				subresourceRange);
+		}
 
-		// Setup buffer copy regions
-		VkBufferImageCopy bufferCopyRegion{};
-		bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		bufferCopyRegion.imageSubresource.mipLevel = 0;
-		bufferCopyRegion.imageSubresource.baseArrayLayer = 0;
-		bufferCopyRegion.imageSubresource.layerCount = 1;
-		bufferCopyRegion.imageExtent.width = texture.width;
-		bufferCopyRegion.imageExtent.height = texture.height;
-		bufferCopyRegion.imageExtent.depth = texture.depth;
+		VK_CHECK_RESULT(vkEndCommandBuffer(generation.commandBuffer));
 
-		vkCmdCopyBufferToImage(
-			copyCmd,
-			stagingBuffer,
-			texture.image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&bufferCopyRegion);
+		// The upload does not touch the displayed texture, so it needs no synchronization with rendering
+		VkSubmitInfo uploadSubmitInfo = vks::initializers::submitInfo();
+		uploadSubmitInfo.commandBufferCount = 1;
+		uploadSubmitInfo.pCommandBuffers = &generation.commandBuffer;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &uploadSubmitInfo, generation.fence));
+		generation.uploadingSlabs = slabs;
+	}
 
-		// Change texture image layout to shader read after all mip levels have been copied
+	// Swaps in the completely uploaded volume
+	void finishNoiseGeneration()
+	{
+		currentTexture = 1 - currentTexture;
+		Texture &texture = textures[currentTexture];
 		texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		vks::tools::setImageLayout(
-			copyCmd,
-			texture.image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			texture.imageLayout,
-			subresourceRange);
+		generation.active = false;
 
-		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+		GenerationTimes times;
+		times.generation = generation.generationTime;
+		times.total = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - generation.tStart).count();
+		times.simd = generation.simd;
+		generationTimes[texture.width] = times;
+		std::cout << "Done in " << times.generation << "ms (" << (times.simd ? "SIMD" : "scalar") << "), visible after " << times.total << "ms" << std::endl;
 
-		// Clean up staging resources
-		delete[] data;
-		vkFreeMemory(device, stagingMemory, nullptr);
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
+		// Command buffers need to bind the descriptor set of the new texture
+		if (prepared)
+		{
+			buildCommandBuffers();
+		}
 	}
-
 	// Free all Vulkan resources used a texture object
 	void destroyTextureImage(Texture texture)
 	{
@@ -459,7 +824,7 @@ public:
 			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
 			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
 
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, NULL);
+			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentTexture], 0, NULL);
 			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.solid);
 
 			VkDeviceSize offsets[1] = { 0 };
@@ -569,8 +934,8 @@ public:
 		// Example uses one ubo and one image sampler
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1),
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1)
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2)
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
@@ -613,7 +978,7 @@ public:
 		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
 	}
 
-	void setupDescriptorSet()
+	void setupDescriptorSets()
 	{
 		VkDescriptorSetAllocateInfo allocInfo =
 			vks::initializers::descriptorSetAllocateInfo(
@@ -621,22 +986,32 @@ public:
 				&descriptorSetLayout,
 				1);
 
-		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet));
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &descriptorSets[i]));
+			if (textures[i].image != VK_NULL_HANDLE)
+			{
+				updateDescriptorSet(i);
+			}
+		}
+	}
 
+	void updateDescriptorSet(uint32_t index)
+	{
 		std::vector<VkWriteDescriptorSet> writeDescriptorSets =
 		{
 			// Binding 0 : Vertex shader uniform buffer
 			vks::initializers::writeDescriptorSet(
-				descriptorSet,
+				descriptorSets[index],
 				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 				0,
 				&uniformBufferVS.descriptor),
 			// Binding 1 : Fragment shader texture sampler
 			vks::initializers::writeDescriptorSet(
-				descriptorSet,
+				descriptorSets[index],
 				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 				1,
-				&texture.descriptor)
+				&textures[index].descriptor)
 		};
 
 		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
@@ -754,11 +1129,18 @@ public:
 		generateQuad();
 		setupVertexDescriptions();
 		prepareUniformBuffers();
-		prepareNoiseTexture(128, 128, 128);
+		prepareStagingRing();
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
-		setupDescriptorSet();
+		setupDescriptorSets();
+		// The first volume is waited for
+		startNoiseGeneration();
+		while (generation.active)
+		{
+			updateNoiseGeneration(true);
+			std::this_thread::yield();
+		}
 		buildCommandBuffers();
 		prepared = true;
 	}
@@ -767,6 +1149,7 @@ public:
 	{
 		if (!prepared)
 			return;
+		updateNoiseGeneration();
 		draw();
 		if (!paused || camera.updated)
 			updateUniformBuffers(camera.updated);
@@ -780,8 +1163,23 @@ public:
 	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
 	{
 		if (overlay->header("Settings")) {
-			if (overlay->button("Generate new texture")) {
-				updateNoiseTexture();
+			std::vector<std::string> sizeNames;
+			for (uint32_t size : volumeSizes) {
+				sizeNames.push_back(std::to_string(size) + "^3");
+			}
+			if (overlay->comboBox("Volume size", &generation.sizeIndex, sizeNames)) {
+				generation.size = volumeSizes[generation.sizeIndex];
+			}
+			overlay->checkBox("SIMD noise", &generation.simd);
+			if (generation.active) {
+				overlay->text("Generating: %d / %d slabs uploaded", generation.uploadedSlabs, generation.slabCount);
+			} else if (overlay->button("Generate new texture")) {
+				startNoiseGeneration();
+			}
+		}
+		if (overlay->header("Generation times")) {
+			for (auto& times : generationTimes) {
+				overlay->text("%d^3 (%s): %.1f ms, visible after %.1f ms", times.first, times.second.simd ? "SIMD" : "scalar", times.second.generation, times.second.total);
 			}
 		}
 	}
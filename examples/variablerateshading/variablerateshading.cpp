@@ -20,6 +20,8 @@ VulkanExample::VulkanExample() : VulkanExampleBase(ENABLE_VALIDATION)
 	camera.setRotationSpeed(0.25f);
 	enabledInstanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 	enabledDeviceExtensions.push_back(VK_NV_SHADING_RATE_IMAGE_EXTENSION_NAME);
+	enabledDeviceExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+	enabledDeviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
 }
 
 VulkanExample::~VulkanExample()
@@ -43,6 +45,26 @@ void VulkanExample::getEnabledFeatures()
 	enabledPhysicalDeviceShadingRateImageFeaturesNV = {};
 	enabledPhysicalDeviceShadingRateImageFeaturesNV.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADING_RATE_IMAGE_FEATURES_NV;
 	enabledPhysicalDeviceShadingRateImageFeaturesNV.shadingRateImage = VK_TRUE;
+	// The scene uses bindless materials, which requires descriptor indexing
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+	descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	VkPhysicalDeviceFeatures2 deviceFeatures2{};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &descriptorIndexingFeatures;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures2);
+	if (!deviceFeatures.shaderSampledImageArrayDynamicIndexing || !descriptorIndexingFeatures.runtimeDescriptorArray || !descriptorIndexingFeatures.descriptorBindingVariableDescriptorCount
+		|| !descriptorIndexingFeatures.descriptorBindingPartiallyBound || !descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind) {
+		vks::tools::exitFatal("Selected GPU does not support the descriptor indexing features required for bindless materials!", VK_ERROR_FEATURE_NOT_PRESENT);
+	}
+	// Material textures are selected with a dynamic index into the texture array
+	enabledFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+	enabledDescriptorIndexingFeatures = {};
+	enabledDescriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	enabledDescriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	enabledDescriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	enabledPhysicalDeviceShadingRateImageFeaturesNV.pNext = &enabledDescriptorIndexingFeatures;
 	deviceCreatepNextChain = &enabledPhysicalDeviceShadingRateImageFeaturesNV;
 }
 
@@ -115,7 +137,8 @@ void VulkanExample::buildCommandBuffers()
 
 void VulkanExample::loadAssets()
 {
-	vkglTF::descriptorBindingFlags = vkglTF::DescriptorBindingFlags::ImageBaseColor | vkglTF::DescriptorBindingFlags::ImageNormalMap;
+	// All materials and textures of the scene are put into a single descriptor set, the whole scene is drawn with one descriptor set bind
+	vkglTF::descriptorBindingFlags = vkglTF::DescriptorBindingFlags::BindlessMaterials;
 	scene.loadFromFile(getAssetPath() + "models/sponza/sponza.gltf", vulkanDevice, queue, vkglTF::FileLoadingFlags::PreTransformVertices);
 }
 
@@ -138,9 +161,13 @@ void VulkanExample::setupDescriptors()
 	// Pipeline layout
 	const std::vector<VkDescriptorSetLayout> setLayouts = {
 		descriptorSetLayout,
-		vkglTF::descriptorSetLayoutImage,
+		vkglTF::descriptorSetLayoutMaterials,
 	};
 	VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(setLayouts.data(), 2);
+	// The glTF model passes the index of the current material via push constant
+	VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(scene.bindlessMaterials.pushConstantStages, sizeof(uint32_t), scene.bindlessMaterials.pushConstantOffset);
+	pPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pPipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 	VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pPipelineLayoutCreateInfo, nullptr, &pipelineLayout));
 
 	// Descriptor set
@@ -324,16 +351,13 @@ void VulkanExample::preparePipelines()
 	shaderStages[0] = loadShader(getShadersPath() + "variablerateshading/scene.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
 	shaderStages[1] = loadShader(getShadersPath() + "variablerateshading/scene.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 
-	// Properties for alpha masked materials will be passed via specialization constants
+	// Alpha masking is enabled via specialization constant, the cutoff is read from the material buffer
 	struct SpecializationData {
 		VkBool32 alphaMask;
-		float alphaMaskCutoff;
 	} specializationData;
 	specializationData.alphaMask = false;
-	specializationData.alphaMaskCutoff = 0.5f;
 	const std::vector<VkSpecializationMapEntry> specializationMapEntries = {
 		vks::initializers::specializationMapEntry(0, offsetof(SpecializationData, alphaMask), sizeof(SpecializationData::alphaMask)),
-		vks::initializers::specializationMapEntry(1, offsetof(SpecializationData, alphaMaskCutoff), sizeof(SpecializationData::alphaMaskCutoff)),
 	};
 	VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(specializationMapEntries, sizeof(specializationData), &specializationData);
 	shaderStages[1].pSpecializationInfo = &specializationInfo;
@@ -51,6 +51,7 @@ public:
 
 	VkPhysicalDeviceShadingRateImagePropertiesNV physicalDeviceShadingRateImagePropertiesNV{};
 	VkPhysicalDeviceShadingRateImageFeaturesNV enabledPhysicalDeviceShadingRateImageFeaturesNV{};
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledDescriptorIndexingFeatures{};
 	PFN_vkCmdBindShadingRateImageNV vkCmdBindShadingRateImageNV;
 
 	VulkanExample();